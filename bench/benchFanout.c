@@ -0,0 +1,309 @@
+/*
+ * benchFanout.c
+ *
+ * This module contains the benchmarks of the AREQ fan out of the mux
+ * daemon to its local clients: one writer hands each frame to N reader
+ * threads, either as the daemon does on the client sockets, one write
+ * per reader, or through the shared memory ring, one write for all.
+ * An operation is one frame read by every reader.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "znpBench.h"
+#include "rpc.h"
+#include "rpcShm.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define FANOUT_MAX_READERS       (4)
+
+// payload of the frames, about an AF_INCOMING_MSG
+#define FANOUT_PAYLOAD_LEN       (40)
+
+#define FANOUT_FRAME_LEN         (FANOUT_PAYLOAD_LEN + 5)
+
+#define FANOUT_SHM_SIZE          (256 * 1024)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	int Fd;                    // socket reader
+	rpcShm_t Ring;             // ring reader
+	uint64_t Count;
+	uint64_t Frames;
+	uint32_t Sum;              // keeps the frame reads
+	pthread_barrier_t *Start;
+} fanoutReader_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static uint8_t fanoutFrame[FANOUT_FRAME_LEN];
+
+// set once the ring writer wrote all the frames
+static volatile uint8_t fanoutDone;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      buildFrame
+ *
+ * @brief   AREQ as the daemon writes it to a client, from SOF to FCS
+ */
+static void buildFrame(void)
+{
+	uint8_t fcs = 0;
+	uint32_t i;
+
+	fanoutFrame[0] = MT_RPC_SOF;
+	fanoutFrame[1] = FANOUT_PAYLOAD_LEN;
+	fanoutFrame[2] = MT_RPC_CMD_AREQ | MT_RPC_SYS_AF;
+	fanoutFrame[3] = 0x81;
+	for (i = 0; i < FANOUT_PAYLOAD_LEN; i++)
+	{
+		fanoutFrame[4 + i] = i;
+	}
+	for (i = 1; i < FANOUT_FRAME_LEN - 1; i++)
+	{
+		fcs ^= fanoutFrame[i];
+	}
+	fanoutFrame[FANOUT_FRAME_LEN - 1] = fcs;
+}
+
+/*********************************************************************
+ * @fn      socketReader
+ *
+ * @brief   reads the frames of its socket as they come and splits them
+ */
+static void *socketReader(void *arg)
+{
+	fanoutReader_t *r = (fanoutReader_t *) arg;
+	uint8_t buf[16 * 1024];
+	uint32_t len = 0, off;
+	ssize_t got;
+
+	pthread_barrier_wait(r->Start);
+	while (r->Frames < r->Count)
+	{
+		got = read(r->Fd, buf + len, sizeof(buf) - len);
+		if (got <= 0)
+		{
+			break;
+		}
+		len += got;
+
+		off = 0;
+		while ((len - off >= 2) && (len - off >= buf[off + 1] + 5U))
+		{
+			r->Sum += buf[off + 2];
+			r->Frames++;
+			off += buf[off + 1] + 5;
+		}
+		len -= off;
+		memmove(buf, buf + off, len);
+	}
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      shmReader
+ *
+ * @brief   reads the frames of the ring in place until the writer is done
+ */
+static void *shmReader(void *arg)
+{
+	fanoutReader_t *r = (fanoutReader_t *) arg;
+	const uint8_t *frame;
+	int32_t len;
+	uint32_t sum;
+
+	pthread_barrier_wait(r->Start);
+	while (r->Frames < r->Count)
+	{
+		len = rpcShmReadBegin(&r->Ring, &frame, 100);
+		if (len == 0)
+		{
+			if (fanoutDone)
+			{
+				break;
+			}
+			continue;
+		}
+		sum = frame[0];
+		if (rpcShmReadEnd(&r->Ring) == 0)
+		{
+			r->Sum += sum;
+			r->Frames++;
+		}
+	}
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      fanoutSocket
+ *
+ * @brief   writes every frame to the socket of each reader
+ */
+static void fanoutSocket(uint64_t iters, uint32_t readers)
+{
+	fanoutReader_t reader[FANOUT_MAX_READERS];
+	pthread_t threads[FANOUT_MAX_READERS];
+	int fds[FANOUT_MAX_READERS][2];
+	pthread_barrier_t start;
+	uint64_t i;
+	uint32_t r;
+
+	benchStopTimer();
+	buildFrame();
+	pthread_barrier_init(&start, NULL, readers + 1);
+	for (r = 0; r < readers; r++)
+	{
+		socketpair(AF_UNIX, SOCK_STREAM, 0, fds[r]);
+		memset(&reader[r], 0, sizeof(fanoutReader_t));
+		reader[r].Fd = fds[r][1];
+		reader[r].Count = iters;
+		reader[r].Start = &start;
+		pthread_create(&threads[r], NULL, socketReader, &reader[r]);
+	}
+	benchStartTimer();
+	pthread_barrier_wait(&start);
+
+	for (i = 0; i < iters; i++)
+	{
+		for (r = 0; r < readers; r++)
+		{
+			send(fds[r][0], fanoutFrame, FANOUT_FRAME_LEN, MSG_NOSIGNAL);
+		}
+	}
+	for (r = 0; r < readers; r++)
+	{
+		pthread_join(threads[r], NULL);
+	}
+
+	benchStopTimer();
+	for (r = 0; r < readers; r++)
+	{
+		close(fds[r][0]);
+		close(fds[r][1]);
+	}
+	pthread_barrier_destroy(&start);
+	benchStartTimer();
+}
+
+/*********************************************************************
+ * @fn      fanoutShm
+ *
+ * @brief   writes every frame once to the ring the readers share, holding
+ *          back while the slowest reader is half a ring behind so that
+ *          no frame is lost
+ */
+static void fanoutShm(uint64_t iters, uint32_t readers)
+{
+	fanoutReader_t reader[FANOUT_MAX_READERS];
+	pthread_t threads[FANOUT_MAX_READERS];
+	pthread_barrier_t start;
+	rpcShm_t ring;
+	char name[32];
+	uint64_t i;
+	uint32_t r;
+
+	benchStopTimer();
+	buildFrame();
+	snprintf(name, sizeof(name), "/znpBench.%d", (int) getpid());
+	if (rpcShmCreate(&ring, name, FANOUT_SHM_SIZE) != 0)
+	{
+		benchStartTimer();
+		return;
+	}
+	fanoutDone = 0;
+	pthread_barrier_init(&start, NULL, readers + 1);
+	for (r = 0; r < readers; r++)
+	{
+		memset(&reader[r], 0, sizeof(fanoutReader_t));
+		rpcShmAttach(&reader[r].Ring, name);
+		reader[r].Count = iters;
+		reader[r].Start = &start;
+		pthread_create(&threads[r], NULL, shmReader, &reader[r]);
+	}
+	benchStartTimer();
+	pthread_barrier_wait(&start);
+
+	for (i = 0; i < iters; i++)
+	{
+		if ((i & 63) == 0)
+		{
+			while (rpcShmLag(&ring) > FANOUT_SHM_SIZE / 2)
+			{
+				sched_yield();
+			}
+		}
+		rpcShmWrite(&ring, &fanoutFrame[2], FANOUT_FRAME_LEN - 2);
+	}
+	fanoutDone = 1;
+	for (r = 0; r < readers; r++)
+	{
+		pthread_join(threads[r], NULL);
+	}
+
+	benchStopTimer();
+	for (r = 0; r < readers; r++)
+	{
+		if (reader[r].Frames != iters)
+		{
+			fprintf(stderr, "fanout/shm: reader %u lost %llu frames\n", r,
+			        (unsigned long long) (iters - reader[r].Frames));
+		}
+		rpcShmClose(&reader[r].Ring);
+	}
+	rpcShmClose(&ring);
+	pthread_barrier_destroy(&start);
+	benchStartTimer();
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+void benchFanoutSocket1(uint64_t iters)
+{
+	fanoutSocket(iters, 1);
+}
+
+void benchFanoutSocket4(uint64_t iters)
+{
+	fanoutSocket(iters, 4);
+}
+
+void benchFanoutShm1(uint64_t iters)
+{
+	fanoutShm(iters, 1);
+}
+
+void benchFanoutShm4(uint64_t iters)
+{
+	fanoutShm(iters, 4);
+}
@@ -0,0 +1,187 @@
+/*
+ * benchJournal.c
+ *
+ * This module contains the benchmarks of the frame journal: the rate
+ * it journals AF incoming messages at, staging, appending and syncing
+ * them to a directory of /tmp, and the query of the newest frames of a
+ * node.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "znpBench.h"
+#include "rpcJournal.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// AF_INCOMING_MSG of a 20 byte payload, from Cmd0 to the FCS
+#define JOURNAL_FRAME_LEN        (20 + 20)
+
+#define JOURNAL_QUERY_NODES      (64)
+#define JOURNAL_QUERY_FRAMES     (1000)
+#define JOURNAL_QUERY_LAST       (16)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static uint8_t journalFrame[JOURNAL_FRAME_LEN];
+
+static char journalDir[64];
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static void buildFrame(uint16_t srcAddr)
+{
+	uint8_t fcs = JOURNAL_FRAME_LEN - 3;
+	uint32_t i;
+
+	memset(journalFrame, 0, sizeof(journalFrame));
+	journalFrame[0] = MT_RPC_CMD_AREQ | MT_RPC_SYS_AF;
+	journalFrame[1] = 0x81;
+	journalFrame[4] = 0x06;
+	journalFrame[6] = srcAddr & 0xFF;
+	journalFrame[7] = srcAddr >> 8;
+	journalFrame[8] = 8;
+	journalFrame[9] = 8;
+	journalFrame[JOURNAL_FRAME_LEN - 2] = srcAddr & 0xFF;
+	for (i = 0; i < JOURNAL_FRAME_LEN - 1; i++)
+	{
+		fcs ^= journalFrame[i];
+	}
+	journalFrame[JOURNAL_FRAME_LEN - 1] = fcs;
+}
+
+static int32_t journalOpen(rpcJournal_t *journal)
+{
+	rpcJournalCfg_t cfg;
+
+	snprintf(journalDir, sizeof(journalDir), "/tmp/znpBench.%d.jnl",
+	        (int) getpid());
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.Dir = journalDir;
+
+	return rpcJournalOpen(journal, &cfg);
+}
+
+static void journalRemove(void)
+{
+	struct dirent *ent;
+	char path[sizeof(journalDir) + 256];
+	DIR *dir;
+
+	dir = opendir(journalDir);
+	if (dir == NULL)
+	{
+		return;
+	}
+	while ((ent = readdir(dir)) != NULL)
+	{
+		if (ent->d_name[0] != '.')
+		{
+			snprintf(path, sizeof(path), "%s/%s", journalDir, ent->d_name);
+			unlink(path);
+		}
+	}
+	closedir(dir);
+	rmdir(journalDir);
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+// a frame journaled and synced, the RPC thread retrying the frames the
+// full staging buffers drop, so the rate is the one the journal keeps up
+void benchJournalAppend(uint64_t iters)
+{
+	rpcJournal_t journal;
+	uint64_t i;
+
+	benchStopTimer();
+	buildFrame(0x1234);
+	if (journalOpen(&journal) != 0)
+	{
+		benchStartTimer();
+		return;
+	}
+	benchStartTimer();
+
+	for (i = 0; i < iters; i++)
+	{
+		while (rpcJournalAppend(&journal, journalFrame, JOURNAL_FRAME_LEN)
+		        != 0)
+		{
+			usleep(100);
+		}
+	}
+	rpcJournalClose(&journal);
+
+	benchStopTimer();
+	journalRemove();
+	benchStartTimer();
+}
+
+// the newest frames of one node among many
+void benchJournalLast(uint64_t iters)
+{
+	static rpcJournalEntry_t entries[JOURNAL_QUERY_LAST];
+	rpcJournal_t journal;
+	uint64_t i, found = 0;
+	uint32_t n;
+
+	benchStopTimer();
+	if (journalOpen(&journal) != 0)
+	{
+		benchStartTimer();
+		return;
+	}
+	for (i = 0; i < JOURNAL_QUERY_NODES * JOURNAL_QUERY_FRAMES; i++)
+	{
+		buildFrame(i % JOURNAL_QUERY_NODES);
+		while (rpcJournalAppend(&journal, journalFrame, JOURNAL_FRAME_LEN)
+		        != 0)
+		{
+			usleep(100);
+		}
+	}
+	// the frames are indexed once written
+	while (rpcJournalLast(&journal, JOURNAL_QUERY_NODES - 1, entries,
+	        JOURNAL_QUERY_LAST) < JOURNAL_QUERY_LAST)
+	{
+		usleep(1000);
+	}
+	benchStartTimer();
+
+	for (i = 0; i < iters; i++)
+	{
+		n = rpcJournalLast(&journal, i % JOURNAL_QUERY_NODES, entries,
+		        JOURNAL_QUERY_LAST);
+		found += n;
+	}
+
+	benchStopTimer();
+	if (found != iters * JOURNAL_QUERY_LAST)
+	{
+		fprintf(stderr, "journal/last: %llu frames missing\n",
+		        (unsigned long long) (iters * JOURNAL_QUERY_LAST - found));
+	}
+	rpcJournalClose(&journal);
+	journalRemove();
+	benchStartTimer();
+}
@@ -0,0 +1,169 @@
+/*
+ * benchPool.c
+ *
+ * This module contains the benchmarks of the worker pool of the MT
+ * event bus: AF incoming messages of 64 nodes handled by a listener
+ * that spends about 2us of CPU on each, run on the thread processing
+ * the frames and on 4 workers. Each run checks that the messages of
+ * every node were handled in the order they came.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "znpBench.h"
+#include "rpc.h"
+#include "mtAf.h"
+#include "mtEventPool.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define POOL_NODES               (64)
+#define POOL_WORK_NS             (2000)
+
+// AF_INCOMING_MSG of a 20 byte payload: Cmd0, Cmd1, payload, FCS
+#define POOL_FRAME_LEN           (2 + 17 + 20 + 1)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static uint8_t poolFrames[POOL_NODES][POOL_FRAME_LEN];
+
+// next TransSeqNum of each node, and the messages out of order
+static uint8_t poolNextSeq[POOL_NODES];
+static uint64_t poolUnordered;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+// the handler of a gateway, CPU bound
+static void poolWorkCb(uint16_t event, void *data, void *arg)
+{
+	IncomingMsgFormat_t *msg = data;
+	uint16_t node = msg->SrcAddr - 1;
+	uint64_t end = nowNs() + POOL_WORK_NS;
+
+	if (msg->TransSeqNum != poolNextSeq[node])
+	{
+		__atomic_add_fetch(&poolUnordered, 1, __ATOMIC_RELAXED);
+	}
+	poolNextSeq[node] = msg->TransSeqNum + 1;
+
+	while (nowNs() < end)
+		;
+}
+
+static void buildFrames(void)
+{
+	uint32_t n;
+
+	memset(poolFrames, 0, sizeof(poolFrames));
+	memset(poolNextSeq, 0, sizeof(poolNextSeq));
+	poolUnordered = 0;
+	for (n = 0; n < POOL_NODES; n++)
+	{
+		poolFrames[n][0] = MT_RPC_CMD_AREQ | MT_RPC_SYS_AF;
+		poolFrames[n][1] = MT_AF_INCOMING_MSG;
+		poolFrames[n][4] = 0x06;
+		poolFrames[n][6] = (n + 1) & 0xFF;
+		poolFrames[n][7] = (n + 1) >> 8;
+		poolFrames[n][8] = 1;
+		poolFrames[n][9] = 1;
+		poolFrames[n][18] = 20;
+	}
+}
+
+static void poolFeed(uint64_t iters)
+{
+	uint8_t *frame;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+	{
+		frame = poolFrames[i % POOL_NODES];
+		afProcess(frame, POOL_FRAME_LEN);
+		frame[17]++;
+	}
+}
+
+static void poolCheck(const char *name)
+{
+	if (poolUnordered > 0)
+	{
+		fprintf(stderr, "%s: %llu messages out of order\n", name,
+		        (unsigned long long) poolUnordered);
+	}
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+// the listener run by the MT dispatch itself
+void benchPoolInline(uint64_t iters)
+{
+	uint16_t event = MT_EVENT(MT_RPC_SYS_AF, MT_AF_INCOMING_MSG);
+
+	benchStopTimer();
+	buildFrames();
+	mtEventAddListener(event, poolWorkCb, NULL, MT_EVENT_PRIO_DEFAULT);
+	benchStartTimer();
+
+	poolFeed(iters);
+
+	benchStopTimer();
+	mtEventRemoveListener(event, poolWorkCb, NULL);
+	poolCheck("pool/inline");
+	benchStartTimer();
+}
+
+// the listener run by 4 workers, sharded by the source address
+void benchPool4(uint64_t iters)
+{
+	mtEventPoolCfg_t cfg;
+	mtEventPool_t pool;
+
+	benchStopTimer();
+	buildFrames();
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.Workers = 4;
+	if ((mtEventPoolInit(&pool, &cfg) != 0)
+	        || (mtEventPoolAddListener(&pool,
+	                MT_EVENT(MT_RPC_SYS_AF, MT_AF_INCOMING_MSG), poolWorkCb,
+	                NULL, sizeof(IncomingMsgFormat_t),
+	                offsetof(IncomingMsgFormat_t, SrcAddr)) != 0))
+	{
+		benchStartTimer();
+		return;
+	}
+	benchStartTimer();
+
+	poolFeed(iters);
+	mtEventPoolFlush(&pool);
+
+	benchStopTimer();
+	mtEventPoolClose(&pool);
+	poolCheck("pool/4");
+	benchStartTimer();
+}
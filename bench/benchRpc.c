@@ -0,0 +1,281 @@
+/*
+ * benchRpc.c
+ *
+ * This module contains the benchmarks of the RPC layer. It includes
+ * rpc.c, the way rpcTransport.c includes the transport it is built for,
+ * so the benchmarks reach calcFcs() and the RPC queue, and it provides
+ * an in memory transport in place of the UART.
+ *
+ * The transport answers every SREQ at once: it queues a success SRSP
+ * and signals it like the RPC thread does, so the SREQ functions run
+ * their whole path, frame building, write, SRSP wait and dispatch, with
+ * no thread switch.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <sys/time.h>
+
+#include "rpc.c"
+
+#include "znpBench.h"
+#include "mtAf.h"
+#include "mtZdo.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// frames read by rpcProcess() between two drains of the RPC queue
+#define BENCH_DEFRAME_BATCH      (256)
+
+// payload of the AF messages
+#define BENCH_AF_PAYLOAD         (40)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+// bytes rpcTransportRead() returns
+static uint8_t memRx[BENCH_DEFRAME_BATCH * (RPC_MAX_LEN + 5)];
+static uint32_t memRxHead;
+static uint32_t memRxTail;
+
+// bytes written by rpcTransportWrite()
+static uint64_t memTxBytes;
+
+// MT_AF_INCOMING_MSG frame with SOF and FCS
+static uint8_t incomingFrame[RPC_MAX_LEN + 5];
+static uint8_t incomingFrameLen;
+
+/*********************************************************************
+ * IN MEMORY TRANSPORT
+ */
+
+int32_t rpcTransportOpen(char *devicePath, uint32_t port)
+{
+	memRxHead = memRxTail = 0;
+
+	return 0;
+}
+
+void rpcTransportClose(void)
+{
+}
+
+void rpcTransportWrite(uint8_t* buf, uint8_t len)
+{
+	uint8_t srsp[3 + RPC_TRACE_TAG_LEN];
+
+	memTxBytes += len;
+
+	// answer an SREQ with a success SRSP
+	if ((len >= 4) && ((buf[2] & MT_RPC_CMD_TYPE_MASK) == MT_RPC_CMD_SREQ))
+	{
+		memset(srsp, 0, sizeof(srsp));
+		srsp[0] = MT_RPC_CMD_SRSP | (buf[2] & MT_RPC_SUBSYSTEM_MASK);
+		srsp[1] = buf[3];
+		srsp[2] = MT_RPC_SUCCESS;
+		llq_add(&rpcLlq, (char *) srsp, sizeof(srsp), 1);
+		sem_post(&srspSem);
+	}
+}
+
+uint8_t rpcTransportRead(uint8_t* buf, uint8_t len)
+{
+	uint32_t count = memRxTail - memRxHead;
+
+	if (count > len)
+	{
+		count = len;
+	}
+	memcpy(buf, &memRx[memRxHead], count);
+	memRxHead += count;
+
+	return count;
+}
+
+uint8_t rpcTransportPoll(void)
+{
+	return (memRxTail != memRxHead);
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      benchRpcInit
+ *
+ * @brief   opens the RPC layer over the in memory transport
+ */
+void benchRpcInit(void)
+{
+	uint8_t i;
+
+	rpcOpen("mem", 0);
+	rpcInitMq();
+
+	// MT_AF_INCOMING_MSG from 0x1234 with a BENCH_AF_PAYLOAD byte payload
+	incomingFrame[0] = MT_RPC_SOF;
+	incomingFrame[1] = 17 + BENCH_AF_PAYLOAD;
+	incomingFrame[2] = MT_RPC_CMD_AREQ | MT_RPC_SYS_AF;
+	incomingFrame[3] = MT_AF_INCOMING_MSG;
+	memset(&incomingFrame[4], 0, 17);
+	incomingFrame[6] = 0x06;
+	incomingFrame[8] = 0x34;
+	incomingFrame[9] = 0x12;
+	incomingFrame[10] = 1;
+	incomingFrame[11] = 1;
+	incomingFrame[13] = 200;
+	incomingFrame[20] = BENCH_AF_PAYLOAD;
+	for (i = 0; i < BENCH_AF_PAYLOAD; i++)
+	{
+		incomingFrame[21 + i] = i;
+	}
+	incomingFrame[21 + BENCH_AF_PAYLOAD] = calcFcs(&incomingFrame[1],
+	        incomingFrame[1] + 3);
+	incomingFrameLen = incomingFrame[1] + 5;
+}
+
+/*********************************************************************
+ * @fn      benchCalcFcs
+ *
+ * @brief   FCS of a 57 byte frame
+ */
+void benchCalcFcs(uint64_t iters)
+{
+	volatile uint8_t fcs;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+	{
+		fcs = calcFcs(&incomingFrame[1], incomingFrame[1] + 3);
+	}
+	(void) fcs;
+}
+
+/*********************************************************************
+ * @fn      benchRpcDeframe
+ *
+ * @brief   rpcProcess() reading MT_AF_INCOMING_MSG frames from the
+ *          transport and queueing them. The frames are written to the
+ *          transport and removed from the queue untimed.
+ */
+void benchRpcDeframe(uint64_t iters)
+{
+	uint8_t frame[RPC_MAX_LEN + 1 + RPC_TRACE_TAG_LEN];
+	uint64_t done = 0;
+	uint32_t batch, i;
+
+	while (done < iters)
+	{
+		benchStopTimer();
+		batch = (iters - done > BENCH_DEFRAME_BATCH) ?
+		        BENCH_DEFRAME_BATCH : (uint32_t) (iters - done);
+		memRxHead = memRxTail = 0;
+		for (i = 0; i < batch; i++)
+		{
+			memcpy(&memRx[memRxTail], incomingFrame, incomingFrameLen);
+			memRxTail += incomingFrameLen;
+		}
+		benchStartTimer();
+
+		for (i = 0; i < batch; i++)
+		{
+			rpcProcess();
+		}
+
+		benchStopTimer();
+		for (i = 0; i < batch; i++)
+		{
+			llq_receive(&rpcLlq, (char *) frame, sizeof(frame));
+		}
+		done += batch;
+		benchStartTimer();
+	}
+}
+
+/*********************************************************************
+ * @fn      benchAfDataRequest
+ *
+ * @brief   afDataRequest() with a BENCH_AF_PAYLOAD byte payload
+ */
+void benchAfDataRequest(uint64_t iters)
+{
+	DataRequestFormat_t req;
+	uint64_t i;
+
+	memset(&req, 0, sizeof(req));
+	req.DstAddr = 0x1234;
+	req.DstEndpoint = 1;
+	req.SrcEndpoint = 1;
+	req.ClusterID = 0x0006;
+	req.Radius = 16;
+	req.Len = BENCH_AF_PAYLOAD;
+
+	for (i = 0; i < iters; i++)
+	{
+		req.TransID = (uint8_t) i;
+		afDataRequest(&req);
+	}
+}
+
+/*********************************************************************
+ * @fn      benchAfDataRequestSched
+ *
+ * @brief   benchAfDataRequest() with a TX scheduler installed, the cost
+ *          of a turn nobody else waits for
+ */
+void benchAfDataRequestSched(uint64_t iters)
+{
+	rpcSchedCfg_t cfg;
+	rpcSched_t sched;
+
+	benchStopTimer();
+	memset(&cfg, 0, sizeof(cfg));
+	if (rpcSchedInit(&sched, &cfg) != 0)
+	{
+		benchStartTimer();
+		return;
+	}
+	rpcSetTxScheduler(&sched);
+	benchStartTimer();
+
+	benchAfDataRequest(iters);
+
+	benchStopTimer();
+	rpcSetTxScheduler(NULL);
+	rpcSchedClose(&sched);
+	benchStartTimer();
+}
+
+/*********************************************************************
+ * @fn      benchZdoBindReq
+ *
+ * @brief   zdoBindReq() to a 64 bit destination address
+ */
+void benchZdoBindReq(uint64_t iters)
+{
+	BindReqFormat_t req;
+	uint64_t i;
+
+	memset(&req, 0, sizeof(req));
+	req.DstAddr = 0x1234;
+	req.SrcAddress[0] = 0x01;
+	req.SrcEndpoint = 1;
+	req.ClusterID = 0x0006;
+	req.DstAddrMode = 3;
+	req.DstAddress[0] = 0x02;
+	req.DstEndpoint = 1;
+
+	for (i = 0; i < iters; i++)
+	{
+		zdoBindReq(&req);
+	}
+}
@@ -0,0 +1,267 @@
+/*
+ * benchSched.c
+ *
+ * This module contains the benchmarks of the TX scheduler: threads
+ * taking turns through rpcSchedAcquire() and rpcSchedRelease() and
+ * holding each turn for the time a frame and its SRSP take, without a
+ * ZNP. Each run checks what rpcSched.h promises:
+ *
+ * sched/drr    three interactive senders to node 1, one to node 2, a
+ *              bulk sender and a control sender sending now and then,
+ *              with a Quantum of one frame. While both nodes have frames
+ *              waiting they send as many as each other, the control
+ *              frames wait for less than the interactive ones and the
+ *              bulk frames wait for both. The flow of node 2 empties
+ *              with each frame sent, its only sender waiting for the
+ *              SRSP, and loses what is left of its quantum: with the
+ *              default Quantum node 1 would send 64 bytes of frames per
+ *              round, two frames of this size, to the one of node 2.
+ * sched/gcra   the interactive class limited to SCHED_RATE frames per
+ *              second with bursts of SCHED_BURST, and a bulk sender.
+ *              The interactive frames keep to the limit and the bulk
+ *              frames are sent meanwhile.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "znpBench.h"
+#include "rpc.h"
+#include "mtAf.h"
+#include "rpcSched.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// a frame of AF_DATA_REQUEST sent and its SRSP back
+#define SCHED_FRAME_NS           (20000)
+
+// between two control frames
+#define SCHED_CONTROL_GAP_NS     (200000)
+
+#define SCHED_RATE               (2000)
+#define SCHED_BURST              (4)
+
+// AF_DATA_REQUEST with a 20 byte payload
+#define SCHED_PAYLOAD_LEN        (10 + 20)
+#define SCHED_FRAME_BYTES        (SCHED_PAYLOAD_LEN + RPC_UART_HDR_LEN \
+                                  + RPC_UART_FCS_LEN)
+
+// frames one node of sched/drr may send more than the other
+#define SCHED_DRR_SLACK          (4)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	pthread_t Thread;
+	rpcSched_t *Sched;
+	uint8_t Class;
+	uint16_t Dest;
+	uint64_t Count;            // frames to send, 0 until schedStop
+	uint64_t GapNs;            // between two frames
+	uint64_t Sent;
+} schedSender_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static volatile uint8_t schedStop;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void sleepNs(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+// the caller of rpcSendFrame(), waiting for the SRSP in its turn
+static void *schedSenderThread(void *arg)
+{
+	schedSender_t *s = arg;
+	uint8_t payload[SCHED_PAYLOAD_LEN];
+
+	memset(payload, 0, sizeof(payload));
+	payload[0] = s->Dest & 0xFF;
+	payload[1] = s->Dest >> 8;
+	payload[2] = 1;
+	payload[3] = 1;
+	payload[9] = SCHED_PAYLOAD_LEN - 10;
+	rpcSchedSetThreadClass(s->Class);
+
+	while ((s->Count != 0) ? (s->Sent < s->Count) : !schedStop)
+	{
+		rpcSchedAcquire(s->Sched, MT_RPC_CMD_SREQ | MT_RPC_SYS_AF,
+		        MT_AF_DATA_REQUEST, payload, SCHED_PAYLOAD_LEN);
+		sleepNs(SCHED_FRAME_NS);
+		rpcSchedRelease(s->Sched);
+		__atomic_add_fetch(&s->Sent, 1, __ATOMIC_RELAXED);
+
+		if (s->GapNs != 0)
+		{
+			sleepNs(s->GapNs);
+		}
+	}
+
+	return NULL;
+}
+
+static void schedStart(schedSender_t *s, rpcSched_t *sched, uint8_t schedClass,
+        uint16_t dest, uint64_t count, uint64_t gapNs)
+{
+	memset(s, 0, sizeof(*s));
+	s->Sched = sched;
+	s->Class = schedClass;
+	s->Dest = dest;
+	s->Count = count;
+	s->GapNs = gapNs;
+	pthread_create(&s->Thread, NULL, schedSenderThread, s);
+}
+
+static double meanWaitUs(rpcSched_t *sched, uint8_t schedClass)
+{
+	rpcSchedStats_t *stats = &sched->Queues[schedClass].Stats;
+
+	return (stats->Frames > 0) ? ((double) stats->WaitUs / stats->Frames) : 0;
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+// node 2 sends iters frames, node 1 as many as it gets meanwhile
+void benchSchedDrr(uint64_t iters)
+{
+	schedSender_t node1[3], node2, bulk, control;
+	rpcSchedCfg_t cfg;
+	rpcSched_t sched;
+	uint64_t sent1;
+	double controlUs, interactiveUs, bulkUs;
+	uint32_t i;
+
+	benchStopTimer();
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.Quantum = SCHED_FRAME_BYTES;
+	if (rpcSchedInit(&sched, &cfg) != 0)
+	{
+		benchStartTimer();
+		return;
+	}
+	schedStop = 0;
+	benchStartTimer();
+
+	for (i = 0; i < 3; i++)
+	{
+		schedStart(&node1[i], &sched, RPC_SCHED_INTERACTIVE, 1, 0, 0);
+	}
+	schedStart(&node2, &sched, RPC_SCHED_INTERACTIVE, 2, iters, 0);
+	schedStart(&bulk, &sched, RPC_SCHED_BULK, 3, 0, 0);
+	schedStart(&control, &sched, RPC_SCHED_CONTROL, 0, (iters / 8) + 1,
+	        SCHED_CONTROL_GAP_NS);
+
+	pthread_join(node2.Thread, NULL);
+	sent1 = 0;
+	for (i = 0; i < 3; i++)
+	{
+		sent1 += __atomic_load_n(&node1[i].Sent, __ATOMIC_RELAXED);
+	}
+	pthread_join(control.Thread, NULL);
+	schedStop = 1;
+	for (i = 0; i < 3; i++)
+	{
+		pthread_join(node1[i].Thread, NULL);
+	}
+	pthread_join(bulk.Thread, NULL);
+
+	benchStopTimer();
+	controlUs = meanWaitUs(&sched, RPC_SCHED_CONTROL);
+	interactiveUs = meanWaitUs(&sched, RPC_SCHED_INTERACTIVE);
+	bulkUs = meanWaitUs(&sched, RPC_SCHED_BULK);
+	if ((sent1 + SCHED_DRR_SLACK < iters) || (sent1 > iters + SCHED_DRR_SLACK))
+	{
+		fprintf(stderr, "sched/drr: node 1 sent %llu frames to the %llu of"
+		        " node 2\n", (unsigned long long) sent1,
+		        (unsigned long long) iters);
+	}
+	if ((iters > 100) && ((controlUs >= interactiveUs)
+	        || (interactiveUs >= bulkUs)))
+	{
+		fprintf(stderr, "sched/drr: mean wait control %.0fus, interactive"
+		        " %.0fus, bulk %.0fus\n", controlUs, interactiveUs, bulkUs);
+	}
+	rpcSchedClose(&sched);
+	benchStartTimer();
+}
+
+// iters interactive frames sent within the rate limit
+void benchSchedGcra(uint64_t iters)
+{
+	schedSender_t interactive, bulk;
+	rpcSchedCfg_t cfg;
+	rpcSched_t sched;
+	uint64_t start, elapsedNs, allowed;
+
+	benchStopTimer();
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.Limits[RPC_SCHED_INTERACTIVE].Rate = SCHED_RATE;
+	cfg.Limits[RPC_SCHED_INTERACTIVE].Burst = SCHED_BURST;
+	if (rpcSchedInit(&sched, &cfg) != 0)
+	{
+		benchStartTimer();
+		return;
+	}
+	schedStop = 0;
+	benchStartTimer();
+
+	start = nowNs();
+	schedStart(&bulk, &sched, RPC_SCHED_BULK, 3, 0, 0);
+	schedStart(&interactive, &sched, RPC_SCHED_INTERACTIVE, 1, iters, 0);
+	pthread_join(interactive.Thread, NULL);
+	elapsedNs = nowNs() - start;
+	schedStop = 1;
+	pthread_join(bulk.Thread, NULL);
+
+	benchStopTimer();
+	allowed = SCHED_BURST + ((elapsedNs * SCHED_RATE) / 1000000000ULL) + 1;
+	if (iters > allowed)
+	{
+		fprintf(stderr, "sched/gcra: %llu frames in %lluus, %llu allowed\n",
+		        (unsigned long long) iters,
+		        (unsigned long long) (elapsedNs / 1000),
+		        (unsigned long long) allowed);
+	}
+	if ((iters > 2 * SCHED_BURST) && (bulk.Sent == 0))
+	{
+		fprintf(stderr, "sched/gcra: no bulk frame sent while the"
+		        " interactive class was limited\n");
+	}
+	rpcSchedClose(&sched);
+	benchStartTimer();
+}
@@ -0,0 +1,932 @@
+/*
+ * perfGate.c
+ *
+ * This module contains the performance regression gate. It runs a fixed
+ * suite of scenarios against the ZNP emulator through the real RPC
+ * layer and UART transport, and compares their throughput, latency
+ * percentiles and peak RSS with the baselines checked in next to it.
+ * A metric outside its tolerance band fails the gate.
+ *
+ * Every scenario runs in its own process against its own emulator, so
+ * the RPC layer starts clean and the peak RSS is the scenario's own:
+ *
+ *   ping       SYS_PING SREQs back to back
+ *   afEcho     AF messages echoed by the nodes, closed loop at max rate
+ *   joinBurst  interview of a burst of announced devices
+ *   topoCrawl  topology crawl of an emulated mesh
+ *   srcRtRefused    source routed messages the emulator refuses, each
+ *                   sent once as is and its route dropped
+ *   srcRtUnanswered source routed messages the emulator leaves without
+ *                   an SRSP, each sent once and not again
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "rpc.h"
+#include "mtSys.h"
+#include "mtZdo.h"
+#include "mtAf.h"
+#include "dbgPrint.h"
+#include "nwkStart.h"
+#include "loadGen.h"
+#include "devInterview.h"
+#include "topoCrawl.h"
+#include "srcRtCache.h"
+#include "mtEvent.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define GATE_EMU_PATH            "../../../examples/znpEmu/build/gnu/znpEmu.bin"
+#define GATE_BASELINE_PATH       "../../perfBaseline.txt"
+
+#define GATE_DURATION_S          (5)
+#define GATE_SCENARIO_TIMEOUT_S  (120)
+#define GATE_MAX_METRICS         (64)
+#define GATE_MAX_SAMPLES         (1000000)
+
+#define GATE_EP                  (1)
+#define GATE_PROFILE             (0x0104)
+#define GATE_CLUSTER             (0x0006)
+
+// messages sent to each node by the source route scenarios
+#define GATE_SRC_RT_MSGS         (4)
+
+// baseline directions
+#define GATE_HIGHER              (0)
+#define GATE_LOWER               (1)
+#define GATE_EXACT               (2)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+	char Name[48];
+	double Value;
+} gateMetric_t;
+
+typedef struct
+{
+	char Name[48];
+	double Value;
+	double TolerancePct;
+	uint8_t Direction;
+	char Note[96];            // why the tolerance is what it is, or empty
+} gateBaseline_t;
+
+typedef struct
+{
+	const char *Name;
+	const char *EmuArgs;      // nodes and shape of the emulated network
+	void (*Run)(FILE *out);
+} gateScenario_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static uint32_t durationS = GATE_DURATION_S;
+
+static gateMetric_t metrics[GATE_MAX_METRICS];
+static uint32_t metricCount;
+static gateBaseline_t baselines[GATE_MAX_METRICS];
+static uint32_t baselineCount;
+
+// join burst progress, updated by the interview thread
+static pthread_mutex_t burstLock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t burstDone;
+static uint32_t burstFailed;
+static uint32_t *burstMs;
+static uint64_t burstLastUs;
+
+// echoes of each AF transaction ID, updated by the dispatcher thread
+static uint32_t echoCount[256];
+
+static const char *directionName[] =
+	{ "higher", "lower", "exact" };
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+static void runPing(FILE *out);
+static void runAfEcho(FILE *out);
+static void runJoinBurst(FILE *out);
+static void runTopoCrawl(FILE *out);
+static void runSrcRtRefused(FILE *out);
+static void runSrcRtUnanswered(FILE *out);
+
+static const gateScenario_t scenarios[] =
+	{
+		{ "ping", "-n 1", runPing },
+		{ "afEcho", "-n 10 -l 2 -j 0", runAfEcho },
+		{ "joinBurst", "-n 200 -a 500 -l 2 -j 0", runJoinBurst },
+		{ "topoCrawl", "-n 300 -f 4 -l 2 -j 0", runTopoCrawl },
+		{ "srcRtRefused", "-n 10 -l 2 -j 0 -r", runSrcRtRefused },
+		{ "srcRtUnanswered", "-n 2 -l 2 -j 0 -s", runSrcRtUnanswered },
+		{ NULL, NULL, NULL } };
+
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int compareU32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*********************************************************************
+ * @fn      percentile
+ *
+ * @brief   percentile of sorted samples
+ */
+static uint32_t percentile(uint32_t *sorted, uint32_t count, double pct)
+{
+	uint32_t idx;
+
+	if (count == 0)
+	{
+		return 0;
+	}
+	idx = (uint32_t) ((pct / 100.0) * (count - 1) + 0.5);
+
+	return sorted[idx];
+}
+
+/*********************************************************************
+ * SCENARIO PROCESS
+ */
+
+static void *rpcTask(void *arg)
+{
+	while (1)
+	{
+		rpcProcess();
+	}
+
+	return NULL;
+}
+
+static void *dispatchTask(void *arg)
+{
+	while (1)
+	{
+		rpcWaitMqClientMsg(1000);
+	}
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      startNetwork
+ *
+ * @brief   forms the network as a coordinator
+ *
+ * @return  0 on success, -1 on error
+ */
+static int32_t startNetwork(void)
+{
+	nwkStartCfg_t cfg;
+	nwkStart_t nwk;
+	RegisterFormat_t *reg = &cfg.Endpoints[0];
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.NewNetwork = 1;
+	cfg.DevType = DEVICETYPE_COORDINATOR;
+	cfg.PanId = 0xFFFF;
+	cfg.ChanList = 1 << 11;
+	cfg.EndpointCount = 1;
+	reg->EndPoint = GATE_EP;
+	reg->AppProfId = GATE_PROFILE;
+	reg->AppDevVer = 1;
+	reg->AppNumInClusters = 1;
+	reg->AppInClusterList[0] = GATE_CLUSTER;
+	reg->AppNumOutClusters = 1;
+	reg->AppOutClusterList[0] = GATE_CLUSTER;
+
+	nwkStartInit(&nwk, &cfg);
+
+	return nwkStartRun(&nwk);
+}
+
+static void runPing(FILE *out)
+{
+	uint32_t *samples = malloc(GATE_MAX_SAMPLES * sizeof(uint32_t));
+	uint64_t start = nowUs();
+	uint64_t end = start + ((uint64_t) durationS * 1000000);
+	uint64_t now = start;
+	uint32_t count = 0;
+	uint32_t errors = 0;
+
+	while ((now < end) && (count < GATE_MAX_SAMPLES))
+	{
+		if (sysPing() != MT_RPC_SUCCESS)
+		{
+			errors++;
+		}
+		samples[count] = (uint32_t) (nowUs() - now);
+		now += samples[count++];
+	}
+	qsort(samples, count, sizeof(uint32_t), compareU32);
+
+	fprintf(out, "opsPerSec %.1f\n", count * 1000000.0 / (now - start));
+	fprintf(out, "p50Us %u\n", percentile(samples, count, 50));
+	fprintf(out, "p99Us %u\n", percentile(samples, count, 99));
+	fprintf(out, "errors %u\n", errors);
+	free(samples);
+}
+
+static void runAfEcho(FILE *out)
+{
+	uint16_t nodes[10];
+	loadGenCfg_t cfg;
+	loadGen_t gen;
+	pthread_t dispatcher;
+	uint32_t i;
+
+	// the nodes echo the messages, the dispatcher thread delivers them
+	pthread_create(&dispatcher, NULL, dispatchTask, NULL);
+
+	for (i = 0; i < 10; i++)
+	{
+		nodes[i] = i + 1;
+	}
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.Nodes = nodes;
+	cfg.NodeCount = 10;
+	cfg.SrcEndpoint = GATE_EP;
+	cfg.DstEndpoint = GATE_EP;
+	cfg.ClusterId = GATE_CLUSTER;
+	cfg.PayloadLen = 8;
+	cfg.Concurrency = 4;
+	cfg.DurationMs = durationS * 1000;
+
+	if (loadGenInit(&gen, &cfg) != 0)
+	{
+		return;
+	}
+	loadGenRun(&gen);
+
+	fprintf(out, "msgsPerSec %.1f\n",
+	        gen.Total.Delivered * 1000000.0 / gen.ElapsedUs);
+	fprintf(out, "p50Us %u\n", gen.Total.P50Us);
+	fprintf(out, "p99Us %u\n", gen.Total.P99Us);
+	fprintf(out, "lost %u\n", gen.Total.Lost + gen.Total.ConfirmFailed
+	        + gen.Total.SendFailed);
+	loadGenClose(&gen);
+}
+
+static void burstReadyCb(devInterviewEvent_t *evt)
+{
+	pthread_mutex_lock(&burstLock);
+	if (evt->Status == DEV_INTERVIEW_OK)
+	{
+		burstMs[burstDone - burstFailed] = evt->DurationMs;
+	}
+	else
+	{
+		burstFailed++;
+	}
+	burstDone++;
+	burstLastUs = nowUs();
+	pthread_mutex_unlock(&burstLock);
+}
+
+static void runJoinBurst(FILE *out)
+{
+	uint32_t expected = 200;
+	uint32_t ready;
+	uint64_t start = nowUs();
+	uint64_t end = start + (GATE_SCENARIO_TIMEOUT_S / 2) * 1000000ULL;
+
+	// the announces started while the network came up, the interviews
+	// are counted from the network start
+	pthread_mutex_lock(&burstLock);
+	while ((burstDone < expected) && (nowUs() < end))
+	{
+		pthread_mutex_unlock(&burstLock);
+		usleep(10000);
+		pthread_mutex_lock(&burstLock);
+	}
+	ready = burstDone - burstFailed;
+	qsort(burstMs, ready, sizeof(uint32_t), compareU32);
+
+	fprintf(out, "durationMs %.1f\n",
+	        (burstLastUs > start ? burstLastUs - start : 0) / 1000.0);
+	fprintf(out, "interviewP50Ms %u\n", percentile(burstMs, ready, 50));
+	fprintf(out, "interviewP99Ms %u\n", percentile(burstMs, ready, 99));
+	fprintf(out, "ready %u\n", ready);
+	pthread_mutex_unlock(&burstLock);
+}
+
+static void runTopoCrawl(FILE *out)
+{
+	topoCrawlCfg_t cfg;
+	topoCrawl_t crawl;
+
+	memset(&cfg, 0, sizeof(cfg));
+	if (topoCrawlInit(&crawl, &cfg) != 0)
+	{
+		return;
+	}
+	topoCrawlRun(&crawl);
+
+	fprintf(out, "durationMs %.1f\n", crawl.Stats.ElapsedUs / 1000.0);
+	fprintf(out, "nodes %u\n", crawl.NodeCount);
+	fprintf(out, "requests %u\n", crawl.Stats.Requests);
+	topoCrawlClose(&crawl);
+}
+
+static void srcRtEchoCb(uint16_t event, void *data, void *arg)
+{
+	IncomingMsgFormat_t *msg = data;
+
+	__atomic_add_fetch(&echoCount[msg->TransSeqNum], 1, __ATOMIC_RELAXED);
+}
+
+/*********************************************************************
+ * @fn      srcRtSend
+ *
+ * @brief   sends msgs messages to each of nodes nodes through a source
+ *          route cache holding a route to each, and waits for the
+ *          echoes
+ *
+ * @param   ctx - cache, initialised
+ * @param   nodes - nodes, network addresses 1..nodes
+ * @param   msgs - messages to each node
+ * @param   out - pipe to the gate
+ *
+ * @return  none
+ */
+static void srcRtSend(srcRtCache_t *ctx, uint32_t nodes, uint32_t msgs,
+        FILE *out)
+{
+	uint16_t event = MT_EVENT(MT_RPC_SYS_AF, MT_AF_INCOMING_MSG);
+	DataRequestFormat_t req;
+	pthread_t dispatcher;
+	uint16_t relay;
+	uint32_t sent = 0, failed = 0, delivered, duplicates, i, n, m;
+	uint64_t end;
+
+	memset(echoCount, 0, sizeof(echoCount));
+	mtEventAddListener(event, srcRtEchoCb, NULL, MT_EVENT_PRIO_DEFAULT);
+	pthread_create(&dispatcher, NULL, dispatchTask, NULL);
+
+	// the route of a node through its parent in the emulated tree
+	for (n = 1; n <= nodes; n++)
+	{
+		relay = (n - 1) / 4;
+		srcRtCacheAdd(ctx, n, (relay != 0) ? 1 : 0, &relay,
+		        SRC_RT_CACHE_IND);
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.DstEndpoint = GATE_EP;
+	req.SrcEndpoint = GATE_EP;
+	req.ClusterID = GATE_CLUSTER;
+	req.Radius = 7;
+	req.Len = 8;
+	for (m = 0; m < msgs; m++)
+	{
+		for (n = 1; n <= nodes; n++)
+		{
+			req.DstAddr = n;
+			req.TransID = sent++;
+			if (srcRtCacheDataRequest(ctx, &req) != MT_RPC_SUCCESS)
+			{
+				failed++;
+			}
+		}
+	}
+
+	// wait for the echoes, a duplicate comes right after the first
+	end = nowUs() + 2000000;
+	do
+	{
+		usleep(100000);
+		for (i = 0, delivered = 0; i < sent; i++)
+		{
+			delivered += (__atomic_load_n(&echoCount[i], __ATOMIC_RELAXED) > 0);
+		}
+	} while ((delivered < sent) && (nowUs() < end));
+	usleep(200000);
+	for (i = 0, duplicates = 0; i < sent; i++)
+	{
+		m = __atomic_load_n(&echoCount[i], __ATOMIC_RELAXED);
+		duplicates += (m > 1) ? (m - 1) : 0;
+	}
+
+	fprintf(out, "delivered %u\n", delivered);
+	fprintf(out, "duplicates %u\n", duplicates);
+	fprintf(out, "failed %u\n", failed);
+	fprintf(out, "srcRouted %llu\n", (unsigned long long) ctx->Stats.SrcRouted);
+	fprintf(out, "refused %u\n", ctx->Stats.Refused);
+	fprintf(out, "unanswered %u\n", ctx->Stats.Unanswered);
+	fprintf(out, "routes %u\n", ctx->Count);
+}
+
+static void runSrcRtRefused(FILE *out)
+{
+	srcRtCacheCfg_t cfg;
+	srcRtCache_t cache;
+
+	memset(&cfg, 0, sizeof(cfg));
+	if (srcRtCacheInit(&cache, &cfg) != 0)
+	{
+		return;
+	}
+	srcRtSend(&cache, 10, GATE_SRC_RT_MSGS, out);
+	srcRtCacheClose(&cache);
+}
+
+// each request waits out the SRSP timeout, one message per node
+static void runSrcRtUnanswered(FILE *out)
+{
+	srcRtCacheCfg_t cfg;
+	srcRtCache_t cache;
+
+	memset(&cfg, 0, sizeof(cfg));
+	if (srcRtCacheInit(&cache, &cfg) != 0)
+	{
+		return;
+	}
+	srcRtSend(&cache, 2, 1, out);
+	srcRtCacheClose(&cache);
+}
+
+/*********************************************************************
+ * @fn      scenarioMain
+ *
+ * @brief   body of a scenario process: brings the network up on the
+ *          emulator and runs the scenario
+ *
+ * @param   scenario - scenario
+ * @param   port - pseudo terminal of the emulator
+ * @param   out - pipe to the gate
+ *
+ * @return  none, exits the process
+ */
+static void scenarioMain(const gateScenario_t *scenario, char *port,
+        FILE *out)
+{
+	pthread_t rpcThread;
+	pthread_t dispatcher;
+	int fd;
+
+	alarm(GATE_SCENARIO_TIMEOUT_S);
+
+	fd = rpcOpen(port, 0);
+	if (fd == -1)
+	{
+		_exit(1);
+	}
+	rpcInitMq();
+	pthread_create(&rpcThread, NULL, rpcTask, NULL);
+
+	if (scenario->Run == runJoinBurst)
+	{
+		// the interviews must be ready before the announces arrive
+		devInterviewCfg_t cfg;
+
+		memset(&cfg, 0, sizeof(cfg));
+		burstMs = calloc(GATE_MAX_SAMPLES, sizeof(uint32_t));
+		devInterviewInit(&cfg, burstReadyCb);
+		pthread_create(&dispatcher, NULL, dispatchTask, NULL);
+	}
+
+	if (startNetwork() != 0)
+	{
+		_exit(1);
+	}
+	scenario->Run(out);
+	fflush(out);
+
+	_exit(0);
+}
+
+/*********************************************************************
+ * GATE
+ */
+
+/*********************************************************************
+ * @fn      startEmu
+ *
+ * @brief   starts the emulator on a pseudo terminal linked at link
+ *
+ * @return  process ID, -1 on error
+ */
+static pid_t startEmu(char *emuPath, const char *emuArgs, char *link)
+{
+	char args[128];
+	char *argv[24];
+	uint32_t argc = 0;
+	pid_t pid;
+	uint32_t i;
+	struct stat st;
+
+	unlink(link);
+	strncpy(args, emuArgs, sizeof(args) - 1);
+	args[sizeof(args) - 1] = 0;
+	argv[argc++] = emuPath;
+	for (argv[argc] = strtok(args, " "); argv[argc] && (argc < 20);
+	        argv[argc] = strtok(NULL, " "))
+	{
+		argc++;
+	}
+	argv[argc++] = "-L";
+	argv[argc++] = link;
+	argv[argc] = NULL;
+
+	pid = fork();
+	if (pid == 0)
+	{
+		int devNull = open("/dev/null", O_WRONLY);
+
+		dup2(devNull, STDOUT_FILENO);
+		execv(emuPath, argv);
+		perror(emuPath);
+		_exit(1);
+	}
+
+	for (i = 0; (i < 300) && (lstat(link, &st) != 0); i++)
+	{
+		usleep(10000);
+	}
+	if (i == 300)
+	{
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+
+	return pid;
+}
+
+static void metricSet(const char *scenario, const char *name, double value)
+{
+	if (metricCount < GATE_MAX_METRICS)
+	{
+		snprintf(metrics[metricCount].Name, sizeof(metrics[0].Name), "%.15s.%.31s",
+		        scenario, name);
+		metrics[metricCount++].Value = value;
+	}
+}
+
+static gateMetric_t *metricFind(const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < metricCount; i++)
+	{
+		if (strcmp(metrics[i].Name, name) == 0)
+		{
+			return &metrics[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      runScenario
+ *
+ * @brief   runs a scenario in its own process against its own emulator
+ *          and collects its metrics and peak RSS
+ *
+ * @return  0 on success, -1 if the scenario failed to run
+ */
+static int32_t runScenario(const gateScenario_t *scenario, char *emuPath)
+{
+	char link[64];
+	char line[128];
+	char name[48];
+	double value;
+	struct rusage usage;
+	int pipeFd[2];
+	int status = -1;
+	pid_t emu, pid;
+	FILE *in;
+
+	snprintf(link, sizeof(link), "/tmp/perfGate-%d", (int) getpid());
+	emu = startEmu(emuPath, scenario->EmuArgs, link);
+	if ((emu < 0) || (pipe(pipeFd) != 0))
+	{
+		fprintf(stderr, "%s: could not start the emulator %s\n",
+		        scenario->Name, emuPath);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid == 0)
+	{
+		close(pipeFd[0]);
+		scenarioMain(scenario, link, fdopen(pipeFd[1], "w"));
+	}
+	close(pipeFd[1]);
+
+	in = fdopen(pipeFd[0], "r");
+	while (fgets(line, sizeof(line), in))
+	{
+		if (sscanf(line, "%31s %lf", name, &value) == 2)
+		{
+			metricSet(scenario->Name, name, value);
+		}
+	}
+	fclose(in);
+
+	memset(&usage, 0, sizeof(usage));
+	wait4(pid, &status, 0, &usage);
+	metricSet(scenario->Name, "peakRssKb", usage.ru_maxrss);
+
+	kill(emu, SIGTERM);
+	waitpid(emu, NULL, 0);
+	unlink(link);
+
+	if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+	{
+		fprintf(stderr, "%s: scenario failed\n", scenario->Name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      loadBaselines
+ *
+ * @brief   reads the baselines, one "scenario.metric value tolerance%
+ *          higher|lower|exact [# note]" per line
+ *
+ * @return  0 on success, -1 if the file cannot be read
+ */
+static int32_t loadBaselines(char *path)
+{
+	char line[256];
+	char dir[16];
+	char *note;
+	gateBaseline_t *b;
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) && (baselineCount < GATE_MAX_METRICS))
+	{
+		b = &baselines[baselineCount];
+		if ((line[0] == '#')
+		        || (sscanf(line, "%47s %lf %lf %15s", b->Name, &b->Value,
+		                &b->TolerancePct, dir) != 4))
+		{
+			continue;
+		}
+		b->Direction = (strcmp(dir, "lower") == 0) ? GATE_LOWER :
+		               (strcmp(dir, "exact") == 0) ? GATE_EXACT : GATE_HIGHER;
+		b->Note[0] = 0;
+		note = strchr(line, '#');
+		if (note != NULL)
+		{
+			note[strcspn(note, "\r\n")] = 0;
+			snprintf(b->Note, sizeof(b->Note), "%s", note);
+		}
+		baselineCount++;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      saveBaselines
+ *
+ * @brief   replaces the baseline values with the measured ones, the
+ *          tolerances, directions and notes are kept
+ */
+static int32_t saveBaselines(char *path)
+{
+	char tmp[256];
+	gateMetric_t *m;
+	FILE *fp;
+	uint32_t i;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	fprintf(fp, "# perfGate baselines, written by perfGate -u\n");
+	fprintf(fp, "# metric value tolerance%% direction [# note] (higher and lower "
+	        "name the better side)\n");
+	for (i = 0; i < baselineCount; i++)
+	{
+		m = metricFind(baselines[i].Name);
+		fprintf(fp, "%-28s %12.1f %6.1f %s", baselines[i].Name,
+		        m ? m->Value : baselines[i].Value, baselines[i].TolerancePct,
+		        directionName[baselines[i].Direction]);
+		fprintf(fp, "%s%s\n", baselines[i].Note[0] ? " " : "",
+		        baselines[i].Note);
+	}
+	fclose(fp);
+
+	return rename(tmp, path);
+}
+
+/*********************************************************************
+ * @fn      compare
+ *
+ * @brief   compares the metrics with their baselines
+ *
+ * @return  number of regressions
+ */
+static uint32_t compare(FILE *fp)
+{
+	uint32_t failures = 0;
+	uint32_t i;
+
+	fprintf(fp, "%-28s %12s %12s %9s  %s\n", "metric", "baseline", "measured",
+	        "change", "result");
+	for (i = 0; i < baselineCount; i++)
+	{
+		gateBaseline_t *b = &baselines[i];
+		gateMetric_t *m = metricFind(b->Name);
+		double band = b->Value * b->TolerancePct / 100.0;
+		const char *result = "ok";
+
+		if (m == NULL)
+		{
+			result = "MISSING";
+		}
+		else if (((b->Direction == GATE_HIGHER) && (m->Value < b->Value - band))
+		        || ((b->Direction == GATE_LOWER)
+		                && (m->Value > b->Value + band))
+		        || ((b->Direction == GATE_EXACT) && (m->Value != b->Value)))
+		{
+			result = "REGRESSION";
+		}
+		if (strcmp(result, "ok") != 0)
+		{
+			failures++;
+		}
+
+		fprintf(fp, "%-28s %12.1f %12.1f %8.1f%%  %s\n", b->Name, b->Value,
+		        m ? m->Value : 0.0,
+		        (m && b->Value) ? ((m->Value - b->Value) * 100.0 / b->Value) :
+		                0.0, result);
+	}
+
+	return failures;
+}
+
+static void writeJson(char *path)
+{
+	FILE *fp = fopen(path, "w");
+	uint32_t i;
+
+	if (fp == NULL)
+	{
+		perror(path);
+		return;
+	}
+	fprintf(fp, "{");
+	for (i = 0; i < metricCount; i++)
+	{
+		fprintf(fp, "%s\n\"%s\":%.1f", i ? "," : "", metrics[i].Name,
+		        metrics[i].Value);
+	}
+	fprintf(fp, "}\n");
+	fclose(fp);
+}
+
+static void usage(char *exeName)
+{
+	printf("Usage: %s [-e emulator] [-b baselines] [-s scenario] [-d s] "
+	        "[-o results.json] [-u]\n", exeName);
+	printf("  -e  ZNP emulator (%s)\n", GATE_EMU_PATH);
+	printf("  -b  baselines (%s)\n", GATE_BASELINE_PATH);
+	printf("  -s  run only the scenario\n");
+	printf("  -d  duration of the timed scenarios (%d)\n", GATE_DURATION_S);
+	printf("  -u  write the measured values as the new baselines\n");
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int main(int argc, char *argv[])
+{
+	char *emuPath = GATE_EMU_PATH;
+	char *baselinePath = GATE_BASELINE_PATH;
+	char *only = NULL;
+	char *jsonPath = NULL;
+	uint8_t update = 0;
+	uint32_t failures = 0;
+	const gateScenario_t *scenario;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:b:s:d:o:uh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'e':
+			emuPath = optarg;
+			break;
+		case 'b':
+			baselinePath = optarg;
+			break;
+		case 's':
+			only = optarg;
+			break;
+		case 'd':
+			durationS = atoi(optarg);
+			break;
+		case 'o':
+			jsonPath = optarg;
+			break;
+		case 'u':
+			update = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (loadBaselines(baselinePath) != 0)
+	{
+		perror(baselinePath);
+		return 2;
+	}
+
+	for (scenario = scenarios; scenario->Name; scenario++)
+	{
+		if (only && (strcmp(only, scenario->Name) != 0))
+		{
+			continue;
+		}
+		printf("running %s\n", scenario->Name);
+		fflush(stdout);
+		if (runScenario(scenario, emuPath) != 0)
+		{
+			failures++;
+		}
+	}
+
+	if (jsonPath)
+	{
+		writeJson(jsonPath);
+	}
+	if (update)
+	{
+		if (saveBaselines(baselinePath) != 0)
+		{
+			perror(baselinePath);
+			return 2;
+		}
+		printf("baselines written to %s\n", baselinePath);
+		return failures ? 1 : 0;
+	}
+
+	if (only)
+	{
+		// compare only the metrics of the scenario run
+		uint32_t i, kept = 0;
+
+		for (i = 0; i < baselineCount; i++)
+		{
+			if (strncmp(baselines[i].Name, only, strlen(only)) == 0)
+			{
+				baselines[kept++] = baselines[i];
+			}
+		}
+		baselineCount = kept;
+	}
+	failures += compare(stdout);
+	printf("%s\n", failures ? "perfGate: FAILED" : "perfGate: passed");
+
+	return failures ? 1 : 0;
+}
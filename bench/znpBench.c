@@ -0,0 +1,699 @@
+/*
+ * znpBench.c
+ *
+ * This module contains the microbenchmarks of the framework hot paths:
+ * the FCS, deframing in rpcProcess(), the RPC queue, the MT dispatch,
+ * parsing of frequent AREQs and building of frequent SREQs. Each
+ * benchmark reports the time and the heap allocations per operation,
+ * as text, CSV or JSON so builds can be compared.
+ *
+ * The number of operations grows until a benchmark runs for the target
+ * time, and the fastest of the runs is reported. The allocations are
+ * counted by wrapping malloc, calloc and realloc at link time
+ * (-Wl,--wrap), so they cover the framework objects, not the C library.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "znpBench.h"
+#include "queue.h"
+#include "rpc.h"
+#include "rpcFilter.h"
+#include "mtParser.h"
+#include "mtAf.h"
+#include "mtZdo.h"
+#include "mtEvent.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define BENCH_TARGET_MS          (200)
+#define BENCH_RUNS               (3)
+#define BENCH_MAX_ITERS          (1000000000ULL)
+
+// size of the messages put in the RPC queue
+#define BENCH_LLQ_MSG_LEN        (40)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+	const char *Name;
+	uint64_t Iters;
+	double NsPerOp;
+	double AllocsPerOp;
+	double BytesPerOp;
+} benchResult_t;
+
+typedef struct
+{
+	llq_t *Queue;
+	uint64_t Count;
+	pthread_barrier_t *Start;
+} benchProducer_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+// allocation counters of the wrapped allocator
+static volatile uint64_t allocCount;
+static volatile uint64_t allocBytes;
+
+// measurement of the running benchmark
+static uint8_t timerOn;
+static uint64_t timerStartNs;
+static uint64_t timerAllocs;
+static uint64_t timerBytes;
+static uint64_t elapsedNs;
+static uint64_t elapsedAllocs;
+static uint64_t elapsedBytes;
+
+static llq_t benchLlq;
+
+// AREQs as queued by the RPC layer: Cmd0, Cmd1, payload, FCS
+static uint8_t confirmFrame[3 + 3];
+static uint8_t incomingFrame[2 + 17 + 40 + 1];
+static uint8_t lqiFrame[2 + 6 + (3 * 22) + 1];
+static uint8_t simpleDescFrame[2 + 14 + (2 * 8) + 1];
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+static void benchLlqUncontended(uint64_t iters);
+static void benchLlqContended1(uint64_t iters);
+static void benchLlqContended2(uint64_t iters);
+static void benchLlqContended4(uint64_t iters);
+static void benchMtDispatch(uint64_t iters);
+static void benchIncomingMsg(uint64_t iters);
+static void benchEventDispatch4(uint64_t iters);
+static void benchMgmtLqiRsp(uint64_t iters);
+static void benchSimpleDescRsp(uint64_t iters);
+static void benchFilterMatch(uint64_t iters);
+
+static const bench_t benches[] =
+	{
+		{ "rpc/calcFcs", benchCalcFcs },
+		{ "rpc/rpcProcess", benchRpcDeframe },
+		{ "llq/uncontended", benchLlqUncontended },
+		{ "llq/contended/1", benchLlqContended1 },
+		{ "llq/contended/2", benchLlqContended2 },
+		{ "llq/contended/4", benchLlqContended4 },
+		{ "mt/mtProcess", benchMtDispatch },
+		{ "af/processIncomingMsg", benchIncomingMsg },
+		{ "mt/eventDispatch/4", benchEventDispatch4 },
+		{ "zdo/processMgmtLqiRsp", benchMgmtLqiRsp },
+		{ "zdo/processSimpleDescRsp", benchSimpleDescRsp },
+		{ "rpc/rpcFilterMatch", benchFilterMatch },
+		{ "af/afDataRequest", benchAfDataRequest },
+		{ "af/afDataRequest/sched", benchAfDataRequestSched },
+		{ "zdo/zdoBindReq", benchZdoBindReq },
+		{ "fanout/socket/1", benchFanoutSocket1 },
+		{ "fanout/socket/4", benchFanoutSocket4 },
+		{ "fanout/shm/1", benchFanoutShm1 },
+		{ "fanout/shm/4", benchFanoutShm4 },
+		{ "journal/append", benchJournalAppend },
+		{ "journal/last", benchJournalLast },
+		{ "pool/inline", benchPoolInline },
+		{ "pool/4", benchPool4 },
+		{ "sched/drr", benchSchedDrr },
+		{ "sched/gcra", benchSchedGcra },
+		{ NULL, NULL } };
+
+/*********************************************************************
+ * ALLOCATION COUNTERS
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	__sync_fetch_and_add(&allocCount, 1);
+	__sync_fetch_and_add(&allocBytes, size);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	__sync_fetch_and_add(&allocCount, 1);
+	__sync_fetch_and_add(&allocBytes, nmemb * size);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	__sync_fetch_and_add(&allocCount, 1);
+	__sync_fetch_and_add(&allocBytes, size);
+	return __real_realloc(ptr, size);
+}
+
+/*********************************************************************
+ * @fn      nowNs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in nano seconds
+ */
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/*********************************************************************
+ * NO-OP LISTENER
+ */
+static void benchNoopCb(uint16_t event, void *msg, void *arg)
+{
+}
+
+/*********************************************************************
+ * @fn      buildFrames
+ *
+ * @brief   builds the AREQs parsed by the benchmarks
+ */
+static void buildFrames(void)
+{
+	uint32_t i, idx;
+
+	// AF_DATA_CONFIRM, no listener handles it
+	confirmFrame[0] = MT_RPC_CMD_AREQ | MT_RPC_SYS_AF;
+	confirmFrame[1] = MT_AF_DATA_CONFIRM;
+
+	// AF_INCOMING_MSG with a 40 byte payload
+	incomingFrame[0] = MT_RPC_CMD_AREQ | MT_RPC_SYS_AF;
+	incomingFrame[1] = MT_AF_INCOMING_MSG;
+	incomingFrame[4] = 0x06;
+	incomingFrame[6] = 0x34;
+	incomingFrame[7] = 0x12;
+	incomingFrame[8] = 1;
+	incomingFrame[9] = 1;
+	incomingFrame[11] = 200;
+	incomingFrame[18] = 40;
+	for (i = 0; i < 40; i++)
+	{
+		incomingFrame[19 + i] = i;
+	}
+
+	// Mgmt_Lqi_rsp with 3 neighbors
+	lqiFrame[0] = MT_RPC_CMD_AREQ | MT_RPC_SYS_ZDO;
+	lqiFrame[1] = MT_ZDO_MGMT_LQI_RSP;
+	lqiFrame[2] = 0x34;
+	lqiFrame[3] = 0x12;
+	lqiFrame[5] = 3;
+	lqiFrame[7] = 3;
+	for (i = 0, idx = 8; i < 3; i++, idx += 22)
+	{
+		memset(&lqiFrame[idx], 0x11 * (i + 1), 16);
+		lqiFrame[idx + 16] = i + 1;
+		lqiFrame[idx + 17] = 0x00;
+		lqiFrame[idx + 18] = 0x25;
+		lqiFrame[idx + 19] = 0x02;
+		lqiFrame[idx + 20] = 1;
+		lqiFrame[idx + 21] = 180;
+	}
+
+	// Simple_Desc_rsp of a Home Automation endpoint, 4 in 4 out clusters
+	simpleDescFrame[0] = MT_RPC_CMD_AREQ | MT_RPC_SYS_ZDO;
+	simpleDescFrame[1] = MT_ZDO_SIMPLE_DESC_RSP;
+	simpleDescFrame[2] = 0x34;
+	simpleDescFrame[3] = 0x12;
+	simpleDescFrame[5] = 0x34;
+	simpleDescFrame[6] = 0x12;
+	simpleDescFrame[7] = 8 + (2 * 8);
+	simpleDescFrame[8] = 1;
+	simpleDescFrame[9] = 0x04;
+	simpleDescFrame[10] = 0x01;
+	simpleDescFrame[11] = 0x00;
+	simpleDescFrame[12] = 0x01;
+	simpleDescFrame[13] = 1;
+	simpleDescFrame[14] = 4;
+	for (i = 0, idx = 15; i < 4; i++, idx += 2)
+	{
+		simpleDescFrame[idx] = i;
+	}
+	simpleDescFrame[idx++] = 4;
+	for (i = 0; i < 4; i++, idx += 2)
+	{
+		simpleDescFrame[idx] = 0x10 + i;
+	}
+}
+
+/*********************************************************************
+ * BENCHMARKS
+ */
+
+static void benchLlqUncontended(uint64_t iters)
+{
+	char msg[BENCH_LLQ_MSG_LEN];
+	uint64_t i;
+
+	memset(msg, 0, sizeof(msg));
+	for (i = 0; i < iters; i++)
+	{
+		llq_add(&benchLlq, msg, sizeof(msg), 0);
+		llq_receive(&benchLlq, msg, sizeof(msg));
+	}
+}
+
+static void *llqProducer(void *arg)
+{
+	benchProducer_t *producer = (benchProducer_t *) arg;
+	char msg[BENCH_LLQ_MSG_LEN];
+	uint64_t i;
+
+	memset(msg, 0, sizeof(msg));
+	pthread_barrier_wait(producer->Start);
+	for (i = 0; i < producer->Count; i++)
+	{
+		llq_add(producer->Queue, msg, sizeof(msg), 0);
+	}
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      llqContended
+ *
+ * @brief   producers adding to the RPC queue while the calling thread
+ *          receives, like the RPC and application threads do
+ *
+ * @param   iters - messages
+ * @param   producers - producer threads
+ */
+static void llqContended(uint64_t iters, uint32_t producers)
+{
+	benchProducer_t producer[4];
+	pthread_t threads[4];
+	pthread_barrier_t start;
+	char msg[BENCH_LLQ_MSG_LEN];
+	uint64_t i;
+	uint32_t p;
+
+	benchStopTimer();
+	pthread_barrier_init(&start, NULL, producers + 1);
+	for (p = 0; p < producers; p++)
+	{
+		producer[p].Queue = &benchLlq;
+		producer[p].Count = (iters / producers)
+		        + ((p == 0) ? (iters % producers) : 0);
+		producer[p].Start = &start;
+		pthread_create(&threads[p], NULL, llqProducer, &producer[p]);
+	}
+
+	// the producers allocate as soon as they are released
+	benchStartTimer();
+	pthread_barrier_wait(&start);
+
+	for (i = 0; i < iters; i++)
+	{
+		llq_receive(&benchLlq, msg, sizeof(msg));
+	}
+
+	benchStopTimer();
+	for (p = 0; p < producers; p++)
+	{
+		pthread_join(threads[p], NULL);
+	}
+	pthread_barrier_destroy(&start);
+	benchStartTimer();
+}
+
+static void benchLlqContended1(uint64_t iters)
+{
+	llqContended(iters, 1);
+}
+
+static void benchLlqContended2(uint64_t iters)
+{
+	llqContended(iters, 2);
+}
+
+static void benchLlqContended4(uint64_t iters)
+{
+	llqContended(iters, 4);
+}
+
+static void benchMtDispatch(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+	{
+		mtProcess(confirmFrame, sizeof(confirmFrame));
+	}
+}
+
+static void benchIncomingMsg(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+	{
+		afProcess(incomingFrame, sizeof(incomingFrame));
+	}
+}
+
+static void benchEventCb(uint16_t event, void *msg, void *arg)
+{
+	(*(uint64_t *) arg)++;
+}
+
+// an AF_INCOMING_MSG decoded once for 4 listeners of the event bus
+static void benchEventDispatch4(uint64_t iters)
+{
+	uint16_t event = MT_EVENT(MT_RPC_SYS_AF, MT_AF_INCOMING_MSG);
+	uint64_t counts[4] = { 0 };
+	uint64_t i;
+
+	benchStopTimer();
+	for (i = 0; i < 4; i++)
+	{
+		mtEventAddListener(event, benchEventCb, &counts[i], i);
+	}
+	benchStartTimer();
+
+	for (i = 0; i < iters; i++)
+	{
+		afProcess(incomingFrame, sizeof(incomingFrame));
+	}
+
+	benchStopTimer();
+	for (i = 0; i < 4; i++)
+	{
+		mtEventRemoveListener(event, benchEventCb, &counts[i]);
+		if (counts[i] != iters)
+		{
+			fprintf(stderr, "mt/eventDispatch/4: %llu events missing\n",
+			        (unsigned long long) (iters - counts[i]));
+		}
+	}
+	benchStartTimer();
+}
+
+// an AF_INCOMING_MSG missing every rule of a filter on other clusters
+// and sources, the longest match
+static void benchFilterMatch(uint64_t iters)
+{
+	rpcFilterRule_t rules[6];
+	rpcFilter_t filter;
+	uint64_t i, passed = 0;
+	uint32_t r;
+
+	benchStopTimer();
+	memset(rules, 0, sizeof(rules));
+	rules[0].Sys = MT_RPC_SYS_SYS;
+	rules[1].Sys = MT_RPC_SYS_ZDO;
+	for (r = 2; r < 6; r++)
+	{
+		rules[r].Sys = MT_RPC_SYS_AF;
+		rules[r].Match = RPC_FILTER_CLUSTER | RPC_FILTER_SRC_ADDR;
+		rules[r].ClusterId = 0x0100 + r;
+		rules[r].SrcAddr = 0x1234;
+	}
+	rpcFilterCompile(&filter, rules, 6);
+	benchStartTimer();
+
+	for (i = 0; i < iters; i++)
+	{
+		passed += rpcFilterMatch(&filter, incomingFrame,
+		        sizeof(incomingFrame));
+	}
+
+	benchStopTimer();
+	if (passed)
+	{
+		fprintf(stderr, "rpc/rpcFilterMatch: %llu frames passed\n",
+		        (unsigned long long) passed);
+	}
+	benchStartTimer();
+}
+
+static void benchMgmtLqiRsp(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+	{
+		zdoProcess(lqiFrame, sizeof(lqiFrame));
+	}
+}
+
+static void benchSimpleDescRsp(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+	{
+		zdoProcess(simpleDescFrame, sizeof(simpleDescFrame));
+	}
+}
+
+/*********************************************************************
+ * RUNNER
+ */
+
+void benchStopTimer(void)
+{
+	if (timerOn)
+	{
+		elapsedNs += nowNs() - timerStartNs;
+		elapsedAllocs += allocCount - timerAllocs;
+		elapsedBytes += allocBytes - timerBytes;
+		timerOn = 0;
+	}
+}
+
+void benchStartTimer(void)
+{
+	if (!timerOn)
+	{
+		timerAllocs = allocCount;
+		timerBytes = allocBytes;
+		timerStartNs = nowNs();
+		timerOn = 1;
+	}
+}
+
+/*********************************************************************
+ * @fn      runOnce
+ *
+ * @brief   runs a benchmark for a number of operations
+ */
+static void runOnce(const bench_t *bench, uint64_t iters)
+{
+	elapsedNs = elapsedAllocs = elapsedBytes = 0;
+	benchStartTimer();
+	bench->Fn(iters);
+	benchStopTimer();
+}
+
+/*********************************************************************
+ * @fn      runBench
+ *
+ * @brief   grows the operations until the benchmark runs for the target
+ *          time, and keeps the fastest of the runs
+ *
+ * @param   bench - benchmark
+ * @param   targetNs - time of a run
+ * @param   runs - runs at the final operation count
+ * @param   result - filled with the fastest run
+ *
+ * @return  none
+ */
+static void runBench(const bench_t *bench, uint64_t targetNs, uint32_t runs,
+        benchResult_t *result)
+{
+	uint64_t iters = 1;
+	uint32_t r;
+
+	while (1)
+	{
+		uint64_t next;
+
+		runOnce(bench, iters);
+		if ((elapsedNs >= targetNs) || (iters >= BENCH_MAX_ITERS))
+		{
+			break;
+		}
+
+		// aim 20% past the target, grow at most 100 fold
+		next = (elapsedNs > 0) ?
+		        (uint64_t) (iters * 1.2 * targetNs / elapsedNs) :
+		        iters * 100;
+		if (next > iters * 100)
+		{
+			next = iters * 100;
+		}
+		iters = (next > iters) ? next : iters + 1;
+	}
+
+	result->Name = bench->Name;
+	result->Iters = iters;
+	result->NsPerOp = (double) elapsedNs / iters;
+	result->AllocsPerOp = (double) elapsedAllocs / iters;
+	result->BytesPerOp = (double) elapsedBytes / iters;
+
+	for (r = 1; r < runs; r++)
+	{
+		runOnce(bench, iters);
+		if ((double) elapsedNs / iters < result->NsPerOp)
+		{
+			result->NsPerOp = (double) elapsedNs / iters;
+			result->AllocsPerOp = (double) elapsedAllocs / iters;
+			result->BytesPerOp = (double) elapsedBytes / iters;
+		}
+	}
+}
+
+static void writeResults(FILE *fp, char *format, benchResult_t *results,
+        uint32_t count)
+{
+	uint32_t i;
+
+	if (strcmp(format, "json") == 0)
+	{
+		fprintf(fp, "{\"benchmarks\":[");
+		for (i = 0; i < count; i++)
+		{
+			fprintf(fp,
+			        "%s\n{\"name\":\"%s\",\"iterations\":%llu,\"nsPerOp\":%.2f,"
+			                "\"allocsPerOp\":%.3f,\"bytesPerOp\":%.1f}",
+			        i ? "," : "", results[i].Name,
+			        (unsigned long long) results[i].Iters, results[i].NsPerOp,
+			        results[i].AllocsPerOp, results[i].BytesPerOp);
+		}
+		fprintf(fp, "]}\n");
+	}
+	else if (strcmp(format, "csv") == 0)
+	{
+		fprintf(fp, "name,iterations,nsPerOp,allocsPerOp,bytesPerOp\n");
+		for (i = 0; i < count; i++)
+		{
+			fprintf(fp, "%s,%llu,%.2f,%.3f,%.1f\n", results[i].Name,
+			        (unsigned long long) results[i].Iters, results[i].NsPerOp,
+			        results[i].AllocsPerOp, results[i].BytesPerOp);
+		}
+	}
+	else
+	{
+		fprintf(fp, "%-28s %12s %12s %10s %10s\n", "benchmark", "iterations",
+		        "ns/op", "allocs/op", "B/op");
+		for (i = 0; i < count; i++)
+		{
+			fprintf(fp, "%-28s %12llu %12.2f %10.3f %10.1f\n",
+			        results[i].Name, (unsigned long long) results[i].Iters,
+			        results[i].NsPerOp, results[i].AllocsPerOp,
+			        results[i].BytesPerOp);
+		}
+	}
+}
+
+static void usage(char *exeName)
+{
+	printf("Usage: %s [-t ms] [-r runs] [-b filter] [-f text|csv|json] "
+	        "[-o file]\n", exeName);
+	printf("  -t  time of a run (%d)\n", BENCH_TARGET_MS);
+	printf("  -r  runs, the fastest is reported (%d)\n", BENCH_RUNS);
+	printf("  -b  run the benchmarks whose name contains filter\n");
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int main(int argc, char *argv[])
+{
+	benchResult_t results[sizeof(benches) / sizeof(benches[0])];
+	uint64_t targetNs = (uint64_t) BENCH_TARGET_MS * 1000000;
+	uint32_t runs = BENCH_RUNS;
+	uint32_t count = 0;
+	char *filter = NULL;
+	char *format = "text";
+	char *out = NULL;
+	FILE *fp = stdout;
+	const bench_t *bench;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:r:b:f:o:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			targetNs = strtoull(optarg, NULL, 0) * 1000000;
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'b':
+			filter = optarg;
+			break;
+		case 'f':
+			format = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	benchRpcInit();
+	llq_open(&benchLlq);
+	buildFrames();
+
+	mtEventAddListener(MT_EVENT(MT_RPC_SYS_AF, MT_AF_INCOMING_MSG),
+	        benchNoopCb, NULL, MT_EVENT_PRIO_DEFAULT);
+	mtEventAddListener(MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_MGMT_LQI_RSP),
+	        benchNoopCb, NULL, MT_EVENT_PRIO_DEFAULT);
+	mtEventAddListener(MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_SIMPLE_DESC_RSP),
+	        benchNoopCb, NULL, MT_EVENT_PRIO_DEFAULT);
+
+	for (bench = benches; bench->Name; bench++)
+	{
+		if (filter && (strstr(bench->Name, filter) == NULL))
+		{
+			continue;
+		}
+		runBench(bench, targetNs, runs ? runs : 1, &results[count]);
+		if (out != NULL)
+		{
+			// progress while the results go to a file
+			fprintf(stderr, "%s: %.2f ns/op\n", bench->Name,
+			        results[count].NsPerOp);
+		}
+		count++;
+	}
+
+	if (out && ((fp = fopen(out, "w")) == NULL))
+	{
+		perror(out);
+		return -1;
+	}
+	writeResults(fp, format, results, count);
+	if (fp != stdout)
+	{
+		fclose(fp);
+	}
+
+	return 0;
+}
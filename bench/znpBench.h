@@ -0,0 +1,77 @@
+/*
+ * znpBench.h
+ *
+ * This module contains the interface between the benchmark runner and
+ * the benchmarks of the framework hot paths.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef ZNPBENCH_H
+#define ZNPBENCH_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// runs iters operations, the runner measures the time and allocations
+typedef void (*benchFn_t)(uint64_t iters);
+
+typedef struct
+{
+	const char *Name;
+	benchFn_t Fn;
+} bench_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+// exclude setup and teardown work of a benchmark from the measurement
+void benchStopTimer(void);
+void benchStartTimer(void);
+
+// benchmarks using the RPC layer over an in memory transport
+void benchRpcInit(void);
+void benchCalcFcs(uint64_t iters);
+void benchRpcDeframe(uint64_t iters);
+void benchAfDataRequest(uint64_t iters);
+void benchAfDataRequestSched(uint64_t iters);
+void benchZdoBindReq(uint64_t iters);
+
+// benchmarks of the AREQ fan out to local clients, sockets against the
+// shared memory ring
+void benchFanoutSocket1(uint64_t iters);
+void benchFanoutSocket4(uint64_t iters);
+void benchFanoutShm1(uint64_t iters);
+void benchFanoutShm4(uint64_t iters);
+
+// benchmarks of the frame journal
+void benchJournalAppend(uint64_t iters);
+void benchJournalLast(uint64_t iters);
+
+// benchmarks of the worker pool of the MT event bus
+void benchPoolInline(uint64_t iters);
+void benchPool4(uint64_t iters);
+
+// benchmarks of the TX scheduler, contended senders without a ZNP
+void benchSchedDrr(uint64_t iters);
+void benchSchedGcra(uint64_t iters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZNPBENCH_H */
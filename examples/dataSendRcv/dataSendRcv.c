@@ -46,6 +46,10 @@
 
 #include "rpc.h"
 #include "mtSys.h"
+#include "nvCache.h"
+#include "nwkStart.h"
+#include "devDb.h"
+#include "devInterview.h"
 #include "mtZdo.h"
 #include "mtAf.h"
 #include "mtParser.h"
@@ -70,6 +74,7 @@ devStates_t devState = DEV_HOLD;
 uint8_t gSrcEndPoint = 1;
 uint8_t gDstEndPoint = 1;
 
+
 /***********************************************************************/
 
 /*********************************************************************
@@ -80,6 +85,7 @@ static uint8_t mtZdoStateChangeIndCb(uint8_t newDevState);
 static uint8_t mtZdoSimpleDescRspCb(SimpleDescRspFormat_t *msg);
 static uint8_t mtZdoActiveEpRspCb(ActiveEpRspFormat_t *msg);
 static uint8_t mtZdoEndDeviceAnnceIndCb(EndDeviceAnnceIndFormat_t *msg);
+static void devInterviewReadyCb(devInterviewEvent_t *evt);
 
 static uint8_t mtZdoMgmtLqiRspCb(MgmtLqiRspFormat_t *msg);
 
@@ -92,12 +98,8 @@ static uint8_t mtAfDataConfirmCb(DataConfirmFormat_t *msg);
 static uint8_t mtAfIncomingMsgCb(IncomingMsgFormat_t *msg);
 
 //helper functions
-static uint8_t setNVStartup(uint8_t startupOption);
-static uint8_t setNVChanList(uint32_t chanList);
-static uint8_t setNVPanID(uint32_t panId);
-static uint8_t setNVDevType(uint8_t devType);
 static int32_t startNetwork(void);
-static int32_t registerAf(void);
+static void setAfEndpoint(RegisterFormat_t *reg);
 
 /*********************************************************************
  * CALLBACK FUNCTIONS
@@ -338,7 +340,6 @@ static uint8_t mtZdoMgmtLqiRspCb(MgmtLqiRspFormat_t *msg)
 static uint8_t mtZdoActiveEpRspCb(ActiveEpRspFormat_t *msg)
 {
 
-	//SimpleDescReqFormat_t simReq;
 	consolePrint("NwkAddr: 0x%04X\n", msg->NwkAddr);
 	if (msg->Status == MT_RPC_SUCCESS)
 	{
@@ -363,15 +364,43 @@ static uint8_t mtZdoActiveEpRspCb(ActiveEpRspFormat_t *msg)
 static uint8_t mtZdoEndDeviceAnnceIndCb(EndDeviceAnnceIndFormat_t *msg)
 {
 
-	ActiveEpReqFormat_t actReq;
-	actReq.DstAddr = msg->NwkAddr;
-	actReq.NwkAddrOfInterest = msg->NwkAddr;
-
-	consolePrint("\nNew device joined network.\n");
-	zdoActiveEpReq(&actReq);
+	//the interview engine reads the descriptors of the device
+	consolePrint("\nDevice 0x%04X joined network.\n", msg->NwkAddr);
 	return 0;
 }
 
+/********************************************************************
+ * @fn     Callback function for the end of a device interview
+
+ * @brief  prints the descriptors of the device
+ *
+ * @param  evt - descriptors read, or read from the device database
+ *
+ * @return none
+ */
+static void devInterviewReadyCb(devInterviewEvent_t *evt)
+{
+	uint32_t i;
+
+	if (evt->Status != DEV_INTERVIEW_OK)
+	{
+		consolePrint("Interview of 0x%04X failed after %d retries\n",
+		        evt->Dev.NwkAddr, evt->Retries);
+		return;
+	}
+
+	consolePrint("\nDevice 0x%04X ready%s in %dms: manufacturer 0x%04X, %d endpoints\n",
+	        evt->Dev.NwkAddr, evt->Cached ? " (known)" : "", evt->DurationMs,
+	        evt->Dev.ManufacturerCode, evt->Dev.NumEndpoints);
+	for (i = 0; i < evt->Dev.NumEndpoints; i++)
+	{
+		consolePrint("\tEndpoint 0x%02X: profile 0x%04X device 0x%04X, %d in %d out clusters\n",
+		        evt->Dev.EpDesc[i].Endpoint, evt->Dev.EpDesc[i].ProfileId,
+		        evt->Dev.EpDesc[i].DeviceId, evt->Dev.EpDesc[i].NumInClusters,
+		        evt->Dev.EpDesc[i].NumOutClusters);
+	}
+}
+
 /********************************************************************
  * AF CALL BACK FUNCTIONS
  */
@@ -406,131 +435,33 @@ static uint8_t mtAfIncomingMsgCb(IncomingMsgFormat_t *msg)
 /********************************************************************
  * HELPER FUNCTIONS
  */
-// helper functions for building and sending the NV messages
-static uint8_t setNVStartup(uint8_t startupOption)
-{
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-
-	// sending startup option
-	nvWrite.Id = ZCD_NV_STARTUP_OPTION;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 1;
-	nvWrite.Value[0] = startupOption;
-	status = sysOsalNvWrite(&nvWrite);
-
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Startup Option cmd sent[%d]...\n",
-	        status);
-
-	return status;
-}
-
-static uint8_t setNVDevType(uint8_t devType)
-{
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-
-	// setting dev type
-	nvWrite.Id = ZCD_NV_LOGICAL_TYPE;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 1;
-	nvWrite.Value[0] = devType;
-	status = sysOsalNvWrite(&nvWrite);
-
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Device Type cmd sent... [%d]\n",
-	        status);
-
-	return status;
-}
-
-static uint8_t setNVPanID(uint32_t panId)
-{
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write PAN ID cmd sending...\n");
-
-	nvWrite.Id = ZCD_NV_PANID;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 2;
-	nvWrite.Value[0] = LO_UINT16(panId);
-	nvWrite.Value[1] = HI_UINT16(panId);
-	status = sysOsalNvWrite(&nvWrite);
-
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write PAN ID cmd sent...[%d]\n", status);
-
-	return status;
-}
-
-static uint8_t setNVChanList(uint32_t chanList)
-{
-	OsalNvWriteFormat_t nvWrite;
-	uint8_t status;
-	// setting chanList
-	nvWrite.Id = ZCD_NV_CHANLIST;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 4;
-	nvWrite.Value[0] = BREAK_UINT32(chanList, 0);
-	nvWrite.Value[1] = BREAK_UINT32(chanList, 1);
-	nvWrite.Value[2] = BREAK_UINT32(chanList, 2);
-	nvWrite.Value[3] = BREAK_UINT32(chanList, 3);
-	status = sysOsalNvWrite(&nvWrite);
-
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Channel List cmd sent...[%d]\n",
-	        status);
-
-	return status;
-}
-
 uint8_t dType;
 static int32_t startNetwork(void)
 {
 	char cDevType;
-	uint8_t devType;
+	nwkStartCfg_t cfg;
+	nwkStart_t nwk;
 	int32_t status;
-	uint8_t newNwk = 0;
 	char sCh[128];
 
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.DevType = NWK_START_DEVTYPE_NV;
+
 	do
 	{
 		consolePrint("Do you wish to start/join a new network? (y/n)\n");
 		consoleGetLine(sCh, 128);
-		if (sCh[0] == 'n' || sCh[0] == 'N')
-		{
-			status = setNVStartup(0);
-		}
-		else if (sCh[0] == 'y' || sCh[0] == 'Y')
+		if (sCh[0] == 'y' || sCh[0] == 'Y')
 		{
-			status = setNVStartup(
-			ZCD_STARTOPT_CLEAR_STATE | ZCD_STARTOPT_CLEAR_CONFIG);
-			newNwk = 1;
-
+			cfg.NewNetwork = 1;
 		}
-		else
+		else if (sCh[0] != 'n' && sCh[0] != 'N')
 		{
 			consolePrint("Incorrect input please type y or n\n");
 		}
 	} while (sCh[0] != 'y' && sCh[0] != 'Y' && sCh[0] != 'n' && sCh[0] != 'N');
 
-	if (status != MT_RPC_SUCCESS)
-	{
-		dbg_print(PRINT_LEVEL_WARNING, "network start failed\n");
-		return -1;
-	}
-	consolePrint("Resetting ZNP\n");
-	ResetReqFormat_t resReq;
-	resReq.Type = 1;
-	sysResetReq(&resReq);
-	//flush the rsp
-	rpcWaitMqClientMsg(5000);
-
-	if (newNwk)
+	if (cfg.NewNetwork)
 	{
 #ifndef CC26xx
 		consolePrint(
@@ -542,106 +473,45 @@ static int32_t startNetwork(void)
 		{
 		case 'c':
 		case 'C':
-			devType = DEVICETYPE_COORDINATOR;
+			cfg.DevType = DEVICETYPE_COORDINATOR;
 			break;
 		case 'r':
 		case 'R':
-			devType = DEVICETYPE_ROUTER;
+			cfg.DevType = DEVICETYPE_ROUTER;
 			break;
 		case 'e':
 		case 'E':
 		default:
-			devType = DEVICETYPE_ENDDEVICE;
+			cfg.DevType = DEVICETYPE_ENDDEVICE;
 			break;
 		}
-		status = setNVDevType(devType);
-
-		if (status != MT_RPC_SUCCESS)
-		{
-			dbg_print(PRINT_LEVEL_WARNING, "setNVDevType failed\n");
-			return 0;
-		}
 #endif //CC26xx
 		//Select random PAN ID for Coord and join any PAN for RTR/ED
-		status = setNVPanID(0xFFFF);
-		if (status != MT_RPC_SUCCESS)
-		{
-			dbg_print(PRINT_LEVEL_WARNING, "setNVPanID failed\n");
-			return -1;
-		}
+		cfg.PanId = 0xFFFF;
 		consolePrint("Enter channel 11-26:\n");
 		consoleGetLine(sCh, 128);
-
-		status = setNVChanList(1 << atoi(sCh));
-		if (status != MT_RPC_SUCCESS)
-		{
-			dbg_print(PRINT_LEVEL_INFO, "setNVPanID failed\n");
-			return -1;
-		}
-
-	}
-
-	registerAf();
-	consolePrint("EndPoint: 1\n");
-
-	status = zdoInit();
-	if (status == NEW_NETWORK)
-	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit NEW_NETWORK\n");
-		status = MT_RPC_SUCCESS;
-	}
-	else if (status == RESTORED_NETWORK)
-	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit RESTORED_NETWORK\n");
-		status = MT_RPC_SUCCESS;
-	}
-	else
-	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit failed\n");
-		status = -1;
+		cfg.ChanList = 1 << atoi(sCh);
 	}
 
-	dbg_print(PRINT_LEVEL_INFO, "process zdoStatechange callbacks\n");
-
-	//flush AREQ ZDO State Change messages
-	while (status != -1)
-	{
-		status = rpcWaitMqClientMsg(5000);
+	cfg.EndpointCount = 1;
+	setAfEndpoint(&cfg.Endpoints[0]);
 
-		if (((devType == DEVICETYPE_COORDINATOR) && (devState == DEV_ZB_COORD))
-		        || ((devType == DEVICETYPE_ROUTER) && (devState == DEV_ROUTER))
-		        || ((devType == DEVICETYPE_ENDDEVICE)
-		                && (devState == DEV_END_DEVICE)))
-		{
-			break;
-		}
-	}
-	//set startup option back to keep configuration in case of reset
-	status = setNVStartup(0);
-	if (devState < DEV_END_DEVICE)
-	{
-		//start network failed
-		return -1;
-	}
+	nwkStartInit(&nwk, &cfg);
+	status = nwkStartRun(&nwk);
+	nwkStartPrintTimes(&nwk);
 
-	return 0;
+	return status;
 }
-static int32_t registerAf(void)
+static void setAfEndpoint(RegisterFormat_t *reg)
 {
-	int32_t status = 0;
-	RegisterFormat_t reg;
-
-	reg.EndPoint = 1;
-	reg.AppProfId = 0x0104;
-	reg.AppDeviceId = 0x0100;
-	reg.AppDevVer = 1;
-	reg.LatencyReq = 0;
-	reg.AppNumInClusters = 1;
-	reg.AppInClusterList[0] = 0x0006;
-	reg.AppNumOutClusters = 0;
-
-	status = afRegister(&reg);
-	return status;
+	reg->EndPoint = 1;
+	reg->AppProfId = 0x0104;
+	reg->AppDeviceId = 0x0100;
+	reg->AppDevVer = 1;
+	reg->LatencyReq = 0;
+	reg->AppNumInClusters = 1;
+	reg->AppInClusterList[0] = 0x0006;
+	reg->AppNumOutClusters = 0;
 }
 
 static void displayDevices(void)
@@ -707,6 +577,7 @@ uint32_t appInit(void)
 {
 	int32_t status = 0;
 	uint32_t msgCnt = 0;
+	devInterviewCfg_t ivCfg;
 
 	//Flush all messages from the que
 	while (status != -1)
@@ -725,6 +596,16 @@ uint32_t appInit(void)
 	zdoRegisterCallbacks(mtZdoCb);
 	afRegisterCallbacks(mtAfCb);
 
+	//keep the interviewed devices across restarts if requested
+	if (getenv("ZNP_DEVDB") != NULL)
+	{
+		devDbOpen(getenv("ZNP_DEVDB"), 0);
+	}
+
+	//interview the devices that announce themselves
+	memset(&ivCfg, 0, sizeof(ivCfg));
+	devInterviewInit(&ivCfg, devInterviewReadyCb);
+
 	return 0;
 }
 uint8_t initDone = 0;
@@ -769,7 +650,7 @@ void* appProcess(void *argument)
 	nvWrite.Offset = 0;
 	nvWrite.Len = 1;
 	nvWrite.Value[0] = 1;
-	status = sysOsalNvWrite(&nvWrite);
+	status = nvCacheWrite(nvWrite.Id, nvWrite.Value, nvWrite.Len);
 
 	char cmd[128];
 	int attget;
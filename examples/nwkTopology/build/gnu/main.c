@@ -38,11 +38,14 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 
 #include "rpc.h"
 #include "nwkTopology.h"
 
 #include "dbgPrint.h"
+#include "rpcMetrics.h"
+#include "rpcTrace.h"
 
 void *rpcTask(void *argument)
 {
@@ -66,6 +69,8 @@ int main(int argc, char* argv[])
 {
 	//int retval = 0;
 	char * selected_serial_port;
+	sigset_t traceSigs;
+	int traceSig;
 	pthread_t rpcThread, appThread;
 
 	dbg_print(PRINT_LEVEL_INFO, "%s -- %s %s\n", argv[0], __DATE__, __TIME__);
@@ -95,6 +100,24 @@ int main(int argc, char* argv[])
 	//init the rpc que client
 	//rpcInitMqClient();
 	rpcInitMq();
+
+	//enable frame tracing if requested, SIGUSR1 dumps the trace. The
+	//signal is blocked before any thread is created so that only the
+	//main thread receives it
+	sigemptyset(&traceSigs);
+	sigaddset(&traceSigs, SIGUSR1);
+	if (getenv("ZNP_TRACE") != NULL)
+	{
+		pthread_sigmask(SIG_BLOCK, &traceSigs, NULL);
+		rpcTraceEnable(1);
+	}
+
+	//start the metrics exporter if requested
+	if (getenv("ZNP_METRICS") != NULL)
+	{
+		rpcMetricsExportStart(getenv("ZNP_METRICS"),
+		        RPC_METRICS_EXPORT_PERIOD_MS);
+	}
 	//init the application thread to register the callbacks
 	appInit();
 
@@ -107,6 +130,12 @@ int main(int argc, char* argv[])
 	pthread_create(&appThread, NULL, appTask, NULL);
 
 	while (1)
-		;
+	{
+		if (rpcTraceIsEnabled() && (sigwait(&traceSigs, &traceSig) == 0))
+		{
+			rpcTraceDump(getenv("ZNP_TRACE"));
+			rpcTracePrintStats();
+		}
+	}
 
 }
@@ -46,6 +46,11 @@
 
 #include "rpc.h"
 #include "mtSys.h"
+#include "nvCache.h"
+#include "nwkStart.h"
+#include "nodeReg.h"
+#include "topoCrawl.h"
+#include "tblHarvest.h"
 #include "mtZdo.h"
 #include "mtAf.h"
 #include "mtParser.h"
@@ -58,9 +63,6 @@
  * MACROS
  */
 
-#define MAX_CHILDREN 20
-#define MAX_NODE_LIST 64
-
 /*********************************************************************
  * TYPES
  */
@@ -94,12 +96,8 @@ static uint8_t mtZdoMgmtLqiRspCb(MgmtLqiRspFormat_t *msg);
 static uint8_t mtSysResetIndCb(ResetIndFormat_t *msg);
 
 //helper functions
-static uint8_t setNVStartup(uint8_t startupOption);
-static uint8_t setNVChanList(uint32_t chanList);
-static uint8_t setNVPanID(uint32_t panId);
-static uint8_t setNVDevType(uint8_t devType);
 static int32_t startNetwork(void);
-static int32_t registerAf(void);
+static void setAfEndpoint(RegisterFormat_t *reg);
 
 /*********************************************************************
  * CALLBACK FUNCTIONS
@@ -146,23 +144,12 @@ static mtZdoCb_t mtZdoCb =
 	        NULL,  //MT_ZDO_MATCH_DESC_RSP_SENT
 	        NULL, NULL };
 
-typedef struct
-{
-	uint16_t ChildAddr;
-	uint8_t Type;
+// graph of the network, updated by every discovery
+static topoCrawl_t topo;
 
-} ChildNode_t;
+// routing tables of the routers, refreshed after every discovery
+static tblHarvest_t tables;
 
-typedef struct
-{
-	uint16_t NodeAddr;
-	uint8_t Type;
-	uint8_t ChildCount;
-	ChildNode_t childs[MAX_CHILDREN];
-} Node_t;
-
-Node_t nodeList[MAX_NODE_LIST];
-uint8_t nodeCount = 0;
 static uint8_t mtSysResetIndCb(ResetIndFormat_t *msg)
 {
 
@@ -244,168 +231,126 @@ static uint8_t mtZdoStateChangeIndCb(uint8_t newDevState)
 
 static uint8_t mtZdoMgmtLqiRspCb(MgmtLqiRspFormat_t *msg)
 {
-	uint8_t devType = 0;
-	uint8_t devRelation = 0;
-	uint8_t localNodeCount = nodeCount;
-	MgmtLqiReqFormat_t req;
-
-	if (msg->Status == MT_RPC_SUCCESS)
-	{
-		nodeCount++;
-		nodeList[localNodeCount].NodeAddr = msg->SrcAddr;
-		nodeList[localNodeCount].Type = (msg->SrcAddr == 0 ?
-		DEVICETYPE_COORDINATOR :
-		                                                DEVICETYPE_ROUTER);
-		nodeList[localNodeCount].ChildCount = 0;
-		uint32_t i;
-		for (i = 0; i < msg->NeighborLqiListCount; i++)
-		{
-			devType = msg->NeighborLqiList[i].DevTyp_RxOnWhenIdle_Relat & 3;
-			devRelation = ((msg->NeighborLqiList[i].DevTyp_RxOnWhenIdle_Relat
-			        >> 4) & 7);
-			if (devRelation == 1)
-			{
-				uint8_t cCount = nodeList[localNodeCount].ChildCount;
-				nodeList[localNodeCount].childs[cCount].ChildAddr =
-				        msg->NeighborLqiList[i].NetworkAddress;
-				nodeList[localNodeCount].childs[cCount].Type = devType;
-				nodeList[localNodeCount].ChildCount++;
-				if (devType == DEVICETYPE_ROUTER)
-				{
-					req.DstAddr = msg->NeighborLqiList[i].NetworkAddress;
-					req.StartIndex = 0;
-					zdoMgmtLqiReq(&req);
-				}
-			}
-		}
-	}
-	else
+	//the topology crawler merges the neighbor tables, only report errors
+	if (msg->Status != MT_RPC_SUCCESS)
 	{
-		consolePrint("MgmtLqiRsp Status: FAIL 0x%02X\n", msg->Status);
+		consolePrint("MgmtLqiRsp from 0x%04X Status: FAIL 0x%02X\n",
+		        msg->SrcAddr, msg->Status);
 	}
 
 	return msg->Status;
 }
 
-// helper functions for building and sending the NV messages
-static uint8_t setNVStartup(uint8_t startupOption)
+/*********************************************************************
+ * @fn      printRouteChanges
+ *
+ * @brief   reads the routing tables of the routers found by the last
+ *          discovery and prints the routes whose next hop changed
+ *
+ * @return  none
+ */
+static void printRouteChanges(void)
 {
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-	// sending startup option
-
-	nvWrite.Id = ZCD_NV_STARTUP_OPTION;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 1;
-	nvWrite.Value[0] = startupOption;
-	status = sysOsalNvWrite(&nvWrite);
-	dbg_print(PRINT_LEVEL_INFO, "\n");
+	uint32_t nI;
+	uint32_t rI;
 
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Startup Option cmd sent[%d]...\n",
-	        status);
-
-	return status;
-}
+	for (nI = 0; nI < topo.NodeCount; nI++)
+	{
+		topoCrawlNode_t *node = &topo.Nodes[nI];
+		if ((node->Round == topo.Round) && (node->Type != DEVICETYPE_ENDDEVICE))
+		{
+			tblHarvestAddRouter(&tables, node->NwkAddr);
+		}
+	}
 
-static uint8_t setNVDevType(uint8_t devType)
-{
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-	// setting dev type
-	nvWrite.Id = ZCD_NV_LOGICAL_TYPE;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 1;
-	nvWrite.Value[0] = devType;
-	status = sysOsalNvWrite(&nvWrite);
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Device Type cmd sent... [%d]\n",
-	        status);
+	tblHarvestRun(&tables);
+	consolePrint("Routing tables: %d read, %d unchanged, %d next hop changes\n",
+	        tables.Stats.Reads, tables.Stats.Unchanged,
+	        tables.Stats.RouteChanges);
 
-	return status;
+	for (rI = 0; rI < tables.RouterCount; rI++)
+	{
+		tblHarvestRouter_t *router = &tables.Routers[rI];
+		uint32_t eI;
+		for (eI = 0; eI < router->Rtg.Count; eI++)
+		{
+			tblHarvestRoute_t *route = &router->Routes[eI];
+			if (route->Changes)
+			{
+				consolePrint(
+				        "\tRouter 0x%04X  Dst 0x%04X  NextHop 0x%04X  Changes %d\n",
+				        router->NwkAddr, route->DstAddr, route->NextHop,
+				        route->Changes);
+			}
+		}
+	}
+	consolePrint("\n");
 }
 
-static uint8_t setNVPanID(uint32_t panId)
+/*********************************************************************
+ * @fn      exportTopology
+ *
+ * @brief   writes the topology to the file named by ZNP_TOPO, as Graphviz
+ *          if the name ends in .dot, else as JSON
+ *
+ * @return  none
+ */
+static void exportTopology(void)
 {
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write PAN ID cmd sending...\n");
+	const char *path = getenv("ZNP_TOPO");
+	size_t len;
+	FILE *out;
 
-	nvWrite.Id = ZCD_NV_PANID;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 2;
-	nvWrite.Value[0] = LO_UINT16(panId);
-	nvWrite.Value[1] = HI_UINT16(panId);
-	status = sysOsalNvWrite(&nvWrite);
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write PAN ID cmd sent...[%d]\n", status);
-
-	return status;
-}
-
-static uint8_t setNVChanList(uint32_t chanList)
-{
-	OsalNvWriteFormat_t nvWrite;
-	uint8_t status;
-	// setting chanList
-	nvWrite.Id = ZCD_NV_CHANLIST;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 4;
-	nvWrite.Value[0] = BREAK_UINT32(chanList, 0);
-	nvWrite.Value[1] = BREAK_UINT32(chanList, 1);
-	nvWrite.Value[2] = BREAK_UINT32(chanList, 2);
-	nvWrite.Value[3] = BREAK_UINT32(chanList, 3);
-	status = sysOsalNvWrite(&nvWrite);
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Channel List cmd sent...[%d]\n",
-	        status);
+	if (path == NULL)
+	{
+		return;
+	}
+	out = fopen(path, "w");
+	if (out == NULL)
+	{
+		consolePrint("Could not write %s\n", path);
+		return;
+	}
 
-	return status;
+	len = strlen(path);
+	if ((len > 4) && (strcmp(&path[len - 4], ".dot") == 0))
+	{
+		topoCrawlExportDot(&topo, out);
+	}
+	else
+	{
+		topoCrawlExportJson(&topo, out);
+	}
+	fclose(out);
+	consolePrint("Topology written to %s\n", path);
 }
 
 static int32_t startNetwork(void)
 {
 	char cDevType;
-	uint8_t devType;
+	nwkStartCfg_t cfg;
+	nwkStart_t nwk;
 	int32_t status;
-	uint8_t newNwk = 0;
 	char sCh[128];
 
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.DevType = NWK_START_DEVTYPE_NV;
+
 	do
 	{
 		consolePrint("Do you wish to start/join a new network? (y/n)\n");
 		consoleGetLine(sCh, 128);
-		if (sCh[0] == 'n' || sCh[0] == 'N')
+		if (sCh[0] == 'y' || sCh[0] == 'Y')
 		{
-			status = setNVStartup(0);
+			cfg.NewNetwork = 1;
 		}
-		else if (sCh[0] == 'y' || sCh[0] == 'Y')
-		{
-			status = setNVStartup(
-			ZCD_STARTOPT_CLEAR_STATE | ZCD_STARTOPT_CLEAR_CONFIG);
-			newNwk = 1;
-
-		}
-		else
+		else if (sCh[0] != 'n' && sCh[0] != 'N')
 		{
 			consolePrint("Incorrect input please type y or n\n");
 		}
 	} while (sCh[0] != 'y' && sCh[0] != 'Y' && sCh[0] != 'n' && sCh[0] != 'N');
 
-	if (status != MT_RPC_SUCCESS)
-	{
-		dbg_print(PRINT_LEVEL_WARNING, "network start failed\n");
-		return -1;
-	}
-	consolePrint("Resetting ZNP\n");
-	ResetReqFormat_t resReq;
-	resReq.Type = 1;
-	sysResetReq(&resReq);
-	//flush the rsp
-	rpcWaitMqClientMsg(5000);
-
-	if (newNwk)
+	if (cfg.NewNetwork)
 	{
 #ifndef CC26xx
 		consolePrint(
@@ -417,107 +362,46 @@ static int32_t startNetwork(void)
 		{
 		case 'c':
 		case 'C':
-			devType = DEVICETYPE_COORDINATOR;
+			cfg.DevType = DEVICETYPE_COORDINATOR;
 			break;
 		case 'r':
 		case 'R':
-			devType = DEVICETYPE_ROUTER;
+			cfg.DevType = DEVICETYPE_ROUTER;
 			break;
 		case 'e':
 		case 'E':
 		default:
-			devType = DEVICETYPE_ENDDEVICE;
+			cfg.DevType = DEVICETYPE_ENDDEVICE;
 			break;
 		}
-		status = setNVDevType(devType);
-
-		if (status != MT_RPC_SUCCESS)
-		{
-			dbg_print(PRINT_LEVEL_WARNING, "setNVDevType failed\n");
-			return 0;
-		}
 #endif //CC26xx
 		//Select random PAN ID for Coord and join any PAN for RTR/ED
-		status = setNVPanID(0xFFFF);
-		if (status != MT_RPC_SUCCESS)
-		{
-			dbg_print(PRINT_LEVEL_WARNING, "setNVPanID failed\n");
-			return -1;
-		}
+		cfg.PanId = 0xFFFF;
 		consolePrint("Enter channel 11-26:\n");
 		consoleGetLine(sCh, 128);
-
-		status = setNVChanList(1 << atoi(sCh));
-		if (status != MT_RPC_SUCCESS)
-		{
-			dbg_print(PRINT_LEVEL_INFO, "setNVPanID failed\n");
-			return -1;
-		}
-
-	}
-
-	registerAf();
-	consolePrint("EndPoint: 1\n");
-
-	status = zdoInit();
-	if (status == NEW_NETWORK)
-	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit NEW_NETWORK\n");
-		status = MT_RPC_SUCCESS;
-	}
-	else if (status == RESTORED_NETWORK)
-	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit RESTORED_NETWORK\n");
-		status = MT_RPC_SUCCESS;
-	}
-	else
-	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit failed\n");
-		status = -1;
+		cfg.ChanList = 1 << atoi(sCh);
 	}
 
-	dbg_print(PRINT_LEVEL_INFO, "process zdoStatechange callbacks\n");
+	cfg.EndpointCount = 1;
+	setAfEndpoint(&cfg.Endpoints[0]);
 
-	//flush AREQ ZDO State Change messages
-	while (status != -1)
-	{
-		status = rpcWaitMqClientMsg(5000);
+	nwkStartInit(&nwk, &cfg);
+	status = nwkStartRun(&nwk);
+	nwkStartPrintTimes(&nwk);
 
-		if (((devType == DEVICETYPE_COORDINATOR) && (devState == DEV_ZB_COORD))
-		        || ((devType == DEVICETYPE_ROUTER) && (devState == DEV_ROUTER))
-		        || ((devType == DEVICETYPE_ENDDEVICE)
-		                && (devState == DEV_END_DEVICE)))
-		{
-			break;
-		}
-	}
-	//set startup option back to keep configuration in case of reset
-	status = setNVStartup(0);
-	if (devState < DEV_END_DEVICE)
-	{
-		//start network failed
-		return -1;
-	}
-
-	return 0;
+	return status;
 }
 
-static int32_t registerAf(void)
+static void setAfEndpoint(RegisterFormat_t *reg)
 {
-	int32_t status = 0;
-	RegisterFormat_t reg;
-
-	reg.EndPoint = 1;
-	reg.AppProfId = 0x0104;
-	reg.AppDeviceId = 0x0100;
-	reg.AppDevVer = 1;
-	reg.LatencyReq = 0;
-	reg.AppNumInClusters = 1;
-	reg.AppInClusterList[0] = 0x0006;
-	reg.AppNumOutClusters = 0;
-
-	status = afRegister(&reg);
-	return status;
+	reg->EndPoint = 1;
+	reg->AppProfId = 0x0104;
+	reg->AppDeviceId = 0x0100;
+	reg->AppDevVer = 1;
+	reg->LatencyReq = 0;
+	reg->AppNumInClusters = 1;
+	reg->AppInClusterList[0] = 0x0006;
+	reg->AppNumOutClusters = 0;
 }
 
 /*********************************************************************
@@ -544,6 +428,16 @@ uint32_t appInit(void)
 	sysRegisterCallbacks(mtSysCb);
 	zdoRegisterCallbacks(mtZdoCb);
 
+	//the crawler feeds the node registry with the neighbor addresses
+	nodeRegInit(0);
+	topoCrawlCfg_t crawlCfg;
+	memset(&crawlCfg, 0, sizeof(crawlCfg));
+	topoCrawlInit(&topo, &crawlCfg);
+	tblHarvestCfg_t harvestCfg;
+	memset(&harvestCfg, 0, sizeof(harvestCfg));
+	harvestCfg.Tables = TBL_HARVEST_RTG;
+	tblHarvestInit(&tables, &harvestCfg);
+
 	return 0;
 }
 
@@ -577,49 +471,62 @@ void* appProcess(void *argument)
 	nvWrite.Offset = 0;
 	nvWrite.Len = 1;
 	nvWrite.Value[0] = 1;
-	status = sysOsalNvWrite(&nvWrite);
+	status = nvCacheWrite(nvWrite.Id, nvWrite.Value, nvWrite.Len);
 	status = 0;
 	char cmd[128];
-	MgmtLqiReqFormat_t req;
-	req.DstAddr = 0;
-	req.StartIndex = 0;
 	while (1)
 	{
 		consolePrint("Press Enter to discover Network Topology:\n");
 
 		consoleGetLine(cmd, 128);
-		nodeCount = 0;
 
-		zdoMgmtLqiReq(&req);
-		while (status != -1)
+		status = topoCrawlRun(&topo);
+		consolePrint("Discovered %d nodes in %d ms, %d requests, %d retries\n",
+		        topo.NodeCount, (int) (topo.Stats.ElapsedUs / 1000),
+		        topo.Stats.Requests, topo.Stats.Retries);
+		if (status != 0)
 		{
-			status = rpcWaitMqClientMsg(1000);
+			consolePrint("%d routers did not answer\n", topo.Stats.Failed);
 		}
-		status = 0;
-		uint8_t i;
-		for (i = 0; i < nodeCount; i++)
+
+		uint32_t nI;
+		for (nI = 0; nI < topo.NodeCount; nI++)
 		{
+			topoCrawlNode_t *node = &topo.Nodes[nI];
+			if ((node->Round != topo.Round)
+			        || (node->Type == DEVICETYPE_ENDDEVICE))
+			{
+				continue;
+			}
+
 			char *devtype = (
-			        nodeList[i].Type == DEVICETYPE_ROUTER ?
-			                "ROUTER" : "END DEVICE");
-			if (nodeList[i].Type == DEVICETYPE_COORDINATOR)
+			        node->Type == DEVICETYPE_ROUTER ? "ROUTER" : "END DEVICE");
+			if (node->Type == DEVICETYPE_COORDINATOR)
 			{
 				devtype = "COORDINATOR";
 			}
-			consolePrint("Node Address: 0x%04X   Type: %s\n",
-			        nodeList[i].NodeAddr, devtype);
+			consolePrint("Node Address: 0x%04X   Type: %s   Depth: %d\n",
+			        node->NwkAddr, devtype, node->Depth);
 
-			consolePrint("Children: %d\n", nodeList[i].ChildCount);
-			uint8_t cI;
-			for (cI = 0; cI < nodeList[i].ChildCount; cI++)
+			uint32_t lI;
+			for (lI = node->FirstLink; lI; lI = topo.Links[lI - 1].Next)
 			{
-				uint8_t type = nodeList[i].childs[cI].Type;
-				consolePrint("\tAddress: 0x%04X   Type: %s\n",
-				        nodeList[i].childs[cI].ChildAddr,
-				        (type == DEVICETYPE_ROUTER ? "ROUTER" : "END DEVICE"));
+				topoCrawlLink_t *link = &topo.Links[lI - 1];
+				uint8_t type = topo.Nodes[link->To].Type;
+				if ((link->Round != topo.Round) || (link->Relation != 1))
+				{
+					continue;
+				}
+				consolePrint("\tChild Address: 0x%04X   Type: %s   LQI: %d\n",
+				        topo.Nodes[link->To].NwkAddr,
+				        (type == DEVICETYPE_ROUTER ? "ROUTER" : "END DEVICE"),
+				        link->Lqi);
 			}
 			consolePrint("\n");
 		}
+
+		exportTopology();
+		printRouteChanges();
 	}
 	return 0;
 }
@@ -46,6 +46,9 @@
 
 #include "rpc.h"
 #include "mtSys.h"
+#include "nvCache.h"
+#include "nwkStart.h"
+#include "svcCache.h"
 #include "mtZdo.h"
 #include "mtAf.h"
 #include "mtParser.h"
@@ -58,6 +61,8 @@
  * MACROS
  */
 
+#define SERVICE_MAX_MEMBERS (64)
+
 /*********************************************************************
  * TYPES
  */
@@ -85,12 +90,9 @@ static uint8_t mtZdoEndDeviceAnnceIndCb(EndDeviceAnnceIndFormat_t *msg);
 static uint8_t mtSysResetIndCb(ResetIndFormat_t *msg);
 
 //helper functions
-static uint8_t setNVStartup(uint8_t startupOption);
-static uint8_t setNVChanList(uint32_t chanList);
-static uint8_t setNVPanID(uint32_t panId);
-static uint8_t setNVDevType(uint8_t devType);
 static int32_t startNetwork(void);
-static int32_t registerAf(void);
+static void setAfEndpoint(RegisterFormat_t *reg);
+static void findService(uint16_t profileId, uint16_t clusterId);
 
 /*********************************************************************
  * CALLBACK FUNCTIONS
@@ -280,127 +282,32 @@ static uint8_t mtZdoEndDeviceAnnceIndCb(EndDeviceAnnceIndFormat_t *msg)
 	return 0;
 }
 
-// helper functions for building and sending the NV messages
-static uint8_t setNVStartup(uint8_t startupOption)
-{
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-
-	// sending startup option
-	nvWrite.Id = ZCD_NV_STARTUP_OPTION;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 1;
-	nvWrite.Value[0] = startupOption;
-	status = sysOsalNvWrite(&nvWrite);
-
-	dbg_print(PRINT_LEVEL_INFO, "\nNV Write Startup Option cmd sent[%d]...\n",
-	        status);
-
-	return status;
-}
-
-static uint8_t setNVDevType(uint8_t devType)
-{
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-
-	// setting dev type
-	nvWrite.Id = ZCD_NV_LOGICAL_TYPE;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 1;
-	nvWrite.Value[0] = devType;
-	status = sysOsalNvWrite(&nvWrite);
-
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Device Type cmd sent... [%d]\n",
-	        status);
-
-	return status;
-}
-
-static uint8_t setNVPanID(uint32_t panId)
-{
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-
-	dbg_print(PRINT_LEVEL_INFO, "\nNV Write PAN ID cmd sending...\n");
-
-	nvWrite.Id = ZCD_NV_PANID;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 2;
-	nvWrite.Value[0] = LO_UINT16(panId);
-	nvWrite.Value[1] = HI_UINT16(panId);
-	status = sysOsalNvWrite(&nvWrite);
-
-	dbg_print(PRINT_LEVEL_INFO, "\nNV Write PAN ID cmd sent...[%d]\n", status);
-
-	return status;
-}
-
-static uint8_t setNVChanList(uint32_t chanList)
-{
-	OsalNvWriteFormat_t nvWrite;
-	uint8_t status;
-
-	// setting chanList
-	nvWrite.Id = ZCD_NV_CHANLIST;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 4;
-	nvWrite.Value[0] = BREAK_UINT32(chanList, 0);
-	nvWrite.Value[1] = BREAK_UINT32(chanList, 1);
-	nvWrite.Value[2] = BREAK_UINT32(chanList, 2);
-	nvWrite.Value[3] = BREAK_UINT32(chanList, 3);
-	status = sysOsalNvWrite(&nvWrite);
-
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Channel List cmd sent...[%d]\n",
-	        status);
-
-	return status;
-}
-
 static int32_t startNetwork(void)
 {
 	char cDevType;
-	uint8_t devType;
+	nwkStartCfg_t cfg;
+	nwkStart_t nwk;
 	int32_t status;
-	uint8_t newNwk = 0;
 	char sCh[128];
 
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.DevType = NWK_START_DEVTYPE_NV;
+
 	do
 	{
 		consolePrint("Do you wish to start/join a new network? (y/n)\n");
 		consoleGetLine(sCh, 128);
-		if (sCh[0] == 'n' || sCh[0] == 'N')
+		if (sCh[0] == 'y' || sCh[0] == 'Y')
 		{
-			status = setNVStartup(0);
+			cfg.NewNetwork = 1;
 		}
-		else if (sCh[0] == 'y' || sCh[0] == 'Y')
-		{
-			status = setNVStartup(
-			ZCD_STARTOPT_CLEAR_STATE | ZCD_STARTOPT_CLEAR_CONFIG);
-			newNwk = 1;
-
-		}
-		else
+		else if (sCh[0] != 'n' && sCh[0] != 'N')
 		{
 			consolePrint("Incorrect input please type y or n\n");
 		}
 	} while (sCh[0] != 'y' && sCh[0] != 'Y' && sCh[0] != 'n' && sCh[0] != 'N');
 
-	if (status != MT_RPC_SUCCESS)
-	{
-		dbg_print(PRINT_LEVEL_WARNING, "network start failed\n");
-		return -1;
-	}
-	consolePrint("Resetting ZNP\n");
-	ResetReqFormat_t resReq;
-	resReq.Type = 1;
-	sysResetReq(&resReq);
-	//flush the rsp
-	rpcWaitMqClientMsg(5000);
-
-	if (newNwk)
+	if (cfg.NewNetwork)
 	{
 #ifndef CC26xx
 		consolePrint(
@@ -412,108 +319,91 @@ static int32_t startNetwork(void)
 		{
 		case 'c':
 		case 'C':
-			devType = DEVICETYPE_COORDINATOR;
+			cfg.DevType = DEVICETYPE_COORDINATOR;
 			break;
 		case 'r':
 		case 'R':
-			devType = DEVICETYPE_ROUTER;
+			cfg.DevType = DEVICETYPE_ROUTER;
 			break;
 		case 'e':
 		case 'E':
 		default:
-			devType = DEVICETYPE_ENDDEVICE;
+			cfg.DevType = DEVICETYPE_ENDDEVICE;
 			break;
 		}
-		status = setNVDevType(devType);
-
-		if (status != MT_RPC_SUCCESS)
-		{
-			dbg_print(PRINT_LEVEL_WARNING, "setNVDevType failed\n");
-			return 0;
-		}
 #endif //CC26xx
-
 		//Select random PAN ID for Coord and join any PAN for RTR/ED
-		status = setNVPanID(0xFFFF);
-		if (status != MT_RPC_SUCCESS)
-		{
-			dbg_print(PRINT_LEVEL_WARNING, "setNVPanID failed\n");
-			return -1;
-		}
+		cfg.PanId = 0xFFFF;
 		consolePrint("Enter channel 11-26:\n");
 		consoleGetLine(sCh, 128);
+		cfg.ChanList = 1 << atoi(sCh);
+	}
 
-		status = setNVChanList(1 << atoi(sCh));
-		if (status != MT_RPC_SUCCESS)
-		{
-			dbg_print(PRINT_LEVEL_INFO, "setNVPanID failed\n");
-			return -1;
-		}
+	cfg.EndpointCount = 1;
+	setAfEndpoint(&cfg.Endpoints[0]);
 
-	}
+	nwkStartInit(&nwk, &cfg);
+	status = nwkStartRun(&nwk);
+	nwkStartPrintTimes(&nwk);
 
-	registerAf();
-	consolePrint("EndPoint: 1\n");
+	return status;
+}
 
-	status = zdoInit();
-	if (status == NEW_NETWORK)
-	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit NEW_NETWORK\n");
-		status = MT_RPC_SUCCESS;
-	}
-	else if (status == RESTORED_NETWORK)
+static void setAfEndpoint(RegisterFormat_t *reg)
+{
+	reg->EndPoint = 1;
+	reg->AppProfId = 0x0104;
+	reg->AppDeviceId = 0x0100;
+	reg->AppDevVer = 1;
+	reg->LatencyReq = 0;
+	reg->AppNumInClusters = 1;
+	reg->AppInClusterList[0] = 0x0006;
+	reg->AppNumOutClusters = 0;
+}
+
+/********************************************************************
+ * @fn     findService
+ *
+ * @brief  lists the endpoints implementing a server cluster. Fresh
+ *         results come from the service discovery cache without any
+ *         request, others are discovered with a Match_Desc_req.
+ *
+ * @param  profileId - profile
+ * @param  clusterId - server cluster
+ *
+ * @return none
+ */
+static void findService(uint16_t profileId, uint16_t clusterId)
+{
+	svcCacheMember_t members[SERVICE_MAX_MEMBERS];
+	uint32_t count;
+	int32_t status;
+	uint32_t i;
+
+	status = svcCacheLookup(profileId, clusterId, members, SERVICE_MAX_MEMBERS,
+	        &count);
+	if (status == SVC_CACHE_FRESH)
 	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit RESTORED_NETWORK\n");
-		status = MT_RPC_SUCCESS;
+		consolePrint("From cache, no request sent:\n");
 	}
 	else
 	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit failed\n");
-		status = -1;
-	}
-
-	dbg_print(PRINT_LEVEL_INFO, "process zdoStatechange callbacks\n");
-
-	//flush AREQ ZDO State Change messages
-	while (status != -1)
-	{
-		status = rpcWaitMqClientMsg(5000);
-
-		if (((devType == DEVICETYPE_COORDINATOR) && (devState == DEV_ZB_COORD))
-		        || ((devType == DEVICETYPE_ROUTER) && (devState == DEV_ROUTER))
-		        || ((devType == DEVICETYPE_ENDDEVICE)
-		                && (devState == DEV_END_DEVICE)))
+		consolePrint("Discovering profile 0x%04X cluster 0x%04X\n", profileId,
+		        clusterId);
+		while (svcCachePoll() != 0)
 		{
-			break;
+			rpcWaitMqClientMsg(50);
 		}
+		status = svcCacheLookup(profileId, clusterId, members,
+		        SERVICE_MAX_MEMBERS, &count);
 	}
-	//set startup option back to keep configuration in case of reset
-	status = setNVStartup(0);
-	if (devState < DEV_END_DEVICE)
+
+	consolePrint("%d endpoints found\n", count);
+	for (i = 0; (i < count) && (i < SERVICE_MAX_MEMBERS); i++)
 	{
-		//start network failed
-		return -1;
+		consolePrint("\tNwkAddr: 0x%04X Endpoint: 0x%02X\n",
+		        members[i].NwkAddr, members[i].Endpoint);
 	}
-
-	return 0;
-}
-
-static int32_t registerAf(void)
-{
-	int32_t status = 0;
-	RegisterFormat_t reg;
-
-	reg.EndPoint = 1;
-	reg.AppProfId = 0x0104;
-	reg.AppDeviceId = 0x0100;
-	reg.AppDevVer = 1;
-	reg.LatencyReq = 0;
-	reg.AppNumInClusters = 1;
-	reg.AppInClusterList[0] = 0x0006;
-	reg.AppNumOutClusters = 0;
-
-	status = afRegister(&reg);
-	return status;
 }
 
 /*********************************************************************
@@ -523,6 +413,7 @@ uint32_t appInit(void)
 {
 	int32_t status = 0;
 	uint32_t msgCnt = 0;
+	svcCacheCfg_t svcCfg;
 
 	//Flush all messages from the que
 	while (status != -1)
@@ -540,12 +431,19 @@ uint32_t appInit(void)
 	sysRegisterCallbacks(mtSysCb);
 	zdoRegisterCallbacks(mtZdoCb);
 
+	//keep the discovered services across restarts if requested
+	memset(&svcCfg, 0, sizeof(svcCfg));
+	svcCfg.Path = getenv("ZNP_SVCCACHE");
+	svcCacheInit(&svcCfg);
+
 	return 0;
 }
 
 void* appProcess(void *argument)
 {
 	int32_t status = 0;
+	unsigned int profileId, clusterId;
+	char sCh[128];
 	//Flush all messages from the que
 	while (status != -1)
 	{
@@ -574,11 +472,23 @@ void* appProcess(void *argument)
 	nvWrite.Offset = 0;
 	nvWrite.Len = 1;
 	nvWrite.Value[0] = 1;
-	status = sysOsalNvWrite(&nvWrite);
+	status = nvCacheWrite(nvWrite.Id, nvWrite.Value, nvWrite.Len);
 
 	while (1)
 	{
-		status = rpcWaitMqClientMsg(1000);
+		consolePrint("Enter profile and server cluster to find (hex, e.g. 0104 0006):\n");
+		consoleGetLine(sCh, 128);
+		if (sscanf(sCh, "%x %x", &profileId, &clusterId) == 2)
+		{
+			findService(profileId, clusterId);
+		}
+
+		//process the announces and refreshes received meanwhile
+		do
+		{
+			status = rpcWaitMqClientMsg(50);
+			svcCachePoll();
+		} while (status != -1);
 	}
 
 	return 0;
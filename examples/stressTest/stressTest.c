@@ -46,33 +46,48 @@
 #include <time.h>
 
 #include "rpc.h"
+#include "rpcFilter.h"
 #include "mtSys.h"
+#include "nvCache.h"
+#include "nwkStart.h"
+#include "nodeReg.h"
 #include "mtZdo.h"
 #include "mtAf.h"
 #include "mtParser.h"
 #include "rpcTransport.h"
 #include "dbgPrint.h"
 #include "hostConsole.h"
+#include "loadGen.h"
+#include "bcastGov.h"
+#include "srcRtCache.h"
+#include "evtExport.h"
 
 /*********************************************************************
  * MACROS
  */
-#define MAX_TEST_NODES      10
 #define TEST_EP             1
 #define TEST_PRIFILE        0x0104
 #define TEST_CLUSTER        0x6
+#define TEST_GROUP          0x0001
+
+//time the coordinator waits for the test nodes by default
+#define TEST_WAIT_S         60
 
 /*********************************************************************
  * TYPES
  */
+// options of the coordinator, given as key=value after the channel
 typedef struct
 {
-	uint16_t nodeAddr;
-	uint8_t txSeqNum;
-	uint8_t rxSeqNum;
-	uint32_t passCnt;
-	uint32_t errorCnt;
-} testNode_t;
+	uint32_t nodes;           // test nodes to wait for, 0 for any
+	uint32_t waitS;           // longest wait for the test nodes
+	char *out;                // result file, .json for JSON, - for stdout
+	char *export;             // event export target, NULL for none
+	uint32_t bcast;           // broadcasts in flight of the governor, 0
+	                          // to send them directly
+	uint8_t srcRt;            // send along the cached source routes
+	loadGenCfg_t gen;
+} testOpts_t;
 
 /*********************************************************************
  * LOCAL VARIABLE
@@ -80,17 +95,44 @@ typedef struct
 
 //init ZDO device state
 devStates_t devState = DEV_HOLD;
-testNode_t testNodes[MAX_TEST_NODES];
 uint16_t transId;
 
 char* cDevType;
 
+//decoded events of the run, written to opts.export
+static evtExport_t eventExport;
+
+//source routes reported during the run, used with opts.srcRt
+static srcRtCache_t srcRoutes;
+
 /***********************************************************************/
 
 void usage(char* exeName)
 {
-	consolePrint("Usage: ./%s <port>\n", exeName);
-	consolePrint("Eample: ./%s /dev/ttyACM0\n", exeName);
+	consolePrint("Usage: ./%s <port> <c|r|e> <channel> [option=value...]\n",
+	        exeName);
+	consolePrint("Options of the coordinator:\n"
+	        "  nodes=<n>        test nodes to wait for (any)\n"
+	        "  wait=<s>         longest wait for the test nodes (%d)\n"
+	        "  payload=<bytes>  payload length (%d-%d, %d)\n"
+	        "  rate=<msg/s>     open loop rate per node (closed loop)\n"
+	        "  conc=<n>         closed loop messages in flight per node (%d)\n"
+	        "  mix=<u:g:b>      unicast, group and broadcast percentages\n"
+	        "  group=<id>       group of the group messages (%d)\n"
+	        "  duration=<s>     test duration (%d)\n"
+	        "  timeout=<ms>     time allowed for an echo or confirm (%d)\n"
+	        "  bcast=<n>        group and broadcast messages sent per %d ms\n"
+	        "                   through the governor (not governed)\n"
+	        "  srcrt=<0|1>      unicast along the source routes reported (0)\n"
+	        "  out=<file>       results as CSV, JSON if .json, - for stdout\n"
+	        "  export=<target>  decoded events to a file, pipe, unix:<path>\n"
+	        "                   or - for stdout\n",
+	        TEST_WAIT_S, LOAD_GEN_MIN_PAYLOAD, LOAD_GEN_MAX_PAYLOAD,
+	        LOAD_GEN_PAYLOAD, LOAD_GEN_CONCURRENCY, TEST_GROUP,
+	        LOAD_GEN_DURATION_MS / 1000, LOAD_GEN_TIMEOUT_MS,
+	        BCAST_GOV_LIFETIME_MS);
+	consolePrint("Eample: ./%s /dev/ttyACM0 c 11 nodes=4 rate=10 out=run.json\n",
+	        exeName);
 }
 
 /*********************************************************************
@@ -108,13 +150,11 @@ static uint8_t mtAfDataConfirmCb(DataConfirmFormat_t *msg);
 static uint8_t mtAfIncomingMsgCb(IncomingMsgFormat_t *msg);
 
 //helper functions
-static uint8_t setNVStartup(uint8_t startupOption);
-static uint8_t setNVChanList(uint32_t chanList);
-static uint8_t setNVPanID(uint32_t panId);
-static uint8_t setNVDevType(uint8_t devType);
 static int32_t startNetwork(char *cDevType, char* sCh);
-static int32_t registerAf(void);
-static void sendTestMsg(uint16_t nodeAddr, uint8_t txSeqNum);
+static void setAfEndpoint(RegisterFormat_t *reg);
+static void sendTestMsg(uint16_t nodeAddr, uint8_t *data, uint8_t len);
+static int32_t parseOpts(char **args, testOpts_t *opts);
+static int32_t runTest(testOpts_t *opts);
 
 /*********************************************************************
  * CALLBACK FUNCTIONS
@@ -169,6 +209,19 @@ static mtAfCb_t mtAfCb =
 	        NULL,			    //MT_AF_REFLECT_ERROR
 	    };
 
+// AREQs the test uses, the others are dropped before they are parsed
+static const rpcFilterRule_t testFilterRules[] =
+	{
+		{ .Sys = MT_RPC_SYS_SYS },
+		{ .Sys = MT_RPC_SYS_ZDO },
+		{ .Sys = MT_RPC_SYS_AF, .Cmd1 = MT_AF_DATA_CONFIRM,
+		        .Match = RPC_FILTER_CMD1 },
+		{ .Sys = MT_RPC_SYS_AF, .Cmd1 = MT_AF_INCOMING_MSG,
+		        .Match = RPC_FILTER_CMD1 | RPC_FILTER_CLUSTER,
+		        .ClusterId = TEST_CLUSTER }, };
+
+static rpcFilter_t testFilter;
+
 /********************************************************************
  * START OF SYS CALL BACK FUNCTIONS
  */
@@ -261,21 +314,9 @@ static uint8_t mtZdoStateChangeIndCb(uint8_t newDevState)
 
 static uint8_t mtZdoEndDeviceAnnceIndCb(EndDeviceAnnceIndFormat_t *msg)
 {
-	uint32_t nodeIdx;
-	consolePrint("\nNew device joined network.\n");
-
-	//find empty slot
-	for (nodeIdx = 0; nodeIdx < MAX_TEST_NODES; nodeIdx++)
-	{
-		if (testNodes[nodeIdx].nodeAddr == 0)
-		{
-			consolePrint("found new test node: %04x \n", msg->NwkAddr);
-			testNodes[nodeIdx].txSeqNum = 0;
-			testNodes[nodeIdx].rxSeqNum = 0;
-			testNodes[nodeIdx].nodeAddr = msg->NwkAddr;
-			break;
-		}
-	}
+	//the registry has already added the node
+	consolePrint("found new test node: %04x, %d nodes\n", msg->NwkAddr,
+	        nodeRegCount());
 
 	return 0;
 }
@@ -300,39 +341,18 @@ static uint8_t mtAfDataConfirmCb(DataConfirmFormat_t *msg)
 
 static uint8_t mtAfIncomingMsgCb(IncomingMsgFormat_t *msg)
 {
-	uint32_t nodeIdx;
-
 	dbg_print(PRINT_LEVEL_INFO, "Incoming message\n");
 
-	//make sure it was a test packet
-	if ((msg->ClusterId == TEST_CLUSTER) && (msg->Len == 1))
+	//the load generator of the coordinator measures the echoes, the
+	//other devices echo the unicast test messages back
+	//the AREQ filter passes the test cluster only
+	if ((msg->Len > 0) && !msg->WasVroadcast && (msg->GroupId == 0)
+	        && (cDevType[0] != 'c') && (cDevType[0] != 'C'))
 	{
-		if ((cDevType[0] == 'c') || (cDevType[0] == 'C'))
-		{
-			//find node in list and update rxSeq
-			for (nodeIdx = 0; nodeIdx < MAX_TEST_NODES; nodeIdx++)
-			{
-				if (testNodes[nodeIdx].nodeAddr == msg->SrcAddr)
-				{
-					dbg_print(PRINT_LEVEL_INFO,
-					        "test message ack recived from node: %04x, seq: %04x\n",
-					        msg->SrcAddr, msg->Data[0]);
-					testNodes[nodeIdx].rxSeqNum = (uint32_t)(msg->Data[0]);
-					break;
-				}
-			}
-		}
-		else
-		{
-			dbg_print(PRINT_LEVEL_INFO,
-			        "rx'ed test packet from: %04x seq: %04x\n", msg->SrcAddr,
-			        msg->Data[0]);
-			consolePrint("Sent node %04x seq: %04x\n", msg->SrcAddr,
-			        msg->Data[0]);
-			//echo back the data
-			uint16_t nodeAddr = msg->SrcAddr;
-			sendTestMsg(nodeAddr, (uint32_t)(msg->Data[0]));
-		}
+		dbg_print(PRINT_LEVEL_INFO,
+		        "rx'ed test packet from: %04x seq: %04x len: %d\n",
+		        msg->SrcAddr, msg->Data[0], msg->Len);
+		sendTestMsg(msg->SrcAddr, msg->Data, msg->Len);
 	}
 
 	return 0;
@@ -341,241 +361,287 @@ static uint8_t mtAfIncomingMsgCb(IncomingMsgFormat_t *msg)
 /********************************************************************
  * HELPER FUNCTIONS
  */
-// helper functions for building and sending the NV messages
-static uint8_t setNVStartup(uint8_t startupOption)
+static int32_t startNetwork(char *cDevType, char* sCh)
 {
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-	// sending startup option
+	nwkStartCfg_t cfg;
+	nwkStart_t nwk;
+	int32_t status;
 
-	nvWrite.Id = ZCD_NV_STARTUP_OPTION;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 1;
-	nvWrite.Value[0] = startupOption;
-	status = sysOsalNvWrite(&nvWrite);
-//	status = sysNvWrite(ZCD_NV_STARTUP_OPTION, 0, pbuf, 1);
-	dbg_print(PRINT_LEVEL_INFO, "\n");
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.NewNetwork = 1;
 
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Startup Option cmd sent[%d]...\n",
-	        status);
+	switch (cDevType[0])
+	{
+	case 'c':
+	case 'C':
+		cfg.DevType = DEVICETYPE_COORDINATOR;
+		break;
+	case 'r':
+	case 'R':
+		cfg.DevType = DEVICETYPE_ROUTER;
+		break;
+	case 'e':
+	case 'E':
+	default:
+		cfg.DevType = DEVICETYPE_ENDDEVICE;
+		break;
+	}
 
-	return status;
-}
+	//Select random PAN ID for Coord and join any PAN for RTR/ED
+	cfg.PanId = 0xFFFF;
+	cfg.ChanList = 1 << atoi(sCh);
 
-static uint8_t setNVDevType(uint8_t devType)
-{
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-	//uint8_t pbuf[1];
-	// setting dev type
-	nvWrite.Id = ZCD_NV_LOGICAL_TYPE;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 1;
-	nvWrite.Value[0] = devType;
-	status = sysOsalNvWrite(&nvWrite);
-	//pbuf[0] = devType;
-	//status = sysNvWrite(ZCD_NV_LOGICAL_TYPE, 0, pbuf, 1);
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Device Type cmd sent... [%d]\n",
-	        status);
+	cfg.EndpointCount = 1;
+	setAfEndpoint(&cfg.Endpoints[0]);
+
+	nwkStartInit(&nwk, &cfg);
+	status = nwkStartRun(&nwk);
+	nwkStartPrintTimes(&nwk);
 
 	return status;
 }
 
-static uint8_t setNVPanID(uint32_t panId)
+static void setAfEndpoint(RegisterFormat_t *reg)
 {
-	uint8_t status;
-	OsalNvWriteFormat_t nvWrite;
-
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write PAN ID cmd sending...\n");
-
-	nvWrite.Id = ZCD_NV_PANID;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 2;
-	nvWrite.Value[0] = LO_UINT16(panId);
-	nvWrite.Value[1] = HI_UINT16(panId);
-	status = sysOsalNvWrite(&nvWrite);
-	//status = sysNvWrite(ZCD_NV_PANID, 0, pbuf, 2);
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write PAN ID cmd sent...[%d]\n", status);
-
-	return status;
+	reg->EndPoint = TEST_EP;
+	reg->AppProfId = TEST_PRIFILE;
+	reg->AppDeviceId = 0x0;
+	reg->AppDevVer = 1;
+	reg->LatencyReq = 0;
+	reg->AppNumInClusters = 1;
+	reg->AppInClusterList[0] = TEST_CLUSTER;
+	reg->AppNumOutClusters = 1;
+	reg->AppOutClusterList[0] = TEST_CLUSTER;
 }
 
-static uint8_t setNVChanList(uint32_t chanList)
+static void sendTestMsg(uint16_t nodeAddr, uint8_t *data, uint8_t len)
 {
-	OsalNvWriteFormat_t nvWrite;
-	uint8_t status;
-	// setting chanList
-	nvWrite.Id = ZCD_NV_CHANLIST;
-	nvWrite.Offset = 0;
-	nvWrite.Len = 4;
-	nvWrite.Value[0] = BREAK_UINT32(chanList, 0);
-	nvWrite.Value[1] = BREAK_UINT32(chanList, 1);
-	nvWrite.Value[2] = BREAK_UINT32(chanList, 2);
-	nvWrite.Value[3] = BREAK_UINT32(chanList, 3);
-	status = sysOsalNvWrite(&nvWrite);
-	//status = sysNvWrite(ZCD_NV_CHANLIST, 0, pbuf, 4);
-	dbg_print(PRINT_LEVEL_INFO, "\n");
-	dbg_print(PRINT_LEVEL_INFO, "NV Write Channel List cmd sent...[%d]\n",
-	        status);
+	DataRequestFormat_t DataRequest;
+	DataRequest.DstAddr = nodeAddr;
+	DataRequest.DstEndpoint = TEST_EP;
+	DataRequest.SrcEndpoint = TEST_EP;
+	DataRequest.ClusterID = TEST_CLUSTER;
+	DataRequest.TransID = transId++;
+	DataRequest.Options = 0;
+	DataRequest.Radius = 16;
 
-	return status;
+	memcpy(DataRequest.Data, data, len);
+	DataRequest.Len = len;
+
+	afDataRequest(&DataRequest);
 }
 
-static int32_t startNetwork(char *cDevType, char* sCh)
+static int32_t parseOpts(char **args, testOpts_t *opts)
 {
-	uint8_t devType;
-	int32_t status;
+	uint32_t u, g, b;
+	char *val;
 
-	status = setNVStartup(
-	ZCD_STARTOPT_CLEAR_STATE | ZCD_STARTOPT_CLEAR_CONFIG);
-	consolePrint("Resetting ZNP\n");
-	ResetReqFormat_t resReq;
-	resReq.Type = 1;
-	sysResetReq(&resReq);
-	//flush the rsp
-	rpcWaitMqClientMsg(5000);
+	memset(opts, 0, sizeof(testOpts_t));
+	opts->waitS = TEST_WAIT_S;
+	opts->gen.SrcEndpoint = TEST_EP;
+	opts->gen.DstEndpoint = TEST_EP;
+	opts->gen.ClusterId = TEST_CLUSTER;
+	opts->gen.GroupId = TEST_GROUP;
 
-	if (status != MT_RPC_SUCCESS)
+	for (; *args; args++)
 	{
-		dbg_print(PRINT_LEVEL_WARNING, "network start failed\n");
-		return 0;
+		val = strchr(*args, '=');
+		if (val == NULL)
+		{
+			consolePrint("option %s has no value\n", *args);
+			return -1;
+		}
+		val++;
+
+		if (strncmp(*args, "nodes=", 6) == 0)
+		{
+			opts->nodes = strtoul(val, NULL, 0);
+		}
+		else if (strncmp(*args, "wait=", 5) == 0)
+		{
+			opts->waitS = strtoul(val, NULL, 0);
+		}
+		else if (strncmp(*args, "payload=", 8) == 0)
+		{
+			opts->gen.PayloadLen = strtoul(val, NULL, 0);
+		}
+		else if (strncmp(*args, "rate=", 5) == 0)
+		{
+			opts->gen.RatePerNode = strtoul(val, NULL, 0);
+		}
+		else if (strncmp(*args, "conc=", 5) == 0)
+		{
+			opts->gen.Concurrency = strtoul(val, NULL, 0);
+		}
+		else if (strncmp(*args, "mix=", 4) == 0)
+		{
+			if (sscanf(val, "%u:%u:%u", &u, &g, &b) != 3)
+			{
+				consolePrint("mix must be <unicast>:<group>:<broadcast>\n");
+				return -1;
+			}
+			opts->gen.UnicastPct = u;
+			opts->gen.GroupPct = g;
+			opts->gen.BroadcastPct = b;
+		}
+		else if (strncmp(*args, "group=", 6) == 0)
+		{
+			opts->gen.GroupId = strtoul(val, NULL, 0);
+		}
+		else if (strncmp(*args, "duration=", 9) == 0)
+		{
+			opts->gen.DurationMs = strtoul(val, NULL, 0) * 1000;
+		}
+		else if (strncmp(*args, "timeout=", 8) == 0)
+		{
+			opts->gen.TimeoutMs = strtoul(val, NULL, 0);
+		}
+		else if (strncmp(*args, "bcast=", 6) == 0)
+		{
+			opts->bcast = strtoul(val, NULL, 0);
+		}
+		else if (strncmp(*args, "srcrt=", 6) == 0)
+		{
+			opts->srcRt = strtoul(val, NULL, 0);
+		}
+		else if (strncmp(*args, "out=", 4) == 0)
+		{
+			opts->out = val;
+		}
+		else if (strncmp(*args, "export=", 7) == 0)
+		{
+			opts->export = val;
+		}
+		else
+		{
+			consolePrint("unknown option %s\n", *args);
+			return -1;
+		}
 	}
 
-	switch (cDevType[0])
+	return 0;
+}
+
+static int32_t runTest(testOpts_t *opts)
+{
+	loadGen_t gen;
+	bcastGov_t gov;
+	bcastGovCfg_t govCfg;
+	nodeRegNode_t *node;
+	uint32_t count = 0;
+	uint32_t waited;
+	FILE *fp;
+	int32_t status;
+
+	consolePrint("Waiting for test nodes to join the network\n");
+	for (waited = 0; waited < opts->waitS * 10; waited++)
 	{
-	case 'c':
-	case 'C':
-		devType = DEVICETYPE_COORDINATOR;
-		break;
-	case 'r':
-	case 'R':
-		devType = DEVICETYPE_ROUTER;
-		break;
-	case 'e':
-	case 'E':
-	default:
-		devType = DEVICETYPE_ENDDEVICE;
-		break;
+		if (opts->nodes && (nodeRegCount() >= opts->nodes))
+		{
+			break;
+		}
+		usleep(100000);
 	}
-	status = setNVDevType(devType);
 
-	if (status != MT_RPC_SUCCESS)
+	opts->gen.NodeCount = nodeRegCount();
+	opts->gen.Nodes = malloc((opts->gen.NodeCount + 1) * sizeof(uint16_t));
+	if (opts->gen.Nodes == NULL)
 	{
-		dbg_print(PRINT_LEVEL_WARNING, "setNVDevType failed\n");
-		return 0;
+		return -1;
 	}
-	//Select random PAN ID for Coord and join any PAN for RTR/ED
-	status = setNVPanID(0xFFFF);
-	if (status != MT_RPC_SUCCESS)
+	for (node = nodeRegNext(NULL); node && (count < opts->gen.NodeCount);
+	        node = nodeRegNext(node))
 	{
-		dbg_print(PRINT_LEVEL_WARNING, "setNVPanID failed\n");
-		return 0;
+		opts->gen.Nodes[count++] = node->NwkAddr;
 	}
+	opts->gen.NodeCount = count;
 
-	status = setNVChanList(1 << atoi(sCh));
-	if (status != MT_RPC_SUCCESS)
+	if (opts->bcast)
 	{
-		dbg_print(PRINT_LEVEL_INFO, "setNVPanID failed\n");
-		return 0;
+		memset(&govCfg, 0, sizeof(govCfg));
+		govCfg.MaxInFlight = opts->bcast;
+		if (bcastGovInit(&gov, &govCfg) != 0)
+		{
+			free(opts->gen.Nodes);
+			return -1;
+		}
+		opts->gen.Governor = &gov;
 	}
 
-	registerAf();
-	consolePrint("EndPoint: 1\n");
-
-	status = zdoInit();
-	if (status == NEW_NETWORK)
-	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit NEW_NETWORK\n");
-		status = MT_RPC_SUCCESS;
-	}
-	else if (status == RESTORED_NETWORK)
+	if ((count == 0) || (loadGenInit(&gen, &opts->gen) != 0))
 	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit RESTORED_NETWORK\n");
-		consolePrint("Network Restored\n");
-		status = MT_RPC_SUCCESS;
-	}
-	else
-	{
-		dbg_print(PRINT_LEVEL_INFO, "zdoInit failed\n");
-		status = -1;
+		consolePrint("No test nodes or invalid options\n");
+		if (opts->bcast)
+		{
+			bcastGovClose(&gov);
+		}
+		free(opts->gen.Nodes);
+		return -1;
 	}
 
-	dbg_print(PRINT_LEVEL_INFO, "process zdoStatechange callbacks\n");
+	consolePrint("Testing %d nodes for %d s\n", count,
+	        gen.Cfg.DurationMs / 1000);
+	status = loadGenRun(&gen);
 
-	//flush AREQ ZDO State Change messages
-	while (status != -1)
+	consolePrint("sent:%d delivered:%d lost:%d confirm failed:%d "
+	        "p50:%dus p99:%dus p999:%dus goodput:%.0fbps fairness:%.3f\n",
+	        gen.Total.Sent, gen.Total.Delivered, gen.Total.Lost,
+	        gen.Total.ConfirmFailed, gen.Total.P50Us, gen.Total.P99Us,
+	        gen.Total.P999Us, gen.GoodputBps, gen.Fairness);
+
+	if (opts->out)
 	{
-		status = rpcWaitMqClientMsg(5000);
+		uint32_t len = strlen(opts->out);
+		uint8_t json = (len > 5) && (strcmp(&opts->out[len - 5], ".json") == 0);
 
-		if (((devType == DEVICETYPE_COORDINATOR) && (devState == DEV_ZB_COORD))
-		        || ((devType == DEVICETYPE_ROUTER) && (devState == DEV_ROUTER))
-		        || ((devType == DEVICETYPE_ENDDEVICE)
-		                && (devState == DEV_END_DEVICE)))
+		fp = (strcmp(opts->out, "-") == 0) ? stdout : fopen(opts->out, "w");
+		if (fp == NULL)
 		{
-			break;
+			consolePrint("could not open %s\n", opts->out);
+			status = -1;
+		}
+		else
+		{
+			if (json)
+			{
+				loadGenWriteJson(&gen, fp);
+			}
+			else
+			{
+				loadGenWriteCsv(&gen, fp);
+			}
+			if (fp != stdout)
+			{
+				fclose(fp);
+			}
 		}
 	}
 
-	if (devState < DEV_END_DEVICE)
+	if (opts->bcast)
 	{
-		//start network failed
-		return -1;
+		bcastGovPrintStats(&gov, stderr);
+		bcastGovClose(&gov);
 	}
-	else
-	{
-		//set startup option back to keep configuration in case of reset
-		status = setNVStartup(0);
-		if (status != MT_RPC_SUCCESS)
-		{
-			dbg_print(PRINT_LEVEL_WARNING, "setNVStartup failed\n");
-			return -1;
-		}
 
+	loadGenClose(&gen);
+	free(opts->gen.Nodes);
+
+	if (opts->srcRt)
+	{
+		srcRtCachePrintStats(&srcRoutes, stderr);
+		srcRtCacheClose(&srcRoutes);
 	}
 
-	return 0;
-}
+	if (opts->export)
+	{
+		evtExportFlush(&eventExport);
+		evtExportPrintStats(&eventExport, stderr);
+		evtExportClose(&eventExport);
+	}
 
-static int32_t registerAf(void)
-{
-	int32_t status = 0;
-	RegisterFormat_t reg;
-
-	reg.EndPoint = TEST_EP;
-	reg.AppProfId = TEST_PRIFILE;
-	reg.AppDeviceId = 0x0;
-	reg.AppDevVer = 1;
-	reg.LatencyReq = 0;
-	reg.AppNumInClusters = 1;
-	reg.AppInClusterList[0] = TEST_CLUSTER;
-	reg.AppNumOutClusters = 1;
-	reg.AppOutClusterList[0] = TEST_CLUSTER;
-
-	status = afRegister(&reg);
 	return status;
 }
 
-static void sendTestMsg(uint16_t nodeAddr, uint8_t txSeqNum)
-{
-	DataRequestFormat_t DataRequest;
-	DataRequest.DstAddr = nodeAddr;
-	DataRequest.DstEndpoint = TEST_EP;
-	DataRequest.SrcEndpoint = TEST_EP;
-	DataRequest.ClusterID = TEST_CLUSTER;
-	DataRequest.TransID = transId++;
-	DataRequest.Options = 0;
-	DataRequest.Radius = 16;
-
-	//memcpy(DataRequest.Data, &txSeqNum, 1);
-	DataRequest.Data[0] = txSeqNum;
-	DataRequest.Len = 1;
-
-	afDataRequest(&DataRequest);
-}
-
 /*********************************************************************
  * INTERFACE FUNCTIONS
  */
@@ -600,9 +666,12 @@ uint32_t appInit(void)
 	sysRegisterCallbacks(mtSysCb);
 	zdoRegisterCallbacks(mtZdoCb);
 	afRegisterCallbacks(mtAfCb);
+	rpcFilterCompile(&testFilter, testFilterRules,
+	        sizeof(testFilterRules) / sizeof(testFilterRules[0]));
+	rpcSetAreqFilter(&testFilter);
 
-	//clear the node test addrs
-	memset(testNodes, 0, sizeof(testNodes));
+	//track the test nodes in the node registry
+	nodeRegInit(0);
 
 	return 0;
 }
@@ -624,9 +693,43 @@ void* appProcess(void *context)
 	char** args = (char**) context;
 	char* sCh = args[1];
 	cDevType = args[0];
+	testOpts_t opts;
 	struct timespec req;
 	struct timespec rem;
 
+	if (((cDevType[0] == 'c') || (cDevType[0] == 'C'))
+	        && (parseOpts(&args[2], &opts) != 0))
+	{
+		usage("stressTest.bin");
+		exit(-1);
+	}
+
+	if (((cDevType[0] == 'c') || (cDevType[0] == 'C')) && opts.export)
+	{
+		evtExportCfg_t exportCfg;
+
+		memset(&exportCfg, 0, sizeof(exportCfg));
+		exportCfg.Target = opts.export;
+		if (evtExportInit(&eventExport, &exportCfg) != 0)
+		{
+			consolePrint("could not export to %s\n", opts.export);
+			exit(-1);
+		}
+	}
+
+	//learn the routes from the network start on
+	if (((cDevType[0] == 'c') || (cDevType[0] == 'C')) && opts.srcRt)
+	{
+		srcRtCacheCfg_t routesCfg;
+
+		memset(&routesCfg, 0, sizeof(routesCfg));
+		if (srcRtCacheInit(&srcRoutes, &routesCfg) != 0)
+		{
+			exit(-1);
+		}
+		opts.gen.Routes = &srcRoutes;
+	}
+
 	//Flush all messages from the que
 	do
 	{
@@ -653,76 +756,25 @@ void* appProcess(void *context)
 	nvWrite.Offset = 0;
 	nvWrite.Len = 1;
 	nvWrite.Value[0] = TEST_EP;
-	status = sysOsalNvWrite(&nvWrite);
+	status = nvCacheWrite(nvWrite.Id, nvWrite.Value, nvWrite.Len);
 
 	if ((cDevType[0] == 'c') || (cDevType[0] == 'C'))
 	{
-		consolePrint("Waiting for test nodes to join the network\n");
+		//the message thread dispatches the callbacks while the load
+		//generator runs
 		initDone = 1;
+		exit(runTest(&opts) == 0 ? 0 : -1);
 	}
 
 	while (1)
 	{
-		if ((cDevType[0] == 'c') || (cDevType[0] == 'C'))
-		{
-			uint32_t nodeIdx;
-
-			for (nodeIdx = 0; nodeIdx < MAX_TEST_NODES; nodeIdx++)
-			{
-				if (testNodes[nodeIdx].nodeAddr != 0)
-				{
-					req.tv_sec = 0;
-					req.tv_nsec = 500000000;
-
-					if ((testNodes[nodeIdx].txSeqNum)
-					        != testNodes[nodeIdx].rxSeqNum)
-					{
-						//error message lost
-						dbg_print(PRINT_LEVEL_WARNING,
-						        "Error: node %x sequence numbers not matching %x:%x \n",
-						        testNodes[nodeIdx].nodeAddr,
-						        testNodes[nodeIdx].txSeqNum,
-						        testNodes[nodeIdx].rxSeqNum);
-
-						//reset conters
-						testNodes[nodeIdx].txSeqNum = 0;
-						testNodes[nodeIdx].rxSeqNum = 0;
-						testNodes[nodeIdx].errorCnt++;
-					}
-					else
-					{
-						testNodes[nodeIdx].passCnt++;
-					}
-					testNodes[nodeIdx].txSeqNum++;
-
-					dbg_print(PRINT_LEVEL_INFO,
-					        "sending node %04x test message %x \n",
-					        testNodes[nodeIdx].nodeAddr,
-					        testNodes[nodeIdx].txSeqNum);
-
-					consolePrint("node:%04x: pass count:%d error count:%d\n",
-					        testNodes[nodeIdx].nodeAddr,
-					        testNodes[nodeIdx].passCnt,
-					        testNodes[nodeIdx].errorCnt);
-
-					sendTestMsg(testNodes[nodeIdx].nodeAddr,
-					        testNodes[nodeIdx].txSeqNum);
-
-					nanosleep(&req, &rem);
-				}
-			}
-		}
-
-		//let other task get context if no devices are found
+		//let other task get context
 		//Set sleep time to 1ms as this is the tick period on Tiva
 		req.tv_sec = 0;
 		req.tv_nsec = 1000000;
 		nanosleep(&req, &rem);
 
-		if ((cDevType[0] != 'c') && (cDevType[0] != 'C'))
-		{
-			rpcWaitMqClientMsg(1000);
-		}
+		rpcWaitMqClientMsg(1000);
 	}
 
 	return 0;
@@ -0,0 +1,1398 @@
+/*
+ * znpEmu.c
+ *
+ * This module contains a ZNP emulator, which answers the MT commands of
+ * the host framework on a pseudo terminal so the examples can run
+ * without hardware.
+ *
+ * The emulator forms a network as a coordinator, announces a number of
+ * emulated nodes and echoes the AF messages sent to them, like the
+ * stressTest example does on routers. The radio is one shared channel:
+ * every frame occupies it for its airtime at 250 kbit/s, and each hop
+ * adds a latency with some jitter, so the emulator saturates like a
+ * real network. Frames can be dropped to emulate a lossy mesh.
+ *
+ * The nodes are routers forming a tree under the coordinator, node n
+ * is a child of node (n - 1) / fanout, node 0 being the coordinator.
+ * They answer the descriptor requests of an interview and Mgmt_Lqi_req
+ * with their parent and children, so a topology crawl sees the tree.
+ *
+ * Started with -b the emulator is a CC2538 in its serial bootloader: it
+ * answers the SBL handshake, programs WRITE blocks into an emulated
+ * 512kB flash, erasing a page on a write at its start, and answers READ
+ * and ENABLE. Each command takes the time the flash needs and only a
+ * few commands fit in the receive buffer, the others are answered with
+ * a failure in turn. The force run byte leaves the bootloader.
+ *
+ * Started with -o the nodes are OTA clients running version 1 of the
+ * image 0xBEEF/0x0001: once announced each one queries the OTA server
+ * of the ZNP for a newer image and downloads it a block at a time,
+ * over the same channel as the AF messages, then reports the download
+ * complete. A client told no image or to wait asks again later.
+ *
+ * AF_DATA_REQUEST_SRC_RTG is sent like AF_DATA_REQUEST, the relays are
+ * not emulated. Started with -r the emulator refuses it with the SRSP
+ * status ZNwkNoRoute, as a ZNP whose route is gone, and with -s it sends
+ * the message but leaves the request without an SRSP.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#define _GNU_SOURCE                  // posix_openpt, ptsname, cfmakeraw
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define MT_SOF                   (0xFE)
+
+#define MT_SREQ                  (0x20)
+#define MT_AREQ                  (0x40)
+#define MT_SRSP                  (0x60)
+#define MT_SYS                   (0x01)
+#define MT_AF                    (0x04)
+#define MT_ZDO                   (0x05)
+#define MT_OTA                   (0x0A)
+#define MT_SBL                   (0x0D)
+
+// ZDO states reported by MT_ZDO_STATE_CHANGE_IND
+#define EMU_DEV_END_DEVICE       (6)
+#define EMU_DEV_ROUTER           (7)
+#define EMU_DEV_COORD_STARTING   (8)
+#define EMU_DEV_ZB_COORD         (9)
+
+#define EMU_NV_LOGICAL_TYPE      (0x0087)
+#define EMU_NV_PANID             (0x0083)
+
+// AF_DATA_CONFIRM status
+#define EMU_MAC_NO_ACK           (0xE9)
+#define EMU_NWK_NO_ROUTE         (0xCD)
+
+// emuCfg_t SrcRtg, answer to AF_DATA_REQUEST_SRC_RTG
+#define EMU_SRC_RTG_REFUSE       (1)
+#define EMU_SRC_RTG_SILENT       (2)
+
+// airtime of a byte at 250 kbit/s, and the PHY/MAC/NWK/APS overhead
+#define EMU_BYTE_US              (32)
+#define EMU_FRAME_OVERHEAD       (31)
+
+// emulated CC2538 flash and serial bootloader
+#define EMU_FLASH_BASE           (0x00200000)
+#define EMU_FLASH_SIZE           (512 * 1024)
+#define EMU_SBL_PAGE_SIZE        (2048)
+#define EMU_SBL_BUF_LEN          (64)
+#define EMU_SBL_RX_SLOTS         (4)
+#define EMU_SBL_ERASE_US         (10000)
+#define EMU_SBL_WRITE_US         (300)
+#define EMU_SBL_READ_US          (50)
+#define EMU_SBL_ENABLE_US        (50000)
+#define EMU_SB_FORCE_RUN         (0x07)
+
+// OTA clients, see mtOta.h for the frames
+#define EMU_OTA_MANUFACTURER     (0xBEEF)
+#define EMU_OTA_IMAGE_TYPE       (0x0001)
+#define EMU_OTA_VERSION          (1)
+#define EMU_OTA_BLOCK_LEN        (48)
+#define EMU_OTA_ENDPOINT         (0x08)
+#define EMU_OTA_QUERY_US         (2000000) // after no image
+#define EMU_OTA_WAIT_US          (200000)  // after wait for data
+#define EMU_OTA_RETRY_US         (1000000) // after a lost frame
+#define EMU_OTA_NO_IMAGE         (0x98)
+#define EMU_OTA_WAIT_FOR_DATA    (0x97)
+
+#define EMU_MAX_NV_ITEMS         (128)
+#define EMU_MAX_EVENTS           (4096)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+	uint16_t Id;
+	uint8_t Len;
+	uint8_t Value[128];
+} emuNvItem_t;
+
+// MT frame written to the host at Due
+typedef struct
+{
+	uint64_t Due;
+	uint8_t Len;
+	uint8_t Frame[256];
+} emuEvent_t;
+
+typedef struct
+{
+	uint32_t Nodes;           // emulated nodes, network addresses 1..Nodes
+	uint32_t LatencyUs;       // per hop
+	uint32_t JitterUs;
+	uint32_t DropPct;         // frames lost per hop
+	uint32_t Fanout;          // children of a router
+	uint32_t AnnounceUs;      // time between two announces
+	uint8_t Boot;             // start in the serial bootloader
+	uint8_t Ota;              // the nodes are OTA clients
+	uint8_t SrcRtg;           // EMU_SRC_RTG_REFUSE or EMU_SRC_RTG_SILENT
+	char *Link;               // symbolic link to the pseudo terminal
+} emuCfg_t;
+
+// download of an OTA client
+typedef struct
+{
+	uint32_t Version;         // running image
+	uint8_t FileId[8];        // image downloaded, as streamed
+	uint32_t Size;
+	uint32_t Offset;          // bytes received
+	uint8_t Done;
+} emuOtaNode_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static emuCfg_t emuCfg =
+	{ 10, 10000, 5000, 0, 4, 2000, 0, 0, 0, NULL };
+
+static int emuFd = -1;
+static emuNvItem_t emuNv[EMU_MAX_NV_ITEMS];
+static uint32_t emuNvCount;
+
+// timer heap of the frames to write
+static emuEvent_t *emuEvents;
+static uint32_t emuEventCount;
+
+// time the radio channel becomes free
+static uint64_t emuAirFree;
+
+// flash and the commands queued in the bootloader, by completion time
+static uint8_t *emuFlash;
+static uint64_t emuSblBusy;
+static uint64_t emuSblDone[EMU_SBL_RX_SLOTS];
+static uint32_t emuSblOverruns;
+
+// OTA clients by network address
+static emuOtaNode_t *emuOta;
+
+static uint32_t emuRxFrames;
+static uint32_t emuTxFrames;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowUs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in micro seconds
+ */
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*********************************************************************
+ * @fn      eventPush
+ *
+ * @brief   queues an MT frame to write to the host at a given time
+ *
+ * @param   due - time in micro seconds
+ * @param   cmd0 - type and subsystem
+ * @param   cmd1 - command ID
+ * @param   data - payload
+ * @param   len - payload length
+ *
+ * @return  none
+ */
+static void eventPush(uint64_t due, uint8_t cmd0, uint8_t cmd1,
+        uint8_t *data, uint8_t len)
+{
+	emuEvent_t evt;
+	uint8_t fcs = 0;
+	uint32_t i, parent;
+
+	if (emuEventCount == EMU_MAX_EVENTS)
+	{
+		fprintf(stderr, "znpEmu: event queue full, frame dropped\n");
+		return;
+	}
+
+	evt.Due = due;
+	evt.Frame[0] = MT_SOF;
+	evt.Frame[1] = len;
+	evt.Frame[2] = cmd0;
+	evt.Frame[3] = cmd1;
+	memcpy(&evt.Frame[4], data, len);
+	for (i = 1; i < 4 + (uint32_t) len; i++)
+	{
+		fcs ^= evt.Frame[i];
+	}
+	evt.Frame[4 + len] = fcs;
+	evt.Len = 5 + len;
+
+	// sift up, frames due at the same time keep their order by sequence
+	i = emuEventCount++;
+	while (i > 0)
+	{
+		parent = (i - 1) / 2;
+		if (emuEvents[parent].Due <= evt.Due)
+		{
+			break;
+		}
+		emuEvents[i] = emuEvents[parent];
+		i = parent;
+	}
+	emuEvents[i] = evt;
+}
+
+/*********************************************************************
+ * @fn      eventPop
+ *
+ * @brief   removes the earliest frame of the timer heap
+ */
+static void eventPop(emuEvent_t *evt)
+{
+	emuEvent_t last;
+	uint32_t i = 0;
+	uint32_t child;
+
+	*evt = emuEvents[0];
+	last = emuEvents[--emuEventCount];
+	while ((child = (2 * i) + 1) < emuEventCount)
+	{
+		if ((child + 1 < emuEventCount)
+		        && (emuEvents[child + 1].Due < emuEvents[child].Due))
+		{
+			child++;
+		}
+		if (last.Due <= emuEvents[child].Due)
+		{
+			break;
+		}
+		emuEvents[i] = emuEvents[child];
+		i = child;
+	}
+	emuEvents[i] = last;
+}
+
+/*********************************************************************
+ * @fn      srsp
+ *
+ * @brief   answers an SREQ at once
+ */
+static void srsp(uint8_t cmd0, uint8_t cmd1, uint8_t *data, uint8_t len)
+{
+	eventPush(nowUs(), MT_SRSP | (cmd0 & 0x1F), cmd1, data, len);
+}
+
+/*********************************************************************
+ * @fn      airHop
+ *
+ * @brief   sends a frame over the emulated radio, the frame waits for
+ *          the channel, occupies it for its airtime and arrives after
+ *          the hop latency
+ *
+ * @param   start - time the frame is ready
+ * @param   payloadLen - application payload
+ *
+ * @return  arrival time, 0 if the frame is lost
+ */
+static uint64_t airHop(uint64_t start, uint32_t payloadLen)
+{
+	uint64_t airtime = (uint64_t) (payloadLen + EMU_FRAME_OVERHEAD)
+	        * EMU_BYTE_US;
+	uint64_t begin = (start > emuAirFree) ? start : emuAirFree;
+
+	emuAirFree = begin + airtime;
+	if (emuCfg.DropPct && ((uint32_t) (rand() % 100) < emuCfg.DropPct))
+	{
+		return 0;
+	}
+
+	return emuAirFree + emuCfg.LatencyUs
+	        + (emuCfg.JitterUs ? (uint32_t) rand() % emuCfg.JitterUs : 0);
+}
+
+/*********************************************************************
+ * @fn      nvFind
+ *
+ * @brief   looks up an NV item
+ */
+static emuNvItem_t *nvFind(uint16_t id, uint8_t create)
+{
+	uint32_t i;
+
+	for (i = 0; i < emuNvCount; i++)
+	{
+		if (emuNv[i].Id == id)
+		{
+			return &emuNv[i];
+		}
+	}
+	if (!create || (emuNvCount == EMU_MAX_NV_ITEMS))
+	{
+		return NULL;
+	}
+	emuNv[emuNvCount].Id = id;
+	emuNv[emuNvCount].Len = 0;
+
+	return &emuNv[emuNvCount++];
+}
+
+/*********************************************************************
+ * @fn      announceNodes
+ *
+ * @brief   queues the device announces of the emulated nodes
+ */
+static void announceNodes(uint64_t start)
+{
+	uint8_t ind[13];
+	uint32_t n;
+
+	for (n = 1; n <= emuCfg.Nodes; n++)
+	{
+		uint64_t ieee = 0x00124B0000000000ULL + n;
+		uint32_t i;
+
+		ind[0] = n & 0xFF;
+		ind[1] = (n >> 8) & 0xFF;
+		ind[2] = n & 0xFF;
+		ind[3] = (n >> 8) & 0xFF;
+		for (i = 0; i < 8; i++)
+		{
+			ind[4 + i] = (ieee >> (i * 8)) & 0xFF;
+		}
+		ind[12] = 0x8E;
+		eventPush(start + (n * emuCfg.AnnounceUs), MT_AREQ | MT_ZDO, 0xC1, ind,
+		        sizeof(ind));
+	}
+}
+
+/*********************************************************************
+ * @fn      otaRequest
+ *
+ * @brief   queues the MT_OTA request of a client: a query for the next
+ *          image, or the read of the block at its offset once it has one
+ *
+ * @param   node - network address of the client
+ * @param   due - time the ZNP receives the request
+ *
+ * @return  none
+ */
+static void otaRequest(uint32_t node, uint64_t due)
+{
+	emuOtaNode_t *ota = &emuOta[node];
+	uint8_t req[25];
+	uint32_t left;
+
+	// file ID, the running image for a query
+	if (ota->Size == 0)
+	{
+		req[0] = EMU_OTA_MANUFACTURER & 0xFF;
+		req[1] = (EMU_OTA_MANUFACTURER >> 8) & 0xFF;
+		req[2] = EMU_OTA_IMAGE_TYPE & 0xFF;
+		req[3] = (EMU_OTA_IMAGE_TYPE >> 8) & 0xFF;
+		req[4] = ota->Version & 0xFF;
+		req[5] = (ota->Version >> 8) & 0xFF;
+		req[6] = (ota->Version >> 16) & 0xFF;
+		req[7] = (ota->Version >> 24) & 0xFF;
+	}
+	else
+	{
+		memcpy(req, ota->FileId, 8);
+	}
+	// address
+	memset(&req[8], 0, 12);
+	req[8] = 0x02;
+	req[9] = node & 0xFF;
+	req[10] = (node >> 8) & 0xFF;
+	req[17] = EMU_OTA_ENDPOINT;
+
+	if (ota->Size == 0)
+	{
+		// MT_OTA_NEXT_IMG_REQ: address, option, file ID
+		uint8_t query[21];
+
+		memcpy(query, &req[8], 12);
+		query[12] = 0x00;
+		memcpy(&query[13], req, 8);
+		eventPush(due, MT_AREQ | MT_OTA, 0x01, query, sizeof(query));
+		return;
+	}
+
+	// MT_OTA_FILE_READ_REQ: file ID, address, offset, length
+	left = ota->Size - ota->Offset;
+	req[20] = ota->Offset & 0xFF;
+	req[21] = (ota->Offset >> 8) & 0xFF;
+	req[22] = (ota->Offset >> 16) & 0xFF;
+	req[23] = (ota->Offset >> 24) & 0xFF;
+	req[24] = (left < EMU_OTA_BLOCK_LEN) ? left : EMU_OTA_BLOCK_LEN;
+	eventPush(due, MT_AREQ | MT_OTA, 0x00, req, sizeof(req));
+}
+
+/*********************************************************************
+ * @fn      otaDeliver
+ *
+ * @brief   sends a response of the host over the air to a client, the
+ *          client asks again after a timeout if it is lost
+ *
+ * @param   node - network address of the client
+ * @param   rspLen - over the air payload of the response
+ *
+ * @return  arrival time, 0 if the response is lost
+ */
+static uint64_t otaDeliver(uint32_t node, uint32_t rspLen)
+{
+	uint64_t now = nowUs();
+	uint64_t arrival = airHop(now, rspLen);
+
+	if (arrival == 0)
+	{
+		otaRequest(node, now + EMU_OTA_RETRY_US);
+	}
+
+	return arrival;
+}
+
+/*********************************************************************
+ * @fn      otaNext
+ *
+ * @brief   sends the next request of a client over the air
+ *
+ * @param   node - network address of the client
+ * @param   start - time the client sends it
+ *
+ * @return  none
+ */
+static void otaNext(uint32_t node, uint64_t start)
+{
+	uint64_t arrival = airHop(start, 25);
+
+	otaRequest(node, arrival ? arrival : start + EMU_OTA_RETRY_US);
+}
+
+/*********************************************************************
+ * @fn      handleSys
+ *
+ * @brief   MT_SYS commands
+ */
+static void handleSys(uint8_t cmd0, uint8_t cmd1, uint8_t *data, uint8_t len)
+{
+	uint8_t rsp[160];
+	emuNvItem_t *item;
+	uint16_t id;
+	uint8_t i;
+
+	if ((cmd0 & 0xE0) == MT_AREQ)
+	{
+		// SYS_RESET_REQ
+		if (cmd1 == 0x00)
+		{
+			uint8_t ind[6] =
+				{ 0x00, 0x02, 0x00, 0x02, 0x06, 0x03 };
+
+			eventPush(nowUs() + 20000, MT_AREQ | MT_SYS, 0x80, ind,
+			        sizeof(ind));
+		}
+		return;
+	}
+
+	id = (len >= 2) ? (data[0] | (data[1] << 8)) : 0;
+	switch (cmd1)
+	{
+	case 0x01: // SYS_PING
+		rsp[0] = 0x79;
+		rsp[1] = 0x01;
+		srsp(cmd0, cmd1, rsp, 2);
+		break;
+	case 0x02: // SYS_VERSION
+		rsp[0] = 0x02;
+		rsp[1] = 0x00;
+		rsp[2] = 0x02;
+		rsp[3] = 0x06;
+		rsp[4] = 0x03;
+		srsp(cmd0, cmd1, rsp, 5);
+		break;
+	case 0x04: // SYS_GET_EXTADDR
+		for (i = 0; i < 8; i++)
+		{
+			rsp[i] = (i < 3) ? (0x00124B >> ((2 - i) * 8)) & 0xFF : 0;
+		}
+		srsp(cmd0, cmd1, rsp, 8);
+		break;
+	case 0x08: // SYS_OSAL_NV_READ
+		item = nvFind(id, 0);
+		rsp[0] = item ? 0x00 : 0x0A;
+		rsp[1] = item ? item->Len : 0;
+		if (item)
+		{
+			memcpy(&rsp[2], item->Value, item->Len);
+		}
+		srsp(cmd0, cmd1, rsp, 2 + rsp[1]);
+		break;
+	case 0x09: // SYS_OSAL_NV_WRITE
+		item = nvFind(id, 1);
+		rsp[0] = 0x01;
+		if (item && (len >= 4) && (data[3] <= sizeof(item->Value))
+		        && (len >= 4 + data[3]))
+		{
+			item->Len = data[3];
+			memcpy(item->Value, &data[4], data[3]);
+			rsp[0] = 0x00;
+		}
+		srsp(cmd0, cmd1, rsp, 1);
+		break;
+	case 0x13: // SYS_OSAL_NV_LENGTH
+		item = nvFind(id, 0);
+		rsp[0] = item ? item->Len : 0;
+		rsp[1] = 0;
+		srsp(cmd0, cmd1, rsp, 2);
+		break;
+	default:
+		rsp[0] = 0x00;
+		srsp(cmd0, cmd1, rsp, 1);
+		break;
+	}
+}
+
+/*********************************************************************
+ * @fn      zdoAnswer
+ *
+ * @brief   queues the ZDO response of a node, the request and the
+ *          response each take one hop
+ *
+ * @param   cmd1 - response command ID
+ * @param   rsp - response
+ * @param   len - response length
+ *
+ * @return  none
+ */
+static void zdoAnswer(uint8_t cmd1, uint8_t *rsp, uint8_t len)
+{
+	uint64_t arrival = airHop(nowUs(), 8);
+
+	if (arrival)
+	{
+		arrival = airHop(arrival, len);
+	}
+	if (arrival)
+	{
+		eventPush(arrival, MT_AREQ | MT_ZDO, cmd1, rsp, len);
+	}
+}
+
+/*********************************************************************
+ * @fn      neighbors
+ *
+ * @brief   lists the neighbors of a node of the tree
+ *
+ * @param   node - node, 0 for the coordinator
+ * @param   addr - network addresses of the neighbors
+ * @param   relation - 0 for the parent, 1 for a child
+ *
+ * @return  number of neighbors
+ */
+static uint32_t neighbors(uint32_t node, uint16_t *addr, uint8_t *relation)
+{
+	uint32_t count = 0;
+	uint32_t child;
+
+	if (node > 0)
+	{
+		addr[count] = (node - 1) / emuCfg.Fanout;
+		relation[count++] = 0;
+	}
+	for (child = (node * emuCfg.Fanout) + 1;
+	        (child <= (node + 1) * emuCfg.Fanout) && (child <= emuCfg.Nodes);
+	        child++)
+	{
+		addr[count] = child;
+		relation[count++] = 1;
+	}
+
+	return count;
+}
+
+/*********************************************************************
+ * @fn      handleZdoReq
+ *
+ * @brief   answers the ZDO requests sent to the nodes
+ *
+ * @param   cmd1 - request command ID
+ * @param   data - request
+ * @param   len - request length
+ *
+ * @return  none
+ */
+static void handleZdoReq(uint8_t cmd1, uint8_t *data, uint8_t len)
+{
+	uint8_t rsp[128];
+	uint16_t nb[64];
+	uint8_t relation[64];
+	uint16_t dst;
+	uint32_t count, i;
+	uint8_t k = 0;
+
+	if (len < 3)
+	{
+		return;
+	}
+	dst = data[0] | (data[1] << 8);
+	if (dst > emuCfg.Nodes)
+	{
+		// no such node, the request times out
+		return;
+	}
+
+	rsp[k++] = data[0];
+	rsp[k++] = data[1];
+	rsp[k++] = 0x00;
+	switch (cmd1)
+	{
+	case 0x02: // ZDO_NODE_DESC_REQ
+		rsp[k++] = data[0];
+		rsp[k++] = data[1];
+		rsp[k++] = dst ? 0x01 : 0x00;
+		rsp[k++] = 0x40;
+		rsp[k++] = 0x8E;
+		rsp[k++] = 0x5F;
+		rsp[k++] = 0x11;
+		rsp[k++] = 80;
+		rsp[k++] = 80;
+		rsp[k++] = 0;
+		rsp[k++] = 0;
+		rsp[k++] = 0;
+		rsp[k++] = 80;
+		rsp[k++] = 0;
+		rsp[k++] = 0;
+		zdoAnswer(0x82, rsp, k);
+		break;
+	case 0x05: // ZDO_ACTIVE_EP_REQ
+		rsp[k++] = data[0];
+		rsp[k++] = data[1];
+		rsp[k++] = 1;
+		rsp[k++] = 1;
+		zdoAnswer(0x85, rsp, k);
+		break;
+	case 0x04: // ZDO_SIMPLE_DESC_REQ, HA on/off light on endpoint 1
+		if ((len < 5) || (data[4] != 1))
+		{
+			return;
+		}
+		rsp[k++] = data[0];
+		rsp[k++] = data[1];
+		rsp[k++] = 14;
+		rsp[k++] = 1;
+		rsp[k++] = 0x04;
+		rsp[k++] = 0x01;
+		rsp[k++] = 0x00;
+		rsp[k++] = 0x01;
+		rsp[k++] = 1;
+		rsp[k++] = 2;
+		rsp[k++] = 0x00;
+		rsp[k++] = 0x00;
+		rsp[k++] = 0x06;
+		rsp[k++] = 0x00;
+		rsp[k++] = 1;
+		rsp[k++] = 0x19;
+		rsp[k++] = 0x00;
+		zdoAnswer(0x84, rsp, k);
+		break;
+	case 0x31: // ZDO_MGMT_LQI_REQ, 3 neighbors per page
+		count = neighbors(dst, nb, relation);
+		rsp[k++] = count;
+		rsp[k++] = data[2];
+		rsp[k++] = 0;
+		for (i = data[2]; (i < count) && (rsp[5] < 3); i++)
+		{
+			uint64_t ieee = 0x00124B0000000000ULL + nb[i];
+			uint32_t b;
+
+			memset(&rsp[k], 0xAB, 8);
+			k += 8;
+			for (b = 0; b < 8; b++)
+			{
+				rsp[k++] = (ieee >> (b * 8)) & 0xFF;
+			}
+			rsp[k++] = nb[i] & 0xFF;
+			rsp[k++] = (nb[i] >> 8) & 0xFF;
+			rsp[k++] = (nb[i] ? 0x01 : 0x00) | 0x04 | (relation[i] << 4);
+			rsp[k++] = 0x01;
+			rsp[k++] = 1;
+			rsp[k++] = 200;
+			rsp[5]++;
+		}
+		zdoAnswer(0xB1, rsp, k);
+		break;
+	default:
+		break;
+	}
+}
+
+/*********************************************************************
+ * @fn      handleZdo
+ *
+ * @brief   MT_ZDO commands
+ */
+static void handleZdo(uint8_t cmd0, uint8_t cmd1, uint8_t *data, uint8_t len)
+{
+	emuNvItem_t *item;
+	uint8_t rsp[4];
+	uint8_t state;
+	uint64_t now = nowUs();
+
+	if ((cmd0 & 0xE0) != MT_SREQ)
+	{
+		return;
+	}
+
+	// ZDO_STARTUP_FROM_APP
+	if (cmd1 == 0x40)
+	{
+		item = nvFind(EMU_NV_PANID, 0);
+		rsp[0] = item ? 0x00 : 0x01;
+		srsp(cmd0, cmd1, rsp, 1);
+
+		item = nvFind(EMU_NV_LOGICAL_TYPE, 0);
+		state = EMU_DEV_ZB_COORD;
+		if (item && (item->Len == 1) && (item->Value[0] == 1))
+		{
+			state = EMU_DEV_ROUTER;
+		}
+		else if (item && (item->Len == 1) && (item->Value[0] == 2))
+		{
+			state = EMU_DEV_END_DEVICE;
+		}
+		rsp[0] = EMU_DEV_COORD_STARTING;
+		eventPush(now + 10000, MT_AREQ | MT_ZDO, 0xC0, rsp, 1);
+		rsp[0] = state;
+		eventPush(now + 50000, MT_AREQ | MT_ZDO, 0xC0, rsp, 1);
+		announceNodes(now + 100000);
+		if (emuOta)
+		{
+			uint32_t n;
+
+			// each client queries once announced
+			for (n = 1; n <= emuCfg.Nodes; n++)
+			{
+				memset(&emuOta[n], 0, sizeof(emuOtaNode_t));
+				emuOta[n].Version = EMU_OTA_VERSION;
+				otaRequest(n, now + 200000 + (n * emuCfg.AnnounceUs));
+			}
+		}
+		return;
+	}
+
+	rsp[0] = 0x00;
+	srsp(cmd0, cmd1, rsp, 1);
+	handleZdoReq(cmd1, data, len);
+}
+
+/*********************************************************************
+ * @fn      afSend
+ *
+ * @brief   emulates an AF message: the confirm after the first hop and,
+ *          for an emulated node, the echo of the payload
+ *
+ * @param   dstAddr - destination, 0 for a group or broadcast
+ * @param   dstEp - destination endpoint
+ * @param   srcEp - source endpoint
+ * @param   clusterId - cluster
+ * @param   transId - AF transaction ID
+ * @param   payload - payload
+ * @param   payloadLen - payload length
+ *
+ * @return  none
+ */
+static void afSend(uint16_t dstAddr, uint8_t dstEp, uint8_t srcEp,
+        uint16_t clusterId, uint8_t transId, uint8_t *payload,
+        uint8_t payloadLen)
+{
+	uint8_t cnf[3];
+	uint8_t msg[17 + 128];
+	uint64_t now = nowUs();
+	uint64_t arrival;
+	uint64_t back;
+
+	cnf[0] = 0x00;
+	cnf[1] = srcEp;
+	cnf[2] = transId;
+
+	arrival = airHop(now, payloadLen);
+	if ((dstAddr != 0) && ((dstAddr > emuCfg.Nodes) || (arrival == 0)))
+	{
+		cnf[0] = (dstAddr > emuCfg.Nodes) ? EMU_NWK_NO_ROUTE : EMU_MAC_NO_ACK;
+		eventPush(now + emuCfg.LatencyUs, MT_AREQ | MT_AF, 0x80, cnf, 3);
+		return;
+	}
+	eventPush(arrival ? arrival : now + emuCfg.LatencyUs, MT_AREQ | MT_AF,
+	        0x80, cnf, 3);
+	if (dstAddr == 0)
+	{
+		return;
+	}
+
+	// the node echoes the payload back
+	back = airHop(arrival, payloadLen);
+	if (back == 0)
+	{
+		return;
+	}
+	memset(msg, 0, 17);
+	msg[2] = clusterId & 0xFF;
+	msg[3] = (clusterId >> 8) & 0xFF;
+	msg[4] = dstAddr & 0xFF;
+	msg[5] = (dstAddr >> 8) & 0xFF;
+	msg[6] = dstEp;
+	msg[7] = srcEp;
+	msg[9] = 200;
+	msg[15] = transId;
+	msg[16] = payloadLen;
+	memcpy(&msg[17], payload, payloadLen);
+	eventPush(back, MT_AREQ | MT_AF, 0x81, msg, 17 + payloadLen);
+}
+
+/*********************************************************************
+ * @fn      handleAf
+ *
+ * @brief   MT_AF commands
+ */
+static void handleAf(uint8_t cmd0, uint8_t cmd1, uint8_t *data, uint8_t len)
+{
+	uint8_t rsp[1] =
+		{ 0x00 };
+
+	if ((cmd0 & 0xE0) != MT_SREQ)
+	{
+		return;
+	}
+
+	// AF_DATA_REQUEST
+	if ((cmd1 == 0x01) && (len >= 10) && (len >= 10 + data[9]))
+	{
+		srsp(cmd0, cmd1, rsp, 1);
+		afSend(data[0] | (data[1] << 8), data[2], data[3],
+		        data[4] | (data[5] << 8), data[6], &data[10], data[9]);
+		return;
+	}
+
+	// AF_DATA_REQUEST_EXT, 16 bit addresses are unicast
+	if ((cmd1 == 0x02) && (len >= 20) && (len >= 20 + data[18]))
+	{
+		uint16_t dstAddr = (data[0] == 0x02) ? (data[1] | (data[2] << 8)) : 0;
+
+		srsp(cmd0, cmd1, rsp, 1);
+		afSend(dstAddr, data[9], data[12], data[13] | (data[14] << 8),
+		        data[15], &data[20], data[18]);
+		return;
+	}
+
+	// AF_DATA_REQUEST_SRC_RTG, the relay list before the payload
+	if ((cmd1 == 0x03) && (len >= 11) && (len >= 11 + (2 * data[9]))
+	        && (len >= 11 + (2 * data[9]) + data[10 + (2 * data[9])]))
+	{
+		uint8_t payloadLen = data[10 + (2 * data[9])];
+		uint8_t *payload = &data[11 + (2 * data[9])];
+
+		if (emuCfg.SrcRtg == EMU_SRC_RTG_REFUSE)
+		{
+			rsp[0] = EMU_NWK_NO_ROUTE;
+			srsp(cmd0, cmd1, rsp, 1);
+			return;
+		}
+		if (emuCfg.SrcRtg != EMU_SRC_RTG_SILENT)
+		{
+			srsp(cmd0, cmd1, rsp, 1);
+		}
+		afSend(data[0] | (data[1] << 8), data[2], data[3],
+		        data[4] | (data[5] << 8), data[6], payload, payloadLen);
+		return;
+	}
+
+	srsp(cmd0, cmd1, rsp, 1);
+}
+
+/*********************************************************************
+ * @fn      handleOta
+ *
+ * @brief   MT_OTA responses of the host to the OTA clients
+ */
+static void handleOta(uint8_t cmd0, uint8_t cmd1, uint8_t *data, uint8_t len)
+{
+	emuOtaNode_t *ota;
+	uint32_t node, offset;
+	uint64_t arrival;
+	uint8_t ind[5];
+
+	if (((cmd0 & 0xE0) != MT_AREQ) || (emuOta == NULL))
+	{
+		return;
+	}
+
+	// MT_OTA_NEXT_IMG_RSP: status, address, option, file ID, image size
+	if ((cmd1 == 0x81) && (len >= 26))
+	{
+		node = data[2] | (data[3] << 8);
+		if ((node == 0) || (node > emuCfg.Nodes) || emuOta[node].Done)
+		{
+			return;
+		}
+		ota = &emuOta[node];
+		if (data[0] != 0x00)
+		{
+			ota->Size = 0;
+			otaRequest(node, nowUs() + EMU_OTA_QUERY_US);
+			return;
+		}
+		arrival = otaDeliver(node, 26);
+		if (arrival == 0)
+		{
+			return;
+		}
+		memcpy(ota->FileId, &data[14], 8);
+		ota->Size = data[22] | (data[23] << 8) | (data[24] << 16)
+		        | ((uint32_t) data[25] << 24);
+		ota->Offset = 0;
+		otaNext(node, arrival);
+		return;
+	}
+
+	// MT_OTA_FILE_READ_RSP: status, file ID, address, offset, length, data
+	if ((cmd1 == 0x80) && (len >= 26))
+	{
+		node = data[10] | (data[11] << 8);
+		if ((node == 0) || (node > emuCfg.Nodes) || emuOta[node].Done
+		        || (emuOta[node].Size == 0))
+		{
+			return;
+		}
+		ota = &emuOta[node];
+		if (data[0] == EMU_OTA_WAIT_FOR_DATA)
+		{
+			otaRequest(node, nowUs() + EMU_OTA_WAIT_US);
+			return;
+		}
+		if ((data[0] != 0x00) || (len < 26 + data[25]))
+		{
+			// aborted, start over with a query
+			ota->Size = 0;
+			otaRequest(node, nowUs() + EMU_OTA_QUERY_US);
+			return;
+		}
+
+		arrival = otaDeliver(node, 26 + data[25]);
+		if (arrival == 0)
+		{
+			return;
+		}
+		offset = data[21] | (data[22] << 8) | (data[23] << 16)
+		        | ((uint32_t) data[24] << 24);
+		if (offset == ota->Offset)
+		{
+			ota->Offset += data[25];
+		}
+		if (ota->Offset < ota->Size)
+		{
+			otaNext(node, arrival);
+			return;
+		}
+
+		// download complete, the client runs the new image
+		ota->Done = 1;
+		ota->Version = data[5] | (data[6] << 8) | (data[7] << 16)
+		        | ((uint32_t) data[8] << 24);
+		ind[0] = node & 0xFF;
+		ind[1] = (node >> 8) & 0xFF;
+		ind[2] = 0x02;
+		ind[3] = 0x00;
+		ind[4] = 0x00;
+		eventPush(arrival + emuCfg.LatencyUs, MT_AREQ | MT_OTA, 0x81, ind,
+		        sizeof(ind));
+	}
+}
+
+/*********************************************************************
+ * @fn      handleSbl
+ *
+ * @brief   MT_SBL commands of the serial bootloader, answered in order
+ *          once the flash is done with them
+ */
+static void handleSbl(uint8_t cmd0, uint8_t cmd1, uint8_t *data, uint8_t len)
+{
+	uint8_t rsp[5 + EMU_SBL_BUF_LEN];
+	uint64_t now = nowUs();
+	uint32_t addr = 0, off, slot, i, costUs = 0;
+	uint8_t rspLen = 1;
+
+	// a full receive buffer rejects the command, still answered in order
+	for (slot = 0; slot < EMU_SBL_RX_SLOTS; slot++)
+	{
+		if (emuSblDone[slot] <= now)
+		{
+			break;
+		}
+	}
+	if (slot == EMU_SBL_RX_SLOTS)
+	{
+		emuSblOverruns++;
+		rsp[0] = 0x01;
+		if ((cmd1 == 0x02) && (len >= 4))
+		{
+			memcpy(&rsp[1], data, 4);
+			rspLen = 5;
+		}
+		eventPush((emuSblBusy > now) ? emuSblBusy : now, MT_AREQ | MT_SBL,
+		        cmd1 | 0x80, rsp, rspLen);
+		return;
+	}
+
+	if (len >= 4)
+	{
+		addr = data[0] | (data[1] << 8) | (data[2] << 16)
+		        | ((uint32_t) data[3] << 24);
+	}
+	off = addr - EMU_FLASH_BASE;
+	rsp[0] = 0x01;
+	switch (cmd1)
+	{
+	case 0x01: // SBL_WRITE
+		if ((len == 4 + EMU_SBL_BUF_LEN) && (addr >= EMU_FLASH_BASE)
+		        && (off + EMU_SBL_BUF_LEN <= EMU_FLASH_SIZE)
+		        && (off % EMU_SBL_BUF_LEN == 0))
+		{
+			if (off % EMU_SBL_PAGE_SIZE == 0)
+			{
+				memset(&emuFlash[off], 0xFF, EMU_SBL_PAGE_SIZE);
+				costUs += EMU_SBL_ERASE_US;
+			}
+			// programming only clears bits
+			for (i = 0; i < EMU_SBL_BUF_LEN; i++)
+			{
+				emuFlash[off + i] &= data[4 + i];
+			}
+			costUs += EMU_SBL_WRITE_US;
+			rsp[0] = 0x00;
+		}
+		break;
+	case 0x02: // SBL_READ
+		costUs = EMU_SBL_READ_US;
+		memcpy(&rsp[1], data, 4);
+		rspLen = 5;
+		if ((len == 4) && (addr >= EMU_FLASH_BASE)
+		        && (off + EMU_SBL_BUF_LEN <= EMU_FLASH_SIZE))
+		{
+			memcpy(&rsp[5], &emuFlash[off], EMU_SBL_BUF_LEN);
+			rspLen += EMU_SBL_BUF_LEN;
+			rsp[0] = 0x00;
+		}
+		break;
+	case 0x03: // SBL_ENABLE
+		costUs = EMU_SBL_ENABLE_US;
+		rsp[0] = 0x00;
+		break;
+	case 0x04: // SBL_HANDSHAKE
+		rsp[0] = 0x00;
+		memset(&rsp[1], 0, 13);
+		rsp[1] = 0x01;
+		rsp[5] = 0x8C;
+		rsp[6] = EMU_SBL_BUF_LEN;
+		rsp[10] = EMU_SBL_PAGE_SIZE & 0xFF;
+		rsp[11] = (EMU_SBL_PAGE_SIZE >> 8) & 0xFF;
+		rspLen = 14;
+		break;
+	default:
+		return;
+	}
+
+	emuSblBusy = ((emuSblBusy > now) ? emuSblBusy : now) + costUs;
+	for (slot = 0; slot < EMU_SBL_RX_SLOTS; slot++)
+	{
+		if (emuSblDone[slot] <= now)
+		{
+			emuSblDone[slot] = emuSblBusy;
+			break;
+		}
+	}
+	eventPush(emuSblBusy, MT_AREQ | MT_SBL, cmd1 | 0x80, rsp, rspLen);
+}
+
+/*********************************************************************
+ * @fn      handleFrame
+ *
+ * @brief   dispatches a frame received from the host
+ */
+static void handleFrame(uint8_t cmd0, uint8_t cmd1, uint8_t *data,
+        uint8_t len)
+{
+	uint8_t rsp[1] =
+		{ 0x00 };
+
+	emuRxFrames++;
+	if (emuCfg.Boot)
+	{
+		// the bootloader knows the SBL commands only
+		if ((cmd0 & 0x1F) == MT_SBL)
+		{
+			handleSbl(cmd0, cmd1, data, len);
+		}
+		return;
+	}
+	switch (cmd0 & 0x1F)
+	{
+	case MT_SYS:
+		handleSys(cmd0, cmd1, data, len);
+		break;
+	case MT_ZDO:
+		handleZdo(cmd0, cmd1, data, len);
+		break;
+	case MT_AF:
+		handleAf(cmd0, cmd1, data, len);
+		break;
+	case MT_OTA:
+		handleOta(cmd0, cmd1, data, len);
+		break;
+	default:
+		if ((cmd0 & 0xE0) == MT_SREQ)
+		{
+			srsp(cmd0, cmd1, rsp, 1);
+		}
+		break;
+	}
+}
+
+/*********************************************************************
+ * @fn      parse
+ *
+ * @brief   reassembles the MT frames from the bytes received
+ */
+static void parse(uint8_t *buf, uint32_t count)
+{
+	static uint8_t frame[256 + 5];
+	static uint32_t pos;
+	uint32_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		if ((pos == 0) && (buf[i] != MT_SOF))
+		{
+			if (emuCfg.Boot && (buf[i] == EMU_SB_FORCE_RUN))
+			{
+				printf("znpEmu: leaving the bootloader, %u overruns\n",
+				        emuSblOverruns);
+				fflush(stdout);
+				emuCfg.Boot = 0;
+			}
+			continue;
+		}
+		frame[pos++] = buf[i];
+		if ((pos >= 2) && (pos == (uint32_t) frame[1] + 5))
+		{
+			uint8_t fcs = 0;
+			uint32_t k;
+
+			for (k = 1; k < pos - 1; k++)
+			{
+				fcs ^= frame[k];
+			}
+			if (fcs == frame[pos - 1])
+			{
+				handleFrame(frame[2], frame[3], &frame[4], frame[1]);
+			}
+			else
+			{
+				fprintf(stderr, "znpEmu: bad FCS, frame dropped\n");
+			}
+			pos = 0;
+		}
+	}
+}
+
+/*********************************************************************
+ * @fn      openPty
+ *
+ * @brief   creates the pseudo terminal the host opens as its serial port
+ *
+ * @return  file descriptor of the master side, -1 on error
+ */
+static int openPty(void)
+{
+	struct termios tio;
+	int fd;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0))
+	{
+		perror("znpEmu: posix_openpt");
+		return -1;
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(fd, TCSANOW, &tio);
+
+	if (emuCfg.Link)
+	{
+		unlink(emuCfg.Link);
+		if (symlink(ptsname(fd), emuCfg.Link) != 0)
+		{
+			perror(emuCfg.Link);
+		}
+	}
+
+	return fd;
+}
+
+static void usage(char *exeName)
+{
+	printf("Usage: %s [-n nodes] [-f fanout] [-l latency ms] [-j jitter ms] "
+	        "[-d drop %%] [-a announce interval us] [-b] [-o] [-r] [-s] "
+	        "[-L link]\n", exeName);
+	printf("  -b  start in the serial bootloader\n");
+	printf("  -o  the nodes are OTA clients\n");
+	printf("  -r  refuse the source routed requests, ZNwkNoRoute\n");
+	printf("  -s  send the source routed requests without an SRSP\n");
+	printf("Example: %s -n 50 -L /tmp/znp0 & ./stressTest.bin /tmp/znp0 c 11\n",
+	        exeName);
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int main(int argc, char *argv[])
+{
+	uint8_t buf[512];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:f:l:j:d:a:borsL:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			emuCfg.Nodes = atoi(optarg);
+			break;
+		case 'l':
+			emuCfg.LatencyUs = atoi(optarg) * 1000;
+			break;
+		case 'j':
+			emuCfg.JitterUs = atoi(optarg) * 1000;
+			break;
+		case 'd':
+			emuCfg.DropPct = atoi(optarg);
+			break;
+		case 'f':
+			emuCfg.Fanout = atoi(optarg);
+			break;
+		case 'a':
+			emuCfg.AnnounceUs = atoi(optarg);
+			break;
+		case 'b':
+			emuCfg.Boot = 1;
+			break;
+		case 'o':
+			emuCfg.Ota = 1;
+			break;
+		case 'r':
+			emuCfg.SrcRtg = EMU_SRC_RTG_REFUSE;
+			break;
+		case 's':
+			emuCfg.SrcRtg = EMU_SRC_RTG_SILENT;
+			break;
+		case 'L':
+			emuCfg.Link = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (emuCfg.Nodes > 0xFFF0)
+	{
+		emuCfg.Nodes = 0xFFF0;
+	}
+	if ((emuCfg.Fanout == 0) || (emuCfg.Fanout > 32))
+	{
+		emuCfg.Fanout = 4;
+	}
+
+	emuEvents = malloc(EMU_MAX_EVENTS * sizeof(emuEvent_t));
+	emuFlash = malloc(EMU_FLASH_SIZE);
+	emuFd = openPty();
+	if ((emuEvents == NULL) || (emuFlash == NULL) || (emuFd < 0))
+	{
+		return -1;
+	}
+	memset(emuFlash, 0xFF, EMU_FLASH_SIZE);
+	if (emuCfg.Ota)
+	{
+		emuOta = calloc(emuCfg.Nodes + 1, sizeof(emuOtaNode_t));
+		if (emuOta == NULL)
+		{
+			return -1;
+		}
+	}
+	printf("ZNP emulator on %s, %u nodes%s%s\n", ptsname(emuFd),
+	        emuCfg.Nodes, emuCfg.Ota ? " with OTA clients" : "",
+	        emuCfg.Boot ? ", in the bootloader" : "");
+	fflush(stdout);
+
+	while (1)
+	{
+		struct pollfd pfd;
+		int timeoutMs = -1;
+		uint64_t now = nowUs();
+		int n;
+
+		// write the frames that are due
+		while (emuEventCount && (emuEvents[0].Due <= now))
+		{
+			emuEvent_t evt;
+
+			eventPop(&evt);
+			if (write(emuFd, evt.Frame, evt.Len) != evt.Len)
+			{
+				perror("znpEmu: write");
+			}
+			emuTxFrames++;
+		}
+		if (emuEventCount)
+		{
+			timeoutMs = (int) ((emuEvents[0].Due - now + 999) / 1000);
+		}
+
+		pfd.fd = emuFd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, timeoutMs) <= 0)
+		{
+			continue;
+		}
+		if (pfd.revents & POLLHUP)
+		{
+			// no host has the terminal open
+			usleep(10000);
+			continue;
+		}
+		n = read(emuFd, buf, sizeof(buf));
+		if (n > 0)
+		{
+			parse(buf, n);
+		}
+	}
+
+	return 0;
+}
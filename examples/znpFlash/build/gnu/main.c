@@ -0,0 +1,54 @@
+/*
+ * main.c
+ *
+ * This module contains the main function of the firmware flashing
+ * tool.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rpc.h"
+#include "znpFlash.h"
+
+#include "dbgPrint.h"
+
+void *rpcTask(void *argument)
+{
+	while (1)
+	{
+		rpcProcess();
+	}
+
+	dbg_print(PRINT_LEVEL_WARNING, "rpcTask exited!\n");
+}
+
+int main(int argc, char* argv[])
+{
+	pthread_t rpcThread;
+
+	if (argc < 3)
+	{
+		printf("usage: %s <UART port> <image.hex> [window=N] [timeout=ms] "
+		        "[verify=read|none] [enable=0|1] [reset=0|1]\n", argv[0]);
+		return 2;
+	}
+
+	if (rpcOpen(argv[1], 0) == -1)
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "could not open serial port\n");
+		return 1;
+	}
+
+	rpcInitMq();
+
+	//Start the Rx thread
+	dbg_print(PRINT_LEVEL_INFO, "creating RPC thread\n");
+	pthread_create(&rpcThread, NULL, rpcTask, NULL);
+
+	return appFlash(argv[2], &argv[3]);
+}
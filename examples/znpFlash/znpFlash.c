@@ -0,0 +1,185 @@
+/*
+ * znpFlash.c
+ *
+ * This module contains the firmware flashing tool, which programs an
+ * Intel HEX image into the ZNP through its serial bootloader.
+ *
+ * Options are key=value arguments after the image:
+ *   window=N     blocks in flight to the bootloader at most
+ *   timeout=MS   time allowed for a bootloader response
+ *   verify=MODE  read to read every block back, none to rely on the
+ *                CRC check of the bootloader
+ *   enable=0     leave the image disabled
+ *   reset=1      reset the ZNP first so its bootloader starts
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "znpFlash.h"
+#include "rpc.h"
+#include "mtSys.h"
+#include "sblFlash.h"
+
+#include "dbgPrint.h"
+#include "hostConsole.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// time the bootloader takes to start after a reset
+#define FLASH_RESET_WAIT_US        (100000)
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      parseOpts
+ *
+ * @brief   reads the key=value options
+ *
+ * @return  0 on success, -1 on an unknown option
+ */
+static int32_t parseOpts(char **args, sblFlashCfg_t *cfg, uint8_t *reset)
+{
+	char *val;
+
+	memset(cfg, 0, sizeof(sblFlashCfg_t));
+	*reset = 0;
+
+	for (; *args; args++)
+	{
+		val = strchr(*args, '=');
+		if (val == NULL)
+		{
+			consolePrint("option %s is not key=value\n", *args);
+			return -1;
+		}
+		val++;
+
+		if (strncmp(*args, "window=", 7) == 0)
+		{
+			cfg->Window = atoi(val);
+		}
+		else if (strncmp(*args, "timeout=", 8) == 0)
+		{
+			cfg->TimeoutMs = atoi(val);
+		}
+		else if (strncmp(*args, "verify=", 7) == 0)
+		{
+			cfg->Verify = (strcmp(val, "none") == 0) ?
+			        SBL_FLASH_VERIFY_NONE : SBL_FLASH_VERIFY_READ;
+		}
+		else if (strncmp(*args, "enable=", 7) == 0)
+		{
+			cfg->NoEnable = (atoi(val) == 0);
+		}
+		else if (strncmp(*args, "reset=", 6) == 0)
+		{
+			*reset = (atoi(val) != 0);
+		}
+		else
+		{
+			consolePrint("unknown option %s\n", *args);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rate
+ *
+ * @brief   bytes per second of a phase
+ */
+static double rate(uint64_t bytes, uint64_t us)
+{
+	return us ? ((double) bytes * 1000000.0 / (double) us) : 0.0;
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      appFlash
+ *
+ * @brief   loads the image and flashes it, the RPC thread must run
+ *
+ * @param   imagePath - Intel HEX file
+ * @param   args - key=value options, NULL terminated
+ *
+ * @return  0 on success, 1 on failure, 2 on a usage error
+ */
+int appFlash(char *imagePath, char **args)
+{
+	sblFlashCfg_t cfg;
+	sblFlash_t flash;
+	sblImage_t image;
+	sblFlashStats_t *st = &flash.Stats;
+	uint8_t reset;
+	int32_t status;
+
+	if (parseOpts(args, &cfg, &reset) != 0)
+	{
+		return 2;
+	}
+	if (sblImageLoadHex(&image, imagePath) != 0)
+	{
+		consolePrint("%s: not a valid Intel HEX file\n", imagePath);
+		return 2;
+	}
+	consolePrint("%s: %u bytes at 0x%08X-0x%08X\n", imagePath,
+	        image.UsedBytes, image.Base, image.Base + image.Size);
+
+	if (reset)
+	{
+		ResetReqFormat_t req;
+
+		req.Type = 0;
+		sysResetReq(&req);
+		usleep(FLASH_RESET_WAIT_US);
+	}
+
+	sblFlashInit(&flash, &cfg);
+	status = sblFlashRun(&flash, &image);
+
+	if (st->BufferLength)
+	{
+		consolePrint("bootloader rev %u, device 0x%02X, %u byte blocks, "
+		        "%u byte pages\n", st->BootloaderRevision, st->DeviceType,
+		        st->BufferLength, st->PageSize);
+	}
+	if (st->WriteUs)
+	{
+		consolePrint("written %llu bytes in %u pages, %.0f bytes/s, "
+		        "window up to %u, %u restarts\n",
+		        (unsigned long long) st->WriteBytes, st->Pages,
+		        rate(st->WriteBytes, st->WriteUs), st->PeakWindow,
+		        st->Restarts);
+	}
+	if (st->VerifyUs)
+	{
+		consolePrint("verified %llu bytes, %.0f bytes/s, %u pages repaired\n",
+		        (unsigned long long) st->VerifyBytes,
+		        rate(st->VerifyBytes, st->VerifyUs), st->Repairs);
+	}
+	consolePrint("flash %s\n", sblFlashResultName(st->Result));
+
+	sblFlashClose(&flash);
+	sblImageFree(&image);
+
+	return (status == 0) ? 0 : 1;
+}
@@ -0,0 +1,26 @@
+/*
+ * znpFlash.h
+ *
+ * This module contains the firmware flashing tool, which programs an
+ * Intel HEX image into the ZNP through its serial bootloader.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef ZNPFLASH_H
+#define ZNPFLASH_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+int appFlash(char *imagePath, char **args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZNPFLASH_H */
@@ -0,0 +1,53 @@
+/*
+ * main.c
+ *
+ * This module contains the main function of the ZNP mux daemon example.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rpc.h"
+#include "znpMux.h"
+
+#include "dbgPrint.h"
+
+void *rpcTask(void *argument)
+{
+	while (1)
+	{
+		rpcProcess();
+	}
+
+	dbg_print(PRINT_LEVEL_WARNING, "rpcTask exited!\n");
+}
+
+int main(int argc, char* argv[])
+{
+	pthread_t rpcThread;
+
+	if (argc < 2)
+	{
+		printf("usage: %s <UART port> [socket=path] [shm=name] [shmsize=n] "
+		        "[reset=0|1] [stats=s] [duration=s]\n", argv[0]);
+		return 2;
+	}
+
+	if (rpcOpen(argv[1], 0) == -1)
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "could not open serial port\n");
+		return 1;
+	}
+
+	rpcInitMq();
+
+	//Start the Rx thread
+	dbg_print(PRINT_LEVEL_INFO, "creating RPC thread\n");
+	pthread_create(&rpcThread, NULL, rpcTask, NULL);
+
+	return appMux(&argv[2]);
+}
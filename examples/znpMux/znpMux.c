@@ -0,0 +1,208 @@
+/*
+ * znpMux.c
+ *
+ * This module contains the ZNP mux daemon example, which shares one ZNP
+ * among the processes connecting to a Unix domain socket, see rpcMux.h.
+ * The examples connect to it by taking the socket path as serial port.
+ *
+ * Options are key=value arguments:
+ *   socket=PATH  socket of the clients, /tmp/znp.sock by default
+ *   shm=NAME     write the AREQs into the shared memory ring NAME too
+ *   shmsize=N    bytes of the ring
+ *   journal=DIR  journal the AF messages and ZDO indications in DIR
+ *   retention=S  delete the journal segments older than S seconds
+ *   reset=0      do not reset the ZNP at start
+ *   stats=S      print the counters every S seconds
+ *   duration=S   stop after S seconds
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "znpMux.h"
+#include "rpc.h"
+#include "rpcMux.h"
+#include "rpcJournal.h"
+
+#include "dbgPrint.h"
+#include "hostConsole.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// time to wait for a client between two rounds
+#define MUX_POLL_MS                (100)
+
+#define MUX_RESET_TIMEOUT_MS       (5000)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static volatile sig_atomic_t muxStop;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint64_t nowMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void muxSignal(int sig)
+{
+	(void) sig;
+	muxStop = 1;
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      appMux
+ *
+ * @brief   serves the clients until stopped by a signal or the duration,
+ *          the RPC thread must run
+ *
+ * @param   args - key=value options, NULL terminated
+ *
+ * @return  0 on success, 1 on failure, 2 on a usage error
+ */
+int appMux(char **args)
+{
+	rpcMux_t mux;
+	rpcJournal_t journal;
+	rpcJournalCfg_t journalCfg;
+	char *path = RPC_MUX_DEFAULT_PATH, *shm = NULL;
+	uint32_t statsS = 0, durationS = 0, shmSize = 0;
+	uint8_t reset = 1;
+	uint64_t start, lastMs, now;
+	char *val;
+
+	memset(&journalCfg, 0, sizeof(journalCfg));
+	for (; *args; args++)
+	{
+		val = strchr(*args, '=');
+		if (val == NULL)
+		{
+			consolePrint("unknown option %s\n", *args);
+			return 2;
+		}
+		val++;
+
+		if (strncmp(*args, "socket=", 7) == 0)
+		{
+			path = val;
+		}
+		else if (strncmp(*args, "shm=", 4) == 0)
+		{
+			shm = val;
+		}
+		else if (strncmp(*args, "shmsize=", 8) == 0)
+		{
+			shmSize = atoi(val);
+		}
+		else if (strncmp(*args, "journal=", 8) == 0)
+		{
+			journalCfg.Dir = val;
+		}
+		else if (strncmp(*args, "retention=", 10) == 0)
+		{
+			journalCfg.RetentionS = atoi(val);
+		}
+		else if (strncmp(*args, "reset=", 6) == 0)
+		{
+			reset = (atoi(val) != 0);
+		}
+		else if (strncmp(*args, "stats=", 6) == 0)
+		{
+			statsS = atoi(val);
+		}
+		else if (strncmp(*args, "duration=", 9) == 0)
+		{
+			durationS = atoi(val);
+		}
+		else
+		{
+			consolePrint("unknown option %s\n", *args);
+			return 2;
+		}
+	}
+
+	if (rpcMuxInit(&mux, path) != 0)
+	{
+		return 1;
+	}
+	if ((shm != NULL) && (rpcMuxShmOpen(&mux, shm, shmSize) != 0))
+	{
+		rpcMuxClose(&mux);
+		return 1;
+	}
+	if ((journalCfg.Dir != NULL)
+	        && (rpcJournalOpen(&journal, &journalCfg) != 0))
+	{
+		consolePrint("could not open the journal in %s\n", journalCfg.Dir);
+		rpcMuxClose(&mux);
+		return 1;
+	}
+	if (reset && (rpcMuxResetZnp(&mux, MUX_RESET_TIMEOUT_MS) != 0))
+	{
+		consolePrint("the ZNP did not indicate its reset\n");
+	}
+	signal(SIGINT, muxSignal);
+	signal(SIGTERM, muxSignal);
+	consolePrint("serving the ZNP on %s\n", mux.Path);
+
+	start = nowMs();
+	lastMs = start;
+	while (!muxStop)
+	{
+		if (rpcMuxPoll(&mux, MUX_POLL_MS) < 0)
+		{
+			consolePrint("poll failed\n");
+			break;
+		}
+
+		now = nowMs();
+		if (statsS && (now - lastMs >= statsS * 1000ULL))
+		{
+			lastMs = now;
+			rpcMuxPrintStats(&mux, stdout);
+			if (journalCfg.Dir != NULL)
+			{
+				rpcJournalPrintStats(&journal, stdout);
+			}
+			fflush(stdout);
+		}
+		if (durationS && (now - start >= durationS * 1000ULL))
+		{
+			break;
+		}
+	}
+
+	rpcMuxPrintStats(&mux, stdout);
+	rpcMuxClose(&mux);
+	if (journalCfg.Dir != NULL)
+	{
+		rpcJournalPrintStats(&journal, stdout);
+		rpcJournalClose(&journal);
+	}
+
+	return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * znpMux.h
+ *
+ * This module contains the ZNP mux daemon example, which shares one ZNP
+ * among the processes connecting to a Unix domain socket.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef ZNPMUX_H
+#define ZNPMUX_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+int appMux(char **args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZNPMUX_H */
@@ -0,0 +1,263 @@
+/*
+ * znpOta.c
+ *
+ * This module contains the OTA upgrade example, which serves upgrade
+ * images to the nodes of the network through the ZNP.
+ *
+ * The ZNP forms the network as coordinator and the OTA files given
+ * after the channel are offered to the clients querying for a newer
+ * image. Options are key=value arguments among the files:
+ *   rate=N       image bytes served per second
+ *   active=N     downloads at once
+ *   pending=N    block requests waiting for the rate
+ *   timeout=S    time without a block before a download stalls
+ *   nodes=N      stop once N clients upgraded
+ *   duration=S   stop after S seconds
+ *   progress=1   print the progress of every client each second
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "znpOta.h"
+#include "rpc.h"
+#include "mtSys.h"
+#include "nwkStart.h"
+#include "nodeReg.h"
+#include "otaServer.h"
+
+#include "dbgPrint.h"
+#include "hostConsole.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// MT dispatch wait between two polls of the server
+#define OTA_POLL_MS                (10)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	otaServerCfg_t cfg;
+	uint32_t nodes;
+	uint32_t durationS;
+	uint8_t progress;
+	char *images[OTA_SERVER_MAX_IMAGES];
+	uint32_t imageCount;
+} otaOpts_t;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint64_t nowMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*********************************************************************
+ * @fn      parseOpts
+ *
+ * @brief   reads the key=value options, the other arguments are OTA
+ *          files
+ *
+ * @return  0 on success, -1 on an unknown option
+ */
+static int32_t parseOpts(char **args, otaOpts_t *opts)
+{
+	char *val;
+
+	memset(opts, 0, sizeof(otaOpts_t));
+	for (; *args; args++)
+	{
+		val = strchr(*args, '=');
+		if (val == NULL)
+		{
+			if (opts->imageCount == OTA_SERVER_MAX_IMAGES)
+			{
+				consolePrint("more than %d OTA files\n", OTA_SERVER_MAX_IMAGES);
+				return -1;
+			}
+			opts->images[opts->imageCount++] = *args;
+			continue;
+		}
+		val++;
+
+		if (strncmp(*args, "rate=", 5) == 0)
+		{
+			opts->cfg.RateBps = atoi(val);
+		}
+		else if (strncmp(*args, "active=", 7) == 0)
+		{
+			opts->cfg.MaxActive = atoi(val);
+		}
+		else if (strncmp(*args, "pending=", 8) == 0)
+		{
+			opts->cfg.MaxPending = atoi(val);
+		}
+		else if (strncmp(*args, "timeout=", 8) == 0)
+		{
+			opts->cfg.SessionTimeoutMs = atoi(val) * 1000;
+		}
+		else if (strncmp(*args, "nodes=", 6) == 0)
+		{
+			opts->nodes = atoi(val);
+		}
+		else if (strncmp(*args, "duration=", 9) == 0)
+		{
+			opts->durationS = atoi(val);
+		}
+		else if (strncmp(*args, "progress=", 9) == 0)
+		{
+			opts->progress = (atoi(val) != 0);
+		}
+		else
+		{
+			consolePrint("unknown option %s\n", *args);
+			return -1;
+		}
+	}
+	if (opts->imageCount == 0)
+	{
+		consolePrint("no OTA file given\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      startNetwork
+ *
+ * @brief   forms the network as coordinator
+ *
+ * @return  0 on success, -1 on failure
+ */
+static int32_t startNetwork(char *channel)
+{
+	nwkStartCfg_t cfg;
+	nwkStart_t nwk;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.NewNetwork = 1;
+	cfg.DevType = DEVICETYPE_COORDINATOR;
+	cfg.PanId = 0xFFFF;
+	cfg.ChanList = 1 << atoi(channel);
+
+	nwkStartInit(&nwk, &cfg);
+	return nwkStartRun(&nwk);
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      appOta
+ *
+ * @brief   serves the OTA files until the options say to stop, the RPC
+ *          thread must run
+ *
+ * @param   channel - channel of the network
+ * @param   args - OTA files and key=value options, NULL terminated
+ *
+ * @return  0 on success, 1 if fewer clients than asked upgraded, 2 on a
+ *          usage error
+ */
+int appOta(char *channel, char **args)
+{
+	otaOpts_t opts;
+	otaServer_t ota;
+	otaServerStats_t *st = &ota.Stats;
+	uint64_t start, lastMs, now;
+	uint32_t i;
+	int status;
+
+	if (parseOpts(args, &opts) != 0)
+	{
+		return 2;
+	}
+	nodeRegInit(0);
+	if (otaServerInit(&ota, &opts.cfg) != 0)
+	{
+		return 1;
+	}
+	for (i = 0; i < opts.imageCount; i++)
+	{
+		if (otaServerAddImage(&ota, opts.images[i]) != 0)
+		{
+			consolePrint("%s: not a valid OTA file\n", opts.images[i]);
+			otaServerClose(&ota);
+			return 2;
+		}
+	}
+
+	if (startNetwork(channel) != 0)
+	{
+		consolePrint("network not started\n");
+		otaServerClose(&ota);
+		return 1;
+	}
+	consolePrint("serving at %u bytes/s, %u downloads at once\n",
+	        ota.Cfg.RateBps, ota.Cfg.MaxActive);
+
+	start = nowMs();
+	lastMs = start;
+	while (1)
+	{
+		otaServerPoll(&ota);
+		rpcWaitMqClientMsg(OTA_POLL_MS);
+
+		now = nowMs();
+		if (now - lastMs >= 1000)
+		{
+			lastMs = now;
+			consolePrint("%4llus active %u, downloaded %u, upgraded %u, "
+			        "deferred %u, waits %u, %u bytes/s\n",
+			        (unsigned long long) ((now - start) / 1000), st->Active,
+			        st->Downloaded, st->Upgraded, st->Deferred, st->Waits,
+			        st->BytesPerSec);
+			if (opts.progress)
+			{
+				otaServerPrintProgress(&ota, stdout);
+			}
+		}
+		if ((opts.nodes && (st->Upgraded >= opts.nodes))
+		        || (opts.durationS && (now - start >= opts.durationS * 1000ULL)))
+		{
+			break;
+		}
+	}
+
+	otaServerPrintProgress(&ota, stdout);
+	now = nowMs();
+	consolePrint("served %llu bytes in %u blocks, %u repeated, %.0f bytes/s, "
+	        "peak %u downloads and %u requests waiting\n",
+	        (unsigned long long) st->Bytes, st->Blocks, st->Repeats,
+	        (now > start) ? ((double) st->Bytes * 1000.0 / (now - start)) : 0.0,
+	        st->PeakActive, st->PeakPending);
+	consolePrint("%u upgraded, %u failed, %u stalled\n", st->Upgraded,
+	        st->Failed, st->Stalled);
+	status = (st->Upgraded >= opts.nodes) ? 0 : 1;
+
+	otaServerClose(&ota);
+	nodeRegClose();
+
+	return status;
+}
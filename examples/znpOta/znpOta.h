@@ -0,0 +1,26 @@
+/*
+ * znpOta.h
+ *
+ * This module contains the OTA upgrade example, which serves upgrade
+ * images to the nodes of the network through the ZNP.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef ZNPOTA_H
+#define ZNPOTA_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+int appOta(char *channel, char **args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZNPOTA_H */
@@ -44,6 +44,7 @@
 #include <stdlib.h>
 
 #include "mtAf.h"
+#include "mtEvent.h"
 #include "mtParser.h"
 #include "rpc.h"
 #include "dbgPrint.h"
@@ -54,6 +55,22 @@
 #define HI_UINT16(a) (((a) >> 8) & 0xFF)
 #define LO_UINT16(a) ((a) & 0xFF)
 
+// true if the application or a listener of the event handles the
+// callback, rpcBuff being the frame processed
+#define AF_CB_ANY(pfn) \
+	(mtAfCbs.pfn || mtEventListened(MT_EVENT_FRAME(rpcBuff)))
+
+// calls the listeners, then the application callback
+#define AF_CB_CALL(pfn, msg) \
+	do \
+	{ \
+		mtEventDispatch(MT_EVENT_FRAME(rpcBuff), msg); \
+		if (mtAfCbs.pfn) \
+		{ \
+			mtAfCbs.pfn(msg); \
+		} \
+	} while (0)
+
 /*********************************************************************
  * LOCAL VARIABLE
  */
@@ -116,7 +133,7 @@ uint8_t afRegister(RegisterFormat_t *req)
 	}
 }
 
-uint8_t afDataRequest(DataRequestFormat_t *req)
+uint8_t afDataRequestStatus(DataRequestFormat_t *req, uint8_t *srspStatus)
 {
 	uint8_t status;
 	uint8_t cmInd = 0;
@@ -150,6 +167,10 @@ uint8_t afDataRequest(DataRequestFormat_t *req)
 		if (status == MT_RPC_SUCCESS)
 		{
 			rpcWaitMqClientMsg(50);
+			if (srspStatus != NULL)
+			{
+				*srspStatus = rpcGetSrspStatus();
+			}
 		}
 
 		free(cmd);
@@ -162,7 +183,12 @@ uint8_t afDataRequest(DataRequestFormat_t *req)
 	}
 }
 
-uint8_t afDataRequestExt(DataRequestExtFormat_t *req)
+uint8_t afDataRequest(DataRequestFormat_t *req)
+{
+	return afDataRequestStatus(req, NULL);
+}
+
+uint8_t afDataRequestExtStatus(DataRequestExtFormat_t *req, uint8_t *srspStatus)
 {
 	uint8_t status;
 	uint8_t cmInd = 0;
@@ -199,6 +225,10 @@ uint8_t afDataRequestExt(DataRequestExtFormat_t *req)
 		if (status == MT_RPC_SUCCESS)
 		{
 			rpcWaitMqClientMsg(50);
+			if (srspStatus != NULL)
+			{
+				*srspStatus = rpcGetSrspStatus();
+			}
 		}
 
 		free(cmd);
@@ -211,7 +241,13 @@ uint8_t afDataRequestExt(DataRequestExtFormat_t *req)
 	}
 }
 
-uint8_t afDataRequestSrcRtg(DataRequestSrcRtgFormat_t *req)
+uint8_t afDataRequestExt(DataRequestExtFormat_t *req)
+{
+	return afDataRequestExtStatus(req, NULL);
+}
+
+uint8_t afDataRequestSrcRtgStatus(DataRequestSrcRtgFormat_t *req,
+        uint8_t *srspStatus)
 {
 	uint8_t status;
 	uint8_t cmInd = 0;
@@ -250,6 +286,10 @@ uint8_t afDataRequestSrcRtg(DataRequestSrcRtgFormat_t *req)
 		if (status == MT_RPC_SUCCESS)
 		{
 			rpcWaitMqClientMsg(50);
+			if (srspStatus != NULL)
+			{
+				*srspStatus = rpcGetSrspStatus();
+			}
 		}
 
 		free(cmd);
@@ -262,6 +302,11 @@ uint8_t afDataRequestSrcRtg(DataRequestSrcRtgFormat_t *req)
 	}
 }
 
+uint8_t afDataRequestSrcRtg(DataRequestSrcRtgFormat_t *req)
+{
+	return afDataRequestSrcRtgStatus(req, NULL);
+}
+
 uint8_t afInterPanCtl(InterPanCtlFormat_t *req)
 {
 	uint8_t status;
@@ -338,7 +383,7 @@ uint8_t afDataStore(DataStoreFormat_t *req)
 
 static void processDataConfirm(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtAfCbs.pfnAfDataConfirm)
+	if (AF_CB_ANY(pfnAfDataConfirm))
 	{
 		uint8_t msgIdx = 2;
 		DataConfirmFormat_t rsp;
@@ -352,13 +397,13 @@ static void processDataConfirm(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.Endpoint = rpcBuff[msgIdx++];
 		rsp.TransId = rpcBuff[msgIdx++];
 
-		mtAfCbs.pfnAfDataConfirm(&rsp);
+		AF_CB_CALL(pfnAfDataConfirm, &rsp);
 	}
 }
 
 static void processIncomingMsg(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtAfCbs.pfnAfIncomingMsg)
+	if (AF_CB_ANY(pfnAfIncomingMsg))
 	{
 		uint8_t msgIdx = 2;
 		IncomingMsgFormat_t rsp;
@@ -393,13 +438,13 @@ static void processIncomingMsg(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.Data[i] = rpcBuff[msgIdx++];
 			}
 		}
-		mtAfCbs.pfnAfIncomingMsg(&rsp);
+		AF_CB_CALL(pfnAfIncomingMsg, &rsp);
 	}
 }
 
 static void processIncomingMsgExt(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtAfCbs.pfnAfIncomingMsgExt)
+	if (AF_CB_ANY(pfnAfIncomingMsgExt))
 	{
 		uint8_t msgIdx = 2;
 		IncomingMsgExtFormat_t rsp;
@@ -443,7 +488,7 @@ static void processIncomingMsgExt(uint8_t *rpcBuff, uint8_t rpcLen)
 			rsp.Data[ind] = rpcBuff[msgIdx++];
 		}
 
-		mtAfCbs.pfnAfIncomingMsgExt(&rsp);
+		AF_CB_CALL(pfnAfIncomingMsgExt, &rsp);
 	}
 }
 
@@ -483,7 +528,7 @@ uint8_t afDataRetrieve(DataRetrieveFormat_t *req)
 
 static void processDataRetrieveSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtAfCbs.pfnAfDataRetrieveSrsp)
+	if (AF_CB_ANY(pfnAfDataRetrieveSrsp))
 	{
 		uint8_t msgIdx = 2;
 		DataRetrieveSrspFormat_t rsp;
@@ -503,7 +548,7 @@ static void processDataRetrieveSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.Data[i] = rpcBuff[msgIdx++];
 			}
 		}
-		mtAfCbs.pfnAfDataRetrieveSrsp(&rsp);
+		AF_CB_CALL(pfnAfDataRetrieveSrsp, &rsp);
 	}
 }
 
@@ -541,7 +586,7 @@ uint8_t afApsfConfigSet(ApsfConfigSetFormat_t *req)
 
 static void processReflectError(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtAfCbs.pfnAfReflectError)
+	if (AF_CB_ANY(pfnAfReflectError))
 	{
 		uint8_t msgIdx = 2;
 		ReflectErrorFormat_t rsp;
@@ -558,7 +603,7 @@ static void processReflectError(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.DstAddr = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
 		msgIdx += 2;
 
-		mtAfCbs.pfnAfReflectError(&rsp);
+		AF_CB_CALL(pfnAfReflectError, &rsp);
 	}
 }
 
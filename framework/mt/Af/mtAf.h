@@ -296,7 +296,14 @@ void afProcess(uint8_t *rpcBuff, uint8_t rpcLen);
 uint8_t afRegister(RegisterFormat_t *req);
 uint8_t afDataRequest(DataRequestFormat_t *req);
 uint8_t afDataRequestExt(DataRequestExtFormat_t *req);
+// as above, with the status of the SRSP in *srspStatus when the ZNP
+// answered, that is when MT_RPC_SUCCESS is returned
+uint8_t afDataRequestStatus(DataRequestFormat_t *req, uint8_t *srspStatus);
+uint8_t afDataRequestExtStatus(DataRequestExtFormat_t *req,
+        uint8_t *srspStatus);
 uint8_t afDataRequestSrcRtg(DataRequestSrcRtgFormat_t *req);
+uint8_t afDataRequestSrcRtgStatus(DataRequestSrcRtgFormat_t *req,
+        uint8_t *srspStatus);
 uint8_t afInterPanCtl(InterPanCtlFormat_t *req);
 uint8_t afDataStore(DataStoreFormat_t *req);
 uint8_t afDataRetrieve(DataRetrieveFormat_t *req);
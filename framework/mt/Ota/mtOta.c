@@ -0,0 +1,328 @@
+/*
+ * mtOta.c
+ *
+ * This module contains the API for the MT OTA (over the air upgrade)
+ * Interface.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "mtOta.h"
+#include "mtParser.h"
+#include "rpc.h"
+
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Cmd0 of the OTA frames in both directions
+#define MT_OTA_CMD0                (MT_RPC_CMD_AREQ | MT_RPC_SYS_OTA)
+
+// streamed sizes of the file ID and of the address
+#define MT_OTA_FILE_ID_LEN         (8)
+#define MT_OTA_ADDR_LEN            (12)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static mtOtaCb_t mtOtaCbs;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+static uint8_t fileIdToStream(OtaFileIdFormat_t *fileId, uint8_t *buf);
+static uint8_t addrToStream(OtaAddrFormat_t *addr, uint8_t *buf);
+static uint8_t streamToFileId(uint8_t *buf, OtaFileIdFormat_t *fileId);
+static uint8_t streamToAddr(uint8_t *buf, OtaAddrFormat_t *addr);
+static void processFileReadReq(uint8_t *rpcBuff, uint8_t rpcLen);
+static void processNextImgReq(uint8_t *rpcBuff, uint8_t rpcLen);
+static void processStatusInd(uint8_t *rpcBuff, uint8_t rpcLen);
+
+/*********************************************************************
+ * API FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      otaFileReadRsp
+ *
+ * @brief   Answers MT_OTA_FILE_READ_REQ with a block of the image, or
+ *          with a status only when the block is not served.
+ *
+ * @param   req - Pointer to command specific structure.
+ *
+ * @return  status
+ */
+uint8_t otaFileReadRsp(OtaFileReadRspFormat_t *req)
+{
+	uint8_t cmd[1 + MT_OTA_FILE_ID_LEN + MT_OTA_ADDR_LEN + 5
+	        + OTA_MAX_DATA_LEN];
+	uint8_t cmInd = 0;
+
+	if (req->Len > OTA_MAX_DATA_LEN)
+	{
+		return MT_RPC_ERR_LENGTH;
+	}
+
+	cmd[cmInd++] = req->Status;
+	cmInd += fileIdToStream(&req->FileId, &cmd[cmInd]);
+	cmInd += addrToStream(&req->Addr, &cmd[cmInd]);
+	cmd[cmInd++] = (uint8_t)(req->Offset & 0xFF);
+	cmd[cmInd++] = (uint8_t)((req->Offset >> 8) & 0xFF);
+	cmd[cmInd++] = (uint8_t)((req->Offset >> 16) & 0xFF);
+	cmd[cmInd++] = (uint8_t)((req->Offset >> 24) & 0xFF);
+	cmd[cmInd++] = req->Len;
+	if (req->Len)
+	{
+		memcpy(&cmd[cmInd], req->Data, req->Len);
+		cmInd += req->Len;
+	}
+
+	return rpcSendFrame(MT_OTA_CMD0, MT_OTA_FILE_READ_RSP, cmd, cmInd);
+}
+
+/*********************************************************************
+ * @fn      otaNextImgRsp
+ *
+ * @brief   Answers MT_OTA_NEXT_IMG_REQ with the image the client is to
+ *          download, or with OTA_NO_IMAGE_AVAILABLE.
+ *
+ * @param   req - Pointer to command specific structure.
+ *
+ * @return  status
+ */
+uint8_t otaNextImgRsp(OtaNextImgRspFormat_t *req)
+{
+	uint8_t cmd[1 + MT_OTA_ADDR_LEN + 1 + MT_OTA_FILE_ID_LEN + 4];
+	uint8_t cmInd = 0;
+
+	cmd[cmInd++] = req->Status;
+	cmInd += addrToStream(&req->Addr, &cmd[cmInd]);
+	cmd[cmInd++] = req->Option;
+	cmInd += fileIdToStream(&req->FileId, &cmd[cmInd]);
+	cmd[cmInd++] = (uint8_t)(req->ImageSize & 0xFF);
+	cmd[cmInd++] = (uint8_t)((req->ImageSize >> 8) & 0xFF);
+	cmd[cmInd++] = (uint8_t)((req->ImageSize >> 16) & 0xFF);
+	cmd[cmInd++] = (uint8_t)((req->ImageSize >> 24) & 0xFF);
+
+	return rpcSendFrame(MT_OTA_CMD0, MT_OTA_NEXT_IMG_RSP, cmd, cmInd);
+}
+
+/*********************************************************************
+ * @fn      otaRegisterCallbacks
+ *
+ * @brief Register the ota callbacks
+ *
+ * @param cbs - callback structure for mtOta
+ *
+ * @return
+ */
+void otaRegisterCallbacks(mtOtaCb_t cbs)
+{
+	memcpy(&mtOtaCbs, &cbs, sizeof(mtOtaCb_t));
+}
+
+/*************************************************************************************************
+ * @fn      otaProcess()
+ *
+ * @brief   read and process the RPC OTA message from the ZB SoC
+ *
+ * @param   rpcBuff - frame starting from the Cmd0 byte
+ * @param   rpcLen - length of the frame
+ *
+ * @return  -
+ *************************************************************************************************/
+void otaProcess(uint8_t *rpcBuff, uint8_t rpcLen)
+{
+	dbg_print(PRINT_LEVEL_VERBOSE, "otaProcess: processing CMD0:%x, CMD1:%x\n",
+	        rpcBuff[0], rpcBuff[1]);
+
+	switch (rpcBuff[1])
+	{
+	case MT_OTA_FILE_READ_REQ:
+		dbg_print(PRINT_LEVEL_VERBOSE, "otaProcess: MT_OTA_FILE_READ_REQ\n");
+		processFileReadReq(rpcBuff, rpcLen);
+		break;
+	case MT_OTA_NEXT_IMG_REQ:
+		dbg_print(PRINT_LEVEL_VERBOSE, "otaProcess: MT_OTA_NEXT_IMG_REQ\n");
+		processNextImgReq(rpcBuff, rpcLen);
+		break;
+	case MT_OTA_STATUS_IND:
+		dbg_print(PRINT_LEVEL_VERBOSE, "otaProcess: MT_OTA_STATUS_IND\n");
+		processStatusInd(rpcBuff, rpcLen);
+		break;
+
+	default:
+		dbg_print(PRINT_LEVEL_INFO,
+		        "otaProcess: CMD0:%x, CMD1:%x, not handled\n", rpcBuff[0],
+		        rpcBuff[1]);
+		break;
+	}
+}
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint8_t fileIdToStream(OtaFileIdFormat_t *fileId, uint8_t *buf)
+{
+	buf[0] = (uint8_t)(fileId->Manufacturer & 0xFF);
+	buf[1] = (uint8_t)((fileId->Manufacturer >> 8) & 0xFF);
+	buf[2] = (uint8_t)(fileId->ImageType & 0xFF);
+	buf[3] = (uint8_t)((fileId->ImageType >> 8) & 0xFF);
+	buf[4] = (uint8_t)(fileId->FileVersion & 0xFF);
+	buf[5] = (uint8_t)((fileId->FileVersion >> 8) & 0xFF);
+	buf[6] = (uint8_t)((fileId->FileVersion >> 16) & 0xFF);
+	buf[7] = (uint8_t)((fileId->FileVersion >> 24) & 0xFF);
+
+	return MT_OTA_FILE_ID_LEN;
+}
+
+static uint8_t addrToStream(OtaAddrFormat_t *addr, uint8_t *buf)
+{
+	buf[0] = addr->AddrMode;
+	memcpy(&buf[1], addr->Addr, 8);
+	buf[9] = addr->Endpoint;
+	buf[10] = (uint8_t)(addr->PanId & 0xFF);
+	buf[11] = (uint8_t)((addr->PanId >> 8) & 0xFF);
+
+	return MT_OTA_ADDR_LEN;
+}
+
+static uint8_t streamToFileId(uint8_t *buf, OtaFileIdFormat_t *fileId)
+{
+	fileId->Manufacturer = BUILD_UINT16(buf[0], buf[1]);
+	fileId->ImageType = BUILD_UINT16(buf[2], buf[3]);
+	fileId->FileVersion = BUILD_UINT32(buf[4], buf[5], buf[6], buf[7]);
+
+	return MT_OTA_FILE_ID_LEN;
+}
+
+static uint8_t streamToAddr(uint8_t *buf, OtaAddrFormat_t *addr)
+{
+	addr->AddrMode = buf[0];
+	memcpy(addr->Addr, &buf[1], 8);
+	addr->Endpoint = buf[9];
+	addr->PanId = BUILD_UINT16(buf[10], buf[11]);
+
+	return MT_OTA_ADDR_LEN;
+}
+
+/*********************************************************************
+ * @fn      processFileReadReq
+ *
+ * @brief   Process the request of an image block
+ *
+ * @param   rpcBuff - frame starting from the Cmd0 byte
+ * @param   rpcLen - length of the frame
+ *
+ * @return  -
+ */
+static void processFileReadReq(uint8_t *rpcBuff, uint8_t rpcLen)
+{
+	if (mtOtaCbs.pfnOtaFileReadReq)
+	{
+		uint8_t msgIdx = 2;
+		OtaFileReadReqFormat_t req;
+
+		// Cmd0, Cmd1, file ID, address, offset, length and FCS
+		if (rpcLen < 3 + MT_OTA_FILE_ID_LEN + MT_OTA_ADDR_LEN + 5)
+		{
+			printf("MT_RPC_ERR_LENGTH\n");
+			return;
+		}
+
+		msgIdx += streamToFileId(&rpcBuff[msgIdx], &req.FileId);
+		msgIdx += streamToAddr(&rpcBuff[msgIdx], &req.Addr);
+		req.Offset = BUILD_UINT32(rpcBuff[msgIdx], rpcBuff[msgIdx + 1],
+		        rpcBuff[msgIdx + 2], rpcBuff[msgIdx + 3]);
+		msgIdx += 4;
+		req.Len = rpcBuff[msgIdx++];
+
+		mtOtaCbs.pfnOtaFileReadReq(&req);
+	}
+}
+
+/*********************************************************************
+ * @fn      processNextImgReq
+ *
+ * @brief   Process the query of a client for its next image, the
+ *          hardware version is there with OTA_NEXT_IMG_HW_VERSION
+ *
+ * @param   rpcBuff - frame starting from the Cmd0 byte
+ * @param   rpcLen - length of the frame
+ *
+ * @return  -
+ */
+static void processNextImgReq(uint8_t *rpcBuff, uint8_t rpcLen)
+{
+	if (mtOtaCbs.pfnOtaNextImgReq)
+	{
+		uint8_t msgIdx = 2;
+		OtaNextImgReqFormat_t req;
+
+		// Cmd0, Cmd1, address, option, file ID and FCS
+		if (rpcLen < 3 + MT_OTA_ADDR_LEN + 1 + MT_OTA_FILE_ID_LEN)
+		{
+			printf("MT_RPC_ERR_LENGTH\n");
+			return;
+		}
+
+		msgIdx += streamToAddr(&rpcBuff[msgIdx], &req.Addr);
+		req.Option = rpcBuff[msgIdx++];
+		msgIdx += streamToFileId(&rpcBuff[msgIdx], &req.FileId);
+		req.HwVersion = 0;
+		if ((req.Option & OTA_NEXT_IMG_HW_VERSION) && (rpcLen >= msgIdx + 3))
+		{
+			req.HwVersion = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
+			msgIdx += 2;
+		}
+
+		mtOtaCbs.pfnOtaNextImgReq(&req);
+	}
+}
+
+/*********************************************************************
+ * @fn      processStatusInd
+ *
+ * @brief   Process the status of a client, sent at the end of its
+ *          download
+ *
+ * @param   rpcBuff - frame starting from the Cmd0 byte
+ * @param   rpcLen - length of the frame
+ *
+ * @return  -
+ */
+static void processStatusInd(uint8_t *rpcBuff, uint8_t rpcLen)
+{
+	if (mtOtaCbs.pfnOtaStatusInd)
+	{
+		uint8_t msgIdx = 2;
+		OtaStatusIndFormat_t ind;
+
+		// Cmd0, Cmd1, address, type, status, optional and FCS
+		if (rpcLen < 8)
+		{
+			printf("MT_RPC_ERR_LENGTH\n");
+			return;
+		}
+
+		ind.ShortAddr = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
+		msgIdx += 2;
+		ind.Type = rpcBuff[msgIdx++];
+		ind.Status = rpcBuff[msgIdx++];
+		ind.Optional = rpcBuff[msgIdx++];
+
+		mtOtaCbs.pfnOtaStatusInd(&ind);
+	}
+}
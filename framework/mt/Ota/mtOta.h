@@ -0,0 +1,141 @@
+/*
+ * mtOta.h
+ *
+ * This module contains the API for the MT OTA (over the air upgrade)
+ * Interface.
+ *
+ * The OTA upgrade server cluster runs in the ZNP, which asks the host
+ * for the images it serves: MT_OTA_NEXT_IMG_REQ when a client queries
+ * for a new image and MT_OTA_FILE_READ_REQ for each image block. The
+ * host answers with the matching responses, all frames are AREQ. The
+ * offsets and sizes are the ones of the OTA file, header included.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef ZBMTOTA_H
+#define ZBMTOTA_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+/***************************************************************************************************
+ * OTA COMMANDS
+ ***************************************************************************************************/
+
+// OTA MT Command Identifiers
+/* AREQ from Host */
+#define MT_OTA_FILE_READ_RSP                0x80
+#define MT_OTA_NEXT_IMG_RSP                 0x81
+
+/* AREQ to host */
+#define MT_OTA_FILE_READ_REQ                0x00
+#define MT_OTA_NEXT_IMG_REQ                 0x01
+#define MT_OTA_STATUS_IND                   0x81
+
+/* ZCL status of the responses */
+#define OTA_SUCCESS                         0x00
+#define OTA_MALFORMED_COMMAND               0x80
+#define OTA_ABORT                           0x95
+#define OTA_INVALID_IMAGE                   0x96
+#define OTA_WAIT_FOR_DATA                   0x97
+#define OTA_NO_IMAGE_AVAILABLE              0x98
+
+/* Option of MT_OTA_NEXT_IMG_REQ */
+#define OTA_NEXT_IMG_HW_VERSION             0x01
+
+/* Type of MT_OTA_STATUS_IND */
+#define OTA_STATUS_DL_COMPLETE              0x02
+
+// address modes of OtaAddrFormat_t
+#define OTA_ADDR_16BIT                      0x02
+#define OTA_ADDR_64BIT                      0x03
+
+// largest image block a MT_OTA_FILE_READ_RSP frame carries
+#define OTA_MAX_DATA_LEN                    (128)
+
+typedef struct
+{
+	uint16_t Manufacturer;
+	uint16_t ImageType;
+	uint32_t FileVersion;
+} OtaFileIdFormat_t;
+
+typedef struct
+{
+	uint8_t AddrMode;            // OTA_ADDR_*
+	uint8_t Addr[8];             // little endian, 2 bytes used in 16 bit mode
+	uint8_t Endpoint;
+	uint16_t PanId;
+} OtaAddrFormat_t;
+
+typedef struct
+{
+	OtaFileIdFormat_t FileId;
+	OtaAddrFormat_t Addr;
+	uint32_t Offset;
+	uint8_t Len;
+} OtaFileReadReqFormat_t;
+
+typedef struct
+{
+	uint8_t Status;
+	OtaFileIdFormat_t FileId;
+	OtaAddrFormat_t Addr;
+	uint32_t Offset;
+	uint8_t Len;
+	const uint8_t *Data;         // Len bytes, sent without a copy
+} OtaFileReadRspFormat_t;
+
+typedef struct
+{
+	OtaAddrFormat_t Addr;
+	uint8_t Option;              // OTA_NEXT_IMG_*
+	OtaFileIdFormat_t FileId;    // image the client runs
+	uint16_t HwVersion;
+} OtaNextImgReqFormat_t;
+
+typedef struct
+{
+	uint8_t Status;
+	OtaAddrFormat_t Addr;
+	uint8_t Option;
+	OtaFileIdFormat_t FileId;    // image to download
+	uint32_t ImageSize;
+} OtaNextImgRspFormat_t;
+
+typedef struct
+{
+	uint16_t ShortAddr;
+	uint8_t Type;                // OTA_STATUS_*
+	uint8_t Status;
+	uint8_t Optional;
+} OtaStatusIndFormat_t;
+
+typedef uint8_t (*mtOtaFileReadReqCb_t)(OtaFileReadReqFormat_t *msg);
+typedef uint8_t (*mtOtaNextImgReqCb_t)(OtaNextImgReqFormat_t *msg);
+typedef uint8_t (*mtOtaStatusIndCb_t)(OtaStatusIndFormat_t *msg);
+
+typedef struct
+{
+	mtOtaFileReadReqCb_t pfnOtaFileReadReq;     //MT_OTA_FILE_READ_REQ
+	mtOtaNextImgReqCb_t pfnOtaNextImgReq;       //MT_OTA_NEXT_IMG_REQ
+	mtOtaStatusIndCb_t pfnOtaStatusInd;         //MT_OTA_STATUS_IND
+} mtOtaCb_t;
+
+void otaRegisterCallbacks(mtOtaCb_t cbs);
+void otaProcess(uint8_t *rpcBuff, uint8_t rpcLen);
+uint8_t otaFileReadRsp(OtaFileReadRspFormat_t *req);
+uint8_t otaNextImgRsp(OtaNextImgRspFormat_t *req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZBMTOTA_H */
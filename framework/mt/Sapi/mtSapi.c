@@ -45,11 +45,32 @@
 
 #include "mtSapi.h"
 #include "mtSys.h"
+#include "mtEvent.h"
 #include "mtParser.h"
 #include "rpc.h"
 
 #include "dbgPrint.h"
 
+/*********************************************************************
+ * MACROS
+ */
+
+// true if the application or a listener of the event handles the
+// callback, rpcBuff being the frame processed
+#define SAPI_CB_ANY(pfn) \
+	(mtSapiCbs.pfn || mtEventListened(MT_EVENT_FRAME(rpcBuff)))
+
+// calls the listeners, then the application callback
+#define SAPI_CB_CALL(pfn, msg) \
+	do \
+	{ \
+		mtEventDispatch(MT_EVENT_FRAME(rpcBuff), msg); \
+		if (mtSapiCbs.pfn) \
+		{ \
+			mtSapiCbs.pfn(msg); \
+		} \
+	} while (0)
+
 /*********************************************************************
  * LOCAL VARIABLES
  */
@@ -538,7 +559,7 @@ uint8_t zbReadConfiguration(ReadConfigurationFormat_t *req)
  */
 static void processReadConfigurationSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSapiCbs.pfnSapiReadConfigurationSrsp)
+	if (SAPI_CB_ANY(pfnSapiReadConfigurationSrsp))
 	{
 		uint8_t msgIdx = 2;
 		ReadConfigurationSrspFormat_t rsp;
@@ -559,7 +580,7 @@ static void processReadConfigurationSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.Value[i] = rpcBuff[msgIdx++];
 			}
 		}
-		mtSapiCbs.pfnSapiReadConfigurationSrsp(&rsp);
+		SAPI_CB_CALL(pfnSapiReadConfigurationSrsp, &rsp);
 	}
 }
 
@@ -577,7 +598,7 @@ static void processReadConfigurationSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processGetDeviceInfoSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSapiCbs.pfnSapiGetDeviceInfoSrsp)
+	if (SAPI_CB_ANY(pfnSapiGetDeviceInfoSrsp))
 	{
 		uint8_t msgIdx = 2;
 		GetDeviceInfoSrspFormat_t rsp;
@@ -594,7 +615,7 @@ static void processGetDeviceInfoSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 			rsp.Value[i] = rpcBuff[msgIdx++];
 		}
 
-		mtSapiCbs.pfnSapiGetDeviceInfoSrsp(&rsp);
+		SAPI_CB_CALL(pfnSapiGetDeviceInfoSrsp, &rsp);
 	}
 }
 
@@ -612,7 +633,7 @@ static void processGetDeviceInfoSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processFindDeviceCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSapiCbs.pfnSapiFindDeviceCnf)
+	if (SAPI_CB_ANY(pfnSapiFindDeviceCnf))
 	{
 		uint8_t msgIdx = 2;
 		FindDeviceCnfFormat_t rsp;
@@ -629,7 +650,7 @@ static void processFindDeviceCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 		for (i = 0; i < 8; i++)
 			rsp.Result |= ((uint64_t) rpcBuff[msgIdx++]) << (i * 8);
 
-		mtSapiCbs.pfnSapiFindDeviceCnf(&rsp);
+		SAPI_CB_CALL(pfnSapiFindDeviceCnf, &rsp);
 	}
 }
 
@@ -647,7 +668,7 @@ static void processFindDeviceCnf(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processSendDataCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSapiCbs.pfnSapiSendDataCnf)
+	if (SAPI_CB_ANY(pfnSapiSendDataCnf))
 	{
 		uint8_t msgIdx = 2;
 		SendDataCnfFormat_t rsp;
@@ -660,7 +681,7 @@ static void processSendDataCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.Handle = rpcBuff[msgIdx++];
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtSapiCbs.pfnSapiSendDataCnf(&rsp);
+		SAPI_CB_CALL(pfnSapiSendDataCnf, &rsp);
 	}
 }
 
@@ -678,7 +699,7 @@ static void processSendDataCnf(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processReceiveDataInd(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSapiCbs.pfnSapiReceiveDataInd)
+	if (SAPI_CB_ANY(pfnSapiReceiveDataInd))
 	{
 		uint8_t msgIdx = 2;
 		ReceiveDataIndFormat_t rsp;
@@ -702,7 +723,7 @@ static void processReceiveDataInd(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.Data[i] = rpcBuff[msgIdx++];
 			}
 		}
-		mtSapiCbs.pfnSapiReceiveDataInd(&rsp);
+		SAPI_CB_CALL(pfnSapiReceiveDataInd, &rsp);
 	}
 }
 
@@ -719,7 +740,7 @@ static void processReceiveDataInd(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processAllowBindCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSapiCbs.pfnSapiAllowBindCnf)
+	if (SAPI_CB_ANY(pfnSapiAllowBindCnf))
 	{
 		uint8_t msgIdx = 2;
 		AllowBindCnfFormat_t rsp;
@@ -732,7 +753,7 @@ static void processAllowBindCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.Source = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
 		msgIdx += 2;
 
-		mtSapiCbs.pfnSapiAllowBindCnf(&rsp);
+		SAPI_CB_CALL(pfnSapiAllowBindCnf, &rsp);
 	}
 }
 
@@ -749,7 +770,7 @@ static void processAllowBindCnf(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processBindCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSapiCbs.pfnSapiBindCnf)
+	if (SAPI_CB_ANY(pfnSapiBindCnf))
 	{
 		uint8_t msgIdx = 2;
 		BindCnfFormat_t rsp;
@@ -763,7 +784,7 @@ static void processBindCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 		msgIdx += 2;
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtSapiCbs.pfnSapiBindCnf(&rsp);
+		SAPI_CB_CALL(pfnSapiBindCnf, &rsp);
 	}
 }
 
@@ -780,7 +801,7 @@ static void processBindCnf(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processStartCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSapiCbs.pfnSapiStartCnf)
+	if (SAPI_CB_ANY(pfnSapiStartCnf))
 	{
 		uint8_t msgIdx = 2;
 		StartCnfFormat_t rsp;
@@ -792,7 +813,7 @@ static void processStartCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtSapiCbs.pfnSapiStartCnf(&rsp);
+		SAPI_CB_CALL(pfnSapiStartCnf, &rsp);
 	}
 }
 
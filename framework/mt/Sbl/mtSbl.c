@@ -0,0 +1,303 @@
+/*
+ * mtSbl.c
+ *
+ * This module contains the API for the MT SBL (serial bootloader)
+ * Interface.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "mtSbl.h"
+#include "mtParser.h"
+#include "rpc.h"
+
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Cmd0 of the SBL frames in both directions
+#define MT_SBL_CMD0                (MT_RPC_CMD_AREQ | MT_RPC_SYS_SBL)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static mtSblCb_t mtSblCbs;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+static void processStatusRsp(mtSblStatusRspCb_t cb, uint8_t *rpcBuff,
+        uint8_t rpcLen);
+static void processReadRsp(uint8_t *rpcBuff, uint8_t rpcLen);
+static void processHandshakeRsp(uint8_t *rpcBuff, uint8_t rpcLen);
+
+/*********************************************************************
+ * API FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      sblHandshake
+ *
+ * @brief   Asks the bootloader for its parameters. The response comes
+ *          with MT_SBL_HANDSHAKE_RSP.
+ *
+ * @param   -
+ *
+ * @return  status
+ */
+uint8_t sblHandshake(void)
+{
+	return rpcSendFrame(MT_SBL_CMD0, MT_SBL_HANDSHAKE, NULL, 0);
+}
+
+/*********************************************************************
+ * @fn      sblWrite
+ *
+ * @brief   Writes a block of the flash, a write at the start of a page
+ *          erases the page first. The response comes with
+ *          MT_SBL_WRITE_RSP, in the order of the writes.
+ *
+ * @param   req - Pointer to command specific structure.
+ *
+ * @return  status
+ */
+uint8_t sblWrite(SblWriteFormat_t *req)
+{
+	uint8_t cmd[4 + SBL_MAX_DATA_LEN];
+	uint8_t cmInd = 0;
+
+	if (req->Len > SBL_MAX_DATA_LEN)
+	{
+		return MT_RPC_ERR_LENGTH;
+	}
+
+	cmd[cmInd++] = (uint8_t)(req->Address & 0xFF);
+	cmd[cmInd++] = (uint8_t)((req->Address >> 8) & 0xFF);
+	cmd[cmInd++] = (uint8_t)((req->Address >> 16) & 0xFF);
+	cmd[cmInd++] = (uint8_t)((req->Address >> 24) & 0xFF);
+	memcpy(&cmd[cmInd], req->Data, req->Len);
+	cmInd += req->Len;
+
+	return rpcSendFrame(MT_SBL_CMD0, MT_SBL_WRITE, cmd, cmInd);
+}
+
+/*********************************************************************
+ * @fn      sblRead
+ *
+ * @brief   Reads a block of the flash, as long as the buffer length of
+ *          the handshake. The data comes with MT_SBL_READ_RSP.
+ *
+ * @param   req - Pointer to command specific structure.
+ *
+ * @return  status
+ */
+uint8_t sblRead(SblReadFormat_t *req)
+{
+	uint8_t cmd[4];
+
+	cmd[0] = (uint8_t)(req->Address & 0xFF);
+	cmd[1] = (uint8_t)((req->Address >> 8) & 0xFF);
+	cmd[2] = (uint8_t)((req->Address >> 16) & 0xFF);
+	cmd[3] = (uint8_t)((req->Address >> 24) & 0xFF);
+
+	return rpcSendFrame(MT_SBL_CMD0, MT_SBL_READ, cmd, sizeof(cmd));
+}
+
+/*********************************************************************
+ * @fn      sblEnable
+ *
+ * @brief   Asks the bootloader to validate the CRC of the image and to
+ *          mark it bootable. The response comes with MT_SBL_ENABLE_RSP.
+ *
+ * @param   -
+ *
+ * @return  status
+ */
+uint8_t sblEnable(void)
+{
+	return rpcSendFrame(MT_SBL_CMD0, MT_SBL_ENABLE, NULL, 0);
+}
+
+/*********************************************************************
+ * @fn      sblRegisterCallbacks
+ *
+ * @brief Register the sbl callbacks
+ *
+ * @param cbs - callback structure for mtSbl
+ *
+ * @return
+ */
+void sblRegisterCallbacks(mtSblCb_t cbs)
+{
+	memcpy(&mtSblCbs, &cbs, sizeof(mtSblCb_t));
+}
+
+/*************************************************************************************************
+ * @fn      sblProcess()
+ *
+ * @brief   read and process the RPC SBL message from the ZB SoC
+ *
+ * @param   rpcBuff - frame starting from the Cmd0 byte
+ * @param   rpcLen - length of the frame
+ *
+ * @return  -
+ *************************************************************************************************/
+void sblProcess(uint8_t *rpcBuff, uint8_t rpcLen)
+{
+	dbg_print(PRINT_LEVEL_VERBOSE, "sblProcess: processing CMD0:%x, CMD1:%x\n",
+	        rpcBuff[0], rpcBuff[1]);
+
+	switch (rpcBuff[1])
+	{
+	case MT_SBL_WRITE_RSP:
+		dbg_print(PRINT_LEVEL_VERBOSE, "sblProcess: MT_SBL_WRITE_RSP\n");
+		processStatusRsp(mtSblCbs.pfnSblWriteRsp, rpcBuff, rpcLen);
+		break;
+	case MT_SBL_READ_RSP:
+		dbg_print(PRINT_LEVEL_VERBOSE, "sblProcess: MT_SBL_READ_RSP\n");
+		processReadRsp(rpcBuff, rpcLen);
+		break;
+	case MT_SBL_ENABLE_RSP:
+		dbg_print(PRINT_LEVEL_VERBOSE, "sblProcess: MT_SBL_ENABLE_RSP\n");
+		processStatusRsp(mtSblCbs.pfnSblEnableRsp, rpcBuff, rpcLen);
+		break;
+	case MT_SBL_HANDSHAKE_RSP:
+		dbg_print(PRINT_LEVEL_VERBOSE, "sblProcess: MT_SBL_HANDSHAKE_RSP\n");
+		processHandshakeRsp(rpcBuff, rpcLen);
+		break;
+
+	default:
+		dbg_print(PRINT_LEVEL_INFO,
+		        "sblProcess: CMD0:%x, CMD1:%x, not handled\n", rpcBuff[0],
+		        rpcBuff[1]);
+		break;
+	}
+}
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      processStatusRsp
+ *
+ * @brief   Process a response carrying only a status
+ *
+ * @param   cb - callback of the response
+ * @param   rpcBuff - frame starting from the Cmd0 byte
+ * @param   rpcLen - length of the frame
+ *
+ * @return  -
+ */
+static void processStatusRsp(mtSblStatusRspCb_t cb, uint8_t *rpcBuff,
+        uint8_t rpcLen)
+{
+	if (cb)
+	{
+		SblStatusRspFormat_t rsp;
+
+		if (rpcLen < 1)
+		{
+			printf("MT_RPC_ERR_LENGTH\n");
+		}
+
+		rsp.Status = rpcBuff[2];
+
+		cb(&rsp);
+	}
+}
+
+/*********************************************************************
+ * @fn      processReadRsp
+ *
+ * @brief   Process the READ response, the data length is what remains
+ *          of the frame after the status and the address
+ *
+ * @param   rpcBuff - frame starting from the Cmd0 byte
+ * @param   rpcLen - length of the frame
+ *
+ * @return  -
+ */
+static void processReadRsp(uint8_t *rpcBuff, uint8_t rpcLen)
+{
+	if (mtSblCbs.pfnSblReadRsp)
+	{
+		uint8_t msgIdx = 2;
+		SblReadRspFormat_t rsp;
+
+		// Cmd0, Cmd1, status, address and FCS
+		if (rpcLen < 8)
+		{
+			printf("MT_RPC_ERR_LENGTH\n");
+			return;
+		}
+
+		rsp.Status = rpcBuff[msgIdx++];
+		rsp.Address = BUILD_UINT32(rpcBuff[msgIdx], rpcBuff[msgIdx + 1],
+		        rpcBuff[msgIdx + 2], rpcBuff[msgIdx + 3]);
+		msgIdx += 4;
+		rsp.Len = rpcLen - 8;
+		if (rsp.Len > SBL_MAX_DATA_LEN)
+		{
+			rsp.Len = SBL_MAX_DATA_LEN;
+		}
+		memcpy(rsp.Data, &rpcBuff[msgIdx], rsp.Len);
+
+		mtSblCbs.pfnSblReadRsp(&rsp);
+	}
+}
+
+/*********************************************************************
+ * @fn      processHandshakeRsp
+ *
+ * @brief   Process the HANDSHAKE response. Older bootloaders answer with
+ *          the status only, they take 64 byte blocks and 2kB pages.
+ *
+ * @param   rpcBuff - frame starting from the Cmd0 byte
+ * @param   rpcLen - length of the frame
+ *
+ * @return  -
+ */
+static void processHandshakeRsp(uint8_t *rpcBuff, uint8_t rpcLen)
+{
+	if (mtSblCbs.pfnSblHandshakeRsp)
+	{
+		uint8_t msgIdx = 2;
+		SblHandshakeRspFormat_t rsp;
+
+		memset(&rsp, 0, sizeof(rsp));
+		rsp.Status = rpcBuff[msgIdx++];
+		rsp.BufferLength = 64;
+		rsp.PageSize = 2048;
+
+		// Cmd0, Cmd1, status, revision, type, buffer, page and FCS
+		if (rpcLen >= 17)
+		{
+			rsp.BootloaderRevision = BUILD_UINT32(rpcBuff[msgIdx],
+			        rpcBuff[msgIdx + 1], rpcBuff[msgIdx + 2],
+			        rpcBuff[msgIdx + 3]);
+			msgIdx += 4;
+			rsp.DeviceType = rpcBuff[msgIdx++];
+			rsp.BufferLength = BUILD_UINT32(rpcBuff[msgIdx],
+			        rpcBuff[msgIdx + 1], rpcBuff[msgIdx + 2],
+			        rpcBuff[msgIdx + 3]);
+			msgIdx += 4;
+			rsp.PageSize = BUILD_UINT32(rpcBuff[msgIdx], rpcBuff[msgIdx + 1],
+			        rpcBuff[msgIdx + 2], rpcBuff[msgIdx + 3]);
+			msgIdx += 4;
+		}
+
+		mtSblCbs.pfnSblHandshakeRsp(&rsp);
+	}
+}
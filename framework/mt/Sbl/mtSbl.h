@@ -0,0 +1,117 @@
+/*
+ * mtSbl.h
+ *
+ * This module contains the API for the MT SBL (serial bootloader)
+ * Interface.
+ *
+ * The commands are the ones of the CC2538 serial bootloader: they are
+ * AREQ frames of the SBL subsystem in both directions, the response
+ * carries the command ID with MT_SBL_RSP_MASK set. Flash addresses are
+ * 32 bit byte addresses and the bootloader handles one command at a
+ * time, answering them in the order received.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef ZBMTSBL_H
+#define ZBMTSBL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+/***************************************************************************************************
+ * SBL COMMANDS
+ ***************************************************************************************************/
+
+// SBL MT Command Identifiers
+/* AREQ from Host */
+#define MT_SBL_WRITE                        0x01
+#define MT_SBL_READ                         0x02
+#define MT_SBL_ENABLE                       0x03
+#define MT_SBL_HANDSHAKE                    0x04
+
+/* AREQ to host, the command ID with the response bit */
+#define MT_SBL_RSP_MASK                     0x80
+#define MT_SBL_WRITE_RSP                    (MT_SBL_WRITE | MT_SBL_RSP_MASK)
+#define MT_SBL_READ_RSP                     (MT_SBL_READ | MT_SBL_RSP_MASK)
+#define MT_SBL_ENABLE_RSP                   (MT_SBL_ENABLE | MT_SBL_RSP_MASK)
+#define MT_SBL_HANDSHAKE_RSP                (MT_SBL_HANDSHAKE | MT_SBL_RSP_MASK)
+
+/* Status of the responses */
+#define SBL_SUCCESS                         0x00
+#define SBL_FAILURE                         0x01
+#define SBL_INVALID_FCS                     0x02
+#define SBL_INVALID_FILE                    0x03
+#define SBL_FILESYSTEM_ERROR                0x04
+#define SBL_ALREADY_STARTED                 0x05
+#define SBL_NO_RESPONSE                     0x06
+#define SBL_VALIDATE_FAILED                 0x07
+#define SBL_CANCELED                        0x08
+
+// largest block a WRITE or READ_RSP frame carries
+#define SBL_MAX_DATA_LEN                    (240)
+
+typedef struct
+{
+	uint32_t Address;
+	uint8_t Len;
+	uint8_t Data[SBL_MAX_DATA_LEN];
+} SblWriteFormat_t;
+
+typedef struct
+{
+	uint32_t Address;
+} SblReadFormat_t;
+
+typedef struct
+{
+	uint8_t Status;
+} SblStatusRspFormat_t;
+
+typedef struct
+{
+	uint8_t Status;
+	uint32_t Address;
+	uint8_t Len;
+	uint8_t Data[SBL_MAX_DATA_LEN];
+} SblReadRspFormat_t;
+
+typedef struct
+{
+	uint8_t Status;
+	uint32_t BootloaderRevision;
+	uint8_t DeviceType;
+	uint32_t BufferLength;       // data bytes of a WRITE and READ
+	uint32_t PageSize;           // flash page, erased by a WRITE at its start
+} SblHandshakeRspFormat_t;
+
+typedef uint8_t (*mtSblStatusRspCb_t)(SblStatusRspFormat_t *msg);
+typedef uint8_t (*mtSblReadRspCb_t)(SblReadRspFormat_t *msg);
+typedef uint8_t (*mtSblHandshakeRspCb_t)(SblHandshakeRspFormat_t *msg);
+
+typedef struct
+{
+	mtSblStatusRspCb_t pfnSblWriteRsp;          //MT_SBL_WRITE_RSP
+	mtSblReadRspCb_t pfnSblReadRsp;             //MT_SBL_READ_RSP
+	mtSblStatusRspCb_t pfnSblEnableRsp;         //MT_SBL_ENABLE_RSP
+	mtSblHandshakeRspCb_t pfnSblHandshakeRsp;   //MT_SBL_HANDSHAKE_RSP
+} mtSblCb_t;
+
+void sblRegisterCallbacks(mtSblCb_t cbs);
+void sblProcess(uint8_t *rpcBuff, uint8_t rpcLen);
+uint8_t sblHandshake(void);
+uint8_t sblWrite(SblWriteFormat_t *req);
+uint8_t sblRead(SblReadFormat_t *req);
+uint8_t sblEnable(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZBMTSBL_H */
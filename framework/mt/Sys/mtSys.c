@@ -44,6 +44,7 @@
 #include <stdlib.h>
 
 #include "mtSys.h"
+#include "mtEvent.h"
 #include "mtParser.h"
 #include "rpc.h"
 #include "dbgPrint.h"
@@ -54,6 +55,22 @@
 #define HI_UINT16(a) (((a) >> 8) & 0xFF)
 #define LO_UINT16(a) ((a) & 0xFF)
 
+// true if the application or a listener of the event handles the
+// callback, rpcBuff being the frame processed
+#define SYS_CB_ANY(pfn) \
+	(mtSysCbs.pfn || mtEventListened(MT_EVENT_FRAME(rpcBuff)))
+
+// calls the listeners, then the application callback
+#define SYS_CB_CALL(pfn, msg) \
+	do \
+	{ \
+		mtEventDispatch(MT_EVENT_FRAME(rpcBuff), msg); \
+		if (mtSysCbs.pfn) \
+		{ \
+			mtSysCbs.pfn(msg); \
+		} \
+	} while (0)
+
 /*********************************************************************
  * LOCAL VARIABLE
  */
@@ -105,7 +122,7 @@ uint8_t sysPing()
  */
 static void processPingSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysPingSrsp)
+	if (SYS_CB_ANY(pfnSysPingSrsp))
 	{
 		uint8_t msgIdx = 2;
 		PingSrspFormat_t rsp;
@@ -119,7 +136,7 @@ static void processPingSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.Capabilities = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
 		msgIdx += 2;
 
-		mtSysCbs.pfnSysPingSrsp(&rsp);
+		SYS_CB_CALL(pfnSysPingSrsp, &rsp);
 	}
 }
 
@@ -198,7 +215,7 @@ uint8_t sysGetExtAddr()
  */
 static void processGetExtAddrSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysGetExtAddrSrsp)
+	if (SYS_CB_ANY(pfnSysGetExtAddrSrsp))
 	{
 		uint8_t msgIdx = 2;
 		GetExtAddrSrspFormat_t rsp;
@@ -214,7 +231,7 @@ static void processGetExtAddrSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		for (i = 0; i < 8; i++)
 			rsp.ExtAddr |= ((uint64_t) rpcBuff[msgIdx++]) << (i * 8);
 
-		mtSysCbs.pfnSysGetExtAddrSrsp(&rsp);
+		SYS_CB_CALL(pfnSysGetExtAddrSrsp, &rsp);
 	}
 }
 
@@ -272,7 +289,7 @@ uint8_t sysRamRead(RamReadFormat_t *req)
  */
 static void processRamReadSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysRamReadSrsp)
+	if (SYS_CB_ANY(pfnSysRamReadSrsp))
 	{
 		uint8_t msgIdx = 2;
 		RamReadSrspFormat_t rsp;
@@ -293,7 +310,7 @@ static void processRamReadSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.Value[i] = rpcBuff[msgIdx++];
 			}
 		}
-		mtSysCbs.pfnSysRamReadSrsp(&rsp);
+		SYS_CB_CALL(pfnSysRamReadSrsp, &rsp);
 	}
 }
 
@@ -396,7 +413,7 @@ uint8_t sysResetReq(ResetReqFormat_t *req)
  */
 static void processResetInd(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysResetInd)
+	if (SYS_CB_ANY(pfnSysResetInd))
 	{
 		uint8_t msgIdx = 2;
 		ResetIndFormat_t rsp;
@@ -414,7 +431,7 @@ static void processResetInd(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.MinorRel = rpcBuff[msgIdx++];
 		rsp.HwRev = rpcBuff[msgIdx++];
 
-		mtSysCbs.pfnSysResetInd(&rsp);
+		SYS_CB_CALL(pfnSysResetInd, &rsp);
 	}
 }
 
@@ -456,7 +473,7 @@ uint8_t sysVersion()
  */
 static void processVersionSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysVersionSrsp)
+	if (SYS_CB_ANY(pfnSysVersionSrsp))
 	{
 		uint8_t msgIdx = 2;
 		VersionSrspFormat_t rsp;
@@ -473,7 +490,7 @@ static void processVersionSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.MinorRel = rpcBuff[msgIdx++];
 		rsp.MaintRel = rpcBuff[msgIdx++];
 
-		mtSysCbs.pfnSysVersionSrsp(&rsp);
+		SYS_CB_CALL(pfnSysVersionSrsp, &rsp);
 	}
 }
 
@@ -532,7 +549,7 @@ uint8_t sysOsalNvRead(OsalNvReadFormat_t *req)
  */
 static void processOsalNvReadSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysOsalNvReadSrsp)
+	if (SYS_CB_ANY(pfnSysOsalNvReadSrsp))
 	{
 		uint8_t msgIdx = 2;
 		OsalNvReadSrspFormat_t rsp;
@@ -553,7 +570,7 @@ static void processOsalNvReadSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.Value[i] = rpcBuff[msgIdx++];
 			}
 		}
-		mtSysCbs.pfnSysOsalNvReadSrsp(&rsp);
+		SYS_CB_CALL(pfnSysOsalNvReadSrsp, &rsp);
 	}
 }
 
@@ -752,7 +769,7 @@ uint8_t sysOsalNvLength(OsalNvLengthFormat_t *req)
  */
 static void processOsalNvLengthSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysOsalNvLengthSrsp)
+	if (SYS_CB_ANY(pfnSysOsalNvLengthSrsp))
 	{
 		uint8_t msgIdx = 2;
 		OsalNvLengthSrspFormat_t rsp;
@@ -766,7 +783,7 @@ static void processOsalNvLengthSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.ItemLen = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
 		msgIdx += 2;
 
-		mtSysCbs.pfnSysOsalNvLengthSrsp(&rsp);
+		SYS_CB_CALL(pfnSysOsalNvLengthSrsp, &rsp);
 	}
 }
 
@@ -864,7 +881,7 @@ uint8_t sysOsalStopTimer(OsalStopTimerFormat_t *req)
  */
 static void processOsalTimerExpired(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysOsalTimerExpired)
+	if (SYS_CB_ANY(pfnSysOsalTimerExpired))
 	{
 		uint8_t msgIdx = 2;
 		OsalTimerExpiredFormat_t rsp;
@@ -877,7 +894,7 @@ static void processOsalTimerExpired(uint8_t *rpcBuff, uint8_t rpcLen)
 
 		rsp.Id = rpcBuff[msgIdx++];
 
-		mtSysCbs.pfnSysOsalTimerExpired(&rsp);
+		SYS_CB_CALL(pfnSysOsalTimerExpired, &rsp);
 	}
 }
 
@@ -934,7 +951,7 @@ uint8_t sysStackTune(StackTuneFormat_t *req)
  */
 static void processStackTuneSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysStackTuneSrsp)
+	if (SYS_CB_ANY(pfnSysStackTuneSrsp))
 	{
 		uint8_t msgIdx = 2;
 		StackTuneSrspFormat_t rsp;
@@ -947,7 +964,7 @@ static void processStackTuneSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 
 		rsp.Value = rpcBuff[msgIdx++];
 
-		mtSysCbs.pfnSysStackTuneSrsp(&rsp);
+		SYS_CB_CALL(pfnSysStackTuneSrsp, &rsp);
 	}
 }
 
@@ -1004,7 +1021,7 @@ uint8_t sysAdcRead(AdcReadFormat_t *req)
  */
 static void processAdcReadSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysAdcReadSrsp)
+	if (SYS_CB_ANY(pfnSysAdcReadSrsp))
 	{
 		uint8_t msgIdx = 2;
 		AdcReadSrspFormat_t rsp;
@@ -1018,7 +1035,7 @@ static void processAdcReadSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.Value = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
 		msgIdx += 2;
 
-		mtSysCbs.pfnSysAdcReadSrsp(&rsp);
+		SYS_CB_CALL(pfnSysAdcReadSrsp, &rsp);
 	}
 }
 
@@ -1075,7 +1092,7 @@ uint8_t sysGpio(GpioFormat_t *req)
  */
 static void processGpioSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysGpioSrsp)
+	if (SYS_CB_ANY(pfnSysGpioSrsp))
 	{
 		uint8_t msgIdx = 2;
 		GpioSrspFormat_t rsp;
@@ -1088,7 +1105,7 @@ static void processGpioSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 
 		rsp.Value = rpcBuff[msgIdx++];
 
-		mtSysCbs.pfnSysGpioSrsp(&rsp);
+		SYS_CB_CALL(pfnSysGpioSrsp, &rsp);
 	}
 }
 
@@ -1129,7 +1146,7 @@ uint8_t sysRandom()
  */
 static void processRandomSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysRandomSrsp)
+	if (SYS_CB_ANY(pfnSysRandomSrsp))
 	{
 		uint8_t msgIdx = 2;
 		RandomSrspFormat_t rsp;
@@ -1143,7 +1160,7 @@ static void processRandomSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.Value = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
 		msgIdx += 2;
 
-		mtSysCbs.pfnSysRandomSrsp(&rsp);
+		SYS_CB_CALL(pfnSysRandomSrsp, &rsp);
 	}
 }
 
@@ -1233,7 +1250,7 @@ uint8_t sysGetTime()
  */
 static void processGetTimeSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysGetTimeSrsp)
+	if (SYS_CB_ANY(pfnSysGetTimeSrsp))
 	{
 		uint8_t msgIdx = 2;
 		GetTimeSrspFormat_t rsp;
@@ -1256,7 +1273,7 @@ static void processGetTimeSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.Year = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
 		msgIdx += 2;
 
-		mtSysCbs.pfnSysGetTimeSrsp(&rsp);
+		SYS_CB_CALL(pfnSysGetTimeSrsp, &rsp);
 	}
 }
 
@@ -1312,7 +1329,7 @@ uint8_t sysSetTxPower(SetTxPowerFormat_t *req)
  */
 static void processSetTxPowerSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtSysCbs.pfnSysSetTxPowerSrsp)
+	if (SYS_CB_ANY(pfnSysSetTxPowerSrsp))
 	{
 		uint8_t msgIdx = 2;
 		SetTxPowerSrspFormat_t rsp;
@@ -1325,7 +1342,7 @@ static void processSetTxPowerSrsp(uint8_t *rpcBuff, uint8_t rpcLen)
 
 		rsp.TxPower = rpcBuff[msgIdx++];
 
-		mtSysCbs.pfnSysSetTxPowerSrsp(&rsp);
+		SYS_CB_CALL(pfnSysSetTxPowerSrsp, &rsp);
 	}
 }
 
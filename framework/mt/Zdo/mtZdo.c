@@ -45,6 +45,7 @@
 
 #include "mtZdo.h"
 #include "mtSys.h"
+#include "mtEvent.h"
 #include "mtParser.h"
 #include "rpc.h"
 #include "hostConsole.h"
@@ -55,6 +56,22 @@
  */
 #define STARTDELAY 0
 
+// true if the application or a listener of the event handles the
+// callback, rpcBuff being the frame processed
+#define ZDO_CB_ANY(pfn) \
+	(mtZdoCbs.pfn || mtEventListened(MT_EVENT_FRAME(rpcBuff)))
+
+// calls the listeners, then the application callback
+#define ZDO_CB_CALL(pfn, msg) \
+	do \
+	{ \
+		mtEventDispatch(MT_EVENT_FRAME(rpcBuff), msg); \
+		if (mtZdoCbs.pfn) \
+		{ \
+			mtZdoCbs.pfn(msg); \
+		} \
+	} while (0)
+
 /*********************************************************************
  * LOCAL VARIABLES
  */
@@ -83,9 +100,14 @@ static void processStateChange(uint8_t *rpcBuff, uint8_t rpcLen)
 
 	uint8_t zdoState = rpcBuff[2];
 	//passes the state to the callback function
-	if (mtZdoCbs.pfnmtZdoStateChangeInd)
+	if (ZDO_CB_ANY(pfnmtZdoStateChangeInd))
 	{
-		mtZdoCbs.pfnmtZdoStateChangeInd(zdoState);
+		// the listeners take the message by pointer
+		mtEventDispatch(MT_EVENT_FRAME(rpcBuff), &zdoState);
+		if (mtZdoCbs.pfnmtZdoStateChangeInd)
+		{
+			mtZdoCbs.pfnmtZdoStateChangeInd(zdoState);
+		}
 	}
 }
 
@@ -758,7 +780,7 @@ uint8_t zdoUnbindReq(UnbindReqFormat_t *req)
 	uint8_t cmInd = 0;
 	uint8_t addrmd = (req->DstAddrMode == 3 ? 8 : 2);
 	uint8_t endP = (req->DstAddrMode == 3 ? 1 : 0);
-	uint32_t cmdLen = 16;
+	uint32_t cmdLen = 14 + addrmd + endP;
 	uint8_t *cmd = malloc(cmdLen);
 
 	if (cmd)
@@ -1538,7 +1560,7 @@ uint8_t zdoMsgCbRemove(MsgCbRemoveFormat_t *req)
  */
 static void processGetLinkKey(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoGetLinkKey)
+	if (ZDO_CB_ANY(pfnZdoGetLinkKey))
 	{
 		uint8_t msgIdx = 2;
 		GetLinkKeySrspFormat_t rsp;
@@ -1557,7 +1579,7 @@ static void processGetLinkKey(uint8_t *rpcBuff, uint8_t rpcLen)
 		memcpy(rsp.LinkKeyData, &rpcBuff[msgIdx], 16);
 		msgIdx += 16;
 
-		mtZdoCbs.pfnZdoGetLinkKey(&rsp);
+		ZDO_CB_CALL(pfnZdoGetLinkKey, &rsp);
 	}
 }
 
@@ -1573,7 +1595,7 @@ static void processGetLinkKey(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processNwkAddrRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoNwkAddrRsp)
+	if (ZDO_CB_ANY(pfnZdoNwkAddrRsp))
 	{
 		uint8_t msgIdx = 2;
 		NwkAddrRspFormat_t rsp;
@@ -1603,7 +1625,7 @@ static void processNwkAddrRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				msgIdx += 2;
 			}
 		}
-		mtZdoCbs.pfnZdoNwkAddrRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoNwkAddrRsp, &rsp);
 	}
 }
 
@@ -1619,7 +1641,7 @@ static void processNwkAddrRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processIeeeAddrRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoIeeeAddrRsp)
+	if (ZDO_CB_ANY(pfnZdoIeeeAddrRsp))
 	{
 		uint8_t msgIdx = 2;
 		IeeeAddrRspFormat_t rsp;
@@ -1650,7 +1672,7 @@ static void processIeeeAddrRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				msgIdx += 2;
 			}
 		}
-		mtZdoCbs.pfnZdoIeeeAddrRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoIeeeAddrRsp, &rsp);
 	}
 }
 
@@ -1666,7 +1688,7 @@ static void processIeeeAddrRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processNodeDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoNodeDescRsp)
+	if (ZDO_CB_ANY(pfnZdoNodeDescRsp))
 	{
 		uint8_t msgIdx = 2;
 		NodeDescRspFormat_t rsp;
@@ -1699,7 +1721,7 @@ static void processNodeDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		msgIdx += 2;
 		rsp.DescriptorCapabilities = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoNodeDescRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoNodeDescRsp, &rsp);
 	}
 }
 
@@ -1715,7 +1737,7 @@ static void processNodeDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processPowerDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoPowerDescRsp)
+	if (ZDO_CB_ANY(pfnZdoPowerDescRsp))
 	{
 		uint8_t msgIdx = 2;
 		PowerDescRspFormat_t rsp;
@@ -1734,7 +1756,7 @@ static void processPowerDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.CurrntPwrMode_AvalPwrSrcs = rpcBuff[msgIdx++];
 		rsp.CurrntPwrSrc_CurrntPwrSrcLvl = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoPowerDescRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoPowerDescRsp, &rsp);
 	}
 }
 
@@ -1750,7 +1772,7 @@ static void processPowerDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processSimpleDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoSimpleDescRsp)
+	if (ZDO_CB_ANY(pfnZdoSimpleDescRsp))
 	{
 		uint8_t msgIdx = 2;
 		SimpleDescRspFormat_t rsp;
@@ -1791,7 +1813,7 @@ static void processSimpleDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				msgIdx += 2;
 			}
 		}
-		mtZdoCbs.pfnZdoSimpleDescRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoSimpleDescRsp, &rsp);
 	}
 }
 
@@ -1807,7 +1829,7 @@ static void processSimpleDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processActiveEpRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoActiveEpRsp)
+	if (ZDO_CB_ANY(pfnZdoActiveEpRsp))
 	{
 		uint8_t msgIdx = 2;
 		ActiveEpRspFormat_t rsp;
@@ -1832,7 +1854,7 @@ static void processActiveEpRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.ActiveEPList[i] = rpcBuff[msgIdx++];
 			}
 		}
-		mtZdoCbs.pfnZdoActiveEpRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoActiveEpRsp, &rsp);
 	}
 }
 
@@ -1848,7 +1870,7 @@ static void processActiveEpRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processMatchDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoMatchDescRsp)
+	if (ZDO_CB_ANY(pfnZdoMatchDescRsp))
 	{
 		uint8_t msgIdx = 2;
 		MatchDescRspFormat_t rsp;
@@ -1873,7 +1895,7 @@ static void processMatchDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.MatchList[i] = rpcBuff[msgIdx++];
 			}
 		}
-		mtZdoCbs.pfnZdoMatchDescRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoMatchDescRsp, &rsp);
 	}
 }
 
@@ -1889,7 +1911,7 @@ static void processMatchDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processComplexDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoComplexDescRsp)
+	if (ZDO_CB_ANY(pfnZdoComplexDescRsp))
 	{
 		uint8_t msgIdx = 2;
 		ComplexDescRspFormat_t rsp;
@@ -1914,7 +1936,7 @@ static void processComplexDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.ComplexList[i] = rpcBuff[msgIdx++];
 			}
 		}
-		mtZdoCbs.pfnZdoComplexDescRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoComplexDescRsp, &rsp);
 	}
 }
 
@@ -1930,7 +1952,7 @@ static void processComplexDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processUserDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoUserDescRsp)
+	if (ZDO_CB_ANY(pfnZdoUserDescRsp))
 	{
 		uint8_t msgIdx = 2;
 		UserDescRspFormat_t rsp;
@@ -1955,7 +1977,7 @@ static void processUserDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.CUserDescriptor[i] = rpcBuff[msgIdx++];
 			}
 		}
-		mtZdoCbs.pfnZdoUserDescRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoUserDescRsp, &rsp);
 	}
 }
 
@@ -1971,7 +1993,7 @@ static void processUserDescRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processUserDescConf(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoUserDescConf)
+	if (ZDO_CB_ANY(pfnZdoUserDescConf))
 	{
 		uint8_t msgIdx = 2;
 		UserDescConfFormat_t rsp;
@@ -1988,7 +2010,7 @@ static void processUserDescConf(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.NwkAddr = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
 		msgIdx += 2;
 
-		mtZdoCbs.pfnZdoUserDescConf(&rsp);
+		ZDO_CB_CALL(pfnZdoUserDescConf, &rsp);
 	}
 }
 
@@ -2004,7 +2026,7 @@ static void processUserDescConf(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processServerDiscRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoServerDiscRsp)
+	if (ZDO_CB_ANY(pfnZdoServerDiscRsp))
 	{
 		uint8_t msgIdx = 2;
 		ServerDiscRspFormat_t rsp;
@@ -2021,7 +2043,7 @@ static void processServerDiscRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.ServerMask = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
 		msgIdx += 2;
 
-		mtZdoCbs.pfnZdoServerDiscRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoServerDiscRsp, &rsp);
 	}
 }
 
@@ -2037,7 +2059,7 @@ static void processServerDiscRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processEndDeviceBindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoEndDeviceBindRsp)
+	if (ZDO_CB_ANY(pfnZdoEndDeviceBindRsp))
 	{
 		uint8_t msgIdx = 2;
 		EndDeviceBindRspFormat_t rsp;
@@ -2052,7 +2074,7 @@ static void processEndDeviceBindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		msgIdx += 2;
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoEndDeviceBindRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoEndDeviceBindRsp, &rsp);
 	}
 }
 
@@ -2068,7 +2090,7 @@ static void processEndDeviceBindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processBindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoBindRsp)
+	if (ZDO_CB_ANY(pfnZdoBindRsp))
 	{
 		uint8_t msgIdx = 2;
 		BindRspFormat_t rsp;
@@ -2083,7 +2105,7 @@ static void processBindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		msgIdx += 2;
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoBindRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoBindRsp, &rsp);
 	}
 }
 
@@ -2099,7 +2121,7 @@ static void processBindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processUnbindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoUnbindRsp)
+	if (ZDO_CB_ANY(pfnZdoUnbindRsp))
 	{
 		uint8_t msgIdx = 2;
 		UnbindRspFormat_t rsp;
@@ -2114,7 +2136,7 @@ static void processUnbindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		msgIdx += 2;
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoUnbindRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoUnbindRsp, &rsp);
 	}
 }
 
@@ -2130,7 +2152,7 @@ static void processUnbindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processMgmtNwkDiscRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoMgmtNwkDiscRsp)
+	if (ZDO_CB_ANY(pfnZdoMgmtNwkDiscRsp))
 	{
 		uint8_t msgIdx = 2;
 		MgmtNwkDiscRspFormat_t rsp;
@@ -2163,7 +2185,7 @@ static void processMgmtNwkDiscRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.NetworkList[i].PermitJoin = rpcBuff[msgIdx++];
 			}
 		}
-		mtZdoCbs.pfnZdoMgmtNwkDiscRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoMgmtNwkDiscRsp, &rsp);
 	}
 }
 
@@ -2179,7 +2201,7 @@ static void processMgmtNwkDiscRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processMgmtLqiRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoMgmtLqiRsp)
+	if (ZDO_CB_ANY(pfnZdoMgmtLqiRsp))
 	{
 		uint8_t msgIdx = 2;
 		MgmtLqiRspFormat_t rsp;
@@ -2223,7 +2245,7 @@ static void processMgmtLqiRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 			}
 		}
 		MgmtLqiRspFormat_t *copyy = &rsp;
-		mtZdoCbs.pfnZdoMgmtLqiRsp(copyy);
+		ZDO_CB_CALL(pfnZdoMgmtLqiRsp, copyy);
 	}
 }
 
@@ -2239,7 +2261,7 @@ static void processMgmtLqiRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processMgmtRtgRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoMgmtRtgRsp)
+	if (ZDO_CB_ANY(pfnZdoMgmtRtgRsp))
 	{
 		uint8_t msgIdx = 2;
 		MgmtRtgRspFormat_t rsp;
@@ -2270,7 +2292,7 @@ static void processMgmtRtgRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				msgIdx += 2;
 			}
 		}
-		mtZdoCbs.pfnZdoMgmtRtgRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoMgmtRtgRsp, &rsp);
 	}
 }
 
@@ -2286,7 +2308,7 @@ static void processMgmtRtgRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processMgmtBindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoMgmtBindRsp)
+	if (ZDO_CB_ANY(pfnZdoMgmtBindRsp))
 	{
 		uint8_t msgIdx = 2;
 		MgmtBindRspFormat_t rsp;
@@ -2323,7 +2345,7 @@ static void processMgmtBindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 				rsp.BindingTableList[i].DstEndpoint = rpcBuff[msgIdx++];
 			}
 		}
-		mtZdoCbs.pfnZdoMgmtBindRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoMgmtBindRsp, &rsp);
 	}
 }
 
@@ -2339,7 +2361,7 @@ static void processMgmtBindRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processMgmtLeaveRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoMgmtLeaveRsp)
+	if (ZDO_CB_ANY(pfnZdoMgmtLeaveRsp))
 	{
 		uint8_t msgIdx = 2;
 		MgmtLeaveRspFormat_t rsp;
@@ -2354,7 +2376,7 @@ static void processMgmtLeaveRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		msgIdx += 2;
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoMgmtLeaveRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoMgmtLeaveRsp, &rsp);
 	}
 }
 
@@ -2370,7 +2392,7 @@ static void processMgmtLeaveRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processMgmtDirectJoinRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoMgmtDirectJoinRsp)
+	if (ZDO_CB_ANY(pfnZdoMgmtDirectJoinRsp))
 	{
 		uint8_t msgIdx = 2;
 		MgmtDirectJoinRspFormat_t rsp;
@@ -2385,7 +2407,7 @@ static void processMgmtDirectJoinRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		msgIdx += 2;
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoMgmtDirectJoinRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoMgmtDirectJoinRsp, &rsp);
 	}
 }
 
@@ -2401,7 +2423,7 @@ static void processMgmtDirectJoinRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processMgmtPermitJoinRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoMgmtPermitJoinRsp)
+	if (ZDO_CB_ANY(pfnZdoMgmtPermitJoinRsp))
 	{
 		uint8_t msgIdx = 2;
 		MgmtPermitJoinRspFormat_t rsp;
@@ -2416,7 +2438,7 @@ static void processMgmtPermitJoinRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		msgIdx += 2;
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoMgmtPermitJoinRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoMgmtPermitJoinRsp, &rsp);
 	}
 }
 
@@ -2432,7 +2454,7 @@ static void processMgmtPermitJoinRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processEndDeviceAnnceInd(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoEndDeviceAnnceInd)
+	if (ZDO_CB_ANY(pfnZdoEndDeviceAnnceInd))
 	{
 		uint8_t msgIdx = 2;
 		EndDeviceAnnceIndFormat_t rsp;
@@ -2453,7 +2475,7 @@ static void processEndDeviceAnnceInd(uint8_t *rpcBuff, uint8_t rpcLen)
 			rsp.IEEEAddr |= ((uint64_t) rpcBuff[msgIdx++]) << (i * 8);
 		rsp.Capabilities = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoEndDeviceAnnceInd(&rsp);
+		ZDO_CB_CALL(pfnZdoEndDeviceAnnceInd, &rsp);
 	}
 }
 
@@ -2469,7 +2491,7 @@ static void processEndDeviceAnnceInd(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processMatchDescRspSent(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoMatchDescRspSent)
+	if (ZDO_CB_ANY(pfnZdoMatchDescRspSent))
 	{
 		uint8_t msgIdx = 2;
 		MatchDescRspSentFormat_t rsp;
@@ -2498,7 +2520,7 @@ static void processMatchDescRspSent(uint8_t *rpcBuff, uint8_t rpcLen)
 			msgIdx += 2;
 		}
 
-		mtZdoCbs.pfnZdoMatchDescRspSent(&rsp);
+		ZDO_CB_CALL(pfnZdoMatchDescRspSent, &rsp);
 	}
 }
 
@@ -2514,7 +2536,7 @@ static void processMatchDescRspSent(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processStatusErrorRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoStatusErrorRsp)
+	if (ZDO_CB_ANY(pfnZdoStatusErrorRsp))
 	{
 		uint8_t msgIdx = 2;
 		StatusErrorRspFormat_t rsp;
@@ -2529,7 +2551,7 @@ static void processStatusErrorRsp(uint8_t *rpcBuff, uint8_t rpcLen)
 		msgIdx += 2;
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoStatusErrorRsp(&rsp);
+		ZDO_CB_CALL(pfnZdoStatusErrorRsp, &rsp);
 	}
 }
 
@@ -2545,7 +2567,7 @@ static void processStatusErrorRsp(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processSrcRtgInd(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoSrcRtgInd)
+	if (ZDO_CB_ANY(pfnZdoSrcRtgInd))
 	{
 		uint8_t msgIdx = 2;
 		SrcRtgIndFormat_t rsp;
@@ -2567,7 +2589,7 @@ static void processSrcRtgInd(uint8_t *rpcBuff, uint8_t rpcLen)
 			msgIdx += 2;
 		}
 
-		mtZdoCbs.pfnZdoSrcRtgInd(&rsp);
+		ZDO_CB_CALL(pfnZdoSrcRtgInd, &rsp);
 	}
 }
 /*********************************************************************
@@ -2582,7 +2604,7 @@ static void processSrcRtgInd(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processBeaconNotifyInd(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoBeaconNotifyInd)
+	if (ZDO_CB_ANY(pfnZdoBeaconNotifyInd))
 	{
 		uint8_t msgIdx = 2;
 		BeaconNotifyIndFormat_t rsp;
@@ -2622,7 +2644,7 @@ static void processBeaconNotifyInd(uint8_t *rpcBuff, uint8_t rpcLen)
 
 			}
 		}
-		mtZdoCbs.pfnZdoBeaconNotifyInd(&rsp);
+		ZDO_CB_CALL(pfnZdoBeaconNotifyInd, &rsp);
 	}
 }
 
@@ -2638,7 +2660,7 @@ static void processBeaconNotifyInd(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processJoinCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoJoinCnf)
+	if (ZDO_CB_ANY(pfnZdoJoinCnf))
 	{
 		uint8_t msgIdx = 2;
 		JoinCnfFormat_t rsp;
@@ -2654,7 +2676,7 @@ static void processJoinCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.ParentAddr = BUILD_UINT16(rpcBuff[msgIdx], rpcBuff[msgIdx + 1]);
 		msgIdx += 2;
 
-		mtZdoCbs.pfnZdoJoinCnf(&rsp);
+		ZDO_CB_CALL(pfnZdoJoinCnf, &rsp);
 	}
 }
 
@@ -2670,7 +2692,7 @@ static void processJoinCnf(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processNwkDiscoveryCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoNwkDiscoveryCnf)
+	if (ZDO_CB_ANY(pfnZdoNwkDiscoveryCnf))
 	{
 		uint8_t msgIdx = 2;
 		NwkDiscoveryCnfFormat_t rsp;
@@ -2682,7 +2704,7 @@ static void processNwkDiscoveryCnf(uint8_t *rpcBuff, uint8_t rpcLen)
 
 		rsp.Status = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoNwkDiscoveryCnf(&rsp);
+		ZDO_CB_CALL(pfnZdoNwkDiscoveryCnf, &rsp);
 	}
 }
 /*********************************************************************
@@ -2697,7 +2719,7 @@ static void processNwkDiscoveryCnf(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processLeaveInd(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoLeaveInd)
+	if (ZDO_CB_ANY(pfnZdoLeaveInd))
 	{
 		uint8_t msgIdx = 2;
 		LeaveIndFormat_t rsp;
@@ -2721,7 +2743,7 @@ static void processLeaveInd(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.Remove = rpcBuff[msgIdx++];
 		rsp.Rejoin = rpcBuff[msgIdx++];
 
-		mtZdoCbs.pfnZdoLeaveInd(&rsp);
+		ZDO_CB_CALL(pfnZdoLeaveInd, &rsp);
 	}
 }
 
@@ -2737,7 +2759,7 @@ static void processLeaveInd(uint8_t *rpcBuff, uint8_t rpcLen)
  */
 static void processMsgCbIncoming(uint8_t *rpcBuff, uint8_t rpcLen)
 {
-	if (mtZdoCbs.pfnZdoMsgCbIncoming)
+	if (ZDO_CB_ANY(pfnZdoMsgCbIncoming))
 	{
 		uint8_t msgIdx = 2;
 		MsgCbIncomingFormat_t rsp;
@@ -2769,7 +2791,7 @@ static void processMsgCbIncoming(uint8_t *rpcBuff, uint8_t rpcLen)
 		rsp.NotUsed = rpcBuff[msgIdx];
 		
 		
-		mtZdoCbs.pfnZdoMsgCbIncoming(&rsp);
+		ZDO_CB_CALL(pfnZdoMsgCbIncoming, &rsp);
 	}
 }
 
@@ -0,0 +1,411 @@
+/*
+ * mtEvent.c
+ *
+ * This module contains the MT event bus, see mtEvent.h.
+ *
+ * A dispatch marks itself reading by incrementing the counter of the
+ * current phase in the slot of its thread, then loads the list. An
+ * update publishes the new list, moves the phase on and waits until the
+ * counters of the previous phase in every slot are back to 0: a
+ * dispatch that could have loaded the old list has ended then, and the
+ * list is freed. A dispatch checks the phase again after its increment
+ * and retries if it moved, so it never counts on a phase already waited
+ * for. Threads share the slots, MT_EVENT_READER_SLOTS of them, only to
+ * bound the memory; the counters work the same shared.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "mtEvent.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define MT_EVENT_READER_SLOTS      (64)
+
+// yields of an update waiting for the dispatches before it sleeps
+#define MT_EVENT_SPINS             (64)
+#define MT_EVENT_NAP_NS            (100000)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	mtEventCb_t Cb;
+	void *Arg;
+	int32_t Priority;
+} eventListener_t;
+
+typedef struct eventList
+{
+	struct eventList *Retired; // next list waiting to be freed
+	uint32_t Count;
+	eventListener_t Listeners[];
+} eventList_t;
+
+// dispatches reading in each phase, alone on its cache line
+typedef struct
+{
+	volatile uint32_t Readers[2];
+	uint8_t Pad[56];
+} eventReaderSlot_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static eventList_t *eventLists[MT_RPC_SYS_MAX][256];
+
+static eventReaderSlot_t eventReaders[MT_EVENT_READER_SLOTS]
+        __attribute__((aligned(64)));
+static volatile uint32_t eventPhase;
+static uint32_t eventNextSlot;
+
+// serializes the updates, and the waits, one wait per phase
+static pthread_mutex_t eventLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t eventWaitLock = PTHREAD_MUTEX_INITIALIZER;
+
+// lists replaced by a listener, freed after the next wait
+static eventList_t *eventRetired;
+
+static __thread int32_t readSlot = -1;
+static __thread uint32_t readDepth;
+static __thread uint32_t readPhase;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static void readEnter(void)
+{
+	eventReaderSlot_t *slot;
+	uint32_t phase;
+
+	// a listener may dispatch again, only the outer dispatch counts
+	if (readDepth++ > 0)
+	{
+		return;
+	}
+	if (readSlot < 0)
+	{
+		readSlot = __atomic_fetch_add(&eventNextSlot, 1, __ATOMIC_RELAXED)
+		        % MT_EVENT_READER_SLOTS;
+	}
+	slot = &eventReaders[readSlot];
+
+	while (1)
+	{
+		phase = __atomic_load_n(&eventPhase, __ATOMIC_RELAXED) & 1;
+		__atomic_add_fetch(&slot->Readers[phase], 1, __ATOMIC_SEQ_CST);
+		if ((__atomic_load_n(&eventPhase, __ATOMIC_SEQ_CST) & 1) == phase)
+		{
+			break;
+		}
+		__atomic_sub_fetch(&slot->Readers[phase], 1, __ATOMIC_RELEASE);
+	}
+	readPhase = phase;
+}
+
+static void readExit(void)
+{
+	if (--readDepth > 0)
+	{
+		return;
+	}
+	__atomic_sub_fetch(&eventReaders[readSlot].Readers[readPhase], 1,
+	        __ATOMIC_RELEASE);
+}
+
+/*********************************************************************
+ * @fn      eventWait
+ *
+ * @brief   waits until the dispatches started before have ended. Called
+ *          with eventWaitLock held, the previous phase already drained.
+ */
+static void eventWait(void)
+{
+	struct timespec nap = { 0, MT_EVENT_NAP_NS };
+	uint32_t phase, slot, spins = 0;
+
+	phase = __atomic_fetch_add(&eventPhase, 1, __ATOMIC_SEQ_CST) & 1;
+	for (slot = 0; slot < MT_EVENT_READER_SLOTS; slot++)
+	{
+		while (__atomic_load_n(&eventReaders[slot].Readers[phase],
+		        __ATOMIC_SEQ_CST) != 0)
+		{
+			if (spins++ < MT_EVENT_SPINS)
+			{
+				sched_yield();
+			}
+			else
+			{
+				nanosleep(&nap, NULL);
+			}
+		}
+	}
+}
+
+/*********************************************************************
+ * @fn      eventPublish
+ *
+ * @brief   replaces the list of an event and retires the old one. Called
+ *          with eventLock held.
+ *
+ * @return  the retired lists to free by eventReclaim(), NULL in a
+ *          listener: the wait would never end, its own dispatch reading,
+ *          so they are freed by a later update instead
+ */
+static eventList_t* eventPublish(eventList_t **slot, eventList_t *old,
+        eventList_t *list)
+{
+	eventList_t *retired;
+
+	__atomic_store_n(slot, list, __ATOMIC_RELEASE);
+	if (old != NULL)
+	{
+		old->Retired = eventRetired;
+		eventRetired = old;
+	}
+	if (readDepth > 0)
+	{
+		return NULL;
+	}
+
+	retired = eventRetired;
+	eventRetired = NULL;
+	return retired;
+}
+
+/*********************************************************************
+ * @fn      eventReclaim
+ *
+ * @brief   frees retired lists once no dispatch reads them. Called
+ *          without eventLock, which the listeners being waited for may
+ *          need.
+ */
+static void eventReclaim(eventList_t *retired)
+{
+	eventList_t *next;
+
+	if (retired == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&eventWaitLock);
+	eventWait();
+	pthread_mutex_unlock(&eventWaitLock);
+
+	while (retired != NULL)
+	{
+		next = retired->Retired;
+		free(retired);
+		retired = next;
+	}
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      mtEventAddListener
+ *
+ * @brief   adds a listener to an event
+ *
+ * @param   event - MT_EVENT() of the callback
+ * @param   cb - listener
+ * @param   arg - context passed to the listener
+ * @param   priority - listeners of lower priority run first
+ *
+ * @return  0 on success, -1 on an invalid event, a listener already
+ *          added with this argument or out of memory
+ */
+int32_t mtEventAddListener(uint16_t event, mtEventCb_t cb, void *arg,
+        int32_t priority)
+{
+	uint8_t sys = MT_EVENT_SYS(event), cmd1 = MT_EVENT_CMD1(event);
+	eventList_t *old, *list, *retired;
+	uint32_t count, pos, i;
+
+	if ((sys >= MT_RPC_SYS_MAX) || (cb == NULL))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&eventLock);
+	old = eventLists[sys][cmd1];
+	count = (old != NULL) ? old->Count : 0;
+	for (i = 0; i < count; i++)
+	{
+		if ((old->Listeners[i].Cb == cb) && (old->Listeners[i].Arg == arg))
+		{
+			pthread_mutex_unlock(&eventLock);
+			return -1;
+		}
+	}
+
+	list = malloc(sizeof(eventList_t) + ((count + 1)
+	        * sizeof(eventListener_t)));
+	if (list == NULL)
+	{
+		pthread_mutex_unlock(&eventLock);
+		dbg_print(PRINT_LEVEL_WARNING, "mtEventAddListener: no memory\n");
+		return -1;
+	}
+
+	// after the listeners of the same priority
+	for (pos = 0; (pos < count) && (old->Listeners[pos].Priority <= priority);
+	        pos++)
+		;
+	if (pos > 0)
+	{
+		memcpy(&list->Listeners[0], &old->Listeners[0],
+		        pos * sizeof(eventListener_t));
+	}
+	if (pos < count)
+	{
+		memcpy(&list->Listeners[pos + 1], &old->Listeners[pos],
+		        (count - pos) * sizeof(eventListener_t));
+	}
+	list->Listeners[pos].Cb = cb;
+	list->Listeners[pos].Arg = arg;
+	list->Listeners[pos].Priority = priority;
+	list->Count = count + 1;
+
+	retired = eventPublish(&eventLists[sys][cmd1], old, list);
+	pthread_mutex_unlock(&eventLock);
+	eventReclaim(retired);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      mtEventRemoveListener
+ *
+ * @brief   removes a listener from an event. Once it returns the
+ *          listener is not running on another thread and is not called
+ *          again; removed by a listener, the dispatches of other threads
+ *          may still be running it.
+ *
+ * @param   event - MT_EVENT() of the callback
+ * @param   cb - listener
+ * @param   arg - context it was added with
+ *
+ * @return  0 on success, -1 if not found or out of memory
+ */
+int32_t mtEventRemoveListener(uint16_t event, mtEventCb_t cb, void *arg)
+{
+	uint8_t sys = MT_EVENT_SYS(event), cmd1 = MT_EVENT_CMD1(event);
+	eventList_t *old, *list = NULL, *retired;
+	uint32_t pos;
+
+	if (sys >= MT_RPC_SYS_MAX)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&eventLock);
+	old = eventLists[sys][cmd1];
+	for (pos = 0; (old != NULL) && (pos < old->Count); pos++)
+	{
+		if ((old->Listeners[pos].Cb == cb) && (old->Listeners[pos].Arg == arg))
+		{
+			break;
+		}
+	}
+	if ((old == NULL) || (pos == old->Count))
+	{
+		pthread_mutex_unlock(&eventLock);
+		return -1;
+	}
+
+	if (old->Count > 1)
+	{
+		list = malloc(sizeof(eventList_t) + ((old->Count - 1)
+		        * sizeof(eventListener_t)));
+		if (list == NULL)
+		{
+			pthread_mutex_unlock(&eventLock);
+			dbg_print(PRINT_LEVEL_WARNING,
+			        "mtEventRemoveListener: no memory\n");
+			return -1;
+		}
+		memcpy(&list->Listeners[0], &old->Listeners[0],
+		        pos * sizeof(eventListener_t));
+		memcpy(&list->Listeners[pos], &old->Listeners[pos + 1],
+		        (old->Count - pos - 1) * sizeof(eventListener_t));
+		list->Count = old->Count - 1;
+	}
+
+	retired = eventPublish(&eventLists[sys][cmd1], old, list);
+	pthread_mutex_unlock(&eventLock);
+	eventReclaim(retired);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      mtEventListened
+ *
+ * @brief   tells whether an event has listeners, for the subsystems to
+ *          skip decoding messages nobody wants
+ *
+ * @param   event - MT_EVENT() of the callback
+ *
+ * @return  1 if the event has listeners, else 0
+ */
+uint8_t mtEventListened(uint16_t event)
+{
+	uint8_t sys = MT_EVENT_SYS(event);
+
+	return (sys < MT_RPC_SYS_MAX)
+	        && (__atomic_load_n(&eventLists[sys][MT_EVENT_CMD1(event)],
+	                __ATOMIC_RELAXED) != NULL);
+}
+
+/*********************************************************************
+ * @fn      mtEventDispatch
+ *
+ * @brief   calls the listeners of an event, in priority order
+ *
+ * @param   event - MT_EVENT() of the callback
+ * @param   msg - decoded message
+ *
+ * @return  none
+ */
+void mtEventDispatch(uint16_t event, void *msg)
+{
+	eventList_t *list;
+	uint32_t i;
+
+	if (!mtEventListened(event))
+	{
+		return;
+	}
+
+	readEnter();
+	list = __atomic_load_n(
+	        &eventLists[MT_EVENT_SYS(event)][MT_EVENT_CMD1(event)],
+	        __ATOMIC_ACQUIRE);
+	for (i = 0; (list != NULL) && (i < list->Count); i++)
+	{
+		list->Listeners[i].Cb(event, msg, list->Listeners[i].Arg);
+	}
+	readExit();
+}
@@ -0,0 +1,85 @@
+/*
+ * mtEvent.h
+ *
+ * This module contains the MT event bus, on which any number of modules
+ * listen to the MT callbacks they need, each on its own, instead of
+ * sharing the one callback table of a subsystem.
+ *
+ * An event is an MT command, MT_EVENT(subsystem, Cmd1), and its message
+ * the structure the subsystem decodes for its callback. A listener is a
+ * function with a context argument and a priority; the listeners of an
+ * event run in increasing priority, those of the same priority in the
+ * order they were added, all before the callback registered with the
+ * *RegisterCallbacks() function of the subsystem. The framework modules
+ * follow the MT messages as listeners and leave the callback tables to
+ * the application.
+ *
+ * Each event has an immutable list of its listeners. Adding or removing
+ * a listener copies the list, publishes the copy and frees the old one
+ * once no dispatch can still read it, RCU style, so the dispatch takes
+ * no lock: it only marks itself reading on a counter of its thread. A
+ * listener may add or remove listeners, itself included.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef MTEVENT_H
+#define MTEVENT_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+#include "rpc.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define MT_EVENT(sys, cmd1)        ((uint16_t) (((sys) << 8) | (cmd1)))
+
+// event of a frame from the Cmd0 byte
+#define MT_EVENT_FRAME(rpcFrame) \
+	MT_EVENT((rpcFrame)[0] & MT_RPC_SUBSYSTEM_MASK, (rpcFrame)[1])
+
+#define MT_EVENT_SYS(event)        ((event) >> 8)
+#define MT_EVENT_CMD1(event)       ((event) & 0xFF)
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// priority of the listeners without a preference
+#define MT_EVENT_PRIO_DEFAULT      (0)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// listener, msg is the decoded message of the event, for
+// MT_ZDO_STATE_CHANGE_IND a pointer to the state
+typedef void (*mtEventCb_t)(uint16_t event, void *msg, void *arg);
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t mtEventAddListener(uint16_t event, mtEventCb_t cb, void *arg,
+        int32_t priority);
+int32_t mtEventRemoveListener(uint16_t event, mtEventCb_t cb, void *arg);
+uint8_t mtEventListened(uint16_t event);
+void mtEventDispatch(uint16_t event, void *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MTEVENT_H */
@@ -0,0 +1,647 @@
+/*
+ * mtEventPool.c
+ *
+ * This module contains the worker pool of the MT event bus, see
+ * mtEventPool.h.
+ *
+ * A shard is a ring of jobs, each the pool listener, the event and a
+ * copy of the message. The dispatch appends at Head + Count, the worker
+ * that set Busy runs the job at Head in place and frees its slot after,
+ * so only the indices move under the lock of the shard. A worker with
+ * nothing to run waits for Work to change; the dispatch changes it and
+ * wakes a worker only when one is idle.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mtEventPool.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define JOB(shard, idx, ctx) \
+	((poolJob_t *) ((shard)->Jobs + ((size_t) (idx) * (ctx)->JobBytes)))
+
+#define POOL_NO_SHARD              (0xFFFFFFFF)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	mtEventPoolListener_t *Listener;
+	uint16_t Event;
+	uint64_t Msg[];            // aligned for the 64 bit fields
+} poolJob_t;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static uint32_t shardOf(mtEventPool_t *ctx, uint16_t key)
+{
+	uint32_t h = (uint32_t) key * 0x9E3779B1;
+
+	// the high bits mix every bit of the key
+	return (ctx->ShardBits == 0) ? 0 : (h >> (32 - ctx->ShardBits));
+}
+
+static void poolWake(mtEventPool_t *ctx)
+{
+	__atomic_add_fetch(&ctx->Work, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ctx->Idle, __ATOMIC_SEQ_CST) > 0)
+	{
+		pthread_mutex_lock(&ctx->IdleLock);
+		pthread_cond_signal(&ctx->WorkCond);
+		pthread_mutex_unlock(&ctx->IdleLock);
+	}
+}
+
+/*********************************************************************
+ * @fn      poolDispatch
+ *
+ * @brief   listener of the bus for a pool listener, queues the event on
+ *          the shard of its key
+ */
+static void poolDispatch(uint16_t event, void *msg, void *arg)
+{
+	mtEventPoolListener_t *l = arg;
+	mtEventPool_t *ctx = l->Pool;
+	mtEventShard_t *s;
+	poolJob_t *job;
+	uint16_t key = 0xFFFF;
+	uint64_t start;
+	uint8_t busy;
+
+	if (l->KeyOffset != MT_EVENT_POOL_NO_KEY)
+	{
+		memcpy(&key, (uint8_t *) msg + l->KeyOffset, sizeof(key));
+	}
+	s = &ctx->Shards[shardOf(ctx, key)];
+
+	pthread_mutex_lock(&s->Lock);
+	while (s->Count == ctx->Cfg.Depth)
+	{
+		if (ctx->Cfg.Drop || !ctx->Running)
+		{
+			s->Stats.Drops++;
+			pthread_mutex_unlock(&s->Lock);
+			return;
+		}
+
+		// backpressure, the MT dispatch waits for the workers
+		s->Stats.Stalls++;
+		start = nowUs();
+		pthread_cond_wait(&s->SpaceCond, &s->Lock);
+		s->Stats.StallUs += nowUs() - start;
+	}
+
+	job = JOB(s, (s->Head + s->Count) % ctx->Cfg.Depth, ctx);
+	job->Listener = l;
+	job->Event = event;
+	memcpy(job->Msg, msg, l->MsgLen);
+	__atomic_store_n(&s->Count, s->Count + 1, __ATOMIC_RELAXED);
+	s->Stats.Queued++;
+	if (s->Count > s->Stats.PeakDepth)
+	{
+		s->Stats.PeakDepth = s->Count;
+	}
+	busy = s->Busy;
+	pthread_mutex_unlock(&s->Lock);
+
+	// a running shard is emptied by its worker
+	if (!busy)
+	{
+		poolWake(ctx);
+	}
+}
+
+static uint8_t shardClaim(mtEventShard_t *s, uint8_t steal)
+{
+	uint8_t claimed = 0;
+
+	pthread_mutex_lock(&s->Lock);
+	if ((s->Count > 0) && !s->Busy)
+	{
+		__atomic_store_n(&s->Busy, 1, __ATOMIC_RELAXED);
+		s->Stats.Steals += steal;
+		claimed = 1;
+	}
+	pthread_mutex_unlock(&s->Lock);
+
+	return claimed;
+}
+
+/*********************************************************************
+ * @fn      poolClaim
+ *
+ * @brief   claims a shard to run for a worker: a home shard waiting,
+ *          from the one after the last run, else the deepest shard
+ *          waiting that no worker runs
+ *
+ * @return  shard, POOL_NO_SHARD if none waits
+ */
+static uint32_t poolClaim(mtEventPool_t *ctx, mtEventPoolWorker_t *w)
+{
+	uint32_t homes = (ctx->Cfg.Shards - w->Index + ctx->Cfg.Workers - 1)
+	        / ctx->Cfg.Workers;
+	uint32_t i, idx, best = POOL_NO_SHARD, bestCount = 0, count;
+	mtEventShard_t *s;
+
+	for (i = 0; i < homes; i++)
+	{
+		idx = w->Index + (((w->Cursor + i) % homes) * ctx->Cfg.Workers);
+		s = &ctx->Shards[idx];
+		if ((__atomic_load_n(&s->Count, __ATOMIC_RELAXED) > 0)
+		        && !__atomic_load_n(&s->Busy, __ATOMIC_RELAXED)
+		        && shardClaim(s, 0))
+		{
+			w->Cursor = (w->Cursor + i + 1) % homes;
+			return idx;
+		}
+	}
+
+	for (idx = 0; idx < ctx->Cfg.Shards; idx++)
+	{
+		s = &ctx->Shards[idx];
+		count = __atomic_load_n(&s->Count, __ATOMIC_RELAXED);
+		if ((count > bestCount)
+		        && !__atomic_load_n(&s->Busy, __ATOMIC_RELAXED))
+		{
+			best = idx;
+			bestCount = count;
+		}
+	}
+	if ((best != POOL_NO_SHARD) && shardClaim(&ctx->Shards[best], 1))
+	{
+		return best;
+	}
+
+	return POOL_NO_SHARD;
+}
+
+/*********************************************************************
+ * @fn      poolRun
+ *
+ * @brief   runs up to Batch events of a claimed shard, in order
+ */
+static void poolRun(mtEventPool_t *ctx, mtEventPoolWorker_t *w,
+        mtEventShard_t *s)
+{
+	poolJob_t *job;
+	uint32_t n;
+	uint8_t empty;
+
+	for (n = 0; n < ctx->Cfg.Batch; n++)
+	{
+		pthread_mutex_lock(&s->Lock);
+		if (s->Count == 0)
+		{
+			pthread_mutex_unlock(&s->Lock);
+			break;
+		}
+		job = JOB(s, s->Head, ctx);
+		pthread_mutex_unlock(&s->Lock);
+
+		job->Listener->Cb(job->Event, job->Msg, job->Listener->Arg);
+
+		pthread_mutex_lock(&s->Lock);
+		s->Head = (s->Head + 1) % ctx->Cfg.Depth;
+		__atomic_store_n(&s->Count, s->Count - 1, __ATOMIC_RELAXED);
+		s->Stats.Ran++;
+		pthread_cond_signal(&s->SpaceCond);
+		pthread_mutex_unlock(&s->Lock);
+		__atomic_add_fetch(&w->Ran, 1, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_lock(&s->Lock);
+	__atomic_store_n(&s->Busy, 0, __ATOMIC_RELAXED);
+	empty = (s->Count == 0);
+	pthread_mutex_unlock(&s->Lock);
+
+	if (empty)
+	{
+		pthread_mutex_lock(&ctx->IdleLock);
+		pthread_cond_broadcast(&ctx->DoneCond);
+		pthread_mutex_unlock(&ctx->IdleLock);
+	}
+}
+
+static void *poolThread(void *arg)
+{
+	mtEventPoolWorker_t *w = arg;
+	mtEventPool_t *ctx = w->Pool;
+	uint32_t seen, idx;
+
+	while (1)
+	{
+		// read before looking, a job queued after changes it
+		seen = __atomic_load_n(&ctx->Work, __ATOMIC_SEQ_CST);
+		idx = poolClaim(ctx, w);
+		if (idx != POOL_NO_SHARD)
+		{
+			poolRun(ctx, w, &ctx->Shards[idx]);
+			continue;
+		}
+
+		pthread_mutex_lock(&ctx->IdleLock);
+		if (!ctx->Running)
+		{
+			pthread_mutex_unlock(&ctx->IdleLock);
+			break;
+		}
+		__atomic_add_fetch(&ctx->Idle, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ctx->Work, __ATOMIC_SEQ_CST) == seen)
+		{
+			pthread_cond_wait(&ctx->WorkCond, &ctx->IdleLock);
+		}
+		__atomic_sub_fetch(&ctx->Idle, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&ctx->IdleLock);
+	}
+
+	return NULL;
+}
+
+// true when no shard has events queued or running, with IdleLock held
+static uint8_t poolDone(mtEventPool_t *ctx)
+{
+	mtEventShard_t *s;
+	uint32_t idx;
+	uint8_t done = 1;
+
+	for (idx = 0; done && (idx < ctx->Cfg.Shards); idx++)
+	{
+		s = &ctx->Shards[idx];
+		pthread_mutex_lock(&s->Lock);
+		done = (s->Count == 0) && !s->Busy;
+		pthread_mutex_unlock(&s->Lock);
+	}
+
+	return done;
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      mtEventPoolInit
+ *
+ * @brief   starts the workers of a pool
+ *
+ * @param   ctx - pool
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 on failure
+ */
+int32_t mtEventPoolInit(mtEventPool_t *ctx, mtEventPoolCfg_t *cfg)
+{
+	uint32_t i;
+
+	memset(ctx, 0, sizeof(mtEventPool_t));
+	ctx->Cfg = *cfg;
+	if (ctx->Cfg.Workers == 0)
+	{
+		ctx->Cfg.Workers = MT_EVENT_POOL_WORKERS;
+	}
+	if (ctx->Cfg.Shards == 0)
+	{
+		ctx->Cfg.Shards = MT_EVENT_POOL_SHARDS;
+	}
+	while ((1UL << ctx->ShardBits) < ctx->Cfg.Shards)
+	{
+		ctx->ShardBits++;
+	}
+	ctx->Cfg.Shards = 1UL << ctx->ShardBits;
+	if (ctx->Cfg.Workers > ctx->Cfg.Shards)
+	{
+		ctx->Cfg.Workers = ctx->Cfg.Shards;
+	}
+	if (ctx->Cfg.Depth == 0)
+	{
+		ctx->Cfg.Depth = MT_EVENT_POOL_DEPTH;
+	}
+	if (ctx->Cfg.MsgBytes == 0)
+	{
+		ctx->Cfg.MsgBytes = MT_EVENT_POOL_MSG_BYTES;
+	}
+	if (ctx->Cfg.Batch == 0)
+	{
+		ctx->Cfg.Batch = MT_EVENT_POOL_BATCH;
+	}
+	ctx->JobBytes = sizeof(poolJob_t) + ((ctx->Cfg.MsgBytes + 7) & ~7);
+
+	ctx->Shards = calloc(ctx->Cfg.Shards, sizeof(mtEventShard_t));
+	ctx->Workers = calloc(ctx->Cfg.Workers, sizeof(mtEventPoolWorker_t));
+	for (i = 0; ctx->Shards && (i < ctx->Cfg.Shards); i++)
+	{
+		ctx->Shards[i].Jobs = malloc((size_t) ctx->Cfg.Depth * ctx->JobBytes);
+		if (ctx->Shards[i].Jobs == NULL)
+		{
+			break;
+		}
+	}
+	if ((ctx->Shards == NULL) || (ctx->Workers == NULL)
+	        || (i < ctx->Cfg.Shards))
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "mtEventPoolInit: allocation failed\n");
+		for (i = 0; ctx->Shards && (i < ctx->Cfg.Shards); i++)
+		{
+			free(ctx->Shards[i].Jobs);
+		}
+		free(ctx->Shards);
+		free(ctx->Workers);
+		return -1;
+	}
+
+	for (i = 0; i < ctx->Cfg.Shards; i++)
+	{
+		pthread_mutex_init(&ctx->Shards[i].Lock, NULL);
+		pthread_cond_init(&ctx->Shards[i].SpaceCond, NULL);
+	}
+	pthread_mutex_init(&ctx->IdleLock, NULL);
+	pthread_cond_init(&ctx->WorkCond, NULL);
+	pthread_cond_init(&ctx->DoneCond, NULL);
+	pthread_mutex_init(&ctx->ListenerLock, NULL);
+
+	ctx->Running = 1;
+	for (i = 0; i < ctx->Cfg.Workers; i++)
+	{
+		ctx->Workers[i].Pool = ctx;
+		ctx->Workers[i].Index = i;
+		if (pthread_create(&ctx->Workers[i].Thread, NULL, poolThread,
+		        &ctx->Workers[i]) != 0)
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "mtEventPoolInit: no worker %d\n",
+			        i);
+			mtEventPoolClose(ctx);
+			return -1;
+		}
+		ctx->Started++;
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      mtEventPoolClose
+ *
+ * @brief   removes the pool listeners, runs the events queued and stops
+ *          the workers
+ *
+ * @param   ctx - pool
+ *
+ * @return  none
+ */
+void mtEventPoolClose(mtEventPool_t *ctx)
+{
+	mtEventPoolListener_t *l;
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->ListenerLock);
+	for (l = ctx->Listeners; l != NULL; l = l->Next)
+	{
+		mtEventRemoveListener(l->Event, poolDispatch, l);
+	}
+	pthread_mutex_unlock(&ctx->ListenerLock);
+	mtEventPoolFlush(ctx);
+
+	pthread_mutex_lock(&ctx->IdleLock);
+	ctx->Running = 0;
+	pthread_cond_broadcast(&ctx->WorkCond);
+	pthread_mutex_unlock(&ctx->IdleLock);
+	for (i = 0; i < ctx->Started; i++)
+	{
+		pthread_join(ctx->Workers[i].Thread, NULL);
+	}
+
+	while (ctx->Listeners != NULL)
+	{
+		l = ctx->Listeners;
+		ctx->Listeners = l->Next;
+		free(l);
+	}
+	for (i = 0; i < ctx->Cfg.Shards; i++)
+	{
+		pthread_cond_destroy(&ctx->Shards[i].SpaceCond);
+		pthread_mutex_destroy(&ctx->Shards[i].Lock);
+		free(ctx->Shards[i].Jobs);
+	}
+	free(ctx->Shards);
+	free(ctx->Workers);
+	pthread_mutex_destroy(&ctx->ListenerLock);
+	pthread_cond_destroy(&ctx->DoneCond);
+	pthread_cond_destroy(&ctx->WorkCond);
+	pthread_mutex_destroy(&ctx->IdleLock);
+}
+
+/*********************************************************************
+ * @fn      mtEventPoolAddListener
+ *
+ * @brief   adds a listener run by the workers
+ *
+ * @param   ctx - pool
+ * @param   event - MT_EVENT() of the callback
+ * @param   cb - listener
+ * @param   arg - context passed to the listener
+ * @param   msgLen - size of the message, up to Cfg.MsgBytes
+ * @param   keyOffset - offset of the uint16_t key in the message, or
+ *          MT_EVENT_POOL_NO_KEY
+ *
+ * @return  0 on success, -1 on an invalid listener, one already added
+ *          with this argument or out of memory
+ */
+int32_t mtEventPoolAddListener(mtEventPool_t *ctx, uint16_t event,
+        mtEventCb_t cb, void *arg, uint32_t msgLen, uint32_t keyOffset)
+{
+	mtEventPoolListener_t *l;
+
+	if ((cb == NULL) || (msgLen > ctx->Cfg.MsgBytes)
+	        || ((keyOffset != MT_EVENT_POOL_NO_KEY)
+	                && (keyOffset + sizeof(uint16_t) > msgLen)))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->ListenerLock);
+	for (l = ctx->Listeners; l != NULL; l = l->Next)
+	{
+		if ((l->Event == event) && (l->Cb == cb) && (l->Arg == arg))
+		{
+			pthread_mutex_unlock(&ctx->ListenerLock);
+			return -1;
+		}
+	}
+
+	l = malloc(sizeof(mtEventPoolListener_t));
+	if (l == NULL)
+	{
+		pthread_mutex_unlock(&ctx->ListenerLock);
+		return -1;
+	}
+	l->Pool = ctx;
+	l->Event = event;
+	l->Cb = cb;
+	l->Arg = arg;
+	l->MsgLen = msgLen;
+	l->KeyOffset = keyOffset;
+	if (mtEventAddListener(event, poolDispatch, l, ctx->Cfg.Priority) != 0)
+	{
+		pthread_mutex_unlock(&ctx->ListenerLock);
+		free(l);
+		return -1;
+	}
+	l->Next = ctx->Listeners;
+	ctx->Listeners = l;
+	pthread_mutex_unlock(&ctx->ListenerLock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      mtEventPoolRemoveListener
+ *
+ * @brief   removes a pool listener once its events queued have run. Not
+ *          to be called from a listener.
+ *
+ * @param   ctx - pool
+ * @param   event - MT_EVENT() of the callback
+ * @param   cb - listener
+ * @param   arg - context it was added with
+ *
+ * @return  0 on success, -1 if not found
+ */
+int32_t mtEventPoolRemoveListener(mtEventPool_t *ctx, uint16_t event,
+        mtEventCb_t cb, void *arg)
+{
+	mtEventPoolListener_t **pl, *l;
+
+	pthread_mutex_lock(&ctx->ListenerLock);
+	for (pl = &ctx->Listeners; *pl != NULL; pl = &(*pl)->Next)
+	{
+		if (((*pl)->Event == event) && ((*pl)->Cb == cb)
+		        && ((*pl)->Arg == arg))
+		{
+			break;
+		}
+	}
+	l = *pl;
+	if (l == NULL)
+	{
+		pthread_mutex_unlock(&ctx->ListenerLock);
+		return -1;
+	}
+	*pl = l->Next;
+	pthread_mutex_unlock(&ctx->ListenerLock);
+
+	// no dispatch queues it once removed, then its queued events run
+	mtEventRemoveListener(event, poolDispatch, l);
+	mtEventPoolFlush(ctx);
+	free(l);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      mtEventPoolFlush
+ *
+ * @brief   waits until the events queued so far have run. Not to be
+ *          called from a pool listener.
+ *
+ * @param   ctx - pool
+ *
+ * @return  none
+ */
+void mtEventPoolFlush(mtEventPool_t *ctx)
+{
+	pthread_mutex_lock(&ctx->IdleLock);
+	while (!poolDone(ctx))
+	{
+		pthread_cond_wait(&ctx->DoneCond, &ctx->IdleLock);
+	}
+	pthread_mutex_unlock(&ctx->IdleLock);
+}
+
+/*********************************************************************
+ * @fn      mtEventPoolPrintStats
+ *
+ * @brief   prints the totals, the events run by each worker and the
+ *          queue depth of each shard used
+ *
+ * @param   ctx - pool
+ * @param   out - stream
+ *
+ * @return  none
+ */
+void mtEventPoolPrintStats(mtEventPool_t *ctx, FILE *out)
+{
+	mtEventPoolStats_t total, st;
+	uint32_t i, depth;
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < ctx->Cfg.Shards; i++)
+	{
+		pthread_mutex_lock(&ctx->Shards[i].Lock);
+		st = ctx->Shards[i].Stats;
+		pthread_mutex_unlock(&ctx->Shards[i].Lock);
+		total.Queued += st.Queued;
+		total.Ran += st.Ran;
+		total.Drops += st.Drops;
+		total.Stalls += st.Stalls;
+		total.StallUs += st.StallUs;
+		total.Steals += st.Steals;
+		if (st.PeakDepth > total.PeakDepth)
+		{
+			total.PeakDepth = st.PeakDepth;
+		}
+	}
+	fprintf(out, "pool of %u workers, %u shards: %llu events queued, "
+	        "%llu run, %u dropped, %u stalls for %llu ms, %u steals, "
+	        "peak depth %u\n", ctx->Cfg.Workers, ctx->Cfg.Shards,
+	        (unsigned long long) total.Queued, (unsigned long long) total.Ran,
+	        total.Drops, total.Stalls,
+	        (unsigned long long) (total.StallUs / 1000), total.Steals,
+	        total.PeakDepth);
+
+	for (i = 0; i < ctx->Cfg.Workers; i++)
+	{
+		fprintf(out, "  worker %u: %llu run\n", i,
+		        (unsigned long long) __atomic_load_n(&ctx->Workers[i].Ran,
+		                __ATOMIC_RELAXED));
+	}
+	for (i = 0; i < ctx->Cfg.Shards; i++)
+	{
+		pthread_mutex_lock(&ctx->Shards[i].Lock);
+		st = ctx->Shards[i].Stats;
+		depth = ctx->Shards[i].Count;
+		pthread_mutex_unlock(&ctx->Shards[i].Lock);
+		if (st.Queued == 0)
+		{
+			continue;
+		}
+		fprintf(out, "  shard %u: depth %u, peak %u, %llu queued, "
+		        "%llu run, %u dropped, %u stalls, %u steals\n", i, depth,
+		        st.PeakDepth, (unsigned long long) st.Queued,
+		        (unsigned long long) st.Ran, st.Drops, st.Stalls, st.Steals);
+	}
+}
@@ -0,0 +1,159 @@
+/*
+ * mtEventPool.h
+ *
+ * This module contains the worker pool of the MT event bus, which runs
+ * the listeners added to it on Workers threads instead of the thread
+ * processing the MT frames, for listeners too slow to hold up the
+ * traffic of every node.
+ *
+ * A pool listener is added to the bus like any listener, with the size
+ * of the message of its event and the offset in the message of its
+ * key, a uint16_t, the source NwkAddr for most events. Its dispatch
+ * copies the message into the queue of the shard of the key; a shard
+ * is run by one worker at a time, in order, so the events of a key are
+ * handled in the order they came while different keys run in parallel.
+ * The events of all pool listeners with the same key go to the same
+ * shard, the AF messages and the ZDO responses of a node stay ordered.
+ *
+ * Each worker runs the shards s with s % Workers equal to its index, a
+ * worker that has none waiting steals the deepest shard nobody runs.
+ * When the queue of a shard is full the dispatch waits for a free slot,
+ * or with Cfg.Drop the event is dropped and counted. A pool listener
+ * must not add or remove listeners of the bus unless Cfg.Drop is set:
+ * the update waits for the dispatch, which may be waiting for it.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef MTEVENTPOOL_H
+#define MTEVENTPOOL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mtEvent.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// key offset of the events without a key, all run on one shard
+#define MT_EVENT_POOL_NO_KEY       (0xFFFFFFFF)
+
+// defaults used for the mtEventPoolCfg_t fields left 0
+#define MT_EVENT_POOL_WORKERS      (4)
+#define MT_EVENT_POOL_SHARDS       (64)
+#define MT_EVENT_POOL_DEPTH        (64)
+#define MT_EVENT_POOL_MSG_BYTES    (256)
+#define MT_EVENT_POOL_BATCH        (16)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint32_t Workers;          // threads
+	uint32_t Shards;           // rounded up to a power of 2
+	uint32_t Depth;            // events queued per shard
+	uint32_t MsgBytes;         // largest message of the listeners
+	uint32_t Batch;            // events a worker runs before it looks
+	                           // at its other shards
+	uint8_t Drop;              // drop the events rather than wait for a
+	                           // free slot
+	int32_t Priority;          // of the pool listeners on the bus
+} mtEventPoolCfg_t;
+
+typedef struct
+{
+	uint64_t Queued;           // events queued
+	uint64_t Ran;              // events run
+	uint32_t Drops;            // events dropped, queue full
+	uint32_t Stalls;           // times the dispatch waited for a slot
+	uint64_t StallUs;
+	uint32_t Steals;           // runs by a worker it is not the home of
+	uint32_t PeakDepth;
+} mtEventPoolStats_t;
+
+typedef struct
+{
+	pthread_mutex_t Lock;
+	pthread_cond_t SpaceCond;  // a slot was freed
+	uint8_t *Jobs;             // ring of Depth jobs
+	uint32_t Head;             // oldest job
+	uint32_t Count;            // jobs queued, read unlocked as a hint
+	uint8_t Busy;              // a worker runs the shard
+	mtEventPoolStats_t Stats;
+} mtEventShard_t;
+
+typedef struct mtEventPoolListener
+{
+	struct mtEventPoolListener *Next;
+	struct mtEventPool *Pool;
+	uint16_t Event;
+	mtEventCb_t Cb;
+	void *Arg;
+	uint32_t MsgLen;
+	uint32_t KeyOffset;
+} mtEventPoolListener_t;
+
+typedef struct
+{
+	struct mtEventPool *Pool;
+	uint32_t Index;
+	uint32_t Cursor;           // next home shard to look at
+	pthread_t Thread;
+	uint64_t Ran;              // events run
+} mtEventPoolWorker_t;
+
+typedef struct mtEventPool
+{
+	mtEventPoolCfg_t Cfg;
+	uint32_t JobBytes;
+	uint32_t ShardBits;
+	mtEventShard_t *Shards;
+
+	// idle workers wait for Work to change
+	pthread_mutex_t IdleLock;
+	pthread_cond_t WorkCond;
+	pthread_cond_t DoneCond;   // a shard was emptied
+	volatile uint32_t Work;
+	volatile uint32_t Idle;
+	uint8_t Running;
+
+	pthread_mutex_t ListenerLock;
+	mtEventPoolListener_t *Listeners;
+
+	mtEventPoolWorker_t *Workers;
+	uint32_t Started;          // threads running
+} mtEventPool_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t mtEventPoolInit(mtEventPool_t *ctx, mtEventPoolCfg_t *cfg);
+void mtEventPoolClose(mtEventPool_t *ctx);
+int32_t mtEventPoolAddListener(mtEventPool_t *ctx, uint16_t event,
+        mtEventCb_t cb, void *arg, uint32_t msgLen, uint32_t keyOffset);
+int32_t mtEventPoolRemoveListener(mtEventPool_t *ctx, uint16_t event,
+        mtEventCb_t cb, void *arg);
+void mtEventPoolFlush(mtEventPool_t *ctx);
+void mtEventPoolPrintStats(mtEventPool_t *ctx, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MTEVENTPOOL_H */
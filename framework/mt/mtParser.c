@@ -50,8 +50,11 @@
 #include "mtZdo.h"
 #include "mtAf.h"
 #include "mtSapi.h"
+#include "mtSbl.h"
+#include "mtOta.h"
 
 #include "dbgPrint.h"
+#include "rpcMetrics.h"
 
 /*********************************************************************
  * MACROS
@@ -82,6 +85,8 @@ uint8_t srspRpcLen;
  *************************************************************************************************/
 void mtProcess(uint8_t *rpcBuff, uint8_t rpcLen)
 {
+    RPC_METRIC_INC(RPC_METRIC_MT_SYS(rpcBuff[0] & MT_RPC_SUBSYSTEM_MASK));
+
     //Read CMD0
     switch (rpcBuff[0] & MT_RPC_SUBSYSTEM_MASK)
     {
@@ -105,10 +110,21 @@ void mtProcess(uint8_t *rpcBuff, uint8_t rpcLen)
         sapiProcess(rpcBuff, rpcLen);
         break;
 
+    case MT_RPC_SYS_SBL:
+        //process SBL RPC's in the Sbl module
+        sblProcess(rpcBuff, rpcLen);
+        break;
+
+    case MT_RPC_SYS_OTA:
+        //process OTA RPC's in the Ota module
+        otaProcess(rpcBuff, rpcLen);
+        break;
+
     default:
         dbg_print(PRINT_LEVEL_VERBOSE,
                 "mtProcess: CMD0:%x, CMD1:%x, not handled\n", rpcBuff[0],
                 rpcBuff[1]);
+        RPC_METRIC_INC(RPC_METRIC_MT_UNHANDLED);
 
         break;
     }
@@ -0,0 +1,508 @@
+/*
+ * bcastGov.c
+ *
+ * This module contains the broadcast governor, see bcastGov.h.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bcastGov.h"
+#include "rpc.h"
+#include "mtAf.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// network broadcast addresses: all routers, rx on when idle, all nodes
+#define BCAST_GOV_ADDR_ROUTERS     (0xFFFC)
+#define BCAST_GOV_ADDR_RESERVED    (0xFFFE)
+
+// what the ZNP did with a request, reqSend return values
+#define BCAST_GOV_TAKEN            (0)
+#define BCAST_GOV_REFUSED          (1)    // SRSP status other than ZSuccess
+#define BCAST_GOV_UNANSWERED       (2)    // no SRSP, it may have gone out
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowMs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in milli seconds
+ */
+static uint64_t nowMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static uint8_t isBcastAddr(uint16_t addr)
+{
+	return (addr >= BCAST_GOV_ADDR_ROUTERS)
+	        && (addr != BCAST_GOV_ADDR_RESERVED);
+}
+
+static uint8_t isBcastExt(DataRequestExtFormat_t *req)
+{
+	switch (req->DstAddrMode)
+	{
+	case afAddrGroup:
+	case afAddrBroadcast:
+		return 1;
+	case afAddr16Bit:
+		return isBcastAddr(req->DstAddr[0] | (req->DstAddr[1] << 8));
+	default:
+		return 0;
+	}
+}
+
+// same destination, endpoints and cluster
+static uint8_t sameTarget(bcastGovEntry_t *e, uint8_t isExt, void *req)
+{
+	DataRequestFormat_t *std = req;
+	DataRequestExtFormat_t *ext = req;
+
+	if (e->IsExt != isExt)
+	{
+		return 0;
+	}
+	if (!isExt)
+	{
+		return (e->Req.Std.DstAddr == std->DstAddr)
+		        && (e->Req.Std.DstEndpoint == std->DstEndpoint)
+		        && (e->Req.Std.SrcEndpoint == std->SrcEndpoint)
+		        && (e->Req.Std.ClusterID == std->ClusterID);
+	}
+	return (e->Req.Ext.DstAddrMode == ext->DstAddrMode)
+	        && (e->Req.Ext.DstAddr[0] == ext->DstAddr[0])
+	        && (e->Req.Ext.DstAddr[1] == ext->DstAddr[1])
+	        && (e->Req.Ext.DstEndpoint == ext->DstEndpoint)
+	        && (e->Req.Ext.DstPanID == ext->DstPanID)
+	        && (e->Req.Ext.SrcEndpoint == ext->SrcEndpoint)
+	        && (e->Req.Ext.ClusterId == ext->ClusterId);
+}
+
+static void entrySet(bcastGovEntry_t *e, uint8_t isExt, void *req)
+{
+	e->IsExt = isExt;
+	if (isExt)
+	{
+		memcpy(&e->Req.Ext, req, sizeof(DataRequestExtFormat_t));
+	}
+	else
+	{
+		memcpy(&e->Req.Std, req, sizeof(DataRequestFormat_t));
+	}
+}
+
+static uint8_t reqSend(uint8_t isExt, void *req)
+{
+	uint8_t srspStatus = MT_RPC_SUCCESS;
+	uint8_t status;
+
+	status = isExt ? afDataRequestExtStatus(req, &srspStatus) :
+	        afDataRequestStatus(req, &srspStatus);
+	if (status != MT_RPC_SUCCESS)
+	{
+		return BCAST_GOV_UNANSWERED;
+	}
+	if (srspStatus != MT_RPC_SUCCESS)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "bcastGov: ZNP refused the request,"
+		        " status 0x%02X\n", srspStatus);
+		return BCAST_GOV_REFUSED;
+	}
+
+	return BCAST_GOV_TAKEN;
+}
+
+/*********************************************************************
+ * @fn      windowExpire
+ *
+ * @brief   takes the broadcasts past their lifetime out of the window.
+ *          Called with the lock held.
+ */
+static void windowExpire(bcastGov_t *ctx, uint64_t now)
+{
+	while ((ctx->WindowCount > 0) && (ctx->Window[ctx->WindowHead] <= now))
+	{
+		ctx->WindowHead = (ctx->WindowHead + 1) % ctx->Cfg.MaxInFlight;
+		ctx->WindowCount--;
+	}
+}
+
+static uint8_t windowFree(bcastGov_t *ctx)
+{
+	return (ctx->WindowCount + ctx->Sending) < ctx->Cfg.MaxInFlight;
+}
+
+/*********************************************************************
+ * @fn      sendDone
+ *
+ * @brief   puts a broadcast the ZNP took in the window, one it refused
+ *          frees its place. One without an SRSP keeps its place, the
+ *          ZNP may have sent it. Either way the governor thread is woken
+ *          if broadcasts are queued, it may be waiting untimed for a
+ *          send of govSubmit() to end. Called with the lock held.
+ */
+static void sendDone(bcastGov_t *ctx, uint8_t outcome)
+{
+	uint32_t tail;
+
+	ctx->Sending--;
+	if (ctx->QueueCount > 0)
+	{
+		pthread_cond_signal(&ctx->Cond);
+	}
+	if (outcome == BCAST_GOV_REFUSED)
+	{
+		ctx->Stats.Failed++;
+		return;
+	}
+
+	tail = (ctx->WindowHead + ctx->WindowCount) % ctx->Cfg.MaxInFlight;
+	ctx->Window[tail] = nowMs() + ctx->Cfg.LifetimeMs;
+	ctx->WindowCount++;
+	if (outcome == BCAST_GOV_TAKEN)
+	{
+		ctx->Stats.Sent++;
+	}
+	else
+	{
+		ctx->Stats.Unanswered++;
+	}
+}
+
+/*********************************************************************
+ * @fn      govTask
+ *
+ * @brief   sends the queued broadcasts as the window lets them go
+ */
+static void *govTask(void *arg)
+{
+	bcastGov_t *ctx = arg;
+	bcastGovEntry_t entry;
+	struct timespec ts;
+	uint64_t now, waitMs;
+	uint8_t outcome;
+
+	pthread_mutex_lock(&ctx->Lock);
+	while (ctx->Running)
+	{
+		now = nowMs();
+		windowExpire(ctx, now);
+
+		if ((ctx->QueueCount > 0) && windowFree(ctx))
+		{
+			entry = ctx->Queue[ctx->QueueHead];
+			ctx->QueueHead = (ctx->QueueHead + 1) % ctx->Cfg.Depth;
+			ctx->QueueCount--;
+			ctx->Sending++;
+
+			waitMs = now - entry.QueuedMs;
+			ctx->Stats.WaitMs += waitMs;
+			if (waitMs > ctx->Stats.MaxWaitMs)
+			{
+				ctx->Stats.MaxWaitMs = waitMs;
+			}
+
+			pthread_mutex_unlock(&ctx->Lock);
+			outcome = reqSend(entry.IsExt, &entry.Req);
+			pthread_mutex_lock(&ctx->Lock);
+			sendDone(ctx, outcome);
+			continue;
+		}
+
+		//sleep until the oldest broadcast leaves the window, a new one
+		//comes or a send of govSubmit() ends
+		if ((ctx->QueueCount > 0) && (ctx->WindowCount > 0))
+		{
+			ts.tv_sec = ctx->Window[ctx->WindowHead] / 1000;
+			ts.tv_nsec = (ctx->Window[ctx->WindowHead] % 1000) * 1000000;
+			pthread_cond_timedwait(&ctx->Cond, &ctx->Lock, &ts);
+		}
+		else
+		{
+			pthread_cond_wait(&ctx->Cond, &ctx->Lock);
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      govSubmit
+ *
+ * @brief   sends a broadcast if the window has room and none waits,
+ *          else queues it
+ */
+static int32_t govSubmit(bcastGov_t *ctx, uint8_t isExt, void *req)
+{
+	bcastGovEntry_t *e;
+	uint64_t now;
+	uint32_t i;
+	uint8_t outcome;
+
+	pthread_mutex_lock(&ctx->Lock);
+	now = nowMs();
+	windowExpire(ctx, now);
+
+	if ((ctx->QueueCount == 0) && windowFree(ctx))
+	{
+		ctx->Sending++;
+		pthread_mutex_unlock(&ctx->Lock);
+		outcome = reqSend(isExt, req);
+		pthread_mutex_lock(&ctx->Lock);
+		sendDone(ctx, outcome);
+		pthread_mutex_unlock(&ctx->Lock);
+
+		return (outcome == BCAST_GOV_TAKEN) ? BCAST_GOV_SENT : -1;
+	}
+
+	if (ctx->Cfg.Coalesce)
+	{
+		for (i = 0; i < ctx->QueueCount; i++)
+		{
+			e = &ctx->Queue[(ctx->QueueHead + i) % ctx->Cfg.Depth];
+			if (sameTarget(e, isExt, req))
+			{
+				entrySet(e, isExt, req);
+				ctx->Stats.Coalesced++;
+				pthread_mutex_unlock(&ctx->Lock);
+				return BCAST_GOV_COALESCED;
+			}
+		}
+	}
+
+	if (ctx->QueueCount == ctx->Cfg.Depth)
+	{
+		ctx->Stats.Refused++;
+		pthread_mutex_unlock(&ctx->Lock);
+		return -1;
+	}
+
+	e = &ctx->Queue[(ctx->QueueHead + ctx->QueueCount) % ctx->Cfg.Depth];
+	entrySet(e, isExt, req);
+	e->QueuedMs = now;
+	ctx->QueueCount++;
+	ctx->Stats.Queued++;
+	if (ctx->QueueCount > ctx->Stats.PeakQueued)
+	{
+		ctx->Stats.PeakQueued = ctx->QueueCount;
+	}
+	pthread_cond_signal(&ctx->Cond);
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return BCAST_GOV_QUEUED;
+}
+
+static int32_t govDirect(bcastGov_t *ctx, uint8_t isExt, void *req)
+{
+	__atomic_add_fetch(&ctx->Stats.Direct, 1, __ATOMIC_RELAXED);
+
+	return (reqSend(isExt, req) == BCAST_GOV_TAKEN) ? BCAST_GOV_SENT : -1;
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      bcastGovInit
+ *
+ * @brief   sets up a governor and starts its thread
+ *
+ * @param   ctx - governor
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 on failure
+ */
+int32_t bcastGovInit(bcastGov_t *ctx, bcastGovCfg_t *cfg)
+{
+	pthread_condattr_t attr;
+
+	memset(ctx, 0, sizeof(bcastGov_t));
+	ctx->Cfg = *cfg;
+	if (ctx->Cfg.MaxInFlight == 0)
+	{
+		ctx->Cfg.MaxInFlight = BCAST_GOV_MAX_IN_FLIGHT;
+	}
+	if (ctx->Cfg.LifetimeMs == 0)
+	{
+		ctx->Cfg.LifetimeMs = BCAST_GOV_LIFETIME_MS;
+	}
+	if (ctx->Cfg.Depth == 0)
+	{
+		ctx->Cfg.Depth = BCAST_GOV_DEPTH;
+	}
+
+	ctx->Window = calloc(ctx->Cfg.MaxInFlight, sizeof(uint64_t));
+	ctx->Queue = calloc(ctx->Cfg.Depth, sizeof(bcastGovEntry_t));
+	if ((ctx->Window == NULL) || (ctx->Queue == NULL))
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "bcastGovInit: allocation failed\n");
+		free(ctx->Window);
+		free(ctx->Queue);
+		return -1;
+	}
+
+	pthread_mutex_init(&ctx->Lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ctx->Cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	ctx->Running = 1;
+	if (pthread_create(&ctx->Thread, NULL, govTask, ctx) != 0)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "bcastGovInit: no thread\n");
+		pthread_cond_destroy(&ctx->Cond);
+		pthread_mutex_destroy(&ctx->Lock);
+		free(ctx->Window);
+		free(ctx->Queue);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      bcastGovClose
+ *
+ * @brief   stops the governor thread, the broadcasts still queued are
+ *          dropped
+ *
+ * @param   ctx - governor
+ *
+ * @return  none
+ */
+void bcastGovClose(bcastGov_t *ctx)
+{
+	pthread_mutex_lock(&ctx->Lock);
+	ctx->Running = 0;
+	pthread_cond_signal(&ctx->Cond);
+	pthread_mutex_unlock(&ctx->Lock);
+	pthread_join(ctx->Thread, NULL);
+
+	ctx->Stats.Dropped += ctx->QueueCount;
+	ctx->QueueCount = 0;
+	pthread_cond_destroy(&ctx->Cond);
+	pthread_mutex_destroy(&ctx->Lock);
+	free(ctx->Window);
+	free(ctx->Queue);
+	ctx->Window = NULL;
+	ctx->Queue = NULL;
+}
+
+/*********************************************************************
+ * @fn      bcastGovDataRequest
+ *
+ * @brief   afDataRequest() through the governor
+ *
+ * @param   ctx - governor
+ * @param   req - request, copied if queued
+ *
+ * @return  BCAST_GOV_SENT, BCAST_GOV_QUEUED or BCAST_GOV_COALESCED, -1
+ *          if the ZNP refused the request or did not answer, or the
+ *          queue is full
+ */
+int32_t bcastGovDataRequest(bcastGov_t *ctx, DataRequestFormat_t *req)
+{
+	if (!isBcastAddr(req->DstAddr))
+	{
+		return govDirect(ctx, 0, req);
+	}
+
+	return govSubmit(ctx, 0, req);
+}
+
+/*********************************************************************
+ * @fn      bcastGovDataRequestExt
+ *
+ * @brief   afDataRequestExt() through the governor
+ *
+ * @param   ctx - governor
+ * @param   req - request, copied if queued
+ *
+ * @return  BCAST_GOV_SENT, BCAST_GOV_QUEUED or BCAST_GOV_COALESCED, -1
+ *          if the ZNP refused the request or did not answer, or the
+ *          queue is full
+ */
+int32_t bcastGovDataRequestExt(bcastGov_t *ctx, DataRequestExtFormat_t *req)
+{
+	if (!isBcastExt(req))
+	{
+		return govDirect(ctx, 1, req);
+	}
+
+	return govSubmit(ctx, 1, req);
+}
+
+/*********************************************************************
+ * @fn      bcastGovInFlight
+ *
+ * @brief   counts the broadcasts in the window
+ *
+ * @param   ctx - governor
+ *
+ * @return  broadcasts sent in the last LifetimeMs or being sent
+ */
+uint32_t bcastGovInFlight(bcastGov_t *ctx)
+{
+	uint32_t inFlight;
+
+	pthread_mutex_lock(&ctx->Lock);
+	windowExpire(ctx, nowMs());
+	inFlight = ctx->WindowCount + ctx->Sending;
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return inFlight;
+}
+
+/*********************************************************************
+ * @fn      bcastGovPrintStats
+ *
+ * @brief   prints the broadcasts sent, queued and refused
+ *
+ * @param   ctx - governor
+ * @param   out - stream
+ *
+ * @return  none
+ */
+void bcastGovPrintStats(bcastGov_t *ctx, FILE *out)
+{
+	bcastGovStats_t *st = &ctx->Stats;
+	uint32_t dequeued;
+
+	pthread_mutex_lock(&ctx->Lock);
+	dequeued = st->Queued - ctx->QueueCount - st->Dropped;
+	fprintf(out, "broadcasts: %llu sent, %u queued, %u coalesced, "
+	        "%u refused, %u failed, %u unanswered, %u dropped, "
+	        "peak queue %u, wait avg %llu ms max %u ms, %llu direct\n",
+	        (unsigned long long) st->Sent, st->Queued, st->Coalesced,
+	        st->Refused, st->Failed, st->Unanswered, st->Dropped,
+	        st->PeakQueued,
+	        (unsigned long long) ((dequeued > 0) ?
+	                (st->WaitMs / dequeued) : 0),
+	        st->MaxWaitMs,
+	        (unsigned long long) __atomic_load_n(&st->Direct,
+	                __ATOMIC_RELAXED));
+	pthread_mutex_unlock(&ctx->Lock);
+}
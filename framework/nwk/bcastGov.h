@@ -0,0 +1,142 @@
+/*
+ * bcastGov.h
+ *
+ * This module contains the broadcast governor, which keeps the AF
+ * broadcasts and group messages sent within what the broadcast
+ * transaction table of the ZNP holds.
+ *
+ * Every broadcast, afDataRequest() to 0xFFFC, 0xFFFD or 0xFFFF and
+ * afDataRequestExt() to a group or a broadcast address, takes an entry
+ * of the table of each node relaying it for the broadcast delivery
+ * time, whatever its confirm says. When the table is full the stack
+ * fails the broadcasts, its own and the relayed ones included, and the
+ * retries slow the whole network. The governor counts the broadcasts
+ * it sent over the last LifetimeMs and sends at most MaxInFlight of
+ * them in that window; the others wait in a queue, in order, for the
+ * oldest to leave the window and are sent by the governor thread.
+ * A broadcast the ZNP refused, its SRSP status other than ZSuccess,
+ * frees its place in the window; one left without an SRSP keeps it,
+ * the ZNP may have sent it.
+ * With Cfg.Coalesce a queued broadcast is replaced by a newer one with
+ * the same destination, endpoints and cluster, the newer state of a
+ * group of lights superseding the older one.
+ *
+ * Requests to a single node go to the ZNP directly, so an application
+ * can send all its AF messages through the governor, and a command to
+ * a group is one broadcast of the table instead of a unicast to each
+ * member.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef BCASTGOV_H
+#define BCASTGOV_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mtAf.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// defaults used for the bcastGovCfg_t fields left 0: Z-Stack has 9
+// entries in the table, kept BCAST_DELIVERY_TIME (30 x 100ms); some
+// are left to the broadcasts of the stack and of the other nodes
+#define BCAST_GOV_MAX_IN_FLIGHT    (6)
+#define BCAST_GOV_LIFETIME_MS      (3000)
+#define BCAST_GOV_DEPTH            (32)
+
+// what bcastGovDataRequest() did with a request, -1 if it was refused
+#define BCAST_GOV_SENT             (0)
+#define BCAST_GOV_QUEUED           (1)
+#define BCAST_GOV_COALESCED        (2)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint32_t MaxInFlight;      // broadcasts sent per window
+	uint32_t LifetimeMs;       // window, the broadcast delivery time
+	uint32_t Depth;            // broadcasts queued at most
+	uint8_t Coalesce;          // replace a queued broadcast by a newer one
+	                           // to the same destination and cluster
+} bcastGovCfg_t;
+
+typedef struct
+{
+	uint64_t Sent;             // broadcasts sent, at once or queued
+	uint64_t Direct;           // requests to a single node
+	uint32_t Queued;           // broadcasts that waited for the window
+	uint32_t Coalesced;        // queued broadcasts replaced by a newer one
+	uint32_t Refused;          // queue full
+	uint32_t Failed;           // refused by the ZNP, SRSP status not 0
+	uint32_t Unanswered;       // no SRSP, kept in the window
+	uint32_t Dropped;          // still queued at bcastGovClose()
+	uint32_t PeakQueued;
+	uint64_t WaitMs;           // time the queued broadcasts waited
+	uint32_t MaxWaitMs;
+} bcastGovStats_t;
+
+typedef struct
+{
+	uint8_t IsExt;             // Req.Ext rather than Req.Std
+	uint64_t QueuedMs;
+	union
+	{
+		DataRequestFormat_t Std;
+		DataRequestExtFormat_t Ext;
+	} Req;
+} bcastGovEntry_t;
+
+typedef struct
+{
+	bcastGovCfg_t Cfg;
+	pthread_mutex_t Lock;
+	pthread_cond_t Cond;       // a broadcast was queued or stopping
+	pthread_t Thread;
+	uint8_t Running;
+
+	// end of the window of the broadcasts sent, oldest first
+	uint64_t *Window;
+	uint32_t WindowHead;
+	uint32_t WindowCount;
+	uint32_t Sending;          // broadcasts being sent, not yet in Window
+
+	bcastGovEntry_t *Queue;    // ring of Depth broadcasts
+	uint32_t QueueHead;
+	uint32_t QueueCount;
+
+	bcastGovStats_t Stats;
+} bcastGov_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t bcastGovInit(bcastGov_t *ctx, bcastGovCfg_t *cfg);
+void bcastGovClose(bcastGov_t *ctx);
+int32_t bcastGovDataRequest(bcastGov_t *ctx, DataRequestFormat_t *req);
+int32_t bcastGovDataRequestExt(bcastGov_t *ctx, DataRequestExtFormat_t *req);
+uint32_t bcastGovInFlight(bcastGov_t *ctx);
+void bcastGovPrintStats(bcastGov_t *ctx, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BCASTGOV_H */
@@ -0,0 +1,1083 @@
+/*
+ * devDb.c
+ *
+ * This module contains the persistent device database, which keeps the
+ * addresses and descriptors of the devices in the network in a memory
+ * mapped file so they survive a restart of the host.
+ *
+ * The file is used in place, there is no load or parse pass. It holds a
+ * header, a direct index from network address to slot and an open
+ * addressing hash table of slots keyed by IEEE address (Fibonacci hash,
+ * linear probing). A slot key is written once when the slot is claimed
+ * and never cleared, a device that leaves is only flagged removed, so
+ * probe sequences never break.
+ *
+ * Each slot holds two copies of the record with a sequence number and a
+ * CRC-32 over both. An update writes the older copy, record first and
+ * CRC last, so a crash in the middle of an update leaves the other copy
+ * valid. The last seen time and link quality change with every frame and
+ * are kept outside the copies, they are written in place.
+ *
+ * Updates reach the page cache immediately, so a crash of the host loses
+ * nothing. devDbSync() also makes them durable against a power loss.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "devDb.h"
+#include "mtZdo.h"
+#include "mtAf.h"
+#include "mtEvent.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define DEV_DB_MAGIC               (0x4244445A) // "ZDDB"
+#define DEV_DB_VERSION             (1)
+
+// the header is padded to one page so the index and slots stay aligned
+#define DEV_DB_HEADER_SIZE         (4096)
+
+// entries of the network address index
+#define DEV_DB_NWK_INDEX           (65536)
+
+// marks a slot position that is not in the table
+#define DEV_DB_INVALID_POS         (0xFFFFFFFF)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t RecordSize;
+	uint32_t SlotCount;
+	uint32_t Devices;
+} dbHeader_t;
+
+typedef struct
+{
+	uint32_t Seq;             // 0 while the copy was never written
+	uint32_t Crc;             // CRC-32 of Seq and Rec
+	devDbRecord_t Rec;
+} dbCopy_t;
+
+typedef struct
+{
+	uint64_t Key;             // IEEE address, 0 while the slot is free
+	uint32_t LastSeen;
+	uint8_t Lqi;
+	uint8_t Reserved[3];
+	dbCopy_t Copy[2];
+} dbSlot_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static pthread_mutex_t devDbLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint8_t *devDbMap;
+static size_t devDbMapLen;
+static int devDbFd = -1;
+static dbHeader_t *devDbHdr;
+static uint32_t *devDbNwkIndex;
+static dbSlot_t *devDbSlots;
+static uint32_t devDbMask;
+static uint8_t devDbShift;
+
+static uint32_t crcTable[256];
+static devDbStats_t devDbStats;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      crcInit
+ *
+ * @brief   builds the CRC-32 (IEEE 802.3) table
+ *
+ * @return  none
+ */
+static void crcInit(void)
+{
+	uint32_t i, bit, crc;
+
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+		for (bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+		}
+		crcTable[i] = crc;
+	}
+}
+
+/*********************************************************************
+ * @fn      copyCrc
+ *
+ * @brief   calculates the CRC-32 of a record copy
+ *
+ * @param   copy - record copy
+ *
+ * @return  CRC of the sequence number and the record
+ */
+static uint32_t copyCrc(dbCopy_t *copy)
+{
+	const uint8_t *buf = (const uint8_t *) copy;
+	uint32_t crc = 0xFFFFFFFF;
+	size_t i;
+
+	for (i = 0; i < sizeof(dbCopy_t); i++)
+	{
+		if ((i >= offsetof(dbCopy_t, Crc))
+		        && (i < offsetof(dbCopy_t, Crc) + sizeof(copy->Crc)))
+		{
+			continue;
+		}
+		crc = crcTable[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc ^ 0xFFFFFFFF;
+}
+
+/*********************************************************************
+ * @fn      slotCurrent
+ *
+ * @brief   selects the newest valid copy of a slot
+ *
+ * @param   slot - slot
+ *
+ * @return  copy index, -1 if the slot has no valid copy
+ */
+static int32_t slotCurrent(dbSlot_t *slot)
+{
+	int32_t cur = -1;
+	uint32_t i;
+
+	for (i = 0; i < 2; i++)
+	{
+		dbCopy_t *copy = &slot->Copy[i];
+
+		if (copy->Seq == 0)
+		{
+			continue;
+		}
+		if (copy->Crc != copyCrc(copy))
+		{
+			devDbStats.TornCopies++;
+			continue;
+		}
+		if ((cur < 0) || ((int32_t) (copy->Seq - slot->Copy[cur].Seq) > 0))
+		{
+			cur = i;
+		}
+	}
+
+	return cur;
+}
+
+/*********************************************************************
+ * @fn      slotRead
+ *
+ * @brief   reads the current record of a slot
+ *
+ * @param   pos - slot position
+ * @param   rec - filled with the record
+ *
+ * @return  0 on success, -1 if the slot has no valid copy
+ */
+static int32_t slotRead(uint32_t pos, devDbRecord_t *rec)
+{
+	dbSlot_t *slot = &devDbSlots[pos];
+	int32_t cur = slotCurrent(slot);
+
+	if (cur < 0)
+	{
+		return -1;
+	}
+	memcpy(rec, &slot->Copy[cur].Rec, sizeof(devDbRecord_t));
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      slotWrite
+ *
+ * @brief   replaces the older copy of a slot with a new record
+ *
+ * @param   pos - slot position
+ * @param   rec - record
+ *
+ * @return  none
+ */
+static void slotWrite(uint32_t pos, devDbRecord_t *rec)
+{
+	dbSlot_t *slot = &devDbSlots[pos];
+	int32_t cur = slotCurrent(slot);
+	dbCopy_t *copy;
+	uint32_t seq = 1;
+
+	if (cur >= 0)
+	{
+		seq = slot->Copy[cur].Seq + 1;
+		if (seq == 0)
+		{
+			seq = 1;
+		}
+	}
+	copy = &slot->Copy[(cur == 0) ? 1 : 0];
+
+	memcpy(&copy->Rec, rec, sizeof(devDbRecord_t));
+	copy->Seq = seq;
+	__sync_synchronize();
+	copy->Crc = copyCrc(copy);
+	__sync_synchronize();
+
+	devDbStats.Puts++;
+}
+
+/*********************************************************************
+ * @fn      slotFind
+ *
+ * @brief   looks up the slot of an IEEE address
+ *
+ * @param   ieeeAddr - IEEE address
+ *
+ * @return  slot holding the address, or the free slot ending its probe,
+ *          DEV_DB_INVALID_POS if the table is full
+ */
+static uint32_t slotFind(uint64_t ieeeAddr)
+{
+	uint32_t pos = (uint32_t) ((ieeeAddr * 0x9E3779B97F4A7C15ULL)
+	        >> devDbShift);
+	uint32_t probes;
+
+	for (probes = 0; probes <= devDbMask; probes++)
+	{
+		if ((devDbSlots[pos].Key == 0) || (devDbSlots[pos].Key == ieeeAddr))
+		{
+			return pos;
+		}
+		pos = (pos + 1) & devDbMask;
+	}
+
+	return DEV_DB_INVALID_POS;
+}
+
+/*********************************************************************
+ * @fn      findIeee
+ *
+ * @brief   reads the record of an IEEE address
+ *
+ * @param   ieeeAddr - IEEE address
+ * @param   rec - filled with the record
+ *
+ * @return  slot position, DEV_DB_INVALID_POS if not known
+ */
+static uint32_t findIeee(uint64_t ieeeAddr, devDbRecord_t *rec)
+{
+	uint32_t pos;
+
+	if ((devDbMap == NULL) || (ieeeAddr == 0))
+	{
+		return DEV_DB_INVALID_POS;
+	}
+	pos = slotFind(ieeeAddr);
+	if ((pos == DEV_DB_INVALID_POS) || (devDbSlots[pos].Key == 0)
+	        || (slotRead(pos, rec) != 0))
+	{
+		return DEV_DB_INVALID_POS;
+	}
+
+	return pos;
+}
+
+/*********************************************************************
+ * @fn      findNwk
+ *
+ * @brief   reads the record of a network address. The index is only a
+ *          hint, the address is checked against the record.
+ *
+ * @param   nwkAddr - network address
+ * @param   rec - filled with the record
+ *
+ * @return  slot position, DEV_DB_INVALID_POS if not known
+ */
+static uint32_t findNwk(uint16_t nwkAddr, devDbRecord_t *rec)
+{
+	uint32_t pos;
+
+	if ((devDbMap == NULL) || (devDbNwkIndex[nwkAddr] == 0))
+	{
+		return DEV_DB_INVALID_POS;
+	}
+	pos = devDbNwkIndex[nwkAddr] - 1;
+	if ((pos > devDbMask) || (slotRead(pos, rec) != 0)
+	        || (rec->NwkAddr != nwkAddr) || (rec->Flags & DEV_DB_REMOVED))
+	{
+		return DEV_DB_INVALID_POS;
+	}
+
+	return pos;
+}
+
+/*********************************************************************
+ * @fn      put
+ *
+ * @brief   commits a record and updates the network address index
+ *
+ * @param   rec - record
+ *
+ * @return  slot position, DEV_DB_INVALID_POS if the file is full
+ */
+static uint32_t put(devDbRecord_t *rec)
+{
+	devDbRecord_t old;
+	uint8_t wasLive = 0;
+	uint8_t isLive = !(rec->Flags & DEV_DB_REMOVED);
+	uint32_t pos = slotFind(rec->IeeeAddr);
+
+	if (pos == DEV_DB_INVALID_POS)
+	{
+		devDbStats.Full++;
+		return pos;
+	}
+
+	if (devDbSlots[pos].Key == 0)
+	{
+		if ((devDbHdr->Devices + 1) > ((devDbMask + 1) / 2))
+		{
+			devDbStats.Full++;
+			return DEV_DB_INVALID_POS;
+		}
+		devDbSlots[pos].Key = rec->IeeeAddr;
+	}
+	else if (slotRead(pos, &old) == 0)
+	{
+		wasLive = !(old.Flags & DEV_DB_REMOVED);
+		if ((old.NwkAddr != rec->NwkAddr)
+		        && (devDbNwkIndex[old.NwkAddr] == pos + 1))
+		{
+			devDbNwkIndex[old.NwkAddr] = 0;
+		}
+	}
+
+	slotWrite(pos, rec);
+
+	if (isLive)
+	{
+		devDbNwkIndex[rec->NwkAddr] = pos + 1;
+	}
+	else if (devDbNwkIndex[rec->NwkAddr] == pos + 1)
+	{
+		devDbNwkIndex[rec->NwkAddr] = 0;
+	}
+	if (isLive && !wasLive)
+	{
+		devDbHdr->Devices++;
+	}
+	else if (wasLive && !isLive)
+	{
+		devDbHdr->Devices--;
+	}
+
+	return pos;
+}
+
+/*********************************************************************
+ * @fn      updateAddr
+ *
+ * @brief   records the network address of a device
+ *
+ * @param   nwkAddr - network address
+ * @param   ieeeAddr - IEEE address
+ *
+ * @return  slot position, DEV_DB_INVALID_POS if not stored
+ */
+static uint32_t updateAddr(uint16_t nwkAddr, uint64_t ieeeAddr)
+{
+	devDbRecord_t rec;
+	uint32_t pos;
+
+	if ((ieeeAddr == 0) || (ieeeAddr == 0xFFFFFFFFFFFFFFFFULL))
+	{
+		return DEV_DB_INVALID_POS;
+	}
+
+	pos = findIeee(ieeeAddr, &rec);
+	if (pos == DEV_DB_INVALID_POS)
+	{
+		memset(&rec, 0, sizeof(rec));
+		rec.IeeeAddr = ieeeAddr;
+	}
+	else if ((rec.NwkAddr == nwkAddr) && !(rec.Flags & DEV_DB_REMOVED)
+	        && (devDbNwkIndex[nwkAddr] == pos + 1))
+	{
+		return pos;
+	}
+	rec.NwkAddr = nwkAddr;
+	rec.Flags &= ~DEV_DB_REMOVED;
+
+	return put(&rec);
+}
+
+/*********************************************************************
+ * @fn      touch
+ *
+ * @brief   records the time and link quality of a frame from a device
+ *
+ * @param   pos - slot position
+ * @param   lqi - link quality
+ *
+ * @return  none
+ */
+static void touch(uint32_t pos, uint8_t lqi)
+{
+	devDbSlots[pos].LastSeen = (uint32_t) time(NULL);
+	devDbSlots[pos].Lqi = lqi;
+	devDbStats.Touches++;
+}
+
+/*********************************************************************
+ * ZDO LISTENERS
+ */
+
+static void endDeviceAnnceIndCb(uint16_t event, void *data, void *arg)
+{
+	EndDeviceAnnceIndFormat_t *msg = data;
+	devDbRecord_t rec;
+	uint32_t pos;
+
+	pthread_mutex_lock(&devDbLock);
+	pos = updateAddr(msg->NwkAddr, msg->IEEEAddr);
+	if ((pos != DEV_DB_INVALID_POS) && (slotRead(pos, &rec) == 0))
+	{
+		if (rec.Capabilities != msg->Capabilities)
+		{
+			rec.Capabilities = msg->Capabilities;
+			put(&rec);
+		}
+		touch(pos, devDbSlots[pos].Lqi);
+	}
+	pthread_mutex_unlock(&devDbLock);
+}
+
+static void nwkAddrRspCb(uint16_t event, void *data, void *arg)
+{
+	NwkAddrRspFormat_t *msg = data;
+
+	if (msg->Status == 0)
+	{
+		pthread_mutex_lock(&devDbLock);
+		updateAddr(msg->NwkAddr, msg->IEEEAddr);
+		pthread_mutex_unlock(&devDbLock);
+	}
+}
+
+static void ieeeAddrRspCb(uint16_t event, void *data, void *arg)
+{
+	IeeeAddrRspFormat_t *msg = data;
+
+	if (msg->Status == 0)
+	{
+		pthread_mutex_lock(&devDbLock);
+		updateAddr(msg->NwkAddr, msg->IEEEAddr);
+		pthread_mutex_unlock(&devDbLock);
+	}
+}
+
+static void nodeDescRspCb(uint16_t event, void *data, void *arg)
+{
+	NodeDescRspFormat_t *msg = data;
+	devDbRecord_t rec;
+
+	if (msg->Status != 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&devDbLock);
+	if (findNwk(msg->NwkAddr, &rec) != DEV_DB_INVALID_POS)
+	{
+		rec.LogicalType = msg->LoTy_ComDescAv_UsrDesAv & 0x07;
+		rec.ManufacturerCode = msg->ManufacturerCode;
+		rec.Capabilities = msg->MACCapFlg;
+		rec.Flags |= DEV_DB_NODE_DESC;
+		put(&rec);
+	}
+	pthread_mutex_unlock(&devDbLock);
+}
+
+static void activeEpRspCb(uint16_t event, void *data, void *arg)
+{
+	ActiveEpRspFormat_t *msg = data;
+	devDbRecord_t rec;
+	uint8_t count = msg->ActiveEPCount;
+
+	if (msg->Status != 0)
+	{
+		return;
+	}
+	if (count > DEV_DB_MAX_ENDPOINTS)
+	{
+		count = DEV_DB_MAX_ENDPOINTS;
+	}
+
+	pthread_mutex_lock(&devDbLock);
+	if (findNwk(msg->NwkAddr, &rec) != DEV_DB_INVALID_POS)
+	{
+		//the simple descriptors are only kept if the endpoints are the same
+		if ((rec.NumEndpoints != count)
+		        || (memcmp(rec.Endpoints, msg->ActiveEPList, count) != 0))
+		{
+			rec.NumEndpoints = count;
+			memset(rec.Endpoints, 0, sizeof(rec.Endpoints));
+			memcpy(rec.Endpoints, msg->ActiveEPList, count);
+			memset(rec.EpDesc, 0, sizeof(rec.EpDesc));
+			rec.SimpleDescMask = 0;
+		}
+		rec.Flags |= DEV_DB_ACTIVE_EP;
+		put(&rec);
+	}
+	pthread_mutex_unlock(&devDbLock);
+}
+
+static void simpleDescRspCb(uint16_t event, void *data, void *arg)
+{
+	SimpleDescRspFormat_t *msg = data;
+	devDbRecord_t rec;
+	devDbEndpoint_t *ep;
+	uint8_t epIdx;
+	uint8_t i;
+
+	if (msg->Status != 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&devDbLock);
+	if (findNwk(msg->NwkAddr, &rec) == DEV_DB_INVALID_POS)
+	{
+		pthread_mutex_unlock(&devDbLock);
+		return;
+	}
+
+	for (epIdx = 0; epIdx < rec.NumEndpoints; epIdx++)
+	{
+		if (rec.Endpoints[epIdx] == msg->Endpoint)
+		{
+			break;
+		}
+	}
+	if (epIdx == rec.NumEndpoints)
+	{
+		if (epIdx == DEV_DB_MAX_ENDPOINTS)
+		{
+			pthread_mutex_unlock(&devDbLock);
+			return;
+		}
+		rec.Endpoints[epIdx] = msg->Endpoint;
+		rec.NumEndpoints++;
+	}
+
+	ep = &rec.EpDesc[epIdx];
+	memset(ep, 0, sizeof(devDbEndpoint_t));
+	ep->Endpoint = msg->Endpoint;
+	ep->DeviceVersion = msg->DeviceVersion;
+	ep->ProfileId = msg->ProfileID;
+	ep->DeviceId = msg->DeviceID;
+	ep->NumInClusters = msg->NumInClusters;
+	if (ep->NumInClusters > DEV_DB_MAX_CLUSTERS)
+	{
+		ep->NumInClusters = DEV_DB_MAX_CLUSTERS;
+	}
+	ep->NumOutClusters = msg->NumOutClusters;
+	if (ep->NumOutClusters > DEV_DB_MAX_CLUSTERS)
+	{
+		ep->NumOutClusters = DEV_DB_MAX_CLUSTERS;
+	}
+	for (i = 0; i < ep->NumInClusters; i++)
+	{
+		ep->InClusters[i] = msg->InClusterList[i];
+	}
+	for (i = 0; i < ep->NumOutClusters; i++)
+	{
+		ep->OutClusters[i] = msg->OutClusterList[i];
+	}
+	rec.SimpleDescMask |= (1 << epIdx);
+	put(&rec);
+	pthread_mutex_unlock(&devDbLock);
+}
+
+static void leaveIndCb(uint16_t event, void *data, void *arg)
+{
+	LeaveIndFormat_t *msg = data;
+	devDbRecord_t rec;
+	uint32_t pos;
+
+	if (msg->Rejoin)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&devDbLock);
+	pos = findIeee(msg->ExtAddr, &rec);
+	if (pos == DEV_DB_INVALID_POS)
+	{
+		pos = findNwk(msg->SrcAddr, &rec);
+	}
+	if ((pos != DEV_DB_INVALID_POS) && !(rec.Flags & DEV_DB_REMOVED))
+	{
+		rec.Flags |= DEV_DB_REMOVED;
+		put(&rec);
+	}
+	pthread_mutex_unlock(&devDbLock);
+}
+
+/*********************************************************************
+ * AF LISTENERS
+ */
+
+static void afIncomingMsgCb(uint16_t event, void *data, void *arg)
+{
+	IncomingMsgFormat_t *msg = data;
+
+	devDbTouch(msg->SrcAddr, msg->LinkQuality);
+}
+
+static const struct
+{
+	uint16_t Event;
+	mtEventCb_t Cb;
+} devDbListeners[] =
+{
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_END_DEVICE_ANNCE_IND),
+	        endDeviceAnnceIndCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_NWK_ADDR_RSP), nwkAddrRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_IEEE_ADDR_RSP), ieeeAddrRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_NODE_DESC_RSP), nodeDescRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_ACTIVE_EP_RSP), activeEpRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_SIMPLE_DESC_RSP), simpleDescRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_LEAVE_IND), leaveIndCb },
+	{ MT_EVENT(MT_RPC_SYS_AF, MT_AF_INCOMING_MSG), afIncomingMsgCb },
+};
+
+#define DEV_DB_LISTENERS \
+	(sizeof(devDbListeners) / sizeof(devDbListeners[0]))
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      devDbOpen
+ *
+ * @brief   maps the database file, creating it if it does not exist,
+ *          and starts following the ZDO and AF messages
+ *
+ * @param   path - database file
+ * @param   maxDevices - devices a new file holds, 0 for
+ *          DEV_DB_DEFAULT_DEVICES. An existing file keeps its size.
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t devDbOpen(const char *path, uint32_t maxDevices)
+{
+	dbHeader_t hdr;
+	struct stat st;
+	uint32_t slotCount = 2;
+	uint8_t bits = 1;
+	uint8_t create = 1;
+	size_t len;
+	uint32_t i;
+
+	if (maxDevices == 0)
+	{
+		maxDevices = DEV_DB_DEFAULT_DEVICES;
+	}
+
+	devDbClose();
+
+	pthread_mutex_lock(&devDbLock);
+	crcInit();
+	memset(&devDbStats, 0, sizeof(devDbStats));
+
+	devDbFd = open(path, O_RDWR | O_CREAT, 0644);
+	if ((devDbFd < 0) || (fstat(devDbFd, &st) != 0))
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "devDbOpen: could not open %s\n",
+		        path);
+		goto fail;
+	}
+
+	//a file whose header was never completed is created again
+	if ((st.st_size >= (off_t) sizeof(hdr))
+	        && (pread(devDbFd, &hdr, sizeof(hdr), 0) == sizeof(hdr))
+	        && (hdr.Magic == DEV_DB_MAGIC))
+	{
+		if ((hdr.Version != DEV_DB_VERSION)
+		        || (hdr.RecordSize != sizeof(devDbRecord_t))
+		        || (hdr.SlotCount < 2)
+		        || (hdr.SlotCount & (hdr.SlotCount - 1)))
+		{
+			dbg_print(PRINT_LEVEL_WARNING,
+			        "devDbOpen: %s has an incompatible layout\n", path);
+			goto fail;
+		}
+		slotCount = hdr.SlotCount;
+		create = 0;
+	}
+	else
+	{
+		while (slotCount < (maxDevices * 2))
+		{
+			slotCount <<= 1;
+		}
+	}
+	while ((1U << bits) < slotCount)
+	{
+		bits++;
+	}
+
+	len = DEV_DB_HEADER_SIZE + (DEV_DB_NWK_INDEX * sizeof(uint32_t))
+	        + ((size_t) slotCount * sizeof(dbSlot_t));
+	if ((create || (st.st_size < (off_t) len))
+	        && (ftruncate(devDbFd, len) != 0))
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "devDbOpen: could not size %s\n",
+		        path);
+		goto fail;
+	}
+
+	devDbMap = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, devDbFd,
+	        0);
+	if (devDbMap == MAP_FAILED)
+	{
+		devDbMap = NULL;
+		dbg_print(PRINT_LEVEL_WARNING, "devDbOpen: could not map %s\n", path);
+		goto fail;
+	}
+	devDbMapLen = len;
+	devDbHdr = (dbHeader_t *) devDbMap;
+	devDbNwkIndex = (uint32_t *) (devDbMap + DEV_DB_HEADER_SIZE);
+	devDbSlots = (dbSlot_t *) (devDbMap + DEV_DB_HEADER_SIZE
+	        + (DEV_DB_NWK_INDEX * sizeof(uint32_t)));
+	devDbMask = slotCount - 1;
+	devDbShift = 64 - bits;
+
+	if (create)
+	{
+		memset(devDbMap, 0, len);
+		devDbHdr->Version = DEV_DB_VERSION;
+		devDbHdr->RecordSize = sizeof(devDbRecord_t);
+		devDbHdr->SlotCount = slotCount;
+		devDbHdr->Devices = 0;
+		msync(devDbMap, len, MS_SYNC);
+		devDbHdr->Magic = DEV_DB_MAGIC;
+		msync(devDbMap, DEV_DB_HEADER_SIZE, MS_SYNC);
+	}
+	pthread_mutex_unlock(&devDbLock);
+
+	dbg_print(PRINT_LEVEL_INFO, "devDbOpen: %s, %u devices, %u slots\n",
+	        path, devDbHdr->Devices, slotCount);
+
+	for (i = 0; i < DEV_DB_LISTENERS; i++)
+	{
+		mtEventAddListener(devDbListeners[i].Event, devDbListeners[i].Cb, NULL,
+		        MT_EVENT_PRIO_DEFAULT);
+	}
+
+	return 0;
+
+fail:
+	if (devDbFd >= 0)
+	{
+		close(devDbFd);
+		devDbFd = -1;
+	}
+	pthread_mutex_unlock(&devDbLock);
+	return -1;
+}
+
+/*********************************************************************
+ * @fn      devDbClose
+ *
+ * @brief   stops following the MT messages, syncs and unmaps the file
+ *
+ * @return  none
+ */
+void devDbClose(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < DEV_DB_LISTENERS; i++)
+	{
+		mtEventRemoveListener(devDbListeners[i].Event, devDbListeners[i].Cb,
+		        NULL);
+	}
+
+	pthread_mutex_lock(&devDbLock);
+	if (devDbMap)
+	{
+		msync(devDbMap, devDbMapLen, MS_SYNC);
+		munmap(devDbMap, devDbMapLen);
+		devDbMap = NULL;
+	}
+	if (devDbFd >= 0)
+	{
+		close(devDbFd);
+		devDbFd = -1;
+	}
+	devDbHdr = NULL;
+	devDbNwkIndex = NULL;
+	devDbSlots = NULL;
+	devDbMask = 0;
+	pthread_mutex_unlock(&devDbLock);
+}
+
+/*********************************************************************
+ * @fn      devDbSync
+ *
+ * @brief   writes the updates back to the file
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t devDbSync(void)
+{
+	int32_t status = -1;
+
+	pthread_mutex_lock(&devDbLock);
+	if (devDbMap && (msync(devDbMap, devDbMapLen, MS_SYNC) == 0))
+	{
+		status = 0;
+	}
+	pthread_mutex_unlock(&devDbLock);
+
+	return status;
+}
+
+/*********************************************************************
+ * @fn      devDbFindIeee
+ *
+ * @brief   reads the record of a device by IEEE address
+ *
+ * @param   ieeeAddr - IEEE address
+ * @param   rec - filled with the record
+ *
+ * @return  0 if found, -1 if not known. Removed devices are returned
+ *          with DEV_DB_REMOVED set.
+ */
+int32_t devDbFindIeee(uint64_t ieeeAddr, devDbRecord_t *rec)
+{
+	uint32_t pos;
+
+	pthread_mutex_lock(&devDbLock);
+	pos = findIeee(ieeeAddr, rec);
+	pthread_mutex_unlock(&devDbLock);
+
+	return (pos == DEV_DB_INVALID_POS) ? -1 : 0;
+}
+
+/*********************************************************************
+ * @fn      devDbFindNwk
+ *
+ * @brief   reads the record of a device in the network by network
+ *          address
+ *
+ * @param   nwkAddr - network address
+ * @param   rec - filled with the record
+ *
+ * @return  0 if found, -1 if not known
+ */
+int32_t devDbFindNwk(uint16_t nwkAddr, devDbRecord_t *rec)
+{
+	uint32_t pos;
+
+	pthread_mutex_lock(&devDbLock);
+	pos = findNwk(nwkAddr, rec);
+	pthread_mutex_unlock(&devDbLock);
+
+	return (pos == DEV_DB_INVALID_POS) ? -1 : 0;
+}
+
+/*********************************************************************
+ * @fn      devDbPut
+ *
+ * @brief   adds or replaces the record of a device
+ *
+ * @param   rec - record, IeeeAddr must be valid
+ *
+ * @return  0 on success, -1 if not stored
+ */
+int32_t devDbPut(devDbRecord_t *rec)
+{
+	uint32_t pos = DEV_DB_INVALID_POS;
+
+	pthread_mutex_lock(&devDbLock);
+	if (devDbMap && (rec->IeeeAddr != 0))
+	{
+		pos = put(rec);
+	}
+	pthread_mutex_unlock(&devDbLock);
+
+	return (pos == DEV_DB_INVALID_POS) ? -1 : 0;
+}
+
+/*********************************************************************
+ * @fn      devDbTouch
+ *
+ * @brief   records the time and link quality of a frame from a device
+ *
+ * @param   nwkAddr - network address of the sender
+ * @param   lqi - link quality
+ *
+ * @return  none
+ */
+void devDbTouch(uint16_t nwkAddr, uint8_t lqi)
+{
+	dbSlot_t *slot;
+	uint32_t pos;
+	int32_t cur;
+
+	pthread_mutex_lock(&devDbLock);
+	if (devDbMap && (devDbNwkIndex[nwkAddr] != 0))
+	{
+		//the newest copy is only read for its address, a torn copy makes
+		//the frame count for the wrong device at worst
+		pos = devDbNwkIndex[nwkAddr] - 1;
+		slot = &devDbSlots[pos & devDbMask];
+		cur = ((int32_t) (slot->Copy[1].Seq - slot->Copy[0].Seq) > 0) ? 1 : 0;
+		if (slot->Copy[cur].Rec.NwkAddr == nwkAddr)
+		{
+			touch(pos & devDbMask, lqi);
+		}
+	}
+	pthread_mutex_unlock(&devDbLock);
+}
+
+/*********************************************************************
+ * @fn      devDbLastSeen
+ *
+ * @brief   reads when a device was last heard
+ *
+ * @param   ieeeAddr - IEEE address
+ * @param   lastSeen - filled with the time() of the last frame
+ * @param   lqi - filled with the link quality of the last frame
+ *
+ * @return  0 if found, -1 if not known
+ */
+int32_t devDbLastSeen(uint64_t ieeeAddr, uint32_t *lastSeen, uint8_t *lqi)
+{
+	uint32_t pos = DEV_DB_INVALID_POS;
+
+	pthread_mutex_lock(&devDbLock);
+	if (devDbMap && (ieeeAddr != 0))
+	{
+		pos = slotFind(ieeeAddr);
+		if ((pos != DEV_DB_INVALID_POS) && (devDbSlots[pos].Key == ieeeAddr))
+		{
+			*lastSeen = devDbSlots[pos].LastSeen;
+			*lqi = devDbSlots[pos].Lqi;
+		}
+		else
+		{
+			pos = DEV_DB_INVALID_POS;
+		}
+	}
+	pthread_mutex_unlock(&devDbLock);
+
+	return (pos == DEV_DB_INVALID_POS) ? -1 : 0;
+}
+
+/*********************************************************************
+ * @fn      devDbNext
+ *
+ * @brief   iterates the devices in the network
+ *
+ * @param   cursor - 0 to start, advanced past the returned device
+ * @param   rec - filled with the record
+ *
+ * @return  0 if a device was returned, -1 at the end
+ */
+int32_t devDbNext(uint32_t *cursor, devDbRecord_t *rec)
+{
+	int32_t status = -1;
+
+	pthread_mutex_lock(&devDbLock);
+	while (devDbMap && (*cursor <= devDbMask))
+	{
+		uint32_t pos = (*cursor)++;
+
+		if ((devDbSlots[pos].Key != 0) && (slotRead(pos, rec) == 0)
+		        && !(rec->Flags & DEV_DB_REMOVED))
+		{
+			status = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&devDbLock);
+
+	return status;
+}
+
+/*********************************************************************
+ * @fn      devDbIsInterviewed
+ *
+ * @brief   checks whether the node descriptor, the active endpoints and
+ *          the simple descriptors of all endpoints of a device are known
+ *
+ * @param   rec - record
+ *
+ * @return  1 if the device needs no interview, else 0
+ */
+uint8_t devDbIsInterviewed(devDbRecord_t *rec)
+{
+	uint8_t allEps = (uint8_t) ((1U << rec->NumEndpoints) - 1);
+
+	if ((rec->Flags & (DEV_DB_NODE_DESC | DEV_DB_ACTIVE_EP))
+	        != (DEV_DB_NODE_DESC | DEV_DB_ACTIVE_EP))
+	{
+		return 0;
+	}
+
+	return ((rec->SimpleDescMask & allEps) == allEps) ? 1 : 0;
+}
+
+/*********************************************************************
+ * @fn      devDbGetStats
+ *
+ * @brief   reads the database statistics
+ *
+ * @param   stats - filled with the statistics
+ *
+ * @return  none
+ */
+void devDbGetStats(devDbStats_t *stats)
+{
+	pthread_mutex_lock(&devDbLock);
+	memcpy(stats, &devDbStats, sizeof(devDbStats_t));
+	stats->Devices = devDbHdr ? devDbHdr->Devices : 0;
+	stats->Capacity = (devDbMask + 1) / 2;
+	pthread_mutex_unlock(&devDbLock);
+}
@@ -0,0 +1,107 @@
+/*
+ * devDb.h
+ *
+ * This module contains the persistent device database, which keeps the
+ * addresses and descriptors of the devices in the network in a memory
+ * mapped file so they survive a restart of the host.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef DEVDB_H
+#define DEVDB_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// number of devices the database holds when devDbOpen() is passed 0
+#define DEV_DB_DEFAULT_DEVICES     (4096)
+
+// endpoints and clusters kept per device
+#define DEV_DB_MAX_ENDPOINTS       (8)
+#define DEV_DB_MAX_CLUSTERS        (16)
+
+// devDbRecord_t Flags
+#define DEV_DB_NODE_DESC           (0x01) // node descriptor is known
+#define DEV_DB_ACTIVE_EP           (0x02) // active endpoint list is known
+#define DEV_DB_REMOVED             (0x80) // device left the network
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint8_t Endpoint;
+	uint8_t DeviceVersion;
+	uint16_t ProfileId;
+	uint16_t DeviceId;
+	uint8_t NumInClusters;
+	uint8_t NumOutClusters;
+	uint16_t InClusters[DEV_DB_MAX_CLUSTERS];
+	uint16_t OutClusters[DEV_DB_MAX_CLUSTERS];
+} devDbEndpoint_t;
+
+// fixed size record as stored in the file, do not reorder
+typedef struct
+{
+	uint64_t IeeeAddr;
+	uint16_t NwkAddr;
+	uint8_t Flags;            // DEV_DB_*
+	uint8_t Capabilities;     // MAC capabilities
+	uint16_t ManufacturerCode;
+	uint8_t LogicalType;      // DEVICETYPE_* from the node descriptor
+	uint8_t NumEndpoints;
+	uint8_t Endpoints[DEV_DB_MAX_ENDPOINTS];
+	uint8_t SimpleDescMask;   // bit n set once Endpoints[n] is described
+	uint8_t Reserved[7];
+	devDbEndpoint_t EpDesc[DEV_DB_MAX_ENDPOINTS];
+} devDbRecord_t;
+
+typedef struct
+{
+	uint32_t Devices;         // devices in the database
+	uint32_t Capacity;        // devices the database can hold
+	uint32_t Puts;            // record updates committed
+	uint32_t Touches;         // last seen updates
+	uint32_t TornCopies;      // record copies rejected by the CRC check
+	uint32_t Full;            // devices refused because the file was full
+} devDbStats_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t devDbOpen(const char *path, uint32_t maxDevices);
+void devDbClose(void);
+int32_t devDbSync(void);
+
+int32_t devDbFindIeee(uint64_t ieeeAddr, devDbRecord_t *rec);
+int32_t devDbFindNwk(uint16_t nwkAddr, devDbRecord_t *rec);
+int32_t devDbPut(devDbRecord_t *rec);
+void devDbTouch(uint16_t nwkAddr, uint8_t lqi);
+int32_t devDbLastSeen(uint64_t ieeeAddr, uint32_t *lastSeen, uint8_t *lqi);
+int32_t devDbNext(uint32_t *cursor, devDbRecord_t *rec);
+
+uint8_t devDbIsInterviewed(devDbRecord_t *rec);
+
+void devDbGetStats(devDbStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEVDB_H */
@@ -0,0 +1,839 @@
+/*
+ * devInterview.c
+ *
+ * This module contains the interview engine, which reads the node
+ * descriptor, active endpoints and simple descriptors of the devices
+ * that announce themselves.
+ *
+ * An interview starts on the device announce. Its requests are sent by
+ * the interview thread: the node descriptor and active endpoint requests
+ * at once, then one simple descriptor request per endpoint. The requests
+ * of all running interviews share MaxInFlight, and at most MaxPerDevice
+ * go to the same device, so a mass join after a power outage does not
+ * flood the network. Requests that time out or fail are sent again
+ * after a backoff that doubles with each retry.
+ *
+ * A device already interviewed, according to the device database, is
+ * reported without any request. Announces of a device whose interview
+ * is running or ended less than DedupMs ago are ignored.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "devInterview.h"
+#include "rpc.h"
+#include "mtZdo.h"
+#include "mtEvent.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// requests of an interview, one bit each
+#define NEED_NODE_DESC             (0x0001)
+#define NEED_ACTIVE_EP             (0x0002)
+#define NEED_SIMPLE_DESC(epIdx)    (0x0004 << (epIdx))
+
+// longest sleep of the interview thread
+#define DEV_INTERVIEW_IDLE_MS      (1000)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+	devDbRecord_t Dev;
+	uint8_t InUse;
+	uint8_t Done;             // ended, kept until ExpireMs to drop duplicates
+	uint8_t Report;           // ready event not delivered yet
+	uint8_t Status;
+	uint8_t Cached;
+	uint8_t Tries;
+	uint16_t Need;            // requests to send
+	uint16_t Sent;            // requests in flight
+	uint64_t StartMs;
+	uint64_t EndMs;
+	uint64_t DeadlineMs;      // of the requests in flight
+	uint64_t NotBeforeMs;     // end of the backoff
+	uint64_t ExpireMs;
+} ivJob_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static pthread_mutex_t ivLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ivCond;
+static pthread_t ivThread;
+static uint8_t ivRunning;
+
+static devInterviewCfg_t ivCfg;
+static devInterviewReadyCb_t ivReadyCb;
+static ivJob_t *ivJobs;
+static uint32_t ivJobCnt;
+static uint32_t ivJobAlloc;
+static uint32_t *ivNwkIndex;
+static uint32_t ivCursor;
+static uint32_t ivInFlight;
+
+static devInterviewStats_t ivStats;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowMs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in milli seconds
+ */
+static uint64_t nowMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*********************************************************************
+ * @fn      bitCount
+ *
+ * @brief   counts the requests in a request mask
+ */
+static uint32_t bitCount(uint16_t mask)
+{
+	uint32_t cnt = 0;
+
+	while (mask)
+	{
+		mask &= mask - 1;
+		cnt++;
+	}
+
+	return cnt;
+}
+
+/*********************************************************************
+ * @fn      jobFind
+ *
+ * @brief   looks up the interview of a network address
+ *
+ * @param   nwkAddr - network address
+ *
+ * @return  interview, NULL if none
+ */
+static ivJob_t *jobFind(uint16_t nwkAddr)
+{
+	ivJob_t *job;
+
+	if ((ivNwkIndex == NULL) || (ivNwkIndex[nwkAddr] == 0))
+	{
+		return NULL;
+	}
+	job = &ivJobs[ivNwkIndex[nwkAddr] - 1];
+	if (!job->InUse || (job->Dev.NwkAddr != nwkAddr))
+	{
+		return NULL;
+	}
+
+	return job;
+}
+
+/*********************************************************************
+ * @fn      jobAlloc
+ *
+ * @brief   takes a free interview slot
+ *
+ * @return  interview, NULL if the memory was not allocated
+ */
+static ivJob_t *jobAlloc(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < ivJobCnt; i++)
+	{
+		if (!ivJobs[i].InUse)
+		{
+			memset(&ivJobs[i], 0, sizeof(ivJob_t));
+			return &ivJobs[i];
+		}
+	}
+	if (ivJobCnt == ivJobAlloc)
+	{
+		uint32_t newAlloc = ivJobAlloc ? (ivJobAlloc * 2) : 64;
+		void *p = realloc(ivJobs, newAlloc * sizeof(ivJob_t));
+
+		if (p == NULL)
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "devInterview: allocation failed\n");
+			return NULL;
+		}
+		ivJobs = p;
+		ivJobAlloc = newAlloc;
+	}
+	memset(&ivJobs[ivJobCnt], 0, sizeof(ivJob_t));
+
+	return &ivJobs[ivJobCnt++];
+}
+
+/*********************************************************************
+ * @fn      jobEnd
+ *
+ * @brief   ends an interview and queues its ready event
+ *
+ * @param   job - interview
+ * @param   status - DEV_INTERVIEW_*
+ *
+ * @return  none
+ */
+static void jobEnd(ivJob_t *job, uint8_t status)
+{
+	ivInFlight -= bitCount(job->Sent);
+	job->Sent = 0;
+	job->Need = 0;
+	job->Done = 1;
+	job->Report = 1;
+	job->Status = status;
+	job->EndMs = nowMs();
+	job->ExpireMs = job->EndMs + ivCfg.DedupMs;
+	ivStats.Active--;
+	if (status == DEV_INTERVIEW_OK)
+	{
+		ivStats.Ready++;
+	}
+	else
+	{
+		ivStats.Failed++;
+	}
+	pthread_cond_signal(&ivCond);
+}
+
+/*********************************************************************
+ * @fn      jobAnswered
+ *
+ * @brief   clears an answered request and ends the interview once all
+ *          descriptors are known
+ *
+ * @param   job - interview
+ * @param   bit - request
+ *
+ * @return  none
+ */
+static void jobAnswered(ivJob_t *job, uint16_t bit)
+{
+	job->Sent &= ~bit;
+	ivInFlight--;
+	if ((job->Need == 0) && (job->Sent == 0))
+	{
+		jobEnd(job, DEV_INTERVIEW_OK);
+	}
+	else
+	{
+		pthread_cond_signal(&ivCond);
+	}
+}
+
+/*********************************************************************
+ * @fn      jobRetry
+ *
+ * @brief   schedules failed requests again after the backoff, or fails
+ *          the interview once the retries are used up
+ *
+ * @param   job - interview
+ * @param   bits - failed requests
+ * @param   now - time in milli seconds
+ *
+ * @return  none
+ */
+static void jobRetry(ivJob_t *job, uint16_t bits, uint64_t now)
+{
+	job->Sent &= ~bits;
+	ivInFlight -= bitCount(bits);
+	job->Tries++;
+	if (job->Tries > ivCfg.MaxRetries)
+	{
+		dbg_print(PRINT_LEVEL_WARNING,
+		        "devInterview: 0x%04X failed after %d retries\n",
+		        job->Dev.NwkAddr, ivCfg.MaxRetries);
+		jobEnd(job, DEV_INTERVIEW_FAILED);
+		return;
+	}
+	job->Need |= bits;
+	job->NotBeforeMs = now + ((uint64_t) ivCfg.BackoffMs << (job->Tries - 1));
+	ivStats.Retries++;
+}
+
+/*********************************************************************
+ * @fn      jobSend
+ *
+ * @brief   sends the next request of an interview. Called with the lock
+ *          held, the lock is released while the request waits for its
+ *          SRSP.
+ *
+ * @param   job - interview
+ * @param   now - time in milli seconds
+ *
+ * @return  none
+ */
+static void jobSend(ivJob_t *job, uint64_t now)
+{
+	uint16_t nwkAddr = job->Dev.NwkAddr;
+	uint16_t bit = job->Need & (~job->Need + 1);
+	uint8_t endpoint = 0;
+	uint8_t status;
+	uint8_t epIdx;
+
+	for (epIdx = 0; epIdx < DEV_DB_MAX_ENDPOINTS; epIdx++)
+	{
+		if (bit == NEED_SIMPLE_DESC(epIdx))
+		{
+			endpoint = job->Dev.Endpoints[epIdx];
+		}
+	}
+
+	job->Need &= ~bit;
+	job->Sent |= bit;
+	job->DeadlineMs = now + ivCfg.TimeoutMs;
+	ivInFlight++;
+	ivStats.Requests++;
+	if (ivInFlight > ivStats.PeakInFlight)
+	{
+		ivStats.PeakInFlight = ivInFlight;
+	}
+
+	pthread_mutex_unlock(&ivLock);
+	if (bit == NEED_NODE_DESC)
+	{
+		NodeDescReqFormat_t req;
+
+		req.DstAddr = nwkAddr;
+		req.NwkAddrOfInterest = nwkAddr;
+		status = zdoNodeDescReq(&req);
+	}
+	else if (bit == NEED_ACTIVE_EP)
+	{
+		ActiveEpReqFormat_t req;
+
+		req.DstAddr = nwkAddr;
+		req.NwkAddrOfInterest = nwkAddr;
+		status = zdoActiveEpReq(&req);
+	}
+	else
+	{
+		SimpleDescReqFormat_t req;
+
+		req.DstAddr = nwkAddr;
+		req.NwkAddrOfInterest = nwkAddr;
+		req.Endpoint = endpoint;
+		status = zdoSimpleDescReq(&req);
+	}
+	pthread_mutex_lock(&ivLock);
+
+	//the job array may have moved while unlocked
+	job = jobFind(nwkAddr);
+	if ((status != MT_RPC_SUCCESS) && job && (job->Sent & bit))
+	{
+		jobRetry(job, bit, nowMs());
+	}
+}
+
+/*********************************************************************
+ * @fn      ivTask
+ *
+ * @brief   interview thread: sends the requests, handles the timeouts
+ *          and delivers the ready events
+ */
+static void *ivTask(void *argument)
+{
+	pthread_mutex_lock(&ivLock);
+	while (ivRunning)
+	{
+		uint64_t now = nowMs();
+		uint64_t wake = now + DEV_INTERVIEW_IDLE_MS;
+		struct timespec ts;
+		uint32_t n;
+
+		for (n = 0; n < ivJobCnt; n++)
+		{
+			ivJob_t *job = &ivJobs[n];
+
+			if (!job->InUse)
+			{
+				continue;
+			}
+			if (job->Report)
+			{
+				devInterviewEvent_t evt;
+
+				job->Report = 0;
+				evt.Status = job->Status;
+				evt.Cached = job->Cached;
+				evt.Retries = job->Tries;
+				evt.DurationMs = (uint32_t) (job->EndMs - job->StartMs);
+				memcpy(&evt.Dev, &job->Dev, sizeof(devDbRecord_t));
+				if (ivReadyCb)
+				{
+					pthread_mutex_unlock(&ivLock);
+					ivReadyCb(&evt);
+					pthread_mutex_lock(&ivLock);
+				}
+				now = nowMs();
+				continue;
+			}
+			if (job->Done)
+			{
+				if (now >= job->ExpireMs)
+				{
+					if (ivNwkIndex[job->Dev.NwkAddr] == n + 1)
+					{
+						ivNwkIndex[job->Dev.NwkAddr] = 0;
+					}
+					job->InUse = 0;
+				}
+				else if (job->ExpireMs < wake)
+				{
+					wake = job->ExpireMs;
+				}
+				continue;
+			}
+			if (job->Sent && (now >= job->DeadlineMs))
+			{
+				jobRetry(job, job->Sent, now);
+			}
+			if (job->Sent && (job->DeadlineMs < wake))
+			{
+				wake = job->DeadlineMs;
+			}
+			if (job->Need && (job->NotBeforeMs > now)
+			        && (job->NotBeforeMs < wake))
+			{
+				wake = job->NotBeforeMs;
+			}
+		}
+
+		//round robin over the interviews so none waits behind the others
+		for (n = 0; (n < ivJobCnt) && (ivInFlight < ivCfg.MaxInFlight); n++)
+		{
+			uint32_t idx = (ivCursor + n) % ivJobCnt;
+			ivJob_t *job = &ivJobs[idx];
+
+			while (job->InUse && !job->Done && job->Need
+			        && (job->NotBeforeMs <= now)
+			        && (bitCount(job->Sent) < ivCfg.MaxPerDevice)
+			        && (ivInFlight < ivCfg.MaxInFlight))
+			{
+				jobSend(job, now);
+				job = &ivJobs[idx];
+			}
+		}
+		if (ivJobCnt)
+		{
+			ivCursor = (ivCursor + n) % ivJobCnt;
+		}
+
+		//sleep until a response, an announce or the next timer
+		ts.tv_sec = wake / 1000;
+		ts.tv_nsec = (wake % 1000) * 1000000;
+		pthread_cond_timedwait(&ivCond, &ivLock, &ts);
+	}
+	pthread_mutex_unlock(&ivLock);
+
+	return NULL;
+}
+
+/*********************************************************************
+ * MT EVENT LISTENERS
+ */
+
+static void endDeviceAnnceIndCb(uint16_t event, void *data, void *arg)
+{
+	EndDeviceAnnceIndFormat_t *msg = data;
+
+	devInterviewStart(msg->NwkAddr, msg->IEEEAddr);
+}
+
+static void nodeDescRspCb(uint16_t event, void *data, void *arg)
+{
+	NodeDescRspFormat_t *msg = data;
+	ivJob_t *job;
+
+	pthread_mutex_lock(&ivLock);
+	job = jobFind(msg->NwkAddr);
+	if (job && !job->Done && (job->Sent & NEED_NODE_DESC))
+	{
+		if (msg->Status != MT_RPC_SUCCESS)
+		{
+			jobRetry(job, NEED_NODE_DESC, nowMs());
+		}
+		else
+		{
+			job->Dev.LogicalType = msg->LoTy_ComDescAv_UsrDesAv & 0x07;
+			job->Dev.ManufacturerCode = msg->ManufacturerCode;
+			job->Dev.Capabilities = msg->MACCapFlg;
+			job->Dev.Flags |= DEV_DB_NODE_DESC;
+			jobAnswered(job, NEED_NODE_DESC);
+		}
+	}
+	pthread_mutex_unlock(&ivLock);
+}
+
+static void activeEpRspCb(uint16_t event, void *data, void *arg)
+{
+	ActiveEpRspFormat_t *msg = data;
+	ivJob_t *job;
+	uint8_t epIdx;
+
+	pthread_mutex_lock(&ivLock);
+	job = jobFind(msg->NwkAddr);
+	if (job && !job->Done && (job->Sent & NEED_ACTIVE_EP))
+	{
+		if (msg->Status != MT_RPC_SUCCESS)
+		{
+			jobRetry(job, NEED_ACTIVE_EP, nowMs());
+		}
+		else
+		{
+			job->Dev.NumEndpoints = msg->ActiveEPCount;
+			if (job->Dev.NumEndpoints > DEV_DB_MAX_ENDPOINTS)
+			{
+				job->Dev.NumEndpoints = DEV_DB_MAX_ENDPOINTS;
+			}
+			for (epIdx = 0; epIdx < job->Dev.NumEndpoints; epIdx++)
+			{
+				job->Dev.Endpoints[epIdx] = msg->ActiveEPList[epIdx];
+				job->Need |= NEED_SIMPLE_DESC(epIdx);
+			}
+			job->Dev.Flags |= DEV_DB_ACTIVE_EP;
+			jobAnswered(job, NEED_ACTIVE_EP);
+		}
+	}
+	pthread_mutex_unlock(&ivLock);
+}
+
+static void simpleDescRspCb(uint16_t event, void *data, void *arg)
+{
+	SimpleDescRspFormat_t *msg = data;
+	ivJob_t *job;
+	devDbEndpoint_t *ep;
+	uint8_t epIdx;
+	uint8_t i;
+
+	pthread_mutex_lock(&ivLock);
+	job = jobFind(msg->NwkAddr);
+	for (epIdx = 0; job && (epIdx < job->Dev.NumEndpoints); epIdx++)
+	{
+		if (job->Dev.Endpoints[epIdx] == msg->Endpoint)
+		{
+			break;
+		}
+	}
+	if ((job == NULL) || job->Done || (epIdx == job->Dev.NumEndpoints)
+	        || !(job->Sent & NEED_SIMPLE_DESC(epIdx)))
+	{
+		pthread_mutex_unlock(&ivLock);
+		return;
+	}
+	if (msg->Status != MT_RPC_SUCCESS)
+	{
+		jobRetry(job, NEED_SIMPLE_DESC(epIdx), nowMs());
+		pthread_mutex_unlock(&ivLock);
+		return;
+	}
+
+	ep = &job->Dev.EpDesc[epIdx];
+	ep->Endpoint = msg->Endpoint;
+	ep->DeviceVersion = msg->DeviceVersion;
+	ep->ProfileId = msg->ProfileID;
+	ep->DeviceId = msg->DeviceID;
+	ep->NumInClusters = msg->NumInClusters;
+	if (ep->NumInClusters > DEV_DB_MAX_CLUSTERS)
+	{
+		ep->NumInClusters = DEV_DB_MAX_CLUSTERS;
+	}
+	ep->NumOutClusters = msg->NumOutClusters;
+	if (ep->NumOutClusters > DEV_DB_MAX_CLUSTERS)
+	{
+		ep->NumOutClusters = DEV_DB_MAX_CLUSTERS;
+	}
+	for (i = 0; i < ep->NumInClusters; i++)
+	{
+		ep->InClusters[i] = msg->InClusterList[i];
+	}
+	for (i = 0; i < ep->NumOutClusters; i++)
+	{
+		ep->OutClusters[i] = msg->OutClusterList[i];
+	}
+	job->Dev.SimpleDescMask |= (1 << epIdx);
+	jobAnswered(job, NEED_SIMPLE_DESC(epIdx));
+	pthread_mutex_unlock(&ivLock);
+}
+
+static void leaveIndCb(uint16_t event, void *data, void *arg)
+{
+	LeaveIndFormat_t *msg = data;
+	ivJob_t *job;
+
+	if (msg->Rejoin)
+	{
+		return;
+	}
+
+	//a device that left is not reported
+	pthread_mutex_lock(&ivLock);
+	job = jobFind(msg->SrcAddr);
+	if (job && !job->Done)
+	{
+		jobEnd(job, DEV_INTERVIEW_FAILED);
+		job->Report = 0;
+	}
+	pthread_mutex_unlock(&ivLock);
+}
+
+static const struct
+{
+	uint16_t Event;
+	mtEventCb_t Cb;
+} ivListeners[] =
+{
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_END_DEVICE_ANNCE_IND),
+	        endDeviceAnnceIndCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_NODE_DESC_RSP), nodeDescRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_ACTIVE_EP_RSP), activeEpRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_SIMPLE_DESC_RSP), simpleDescRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_LEAVE_IND), leaveIndCb },
+};
+
+#define IV_LISTENERS \
+	(sizeof(ivListeners) / sizeof(ivListeners[0]))
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      devInterviewInit
+ *
+ * @brief   starts the interview thread and the interviews on device
+ *          announce. Call before the MT callbacks are dispatched.
+ *
+ * @param   cfg - configuration, fields left 0 take the defaults
+ * @param   pfnReady - called when an interview ends
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t devInterviewInit(devInterviewCfg_t *cfg, devInterviewReadyCb_t pfnReady)
+{
+	pthread_condattr_t attr;
+	uint32_t i;
+
+	devInterviewClose();
+
+	pthread_mutex_lock(&ivLock);
+	memcpy(&ivCfg, cfg, sizeof(devInterviewCfg_t));
+	if (ivCfg.MaxInFlight == 0)
+	{
+		ivCfg.MaxInFlight = DEV_INTERVIEW_MAX_IN_FLIGHT;
+	}
+	if (ivCfg.MaxPerDevice == 0)
+	{
+		ivCfg.MaxPerDevice = DEV_INTERVIEW_MAX_PER_DEVICE;
+	}
+	if (ivCfg.TimeoutMs == 0)
+	{
+		ivCfg.TimeoutMs = DEV_INTERVIEW_TIMEOUT_MS;
+	}
+	if (ivCfg.BackoffMs == 0)
+	{
+		ivCfg.BackoffMs = DEV_INTERVIEW_BACKOFF_MS;
+	}
+	if (ivCfg.MaxRetries == 0)
+	{
+		ivCfg.MaxRetries = DEV_INTERVIEW_MAX_RETRIES;
+	}
+	if (ivCfg.DedupMs == 0)
+	{
+		ivCfg.DedupMs = DEV_INTERVIEW_DEDUP_MS;
+	}
+	ivReadyCb = pfnReady;
+	memset(&ivStats, 0, sizeof(ivStats));
+
+	ivNwkIndex = calloc(65536, sizeof(uint32_t));
+	if (ivNwkIndex == NULL)
+	{
+		pthread_mutex_unlock(&ivLock);
+		dbg_print(PRINT_LEVEL_WARNING, "devInterviewInit: allocation failed\n");
+		return -1;
+	}
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ivCond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	ivRunning = 1;
+	if (pthread_create(&ivThread, NULL, ivTask, NULL) != 0)
+	{
+		ivRunning = 0;
+		free(ivNwkIndex);
+		ivNwkIndex = NULL;
+		pthread_mutex_unlock(&ivLock);
+		dbg_print(PRINT_LEVEL_WARNING, "devInterviewInit: no thread\n");
+		return -1;
+	}
+	pthread_mutex_unlock(&ivLock);
+
+	for (i = 0; i < IV_LISTENERS; i++)
+	{
+		mtEventAddListener(ivListeners[i].Event, ivListeners[i].Cb, NULL,
+		        MT_EVENT_PRIO_DEFAULT);
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      devInterviewClose
+ *
+ * @brief   stops the interviews and the interview thread
+ *
+ * @return  none
+ */
+void devInterviewClose(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < IV_LISTENERS; i++)
+	{
+		mtEventRemoveListener(ivListeners[i].Event, ivListeners[i].Cb, NULL);
+	}
+
+	pthread_mutex_lock(&ivLock);
+	if (!ivRunning)
+	{
+		pthread_mutex_unlock(&ivLock);
+		return;
+	}
+	ivRunning = 0;
+	pthread_cond_signal(&ivCond);
+	pthread_mutex_unlock(&ivLock);
+	pthread_join(ivThread, NULL);
+
+	pthread_mutex_lock(&ivLock);
+	free(ivJobs);
+	free(ivNwkIndex);
+	ivJobs = NULL;
+	ivNwkIndex = NULL;
+	ivJobCnt = 0;
+	ivJobAlloc = 0;
+	ivInFlight = 0;
+	pthread_cond_destroy(&ivCond);
+	pthread_mutex_unlock(&ivLock);
+}
+
+/*********************************************************************
+ * @fn      devInterviewStart
+ *
+ * @brief   starts the interview of a device, unless it is running, ended
+ *          recently or the device database already describes the device
+ *
+ * @param   nwkAddr - network address
+ * @param   ieeeAddr - IEEE address, 0 if not known
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t devInterviewStart(uint16_t nwkAddr, uint64_t ieeeAddr)
+{
+	devDbRecord_t rec;
+	ivJob_t *job;
+	uint32_t i;
+
+	pthread_mutex_lock(&ivLock);
+	if (!ivRunning)
+	{
+		pthread_mutex_unlock(&ivLock);
+		return -1;
+	}
+
+	job = jobFind(nwkAddr);
+	if (job && ((ieeeAddr == 0) || (job->Dev.IeeeAddr == ieeeAddr)))
+	{
+		ivStats.Duplicates++;
+		pthread_mutex_unlock(&ivLock);
+		return 0;
+	}
+	for (i = 0; (ieeeAddr != 0) && (i < ivJobCnt); i++)
+	{
+		job = &ivJobs[i];
+		if (job->InUse && (job->Dev.IeeeAddr == ieeeAddr))
+		{
+			//the device rejoined with a new address during its interview
+			job->Dev.NwkAddr = nwkAddr;
+			ivNwkIndex[nwkAddr] = i + 1;
+			ivStats.Duplicates++;
+			pthread_mutex_unlock(&ivLock);
+			return 0;
+		}
+	}
+
+	job = jobAlloc();
+	if (job == NULL)
+	{
+		pthread_mutex_unlock(&ivLock);
+		return -1;
+	}
+	job->InUse = 1;
+	job->StartMs = nowMs();
+	ivNwkIndex[nwkAddr] = (job - ivJobs) + 1;
+	ivStats.Started++;
+	ivStats.Active++;
+
+	if ((ieeeAddr != 0) && (devDbFindIeee(ieeeAddr, &rec) == 0)
+	        && devDbIsInterviewed(&rec))
+	{
+		memcpy(&job->Dev, &rec, sizeof(devDbRecord_t));
+		job->Dev.NwkAddr = nwkAddr;
+		job->Dev.Flags &= ~DEV_DB_REMOVED;
+		job->Cached = 1;
+		ivStats.Cached++;
+		jobEnd(job, DEV_INTERVIEW_OK);
+	}
+	else
+	{
+		job->Dev.IeeeAddr = ieeeAddr;
+		job->Dev.NwkAddr = nwkAddr;
+		job->Need = NEED_NODE_DESC | NEED_ACTIVE_EP;
+		pthread_cond_signal(&ivCond);
+	}
+	pthread_mutex_unlock(&ivLock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      devInterviewGetStats
+ *
+ * @brief   reads the interview statistics
+ *
+ * @param   stats - filled with the statistics
+ *
+ * @return  none
+ */
+void devInterviewGetStats(devInterviewStats_t *stats)
+{
+	pthread_mutex_lock(&ivLock);
+	memcpy(stats, &ivStats, sizeof(devInterviewStats_t));
+	pthread_mutex_unlock(&ivLock);
+}
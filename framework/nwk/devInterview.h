@@ -0,0 +1,96 @@
+/*
+ * devInterview.h
+ *
+ * This module contains the interview engine, which reads the node
+ * descriptor, active endpoints and simple descriptors of the devices
+ * that announce themselves.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef DEVINTERVIEW_H
+#define DEVINTERVIEW_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+#include "devDb.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// defaults used for the devInterviewCfg_t fields left 0
+#define DEV_INTERVIEW_MAX_IN_FLIGHT   (8)
+#define DEV_INTERVIEW_MAX_PER_DEVICE  (2)
+#define DEV_INTERVIEW_TIMEOUT_MS      (3000)
+#define DEV_INTERVIEW_BACKOFF_MS      (500)
+#define DEV_INTERVIEW_MAX_RETRIES     (4)
+#define DEV_INTERVIEW_DEDUP_MS        (10000)
+
+// devInterviewEvent_t Status
+#define DEV_INTERVIEW_OK              (0)
+#define DEV_INTERVIEW_FAILED          (1)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint8_t MaxInFlight;      // requests in flight in the network
+	uint8_t MaxPerDevice;     // requests in flight to one device
+	uint32_t TimeoutMs;       // time allowed for a response
+	uint32_t BackoffMs;       // wait before the first retry, doubled per retry
+	uint8_t MaxRetries;       // retries before the interview fails
+	uint32_t DedupMs;         // announces ignored after an interview ended
+} devInterviewCfg_t;
+
+typedef struct
+{
+	uint8_t Status;           // DEV_INTERVIEW_*
+	uint8_t Cached;           // 1 if read from the device database
+	uint8_t Retries;
+	uint32_t DurationMs;      // from the announce to the last response
+	devDbRecord_t Dev;        // descriptors of the device
+} devInterviewEvent_t;
+
+typedef struct
+{
+	uint32_t Started;
+	uint32_t Ready;
+	uint32_t Failed;
+	uint32_t Cached;          // interviews answered by the device database
+	uint32_t Duplicates;      // announces of devices already interviewed
+	uint32_t Requests;
+	uint32_t Retries;
+	uint32_t Active;          // interviews running
+	uint32_t PeakInFlight;
+} devInterviewStats_t;
+
+// called once per interview, from the interview thread
+typedef void (*devInterviewReadyCb_t)(devInterviewEvent_t *evt);
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t devInterviewInit(devInterviewCfg_t *cfg, devInterviewReadyCb_t pfnReady);
+void devInterviewClose(void);
+int32_t devInterviewStart(uint16_t nwkAddr, uint64_t ieeeAddr);
+void devInterviewGetStats(devInterviewStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEVINTERVIEW_H */
@@ -0,0 +1,724 @@
+/*
+ * evtExport.c
+ *
+ * This module contains the event exporter, see evtExport.h.
+ *
+ * The batches form a ring: the MT dispatch fills the batch at Fill and
+ * hands it to the writer thread once full or old enough, the writer
+ * writes the batches from Head in order and gives them back. Only the
+ * batch indices move under the lock, the records are encoded in place
+ * and the writes run without the lock.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "evtExport.h"
+#include "mtAf.h"
+#include "mtZdo.h"
+#include "mtSys.h"
+#include "mtEvent.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// smallest batch, holds the longest record
+#define EVT_EXPORT_MIN_BATCH       (1024)
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static uint64_t epochUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+	return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+	p = put16(p, v & 0xFFFF);
+	return put16(p, v >> 16);
+}
+
+static uint8_t *put64(uint8_t *p, uint64_t v)
+{
+	p = put32(p, v & 0xFFFFFFFF);
+	return put32(p, v >> 32);
+}
+
+/*********************************************************************
+ * @fn      batchSeal
+ *
+ * @brief   hands the batch being filled to the writer, called with the
+ *          lock held
+ */
+static void batchSeal(evtExport_t *ctx)
+{
+	ctx->Full++;
+	ctx->Fill = (ctx->Fill + 1) % ctx->Cfg.Batches;
+	if (ctx->Full > ctx->Stats.PeakBatches)
+	{
+		ctx->Stats.PeakBatches = ctx->Full;
+	}
+	pthread_cond_signal(&ctx->FullCond);
+}
+
+/*********************************************************************
+ * @fn      recordBegin
+ *
+ * @brief   takes the room of a record in the batch being filled, waiting
+ *          for the writer if every batch is full, called with the lock
+ *          held
+ *
+ * @param   ctx - exporter
+ * @param   type - EVT_EXPORT_*
+ * @param   bodyLen - bytes of the body
+ *
+ * @return  body of the record to encode, NULL if the event is dropped
+ */
+static uint8_t *recordBegin(evtExport_t *ctx, uint8_t type, uint32_t bodyLen)
+{
+	uint32_t len = EVT_EXPORT_HDR_LEN + bodyLen;
+	evtExportBatch_t *b;
+	uint64_t start;
+	uint8_t *p;
+
+	while (1)
+	{
+		if (ctx->Full < ctx->Cfg.Batches)
+		{
+			b = &ctx->Batches[ctx->Fill];
+			if (b->Len + len <= ctx->Cfg.BatchBytes)
+			{
+				break;
+			}
+			batchSeal(ctx);
+			continue;
+		}
+		if (ctx->Cfg.Drop || !ctx->Running)
+		{
+			ctx->Stats.Drops++;
+			return NULL;
+		}
+
+		// backpressure, the MT dispatch waits for the writer
+		ctx->Stats.Stalls++;
+		start = nowUs();
+		pthread_cond_wait(&ctx->FreeCond, &ctx->Lock);
+		ctx->Stats.StallUs += nowUs() - start;
+	}
+
+	if (b->Len == 0)
+	{
+		b->FirstUs = nowUs();
+		pthread_cond_signal(&ctx->FullCond);
+	}
+	p = b->Data + b->Len;
+	b->Len += len;
+	b->Events++;
+	ctx->Stats.Events++;
+
+	p = put16(p, len - 2);
+	*p++ = type;
+	*p++ = 0;
+	return put64(p, epochUs());
+}
+
+/*********************************************************************
+ * @fn      targetOpen
+ *
+ * @brief   opens the target if it is not, on the writer thread
+ *
+ * @return  0 on success, -1 on failure
+ */
+static int32_t targetOpen(evtExport_t *ctx)
+{
+	const char *target = ctx->Cfg.Target;
+	struct sockaddr_un addr;
+
+	if (ctx->Fd >= 0)
+	{
+		return 0;
+	}
+	if (nowUs() < ctx->RetryUs)
+	{
+		return -1;
+	}
+
+	if (strcmp(target, EVT_EXPORT_STDOUT) == 0)
+	{
+		ctx->Fd = dup(STDOUT_FILENO);
+	}
+	else if (strncmp(target, EVT_EXPORT_UNIX_PREFIX,
+	        strlen(EVT_EXPORT_UNIX_PREFIX)) == 0)
+	{
+		const char *path = target + strlen(EVT_EXPORT_UNIX_PREFIX);
+		size_t len = strlen(path);
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (len < sizeof(addr.sun_path))
+		{
+			memcpy(addr.sun_path, path, len + 1);
+			ctx->Fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		}
+		else
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "evtExport: %s is too long for a"
+			        " socket path\n", path);
+		}
+		if ((ctx->Fd >= 0)
+		        && (connect(ctx->Fd, (struct sockaddr *) &addr, sizeof(addr))
+		                != 0))
+		{
+			close(ctx->Fd);
+			ctx->Fd = -1;
+		}
+	}
+	else
+	{
+		// a pipe opens once its reader is there
+		ctx->Fd = open(target, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	}
+
+	if (ctx->Fd < 0)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "evtExport: cannot open %s\n", target);
+		ctx->RetryUs = nowUs() + (EVT_EXPORT_RETRY_MS * 1000ULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      targetWrite
+ *
+ * @brief   writes a batch, on the writer thread
+ *
+ * @return  0 on success, -1 if the batch is lost
+ */
+static int32_t targetWrite(evtExport_t *ctx, evtExportBatch_t *b)
+{
+	uint32_t done = 0;
+	ssize_t n;
+
+	if (targetOpen(ctx) != 0)
+	{
+		return -1;
+	}
+	while (done < b->Len)
+	{
+		n = write(ctx->Fd, b->Data + done, b->Len - done);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			dbg_print(PRINT_LEVEL_WARNING, "evtExport: write failed, %s\n",
+			        strerror(errno));
+			close(ctx->Fd);
+			ctx->Fd = -1;
+			ctx->RetryUs = nowUs() + (EVT_EXPORT_RETRY_MS * 1000ULL);
+			return -1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      exportThread
+ *
+ * @brief   writes the full batches, and the batch being filled once its
+ *          first record is FlushMs old, until closed and all written
+ */
+static void *exportThread(void *arg)
+{
+	evtExport_t *ctx = (evtExport_t *) arg;
+	evtExportBatch_t *b;
+	struct timespec to;
+	uint64_t due;
+	sigset_t set;
+	int32_t status;
+
+	// a reader going away fails the write rather than kill the process
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	pthread_mutex_lock(&ctx->Lock);
+	while (1)
+	{
+		b = &ctx->Batches[ctx->Fill];
+		if ((ctx->Full == 0) && (b->Len > 0)
+		        && (!ctx->Running
+		                || (nowUs() >= b->FirstUs
+		                        + (ctx->Cfg.FlushMs * 1000ULL))))
+		{
+			batchSeal(ctx);
+		}
+		if (ctx->Full == 0)
+		{
+			if (!ctx->Running)
+			{
+				break;
+			}
+			due = (b->Len > 0) ?
+			        (b->FirstUs + (ctx->Cfg.FlushMs * 1000ULL)) :
+			        (nowUs() + (ctx->Cfg.FlushMs * 1000ULL));
+			to.tv_sec = due / 1000000;
+			to.tv_nsec = (due % 1000000) * 1000;
+			pthread_cond_timedwait(&ctx->FullCond, &ctx->Lock, &to);
+			continue;
+		}
+
+		b = &ctx->Batches[ctx->Head];
+		pthread_mutex_unlock(&ctx->Lock);
+		status = targetWrite(ctx, b);
+		pthread_mutex_lock(&ctx->Lock);
+
+		if (status == 0)
+		{
+			ctx->Stats.Writes++;
+			ctx->Stats.Bytes += b->Len;
+		}
+		else
+		{
+			ctx->Stats.Errors++;
+			ctx->Stats.Lost += b->Events;
+		}
+		b->Len = 0;
+		b->Events = 0;
+		ctx->Head = (ctx->Head + 1) % ctx->Cfg.Batches;
+		ctx->Full--;
+		pthread_cond_broadcast(&ctx->FreeCond);
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return NULL;
+}
+
+/*********************************************************************
+ * LISTENERS
+ */
+
+static void incomingMsgCb(uint16_t event, void *data, void *arg)
+{
+	IncomingMsgFormat_t *msg = data;
+	evtExport_t *ctx = arg;
+	uint8_t *p;
+
+	pthread_mutex_lock(&ctx->Lock);
+	p = recordBegin(ctx, EVT_EXPORT_AF_INCOMING, 17 + msg->Len);
+	if (p != NULL)
+	{
+		p = put16(p, msg->GroupId);
+		p = put16(p, msg->ClusterId);
+		p = put16(p, msg->SrcAddr);
+		*p++ = msg->SrcEndpoint;
+		*p++ = msg->DstEndpoint;
+		*p++ = msg->WasVroadcast;
+		*p++ = msg->LinkQuality;
+		*p++ = msg->SecurityUse;
+		p = put32(p, msg->TimeStamp);
+		*p++ = msg->TransSeqNum;
+		*p++ = msg->Len;
+		memcpy(p, msg->Data, msg->Len);
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static void incomingMsgExtCb(uint16_t event, void *data, void *arg)
+{
+	IncomingMsgExtFormat_t *msg = data;
+	evtExport_t *ctx = arg;
+	uint8_t *p;
+
+	pthread_mutex_lock(&ctx->Lock);
+	p = recordBegin(ctx, EVT_EXPORT_AF_INCOMING_EXT, 26 + msg->Len);
+	if (p != NULL)
+	{
+		p = put16(p, msg->GroupId);
+		p = put16(p, msg->ClusterId);
+		*p++ = msg->SrcAddrMode;
+		p = put64(p, msg->SrcAddr);
+		*p++ = msg->SrcEndpoint;
+		p = put16(p, msg->SrcPanId);
+		*p++ = msg->DstEndpoint;
+		*p++ = msg->WasVroadcast;
+		*p++ = msg->LinkQuality;
+		*p++ = msg->SecurityUse;
+		p = put32(p, msg->TimeStamp);
+		*p++ = msg->TransSeqNum;
+		*p++ = msg->Len;
+		memcpy(p, msg->Data, msg->Len);
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static void dataConfirmCb(uint16_t event, void *data, void *arg)
+{
+	DataConfirmFormat_t *msg = data;
+	evtExport_t *ctx = arg;
+	uint8_t *p;
+
+	pthread_mutex_lock(&ctx->Lock);
+	p = recordBegin(ctx, EVT_EXPORT_AF_DATA_CONFIRM, 3);
+	if (p != NULL)
+	{
+		p[0] = msg->Status;
+		p[1] = msg->Endpoint;
+		p[2] = msg->TransId;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static void stateChangeIndCb(uint16_t event, void *data, void *arg)
+{
+	uint8_t *zdoState = data;
+	evtExport_t *ctx = arg;
+	uint8_t *p;
+
+	pthread_mutex_lock(&ctx->Lock);
+	p = recordBegin(ctx, EVT_EXPORT_STATE_CHANGE, 1);
+	if (p != NULL)
+	{
+		p[0] = *zdoState;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static void endDeviceAnnceIndCb(uint16_t event, void *data, void *arg)
+{
+	EndDeviceAnnceIndFormat_t *msg = data;
+	evtExport_t *ctx = arg;
+	uint8_t *p;
+
+	pthread_mutex_lock(&ctx->Lock);
+	p = recordBegin(ctx, EVT_EXPORT_DEVICE_ANNCE, 13);
+	if (p != NULL)
+	{
+		p = put16(p, msg->SrcAddr);
+		p = put16(p, msg->NwkAddr);
+		p = put64(p, msg->IEEEAddr);
+		*p = msg->Capabilities;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static void leaveIndCb(uint16_t event, void *data, void *arg)
+{
+	LeaveIndFormat_t *msg = data;
+	evtExport_t *ctx = arg;
+	uint8_t *p;
+
+	pthread_mutex_lock(&ctx->Lock);
+	p = recordBegin(ctx, EVT_EXPORT_LEAVE_IND, 13);
+	if (p != NULL)
+	{
+		p = put16(p, msg->SrcAddr);
+		p = put64(p, msg->ExtAddr);
+		*p++ = msg->Request;
+		*p++ = msg->Remove;
+		*p = msg->Rejoin;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static void srcRtgIndCb(uint16_t event, void *data, void *arg)
+{
+	SrcRtgIndFormat_t *msg = data;
+	evtExport_t *ctx = arg;
+	uint32_t i;
+	uint8_t *p;
+
+	pthread_mutex_lock(&ctx->Lock);
+	p = recordBegin(ctx, EVT_EXPORT_SRC_RTG_IND, 3 + (2 * msg->RelayCount));
+	if (p != NULL)
+	{
+		p = put16(p, msg->DstAddr);
+		*p++ = msg->RelayCount;
+		for (i = 0; i < msg->RelayCount; i++)
+		{
+			p = put16(p, msg->RelayList[i]);
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static void resetIndCb(uint16_t event, void *data, void *arg)
+{
+	ResetIndFormat_t *msg = data;
+	evtExport_t *ctx = arg;
+	uint8_t *p;
+
+	pthread_mutex_lock(&ctx->Lock);
+	p = recordBegin(ctx, EVT_EXPORT_RESET_IND, 6);
+	if (p != NULL)
+	{
+		p[0] = msg->Reason;
+		p[1] = msg->TransportRev;
+		p[2] = msg->ProductId;
+		p[3] = msg->MajorRel;
+		p[4] = msg->MinorRel;
+		p[5] = msg->HwRev;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+// listener of each event type
+static const struct
+{
+	uint8_t Type;
+	uint16_t Event;
+	mtEventCb_t Cb;
+} exportListeners[] =
+{
+	{ EVT_EXPORT_AF_INCOMING, MT_EVENT(MT_RPC_SYS_AF, MT_AF_INCOMING_MSG),
+	        incomingMsgCb },
+	{ EVT_EXPORT_AF_INCOMING_EXT, MT_EVENT(MT_RPC_SYS_AF,
+	        MT_AF_INCOMING_MSG_EXT), incomingMsgExtCb },
+	{ EVT_EXPORT_AF_DATA_CONFIRM, MT_EVENT(MT_RPC_SYS_AF, MT_AF_DATA_CONFIRM),
+	        dataConfirmCb },
+	{ EVT_EXPORT_STATE_CHANGE, MT_EVENT(MT_RPC_SYS_ZDO,
+	        MT_ZDO_STATE_CHANGE_IND), stateChangeIndCb },
+	{ EVT_EXPORT_DEVICE_ANNCE, MT_EVENT(MT_RPC_SYS_ZDO,
+	        MT_ZDO_END_DEVICE_ANNCE_IND), endDeviceAnnceIndCb },
+	{ EVT_EXPORT_LEAVE_IND, MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_LEAVE_IND),
+	        leaveIndCb },
+	{ EVT_EXPORT_SRC_RTG_IND, MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_SRC_RTG_IND),
+	        srcRtgIndCb },
+	{ EVT_EXPORT_RESET_IND, MT_EVENT(MT_RPC_SYS_SYS, MT_SYS_RESET_IND),
+	        resetIndCb },
+};
+
+#define EVT_EXPORT_LISTENERS \
+	(sizeof(exportListeners) / sizeof(exportListeners[0]))
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      evtExportInit
+ *
+ * @brief   starts exporting the events, the target is opened by the
+ *          writer thread, a socket connected again after a failure
+ *
+ * @param   ctx - exporter
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 on failure
+ */
+int32_t evtExportInit(evtExport_t *ctx, evtExportCfg_t *cfg)
+{
+	pthread_condattr_t attr;
+	uint32_t i;
+
+	memset(ctx, 0, sizeof(evtExport_t));
+	ctx->Cfg = *cfg;
+	ctx->Fd = -1;
+	if (ctx->Cfg.Target == NULL)
+	{
+		ctx->Cfg.Target = EVT_EXPORT_STDOUT;
+	}
+	if (ctx->Cfg.Events == 0)
+	{
+		ctx->Cfg.Events = 0xFFFFFFFF;
+	}
+	if (ctx->Cfg.BatchBytes == 0)
+	{
+		ctx->Cfg.BatchBytes = EVT_EXPORT_BATCH_BYTES;
+	}
+	if (ctx->Cfg.BatchBytes < EVT_EXPORT_MIN_BATCH)
+	{
+		ctx->Cfg.BatchBytes = EVT_EXPORT_MIN_BATCH;
+	}
+	if (ctx->Cfg.Batches < 2)
+	{
+		ctx->Cfg.Batches = (ctx->Cfg.Batches == 0) ? EVT_EXPORT_BATCHES : 2;
+	}
+	if (ctx->Cfg.FlushMs == 0)
+	{
+		ctx->Cfg.FlushMs = EVT_EXPORT_FLUSH_MS;
+	}
+
+	ctx->Batches = calloc(ctx->Cfg.Batches, sizeof(evtExportBatch_t));
+	for (i = 0; ctx->Batches && (i < ctx->Cfg.Batches); i++)
+	{
+		ctx->Batches[i].Data = malloc(ctx->Cfg.BatchBytes);
+		if (ctx->Batches[i].Data == NULL)
+		{
+			break;
+		}
+	}
+	if ((ctx->Batches == NULL) || (i < ctx->Cfg.Batches))
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "evtExportInit: allocation failed\n");
+		for (i = 0; ctx->Batches && (i < ctx->Cfg.Batches); i++)
+		{
+			free(ctx->Batches[i].Data);
+		}
+		free(ctx->Batches);
+		return -1;
+	}
+
+	pthread_mutex_init(&ctx->Lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ctx->FullCond, &attr);
+	pthread_cond_init(&ctx->FreeCond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	ctx->Running = 1;
+	if (pthread_create(&ctx->Thread, NULL, exportThread, ctx) != 0)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "evtExportInit: no writer thread\n");
+		ctx->Running = 0;
+		evtExportClose(ctx);
+		return -1;
+	}
+
+	// only the events exported are decoded for the exporter
+	for (i = 0; i < EVT_EXPORT_LISTENERS; i++)
+	{
+		if (ctx->Cfg.Events & EVT_EXPORT_BIT(exportListeners[i].Type))
+		{
+			mtEventAddListener(exportListeners[i].Event,
+			        exportListeners[i].Cb, ctx, ctx->Cfg.Priority);
+		}
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      evtExportClose
+ *
+ * @brief   stops exporting, writes the records collected and frees the
+ *          exporter
+ *
+ * @param   ctx - exporter
+ *
+ * @return  none
+ */
+void evtExportClose(evtExport_t *ctx)
+{
+	uint32_t i;
+
+	// no listener runs once removed, the batches can go
+	for (i = 0; i < EVT_EXPORT_LISTENERS; i++)
+	{
+		mtEventRemoveListener(exportListeners[i].Event,
+		        exportListeners[i].Cb, ctx);
+	}
+
+	pthread_mutex_lock(&ctx->Lock);
+	if (ctx->Running)
+	{
+		ctx->Running = 0;
+		pthread_cond_broadcast(&ctx->FullCond);
+		pthread_cond_broadcast(&ctx->FreeCond);
+		pthread_mutex_unlock(&ctx->Lock);
+		pthread_join(ctx->Thread, NULL);
+	}
+	else
+	{
+		pthread_mutex_unlock(&ctx->Lock);
+	}
+
+	if (ctx->Fd >= 0)
+	{
+		close(ctx->Fd);
+	}
+	for (i = 0; i < ctx->Cfg.Batches; i++)
+	{
+		free(ctx->Batches[i].Data);
+	}
+	free(ctx->Batches);
+	pthread_cond_destroy(&ctx->FreeCond);
+	pthread_cond_destroy(&ctx->FullCond);
+	pthread_mutex_destroy(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      evtExportFlush
+ *
+ * @brief   waits until the records collected so far are written
+ *
+ * @param   ctx - exporter
+ *
+ * @return  none
+ */
+void evtExportFlush(evtExport_t *ctx)
+{
+	pthread_mutex_lock(&ctx->Lock);
+
+	// with every batch full the one at Fill is sealed already
+	if ((ctx->Full < ctx->Cfg.Batches) && (ctx->Batches[ctx->Fill].Len > 0))
+	{
+		batchSeal(ctx);
+	}
+	while (ctx->Running && (ctx->Full > 0))
+	{
+		pthread_cond_wait(&ctx->FreeCond, &ctx->Lock);
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      evtExportPrintStats
+ *
+ * @brief   prints the counters of the exporter
+ */
+void evtExportPrintStats(evtExport_t *ctx, FILE *out)
+{
+	evtExportStats_t *st = &ctx->Stats;
+
+	pthread_mutex_lock(&ctx->Lock);
+	fprintf(out, "exported %llu events, %llu bytes in %u writes, "
+	        "%u dropped, %u lost, %u errors, %u stalls for %llu ms, "
+	        "peak %u batches waiting\n", (unsigned long long) st->Events,
+	        (unsigned long long) st->Bytes, st->Writes, st->Drops, st->Lost,
+	        st->Errors, st->Stalls, (unsigned long long) (st->StallUs / 1000),
+	        st->PeakBatches);
+	pthread_mutex_unlock(&ctx->Lock);
+}
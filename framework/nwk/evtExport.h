@@ -0,0 +1,156 @@
+/*
+ * evtExport.h
+ *
+ * This module contains the event exporter, which writes the decoded MT
+ * events (AF messages and confirms, device announces, leaves, source
+ * routes, state changes and resets) as a stream of binary records to a
+ * file, a pipe or a Unix domain socket, for a data pipeline to ingest.
+ *
+ * The records are collected in batches written by a thread of the
+ * exporter, a batch when it is full or FlushMs after its first record.
+ * When every batch waits to be written the MT dispatch waits too, or
+ * with Cfg.Drop the events are counted and dropped.
+ *
+ * Record, little endian:
+ *   uint16  length of the record after this field
+ *   uint8   type, EVT_EXPORT_*
+ *   uint8   0
+ *   uint64  time of the decode, micro seconds since the epoch
+ *   body of the type:
+ *   AF_INCOMING      GroupId:2 ClusterId:2 SrcAddr:2 SrcEndpoint:1
+ *                    DstEndpoint:1 WasBroadcast:1 LinkQuality:1
+ *                    SecurityUse:1 TimeStamp:4 TransSeqNum:1 Len:1 Data
+ *   AF_INCOMING_EXT  GroupId:2 ClusterId:2 SrcAddrMode:1 SrcAddr:8
+ *                    SrcEndpoint:1 SrcPanId:2 DstEndpoint:1
+ *                    WasBroadcast:1 LinkQuality:1 SecurityUse:1
+ *                    TimeStamp:4 TransSeqNum:1 Len:1 Data
+ *   AF_DATA_CONFIRM  Status:1 Endpoint:1 TransId:1
+ *   STATE_CHANGE     State:1
+ *   DEVICE_ANNCE     SrcAddr:2 NwkAddr:2 IEEEAddr:8 Capabilities:1
+ *   LEAVE_IND        SrcAddr:2 ExtAddr:8 Request:1 Remove:1 Rejoin:1
+ *   SRC_RTG_IND      DstAddr:2 RelayCount:1 RelayList:2 each
+ *   RESET_IND        Reason:1 TransportRev:1 ProductId:1 MajorRel:1
+ *                    MinorRel:1 HwRev:1
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef EVTEXPORT_H
+#define EVTEXPORT_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// record types
+#define EVT_EXPORT_AF_INCOMING       (1)
+#define EVT_EXPORT_AF_INCOMING_EXT   (2)
+#define EVT_EXPORT_AF_DATA_CONFIRM   (3)
+#define EVT_EXPORT_STATE_CHANGE      (4)
+#define EVT_EXPORT_DEVICE_ANNCE      (5)
+#define EVT_EXPORT_LEAVE_IND         (6)
+#define EVT_EXPORT_SRC_RTG_IND       (7)
+#define EVT_EXPORT_RESET_IND         (8)
+
+#define EVT_EXPORT_BIT(type)         (1UL << (type))
+
+// bytes of the record header, up to the body
+#define EVT_EXPORT_HDR_LEN           (12)
+
+// targets besides a file or pipe path
+#define EVT_EXPORT_UNIX_PREFIX       "unix:"
+#define EVT_EXPORT_STDOUT            "-"
+
+// defaults used for the evtExportCfg_t fields left 0
+#define EVT_EXPORT_BATCH_BYTES       (64 * 1024)
+#define EVT_EXPORT_BATCHES           (4)
+#define EVT_EXPORT_FLUSH_MS          (100)
+
+// wait before connecting again to a socket that failed
+#define EVT_EXPORT_RETRY_MS          (1000)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	const char *Target;       // path, unix:PATH or - for stdout
+	uint32_t Events;          // EVT_EXPORT_BIT() of the types, 0 for all
+	uint32_t BatchBytes;
+	uint32_t Batches;         // batches filled or being written
+	uint32_t FlushMs;         // longest a record waits in its batch
+	uint8_t Drop;             // drop the events rather than wait for a
+	                          // free batch
+	int32_t Priority;         // of its listeners on the MT event bus
+} evtExportCfg_t;
+
+typedef struct
+{
+	uint64_t Events;          // records exported
+	uint64_t Bytes;           // bytes written
+	uint32_t Writes;          // batches written
+	uint32_t Drops;           // events dropped, no free batch
+	uint32_t Lost;            // events of batches that failed to write
+	uint32_t Stalls;          // times the MT dispatch waited for a batch
+	uint64_t StallUs;
+	uint32_t Errors;          // failed writes and connections
+	uint32_t PeakBatches;     // batches waiting to be written at most
+} evtExportStats_t;
+
+typedef struct
+{
+	uint8_t *Data;
+	uint32_t Len;
+	uint32_t Events;
+	uint64_t FirstUs;         // time of the first record
+} evtExportBatch_t;
+
+typedef struct
+{
+	evtExportCfg_t Cfg;
+	pthread_mutex_t Lock;
+	pthread_cond_t FullCond;  // a batch is ready to be written
+	pthread_cond_t FreeCond;  // a batch was written
+	pthread_t Thread;
+	uint8_t Running;
+
+	evtExportBatch_t *Batches;
+	uint32_t Fill;            // batch being filled
+	uint32_t Head;            // oldest batch to write
+	uint32_t Full;            // batches to write
+
+	int Fd;
+	uint64_t RetryUs;         // time to connect again
+
+	evtExportStats_t Stats;
+} evtExport_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t evtExportInit(evtExport_t *ctx, evtExportCfg_t *cfg);
+void evtExportClose(evtExport_t *ctx);
+void evtExportFlush(evtExport_t *ctx);
+void evtExportPrintStats(evtExport_t *ctx, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVTEXPORT_H */
@@ -0,0 +1,781 @@
+/*
+ * loadGen.c
+ *
+ * This module contains the load generator, which sends AF messages to a
+ * set of nodes at a target rate or concurrency and measures the round
+ * trip latency, goodput, confirm failures and fairness.
+ *
+ * Each message carries its AF transaction ID in the first payload byte.
+ * A unicast message is delivered when the node echoes the payload back,
+ * which is what the stressTest example does on routers and end devices.
+ * Group and broadcast messages are not echoed, they are delivered when
+ * the ZNP confirms them. The latency of a message is the time from the
+ * AF_DATA_REQUEST to the echo or confirm.
+ *
+ * In a closed loop every node has Concurrency unicast messages in flight
+ * at any time. In an open loop each node gets RatePerNode messages per
+ * second whatever the answers, messages that cannot be sent in time are
+ * counted as skipped. The message class is drawn from the configured
+ * mix; group and broadcast messages use the slot of the node they were
+ * drawn for, so the mix does not change the offered load.
+ *
+ * The MT callbacks must be dispatched by another thread while
+ * loadGenRun() runs.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "loadGen.h"
+#include "rpc.h"
+#include "mtAf.h"
+#include "mtEvent.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// marks the second payload byte of the load generator messages
+#define LOAD_GEN_MAGIC           (0xA5)
+
+#define LOAD_GEN_BROADCAST_ADDR  (0xFFFD)
+#define LOAD_GEN_ADDR_MODE_GROUP (0x01)
+#define LOAD_GEN_ADDR_MODE_BCAST (0x0F)
+
+// longest sleep of the send loop
+#define LOAD_GEN_IDLE_US         (5000)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static const char *className[LOAD_GEN_CLASSES] =
+	{ "unicast", "group", "broadcast" };
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowUs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in micro seconds
+ */
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*********************************************************************
+ * @fn      sampleAdd
+ *
+ * @brief   appends a latency
+ */
+static void sampleAdd(loadGenSamples_t *samples, uint32_t us)
+{
+	if (samples->Count == samples->Alloc)
+	{
+		uint32_t newAlloc = samples->Alloc ? (samples->Alloc * 2) : 1024;
+		void *p = realloc(samples->Us, newAlloc * sizeof(uint32_t));
+
+		if (p == NULL)
+		{
+			return;
+		}
+		samples->Us = p;
+		samples->Alloc = newAlloc;
+	}
+	samples->Us[samples->Count++] = us;
+}
+
+static int compareUs(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*********************************************************************
+ * @fn      percentiles
+ *
+ * @brief   sorts the latencies and fills the percentiles of a result
+ */
+static void percentiles(loadGenSamples_t *samples, loadGenResult_t *result)
+{
+	uint32_t n = samples->Count;
+
+	if (n == 0)
+	{
+		return;
+	}
+	qsort(samples->Us, n, sizeof(uint32_t), compareUs);
+	result->P50Us = samples->Us[(uint32_t) ((uint64_t) n * 50 / 100)];
+	result->P99Us = samples->Us[(uint32_t) ((uint64_t) n * 99 / 100)];
+	result->P999Us = samples->Us[(uint32_t) ((uint64_t) n * 999 / 1000)];
+	result->MaxUs = samples->Us[n - 1];
+}
+
+/*********************************************************************
+ * @fn      slotEnd
+ *
+ * @brief   frees the slot of a message and accounts its outcome. Called
+ *          with the lock held.
+ *
+ * @param   ctx - load generator
+ * @param   transId - AF transaction ID of the message
+ * @param   delivered - 1 if echoed or confirmed, 0 if lost or failed
+ * @param   now - time in micro seconds
+ *
+ * @return  none
+ */
+static void slotEnd(loadGen_t *ctx, uint8_t transId, uint8_t delivered,
+        uint64_t now)
+{
+	loadGenSlot_t *slot = &ctx->Slots[transId];
+	loadGenNode_t *node = &ctx->Nodes[slot->Node];
+	loadGenResult_t *cls = &ctx->Classes[slot->Class];
+	uint32_t us = (uint32_t) (now - slot->SentUs);
+
+	if (delivered)
+	{
+		cls->Delivered++;
+		cls->Bytes += ctx->Cfg.PayloadLen;
+		sampleAdd(&ctx->ClassSamples[slot->Class], us);
+		if (slot->Class == LOAD_GEN_UNICAST)
+		{
+			node->Result.Delivered++;
+			node->Result.Bytes += ctx->Cfg.PayloadLen;
+			sampleAdd(&node->Samples, us);
+		}
+	}
+
+	slot->InUse = 0;
+	node->InFlight--;
+	ctx->InFlight--;
+	pthread_cond_signal(&ctx->Cond);
+}
+
+/*********************************************************************
+ * @fn      drawClass
+ *
+ * @brief   draws the class of the next message from the mix
+ */
+static uint8_t drawClass(loadGen_t *ctx)
+{
+	uint32_t total = ctx->Cfg.UnicastPct + ctx->Cfg.GroupPct
+	        + ctx->Cfg.BroadcastPct;
+	uint32_t r;
+
+	if ((total == 0) || (total == ctx->Cfg.UnicastPct))
+	{
+		return LOAD_GEN_UNICAST;
+	}
+	r = (uint32_t) rand() % total;
+	if (r < ctx->Cfg.UnicastPct)
+	{
+		return LOAD_GEN_UNICAST;
+	}
+	if (r < ctx->Cfg.UnicastPct + ctx->Cfg.GroupPct)
+	{
+		return LOAD_GEN_GROUP;
+	}
+
+	return LOAD_GEN_BROADCAST;
+}
+
+/*********************************************************************
+ * @fn      sendMsg
+ *
+ * @brief   sends one message for a node. Called with the lock held, the
+ *          lock is released while the request waits for its SRSP.
+ *
+ * @param   ctx - load generator
+ * @param   nodeIdx - node the message is sent for
+ * @param   now - time in micro seconds
+ *
+ * @return  0 if sent, -1 if no transaction ID is free
+ */
+static int32_t sendMsg(loadGen_t *ctx, uint32_t nodeIdx, uint64_t now)
+{
+	loadGenNode_t *node = &ctx->Nodes[nodeIdx];
+	loadGenSlot_t *slot;
+	uint8_t payload[LOAD_GEN_MAX_PAYLOAD];
+	uint8_t transId = 0;
+	uint8_t status;
+	uint32_t i;
+
+	for (i = 0; i < LOAD_GEN_MAX_IN_FLIGHT; i++)
+	{
+		transId = (uint8_t) (ctx->NextTransId + i);
+		if (!ctx->Slots[transId].InUse)
+		{
+			break;
+		}
+	}
+	if (i == LOAD_GEN_MAX_IN_FLIGHT)
+	{
+		return -1;
+	}
+	ctx->NextTransId = transId + 1;
+
+	slot = &ctx->Slots[transId];
+	slot->InUse = 1;
+	slot->Class = drawClass(ctx);
+	slot->Confirmed = 0;
+	slot->Node = nodeIdx;
+	slot->SentUs = now;
+	node->InFlight++;
+	ctx->InFlight++;
+	ctx->Classes[slot->Class].Sent++;
+	if (slot->Class == LOAD_GEN_UNICAST)
+	{
+		node->Result.Sent++;
+	}
+
+	payload[0] = transId;
+	payload[1] = LOAD_GEN_MAGIC;
+	for (i = 2; i < ctx->Cfg.PayloadLen; i++)
+	{
+		payload[i] = (uint8_t) i;
+	}
+
+	if (slot->Class == LOAD_GEN_UNICAST)
+	{
+		DataRequestFormat_t req;
+
+		req.DstAddr = node->NwkAddr;
+		req.DstEndpoint = ctx->Cfg.DstEndpoint;
+		req.SrcEndpoint = ctx->Cfg.SrcEndpoint;
+		req.ClusterID = ctx->Cfg.ClusterId;
+		req.TransID = transId;
+		req.Options = 0;
+		req.Radius = LOAD_GEN_RADIUS;
+		req.Len = ctx->Cfg.PayloadLen;
+		memcpy(req.Data, payload, ctx->Cfg.PayloadLen);
+
+		pthread_mutex_unlock(&ctx->Lock);
+		if (ctx->Cfg.Routes != NULL)
+		{
+			status = srcRtCacheDataRequest(ctx->Cfg.Routes, &req);
+		}
+		else
+		{
+			status = afDataRequest(&req);
+		}
+	}
+	else
+	{
+		DataRequestExtFormat_t req;
+		uint16_t dstAddr = (slot->Class == LOAD_GEN_GROUP) ?
+		        ctx->Cfg.GroupId : LOAD_GEN_BROADCAST_ADDR;
+
+		memset(&req, 0, sizeof(req));
+		req.DstAddrMode = (slot->Class == LOAD_GEN_GROUP) ?
+		        LOAD_GEN_ADDR_MODE_GROUP : LOAD_GEN_ADDR_MODE_BCAST;
+		req.DstAddr[0] = dstAddr & 0xFF;
+		req.DstAddr[1] = (dstAddr >> 8) & 0xFF;
+		req.DstEndpoint = ctx->Cfg.DstEndpoint;
+		req.SrcEndpoint = ctx->Cfg.SrcEndpoint;
+		req.ClusterId = ctx->Cfg.ClusterId;
+		req.TransId = transId;
+		req.Options = 0;
+		req.Radius = LOAD_GEN_RADIUS;
+		req.Len = ctx->Cfg.PayloadLen;
+		memcpy(req.Data, payload, ctx->Cfg.PayloadLen);
+
+		pthread_mutex_unlock(&ctx->Lock);
+		if (ctx->Cfg.Governor != NULL)
+		{
+			// a queued message counts as sent, its confirm comes later
+			status = (bcastGovDataRequestExt(ctx->Cfg.Governor, &req) < 0) ?
+			        MT_RPC_ERR_SUBSYSTEM : MT_RPC_SUCCESS;
+		}
+		else
+		{
+			status = afDataRequestExt(&req);
+		}
+	}
+	pthread_mutex_lock(&ctx->Lock);
+
+	// the confirm may already have ended the message
+	if ((status != MT_RPC_SUCCESS) && slot->InUse && (slot->SentUs == now))
+	{
+		ctx->Classes[slot->Class].SendFailed++;
+		if (slot->Class == LOAD_GEN_UNICAST)
+		{
+			node->Result.SendFailed++;
+		}
+		slotEnd(ctx, transId, 0, now);
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      expire
+ *
+ * @brief   ends the messages without echo or confirm in time. Called
+ *          with the lock held.
+ */
+static void expire(loadGen_t *ctx, uint64_t now)
+{
+	uint64_t timeoutUs = (uint64_t) ctx->Cfg.TimeoutMs * 1000;
+	uint32_t i;
+
+	for (i = 0; (i < LOAD_GEN_MAX_IN_FLIGHT) && ctx->InFlight; i++)
+	{
+		loadGenSlot_t *slot = &ctx->Slots[i];
+
+		if (slot->InUse && (now - slot->SentUs >= timeoutUs))
+		{
+			ctx->Classes[slot->Class].Lost++;
+			if (slot->Class == LOAD_GEN_UNICAST)
+			{
+				ctx->Nodes[slot->Node].Result.Lost++;
+			}
+			slotEnd(ctx, (uint8_t) i, 0, now);
+		}
+	}
+}
+
+/*********************************************************************
+ * @fn      summarize
+ *
+ * @brief   computes the percentiles, goodput and fairness
+ */
+static void summarize(loadGen_t *ctx)
+{
+	loadGenSamples_t all;
+	double sum = 0;
+	double sumSq = 0;
+	uint32_t c, n;
+
+	memset(&ctx->Total, 0, sizeof(loadGenResult_t));
+	memset(&all, 0, sizeof(all));
+	for (c = 0; c < LOAD_GEN_CLASSES; c++)
+	{
+		loadGenResult_t *cls = &ctx->Classes[c];
+		uint32_t i;
+
+		ctx->Total.Sent += cls->Sent;
+		ctx->Total.Delivered += cls->Delivered;
+		ctx->Total.Lost += cls->Lost;
+		ctx->Total.ConfirmFailed += cls->ConfirmFailed;
+		ctx->Total.SendFailed += cls->SendFailed;
+		ctx->Total.Bytes += cls->Bytes;
+		for (i = 0; i < ctx->ClassSamples[c].Count; i++)
+		{
+			sampleAdd(&all, ctx->ClassSamples[c].Us[i]);
+		}
+		percentiles(&ctx->ClassSamples[c], cls);
+	}
+	percentiles(&all, &ctx->Total);
+	free(all.Us);
+
+	for (n = 0; n < ctx->Cfg.NodeCount; n++)
+	{
+		loadGenNode_t *node = &ctx->Nodes[n];
+
+		percentiles(&node->Samples, &node->Result);
+		sum += node->Result.Delivered;
+		sumSq += (double) node->Result.Delivered * node->Result.Delivered;
+	}
+
+	ctx->GoodputBps = ctx->ElapsedUs ?
+	        (ctx->Total.Bytes * 8.0 * 1000000.0 / ctx->ElapsedUs) : 0;
+	ctx->Fairness = (sumSq > 0) ? (sum * sum / (ctx->Cfg.NodeCount * sumSq)) : 0;
+}
+
+/*********************************************************************
+ * @fn      writeResultCsv
+ */
+static void writeResultCsv(FILE *fp, const char *scope, const char *id,
+        loadGenResult_t *r, double elapsedS)
+{
+	fprintf(fp, "%s,%s,%u,%u,%u,%u,%u,%u,%u,%u,%u,%.0f\n", scope, id, r->Sent,
+	        r->Delivered, r->Lost, r->ConfirmFailed, r->SendFailed, r->P50Us,
+	        r->P99Us, r->P999Us, r->MaxUs,
+	        elapsedS > 0 ? (r->Bytes * 8.0 / elapsedS) : 0);
+}
+
+/*********************************************************************
+ * @fn      writeResultJson
+ */
+static void writeResultJson(FILE *fp, loadGenResult_t *r, double elapsedS)
+{
+	fprintf(fp, "\"sent\":%u,\"delivered\":%u,\"lost\":%u,"
+	        "\"confirmFailed\":%u,\"sendFailed\":%u,\"p50Us\":%u,\"p99Us\":%u,"
+	        "\"p999Us\":%u,\"maxUs\":%u,\"goodputBps\":%.0f", r->Sent,
+	        r->Delivered, r->Lost, r->ConfirmFailed, r->SendFailed, r->P50Us,
+	        r->P99Us, r->P999Us, r->MaxUs,
+	        elapsedS > 0 ? (r->Bytes * 8.0 / elapsedS) : 0);
+}
+
+/*********************************************************************
+ * MT EVENT LISTENERS
+ */
+
+static void dataConfirmCb(uint16_t event, void *data, void *arg)
+{
+	DataConfirmFormat_t *msg = data;
+	loadGen_t *ctx = arg;
+	loadGenSlot_t *slot;
+
+	pthread_mutex_lock(&ctx->Lock);
+
+	slot = &ctx->Slots[msg->TransId];
+	if ((msg->Endpoint == ctx->Cfg.SrcEndpoint) && slot->InUse
+	        && !slot->Confirmed)
+	{
+		slot->Confirmed = 1;
+		if (msg->Status != MT_RPC_SUCCESS)
+		{
+			ctx->Classes[slot->Class].ConfirmFailed++;
+			if (slot->Class == LOAD_GEN_UNICAST)
+			{
+				ctx->Nodes[slot->Node].Result.ConfirmFailed++;
+			}
+			slotEnd(ctx, msg->TransId, 0, nowUs());
+		}
+		else if (slot->Class != LOAD_GEN_UNICAST)
+		{
+			slotEnd(ctx, msg->TransId, 1, nowUs());
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static void incomingMsgCb(uint16_t event, void *data, void *arg)
+{
+	IncomingMsgFormat_t *msg = data;
+	loadGen_t *ctx = arg;
+	loadGenSlot_t *slot;
+
+	pthread_mutex_lock(&ctx->Lock);
+
+	if ((msg->ClusterId == ctx->Cfg.ClusterId)
+	        && (msg->Len >= LOAD_GEN_MIN_PAYLOAD)
+	        && (msg->Data[1] == LOAD_GEN_MAGIC))
+	{
+		slot = &ctx->Slots[msg->Data[0]];
+		if (slot->InUse && (slot->Class == LOAD_GEN_UNICAST)
+		        && (ctx->Nodes[slot->Node].NwkAddr == msg->SrcAddr))
+		{
+			slotEnd(ctx, msg->Data[0], 1, nowUs());
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static const struct
+{
+	uint16_t Event;
+	mtEventCb_t Cb;
+} loadGenListeners[] =
+{
+	{ MT_EVENT(MT_RPC_SYS_AF, MT_AF_DATA_CONFIRM), dataConfirmCb },
+	{ MT_EVENT(MT_RPC_SYS_AF, MT_AF_INCOMING_MSG), incomingMsgCb },
+};
+
+#define LOAD_GEN_LISTENERS \
+	(sizeof(loadGenListeners) / sizeof(loadGenListeners[0]))
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      loadGenInit
+ *
+ * @brief   prepares a load generator
+ *
+ * @param   ctx - load generator
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t loadGenInit(loadGen_t *ctx, loadGenCfg_t *cfg)
+{
+	pthread_condattr_t attr;
+	uint32_t n;
+
+	memset(ctx, 0, sizeof(loadGen_t));
+	memcpy(&ctx->Cfg, cfg, sizeof(loadGenCfg_t));
+	if (ctx->Cfg.PayloadLen == 0)
+	{
+		ctx->Cfg.PayloadLen = LOAD_GEN_PAYLOAD;
+	}
+	if (ctx->Cfg.PayloadLen < LOAD_GEN_MIN_PAYLOAD)
+	{
+		ctx->Cfg.PayloadLen = LOAD_GEN_MIN_PAYLOAD;
+	}
+	if (ctx->Cfg.PayloadLen > LOAD_GEN_MAX_PAYLOAD)
+	{
+		ctx->Cfg.PayloadLen = LOAD_GEN_MAX_PAYLOAD;
+	}
+	if (ctx->Cfg.Concurrency == 0)
+	{
+		ctx->Cfg.Concurrency = LOAD_GEN_CONCURRENCY;
+	}
+	if (ctx->Cfg.DurationMs == 0)
+	{
+		ctx->Cfg.DurationMs = LOAD_GEN_DURATION_MS;
+	}
+	if (ctx->Cfg.TimeoutMs == 0)
+	{
+		ctx->Cfg.TimeoutMs = LOAD_GEN_TIMEOUT_MS;
+	}
+	if (ctx->Cfg.NodeCount == 0)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "loadGenInit: no nodes\n");
+		return -1;
+	}
+
+	ctx->Nodes = calloc(ctx->Cfg.NodeCount, sizeof(loadGenNode_t));
+	if (ctx->Nodes == NULL)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "loadGenInit: allocation failed\n");
+		return -1;
+	}
+	for (n = 0; n < ctx->Cfg.NodeCount; n++)
+	{
+		ctx->Nodes[n].NwkAddr = ctx->Cfg.Nodes[n];
+	}
+	ctx->NextTransId = (uint8_t) rand();
+
+	pthread_mutex_init(&ctx->Lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ctx->Cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	for (n = 0; n < LOAD_GEN_LISTENERS; n++)
+	{
+		mtEventAddListener(loadGenListeners[n].Event, loadGenListeners[n].Cb,
+		        ctx, MT_EVENT_PRIO_DEFAULT);
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      loadGenClose
+ *
+ * @brief   stops the load generator receiving messages and frees it
+ *
+ * @param   ctx - load generator
+ *
+ * @return  none
+ */
+void loadGenClose(loadGen_t *ctx)
+{
+	uint32_t i;
+
+	for (i = 0; i < LOAD_GEN_LISTENERS; i++)
+	{
+		mtEventRemoveListener(loadGenListeners[i].Event,
+		        loadGenListeners[i].Cb, ctx);
+	}
+
+	for (i = 0; ctx->Nodes && (i < ctx->Cfg.NodeCount); i++)
+	{
+		free(ctx->Nodes[i].Samples.Us);
+	}
+	for (i = 0; i < LOAD_GEN_CLASSES; i++)
+	{
+		free(ctx->ClassSamples[i].Us);
+	}
+	free(ctx->Nodes);
+	pthread_mutex_destroy(&ctx->Lock);
+	pthread_cond_destroy(&ctx->Cond);
+	memset(ctx, 0, sizeof(loadGen_t));
+}
+
+/*********************************************************************
+ * @fn      loadGenRun
+ *
+ * @brief   sends the load for DurationMs, then waits for the messages in
+ *          flight and computes the results
+ *
+ * @param   ctx - load generator
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t loadGenRun(loadGen_t *ctx)
+{
+	uint64_t intervalUs = ctx->Cfg.RatePerNode ?
+	        (1000000 / ctx->Cfg.RatePerNode) : 0;
+	uint64_t start = nowUs();
+	uint64_t end = start + ((uint64_t) ctx->Cfg.DurationMs * 1000);
+	uint64_t now;
+	uint32_t n;
+
+	pthread_mutex_lock(&ctx->Lock);
+
+	// spread the first messages of the open loop over one interval
+	for (n = 0; n < ctx->Cfg.NodeCount; n++)
+	{
+		ctx->Nodes[n].NextUs = start
+		        + (intervalUs * n / ctx->Cfg.NodeCount);
+	}
+
+	while ((now = nowUs()) < end)
+	{
+		uint64_t wake = now + LOAD_GEN_IDLE_US;
+		struct timespec ts;
+		uint8_t sent = 0;
+
+		expire(ctx, now);
+		for (n = 0; n < ctx->Cfg.NodeCount; n++)
+		{
+			loadGenNode_t *node = &ctx->Nodes[n];
+
+			if (intervalUs)
+			{
+				// an open loop does not wait for the answers
+				if (node->NextUs > now)
+				{
+					if (node->NextUs < wake)
+					{
+						wake = node->NextUs;
+					}
+					continue;
+				}
+				while (node->NextUs + 1000000 < now)
+				{
+					node->NextUs += intervalUs;
+					ctx->Skipped++;
+				}
+				if (sendMsg(ctx, n, now) == 0)
+				{
+					node->NextUs += intervalUs;
+					sent = 1;
+				}
+			}
+			else if (node->InFlight < ctx->Cfg.Concurrency)
+			{
+				if (sendMsg(ctx, n, now) == 0)
+				{
+					sent = 1;
+				}
+			}
+			now = nowUs();
+		}
+
+		if (!sent)
+		{
+			ts.tv_sec = wake / 1000000;
+			ts.tv_nsec = (wake % 1000000) * 1000;
+			pthread_cond_timedwait(&ctx->Cond, &ctx->Lock, &ts);
+		}
+	}
+	ctx->ElapsedUs = nowUs() - start;
+
+	// the messages in flight get their full timeout
+	end = nowUs() + ((uint64_t) ctx->Cfg.TimeoutMs * 1000);
+	while (ctx->InFlight && ((now = nowUs()) < end))
+	{
+		struct timespec ts;
+		uint64_t wake = now + LOAD_GEN_IDLE_US;
+
+		ts.tv_sec = wake / 1000000;
+		ts.tv_nsec = (wake % 1000000) * 1000;
+		pthread_cond_timedwait(&ctx->Cond, &ctx->Lock, &ts);
+	}
+	expire(ctx, end);
+
+	summarize(ctx);
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      loadGenWriteCsv
+ *
+ * @brief   writes the results as CSV, one line for all messages, one per
+ *          class and one per node
+ *
+ * @param   ctx - load generator after loadGenRun()
+ * @param   fp - output
+ *
+ * @return  none
+ */
+void loadGenWriteCsv(loadGen_t *ctx, FILE *fp)
+{
+	double elapsedS = ctx->ElapsedUs / 1000000.0;
+	char id[32];
+	uint32_t i;
+
+	fprintf(fp, "scope,id,sent,delivered,lost,confirmFailed,sendFailed,"
+	        "p50Us,p99Us,p999Us,maxUs,goodputBps\n");
+	snprintf(id, sizeof(id), "fairness=%.3f", ctx->Fairness);
+	writeResultCsv(fp, "total", id, &ctx->Total, elapsedS);
+	for (i = 0; i < LOAD_GEN_CLASSES; i++)
+	{
+		writeResultCsv(fp, "class", className[i], &ctx->Classes[i], elapsedS);
+	}
+	for (i = 0; i < ctx->Cfg.NodeCount; i++)
+	{
+		snprintf(id, sizeof(id), "0x%04X", ctx->Nodes[i].NwkAddr);
+		writeResultCsv(fp, "node", id, &ctx->Nodes[i].Result, elapsedS);
+	}
+}
+
+/*********************************************************************
+ * @fn      loadGenWriteJson
+ *
+ * @brief   writes the configuration and results as JSON
+ *
+ * @param   ctx - load generator after loadGenRun()
+ * @param   fp - output
+ *
+ * @return  none
+ */
+void loadGenWriteJson(loadGen_t *ctx, FILE *fp)
+{
+	double elapsedS = ctx->ElapsedUs / 1000000.0;
+	uint32_t i;
+
+	fprintf(fp, "{\"config\":{\"nodes\":%u,\"payload\":%u,\"ratePerNode\":%u,"
+	        "\"concurrency\":%u,\"unicastPct\":%u,\"groupPct\":%u,"
+	        "\"broadcastPct\":%u,\"durationMs\":%u,\"timeoutMs\":%u},\n",
+	        ctx->Cfg.NodeCount, ctx->Cfg.PayloadLen, ctx->Cfg.RatePerNode,
+	        ctx->Cfg.Concurrency, ctx->Cfg.UnicastPct, ctx->Cfg.GroupPct,
+	        ctx->Cfg.BroadcastPct, ctx->Cfg.DurationMs, ctx->Cfg.TimeoutMs);
+	fprintf(fp, "\"elapsedMs\":%llu,\"goodputBps\":%.0f,\"fairness\":%.4f,"
+	        "\"skipped\":%u,\n\"total\":{",
+	        (unsigned long long) (ctx->ElapsedUs / 1000), ctx->GoodputBps,
+	        ctx->Fairness, ctx->Skipped);
+	writeResultJson(fp, &ctx->Total, elapsedS);
+	fprintf(fp, "},\n\"classes\":{");
+	for (i = 0; i < LOAD_GEN_CLASSES; i++)
+	{
+		fprintf(fp, "%s\n\"%s\":{", i ? "," : "", className[i]);
+		writeResultJson(fp, &ctx->Classes[i], elapsedS);
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "},\n\"nodes\":[");
+	for (i = 0; i < ctx->Cfg.NodeCount; i++)
+	{
+		fprintf(fp, "%s\n{\"nwkAddr\":%u,", i ? "," : "",
+		        ctx->Nodes[i].NwkAddr);
+		writeResultJson(fp, &ctx->Nodes[i].Result, elapsedS);
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "]}\n");
+}
@@ -0,0 +1,156 @@
+/*
+ * loadGen.h
+ *
+ * This module contains the load generator, which sends AF messages to a
+ * set of nodes at a target rate or concurrency and measures the round
+ * trip latency, goodput, confirm failures and fairness.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "bcastGov.h"
+#include "srcRtCache.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// message classes
+#define LOAD_GEN_UNICAST         (0)
+#define LOAD_GEN_GROUP           (1)
+#define LOAD_GEN_BROADCAST       (2)
+#define LOAD_GEN_CLASSES         (3)
+
+// defaults used for the loadGenCfg_t fields left 0
+#define LOAD_GEN_PAYLOAD         (8)
+#define LOAD_GEN_CONCURRENCY     (1)
+#define LOAD_GEN_DURATION_MS     (30000)
+#define LOAD_GEN_TIMEOUT_MS      (2000)
+#define LOAD_GEN_RADIUS          (16)
+
+// payload sizes accepted, the first 2 bytes identify the message
+#define LOAD_GEN_MIN_PAYLOAD     (2)
+#define LOAD_GEN_MAX_PAYLOAD     (80)
+
+// messages in flight, one per AF transaction ID
+#define LOAD_GEN_MAX_IN_FLIGHT   (256)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint16_t *Nodes;          // destinations of the unicast messages
+	uint32_t NodeCount;
+	uint8_t SrcEndpoint;
+	uint8_t DstEndpoint;
+	uint16_t ClusterId;
+	uint16_t GroupId;         // destination of the group messages
+	uint8_t PayloadLen;
+	uint32_t RatePerNode;     // messages per second per node, 0 for a
+	                          // closed loop
+	uint8_t Concurrency;      // closed loop messages in flight per node
+	uint8_t UnicastPct;       // mix of the messages, all 0 for unicast only
+	uint8_t GroupPct;
+	uint8_t BroadcastPct;
+	uint32_t DurationMs;
+	uint32_t TimeoutMs;       // time allowed for the echo or confirm
+	bcastGov_t *Governor;     // sends the group and broadcast messages,
+	                          // NULL to send them directly
+	srcRtCache_t *Routes;     // sends the unicast messages along the
+	                          // cached source routes, or NULL
+} loadGenCfg_t;
+
+// results of a message class, or of a node for the unicast messages
+typedef struct
+{
+	uint32_t Sent;
+	uint32_t Delivered;       // echoed (unicast) or confirmed (group, broadcast)
+	uint32_t Lost;            // no echo or confirm within TimeoutMs
+	uint32_t ConfirmFailed;   // AF_DATA_CONFIRM with a failure status
+	uint32_t SendFailed;      // AF_DATA_REQUEST rejected by the ZNP
+	uint64_t Bytes;           // payload delivered
+	uint32_t P50Us;
+	uint32_t P99Us;
+	uint32_t P999Us;
+	uint32_t MaxUs;
+} loadGenResult_t;
+
+// growable array of latencies
+typedef struct
+{
+	uint32_t *Us;
+	uint32_t Count;
+	uint32_t Alloc;
+} loadGenSamples_t;
+
+typedef struct
+{
+	uint16_t NwkAddr;
+	uint32_t InFlight;
+	uint64_t NextUs;          // open loop: time of the next message
+	loadGenResult_t Result;
+	loadGenSamples_t Samples;
+} loadGenNode_t;
+
+typedef struct
+{
+	uint8_t InUse;
+	uint8_t Class;
+	uint8_t Confirmed;
+	uint32_t Node;
+	uint64_t SentUs;
+} loadGenSlot_t;
+
+typedef struct
+{
+	loadGenCfg_t Cfg;
+	pthread_mutex_t Lock;
+	pthread_cond_t Cond;
+	loadGenNode_t *Nodes;
+	loadGenSlot_t Slots[LOAD_GEN_MAX_IN_FLIGHT];
+	uint32_t InFlight;
+	uint8_t NextTransId;
+	uint32_t Skipped;         // open loop messages not sent in time
+	loadGenResult_t Classes[LOAD_GEN_CLASSES];
+	loadGenSamples_t ClassSamples[LOAD_GEN_CLASSES];
+	loadGenResult_t Total;
+	uint64_t ElapsedUs;
+	double GoodputBps;        // payload bits delivered per second
+	double Fairness;          // Jain's index of the unicast deliveries
+} loadGen_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t loadGenInit(loadGen_t *ctx, loadGenCfg_t *cfg);
+void loadGenClose(loadGen_t *ctx);
+int32_t loadGenRun(loadGen_t *ctx);
+
+void loadGenWriteCsv(loadGen_t *ctx, FILE *fp);
+void loadGenWriteJson(loadGen_t *ctx, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOADGEN_H */
@@ -0,0 +1,830 @@
+/*
+ * nodeReg.c
+ *
+ * This module contains the node registry, which maps the network and
+ * IEEE addresses of the nodes in the network to per node state.
+ *
+ * The nodes live in one array allocated by nodeRegInit(), so a node
+ * pointer stays valid until the node is removed. Each address type has
+ * its own open addressing hash table with linear probing that maps the
+ * address to the node index. The tables are kept at most half full and
+ * use backward shift deletion, so lookups stay short without tombstones.
+ *
+ * The registry follows address changes reported by the ZDO device
+ * announce, network address and IEEE address responses, and drops nodes
+ * that leave without rejoin.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "nodeReg.h"
+#include "mtZdo.h"
+#include "mtEvent.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// marks a free hash slot
+#define NODE_REG_EMPTY             (0xFFFFFFFF)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+	uint64_t key;
+	uint32_t idx;
+} regSlot_t;
+
+typedef struct
+{
+	regSlot_t *slots;
+	uint32_t mask;
+	uint8_t shift;
+} regTable_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static pthread_mutex_t nodeRegLock = PTHREAD_MUTEX_INITIALIZER;
+
+static nodeRegNode_t *nodeRegNodes;
+static uint32_t *nodeRegFree;
+static uint32_t nodeRegFreeCnt;
+static uint32_t nodeRegUsed;
+static uint32_t nodeRegCapacity;
+
+static regTable_t nwkTable;
+static regTable_t ieeeTable;
+
+static nodeRegFreeCb_t nodeRegFreeCbs[NODE_REG_APP_SLOTS];
+static uint8_t nodeRegSlotCnt;
+
+static nodeRegStats_t nodeRegStats;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      tableInit
+ *
+ * @brief   allocates a hash table for at least twice as many keys
+ *
+ * @param   tab - table
+ * @param   maxKeys - number of keys the table must hold
+ *
+ * @return  0 on success, -1 if the memory was not allocated
+ */
+static int32_t tableInit(regTable_t *tab, uint32_t maxKeys)
+{
+	uint32_t size = 2;
+	uint8_t bits = 1;
+	uint32_t i;
+
+	while (size < (maxKeys * 2))
+	{
+		size <<= 1;
+		bits++;
+	}
+
+	tab->slots = malloc(size * sizeof(regSlot_t));
+	if (tab->slots == NULL)
+	{
+		return -1;
+	}
+	for (i = 0; i < size; i++)
+	{
+		tab->slots[i].idx = NODE_REG_EMPTY;
+	}
+	tab->mask = size - 1;
+	tab->shift = 64 - bits;
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      tableHome
+ *
+ * @brief   Fibonacci hash of a key
+ *
+ * @param   tab - table
+ * @param   key - address
+ *
+ * @return  home slot of the key
+ */
+static uint32_t tableHome(regTable_t *tab, uint64_t key)
+{
+	return (uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> tab->shift);
+}
+
+/*********************************************************************
+ * @fn      tableFind
+ *
+ * @brief   looks up the slot of a key
+ *
+ * @param   tab - table
+ * @param   key - address
+ *
+ * @return  slot holding the key, or the free slot ending its probe
+ */
+static uint32_t tableFind(regTable_t *tab, uint64_t key)
+{
+	uint32_t pos = tableHome(tab, key);
+	uint32_t probes = 1;
+
+	while ((tab->slots[pos].idx != NODE_REG_EMPTY)
+	        && (tab->slots[pos].key != key))
+	{
+		pos = (pos + 1) & tab->mask;
+		probes++;
+	}
+
+	nodeRegStats.Lookups++;
+	nodeRegStats.Probes += probes;
+	if (probes > nodeRegStats.MaxProbe)
+	{
+		nodeRegStats.MaxProbe = probes;
+	}
+
+	return pos;
+}
+
+/*********************************************************************
+ * @fn      tableGet
+ *
+ * @brief   looks up the node index of a key
+ *
+ * @param   tab - table
+ * @param   key - address
+ *
+ * @return  node index, NODE_REG_EMPTY if the key is not in the table
+ */
+static uint32_t tableGet(regTable_t *tab, uint64_t key)
+{
+	return tab->slots[tableFind(tab, key)].idx;
+}
+
+/*********************************************************************
+ * @fn      tablePut
+ *
+ * @brief   maps a key to a node index
+ *
+ * @param   tab - table
+ * @param   key - address
+ * @param   idx - node index
+ *
+ * @return  none
+ */
+static void tablePut(regTable_t *tab, uint64_t key, uint32_t idx)
+{
+	uint32_t pos = tableFind(tab, key);
+
+	tab->slots[pos].key = key;
+	tab->slots[pos].idx = idx;
+}
+
+/*********************************************************************
+ * @fn      tableErase
+ *
+ * @brief   removes a key, the keys behind it in the probe sequence are
+ *          shifted back so no tombstone is left
+ *
+ * @param   tab - table
+ * @param   key - address
+ *
+ * @return  none
+ */
+static void tableErase(regTable_t *tab, uint64_t key)
+{
+	uint32_t hole = tableFind(tab, key);
+	uint32_t pos = hole;
+
+	if (tab->slots[hole].idx == NODE_REG_EMPTY)
+	{
+		return;
+	}
+
+	while (1)
+	{
+		uint32_t home;
+
+		pos = (pos + 1) & tab->mask;
+		if (tab->slots[pos].idx == NODE_REG_EMPTY)
+		{
+			break;
+		}
+
+		// the entry may move to the hole if its home is not between
+		// the hole and its current slot
+		home = tableHome(tab, tab->slots[pos].key);
+		if (((pos - home) & tab->mask) >= ((pos - hole) & tab->mask))
+		{
+			tab->slots[hole] = tab->slots[pos];
+			hole = pos;
+		}
+	}
+
+	tab->slots[hole].idx = NODE_REG_EMPTY;
+}
+
+/*********************************************************************
+ * @fn      nodeAlloc
+ *
+ * @brief   takes a free node
+ *
+ * @return  node, NULL if the registry is full
+ */
+static nodeRegNode_t *nodeAlloc(void)
+{
+	nodeRegNode_t *node;
+
+	if (nodeRegFreeCnt > 0)
+	{
+		node = &nodeRegNodes[nodeRegFree[--nodeRegFreeCnt]];
+	}
+	else if (nodeRegUsed < nodeRegCapacity)
+	{
+		node = &nodeRegNodes[nodeRegUsed++];
+	}
+	else
+	{
+		nodeRegStats.Full++;
+		return NULL;
+	}
+
+	memset(node, 0, sizeof(nodeRegNode_t));
+	node->IeeeAddr = NODE_REG_INVALID_IEEE;
+	node->NwkAddr = NODE_REG_INVALID_NWK;
+	node->InUse = 1;
+	nodeRegStats.Nodes++;
+
+	return node;
+}
+
+/*********************************************************************
+ * @fn      nodeDrop
+ *
+ * @brief   removes a node, its application state moves to the heir
+ *          where the heir has none, the rest is freed
+ *
+ * @param   node - node to remove
+ * @param   heir - node taking over the state, or NULL
+ *
+ * @return  none
+ */
+static void nodeDrop(nodeRegNode_t *node, nodeRegNode_t *heir)
+{
+	uint8_t slot;
+
+	if (node->NwkAddr != NODE_REG_INVALID_NWK)
+	{
+		tableErase(&nwkTable, node->NwkAddr);
+	}
+	if (node->IeeeAddr != NODE_REG_INVALID_IEEE)
+	{
+		tableErase(&ieeeTable, node->IeeeAddr);
+	}
+
+	for (slot = 0; slot < NODE_REG_APP_SLOTS; slot++)
+	{
+		if (node->AppState[slot] == NULL)
+		{
+			continue;
+		}
+		if (heir && (heir->AppState[slot] == NULL))
+		{
+			heir->AppState[slot] = node->AppState[slot];
+		}
+		else if (nodeRegFreeCbs[slot])
+		{
+			nodeRegFreeCbs[slot](node->AppState[slot]);
+		}
+	}
+
+	node->InUse = 0;
+	nodeRegFree[nodeRegFreeCnt++] = (uint32_t) (node - nodeRegNodes);
+	nodeRegStats.Nodes--;
+}
+
+/*********************************************************************
+ * @fn      findNwk
+ *
+ * @brief   looks up a node by network address, lock held
+ *
+ * @param   nwkAddr - network address
+ *
+ * @return  node, NULL if not known
+ */
+static nodeRegNode_t *findNwk(uint16_t nwkAddr)
+{
+	uint32_t idx = tableGet(&nwkTable, nwkAddr);
+
+	return (idx == NODE_REG_EMPTY) ? NULL : &nodeRegNodes[idx];
+}
+
+/*********************************************************************
+ * @fn      findIeee
+ *
+ * @brief   looks up a node by IEEE address, lock held
+ *
+ * @param   ieeeAddr - IEEE address
+ *
+ * @return  node, NULL if not known
+ */
+static nodeRegNode_t *findIeee(uint64_t ieeeAddr)
+{
+	uint32_t idx = tableGet(&ieeeTable, ieeeAddr);
+
+	return (idx == NODE_REG_EMPTY) ? NULL : &nodeRegNodes[idx];
+}
+
+/*********************************************************************
+ * @fn      update
+ *
+ * @brief   adds a node or reconciles its addresses, lock held
+ *
+ * @param   nwkAddr - network address, or NODE_REG_INVALID_NWK
+ * @param   ieeeAddr - IEEE address, or NODE_REG_INVALID_IEEE
+ *
+ * @return  node, NULL if the registry is full or no address is known
+ */
+static nodeRegNode_t *update(uint16_t nwkAddr, uint64_t ieeeAddr)
+{
+	nodeRegNode_t *byNwk = NULL;
+	nodeRegNode_t *byIeee = NULL;
+	nodeRegNode_t *node;
+	uint32_t idx;
+
+	// neighbor tables report unknown extended addresses as all ones
+	if (ieeeAddr == 0xFFFFFFFFFFFFFFFFULL)
+	{
+		ieeeAddr = NODE_REG_INVALID_IEEE;
+	}
+	if ((nwkAddr == NODE_REG_INVALID_NWK)
+	        && (ieeeAddr == NODE_REG_INVALID_IEEE))
+	{
+		return NULL;
+	}
+
+	if (nwkAddr != NODE_REG_INVALID_NWK)
+	{
+		byNwk = findNwk(nwkAddr);
+	}
+	if (ieeeAddr != NODE_REG_INVALID_IEEE)
+	{
+		byIeee = findIeee(ieeeAddr);
+	}
+
+	if (byIeee)
+	{
+		node = byIeee;
+	}
+	else if (byNwk && (byNwk->IeeeAddr == NODE_REG_INVALID_IEEE))
+	{
+		// a node known by its short address only, learn its IEEE address
+		node = byNwk;
+	}
+	else
+	{
+		node = nodeAlloc();
+		if (node == NULL)
+		{
+			return NULL;
+		}
+	}
+	idx = (uint32_t) (node - nodeRegNodes);
+
+	if ((ieeeAddr != NODE_REG_INVALID_IEEE)
+	        && (node->IeeeAddr == NODE_REG_INVALID_IEEE))
+	{
+		node->IeeeAddr = ieeeAddr;
+		tablePut(&ieeeTable, ieeeAddr, idx);
+	}
+
+	if ((nwkAddr != NODE_REG_INVALID_NWK) && (node->NwkAddr != nwkAddr))
+	{
+		if (byNwk && (byNwk != node))
+		{
+			// the short address now belongs to this node
+			tableErase(&nwkTable, nwkAddr);
+			byNwk->NwkAddr = NODE_REG_INVALID_NWK;
+			if (byNwk->IeeeAddr == NODE_REG_INVALID_IEEE)
+			{
+				// nothing identifies the old entry any more, it was
+				// this node before its IEEE address was known
+				nodeDrop(byNwk, node);
+			}
+		}
+		if (node->NwkAddr != NODE_REG_INVALID_NWK)
+		{
+			tableErase(&nwkTable, node->NwkAddr);
+			nodeRegStats.AddrChanges++;
+			dbg_print(PRINT_LEVEL_INFO, "nodeReg: %016llX moved %04X->%04X\n",
+			        (unsigned long long) node->IeeeAddr, node->NwkAddr,
+			        nwkAddr);
+		}
+		node->NwkAddr = nwkAddr;
+		tablePut(&nwkTable, nwkAddr, idx);
+	}
+
+	node->LastSeen = (uint32_t) time(NULL);
+
+	return node;
+}
+
+/*********************************************************************
+ * MT EVENT LISTENERS
+ */
+
+static void endDeviceAnnceIndCb(uint16_t event, void *data, void *arg)
+{
+	EndDeviceAnnceIndFormat_t *msg = data;
+	nodeRegNode_t *node;
+
+	pthread_mutex_lock(&nodeRegLock);
+	node = update(msg->NwkAddr, msg->IEEEAddr);
+	if (node)
+	{
+		node->Capabilities = msg->Capabilities;
+	}
+	pthread_mutex_unlock(&nodeRegLock);
+}
+
+static void nwkAddrRspCb(uint16_t event, void *data, void *arg)
+{
+	NwkAddrRspFormat_t *msg = data;
+
+	if (msg->Status == 0)
+	{
+		pthread_mutex_lock(&nodeRegLock);
+		update(msg->NwkAddr, msg->IEEEAddr);
+		pthread_mutex_unlock(&nodeRegLock);
+	}
+}
+
+static void ieeeAddrRspCb(uint16_t event, void *data, void *arg)
+{
+	IeeeAddrRspFormat_t *msg = data;
+
+	if (msg->Status == 0)
+	{
+		pthread_mutex_lock(&nodeRegLock);
+		update(msg->NwkAddr, msg->IEEEAddr);
+		pthread_mutex_unlock(&nodeRegLock);
+	}
+}
+
+static void leaveIndCb(uint16_t event, void *data, void *arg)
+{
+	LeaveIndFormat_t *msg = data;
+	nodeRegNode_t *node;
+
+	if (msg->Rejoin)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&nodeRegLock);
+	node = findIeee(msg->ExtAddr);
+	if (node == NULL)
+	{
+		node = findNwk(msg->SrcAddr);
+	}
+	if (node)
+	{
+		nodeDrop(node, NULL);
+	}
+	pthread_mutex_unlock(&nodeRegLock);
+}
+
+static const struct
+{
+	uint16_t Event;
+	mtEventCb_t Cb;
+} nodeRegListeners[] =
+{
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_END_DEVICE_ANNCE_IND),
+	        endDeviceAnnceIndCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_NWK_ADDR_RSP), nwkAddrRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_IEEE_ADDR_RSP), ieeeAddrRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_LEAVE_IND), leaveIndCb },
+};
+
+#define NODE_REG_LISTENERS \
+	(sizeof(nodeRegListeners) / sizeof(nodeRegListeners[0]))
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nodeRegInit
+ *
+ * @brief   allocates the registry and starts following the ZDO address
+ *          messages. Call before the MT callbacks are dispatched.
+ *
+ * @param   maxNodes - nodes to hold, 0 for NODE_REG_DEFAULT_NODES
+ *
+ * @return  0 on success, -1 if the memory was not allocated
+ */
+int32_t nodeRegInit(uint32_t maxNodes)
+{
+	uint32_t i;
+
+	if (maxNodes == 0)
+	{
+		maxNodes = NODE_REG_DEFAULT_NODES;
+	}
+
+	nodeRegClose();
+
+	pthread_mutex_lock(&nodeRegLock);
+	nodeRegNodes = calloc(maxNodes, sizeof(nodeRegNode_t));
+	nodeRegFree = malloc(maxNodes * sizeof(uint32_t));
+	if ((nodeRegNodes == NULL) || (nodeRegFree == NULL)
+	        || (tableInit(&nwkTable, maxNodes) != 0)
+	        || (tableInit(&ieeeTable, maxNodes) != 0))
+	{
+		pthread_mutex_unlock(&nodeRegLock);
+		dbg_print(PRINT_LEVEL_WARNING, "nodeRegInit: allocation failed\n");
+		nodeRegClose();
+		return -1;
+	}
+	nodeRegCapacity = maxNodes;
+	memset(&nodeRegStats, 0, sizeof(nodeRegStats));
+	pthread_mutex_unlock(&nodeRegLock);
+
+	for (i = 0; i < NODE_REG_LISTENERS; i++)
+	{
+		mtEventAddListener(nodeRegListeners[i].Event, nodeRegListeners[i].Cb,
+		        NULL, MT_EVENT_PRIO_DEFAULT);
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      nodeRegClose
+ *
+ * @brief   removes all nodes and frees the registry
+ *
+ * @return  none
+ */
+void nodeRegClose(void)
+{
+	uint32_t idx;
+
+	for (idx = 0; idx < NODE_REG_LISTENERS; idx++)
+	{
+		mtEventRemoveListener(nodeRegListeners[idx].Event,
+		        nodeRegListeners[idx].Cb, NULL);
+	}
+
+	pthread_mutex_lock(&nodeRegLock);
+	for (idx = 0; nodeRegNodes && (idx < nodeRegUsed); idx++)
+	{
+		if (nodeRegNodes[idx].InUse)
+		{
+			nodeDrop(&nodeRegNodes[idx], NULL);
+		}
+	}
+	free(nodeRegNodes);
+	free(nodeRegFree);
+	free(nwkTable.slots);
+	free(ieeeTable.slots);
+	nodeRegNodes = NULL;
+	nodeRegFree = NULL;
+	nwkTable.slots = NULL;
+	ieeeTable.slots = NULL;
+	nodeRegFreeCnt = 0;
+	nodeRegUsed = 0;
+	nodeRegCapacity = 0;
+	pthread_mutex_unlock(&nodeRegLock);
+}
+
+/*********************************************************************
+ * @fn      nodeRegFindNwk
+ *
+ * @brief   looks up a node by network address
+ *
+ * @param   nwkAddr - network address
+ *
+ * @return  node, NULL if not known
+ */
+nodeRegNode_t *nodeRegFindNwk(uint16_t nwkAddr)
+{
+	nodeRegNode_t *node = NULL;
+
+	pthread_mutex_lock(&nodeRegLock);
+	if (nodeRegNodes)
+	{
+		node = findNwk(nwkAddr);
+	}
+	pthread_mutex_unlock(&nodeRegLock);
+
+	return node;
+}
+
+/*********************************************************************
+ * @fn      nodeRegFindIeee
+ *
+ * @brief   looks up a node by IEEE address
+ *
+ * @param   ieeeAddr - IEEE address
+ *
+ * @return  node, NULL if not known
+ */
+nodeRegNode_t *nodeRegFindIeee(uint64_t ieeeAddr)
+{
+	nodeRegNode_t *node = NULL;
+
+	pthread_mutex_lock(&nodeRegLock);
+	if (nodeRegNodes)
+	{
+		node = findIeee(ieeeAddr);
+	}
+	pthread_mutex_unlock(&nodeRegLock);
+
+	return node;
+}
+
+/*********************************************************************
+ * @fn      nodeRegUpdate
+ *
+ * @brief   Adds a node or updates its addresses. Either address may be
+ *          unknown. A network address that moved to another node is
+ *          taken from the node that held it.
+ *
+ * @param   nwkAddr - network address, or NODE_REG_INVALID_NWK
+ * @param   ieeeAddr - IEEE address, or NODE_REG_INVALID_IEEE
+ *
+ * @return  node, NULL if the registry is full or no address is known
+ */
+nodeRegNode_t *nodeRegUpdate(uint16_t nwkAddr, uint64_t ieeeAddr)
+{
+	nodeRegNode_t *node = NULL;
+
+	pthread_mutex_lock(&nodeRegLock);
+	if (nodeRegNodes)
+	{
+		node = update(nwkAddr, ieeeAddr);
+	}
+	pthread_mutex_unlock(&nodeRegLock);
+
+	return node;
+}
+
+/*********************************************************************
+ * @fn      nodeRegRemove
+ *
+ * @brief   removes a node and frees its application state
+ *
+ * @param   node - node
+ *
+ * @return  none
+ */
+void nodeRegRemove(nodeRegNode_t *node)
+{
+	pthread_mutex_lock(&nodeRegLock);
+	if (node->InUse)
+	{
+		nodeDrop(node, NULL);
+	}
+	pthread_mutex_unlock(&nodeRegLock);
+}
+
+/*********************************************************************
+ * @fn      nodeRegNext
+ *
+ * @brief   iterates over the nodes
+ *
+ * @param   node - previous node, NULL to start
+ *
+ * @return  next node, NULL after the last one
+ */
+nodeRegNode_t *nodeRegNext(nodeRegNode_t *node)
+{
+	nodeRegNode_t *next = NULL;
+	uint32_t idx;
+
+	pthread_mutex_lock(&nodeRegLock);
+	idx = node ? (uint32_t) (node - nodeRegNodes) + 1 : 0;
+	for (; nodeRegNodes && (idx < nodeRegUsed); idx++)
+	{
+		if (nodeRegNodes[idx].InUse)
+		{
+			next = &nodeRegNodes[idx];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&nodeRegLock);
+
+	return next;
+}
+
+/*********************************************************************
+ * @fn      nodeRegCount
+ *
+ * @brief   number of nodes in the registry
+ *
+ * @return  node count
+ */
+uint32_t nodeRegCount(void)
+{
+	return nodeRegStats.Nodes;
+}
+
+/*********************************************************************
+ * @fn      nodeRegAllocSlot
+ *
+ * @brief   reserves an application state slot in every node
+ *
+ * @param   pfnFree - frees the state of a removed node, may be NULL
+ *
+ * @return  slot, NODE_REG_INVALID_SLOT if none is left
+ */
+uint8_t nodeRegAllocSlot(nodeRegFreeCb_t pfnFree)
+{
+	uint8_t slot = NODE_REG_INVALID_SLOT;
+
+	pthread_mutex_lock(&nodeRegLock);
+	if (nodeRegSlotCnt < NODE_REG_APP_SLOTS)
+	{
+		slot = nodeRegSlotCnt++;
+		nodeRegFreeCbs[slot] = pfnFree;
+	}
+	pthread_mutex_unlock(&nodeRegLock);
+
+	return slot;
+}
+
+/*********************************************************************
+ * @fn      nodeRegGetState
+ *
+ * @brief   reads the application state of a node
+ *
+ * @param   node - node
+ * @param   slot - slot from nodeRegAllocSlot()
+ *
+ * @return  state, NULL if none was set
+ */
+void *nodeRegGetState(nodeRegNode_t *node, uint8_t slot)
+{
+	if (slot >= NODE_REG_APP_SLOTS)
+	{
+		return NULL;
+	}
+
+	return node->AppState[slot];
+}
+
+/*********************************************************************
+ * @fn      nodeRegSetState
+ *
+ * @brief   sets the application state of a node
+ *
+ * @param   node - node
+ * @param   slot - slot from nodeRegAllocSlot()
+ * @param   state - state, freed with the slot's free callback when the
+ *          node is removed
+ *
+ * @return  none
+ */
+void nodeRegSetState(nodeRegNode_t *node, uint8_t slot, void *state)
+{
+	if (slot < NODE_REG_APP_SLOTS)
+	{
+		node->AppState[slot] = state;
+	}
+}
+
+/*********************************************************************
+ * @fn      nodeRegGetStats
+ *
+ * @brief   reads the registry statistics
+ *
+ * @param   stats - filled with the statistics
+ *
+ * @return  none
+ */
+void nodeRegGetStats(nodeRegStats_t *stats)
+{
+	pthread_mutex_lock(&nodeRegLock);
+	memcpy(stats, &nodeRegStats, sizeof(nodeRegStats_t));
+	stats->Capacity = nodeRegCapacity;
+	pthread_mutex_unlock(&nodeRegLock);
+}
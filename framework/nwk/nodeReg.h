@@ -0,0 +1,96 @@
+/*
+ * nodeReg.h
+ *
+ * This module contains the node registry, which maps the network and
+ * IEEE addresses of the nodes in the network to per node state.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef NODEREG_H
+#define NODEREG_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// number of nodes the registry holds when nodeRegInit() is passed 0
+#define NODE_REG_DEFAULT_NODES     (4096)
+
+// number of application state slots per node
+#define NODE_REG_APP_SLOTS         (4)
+
+// network address of a node whose short address is not known
+#define NODE_REG_INVALID_NWK       (0xFFFE)
+
+// IEEE address of a node whose extended address is not known
+#define NODE_REG_INVALID_IEEE      (0)
+
+// returned by nodeRegAllocSlot() when all slots are taken
+#define NODE_REG_INVALID_SLOT      (0xFF)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint64_t IeeeAddr;        // NODE_REG_INVALID_IEEE while unknown
+	uint16_t NwkAddr;         // NODE_REG_INVALID_NWK while unknown
+	uint8_t Capabilities;     // MAC capabilities from the device announce
+	uint8_t InUse;
+	uint32_t LastSeen;        // time() of the last address update
+	void *AppState[NODE_REG_APP_SLOTS];
+} nodeRegNode_t;
+
+typedef struct
+{
+	uint32_t Nodes;           // nodes in the registry
+	uint32_t Capacity;        // nodes the registry can hold
+	uint32_t Lookups;         // address lookups
+	uint32_t Probes;          // hash slots inspected by the lookups
+	uint32_t MaxProbe;        // longest probe sequence seen
+	uint32_t AddrChanges;     // network address changes of known nodes
+	uint32_t Full;            // nodes refused because the registry was full
+} nodeRegStats_t;
+
+// frees the application state of a node that is removed
+typedef void (*nodeRegFreeCb_t)(void *state);
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t nodeRegInit(uint32_t maxNodes);
+void nodeRegClose(void);
+
+nodeRegNode_t *nodeRegFindNwk(uint16_t nwkAddr);
+nodeRegNode_t *nodeRegFindIeee(uint64_t ieeeAddr);
+nodeRegNode_t *nodeRegUpdate(uint16_t nwkAddr, uint64_t ieeeAddr);
+void nodeRegRemove(nodeRegNode_t *node);
+nodeRegNode_t *nodeRegNext(nodeRegNode_t *node);
+uint32_t nodeRegCount(void);
+
+uint8_t nodeRegAllocSlot(nodeRegFreeCb_t pfnFree);
+void *nodeRegGetState(nodeRegNode_t *node, uint8_t slot);
+void nodeRegSetState(nodeRegNode_t *node, uint8_t slot, void *state);
+
+void nodeRegGetStats(nodeRegStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NODEREG_H */
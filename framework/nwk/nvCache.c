@@ -0,0 +1,555 @@
+/*
+ * nvCache.c
+ *
+ * This module contains the host side cache of ZNP NV items and the
+ * desired configuration profile API.
+ *
+ * Each NV item read or written through the cache costs at most one SREQ
+ * round trip, later reads are answered on the host and writes of an
+ * unchanged value are dropped. nvCacheApply() compares a profile against
+ * the ZNP, writes only the items that differ and resets the ZNP only if
+ * something was written.
+ *
+ * The cache is used from the application thread, like the MT API.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nvCache.h"
+#include "rpc.h"
+#include "mtSys.h"
+#include "mtEvent.h"
+#include "mtParser.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+	uint8_t valid;
+	nvItem_t item;
+} nvCacheEntry_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+extern uint8_t srspRpcBuff[RPC_MAX_LEN];
+
+static nvCacheEntry_t nvCache[NV_CACHE_ENTRIES];
+static uint8_t nvCacheNext;
+static nvCacheStats_t nvStats;
+static uint8_t nvResetInd;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowUs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in micro seconds
+ */
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*********************************************************************
+ * @fn      resetIndCb
+ *
+ * @brief   SYS reset indication listener, while nvCacheApply() waits
+ *
+ * @return  none
+ */
+static void resetIndCb(uint16_t event, void *data, void *arg)
+{
+	nvResetInd = 1;
+}
+
+/*********************************************************************
+ * @fn      findEntry
+ *
+ * @brief   looks up the cache entry of an item
+ *
+ * @param   id - NV item id
+ *
+ * @return  entry, NULL if the item is not cached
+ */
+static nvCacheEntry_t *findEntry(uint16_t id)
+{
+	uint32_t i;
+
+	for (i = 0; i < NV_CACHE_ENTRIES; i++)
+	{
+		if (nvCache[i].valid && (nvCache[i].item.Id == id))
+		{
+			return &nvCache[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      storeEntry
+ *
+ * @brief   stores the value of an item, replacing the oldest entry when
+ *          the cache is full
+ *
+ * @param   id - NV item id
+ * @param   value - item value
+ * @param   len - item length
+ *
+ * @return  -
+ */
+static void storeEntry(uint16_t id, uint8_t *value, uint8_t len)
+{
+	nvCacheEntry_t *entry = findEntry(id);
+	uint32_t i;
+
+	if (len > NV_CACHE_VALUE_LEN)
+	{
+		// too long to cache, make sure no stale copy survives
+		nvCacheInvalidate(id);
+		return;
+	}
+
+	for (i = 0; (entry == NULL) && (i < NV_CACHE_ENTRIES); i++)
+	{
+		if (!nvCache[i].valid)
+		{
+			entry = &nvCache[i];
+		}
+	}
+
+	if (entry == NULL)
+	{
+		entry = &nvCache[nvCacheNext];
+		nvCacheNext = (nvCacheNext + 1) % NV_CACHE_ENTRIES;
+	}
+
+	entry->item.Id = id;
+	entry->item.Len = len;
+	memcpy(entry->item.Value, value, len);
+	entry->valid = 1;
+}
+
+/*********************************************************************
+ * @fn      readZnp
+ *
+ * @brief   reads an item from the ZNP and caches it
+ *
+ * @param   id - NV item id
+ * @param   value - buffer for the value, at least 248 bytes
+ *
+ * @return  item length, -1 if the item does not exist or on error
+ */
+static int32_t readZnp(uint16_t id, uint8_t *value)
+{
+	OsalNvReadFormat_t req;
+	uint8_t status;
+
+	nvStats.Misses++;
+
+	req.Id = id;
+	req.Offset = 0;
+	srspRpcBuff[1] = 0;
+	status = sysOsalNvRead(&req);
+
+	// SRSP: Cmd0, Cmd1, Status, Len, Value
+	if ((status != MT_RPC_SUCCESS) || (srspRpcBuff[1] != MT_SYS_OSAL_NV_READ)
+	        || (srspRpcBuff[2] != MT_RPC_SUCCESS))
+	{
+		dbg_print(PRINT_LEVEL_INFO, "nvCache: read of item 0x%04X failed\n",
+		        id);
+		return -1;
+	}
+
+	memcpy(value, &srspRpcBuff[4], srspRpcBuff[3]);
+	storeEntry(id, value, srspRpcBuff[3]);
+
+	return srspRpcBuff[3];
+}
+
+/*********************************************************************
+ * API FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nvCacheRead
+ *
+ * @brief   reads an NV item, from the cache if possible
+ *
+ * @param   id - NV item id
+ * @param   value - buffer for the value
+ * @param   maxLen - size of value
+ *
+ * @return  number of bytes copied to value, -1 on error
+ */
+int32_t nvCacheRead(uint16_t id, uint8_t *value, uint8_t maxLen)
+{
+	nvCacheEntry_t *entry = findEntry(id);
+	uint8_t buf[256];
+	int32_t len;
+
+	if (entry != NULL)
+	{
+		nvStats.Hits++;
+		len = (entry->item.Len < maxLen) ? entry->item.Len : maxLen;
+		memcpy(value, entry->item.Value, len);
+		return len;
+	}
+
+	len = readZnp(id, buf);
+	if (len < 0)
+	{
+		return -1;
+	}
+
+	if (len > maxLen)
+	{
+		len = maxLen;
+	}
+	memcpy(value, buf, len);
+
+	return len;
+}
+
+/*********************************************************************
+ * @fn      nvCacheLength
+ *
+ * @brief   returns the length of an NV item, from the cache if possible
+ *
+ * @param   id - NV item id
+ *
+ * @return  item length, 0 if the item does not exist, -1 on error
+ */
+int32_t nvCacheLength(uint16_t id)
+{
+	nvCacheEntry_t *entry = findEntry(id);
+	OsalNvLengthFormat_t req;
+
+	if (entry != NULL)
+	{
+		nvStats.Hits++;
+		return entry->item.Len;
+	}
+
+	nvStats.Misses++;
+	req.Id = id;
+	srspRpcBuff[1] = 0;
+	if ((sysOsalNvLength(&req) != MT_RPC_SUCCESS)
+	        || (srspRpcBuff[1] != MT_SYS_OSAL_NV_LENGTH))
+	{
+		return -1;
+	}
+
+	return BUILD_UINT16(srspRpcBuff[2], srspRpcBuff[3]);
+}
+
+/*********************************************************************
+ * @fn      nvCacheWrite
+ *
+ * @brief   writes an NV item through the cache. The write is dropped if
+ *          the cached value is the same.
+ *
+ *          Writing ZCD_NV_STARTUP_OPTION with one of the clear bits set
+ *          invalidates the whole cache, as the ZNP restores its defaults
+ *          on the next reset.
+ *
+ * @param   id - NV item id
+ * @param   value - item value
+ * @param   len - item length
+ *
+ * @return  status
+ */
+uint8_t nvCacheWrite(uint16_t id, uint8_t *value, uint8_t len)
+{
+	nvCacheEntry_t *entry = findEntry(id);
+	OsalNvWriteFormat_t req;
+	uint8_t status;
+
+	if ((entry != NULL) && (entry->item.Len == len)
+	        && (memcmp(entry->item.Value, value, len) == 0))
+	{
+		nvStats.Skipped++;
+		return MT_RPC_SUCCESS;
+	}
+
+	if (len > sizeof(req.Value))
+	{
+		return MT_RPC_ERR_LENGTH;
+	}
+
+	req.Id = id;
+	req.Offset = 0;
+	req.Len = len;
+	memcpy(req.Value, value, len);
+
+	nvStats.Writes++;
+	srspRpcBuff[1] = 0;
+	status = sysOsalNvWrite(&req);
+	if ((status == MT_RPC_SUCCESS) && (srspRpcBuff[1] == MT_SYS_OSAL_NV_WRITE))
+	{
+		status = srspRpcBuff[2];
+	}
+
+	if (status != MT_RPC_SUCCESS)
+	{
+		dbg_print(PRINT_LEVEL_WARNING,
+		        "nvCache: write of item 0x%04X failed [%d]\n", id, status);
+		nvCacheInvalidate(id);
+		return status;
+	}
+
+	if ((id == ZCD_NV_STARTUP_OPTION) && (len > 0)
+	        && (value[0] & (ZCD_STARTOPT_CLEAR_CONFIG | ZCD_STARTOPT_CLEAR_STATE)))
+	{
+		nvCacheInvalidateAll();
+	}
+	else
+	{
+		storeEntry(id, value, len);
+	}
+
+	return MT_RPC_SUCCESS;
+}
+
+/*********************************************************************
+ * @fn      nvCacheInvalidate
+ *
+ * @brief   drops an item from the cache
+ *
+ * @param   id - NV item id
+ *
+ * @return  -
+ */
+void nvCacheInvalidate(uint16_t id)
+{
+	nvCacheEntry_t *entry = findEntry(id);
+
+	if (entry != NULL)
+	{
+		entry->valid = 0;
+	}
+}
+
+/*********************************************************************
+ * @fn      nvCacheInvalidateAll
+ *
+ * @brief   drops all items, e.g. after the ZNP was replaced or cleared
+ *
+ * @param   -
+ *
+ * @return  -
+ */
+void nvCacheInvalidateAll(void)
+{
+	memset(nvCache, 0, sizeof(nvCache));
+	nvCacheNext = 0;
+}
+
+/*********************************************************************
+ * @fn      nvCacheGetStats
+ *
+ * @brief   returns the cache statistics
+ *
+ * @param   stats - filled with the statistics
+ *
+ * @return  -
+ */
+void nvCacheGetStats(nvCacheStats_t *stats)
+{
+	memcpy(stats, &nvStats, sizeof(nvCacheStats_t));
+}
+
+/*********************************************************************
+ * @fn      nvProfileInit
+ *
+ * @brief   empties a configuration profile
+ *
+ * @param   profile - profile
+ *
+ * @return  -
+ */
+void nvProfileInit(nvProfile_t *profile)
+{
+	profile->Count = 0;
+}
+
+/*********************************************************************
+ * @fn      nvProfileAdd
+ *
+ * @brief   adds the desired value of an item to a profile
+ *
+ * @param   profile - profile
+ * @param   id - NV item id
+ * @param   value - desired value
+ * @param   len - length of value
+ *
+ * @return  0 on success, -1 if the profile is full or value too long
+ */
+int32_t nvProfileAdd(nvProfile_t *profile, uint16_t id, uint8_t *value,
+        uint8_t len)
+{
+	nvItem_t *item;
+
+	if ((profile->Count >= NV_PROFILE_MAX_ITEMS)
+	        || (len > NV_CACHE_VALUE_LEN))
+	{
+		return -1;
+	}
+
+	item = &profile->Items[profile->Count++];
+	item->Id = id;
+	item->Len = len;
+	memcpy(item->Value, value, len);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      nvProfileAddUint8
+ *
+ * @brief   adds a one byte item to a profile
+ *
+ * @return  0 on success, -1 if the profile is full
+ */
+int32_t nvProfileAddUint8(nvProfile_t *profile, uint16_t id, uint8_t value)
+{
+	return nvProfileAdd(profile, id, &value, 1);
+}
+
+/*********************************************************************
+ * @fn      nvProfileAddUint16
+ *
+ * @brief   adds a two byte item (little endian, as on the ZNP)
+ *
+ * @return  0 on success, -1 if the profile is full
+ */
+int32_t nvProfileAddUint16(nvProfile_t *profile, uint16_t id, uint16_t value)
+{
+	uint8_t buf[2];
+
+	buf[0] = LO_UINT16(value);
+	buf[1] = HI_UINT16(value);
+
+	return nvProfileAdd(profile, id, buf, 2);
+}
+
+/*********************************************************************
+ * @fn      nvProfileAddUint32
+ *
+ * @brief   adds a four byte item (little endian, as on the ZNP)
+ *
+ * @return  0 on success, -1 if the profile is full
+ */
+int32_t nvProfileAddUint32(nvProfile_t *profile, uint16_t id, uint32_t value)
+{
+	uint8_t buf[4];
+
+	buf[0] = BREAK_UINT32(value, 0);
+	buf[1] = BREAK_UINT32(value, 1);
+	buf[2] = BREAK_UINT32(value, 2);
+	buf[3] = BREAK_UINT32(value, 3);
+
+	return nvProfileAdd(profile, id, buf, 4);
+}
+
+/*********************************************************************
+ * @fn      nvCacheApply
+ *
+ * @brief   brings the ZNP to a configuration profile. All items are
+ *          read first (from the cache where possible), then only the
+ *          items that differ are written back to back. The ZNP is reset
+ *          only if an item was written.
+ *
+ * @param   profile - desired configuration
+ * @param   resetOnChange - 1 to soft reset the ZNP after writing
+ *
+ * @return  number of items written, -1 on error
+ */
+int32_t nvCacheApply(nvProfile_t *profile, uint8_t resetOnChange)
+{
+	uint8_t differs[NV_PROFILE_MAX_ITEMS];
+	uint8_t buf[NV_CACHE_VALUE_LEN];
+	int32_t written = 0;
+	int32_t len;
+	uint32_t i;
+
+	// diff pass, no writes yet so a read failure leaves the ZNP as it was
+	for (i = 0; i < profile->Count; i++)
+	{
+		nvItem_t *item = &profile->Items[i];
+
+		len = nvCacheRead(item->Id, buf, sizeof(buf));
+		differs[i] = (len != item->Len)
+		        || (memcmp(buf, item->Value, item->Len) != 0);
+	}
+
+	// write pass
+	for (i = 0; i < profile->Count; i++)
+	{
+		nvItem_t *item = &profile->Items[i];
+
+		if (!differs[i])
+		{
+			nvStats.Skipped++;
+			continue;
+		}
+
+		if (nvCacheWrite(item->Id, item->Value, item->Len) != MT_RPC_SUCCESS)
+		{
+			return -1;
+		}
+		written++;
+	}
+
+	dbg_print(PRINT_LEVEL_INFO, "nvCacheApply: %d of %d items written\n",
+	        written, profile->Count);
+
+	if ((written > 0) && resetOnChange)
+	{
+		ResetReqFormat_t resReq;
+		uint64_t deadline = nowUs() + (NV_CACHE_RESET_TIMEOUT_MS * 1000);
+		uint64_t now;
+
+		nvStats.Resets++;
+		nvResetInd = 0;
+		mtEventAddListener(MT_EVENT(MT_RPC_SYS_SYS, MT_SYS_RESET_IND),
+		        resetIndCb, NULL, MT_EVENT_PRIO_DEFAULT);
+		resReq.Type = 1;
+		sysResetReq(&resReq);
+
+		// other messages may come first, or the indication within sysResetReq
+		while (!nvResetInd && ((now = nowUs()) < deadline))
+		{
+			rpcWaitMqClientMsg((uint32_t) ((deadline - now + 999) / 1000));
+		}
+		mtEventRemoveListener(MT_EVENT(MT_RPC_SYS_SYS, MT_SYS_RESET_IND),
+		        resetIndCb, NULL);
+		if (!nvResetInd)
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "nvCacheApply: no reset"
+			        " indication\n");
+		}
+	}
+
+	return written;
+}
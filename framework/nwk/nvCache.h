@@ -0,0 +1,91 @@
+/*
+ * nvCache.h
+ *
+ * This module contains the host side cache of ZNP NV items and the
+ * desired configuration profile API.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef NVCACHE_H
+#define NVCACHE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// number of NV items the cache holds
+#define NV_CACHE_ENTRIES           (32)
+
+// largest item value that is cached, longer items pass through
+#define NV_CACHE_VALUE_LEN         (64)
+
+// number of items in a configuration profile
+#define NV_PROFILE_MAX_ITEMS       (16)
+
+// wait of nvCacheApply() for the reset indication
+#define NV_CACHE_RESET_TIMEOUT_MS  (5000)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint16_t Id;
+	uint8_t Len;
+	uint8_t Value[NV_CACHE_VALUE_LEN];
+} nvItem_t;
+
+// desired configuration, items are applied in the order they were added
+typedef struct
+{
+	uint8_t Count;
+	nvItem_t Items[NV_PROFILE_MAX_ITEMS];
+} nvProfile_t;
+
+typedef struct
+{
+	uint32_t Hits;      // reads answered from the cache
+	uint32_t Misses;    // reads that went to the ZNP
+	uint32_t Writes;    // writes sent to the ZNP
+	uint32_t Skipped;   // writes dropped because the value was unchanged
+	uint32_t Resets;    // ZNP resets issued by nvCacheApply
+} nvCacheStats_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t nvCacheRead(uint16_t id, uint8_t *value, uint8_t maxLen);
+int32_t nvCacheLength(uint16_t id);
+uint8_t nvCacheWrite(uint16_t id, uint8_t *value, uint8_t len);
+void nvCacheInvalidate(uint16_t id);
+void nvCacheInvalidateAll(void);
+void nvCacheGetStats(nvCacheStats_t *stats);
+
+void nvProfileInit(nvProfile_t *profile);
+int32_t nvProfileAdd(nvProfile_t *profile, uint16_t id, uint8_t *value,
+        uint8_t len);
+int32_t nvProfileAddUint8(nvProfile_t *profile, uint16_t id, uint8_t value);
+int32_t nvProfileAddUint16(nvProfile_t *profile, uint16_t id, uint16_t value);
+int32_t nvProfileAddUint32(nvProfile_t *profile, uint16_t id, uint32_t value);
+int32_t nvCacheApply(nvProfile_t *profile, uint8_t resetOnChange);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NVCACHE_H */
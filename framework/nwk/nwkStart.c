@@ -0,0 +1,538 @@
+/*
+ * nwkStart.c
+ *
+ * This module contains the network bring-up state machine, which takes
+ * the ZNP from reset to a joined or formed network.
+ *
+ * A new network clears the ZNP, writes the network parameters and
+ * starts the ZDO. A restored network only writes the NV items that
+ * differ from the desired profile, so an unchanged ZNP is started
+ * without a reset. The online phase ends on the ZDO state change
+ * indication rather than after a fixed wait. If a ZNP that was not
+ * reset does not come online, the bring-up retries once with a reset.
+ * Resets end on the SYS reset indication.
+ *
+ * The state machine runs in the application thread, the MT callbacks
+ * are dispatched while it waits for the ZNP.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nwkStart.h"
+#include "nvCache.h"
+#include "rpc.h"
+#include "mtAf.h"
+#include "mtZdo.h"
+#include "mtSys.h"
+#include "mtEvent.h"
+#include "mtParser.h"
+#include "hostConsole.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static const char *nwkStartStateNames[NWK_START_STATE_MAX] =
+{ "configure", "reset", "commission", "register", "init", "wait-online",
+        "finalize", "done", "failed" };
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowUs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in micro seconds
+ */
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*********************************************************************
+ * @fn      isOnline
+ *
+ * @brief   checks whether a ZDO state is the online state of the
+ *          logical type the ZNP starts as
+ *
+ * @param   ctx - bring-up context
+ *
+ * @return  1 if online, else 0
+ */
+static uint8_t isOnline(nwkStart_t *ctx)
+{
+	switch (ctx->DevType)
+	{
+	case DEVICETYPE_COORDINATOR:
+		return (ctx->DevState == DEV_ZB_COORD);
+	case DEVICETYPE_ROUTER:
+		return (ctx->DevState == DEV_ROUTER);
+	case DEVICETYPE_ENDDEVICE:
+		return (ctx->DevState == DEV_END_DEVICE);
+	default:
+		return (ctx->DevState == DEV_ZB_COORD)
+		        || (ctx->DevState == DEV_ROUTER)
+		        || (ctx->DevState == DEV_END_DEVICE);
+	}
+}
+
+/*********************************************************************
+ * @fn      stateChangeCb
+ *
+ * @brief   ZDO state change listener
+ *
+ * @param   data - new ZDO state
+ * @param   arg - bring-up context
+ *
+ * @return  none
+ */
+static void stateChangeCb(uint16_t event, void *data, void *arg)
+{
+	nwkStart_t *ctx = arg;
+	uint8_t zdoState = *(uint8_t *) data;
+
+	ctx->DevState = zdoState;
+	dbg_print(PRINT_LEVEL_INFO, "nwkStart: ZDO state %d\n", zdoState);
+}
+
+/*********************************************************************
+ * @fn      resetIndCb
+ *
+ * @brief   SYS reset indication listener
+ *
+ * @param   data - reset indication
+ * @param   arg - bring-up context
+ *
+ * @return  none
+ */
+static void resetIndCb(uint16_t event, void *data, void *arg)
+{
+	nwkStart_t *ctx = arg;
+
+	ctx->ResetInd = 1;
+}
+
+/*********************************************************************
+ * @fn      configure
+ *
+ * @brief   writes the startup option, a new network clears the ZNP and
+ *          always needs a reset, a restored one only if the NV changed
+ *
+ * @param   ctx - bring-up context
+ *
+ * @return  next state
+ */
+static nwkStartState_t configure(nwkStart_t *ctx)
+{
+	nvProfile_t profile;
+	uint8_t startupOption;
+	uint8_t devType;
+	int32_t written;
+
+	if (ctx->Cfg.NewNetwork)
+	{
+		startupOption = ZCD_STARTOPT_CLEAR_STATE | ZCD_STARTOPT_CLEAR_CONFIG;
+		if (nvCacheWrite(ZCD_NV_STARTUP_OPTION, &startupOption, 1)
+		        != MT_RPC_SUCCESS)
+		{
+			return NWK_START_FAILED;
+		}
+		return NWK_START_RESET;
+	}
+
+	// the logical type decides which ZDO state counts as online
+	if ((ctx->DevType == NWK_START_DEVTYPE_NV)
+	        && (nvCacheRead(ZCD_NV_LOGICAL_TYPE, &devType, 1) == 1))
+	{
+		ctx->DevType = devType;
+	}
+
+	nvProfileInit(&profile);
+	nvProfileAddUint8(&profile, ZCD_NV_STARTUP_OPTION, 0);
+	written = nvCacheApply(&profile, 0);
+	if (written < 0)
+	{
+		return NWK_START_FAILED;
+	}
+	if (written > 0)
+	{
+		return NWK_START_RESET;
+	}
+
+	ctx->ResetSkipped = 1;
+	return NWK_START_REGISTER;
+}
+
+/*********************************************************************
+ * @fn      reset
+ *
+ * @brief   soft resets the ZNP and waits for the reset indication
+ *
+ * @param   ctx - bring-up context
+ *
+ * @return  next state
+ */
+static nwkStartState_t reset(nwkStart_t *ctx)
+{
+	ResetReqFormat_t resReq;
+	uint64_t deadline = nowUs() + (NWK_START_RESET_TIMEOUT_MS * 1000);
+	uint64_t now;
+
+	consolePrint("Resetting ZNP\n");
+	ctx->ResetInd = 0;
+	resReq.Type = 1;
+	sysResetReq(&resReq);
+
+	// the reset indication may already have been dispatched by sysResetReq
+	while (!ctx->ResetInd && ((now = nowUs()) < deadline))
+	{
+		rpcWaitMqClientMsg((uint32_t) ((deadline - now + 999) / 1000));
+	}
+	if (!ctx->ResetInd)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "nwkStart: no reset indication\n");
+	}
+
+	ctx->ResetDone = 1;
+	ctx->ResetSkipped = 0;
+	ctx->DevState = DEV_HOLD;
+
+	return ctx->Cfg.NewNetwork ? NWK_START_COMMISSION : NWK_START_REGISTER;
+}
+
+/*********************************************************************
+ * @fn      commission
+ *
+ * @brief   writes the network parameters of a new network
+ *
+ * @param   ctx - bring-up context
+ *
+ * @return  next state
+ */
+static nwkStartState_t commission(nwkStart_t *ctx)
+{
+	nvProfile_t profile;
+
+	nvProfileInit(&profile);
+	if (ctx->Cfg.DevType != NWK_START_DEVTYPE_NV)
+	{
+		nvProfileAddUint8(&profile, ZCD_NV_LOGICAL_TYPE, ctx->Cfg.DevType);
+	}
+	nvProfileAddUint16(&profile, ZCD_NV_PANID, ctx->Cfg.PanId);
+	nvProfileAddUint32(&profile, ZCD_NV_CHANLIST, ctx->Cfg.ChanList);
+
+	if (nvCacheApply(&profile, 0) < 0)
+	{
+		return NWK_START_FAILED;
+	}
+
+	return NWK_START_REGISTER;
+}
+
+/*********************************************************************
+ * @fn      registerEndpoints
+ *
+ * @brief   registers the AF endpoints
+ *
+ * @param   ctx - bring-up context
+ *
+ * @return  next state
+ */
+static nwkStartState_t registerEndpoints(nwkStart_t *ctx)
+{
+	uint8_t i;
+
+	for (i = 0; i < ctx->Cfg.EndpointCount; i++)
+	{
+		if (afRegister(&ctx->Cfg.Endpoints[i]) != MT_RPC_SUCCESS)
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "nwkStart: afRegister %d failed\n",
+			        ctx->Cfg.Endpoints[i].EndPoint);
+			return NWK_START_FAILED;
+		}
+		consolePrint("EndPoint: %d\n", ctx->Cfg.Endpoints[i].EndPoint);
+	}
+
+	return NWK_START_INIT;
+}
+
+/*********************************************************************
+ * @fn      init
+ *
+ * @brief   starts the ZDO
+ *
+ * @param   ctx - bring-up context
+ *
+ * @return  next state
+ */
+static nwkStartState_t init(nwkStart_t *ctx)
+{
+	uint8_t status;
+
+	status = zdoInit();
+	if (status == NEW_NETWORK)
+	{
+		dbg_print(PRINT_LEVEL_INFO, "zdoInit NEW_NETWORK\n");
+		ctx->Restored = 0;
+	}
+	else if (status == RESTORED_NETWORK)
+	{
+		dbg_print(PRINT_LEVEL_INFO, "zdoInit RESTORED_NETWORK\n");
+		consolePrint("Network Restored\n");
+		ctx->Restored = 1;
+	}
+	else
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "zdoInit failed\n");
+		return NWK_START_FAILED;
+	}
+
+	return NWK_START_WAIT_ONLINE;
+}
+
+/*********************************************************************
+ * @fn      waitOnline
+ *
+ * @brief   dispatches MT messages until the ZDO state change reports
+ *          the ZNP online or the timeout expires
+ *
+ * @param   ctx - bring-up context
+ *
+ * @return  next state
+ */
+static nwkStartState_t waitOnline(nwkStart_t *ctx)
+{
+	uint32_t timeoutMs = ctx->Cfg.TimeoutMs ?
+	        ctx->Cfg.TimeoutMs : NWK_START_TIMEOUT_MS;
+	uint64_t deadline = nowUs() + ((uint64_t) timeoutMs * 1000);
+	uint64_t now;
+
+	while (!isOnline(ctx) && ((now = nowUs()) < deadline))
+	{
+		rpcWaitMqClientMsg((uint32_t) ((deadline - now + 999) / 1000));
+	}
+
+	if (isOnline(ctx))
+	{
+		return NWK_START_FINALIZE;
+	}
+
+	// a ZNP that was started without a reset gets one more try
+	if (!ctx->ResetDone)
+	{
+		dbg_print(PRINT_LEVEL_WARNING,
+		        "nwkStart: not online without reset, retrying\n");
+		return NWK_START_RESET;
+	}
+
+	dbg_print(PRINT_LEVEL_WARNING, "nwkStart: timeout in ZDO state %d\n",
+	        ctx->DevState);
+	return NWK_START_FAILED;
+}
+
+/*********************************************************************
+ * @fn      finalize
+ *
+ * @brief   sets the startup option back so a later reset keeps the
+ *          network
+ *
+ * @param   ctx - bring-up context
+ *
+ * @return  next state
+ */
+static nwkStartState_t finalize(nwkStart_t *ctx)
+{
+	uint8_t startupOption = 0;
+
+	if (nvCacheWrite(ZCD_NV_STARTUP_OPTION, &startupOption, 1)
+	        != MT_RPC_SUCCESS)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "nwkStart: setNVStartup failed\n");
+		return NWK_START_FAILED;
+	}
+
+	return NWK_START_DONE;
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nwkStartInit
+ *
+ * @brief   prepares a bring-up, the ZDO state listener stays installed
+ *          until the bring-up ends
+ *
+ * @param   ctx - bring-up context
+ * @param   cfg - desired network configuration
+ *
+ * @return  none
+ */
+void nwkStartInit(nwkStart_t *ctx, nwkStartCfg_t *cfg)
+{
+	memset(ctx, 0, sizeof(nwkStart_t));
+	memcpy(&ctx->Cfg, cfg, sizeof(nwkStartCfg_t));
+	if (ctx->Cfg.EndpointCount > NWK_START_MAX_ENDPOINTS)
+	{
+		ctx->Cfg.EndpointCount = NWK_START_MAX_ENDPOINTS;
+	}
+	ctx->State = NWK_START_CONFIGURE;
+	ctx->DevType = cfg->DevType;
+	ctx->DevState = DEV_HOLD;
+
+	mtEventAddListener(MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_STATE_CHANGE_IND),
+	        stateChangeCb, ctx, MT_EVENT_PRIO_DEFAULT);
+	mtEventAddListener(MT_EVENT(MT_RPC_SYS_SYS, MT_SYS_RESET_IND),
+	        resetIndCb, ctx, MT_EVENT_PRIO_DEFAULT);
+}
+
+/*********************************************************************
+ * @fn      nwkStartStep
+ *
+ * @brief   runs the current phase and moves to the next one
+ *
+ * @param   ctx - bring-up context
+ *
+ * @return  new state
+ */
+nwkStartState_t nwkStartStep(nwkStart_t *ctx)
+{
+	nwkStartState_t state = ctx->State;
+	nwkStartState_t next;
+	uint64_t start;
+
+	if ((state == NWK_START_DONE) || (state == NWK_START_FAILED))
+	{
+		return state;
+	}
+
+	start = nowUs();
+	switch (state)
+	{
+	case NWK_START_CONFIGURE:
+		next = configure(ctx);
+		break;
+	case NWK_START_RESET:
+		next = reset(ctx);
+		break;
+	case NWK_START_COMMISSION:
+		next = commission(ctx);
+		break;
+	case NWK_START_REGISTER:
+		next = registerEndpoints(ctx);
+		break;
+	case NWK_START_INIT:
+		next = init(ctx);
+		break;
+	case NWK_START_WAIT_ONLINE:
+		next = waitOnline(ctx);
+		break;
+	case NWK_START_FINALIZE:
+		next = finalize(ctx);
+		break;
+	default:
+		next = NWK_START_FAILED;
+		break;
+	}
+	ctx->PhaseUs[state] += nowUs() - start;
+	ctx->TotalUs += nowUs() - start;
+
+	dbg_print(PRINT_LEVEL_INFO, "nwkStart: %s -> %s\n",
+	        nwkStartStateNames[state], nwkStartStateNames[next]);
+
+	ctx->State = next;
+	if ((next == NWK_START_DONE) || (next == NWK_START_FAILED))
+	{
+		mtEventRemoveListener(MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_STATE_CHANGE_IND),
+		        stateChangeCb, ctx);
+		mtEventRemoveListener(MT_EVENT(MT_RPC_SYS_SYS, MT_SYS_RESET_IND),
+		        resetIndCb, ctx);
+	}
+
+	return next;
+}
+
+/*********************************************************************
+ * @fn      nwkStartRun
+ *
+ * @brief   runs the bring-up to completion
+ *
+ * @param   ctx - bring-up context, set up with nwkStartInit()
+ *
+ * @return  0 if the ZNP is online, -1 on failure
+ */
+int32_t nwkStartRun(nwkStart_t *ctx)
+{
+	nwkStartState_t state;
+
+	do
+	{
+		state = nwkStartStep(ctx);
+	} while ((state != NWK_START_DONE) && (state != NWK_START_FAILED));
+
+	return (state == NWK_START_DONE) ? 0 : -1;
+}
+
+/*********************************************************************
+ * @fn      nwkStartStateName
+ *
+ * @brief   names a bring-up state
+ *
+ * @param   state - bring-up state
+ *
+ * @return  state name
+ */
+const char *nwkStartStateName(nwkStartState_t state)
+{
+	if (state >= NWK_START_STATE_MAX)
+	{
+		return "unknown";
+	}
+
+	return nwkStartStateNames[state];
+}
+
+/*********************************************************************
+ * @fn      nwkStartPrintTimes
+ *
+ * @brief   prints the time spent in each phase
+ *
+ * @param   ctx - bring-up context
+ *
+ * @return  none
+ */
+void nwkStartPrintTimes(nwkStart_t *ctx)
+{
+	uint32_t i;
+
+	consolePrint("Network bring-up %s, %s network%s:\n",
+	        nwkStartStateNames[ctx->State],
+	        ctx->Restored ? "restored" : "new",
+	        ctx->ResetSkipped ? ", reset skipped" : "");
+	for (i = 0; i < NWK_START_DONE; i++)
+	{
+		if (ctx->PhaseUs[i])
+		{
+			consolePrint("  %-12s %8.3f ms\n", nwkStartStateNames[i],
+			        ctx->PhaseUs[i] / 1000.0);
+		}
+	}
+	consolePrint("  %-12s %8.3f ms\n", "total", ctx->TotalUs / 1000.0);
+}
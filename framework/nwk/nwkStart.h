@@ -0,0 +1,101 @@
+/*
+ * nwkStart.h
+ *
+ * This module contains the network bring-up state machine, which takes
+ * the ZNP from reset to a joined or formed network.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef NWKSTART_H
+#define NWKSTART_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+#include "mtAf.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// DevType value that keeps the logical type stored in the ZNP NV
+#define NWK_START_DEVTYPE_NV       (0xFF)
+
+// number of AF endpoints registered during bring-up
+#define NWK_START_MAX_ENDPOINTS    (4)
+
+// time allowed for the ZNP to come online when TimeoutMs is 0
+#define NWK_START_TIMEOUT_MS       (30000)
+
+// time allowed for the reset indication after a ZNP reset
+#define NWK_START_RESET_TIMEOUT_MS (5000)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// bring-up phases, in the order they run
+typedef enum
+{
+	NWK_START_CONFIGURE,     // startup option and NV profile
+	NWK_START_RESET,         // ZNP soft reset, skipped if the NV is unchanged
+	NWK_START_COMMISSION,    // network parameters of a new network
+	NWK_START_REGISTER,      // AF endpoint registration
+	NWK_START_INIT,          // ZDO startup from app
+	NWK_START_WAIT_ONLINE,   // waiting for the ZDO state change
+	NWK_START_FINALIZE,      // startup option restored
+	NWK_START_DONE,
+	NWK_START_FAILED,
+	NWK_START_STATE_MAX
+} nwkStartState_t;
+
+typedef struct
+{
+	uint8_t NewNetwork;      // 1 to clear the ZNP and form or join a new network
+	uint8_t DevType;         // DEVICETYPE_* or NWK_START_DEVTYPE_NV
+	uint16_t PanId;          // new network only, 0xFFFF for any
+	uint32_t ChanList;       // new network only
+	uint32_t TimeoutMs;      // time allowed for the ZNP to come online
+	uint8_t EndpointCount;
+	RegisterFormat_t Endpoints[NWK_START_MAX_ENDPOINTS];
+} nwkStartCfg_t;
+
+typedef struct
+{
+	nwkStartCfg_t Cfg;
+	nwkStartState_t State;
+	uint8_t DevType;         // logical type the ZNP starts as
+	uint8_t DevState;        // last ZDO state reported by the ZNP
+	uint8_t Restored;        // zdoInit() reported RESTORED_NETWORK
+	uint8_t ResetDone;       // a ZNP reset was issued
+	uint8_t ResetSkipped;    // NV was unchanged so the reset was skipped
+	uint8_t ResetInd;        // SYS reset indication seen since the last reset
+	uint64_t PhaseUs[NWK_START_STATE_MAX];
+	uint64_t TotalUs;
+} nwkStart_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+void nwkStartInit(nwkStart_t *ctx, nwkStartCfg_t *cfg);
+nwkStartState_t nwkStartStep(nwkStart_t *ctx);
+int32_t nwkStartRun(nwkStart_t *ctx);
+const char *nwkStartStateName(nwkStartState_t state);
+void nwkStartPrintTimes(nwkStart_t *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NWKSTART_H */
@@ -0,0 +1,941 @@
+/*
+ * otaServer.c
+ *
+ * This module contains the OTA upgrade server, which serves the image
+ * blocks the ZNP asks for over MT_OTA from memory mapped OTA files, to
+ * many clients at once and at a limited rate.
+ *
+ * The OTA files are mapped read only and the blocks are sent straight
+ * from the mapping, so the clients downloading the same image share its
+ * pages: the pages ahead of the leading client are advised to be read
+ * in, the clients behind it find them resident. Every client has a
+ * session with a block cursor. MaxActive sessions download at once, the
+ * other clients are told no image is available and come back at their
+ * next query. The blocks are served at RateBps so the upgrade leaves
+ * room for the application traffic, the requests over the rate wait in
+ * a ring and those over the ring are told to wait for data.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "otaServer.h"
+#include "nodeReg.h"
+#include "rpc.h"
+#include "mtOta.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// OTA file header
+#define OTA_FILE_MAGIC             (0x0BEEF11E)
+#define OTA_HDR_MIN_LEN            (56)
+#define OTA_HDR_FC_SECURITY        (0x0001)
+#define OTA_HDR_FC_DESTINATION     (0x0002)
+#define OTA_HDR_FC_HW_VERSIONS     (0x0004)
+
+// manufacturer code of the images for all manufacturers
+#define OTA_WILDCARD_MANUFACTURER  (0xFFFF)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+// server receiving the OTA requests, the callbacks have no context
+static otaServer_t *activeOta;
+static pthread_mutex_t activeLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowUs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in micro seconds
+ */
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/*********************************************************************
+ * @fn      nodeGet
+ *
+ * @brief   looks up the session of a client, adding it if not known
+ *
+ * @param   ctx - server
+ * @param   addr - client address from the ZNP
+ *
+ * @return  session, NULL for a 64 bit address the registry does not
+ *          know or if the memory was not allocated
+ */
+static otaServerNode_t *nodeGet(otaServer_t *ctx, OtaAddrFormat_t *addr)
+{
+	otaServerNode_t *node;
+	uint16_t nwkAddr;
+
+	if (addr->AddrMode == OTA_ADDR_64BIT)
+	{
+		uint64_t ieeeAddr = 0;
+		nodeRegNode_t *reg;
+		int32_t i;
+
+		for (i = 7; i >= 0; i--)
+		{
+			ieeeAddr = (ieeeAddr << 8) | addr->Addr[i];
+		}
+		reg = nodeRegFindIeee(ieeeAddr);
+		if ((reg == NULL) || (reg->NwkAddr == NODE_REG_INVALID_NWK))
+		{
+			return NULL;
+		}
+		nwkAddr = reg->NwkAddr;
+	}
+	else
+	{
+		nwkAddr = get16(addr->Addr);
+	}
+
+	if (ctx->NodeIndex[nwkAddr])
+	{
+		return &ctx->Nodes[ctx->NodeIndex[nwkAddr] - 1];
+	}
+	if (ctx->NodeCount == ctx->NodeAlloc)
+	{
+		uint32_t newAlloc = ctx->NodeAlloc ? (ctx->NodeAlloc * 2) : 64;
+		void *p = realloc(ctx->Nodes, newAlloc * sizeof(otaServerNode_t));
+
+		if (p == NULL)
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "otaServer: allocation failed\n");
+			return NULL;
+		}
+		ctx->Nodes = p;
+		ctx->NodeAlloc = newAlloc;
+	}
+
+	node = &ctx->Nodes[ctx->NodeCount];
+	memset(node, 0, sizeof(otaServerNode_t));
+	node->NwkAddr = nwkAddr;
+	ctx->NodeIndex[nwkAddr] = ++ctx->NodeCount;
+
+	return node;
+}
+
+/*********************************************************************
+ * @fn      imageFind
+ *
+ * @brief   looks up the image of a file ID
+ *
+ * @return  image index, -1 if not held
+ */
+static int32_t imageFind(otaServer_t *ctx, OtaFileIdFormat_t *fileId)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctx->ImageCount; i++)
+	{
+		otaServerImage_t *img = &ctx->Images[i];
+
+		if ((img->FileId.Manufacturer == fileId->Manufacturer)
+		        && (img->FileId.ImageType == fileId->ImageType)
+		        && (img->FileId.FileVersion == fileId->FileVersion))
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*********************************************************************
+ * @fn      imageNext
+ *
+ * @brief   picks the newest image for a client
+ *
+ * @return  image index, -1 if none is newer than what the client runs
+ */
+static int32_t imageNext(otaServer_t *ctx, OtaNextImgReqFormat_t *req)
+{
+	int32_t best = -1;
+	uint32_t i;
+
+	for (i = 0; i < ctx->ImageCount; i++)
+	{
+		otaServerImage_t *img = &ctx->Images[i];
+
+		if (((img->FileId.Manufacturer != req->FileId.Manufacturer)
+		        && (img->FileId.Manufacturer != OTA_WILDCARD_MANUFACTURER))
+		        || (img->FileId.ImageType != req->FileId.ImageType)
+		        || (img->FileId.FileVersion <= req->FileId.FileVersion))
+		{
+			continue;
+		}
+		if (img->HwVersions && (req->Option & OTA_NEXT_IMG_HW_VERSION)
+		        && ((req->HwVersion < img->MinHwVersion)
+		                || (req->HwVersion > img->MaxHwVersion)))
+		{
+			continue;
+		}
+		if ((best < 0) || (img->FileId.FileVersion
+		        > ctx->Images[best].FileId.FileVersion))
+		{
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+/*********************************************************************
+ * @fn      sessionEnd
+ *
+ * @brief   ends the download of a client, with the lock held
+ */
+static void sessionEnd(otaServer_t *ctx, otaServerNode_t *node, uint8_t state)
+{
+	if (node->State == OTA_SERVER_NODE_DOWNLOADING)
+	{
+		ctx->Stats.Active--;
+	}
+	node->State = state;
+	node->DoneMs = nowUs() / 1000;
+}
+
+/*********************************************************************
+ * @fn      sessionStart
+ *
+ * @brief   starts the download of an image by a client if a session is
+ *          free, with the lock held
+ *
+ * @return  1 if the client downloads, 0 if the sessions are full
+ */
+static uint8_t sessionStart(otaServer_t *ctx, otaServerNode_t *node,
+        uint8_t image)
+{
+	if (node->State != OTA_SERVER_NODE_DOWNLOADING)
+	{
+		if (ctx->Stats.Active >= ctx->Cfg.MaxActive)
+		{
+			return 0;
+		}
+		ctx->Stats.Active++;
+		if (ctx->Stats.Active > ctx->Stats.PeakActive)
+		{
+			ctx->Stats.PeakActive = ctx->Stats.Active;
+		}
+		ctx->Stats.Offered++;
+	}
+	node->State = OTA_SERVER_NODE_DOWNLOADING;
+	node->Image = image;
+	node->Offset = 0;
+	node->StartMs = nowUs() / 1000;
+	node->LastMs = node->StartMs;
+	node->DoneMs = 0;
+
+	return 1;
+}
+
+/*********************************************************************
+ * @fn      refill
+ *
+ * @brief   adds the tokens earned since the last refill, with the lock
+ *          held
+ */
+static void refill(otaServer_t *ctx, uint64_t now)
+{
+	uint64_t max = (uint64_t) ctx->Cfg.BurstBytes * 1000;
+
+	ctx->Tokens += (now - ctx->RefillUs) * ctx->Cfg.RateBps / 1000;
+	if (ctx->Tokens > max)
+	{
+		ctx->Tokens = max;
+	}
+	ctx->RefillUs = now;
+}
+
+/*********************************************************************
+ * @fn      prefetch
+ *
+ * @brief   advises the kernel to read the pages ahead of a block once
+ *          the leading client gets near the end of those read ahead,
+ *          with the lock held
+ */
+static void prefetch(otaServer_t *ctx, otaServerImage_t *img, uint32_t end)
+{
+	long pageSize = sysconf(_SC_PAGESIZE);
+	uint32_t start, len;
+
+	if ((img->Prefetched >= img->Size)
+	        || (end + (OTA_SERVER_PREFETCH / 2) < img->Prefetched))
+	{
+		return;
+	}
+	start = img->Prefetched - (img->Prefetched % pageSize);
+	len = OTA_SERVER_PREFETCH;
+	if (start + len > img->MapSize)
+	{
+		len = img->MapSize - start;
+	}
+	madvise((void *) (img->Data + start), len, MADV_WILLNEED);
+	img->Prefetched = start + len;
+	ctx->Stats.Prefetched += len;
+}
+
+/*********************************************************************
+ * @fn      blockServe
+ *
+ * @brief   fills the response of a block request and moves the cursor
+ *          of the client, with the lock held
+ *
+ * @param   ctx - server
+ * @param   req - block request
+ * @param   rsp - response to send once the lock is released
+ *
+ * @return  none
+ */
+static void blockServe(otaServer_t *ctx, OtaFileReadReqFormat_t *req,
+        OtaFileReadRspFormat_t *rsp)
+{
+	otaServerImage_t *img;
+	otaServerNode_t *node;
+	int32_t image = imageFind(ctx, &req->FileId);
+	uint32_t end;
+
+	memset(rsp, 0, sizeof(OtaFileReadRspFormat_t));
+	rsp->FileId = req->FileId;
+	rsp->Addr = req->Addr;
+	rsp->Offset = req->Offset;
+	if ((image < 0) || (req->Offset >= ctx->Images[image].Size))
+	{
+		rsp->Status = OTA_ABORT;
+		ctx->Stats.Aborts++;
+		return;
+	}
+	img = &ctx->Images[image];
+
+	rsp->Status = OTA_SUCCESS;
+	rsp->Len = (req->Len < OTA_MAX_DATA_LEN) ? req->Len : OTA_MAX_DATA_LEN;
+	if (rsp->Len > img->Size - req->Offset)
+	{
+		rsp->Len = img->Size - req->Offset;
+	}
+	rsp->Data = img->Data + req->Offset;
+	end = req->Offset + rsp->Len;
+	prefetch(ctx, img, end);
+
+	ctx->Stats.Blocks++;
+	ctx->Stats.Bytes += rsp->Len;
+	ctx->SecondBytes += rsp->Len;
+
+	node = nodeGet(ctx, &req->Addr);
+	if (node == NULL)
+	{
+		return;
+	}
+	node->Blocks++;
+	node->LastMs = nowUs() / 1000;
+	if (req->Offset < node->Offset)
+	{
+		node->Repeats++;
+		ctx->Stats.Repeats++;
+	}
+	else
+	{
+		node->Offset = end;
+	}
+	if ((end == img->Size) && (node->State == OTA_SERVER_NODE_DOWNLOADING))
+	{
+		sessionEnd(ctx, node, OTA_SERVER_NODE_DOWNLOADED);
+		ctx->Stats.Downloaded++;
+	}
+}
+
+/*********************************************************************
+ * @fn      pendingPush
+ *
+ * @brief   queues a request over the rate, with the lock held
+ *
+ * @return  0 if queued, -1 if the ring is full
+ */
+static int32_t pendingPush(otaServer_t *ctx, OtaFileReadReqFormat_t *req)
+{
+	if (ctx->PendingCount == ctx->Cfg.MaxPending)
+	{
+		return -1;
+	}
+	ctx->Pending[(ctx->PendingHead + ctx->PendingCount) % ctx->Cfg.MaxPending] =
+	        *req;
+	ctx->PendingCount++;
+	if (ctx->PendingCount > ctx->Stats.PeakPending)
+	{
+		ctx->Stats.PeakPending = ctx->PendingCount;
+	}
+	ctx->Stats.Queued++;
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      blockCost
+ *
+ * @brief   tokens a request takes
+ */
+static uint64_t blockCost(OtaFileReadReqFormat_t *req)
+{
+	return (uint64_t) ((req->Len < OTA_MAX_DATA_LEN) ?
+	        req->Len : OTA_MAX_DATA_LEN) * 1000;
+}
+
+/*********************************************************************
+ * CALLBACKS
+ */
+
+static uint8_t otaNextImgReqCb(OtaNextImgReqFormat_t *msg)
+{
+	otaServer_t *ctx;
+	otaServerNode_t *node;
+	OtaNextImgRspFormat_t rsp;
+	int32_t image;
+
+	pthread_mutex_lock(&activeLock);
+	ctx = activeOta;
+	if (ctx == NULL)
+	{
+		pthread_mutex_unlock(&activeLock);
+		return 0;
+	}
+	pthread_mutex_lock(&ctx->Lock);
+	pthread_mutex_unlock(&activeLock);
+
+	memset(&rsp, 0, sizeof(rsp));
+	rsp.Status = OTA_NO_IMAGE_AVAILABLE;
+	rsp.Addr = msg->Addr;
+	rsp.Option = msg->Option;
+	rsp.FileId = msg->FileId;
+
+	ctx->Stats.Queries++;
+	image = imageNext(ctx, msg);
+	node = nodeGet(ctx, &msg->Addr);
+	if (node)
+	{
+		node->RunVersion = msg->FileId.FileVersion;
+	}
+	if (image < 0)
+	{
+		if (node && (node->State == OTA_SERVER_NODE_DOWNLOADED))
+		{
+			// the client runs the image it downloaded
+			sessionEnd(ctx, node, OTA_SERVER_NODE_UPGRADED);
+			ctx->Stats.Upgraded++;
+		}
+		else if (node && (node->State != OTA_SERVER_NODE_UPGRADED))
+		{
+			sessionEnd(ctx, node, OTA_SERVER_NODE_IDLE);
+		}
+	}
+	else if (node && !sessionStart(ctx, node, image))
+	{
+		node->State = OTA_SERVER_NODE_DEFERRED;
+		ctx->Stats.Deferred++;
+	}
+	else
+	{
+		rsp.Status = OTA_SUCCESS;
+		rsp.FileId = ctx->Images[image].FileId;
+		rsp.ImageSize = ctx->Images[image].Size;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	otaNextImgRsp(&rsp);
+
+	return 0;
+}
+
+static uint8_t otaFileReadReqCb(OtaFileReadReqFormat_t *msg)
+{
+	otaServer_t *ctx;
+	otaServerNode_t *node;
+	OtaFileReadRspFormat_t rsp;
+	int32_t image;
+
+	pthread_mutex_lock(&activeLock);
+	ctx = activeOta;
+	if (ctx == NULL)
+	{
+		pthread_mutex_unlock(&activeLock);
+		return 0;
+	}
+	pthread_mutex_lock(&ctx->Lock);
+	pthread_mutex_unlock(&activeLock);
+
+	ctx->Stats.Requests++;
+	memset(&rsp, 0, sizeof(rsp));
+	rsp.FileId = msg->FileId;
+	rsp.Addr = msg->Addr;
+	rsp.Offset = msg->Offset;
+	rsp.Status = OTA_WAIT_FOR_DATA;
+
+	// a client downloading since before the server started, or back from
+	// a stall, takes a session. A last block asked again needs none.
+	image = imageFind(ctx, &msg->FileId);
+	node = nodeGet(ctx, &msg->Addr);
+	if (node && (image >= 0) && (node->State != OTA_SERVER_NODE_DOWNLOADING)
+	        && (node->State != OTA_SERVER_NODE_DOWNLOADED)
+	        && (node->State != OTA_SERVER_NODE_UPGRADED)
+	        && !sessionStart(ctx, node, image))
+	{
+		ctx->Stats.Waits++;
+	}
+	else
+	{
+		refill(ctx, nowUs());
+		if ((ctx->PendingCount == 0) && (ctx->Tokens >= blockCost(msg)))
+		{
+			ctx->Tokens -= blockCost(msg);
+			blockServe(ctx, msg, &rsp);
+		}
+		else if (pendingPush(ctx, msg) == 0)
+		{
+			pthread_mutex_unlock(&ctx->Lock);
+			return 0;
+		}
+		else
+		{
+			ctx->Stats.Waits++;
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	otaFileReadRsp(&rsp);
+
+	return 0;
+}
+
+static uint8_t otaStatusIndCb(OtaStatusIndFormat_t *msg)
+{
+	otaServer_t *ctx;
+	OtaAddrFormat_t addr;
+	otaServerNode_t *node;
+
+	pthread_mutex_lock(&activeLock);
+	ctx = activeOta;
+	if (ctx == NULL)
+	{
+		pthread_mutex_unlock(&activeLock);
+		return 0;
+	}
+	pthread_mutex_lock(&ctx->Lock);
+	pthread_mutex_unlock(&activeLock);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.AddrMode = OTA_ADDR_16BIT;
+	addr.Addr[0] = msg->ShortAddr & 0xFF;
+	addr.Addr[1] = (msg->ShortAddr >> 8) & 0xFF;
+	node = nodeGet(ctx, &addr);
+	if (node && (msg->Type == OTA_STATUS_DL_COMPLETE))
+	{
+		if (msg->Status == OTA_SUCCESS)
+		{
+			if (node->State != OTA_SERVER_NODE_UPGRADED)
+			{
+				sessionEnd(ctx, node, OTA_SERVER_NODE_UPGRADED);
+				ctx->Stats.Upgraded++;
+			}
+		}
+		else
+		{
+			dbg_print(PRINT_LEVEL_WARNING,
+			        "otaServer: 0x%04X failed its upgrade, status 0x%02X\n",
+			        msg->ShortAddr, msg->Status);
+			sessionEnd(ctx, node, OTA_SERVER_NODE_FAILED);
+			ctx->Stats.Failed++;
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      otaServerInit
+ *
+ * @brief   initializes a server and registers its OTA callbacks
+ *
+ * @param   ctx - server
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 if the memory was not allocated
+ */
+int32_t otaServerInit(otaServer_t *ctx, otaServerCfg_t *cfg)
+{
+	mtOtaCb_t cbs;
+
+	memset(ctx, 0, sizeof(otaServer_t));
+	memcpy(&ctx->Cfg, cfg, sizeof(otaServerCfg_t));
+	if (ctx->Cfg.RateBps == 0)
+	{
+		ctx->Cfg.RateBps = OTA_SERVER_RATE_BPS;
+	}
+	if (ctx->Cfg.BurstBytes == 0)
+	{
+		ctx->Cfg.BurstBytes = ctx->Cfg.RateBps / 4;
+	}
+	if (ctx->Cfg.BurstBytes < OTA_MAX_DATA_LEN)
+	{
+		ctx->Cfg.BurstBytes = OTA_MAX_DATA_LEN;
+	}
+	if (ctx->Cfg.MaxActive == 0)
+	{
+		ctx->Cfg.MaxActive = OTA_SERVER_MAX_ACTIVE;
+	}
+	if ((ctx->Cfg.MaxPending == 0)
+	        || (ctx->Cfg.MaxPending > OTA_SERVER_PENDING_MAX))
+	{
+		ctx->Cfg.MaxPending = (ctx->Cfg.MaxPending == 0) ?
+		        OTA_SERVER_MAX_PENDING : OTA_SERVER_PENDING_MAX;
+	}
+	if (ctx->Cfg.SessionTimeoutMs == 0)
+	{
+		ctx->Cfg.SessionTimeoutMs = OTA_SERVER_SESSION_TIMEOUT_MS;
+	}
+
+	ctx->NodeIndex = calloc(65536, sizeof(uint32_t));
+	ctx->Pending = malloc(ctx->Cfg.MaxPending * sizeof(OtaFileReadReqFormat_t));
+	if ((ctx->NodeIndex == NULL) || (ctx->Pending == NULL))
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "otaServerInit: allocation failed\n");
+		free(ctx->NodeIndex);
+		free(ctx->Pending);
+		return -1;
+	}
+	ctx->RefillUs = nowUs();
+	ctx->SecondUs = ctx->RefillUs;
+	ctx->Tokens = (uint64_t) ctx->Cfg.BurstBytes * 1000;
+	pthread_mutex_init(&ctx->Lock, NULL);
+
+	pthread_mutex_lock(&activeLock);
+	activeOta = ctx;
+	pthread_mutex_unlock(&activeLock);
+
+	memset(&cbs, 0, sizeof(mtOtaCb_t));
+	cbs.pfnOtaNextImgReq = otaNextImgReqCb;
+	cbs.pfnOtaFileReadReq = otaFileReadReqCb;
+	cbs.pfnOtaStatusInd = otaStatusIndCb;
+	otaRegisterCallbacks(cbs);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      otaServerClose
+ *
+ * @brief   stops the server receiving requests and unmaps the images
+ *
+ * @param   ctx - server
+ *
+ * @return  none
+ */
+void otaServerClose(otaServer_t *ctx)
+{
+	mtOtaCb_t cbs;
+	uint32_t i;
+
+	pthread_mutex_lock(&activeLock);
+	if (activeOta == ctx)
+	{
+		memset(&cbs, 0, sizeof(mtOtaCb_t));
+		otaRegisterCallbacks(cbs);
+		activeOta = NULL;
+	}
+	pthread_mutex_unlock(&activeLock);
+
+	for (i = 0; i < ctx->ImageCount; i++)
+	{
+		munmap((void *) ctx->Images[i].Data, ctx->Images[i].MapSize);
+	}
+	free(ctx->Nodes);
+	free(ctx->NodeIndex);
+	free(ctx->Pending);
+	pthread_mutex_destroy(&ctx->Lock);
+	memset(ctx, 0, sizeof(otaServer_t));
+}
+
+/*********************************************************************
+ * @fn      otaServerAddImage
+ *
+ * @brief   maps an OTA upgrade file and offers it to the clients of its
+ *          manufacturer and image type running an older version
+ *
+ * @param   ctx - server
+ * @param   path - OTA file
+ *
+ * @return  0 on success, -1 if the file is not a valid OTA file or the
+ *          server holds OTA_SERVER_MAX_IMAGES
+ */
+int32_t otaServerAddImage(otaServer_t *ctx, const char *path)
+{
+	otaServerImage_t img;
+	const uint8_t *hdr;
+	struct stat st;
+	uint16_t hdrLen, fc, pos;
+	int fd;
+
+	memset(&img, 0, sizeof(img));
+	fd = open(path, O_RDONLY);
+	if ((fd < 0) || (fstat(fd, &st) != 0) || (st.st_size < OTA_HDR_MIN_LEN))
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "otaServer: cannot read %s\n", path);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "otaServer: cannot map %s\n", path);
+		return -1;
+	}
+	img.Data = hdr;
+	img.MapSize = st.st_size;
+
+	hdrLen = get16(&hdr[6]);
+	fc = get16(&hdr[8]);
+	img.FileId.Manufacturer = get16(&hdr[10]);
+	img.FileId.ImageType = get16(&hdr[12]);
+	img.FileId.FileVersion = get32(&hdr[14]);
+	img.Size = get32(&hdr[52]);
+	pos = OTA_HDR_MIN_LEN;
+	pos += (fc & OTA_HDR_FC_SECURITY) ? 1 : 0;
+	pos += (fc & OTA_HDR_FC_DESTINATION) ? 8 : 0;
+	if ((fc & OTA_HDR_FC_HW_VERSIONS) && (pos + 4 <= hdrLen)
+	        && (pos + 4 <= st.st_size))
+	{
+		img.HwVersions = 1;
+		img.MinHwVersion = get16(&hdr[pos]);
+		img.MaxHwVersion = get16(&hdr[pos + 2]);
+	}
+
+	if ((get32(hdr) != OTA_FILE_MAGIC) || (hdrLen < OTA_HDR_MIN_LEN)
+	        || (img.Size < hdrLen) || (img.Size > st.st_size))
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "otaServer: %s is not an OTA file\n",
+		        path);
+		munmap((void *) hdr, st.st_size);
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->Lock);
+	if ((ctx->ImageCount == OTA_SERVER_MAX_IMAGES)
+	        || (imageFind(ctx, &img.FileId) >= 0))
+	{
+		pthread_mutex_unlock(&ctx->Lock);
+		dbg_print(PRINT_LEVEL_ERROR, "otaServer: %s not added\n", path);
+		munmap((void *) hdr, st.st_size);
+		return -1;
+	}
+	ctx->Images[ctx->ImageCount++] = img;
+	pthread_mutex_unlock(&ctx->Lock);
+
+	dbg_print(PRINT_LEVEL_INFO,
+	        "otaServer: %s, manufacturer 0x%04X type 0x%04X version 0x%08X, %u bytes\n",
+	        path, img.FileId.Manufacturer, img.FileId.ImageType,
+	        img.FileId.FileVersion, img.Size);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      otaServerPoll
+ *
+ * @brief   serves the requests that waited for the rate, ends the
+ *          downloads that stalled and updates the bytes per second.
+ *          The requests are answered when the MT callbacks are
+ *          dispatched.
+ *
+ * @param   ctx - server
+ *
+ * @return  none
+ */
+void otaServerPoll(otaServer_t *ctx)
+{
+	OtaFileReadRspFormat_t rsp;
+	uint64_t now = nowUs();
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+	refill(ctx, now);
+	while (ctx->PendingCount
+	        && (ctx->Tokens >= blockCost(&ctx->Pending[ctx->PendingHead])))
+	{
+		OtaFileReadReqFormat_t *req = &ctx->Pending[ctx->PendingHead];
+
+		ctx->Tokens -= blockCost(req);
+		blockServe(ctx, req, &rsp);
+		ctx->PendingHead = (ctx->PendingHead + 1) % ctx->Cfg.MaxPending;
+		ctx->PendingCount--;
+
+		pthread_mutex_unlock(&ctx->Lock);
+		otaFileReadRsp(&rsp);
+		pthread_mutex_lock(&ctx->Lock);
+	}
+
+	if (now - ctx->SecondUs >= 1000000)
+	{
+		uint64_t nowMs = now / 1000;
+
+		ctx->Stats.BytesPerSec = (ctx->SecondBytes * 1000000)
+		        / (now - ctx->SecondUs);
+		ctx->SecondBytes = 0;
+		ctx->SecondUs = now;
+
+		for (i = 0; i < ctx->NodeCount; i++)
+		{
+			otaServerNode_t *node = &ctx->Nodes[i];
+
+			if ((node->State == OTA_SERVER_NODE_DOWNLOADING)
+			        && (nowMs - node->LastMs >= ctx->Cfg.SessionTimeoutMs))
+			{
+				dbg_print(PRINT_LEVEL_WARNING,
+				        "otaServer: 0x%04X stalled at %u bytes\n",
+				        node->NwkAddr, node->Offset);
+				sessionEnd(ctx, node, OTA_SERVER_NODE_STALLED);
+				ctx->Stats.Stalled++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      otaServerGetNode
+ *
+ * @brief   copies the session of a client
+ *
+ * @param   ctx - server
+ * @param   nwkAddr - network address
+ * @param   node - copy of the session
+ *
+ * @return  0 on success, -1 if the client never asked the server
+ */
+int32_t otaServerGetNode(otaServer_t *ctx, uint16_t nwkAddr,
+        otaServerNode_t *node)
+{
+	int32_t status = -1;
+
+	pthread_mutex_lock(&ctx->Lock);
+	if (ctx->NodeIndex[nwkAddr])
+	{
+		*node = ctx->Nodes[ctx->NodeIndex[nwkAddr] - 1];
+		status = 0;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return status;
+}
+
+/*********************************************************************
+ * @fn      otaServerPrintProgress
+ *
+ * @brief   prints a line per client with its download progress
+ *
+ * @param   ctx - server
+ * @param   out - stream
+ *
+ * @return  none
+ */
+void otaServerPrintProgress(otaServer_t *ctx, FILE *out)
+{
+	uint64_t nowMs = nowUs() / 1000;
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+	for (i = 0; i < ctx->NodeCount; i++)
+	{
+		otaServerNode_t *node = &ctx->Nodes[i];
+		uint32_t size = ctx->Images[node->Image].Size;
+		uint64_t ms;
+
+		if (node->StartMs == 0)
+		{
+			fprintf(out, "0x%04X %-11s version 0x%08X\n", node->NwkAddr,
+			        otaServerNodeStateName(node->State), node->RunVersion);
+			continue;
+		}
+		ms = (node->DoneMs ? node->DoneMs : nowMs) - node->StartMs;
+		fprintf(out, "0x%04X %-11s %3u%% %7u/%u bytes %5llu bytes/s "
+		        "%u repeats\n", node->NwkAddr,
+		        otaServerNodeStateName(node->State),
+		        (uint32_t) (((uint64_t) node->Offset * 100) / size),
+		        node->Offset, size,
+		        (unsigned long long) (ms ? (node->Offset * 1000ULL) / ms : 0),
+		        node->Repeats);
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      otaServerNodeStateName
+ *
+ * @brief   names an OTA_SERVER_NODE_* state
+ */
+const char *otaServerNodeStateName(uint8_t state)
+{
+	switch (state)
+	{
+	case OTA_SERVER_NODE_IDLE:
+		return "idle";
+	case OTA_SERVER_NODE_DEFERRED:
+		return "deferred";
+	case OTA_SERVER_NODE_DOWNLOADING:
+		return "downloading";
+	case OTA_SERVER_NODE_DOWNLOADED:
+		return "downloaded";
+	case OTA_SERVER_NODE_UPGRADED:
+		return "upgraded";
+	case OTA_SERVER_NODE_FAILED:
+		return "failed";
+	case OTA_SERVER_NODE_STALLED:
+		return "stalled";
+	default:
+		return "unknown";
+	}
+}
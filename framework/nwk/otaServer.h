@@ -0,0 +1,165 @@
+/*
+ * otaServer.h
+ *
+ * This module contains the OTA upgrade server, which serves the image
+ * blocks the ZNP asks for over MT_OTA from memory mapped OTA files, to
+ * many clients at once and at a limited rate.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef OTASERVER_H
+#define OTASERVER_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "mtOta.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// defaults used for the otaServerCfg_t fields left 0
+#define OTA_SERVER_RATE_BPS        (4000)
+#define OTA_SERVER_MAX_ACTIVE      (32)
+#define OTA_SERVER_MAX_PENDING     (32)
+#define OTA_SERVER_SESSION_TIMEOUT_MS (60000)
+
+// upper bound of OTA_SERVER_MAX_PENDING
+#define OTA_SERVER_PENDING_MAX     (256)
+
+// images the server holds
+#define OTA_SERVER_MAX_IMAGES      (16)
+
+// image bytes read ahead of the leading client
+#define OTA_SERVER_PREFETCH        (64 * 1024)
+
+// otaServerNode_t State
+#define OTA_SERVER_NODE_IDLE       (0) // queried, no newer image
+#define OTA_SERVER_NODE_DEFERRED   (1) // an image waits for a free session
+#define OTA_SERVER_NODE_DOWNLOADING (2)
+#define OTA_SERVER_NODE_DOWNLOADED (3) // last block served
+#define OTA_SERVER_NODE_UPGRADED   (4) // the client reported success
+#define OTA_SERVER_NODE_FAILED     (5) // the client reported a failure
+#define OTA_SERVER_NODE_STALLED    (6) // no block asked within the timeout
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint32_t RateBps;         // image bytes served per second
+	uint32_t BurstBytes;      // bytes saved up while idle, RateBps / 4 if 0
+	uint16_t MaxActive;       // downloads at once, others are deferred
+	uint16_t MaxPending;      // block requests waiting for the rate
+	uint32_t SessionTimeoutMs; // time without a block before a download stalls
+} otaServerCfg_t;
+
+typedef struct
+{
+	OtaFileIdFormat_t FileId;
+	uint32_t Size;            // total image size, header included
+	uint8_t HwVersions;       // the header bounds the hardware versions
+	uint16_t MinHwVersion;
+	uint16_t MaxHwVersion;
+	const uint8_t *Data;      // the mapped file
+	size_t MapSize;
+	uint32_t Prefetched;      // bytes advised to be read ahead
+} otaServerImage_t;
+
+typedef struct
+{
+	uint16_t NwkAddr;
+	uint8_t State;            // OTA_SERVER_NODE_*
+	uint8_t Image;            // index in Images of the download
+	uint32_t RunVersion;      // file version the client reported
+	uint32_t Offset;          // block cursor, image bytes served in order
+	uint32_t Blocks;          // blocks served
+	uint32_t Repeats;         // blocks served again
+	uint64_t StartMs;
+	uint64_t LastMs;          // last block request
+	uint64_t DoneMs;
+} otaServerNode_t;
+
+typedef struct
+{
+	uint32_t Queries;         // MT_OTA_NEXT_IMG_REQ received
+	uint32_t Offered;         // downloads started
+	uint32_t Deferred;        // queries told no image while sessions were full
+	uint32_t Requests;        // MT_OTA_FILE_READ_REQ received
+	uint32_t Blocks;          // blocks served
+	uint32_t Repeats;         // blocks served again to a client
+	uint32_t Queued;          // requests that waited for the rate
+	uint32_t Waits;           // requests told to wait for data
+	uint32_t Aborts;          // requests for an unknown image or offset
+	uint32_t Downloaded;
+	uint32_t Upgraded;
+	uint32_t Failed;
+	uint32_t Stalled;
+	uint32_t Active;          // downloads in progress
+	uint32_t PeakActive;
+	uint32_t PeakPending;
+	uint64_t Bytes;           // image bytes served
+	uint32_t BytesPerSec;     // over the last second
+	uint64_t Prefetched;      // bytes advised to be read ahead
+} otaServerStats_t;
+
+typedef struct
+{
+	otaServerCfg_t Cfg;
+	pthread_mutex_t Lock;
+
+	otaServerImage_t Images[OTA_SERVER_MAX_IMAGES];
+	uint32_t ImageCount;
+
+	otaServerNode_t *Nodes;
+	uint32_t NodeCount;
+	uint32_t NodeAlloc;
+	uint32_t *NodeIndex;      // network address to node index + 1
+
+	OtaFileReadReqFormat_t *Pending; // ring of the requests over the rate
+	uint32_t PendingHead;
+	uint32_t PendingCount;
+
+	// token bucket of the rate, in thousandths of a byte
+	uint64_t Tokens;
+	uint64_t RefillUs;
+
+	uint64_t SecondUs;        // start of the second BytesPerSec is counted on
+	uint64_t SecondBytes;
+	otaServerStats_t Stats;
+} otaServer_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t otaServerInit(otaServer_t *ctx, otaServerCfg_t *cfg);
+void otaServerClose(otaServer_t *ctx);
+int32_t otaServerAddImage(otaServer_t *ctx, const char *path);
+void otaServerPoll(otaServer_t *ctx);
+
+int32_t otaServerGetNode(otaServer_t *ctx, uint16_t nwkAddr,
+        otaServerNode_t *node);
+void otaServerPrintProgress(otaServer_t *ctx, FILE *out);
+const char *otaServerNodeStateName(uint8_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OTASERVER_H */
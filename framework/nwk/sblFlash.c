@@ -0,0 +1,1019 @@
+/*
+ * sblFlash.c
+ *
+ * This module contains the firmware flasher, which loads an Intel HEX
+ * image and programs it through the serial bootloader of the ZNP.
+ *
+ * The image is cut into blocks of the bootloader buffer length, only
+ * in the pages the file gives data for. The first block of a page is
+ * always written since it erases the page, the other blocks only if
+ * the file has data in them. The blocks are streamed with several
+ * WRITE commands in flight: the bootloader answers in order, so the
+ * window grows by one block each time a full window is answered, up to
+ * the configured maximum. A timeout or a failed block means the
+ * bootloader could not take that many: the maximum drops below the
+ * window, the window halves, the late answers drain and the pass
+ * restarts from the first block of the page, since that block erases
+ * what followed it. The window so settles at the largest one the
+ * bootloader buffers. The blocks are then read back the same way and
+ * compared, and ENABLE makes the bootloader check the CRC of the image.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sblFlash.h"
+#include "rpc.h"
+#include "mtSbl.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define BIT_GET(map, bit)          ((map)[(bit) >> 3] & (1 << ((bit) & 7)))
+#define BIT_SET(map, bit)          ((map)[(bit) >> 3] |= (1 << ((bit) & 7)))
+
+// MT dispatch wait of sblFlashRun() between polls
+#define SBL_FLASH_POLL_MS          (10)
+
+// the ENABLE check of the CRC reads the whole flash
+#define SBL_FLASH_ENABLE_TIMEOUTS  (10)
+
+// sblFlash_t Phase
+#define SBL_PHASE_IDLE             (0)
+#define SBL_PHASE_HANDSHAKE        (1)
+#define SBL_PHASE_WRITE            (2)
+#define SBL_PHASE_VERIFY           (3)
+#define SBL_PHASE_ENABLE           (4)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+// flasher receiving the SBL responses, the callbacks have no context
+static sblFlash_t *activeFlash;
+static pthread_mutex_t activeLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowUs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in micro seconds
+ */
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*********************************************************************
+ * @fn      hexByte
+ *
+ * @brief   decodes two hex digits
+ *
+ * @return  byte value, -1 if the digits are not hex
+ */
+static int32_t hexByte(const char *p)
+{
+	int32_t val = 0;
+	uint8_t i;
+
+	for (i = 0; i < 2; i++)
+	{
+		val <<= 4;
+		if ((p[i] >= '0') && (p[i] <= '9'))
+		{
+			val |= p[i] - '0';
+		}
+		else if ((p[i] >= 'A') && (p[i] <= 'F'))
+		{
+			val |= p[i] - 'A' + 10;
+		}
+		else if ((p[i] >= 'a') && (p[i] <= 'f'))
+		{
+			val |= p[i] - 'a' + 10;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+
+	return val;
+}
+
+/*********************************************************************
+ * @fn      parseHex
+ *
+ * @brief   walks the records of an Intel HEX file. The first pass finds
+ *          the span of the data, the second copies it into the image.
+ *
+ * @param   image - image, Base and Size set by the first pass
+ * @param   text - file contents
+ * @param   size - file size
+ * @param   fill - 0 for the first pass, 1 for the second
+ *
+ * @return  0 on success, -1 if the file is not valid
+ */
+static int32_t parseHex(sblImage_t *image, const char *text, size_t size,
+        uint8_t fill)
+{
+	uint8_t rec[5 + 255];
+	uint32_t upper = 0, low = 0xFFFFFFFF, high = 0;
+	uint32_t line = 0;
+	size_t pos = 0;
+	uint32_t i, count, addr;
+
+	while (pos < size)
+	{
+		int32_t b;
+
+		if ((text[pos] == '\r') || (text[pos] == '\n') || (text[pos] == ' '))
+		{
+			line += (text[pos] == '\n');
+			pos++;
+			continue;
+		}
+		if ((text[pos] != ':') || (pos + 11 > size))
+		{
+			dbg_print(PRINT_LEVEL_ERROR, "sblImage: line %u is not a record\n",
+			        line + 1);
+			return -1;
+		}
+		pos++;
+
+		// count, address, type, data and checksum
+		b = hexByte(&text[pos]);
+		count = (b < 0) ? 0 : (uint32_t) b + 5;
+		if ((b < 0) || (pos + (count * 2) > size))
+		{
+			dbg_print(PRINT_LEVEL_ERROR, "sblImage: line %u is truncated\n",
+			        line + 1);
+			return -1;
+		}
+		for (i = 0; i < count; i++)
+		{
+			b = hexByte(&text[pos + (i * 2)]);
+			if (b < 0)
+			{
+				dbg_print(PRINT_LEVEL_ERROR,
+				        "sblImage: line %u has a bad digit\n", line + 1);
+				return -1;
+			}
+			rec[i] = (uint8_t) b;
+		}
+		pos += count * 2;
+
+		b = 0;
+		for (i = 0; i < count; i++)
+		{
+			b += rec[i];
+		}
+		if (b & 0xFF)
+		{
+			dbg_print(PRINT_LEVEL_ERROR, "sblImage: line %u checksum error\n",
+			        line + 1);
+			return -1;
+		}
+
+		switch (rec[3])
+		{
+		case 0x00:
+			// data
+			addr = upper + (((uint32_t) rec[1] << 8) | rec[2]);
+			if (fill)
+			{
+				for (i = 0; i < rec[0]; i++)
+				{
+					uint32_t off = addr + i - image->Base;
+
+					if (!BIT_GET(image->Used, off))
+					{
+						BIT_SET(image->Used, off);
+						image->UsedBytes++;
+					}
+					image->Data[off] = rec[4 + i];
+				}
+			}
+			else if (rec[0])
+			{
+				low = (addr < low) ? addr : low;
+				high = (addr + rec[0] > high) ? addr + rec[0] : high;
+			}
+			break;
+		case 0x01:
+			// end of file
+			pos = size;
+			break;
+		case 0x02:
+			// extended segment address
+			upper = (((uint32_t) rec[4] << 8) | rec[5]) << 4;
+			break;
+		case 0x04:
+			// extended linear address
+			upper = (((uint32_t) rec[4] << 8) | rec[5]) << 16;
+			break;
+		default:
+			// start addresses
+			break;
+		}
+	}
+
+	if (!fill)
+	{
+		if (high == 0)
+		{
+			dbg_print(PRINT_LEVEL_ERROR, "sblImage: no data\n");
+			return -1;
+		}
+		if (high - low > SBL_IMAGE_MAX_SIZE)
+		{
+			dbg_print(PRINT_LEVEL_ERROR,
+			        "sblImage: data spans 0x%08X-0x%08X, more than %u bytes\n",
+			        low, high, SBL_IMAGE_MAX_SIZE);
+			return -1;
+		}
+		image->Base = low;
+		image->Size = high - low;
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rangeUsed
+ *
+ * @brief   tells whether the file gives data in a range of the flash
+ */
+static uint8_t rangeUsed(sblImage_t *image, uint32_t addr, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		uint32_t off = addr + i - image->Base;
+
+		if ((addr + i >= image->Base) && (off < image->Size)
+		        && BIT_GET(image->Used, off))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      blockData
+ *
+ * @brief   copies the image bytes of a block, 0xFF outside the image
+ */
+static void blockData(sblImage_t *image, sblFlashBlock_t *block,
+        uint8_t *data)
+{
+	uint32_t i;
+
+	for (i = 0; i < block->Len; i++)
+	{
+		uint32_t addr = block->Address + i;
+
+		data[i] = ((addr >= image->Base) && (addr - image->Base < image->Size)) ?
+		        image->Data[addr - image->Base] : 0xFF;
+	}
+}
+
+/*********************************************************************
+ * @fn      buildBlocks
+ *
+ * @brief   cuts the pages the image has data for into blocks
+ *
+ * @return  0 on success, -1 if the memory was not allocated
+ */
+static int32_t buildBlocks(sblFlash_t *ctx)
+{
+	sblImage_t *image = ctx->Image;
+	uint32_t pageSize = ctx->Stats.PageSize;
+	uint32_t bufLen = ctx->Stats.BufferLength;
+	uint32_t first = (image->Base / pageSize) * pageSize;
+	uint32_t page, off;
+
+	free(ctx->Blocks);
+	ctx->BlockCount = 0;
+	ctx->Blocks = malloc(
+	        (((image->Size + (2 * pageSize)) / bufLen) + 1)
+	                * sizeof(sblFlashBlock_t));
+	if (ctx->Blocks == NULL)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "sblFlash: allocation failed\n");
+		return -1;
+	}
+
+	for (page = first; page < image->Base + image->Size; page += pageSize)
+	{
+		uint32_t pageFirst = ctx->BlockCount;
+
+		if (!rangeUsed(image, page, pageSize))
+		{
+			continue;
+		}
+		ctx->Stats.Pages++;
+		for (off = 0; off < pageSize; off += bufLen)
+		{
+			if ((off == 0) || rangeUsed(image, page + off, bufLen))
+			{
+				sblFlashBlock_t *block = &ctx->Blocks[ctx->BlockCount++];
+
+				block->Address = page + off;
+				block->Len = bufLen;
+				block->PageFirst = pageFirst;
+				block->Tries = 0;
+				block->Bad = 0;
+			}
+		}
+	}
+	ctx->Stats.Blocks = ctx->BlockCount;
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      repairBlocks
+ *
+ * @brief   keeps only the pages with a block read back different, the
+ *          pages are written again from their first block
+ *
+ * @return  pages kept
+ */
+static uint32_t repairBlocks(sblFlash_t *ctx)
+{
+	uint32_t i, j, count = 0, pages = 0;
+
+	for (i = 0; i < ctx->BlockCount; i = j)
+	{
+		uint8_t bad = 0;
+
+		for (j = i; (j < ctx->BlockCount) && (ctx->Blocks[j].PageFirst == i);
+		        j++)
+		{
+			bad |= ctx->Blocks[j].Bad;
+		}
+		if (!bad)
+		{
+			continue;
+		}
+		pages++;
+		for (; i < j; i++)
+		{
+			ctx->Blocks[count] = ctx->Blocks[i];
+			ctx->Blocks[count].PageFirst = count - (i - ctx->Blocks[i].PageFirst);
+			count++;
+		}
+	}
+	ctx->BlockCount = count;
+
+	return pages;
+}
+
+/*********************************************************************
+ * @fn      blockAnswered
+ *
+ * @brief   moves the pipeline past the oldest block, with the lock held
+ */
+static void blockAnswered(sblFlash_t *ctx)
+{
+	ctx->Acked++;
+	ctx->WindowAcks++;
+	if ((ctx->WindowAcks >= ctx->Window) && (ctx->Window < ctx->WindowMax))
+	{
+		ctx->Window++;
+		ctx->WindowAcks = 0;
+	}
+	ctx->DeadlineMs = (ctx->Acked < ctx->Next) ?
+	        (nowUs() / 1000) + ctx->Cfg.TimeoutMs : 0;
+}
+
+/*********************************************************************
+ * @fn      lateAnswer
+ *
+ * @brief   tells whether an answer belongs to commands given up on by a
+ *          restart, with the lock held. Each one extends the quiet time.
+ */
+static uint8_t lateAnswer(sblFlash_t *ctx)
+{
+	if (ctx->QuietMs == 0)
+	{
+		return 0;
+	}
+	ctx->QuietMs = (nowUs() / 1000) + ctx->Cfg.TimeoutMs;
+
+	return 1;
+}
+
+/*********************************************************************
+ * CALLBACKS
+ */
+
+static uint8_t sblHandshakeRspCb(SblHandshakeRspFormat_t *msg)
+{
+	sblFlash_t *ctx;
+
+	pthread_mutex_lock(&activeLock);
+	ctx = activeFlash;
+	if (ctx && (ctx->Phase == SBL_PHASE_HANDSHAKE))
+	{
+		pthread_mutex_lock(&ctx->Lock);
+		ctx->Stats.BootloaderRevision = msg->BootloaderRevision;
+		ctx->Stats.DeviceType = msg->DeviceType;
+		ctx->Stats.BufferLength = msg->BufferLength;
+		ctx->Stats.PageSize = msg->PageSize;
+		ctx->Status = msg->Status;
+		ctx->Answered = 1;
+		pthread_mutex_unlock(&ctx->Lock);
+	}
+	pthread_mutex_unlock(&activeLock);
+
+	return 0;
+}
+
+static uint8_t sblWriteRspCb(SblStatusRspFormat_t *msg)
+{
+	sblFlash_t *ctx;
+
+	pthread_mutex_lock(&activeLock);
+	ctx = activeFlash;
+	if (ctx && (ctx->Phase == SBL_PHASE_WRITE))
+	{
+		pthread_mutex_lock(&ctx->Lock);
+		if (!ctx->Failed && !lateAnswer(ctx) && (ctx->Acked < ctx->Next))
+		{
+			if (msg->Status == SBL_SUCCESS)
+			{
+				blockAnswered(ctx);
+			}
+			else
+			{
+				dbg_print(PRINT_LEVEL_WARNING,
+				        "sblFlash: write of 0x%08X failed, status %d\n",
+				        ctx->Blocks[ctx->Acked].Address, msg->Status);
+				ctx->Failed = 1;
+			}
+		}
+		pthread_mutex_unlock(&ctx->Lock);
+	}
+	pthread_mutex_unlock(&activeLock);
+
+	return 0;
+}
+
+static uint8_t sblReadRspCb(SblReadRspFormat_t *msg)
+{
+	sblFlash_t *ctx;
+
+	pthread_mutex_lock(&activeLock);
+	ctx = activeFlash;
+	if (ctx && (ctx->Phase == SBL_PHASE_VERIFY))
+	{
+		pthread_mutex_lock(&ctx->Lock);
+		if (!ctx->Failed && !lateAnswer(ctx) && (ctx->Acked < ctx->Next))
+		{
+			sblFlashBlock_t *block = &ctx->Blocks[ctx->Acked];
+			uint8_t data[SBL_MAX_DATA_LEN];
+
+			if ((msg->Status != SBL_SUCCESS) || (msg->Address != block->Address)
+			        || (msg->Len < block->Len))
+			{
+				dbg_print(PRINT_LEVEL_WARNING,
+				        "sblFlash: read of 0x%08X failed, status %d\n",
+				        block->Address, msg->Status);
+				ctx->Failed = 1;
+			}
+			else
+			{
+				blockData(ctx->Image, block, data);
+				if (memcmp(data, msg->Data, block->Len) != 0)
+				{
+					dbg_print(PRINT_LEVEL_WARNING,
+					        "sblFlash: block 0x%08X differs\n", block->Address);
+					ctx->Stats.Mismatches++;
+					block->Bad = 1;
+				}
+				blockAnswered(ctx);
+			}
+		}
+		pthread_mutex_unlock(&ctx->Lock);
+	}
+	pthread_mutex_unlock(&activeLock);
+
+	return 0;
+}
+
+static uint8_t sblEnableRspCb(SblStatusRspFormat_t *msg)
+{
+	sblFlash_t *ctx;
+
+	pthread_mutex_lock(&activeLock);
+	ctx = activeFlash;
+	if (ctx && (ctx->Phase == SBL_PHASE_ENABLE))
+	{
+		pthread_mutex_lock(&ctx->Lock);
+		ctx->Status = msg->Status;
+		ctx->Answered = 1;
+		pthread_mutex_unlock(&ctx->Lock);
+	}
+	pthread_mutex_unlock(&activeLock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      command
+ *
+ * @brief   sends a command answered by a single response and waits for
+ *          the answer
+ *
+ * @param   ctx - flasher
+ * @param   phase - SBL_PHASE_HANDSHAKE or SBL_PHASE_ENABLE
+ * @param   timeoutMs - time allowed for the answer
+ *
+ * @return  0 if answered, -1 on timeout
+ */
+static int32_t command(sblFlash_t *ctx, uint8_t phase, uint32_t timeoutMs)
+{
+	uint64_t deadlineMs = (nowUs() / 1000) + timeoutMs;
+	uint8_t answered;
+
+	pthread_mutex_lock(&ctx->Lock);
+	ctx->Phase = phase;
+	ctx->Answered = 0;
+	pthread_mutex_unlock(&ctx->Lock);
+
+	if (phase == SBL_PHASE_HANDSHAKE)
+	{
+		// keep a bootloader waiting after reset in boot mode
+		rpcForceBoot();
+		sblHandshake();
+	}
+	else
+	{
+		sblEnable();
+	}
+
+	do
+	{
+		rpcWaitMqClientMsg(SBL_FLASH_POLL_MS);
+		pthread_mutex_lock(&ctx->Lock);
+		answered = ctx->Answered;
+		pthread_mutex_unlock(&ctx->Lock);
+	} while (!answered && ((nowUs() / 1000) < deadlineMs));
+
+	return answered ? 0 : -1;
+}
+
+/*********************************************************************
+ * @fn      pipeline
+ *
+ * @brief   writes or reads back all the blocks with several in flight
+ *
+ * @param   ctx - flasher
+ * @param   phase - SBL_PHASE_WRITE or SBL_PHASE_VERIFY
+ *
+ * @return  0 if every block was answered, -1 if one failed too often
+ */
+static int32_t pipeline(sblFlash_t *ctx, uint8_t phase)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+	ctx->Phase = phase;
+	ctx->Next = 0;
+	ctx->Acked = 0;
+	ctx->Window = 1;
+	if (ctx->WindowMax == 0)
+	{
+		ctx->WindowMax = ctx->Cfg.Window;
+	}
+	ctx->WindowAcks = 0;
+	ctx->Failed = 0;
+	ctx->DeadlineMs = 0;
+	ctx->QuietMs = 0;
+	for (i = 0; i < ctx->BlockCount; i++)
+	{
+		ctx->Blocks[i].Tries = 0;
+		if (phase == SBL_PHASE_VERIFY)
+		{
+			ctx->Blocks[i].Bad = 0;
+		}
+	}
+
+	while (ctx->Acked < ctx->BlockCount)
+	{
+		uint64_t nowMs = nowUs() / 1000;
+
+		if (ctx->QuietMs && (nowMs >= ctx->QuietMs))
+		{
+			ctx->QuietMs = 0;
+		}
+		else if (ctx->QuietMs == 0)
+		{
+			if (ctx->Failed || (ctx->DeadlineMs && (nowMs >= ctx->DeadlineMs)))
+			{
+				sblFlashBlock_t *block = &ctx->Blocks[ctx->Acked];
+
+				ctx->Stats.Restarts++;
+				if (++block->Tries > ctx->Cfg.MaxRetries)
+				{
+					dbg_print(PRINT_LEVEL_ERROR,
+					        "sblFlash: block 0x%08X failed %d times\n",
+					        block->Address, block->Tries);
+					ctx->Phase = SBL_PHASE_IDLE;
+					pthread_mutex_unlock(&ctx->Lock);
+					return -1;
+				}
+				dbg_print(PRINT_LEVEL_WARNING,
+				        "sblFlash: restarting at 0x%08X, window %d\n",
+				        block->Address, ctx->Window);
+
+				// a rewrite of the first block of a page erases the page
+				if (phase == SBL_PHASE_WRITE)
+				{
+					ctx->Acked = block->PageFirst;
+				}
+				ctx->Next = ctx->Acked;
+				if ((ctx->Window > 1) && (ctx->Window <= ctx->WindowMax))
+				{
+					ctx->WindowMax = ctx->Window - 1;
+				}
+				ctx->Window = (ctx->Window > 1) ? (ctx->Window / 2) : 1;
+				ctx->WindowAcks = 0;
+				ctx->Failed = 0;
+				ctx->DeadlineMs = 0;
+				ctx->QuietMs = nowMs + ctx->Cfg.TimeoutMs;
+			}
+
+			while ((ctx->QuietMs == 0) && (ctx->Next < ctx->BlockCount)
+			        && (ctx->Next - ctx->Acked < ctx->Window))
+			{
+				sblFlashBlock_t *block = &ctx->Blocks[ctx->Next++];
+
+				if (ctx->DeadlineMs == 0)
+				{
+					ctx->DeadlineMs = nowMs + ctx->Cfg.TimeoutMs;
+				}
+				if (ctx->Next - ctx->Acked > ctx->Stats.PeakWindow)
+				{
+					ctx->Stats.PeakWindow = ctx->Next - ctx->Acked;
+				}
+
+				if (phase == SBL_PHASE_WRITE)
+				{
+					SblWriteFormat_t req;
+
+					req.Address = block->Address;
+					req.Len = block->Len;
+					blockData(ctx->Image, block, req.Data);
+					ctx->Stats.Writes++;
+					pthread_mutex_unlock(&ctx->Lock);
+					sblWrite(&req);
+				}
+				else
+				{
+					SblReadFormat_t req;
+
+					req.Address = block->Address;
+					ctx->Stats.Reads++;
+					pthread_mutex_unlock(&ctx->Lock);
+					sblRead(&req);
+				}
+				pthread_mutex_lock(&ctx->Lock);
+			}
+		}
+
+		pthread_mutex_unlock(&ctx->Lock);
+		rpcWaitMqClientMsg(SBL_FLASH_POLL_MS);
+		pthread_mutex_lock(&ctx->Lock);
+	}
+	ctx->Phase = SBL_PHASE_IDLE;
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      sblImageLoadHex
+ *
+ * @brief   loads an Intel HEX file, the file is mapped and parsed in
+ *          place
+ *
+ * @param   image - image to fill
+ * @param   path - file name
+ *
+ * @return  0 on success, -1 if the file cannot be read or is not valid
+ */
+int32_t sblImageLoadHex(sblImage_t *image, const char *path)
+{
+	struct stat st;
+	const char *text;
+	int32_t status = -1;
+	int fd;
+
+	memset(image, 0, sizeof(sblImage_t));
+	fd = open(path, O_RDONLY);
+	if ((fd < 0) || (fstat(fd, &st) != 0) || (st.st_size == 0))
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "sblImage: cannot read %s\n", path);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+	text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED)
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "sblImage: cannot map %s\n", path);
+		return -1;
+	}
+	madvise((void *) text, st.st_size, MADV_SEQUENTIAL);
+
+	if (parseHex(image, text, st.st_size, 0) == 0)
+	{
+		image->Data = malloc(image->Size);
+		image->Used = calloc((image->Size + 7) / 8, 1);
+		if ((image->Data == NULL) || (image->Used == NULL))
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "sblImage: allocation failed\n");
+		}
+		else
+		{
+			memset(image->Data, 0xFF, image->Size);
+			status = parseHex(image, text, st.st_size, 1);
+		}
+	}
+	munmap((void *) text, st.st_size);
+
+	if (status != 0)
+	{
+		sblImageFree(image);
+	}
+
+	return status;
+}
+
+/*********************************************************************
+ * @fn      sblImageFree
+ *
+ * @brief   frees an image loaded by sblImageLoadHex
+ */
+void sblImageFree(sblImage_t *image)
+{
+	free(image->Data);
+	free(image->Used);
+	memset(image, 0, sizeof(sblImage_t));
+}
+
+/*********************************************************************
+ * @fn      sblFlashInit
+ *
+ * @brief   initializes a flasher and registers its SBL callbacks
+ *
+ * @param   ctx - flasher
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0
+ */
+int32_t sblFlashInit(sblFlash_t *ctx, sblFlashCfg_t *cfg)
+{
+	mtSblCb_t cbs;
+
+	memset(ctx, 0, sizeof(sblFlash_t));
+	memcpy(&ctx->Cfg, cfg, sizeof(sblFlashCfg_t));
+	if ((ctx->Cfg.Window == 0) || (ctx->Cfg.Window > SBL_FLASH_WINDOW_MAX))
+	{
+		ctx->Cfg.Window = (ctx->Cfg.Window == 0) ?
+		        SBL_FLASH_WINDOW : SBL_FLASH_WINDOW_MAX;
+	}
+	if (ctx->Cfg.TimeoutMs == 0)
+	{
+		ctx->Cfg.TimeoutMs = SBL_FLASH_TIMEOUT_MS;
+	}
+	if (ctx->Cfg.MaxRetries == 0)
+	{
+		ctx->Cfg.MaxRetries = SBL_FLASH_MAX_RETRIES;
+	}
+	if (ctx->Cfg.HandshakeTries == 0)
+	{
+		ctx->Cfg.HandshakeTries = SBL_FLASH_HANDSHAKE_TRIES;
+	}
+	pthread_mutex_init(&ctx->Lock, NULL);
+
+	pthread_mutex_lock(&activeLock);
+	activeFlash = ctx;
+	pthread_mutex_unlock(&activeLock);
+
+	memset(&cbs, 0, sizeof(mtSblCb_t));
+	cbs.pfnSblWriteRsp = sblWriteRspCb;
+	cbs.pfnSblReadRsp = sblReadRspCb;
+	cbs.pfnSblEnableRsp = sblEnableRspCb;
+	cbs.pfnSblHandshakeRsp = sblHandshakeRspCb;
+	sblRegisterCallbacks(cbs);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      sblFlashClose
+ *
+ * @brief   stops the flasher receiving responses and frees the blocks
+ *
+ * @param   ctx - flasher
+ *
+ * @return  none
+ */
+void sblFlashClose(sblFlash_t *ctx)
+{
+	mtSblCb_t cbs;
+
+	pthread_mutex_lock(&activeLock);
+	if (activeFlash == ctx)
+	{
+		memset(&cbs, 0, sizeof(mtSblCb_t));
+		sblRegisterCallbacks(cbs);
+		activeFlash = NULL;
+	}
+	pthread_mutex_unlock(&activeLock);
+
+	free(ctx->Blocks);
+	ctx->Blocks = NULL;
+	pthread_mutex_destroy(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      sblFlashRun
+ *
+ * @brief   programs an image, dispatching the MT callbacks until done.
+ *          The ZNP must be in its bootloader, a bootloader waiting
+ *          after reset is kept there by the handshake.
+ *
+ * @param   ctx - flasher
+ * @param   image - image loaded by sblImageLoadHex
+ *
+ * @return  0 on success, -1 on failure with Stats.Result telling why
+ */
+int32_t sblFlashRun(sblFlash_t *ctx, sblImage_t *image)
+{
+	uint64_t start;
+	uint32_t i;
+
+	memset(&ctx->Stats, 0, sizeof(sblFlashStats_t));
+	ctx->Image = image;
+	ctx->WindowMax = 0;
+
+	// bootloader parameters
+	for (i = 0; i < ctx->Cfg.HandshakeTries; i++)
+	{
+		if (command(ctx, SBL_PHASE_HANDSHAKE, ctx->Cfg.TimeoutMs) == 0)
+		{
+			break;
+		}
+	}
+	if ((i == ctx->Cfg.HandshakeTries) || (ctx->Status != SBL_SUCCESS))
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "sblFlash: no bootloader answered\n");
+		ctx->Stats.Result = SBL_FLASH_NO_BOOTLOADER;
+		return -1;
+	}
+	ctx->Stats.BufferLength &= ~3;
+	if (ctx->Stats.BufferLength > SBL_MAX_DATA_LEN)
+	{
+		ctx->Stats.BufferLength = 128;
+	}
+	if ((ctx->Stats.BufferLength == 0) || (ctx->Stats.PageSize == 0)
+	        || (ctx->Stats.PageSize % ctx->Stats.BufferLength))
+	{
+		dbg_print(PRINT_LEVEL_ERROR,
+		        "sblFlash: buffer of %u bytes does not fit pages of %u bytes\n",
+		        ctx->Stats.BufferLength, ctx->Stats.PageSize);
+		ctx->Stats.Result = SBL_FLASH_NO_BOOTLOADER;
+		return -1;
+	}
+	dbg_print(PRINT_LEVEL_INFO,
+	        "sblFlash: bootloader rev %u, device %u, %u byte blocks, %u byte pages\n",
+	        ctx->Stats.BootloaderRevision, ctx->Stats.DeviceType,
+	        ctx->Stats.BufferLength, ctx->Stats.PageSize);
+
+	if (buildBlocks(ctx) != 0)
+	{
+		ctx->Stats.Result = SBL_FLASH_WRITE_FAILED;
+		return -1;
+	}
+
+	start = nowUs();
+	if (pipeline(ctx, SBL_PHASE_WRITE) != 0)
+	{
+		ctx->Stats.Result = SBL_FLASH_WRITE_FAILED;
+		return -1;
+	}
+	ctx->Stats.WriteUs = nowUs() - start;
+	ctx->Stats.WriteBytes = (uint64_t) ctx->BlockCount
+	        * ctx->Stats.BufferLength;
+
+	if (ctx->Cfg.Verify == SBL_FLASH_VERIFY_READ)
+	{
+		uint32_t pages;
+
+		start = nowUs();
+		for (i = 0; ; i++)
+		{
+			if (pipeline(ctx, SBL_PHASE_VERIFY) != 0)
+			{
+				ctx->Stats.Result = SBL_FLASH_VERIFY_FAILED;
+				return -1;
+			}
+			pages = repairBlocks(ctx);
+			if (pages == 0)
+			{
+				break;
+			}
+
+			// a block lost without an answer went unnoticed at this window,
+			// write the pages again one block at a time and read them back
+			ctx->Stats.Repairs += pages;
+			ctx->WindowMax = 1;
+			if ((i == ctx->Cfg.MaxRetries)
+			        || (pipeline(ctx, SBL_PHASE_WRITE) != 0))
+			{
+				ctx->Stats.Result = SBL_FLASH_VERIFY_FAILED;
+				return -1;
+			}
+		}
+		ctx->Stats.VerifyUs = nowUs() - start;
+		ctx->Stats.VerifyBytes = ctx->Stats.WriteBytes;
+	}
+
+	if (!ctx->Cfg.NoEnable)
+	{
+		if ((command(ctx, SBL_PHASE_ENABLE,
+		        ctx->Cfg.TimeoutMs * SBL_FLASH_ENABLE_TIMEOUTS) != 0)
+		        || (ctx->Status != SBL_SUCCESS))
+		{
+			dbg_print(PRINT_LEVEL_ERROR, "sblFlash: image not enabled\n");
+			ctx->Stats.Result = SBL_FLASH_ENABLE_FAILED;
+			return -1;
+		}
+
+		// leave the bootloader for the new image
+		rpcForceRun();
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      sblFlashResultName
+ *
+ * @brief   names a SBL_FLASH_* result
+ */
+const char *sblFlashResultName(uint8_t result)
+{
+	switch (result)
+	{
+	case SBL_FLASH_OK:
+		return "ok";
+	case SBL_FLASH_NO_BOOTLOADER:
+		return "no bootloader";
+	case SBL_FLASH_WRITE_FAILED:
+		return "write failed";
+	case SBL_FLASH_VERIFY_FAILED:
+		return "verify failed";
+	case SBL_FLASH_ENABLE_FAILED:
+		return "image rejected";
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,151 @@
+/*
+ * sblFlash.h
+ *
+ * This module contains the firmware flasher, which loads an Intel HEX
+ * image and programs it through the serial bootloader of the ZNP.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef SBLFLASH_H
+#define SBLFLASH_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include <pthread.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// defaults used for the sblFlashCfg_t fields left 0
+#define SBL_FLASH_WINDOW           (8)
+#define SBL_FLASH_TIMEOUT_MS       (1000)
+#define SBL_FLASH_MAX_RETRIES      (3)
+#define SBL_FLASH_HANDSHAKE_TRIES  (10)
+
+// upper bound of SBL_FLASH_WINDOW
+#define SBL_FLASH_WINDOW_MAX       (64)
+
+// largest span of flash an image covers
+#define SBL_IMAGE_MAX_SIZE         (1024 * 1024)
+
+// sblFlashCfg_t Verify
+#define SBL_FLASH_VERIFY_READ      (0) // read every block back
+#define SBL_FLASH_VERIFY_NONE      (1) // rely on the CRC check of ENABLE
+
+// sblFlashStats_t Result
+#define SBL_FLASH_OK               (0)
+#define SBL_FLASH_NO_BOOTLOADER    (1) // no answer to the handshake
+#define SBL_FLASH_WRITE_FAILED     (2)
+#define SBL_FLASH_VERIFY_FAILED    (3)
+#define SBL_FLASH_ENABLE_FAILED    (4) // the bootloader rejected the image
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint32_t Base;            // flash address of Data[0]
+	uint32_t Size;            // bytes from Base to the last byte of the file
+	uint8_t *Data;            // 0xFF where the file has no data
+	uint8_t *Used;            // bit per byte given by the file
+	uint32_t UsedBytes;
+} sblImage_t;
+
+typedef struct
+{
+	uint8_t Window;           // blocks in flight to the bootloader at most
+	uint32_t TimeoutMs;       // time allowed for a response
+	uint8_t MaxRetries;       // restarts of a block before the flash fails
+	uint8_t HandshakeTries;   // handshakes before the bootloader is missing
+	uint8_t Verify;           // SBL_FLASH_VERIFY_*
+	uint8_t NoEnable;         // leave the image disabled
+} sblFlashCfg_t;
+
+typedef struct
+{
+	uint32_t Address;
+	uint8_t Len;
+	uint32_t PageFirst;       // index of the first block of the page
+	uint8_t Tries;            // restarts including the block
+	uint8_t Bad;              // read back different
+} sblFlashBlock_t;
+
+typedef struct
+{
+	uint32_t BootloaderRevision;
+	uint8_t DeviceType;
+	uint32_t BufferLength;
+	uint32_t PageSize;
+
+	uint32_t Pages;           // pages with data
+	uint32_t Blocks;          // blocks written per pass
+	uint32_t Writes;          // WRITE commands sent, restarts included
+	uint32_t Reads;           // READ commands sent, restarts included
+	uint32_t Restarts;        // after a timeout or a failed block
+	uint32_t Mismatches;      // blocks read back different
+	uint32_t Repairs;         // pages written again after a mismatch
+	uint8_t PeakWindow;
+	uint64_t WriteBytes;
+	uint64_t WriteUs;
+	uint64_t VerifyBytes;
+	uint64_t VerifyUs;
+	uint8_t Result;           // SBL_FLASH_*
+} sblFlashStats_t;
+
+typedef struct
+{
+	sblFlashCfg_t Cfg;
+	pthread_mutex_t Lock;
+	sblImage_t *Image;
+
+	sblFlashBlock_t *Blocks;
+	uint32_t BlockCount;
+
+	// pipeline of the current pass, the responses come in order
+	uint8_t Phase;
+	uint32_t Next;            // next block to send
+	uint32_t Acked;           // first block not answered
+	uint8_t Window;           // current window, grows up to WindowMax
+	uint8_t WindowMax;        // below the windows that lost a block
+	uint32_t WindowAcks;      // answers since the window last grew
+	uint8_t Failed;           // a block failed, restart the pipeline
+	uint64_t DeadlineMs;      // of the oldest block in flight
+	uint64_t QuietMs;         // responses ignored until then on restart
+
+	// answers of the single command phases
+	uint8_t Answered;
+	uint8_t Status;
+
+	sblFlashStats_t Stats;
+} sblFlash_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t sblImageLoadHex(sblImage_t *image, const char *path);
+void sblImageFree(sblImage_t *image);
+
+int32_t sblFlashInit(sblFlash_t *ctx, sblFlashCfg_t *cfg);
+void sblFlashClose(sblFlash_t *ctx);
+int32_t sblFlashRun(sblFlash_t *ctx, sblImage_t *image);
+
+const char *sblFlashResultName(uint8_t result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SBLFLASH_H */
@@ -0,0 +1,633 @@
+/*
+ * srcRtCache.c
+ *
+ * This module contains the source route cache, see srcRtCache.h.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "srcRtCache.h"
+#include "rpc.h"
+#include "mtAf.h"
+#include "mtZdo.h"
+#include "mtEvent.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// network address of the concentrator, the coordinator
+#define SRC_RT_CONCENTRATOR        (0x0000)
+
+// status of a routing table entry in use, the bits above it are flags
+#define SRC_RT_ROUTE_STATUS_MASK   (0x07)
+#define SRC_RT_ROUTE_ACTIVE        (0x00)
+
+// AF_DATA_CONFIRM Status of a message delivered
+#define SRC_RT_CONFIRM_SUCCESS     (0x00)
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowMs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in milli seconds
+ */
+static uint64_t nowMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static srcRtCacheEntry_t *entryFind(srcRtCache_t *ctx, uint16_t dstAddr)
+{
+	if (ctx->Index[dstAddr] == 0)
+	{
+		return NULL;
+	}
+
+	return &ctx->Entries[ctx->Index[dstAddr] - 1];
+}
+
+/*********************************************************************
+ * @fn      entryRemove
+ *
+ * @brief   moves the last entry in the place of the one removed. Called
+ *          with the lock held.
+ */
+static void entryRemove(srcRtCache_t *ctx, srcRtCacheEntry_t *e)
+{
+	uint32_t idx = e - ctx->Entries;
+
+	ctx->Index[e->DstAddr] = 0;
+	ctx->Count--;
+	if (idx != ctx->Count)
+	{
+		ctx->Entries[idx] = ctx->Entries[ctx->Count];
+		ctx->Index[ctx->Entries[idx].DstAddr] = idx + 1;
+	}
+}
+
+static srcRtCacheEntry_t *entryOldest(srcRtCache_t *ctx)
+{
+	srcRtCacheEntry_t *oldest = &ctx->Entries[0];
+	uint32_t i;
+
+	for (i = 1; i < ctx->Count; i++)
+	{
+		if (ctx->Entries[i].UpdatedMs < oldest->UpdatedMs)
+		{
+			oldest = &ctx->Entries[i];
+		}
+	}
+
+	return oldest;
+}
+
+/*********************************************************************
+ * @fn      routeAdd
+ *
+ * @brief   stores the route to a destination. A route from the tables
+ *          does not replace a fresh one from an indication, the route
+ *          record being newer than the table. Called with the lock held.
+ *
+ * @return  0 if stored, -1 if not
+ */
+static int32_t routeAdd(srcRtCache_t *ctx, uint16_t dstAddr,
+        uint8_t relayCount, uint16_t *relays, uint8_t source, uint64_t now)
+{
+	srcRtCacheEntry_t *e;
+
+	if (relayCount > SRC_RT_CACHE_MAX_RELAYS)
+	{
+		ctx->Stats.TooLong++;
+		return -1;
+	}
+
+	e = entryFind(ctx, dstAddr);
+	if (e != NULL)
+	{
+		if ((source == SRC_RT_CACHE_TABLES) && (e->Source == SRC_RT_CACHE_IND)
+		        && (now - e->UpdatedMs <= ctx->Cfg.TtlMs))
+		{
+			return -1;
+		}
+	}
+	else
+	{
+		if (ctx->Count == ctx->Cfg.Entries)
+		{
+			entryRemove(ctx, entryOldest(ctx));
+			ctx->Stats.Evicted++;
+		}
+		e = &ctx->Entries[ctx->Count++];
+		e->DstAddr = dstAddr;
+		ctx->Index[dstAddr] = ctx->Count;
+	}
+
+	e->Source = source;
+	e->RelayCount = relayCount;
+	memcpy(e->Relays, relays, relayCount * sizeof(uint16_t));
+	e->UpdatedMs = now;
+	if (source == SRC_RT_CACHE_IND)
+	{
+		ctx->Stats.Learnt++;
+	}
+	else
+	{
+		ctx->Stats.LearntTables++;
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      tablesNextHop
+ *
+ * @brief   looks up the next hop of a router to a destination in the
+ *          harvested tables, the routes of a router sorted by DstAddr
+ *
+ * @return  0 if the router has an active route, -1 if not
+ */
+static int32_t tablesNextHop(tblHarvest_t *tables, uint16_t nwkAddr,
+        uint16_t dstAddr, uint16_t *nextHop)
+{
+	tblHarvestRouter_t *r;
+	tblHarvestRoute_t *route;
+	int32_t lo, hi, mid;
+
+	if (tables->RouterIndex[nwkAddr] == 0)
+	{
+		return -1;
+	}
+	r = &tables->Routers[tables->RouterIndex[nwkAddr] - 1];
+	if (!r->Rtg.Valid)
+	{
+		return -1;
+	}
+
+	lo = 0;
+	hi = (int32_t) r->Rtg.Count - 1;
+	while (lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		route = &r->Routes[mid];
+		if (route->DstAddr == dstAddr)
+		{
+			if ((route->Status & SRC_RT_ROUTE_STATUS_MASK)
+			        != SRC_RT_ROUTE_ACTIVE)
+			{
+				return -1;
+			}
+			*nextHop = route->NextHop;
+			return 0;
+		}
+		if (route->DstAddr < dstAddr)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+
+	return -1;
+}
+
+/*********************************************************************
+ * MT EVENT LISTENERS
+ */
+
+static void srcRtgIndCb(uint16_t event, void *data, void *arg)
+{
+	SrcRtgIndFormat_t *msg = data;
+	srcRtCache_t *ctx = arg;
+
+	pthread_mutex_lock(&ctx->Lock);
+	routeAdd(ctx, msg->DstAddr, msg->RelayCount, msg->RelayList,
+	        SRC_RT_CACHE_IND, nowMs());
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static void leaveIndCb(uint16_t event, void *data, void *arg)
+{
+	LeaveIndFormat_t *msg = data;
+	srcRtCache_t *ctx = arg;
+	srcRtCacheEntry_t *e;
+
+	pthread_mutex_lock(&ctx->Lock);
+	e = entryFind(ctx, msg->SrcAddr);
+	if (e != NULL)
+	{
+		entryRemove(ctx, e);
+		ctx->Stats.Invalidated++;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+// a message sent along a cached route failed, the route is likely broken
+static void dataConfirmCb(uint16_t event, void *data, void *arg)
+{
+	DataConfirmFormat_t *msg = data;
+	srcRtCache_t *ctx = arg;
+	srcRtCacheEntry_t *e;
+	uint32_t dst;
+
+	pthread_mutex_lock(&ctx->Lock);
+	dst = ctx->TransDst[msg->TransId];
+	ctx->TransDst[msg->TransId] = 0;
+	if ((dst != 0) && (msg->Status != SRC_RT_CONFIRM_SUCCESS))
+	{
+		e = entryFind(ctx, dst - 1);
+		if (e != NULL)
+		{
+			entryRemove(ctx, e);
+			ctx->Stats.Invalidated++;
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static const struct
+{
+	uint16_t Event;
+	mtEventCb_t Cb;
+} cacheListeners[] =
+{
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_SRC_RTG_IND), srcRtgIndCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_LEAVE_IND), leaveIndCb },
+	{ MT_EVENT(MT_RPC_SYS_AF, MT_AF_DATA_CONFIRM), dataConfirmCb },
+};
+
+#define SRC_RT_CACHE_LISTENERS \
+	(sizeof(cacheListeners) / sizeof(cacheListeners[0]))
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      srcRtCacheInit
+ *
+ * @brief   sets up a cache and makes it learn the routes the ZNP reports
+ *
+ * @param   ctx - cache
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 on failure
+ */
+int32_t srcRtCacheInit(srcRtCache_t *ctx, srcRtCacheCfg_t *cfg)
+{
+	uint32_t i;
+
+	memset(ctx, 0, sizeof(srcRtCache_t));
+	ctx->Cfg = *cfg;
+	if (ctx->Cfg.TtlMs == 0)
+	{
+		ctx->Cfg.TtlMs = SRC_RT_CACHE_TTL_MS;
+	}
+	if (ctx->Cfg.Entries == 0)
+	{
+		ctx->Cfg.Entries = SRC_RT_CACHE_ENTRIES;
+	}
+
+	ctx->Entries = calloc(ctx->Cfg.Entries, sizeof(srcRtCacheEntry_t));
+	ctx->Index = calloc(65536, sizeof(uint32_t));
+	if ((ctx->Entries == NULL) || (ctx->Index == NULL))
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "srcRtCacheInit: allocation failed\n");
+		free(ctx->Entries);
+		free(ctx->Index);
+		return -1;
+	}
+	pthread_mutex_init(&ctx->Lock, NULL);
+
+	for (i = 0; i < SRC_RT_CACHE_LISTENERS; i++)
+	{
+		mtEventAddListener(cacheListeners[i].Event, cacheListeners[i].Cb, ctx,
+		        ctx->Cfg.Priority);
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      srcRtCacheClose
+ *
+ * @brief   stops learning routes and frees the cache
+ *
+ * @param   ctx - cache
+ *
+ * @return  none
+ */
+void srcRtCacheClose(srcRtCache_t *ctx)
+{
+	uint32_t i;
+
+	for (i = 0; i < SRC_RT_CACHE_LISTENERS; i++)
+	{
+		mtEventRemoveListener(cacheListeners[i].Event, cacheListeners[i].Cb,
+		        ctx);
+	}
+
+	pthread_mutex_destroy(&ctx->Lock);
+	free(ctx->Entries);
+	free(ctx->Index);
+	ctx->Entries = NULL;
+	ctx->Index = NULL;
+	ctx->Count = 0;
+}
+
+/*********************************************************************
+ * @fn      srcRtCacheAdd
+ *
+ * @brief   stores a route learnt by other means than the indications
+ *
+ * @param   ctx - cache
+ * @param   dstAddr - destination
+ * @param   relayCount - relays of the route, 0 for a neighbour
+ * @param   relays - relays, the one next to the destination first
+ * @param   source - SRC_RT_CACHE_IND or SRC_RT_CACHE_TABLES
+ *
+ * @return  0 if stored, -1 if too long or a fresher route is kept
+ */
+int32_t srcRtCacheAdd(srcRtCache_t *ctx, uint16_t dstAddr, uint8_t relayCount,
+        uint16_t *relays, uint8_t source)
+{
+	int32_t status;
+
+	pthread_mutex_lock(&ctx->Lock);
+	status = routeAdd(ctx, dstAddr, relayCount, relays, source, nowMs());
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return status;
+}
+
+/*********************************************************************
+ * @fn      srcRtCacheRemove
+ *
+ * @brief   drops the route to a destination
+ *
+ * @param   ctx - cache
+ * @param   dstAddr - destination
+ *
+ * @return  none
+ */
+void srcRtCacheRemove(srcRtCache_t *ctx, uint16_t dstAddr)
+{
+	srcRtCacheEntry_t *e;
+
+	pthread_mutex_lock(&ctx->Lock);
+	e = entryFind(ctx, dstAddr);
+	if (e != NULL)
+	{
+		entryRemove(ctx, e);
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      srcRtCacheLearnTables
+ *
+ * @brief   learns the routes to the harvested routers from their routes
+ *          to the concentrator, after a tblHarvestRun() or when the
+ *          tblHarvestPoll() refreshes are done
+ *
+ * @param   ctx - cache
+ * @param   tables - harvester collecting the routing tables
+ *
+ * @return  routes stored
+ */
+uint32_t srcRtCacheLearnTables(srcRtCache_t *ctx, tblHarvest_t *tables)
+{
+	uint16_t relays[SRC_RT_CACHE_MAX_RELAYS];
+	uint16_t dstAddr, hop;
+	uint32_t r, learnt = 0;
+	uint64_t now = nowMs();
+	uint8_t count;
+
+	pthread_mutex_lock(&tables->Lock);
+	pthread_mutex_lock(&ctx->Lock);
+	for (r = 0; r < tables->RouterCount; r++)
+	{
+		dstAddr = tables->Routers[r].NwkAddr;
+		if (dstAddr == SRC_RT_CONCENTRATOR)
+		{
+			continue;
+		}
+
+		// each next hop toward the concentrator is a relay of the record
+		count = 0;
+		hop = dstAddr;
+		while (tablesNextHop(tables, hop, SRC_RT_CONCENTRATOR, &hop) == 0)
+		{
+			if (hop == SRC_RT_CONCENTRATOR)
+			{
+				if (routeAdd(ctx, dstAddr, count, relays, SRC_RT_CACHE_TABLES,
+				        now) == 0)
+				{
+					learnt++;
+				}
+				break;
+			}
+			if ((count == SRC_RT_CACHE_MAX_RELAYS) || (hop == dstAddr))
+			{
+				break;
+			}
+			relays[count++] = hop;
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+	pthread_mutex_unlock(&tables->Lock);
+
+	return learnt;
+}
+
+/*********************************************************************
+ * @fn      srcRtCacheExpire
+ *
+ * @brief   drops the routes older than TtlMs
+ *
+ * @param   ctx - cache
+ *
+ * @return  routes dropped
+ */
+uint32_t srcRtCacheExpire(srcRtCache_t *ctx)
+{
+	uint64_t now = nowMs();
+	uint32_t i = 0, expired = 0;
+
+	pthread_mutex_lock(&ctx->Lock);
+	while (i < ctx->Count)
+	{
+		if (now - ctx->Entries[i].UpdatedMs > ctx->Cfg.TtlMs)
+		{
+			entryRemove(ctx, &ctx->Entries[i]);
+			expired++;
+		}
+		else
+		{
+			i++;
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return expired;
+}
+
+/*********************************************************************
+ * @fn      srcRtCacheLookup
+ *
+ * @brief   looks up the route to a destination
+ *
+ * @param   ctx - cache
+ * @param   dstAddr - destination
+ * @param   route - copy of the route if fresh
+ *
+ * @return  SRC_RT_CACHE_FRESH or SRC_RT_CACHE_MISS, a stale route being
+ *          dropped
+ */
+int32_t srcRtCacheLookup(srcRtCache_t *ctx, uint16_t dstAddr,
+        srcRtCacheEntry_t *route)
+{
+	srcRtCacheEntry_t *e;
+	int32_t status = SRC_RT_CACHE_MISS;
+
+	pthread_mutex_lock(&ctx->Lock);
+	e = entryFind(ctx, dstAddr);
+	if (e != NULL)
+	{
+		if (nowMs() - e->UpdatedMs > ctx->Cfg.TtlMs)
+		{
+			entryRemove(ctx, e);
+			ctx->Stats.Stale++;
+		}
+		else
+		{
+			*route = *e;
+			status = SRC_RT_CACHE_FRESH;
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return status;
+}
+
+/*********************************************************************
+ * @fn      srcRtCacheDataRequest
+ *
+ * @brief   afDataRequest() along the cached route to the destination,
+ *          with afDataRequestSrcRtg(), or as is without a fresh route.
+ *          Broadcasts and group addresses are sent as is. A route the
+ *          ZNP refused, its SRSP status other than ZSuccess, is dropped
+ *          and the request sent as is; a request left without an SRSP
+ *          is not sent again, the ZNP may have sent it.
+ *
+ * @param   ctx - cache
+ * @param   req - request
+ *
+ * @return  status of rpcSendFrame() for the request sent last
+ */
+uint8_t srcRtCacheDataRequest(srcRtCache_t *ctx, DataRequestFormat_t *req)
+{
+	DataRequestSrcRtgFormat_t srcReq;
+	srcRtCacheEntry_t route;
+	uint8_t srspStatus = MT_RPC_SUCCESS;
+	uint8_t status;
+
+	__atomic_add_fetch(&ctx->Stats.Sent, 1, __ATOMIC_RELAXED);
+	if (srcRtCacheLookup(ctx, req->DstAddr, &route) != SRC_RT_CACHE_FRESH)
+	{
+		__atomic_add_fetch(&ctx->Stats.Misses, 1, __ATOMIC_RELAXED);
+		return afDataRequest(req);
+	}
+
+	srcReq.DstAddr = req->DstAddr;
+	srcReq.DstEndpoint = req->DstEndpoint;
+	srcReq.SrcEndpoint = req->SrcEndpoint;
+	srcReq.ClusterID = req->ClusterID;
+	srcReq.TransID = req->TransID;
+	srcReq.Options = req->Options;
+	srcReq.Radius = req->Radius;
+	srcReq.RelayCount = route.RelayCount;
+	memcpy(srcReq.RelayList, route.Relays,
+	        route.RelayCount * sizeof(uint16_t));
+	srcReq.Len = req->Len;
+	memcpy(srcReq.Data, req->Data, req->Len);
+
+	pthread_mutex_lock(&ctx->Lock);
+	ctx->TransDst[req->TransID] = req->DstAddr + 1;
+	pthread_mutex_unlock(&ctx->Lock);
+
+	status = afDataRequestSrcRtgStatus(&srcReq, &srspStatus);
+	if (status != MT_RPC_SUCCESS)
+	{
+		// no SRSP, the confirm still drops the route if it went out
+		__atomic_add_fetch(&ctx->Stats.Unanswered, 1, __ATOMIC_RELAXED);
+		return status;
+	}
+	if (srspStatus != MT_RPC_SUCCESS)
+	{
+		// the ZNP refused the route, send it the usual way
+		dbg_print(PRINT_LEVEL_WARNING, "srcRtCache: route to 0x%04X refused,"
+		        " status 0x%02X\n", req->DstAddr, srspStatus);
+		srcRtCacheRemove(ctx, req->DstAddr);
+		pthread_mutex_lock(&ctx->Lock);
+		ctx->TransDst[req->TransID] = 0;
+		ctx->Stats.Invalidated++;
+		ctx->Stats.Refused++;
+		pthread_mutex_unlock(&ctx->Lock);
+		__atomic_add_fetch(&ctx->Stats.Misses, 1, __ATOMIC_RELAXED);
+		return afDataRequest(req);
+	}
+	__atomic_add_fetch(&ctx->Stats.SrcRouted, 1, __ATOMIC_RELAXED);
+
+	return status;
+}
+
+/*********************************************************************
+ * @fn      srcRtCachePrintStats
+ *
+ * @brief   prints the routes learnt and the messages sent along them
+ *
+ * @param   ctx - cache
+ * @param   out - stream
+ *
+ * @return  none
+ */
+void srcRtCachePrintStats(srcRtCache_t *ctx, FILE *out)
+{
+	srcRtCacheStats_t *st = &ctx->Stats;
+
+	pthread_mutex_lock(&ctx->Lock);
+	st->Entries = ctx->Count;
+	fprintf(out, "source routes: %u entries, %u learnt, %u from tables, "
+	        "%u too long, %u evicted, %u invalidated, %u stale; "
+	        "%llu sent, %llu source routed, %u misses, %u refused, "
+	        "%u unanswered\n", st->Entries,
+	        st->Learnt, st->LearntTables, st->TooLong, st->Evicted,
+	        st->Invalidated, st->Stale,
+	        (unsigned long long) __atomic_load_n(&st->Sent, __ATOMIC_RELAXED),
+	        (unsigned long long) __atomic_load_n(&st->SrcRouted,
+	                __ATOMIC_RELAXED),
+	        __atomic_load_n(&st->Misses, __ATOMIC_RELAXED), st->Refused,
+	        __atomic_load_n(&st->Unanswered, __ATOMIC_RELAXED));
+	pthread_mutex_unlock(&ctx->Lock);
+}
@@ -0,0 +1,133 @@
+/*
+ * srcRtCache.h
+ *
+ * This module contains the source route cache, which keeps the route
+ * to each destination the ZNP reported and sends the AF messages to a
+ * destination with a fresh route as source routed frames, so a deep
+ * node of a many-to-one network is reached without a route discovery.
+ *
+ * Routes are learnt from the MT_ZDO_SRC_RTG_IND of the route records
+ * the nodes send to the concentrator, and from the routing tables of
+ * the routers collected by tblHarvest: a router's route to the
+ * concentrator, followed through the tables of its next hops, is the
+ * route record it would send. A relay list is kept in the order of the
+ * indication, the one afDataRequestSrcRtg() takes, the relay next to
+ * the destination first. A route older than TtlMs is no longer used,
+ * and a route is dropped when the destination leaves, a message sent
+ * along it fails its AF_DATA_CONFIRM or the ZNP refuses it.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef SRCRTCACHE_H
+#define SRCRTCACHE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mtAf.h"
+#include "tblHarvest.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// defaults used for the srcRtCacheCfg_t fields left 0
+#define SRC_RT_CACHE_TTL_MS        (300000)
+#define SRC_RT_CACHE_ENTRIES       (1024)
+
+// relays of a route kept, longer routes are not cached
+#define SRC_RT_CACHE_MAX_RELAYS    (16)
+
+// srcRtCacheEntry_t Source
+#define SRC_RT_CACHE_IND           (0)
+#define SRC_RT_CACHE_TABLES        (1)
+
+// srcRtCacheLookup return values
+#define SRC_RT_CACHE_FRESH         (0)
+#define SRC_RT_CACHE_MISS          (1)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint32_t TtlMs;            // age after which a route is no longer used
+	uint32_t Entries;          // destinations kept, the oldest go first
+	int32_t Priority;          // of the listeners on the MT event bus
+} srcRtCacheCfg_t;
+
+typedef struct
+{
+	uint16_t DstAddr;
+	uint8_t Source;            // SRC_RT_CACHE_IND or SRC_RT_CACHE_TABLES
+	uint8_t RelayCount;
+	uint16_t Relays[SRC_RT_CACHE_MAX_RELAYS];
+	uint64_t UpdatedMs;
+} srcRtCacheEntry_t;
+
+typedef struct
+{
+	uint64_t Sent;             // messages sent by srcRtCacheDataRequest()
+	uint64_t SrcRouted;        // sent along a cached route
+	uint32_t Misses;           // sent without a route, none or stale
+	uint32_t Stale;
+	uint32_t Learnt;           // routes from the indications
+	uint32_t LearntTables;     // routes from the routing tables
+	uint32_t TooLong;          // routes over SRC_RT_CACHE_MAX_RELAYS
+	uint32_t Evicted;          // oldest routes dropped, cache full
+	uint32_t Invalidated;      // dropped by a leave, a failed confirm or
+	                           // a refusal of the ZNP
+	uint32_t Refused;          // source routed requests the ZNP refused
+	uint32_t Unanswered;       // source routed requests without an SRSP
+	uint32_t Entries;
+} srcRtCacheStats_t;
+
+typedef struct
+{
+	srcRtCacheCfg_t Cfg;
+	pthread_mutex_t Lock;
+	srcRtCacheEntry_t *Entries;
+	uint32_t Count;
+	uint32_t *Index;           // network address to entry index + 1
+	uint32_t TransDst[256];    // destination + 1 of the source routed
+	                           // message of each AF transaction ID
+	srcRtCacheStats_t Stats;
+} srcRtCache_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t srcRtCacheInit(srcRtCache_t *ctx, srcRtCacheCfg_t *cfg);
+void srcRtCacheClose(srcRtCache_t *ctx);
+
+int32_t srcRtCacheAdd(srcRtCache_t *ctx, uint16_t dstAddr, uint8_t relayCount,
+        uint16_t *relays, uint8_t source);
+void srcRtCacheRemove(srcRtCache_t *ctx, uint16_t dstAddr);
+uint32_t srcRtCacheLearnTables(srcRtCache_t *ctx, tblHarvest_t *tables);
+uint32_t srcRtCacheExpire(srcRtCache_t *ctx);
+
+int32_t srcRtCacheLookup(srcRtCache_t *ctx, uint16_t dstAddr,
+        srcRtCacheEntry_t *route);
+uint8_t srcRtCacheDataRequest(srcRtCache_t *ctx, DataRequestFormat_t *req);
+
+void srcRtCachePrintStats(srcRtCache_t *ctx, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SRCRTCACHE_H */
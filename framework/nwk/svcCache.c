@@ -0,0 +1,923 @@
+/*
+ * svcCache.c
+ *
+ * This module contains the service discovery cache, which maps a
+ * profile and server cluster to the endpoints implementing it.
+ *
+ * The cache is filled from the Simple_Desc_rsp, Active_EP_rsp and
+ * Match_Desc_rsp seen by the host. An entry is fresh for TtlMs after a
+ * Match_Desc_req broadcast collected the answers of the network, and a
+ * fresh lookup is answered without any request. Lookups of entries that
+ * are not fresh return what is known and queue a discovery. Entries in
+ * use are discovered again once RefreshMs old, one broadcast at a time
+ * and no more often than MinGapMs, so the refresh does not load the
+ * mesh. An announce of a device removes its endpoints and makes the
+ * entries it was in stale, a leave removes them.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "svcCache.h"
+#include "rpc.h"
+#include "mtZdo.h"
+#include "mtEvent.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define SVC_CACHE_KEY(profileId, clusterId) \
+	(((uint32_t) (profileId) << 16) | (clusterId))
+
+// Match_Desc_req destination, all devices with the receiver on
+#define SVC_CACHE_BROADCAST      (0xFFFD)
+
+#define SVC_CACHE_MAGIC          (0x43435653)
+#define SVC_CACHE_VERSION        (1)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+	uint16_t NwkAddr;
+	uint8_t Endpoint;
+	uint8_t Seen;             // answered the discovery in flight
+	uint8_t Misses;           // discoveries not answered in a row
+} scMember_t;
+
+typedef struct
+{
+	uint32_t Key;             // profile and cluster, the sort key
+	uint8_t Complete;         // a discovery ended less than TtlMs ago
+	uint8_t Used;             // looked up since the last discovery
+	uint8_t Queued;           // discovery queued
+	uint64_t UpdatedMs;       // end of the last discovery
+	uint64_t QueuedMs;
+	uint32_t MemberCount;
+	uint32_t MemberAlloc;
+	scMember_t *Members;
+} scEntry_t;
+
+// record of the cache file
+typedef struct
+{
+	uint32_t Key;
+	uint32_t AgeMs;           // age of the discovery, 0xFFFFFFFF if none
+	uint32_t MemberCount;
+} scFileEntry_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static pthread_mutex_t scLock = PTHREAD_MUTEX_INITIALIZER;
+static svcCacheCfg_t scCfg;
+static uint8_t scOpen;
+static scEntry_t *scEntries;
+static uint32_t scEntryCnt;
+static uint32_t scEntryAlloc;
+
+// discovery in flight
+static uint8_t scInFlight;
+static uint32_t scInFlightKey;
+static uint64_t scInFlightEndMs;
+static uint64_t scLastSendMs;
+
+static svcCacheStats_t scStats;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowMs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in milli seconds
+ */
+static uint64_t nowMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*********************************************************************
+ * @fn      entryFind
+ *
+ * @brief   binary search of an entry
+ *
+ * @param   key - profile and cluster
+ * @param   pos - set to the position of the entry, or where to insert it
+ *
+ * @return  entry, NULL if none
+ */
+static scEntry_t *entryFind(uint32_t key, uint32_t *pos)
+{
+	uint32_t lo = 0;
+	uint32_t hi = scEntryCnt;
+
+	while (lo < hi)
+	{
+		uint32_t mid = (lo + hi) / 2;
+
+		if (scEntries[mid].Key < key)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	if (pos)
+	{
+		*pos = lo;
+	}
+
+	return ((lo < scEntryCnt) && (scEntries[lo].Key == key)) ?
+	        &scEntries[lo] : NULL;
+}
+
+/*********************************************************************
+ * @fn      entryGet
+ *
+ * @brief   finds an entry, creating it if needed
+ *
+ * @param   key - profile and cluster
+ *
+ * @return  entry, NULL if the memory was not allocated
+ */
+static scEntry_t *entryGet(uint32_t key)
+{
+	scEntry_t *entry;
+	uint32_t pos;
+
+	entry = entryFind(key, &pos);
+	if (entry)
+	{
+		return entry;
+	}
+	if (scEntryCnt == scEntryAlloc)
+	{
+		uint32_t newAlloc = scEntryAlloc ? (scEntryAlloc * 2) : 32;
+		void *p = realloc(scEntries, newAlloc * sizeof(scEntry_t));
+
+		if (p == NULL)
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "svcCache: allocation failed\n");
+			return NULL;
+		}
+		scEntries = p;
+		scEntryAlloc = newAlloc;
+	}
+	memmove(&scEntries[pos + 1], &scEntries[pos],
+	        (scEntryCnt - pos) * sizeof(scEntry_t));
+	scEntryCnt++;
+	scStats.Entries = scEntryCnt;
+
+	entry = &scEntries[pos];
+	memset(entry, 0, sizeof(scEntry_t));
+	entry->Key = key;
+
+	return entry;
+}
+
+/*********************************************************************
+ * @fn      memberAdd
+ *
+ * @brief   adds an endpoint to an entry, or marks it seen
+ *
+ * @param   entry - entry
+ * @param   nwkAddr - network address
+ * @param   endpoint - endpoint
+ *
+ * @return  none
+ */
+static void memberAdd(scEntry_t *entry, uint16_t nwkAddr, uint8_t endpoint)
+{
+	scMember_t *member;
+	uint32_t i;
+
+	for (i = 0; i < entry->MemberCount; i++)
+	{
+		member = &entry->Members[i];
+		if ((member->NwkAddr == nwkAddr) && (member->Endpoint == endpoint))
+		{
+			member->Seen = 1;
+			member->Misses = 0;
+			return;
+		}
+	}
+	if (entry->MemberCount == entry->MemberAlloc)
+	{
+		uint32_t newAlloc = entry->MemberAlloc ? (entry->MemberAlloc * 2) : 4;
+		void *p = realloc(entry->Members, newAlloc * sizeof(scMember_t));
+
+		if (p == NULL)
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "svcCache: allocation failed\n");
+			return;
+		}
+		entry->Members = p;
+		entry->MemberAlloc = newAlloc;
+	}
+	member = &entry->Members[entry->MemberCount++];
+	member->NwkAddr = nwkAddr;
+	member->Endpoint = endpoint;
+	member->Seen = 1;
+	member->Misses = 0;
+}
+
+/*********************************************************************
+ * @fn      removeEndpoints
+ *
+ * @brief   removes the endpoints of a device from all entries
+ *
+ * @param   nwkAddr - network address
+ * @param   keepList - endpoints to keep, NULL for none
+ * @param   keepCnt - number of endpoints to keep
+ * @param   stale - 1 to make the entries losing an endpoint stale
+ *
+ * @return  number of endpoints removed
+ */
+static uint32_t removeEndpoints(uint16_t nwkAddr, uint8_t *keepList,
+        uint8_t keepCnt, uint8_t stale)
+{
+	uint32_t removed = 0;
+	uint32_t n, i;
+	uint8_t k;
+
+	for (n = 0; n < scEntryCnt; n++)
+	{
+		scEntry_t *entry = &scEntries[n];
+
+		i = 0;
+		while (i < entry->MemberCount)
+		{
+			scMember_t *member = &entry->Members[i];
+
+			for (k = 0; k < keepCnt; k++)
+			{
+				if (keepList[k] == member->Endpoint)
+				{
+					break;
+				}
+			}
+			if ((member->NwkAddr != nwkAddr) || (k < keepCnt))
+			{
+				i++;
+				continue;
+			}
+			*member = entry->Members[--entry->MemberCount];
+			removed++;
+			if (stale)
+			{
+				entry->Complete = 0;
+			}
+		}
+	}
+
+	return removed;
+}
+
+/*********************************************************************
+ * @fn      queueDiscovery
+ *
+ * @brief   queues the discovery of an entry
+ */
+static void queueDiscovery(scEntry_t *entry, uint64_t now)
+{
+	if (!entry->Queued
+	        && !(scInFlight && (scInFlightKey == entry->Key)))
+	{
+		entry->Queued = 1;
+		entry->QueuedMs = now;
+	}
+}
+
+/*********************************************************************
+ * @fn      endDiscovery
+ *
+ * @brief   ends the discovery in flight, the endpoints that missed too
+ *          many discoveries are removed
+ *
+ * @param   now - time in milli seconds
+ *
+ * @return  none
+ */
+static void endDiscovery(uint64_t now)
+{
+	scEntry_t *entry = entryFind(scInFlightKey, NULL);
+	uint32_t i;
+
+	scInFlight = 0;
+	if (entry == NULL)
+	{
+		return;
+	}
+
+	i = 0;
+	while (i < entry->MemberCount)
+	{
+		scMember_t *member = &entry->Members[i];
+
+		if (!member->Seen && (++member->Misses >= scCfg.MaxMisses))
+		{
+			*member = entry->Members[--entry->MemberCount];
+			continue;
+		}
+		member->Seen = 0;
+		i++;
+	}
+	entry->Complete = 1;
+	entry->UpdatedMs = now;
+}
+
+/*********************************************************************
+ * @fn      loadFile
+ *
+ * @brief   reads the entries kept in the cache file. The age of the
+ *          discoveries includes the time the host was stopped.
+ *
+ * @return  0 on success, -1 if the file was not read
+ */
+static int32_t loadFile(void)
+{
+	uint32_t header[4];
+	scFileEntry_t rec;
+	svcCacheMember_t member;
+	uint64_t now = nowMs();
+	uint64_t offMs;
+	uint32_t n, i;
+	FILE *fp;
+
+	fp = fopen(scCfg.Path, "r");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	if ((fread(header, sizeof(header), 1, fp) != 1)
+	        || (header[0] != SVC_CACHE_MAGIC) || (header[1] != SVC_CACHE_VERSION))
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "svcCache: %s is not a cache file\n",
+		        scCfg.Path);
+		fclose(fp);
+		return -1;
+	}
+
+	//header[2] holds the wall clock time of the save
+	offMs = ((uint64_t) time(NULL) > header[2]) ?
+	        ((uint64_t) time(NULL) - header[2]) * 1000 : 0;
+	for (n = 0; n < header[3]; n++)
+	{
+		scEntry_t *entry;
+		uint64_t ageMs;
+
+		if (fread(&rec, sizeof(rec), 1, fp) != 1)
+		{
+			break;
+		}
+		entry = entryGet(rec.Key);
+		if (entry == NULL)
+		{
+			break;
+		}
+		for (i = 0; i < rec.MemberCount; i++)
+		{
+			if (fread(&member, sizeof(member), 1, fp) != 1)
+			{
+				break;
+			}
+			memberAdd(entry, member.NwkAddr, member.Endpoint);
+			entry->Members[entry->MemberCount - 1].Seen = 0;
+		}
+		ageMs = rec.AgeMs + offMs;
+		if ((rec.AgeMs != 0xFFFFFFFF) && (ageMs < scCfg.TtlMs) && (ageMs < now))
+		{
+			entry->Complete = 1;
+			entry->UpdatedMs = now - ageMs;
+		}
+	}
+	fclose(fp);
+	dbg_print(PRINT_LEVEL_INFO, "svcCache: %d entries read from %s\n",
+	        scEntryCnt, scCfg.Path);
+
+	return 0;
+}
+
+/*********************************************************************
+ * MT EVENT LISTENERS
+ */
+
+static void simpleDescRspCb(uint16_t event, void *data, void *arg)
+{
+	SimpleDescRspFormat_t *msg = data;
+	scEntry_t *entry;
+	uint32_t i;
+
+	if (msg->Status != MT_RPC_SUCCESS)
+	{
+		return;
+	}
+
+	//the descriptor replaces the clusters known for the endpoint
+	pthread_mutex_lock(&scLock);
+	for (i = 0; i < scEntryCnt; i++)
+	{
+		uint32_t m;
+
+		entry = &scEntries[i];
+		for (m = 0; m < entry->MemberCount; m++)
+		{
+			if ((entry->Members[m].NwkAddr == msg->NwkAddr)
+			        && (entry->Members[m].Endpoint == msg->Endpoint))
+			{
+				entry->Members[m] = entry->Members[--entry->MemberCount];
+				break;
+			}
+		}
+	}
+	for (i = 0; (i < msg->NumInClusters) && (i < 16); i++)
+	{
+		entry = entryGet(SVC_CACHE_KEY(msg->ProfileID, msg->InClusterList[i]));
+		if (entry)
+		{
+			memberAdd(entry, msg->NwkAddr, msg->Endpoint);
+		}
+	}
+	pthread_mutex_unlock(&scLock);
+}
+
+static void activeEpRspCb(uint16_t event, void *data, void *arg)
+{
+	ActiveEpRspFormat_t *msg = data;
+
+	if (msg->Status != MT_RPC_SUCCESS)
+	{
+		return;
+	}
+
+	//endpoints no longer active are dropped
+	pthread_mutex_lock(&scLock);
+	removeEndpoints(msg->NwkAddr, msg->ActiveEPList, msg->ActiveEPCount, 0);
+	pthread_mutex_unlock(&scLock);
+}
+
+static void matchDescRspCb(uint16_t event, void *data, void *arg)
+{
+	MatchDescRspFormat_t *msg = data;
+	scEntry_t *entry;
+	uint8_t i;
+
+	pthread_mutex_lock(&scLock);
+	if (scInFlight && (msg->Status == MT_RPC_SUCCESS))
+	{
+		scStats.Responses++;
+		entry = entryGet(scInFlightKey);
+		for (i = 0; entry && (i < msg->MatchLength); i++)
+		{
+			memberAdd(entry, msg->NwkAddr, msg->MatchList[i]);
+		}
+	}
+	pthread_mutex_unlock(&scLock);
+}
+
+static void endDeviceAnnceIndCb(uint16_t event, void *data, void *arg)
+{
+	EndDeviceAnnceIndFormat_t *msg = data;
+
+	pthread_mutex_lock(&scLock);
+	if (removeEndpoints(msg->NwkAddr, NULL, 0, 1))
+	{
+		scStats.Invalidations++;
+	}
+	pthread_mutex_unlock(&scLock);
+}
+
+static void leaveIndCb(uint16_t event, void *data, void *arg)
+{
+	LeaveIndFormat_t *msg = data;
+
+	pthread_mutex_lock(&scLock);
+	if (removeEndpoints(msg->SrcAddr, NULL, 0, msg->Rejoin))
+	{
+		scStats.Invalidations++;
+	}
+	pthread_mutex_unlock(&scLock);
+}
+
+static const struct
+{
+	uint16_t Event;
+	mtEventCb_t Cb;
+} scListeners[] =
+{
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_SIMPLE_DESC_RSP), simpleDescRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_ACTIVE_EP_RSP), activeEpRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_MATCH_DESC_RSP), matchDescRspCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_END_DEVICE_ANNCE_IND),
+	        endDeviceAnnceIndCb },
+	{ MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_LEAVE_IND), leaveIndCb },
+};
+
+#define SC_LISTENERS \
+	(sizeof(scListeners) / sizeof(scListeners[0]))
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      svcCacheInit
+ *
+ * @brief   starts filling the cache from the ZDO responses, and reads
+ *          the cache file if any
+ *
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t svcCacheInit(svcCacheCfg_t *cfg)
+{
+	uint32_t i;
+
+	svcCacheClose();
+
+	pthread_mutex_lock(&scLock);
+	memcpy(&scCfg, cfg, sizeof(svcCacheCfg_t));
+	if (scCfg.TtlMs == 0)
+	{
+		scCfg.TtlMs = SVC_CACHE_TTL_MS;
+	}
+	if ((scCfg.RefreshMs == 0) || (scCfg.RefreshMs > scCfg.TtlMs))
+	{
+		scCfg.RefreshMs = scCfg.TtlMs / 4 * 3;
+	}
+	if (scCfg.WaitMs == 0)
+	{
+		scCfg.WaitMs = SVC_CACHE_WAIT_MS;
+	}
+	if (scCfg.MinGapMs == 0)
+	{
+		scCfg.MinGapMs = SVC_CACHE_MIN_GAP_MS;
+	}
+	if (scCfg.MaxMisses == 0)
+	{
+		scCfg.MaxMisses = SVC_CACHE_MAX_MISSES;
+	}
+	memset(&scStats, 0, sizeof(scStats));
+	if (scCfg.Path)
+	{
+		scCfg.Path = strdup(scCfg.Path);
+		loadFile();
+	}
+	scOpen = 1;
+	pthread_mutex_unlock(&scLock);
+
+	for (i = 0; i < SC_LISTENERS; i++)
+	{
+		mtEventAddListener(scListeners[i].Event, scListeners[i].Cb, NULL,
+		        MT_EVENT_PRIO_DEFAULT);
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      svcCacheClose
+ *
+ * @brief   saves the cache file if any and frees the cache
+ *
+ * @return  none
+ */
+void svcCacheClose(void)
+{
+	uint32_t n;
+
+	for (n = 0; n < SC_LISTENERS; n++)
+	{
+		mtEventRemoveListener(scListeners[n].Event, scListeners[n].Cb, NULL);
+	}
+	if (!scOpen)
+	{
+		return;
+	}
+	svcCacheSave();
+
+	pthread_mutex_lock(&scLock);
+	for (n = 0; n < scEntryCnt; n++)
+	{
+		free(scEntries[n].Members);
+	}
+	free(scEntries);
+	free(scCfg.Path);
+	scEntries = NULL;
+	scEntryCnt = 0;
+	scEntryAlloc = 0;
+	scInFlight = 0;
+	scOpen = 0;
+	pthread_mutex_unlock(&scLock);
+}
+
+/*********************************************************************
+ * @fn      svcCacheLookup
+ *
+ * @brief   finds the endpoints implementing a server cluster. A fresh
+ *          entry is answered without any request, otherwise the known
+ *          endpoints are returned and a discovery is queued.
+ *
+ * @param   profileId - profile
+ * @param   clusterId - server cluster
+ * @param   members - filled with the endpoints
+ * @param   maxMembers - size of members
+ * @param   count - set to the number of endpoints known
+ *
+ * @return  SVC_CACHE_FRESH, SVC_CACHE_STALE or SVC_CACHE_MISS, -1 on error
+ */
+int32_t svcCacheLookup(uint16_t profileId, uint16_t clusterId,
+        svcCacheMember_t *members, uint32_t maxMembers, uint32_t *count)
+{
+	uint64_t now = nowMs();
+	scEntry_t *entry;
+	int32_t status;
+	uint32_t i;
+
+	*count = 0;
+	pthread_mutex_lock(&scLock);
+	if (!scOpen)
+	{
+		pthread_mutex_unlock(&scLock);
+		return -1;
+	}
+	scStats.Lookups++;
+
+	entry = entryFind(SVC_CACHE_KEY(profileId, clusterId), NULL);
+	if (entry && entry->Complete && (now - entry->UpdatedMs < scCfg.TtlMs))
+	{
+		entry->Used = 1;
+		scStats.Hits++;
+		status = SVC_CACHE_FRESH;
+	}
+	else if (entry)
+	{
+		entry->Complete = 0;
+		queueDiscovery(entry, now);
+		scStats.Stale++;
+		status = SVC_CACHE_STALE;
+	}
+	else
+	{
+		entry = entryGet(SVC_CACHE_KEY(profileId, clusterId));
+		if (entry == NULL)
+		{
+			pthread_mutex_unlock(&scLock);
+			return -1;
+		}
+		queueDiscovery(entry, now);
+		scStats.Misses++;
+		status = SVC_CACHE_MISS;
+	}
+
+	for (i = 0; (i < entry->MemberCount) && (i < maxMembers); i++)
+	{
+		members[i].NwkAddr = entry->Members[i].NwkAddr;
+		members[i].Endpoint = entry->Members[i].Endpoint;
+	}
+	*count = entry->MemberCount;
+	pthread_mutex_unlock(&scLock);
+
+	return status;
+}
+
+/*********************************************************************
+ * @fn      svcCacheDiscover
+ *
+ * @brief   queues the discovery of a server cluster, fresh or not
+ *
+ * @param   profileId - profile
+ * @param   clusterId - server cluster
+ *
+ * @return  none
+ */
+void svcCacheDiscover(uint16_t profileId, uint16_t clusterId)
+{
+	scEntry_t *entry;
+
+	pthread_mutex_lock(&scLock);
+	entry = scOpen ? entryGet(SVC_CACHE_KEY(profileId, clusterId)) : NULL;
+	if (entry)
+	{
+		queueDiscovery(entry, nowMs());
+	}
+	pthread_mutex_unlock(&scLock);
+}
+
+/*********************************************************************
+ * @fn      svcCachePoll
+ *
+ * @brief   ends the discovery in flight once WaitMs passed, queues the
+ *          refreshes and broadcasts the oldest queued discovery. To be
+ *          called periodically from the application thread.
+ *
+ * @return  number of discoveries queued or in flight
+ */
+uint32_t svcCachePoll(void)
+{
+	uint64_t now = nowMs();
+	scEntry_t *next = NULL;
+	MatchDescReqFormat_t req;
+	uint32_t pending = 0;
+	uint8_t ended = 0;
+	uint8_t status;
+	uint32_t n;
+
+	pthread_mutex_lock(&scLock);
+	if (!scOpen)
+	{
+		pthread_mutex_unlock(&scLock);
+		return 0;
+	}
+	if (scInFlight && (now >= scInFlightEndMs))
+	{
+		endDiscovery(now);
+		ended = 1;
+	}
+
+	for (n = 0; n < scEntryCnt; n++)
+	{
+		scEntry_t *entry = &scEntries[n];
+
+		if (entry->Complete && (now - entry->UpdatedMs >= scCfg.TtlMs))
+		{
+			entry->Complete = 0;
+		}
+		//only the entries in use are refreshed
+		if (entry->Complete && entry->Used && !entry->Queued
+		        && (now - entry->UpdatedMs >= scCfg.RefreshMs))
+		{
+			entry->Used = 0;
+			queueDiscovery(entry, now);
+			scStats.Refreshes++;
+		}
+		if (entry->Queued)
+		{
+			pending++;
+			if ((next == NULL) || (entry->QueuedMs < next->QueuedMs))
+			{
+				next = entry;
+			}
+		}
+	}
+
+	if (!scInFlight && next && (now - scLastSendMs >= scCfg.MinGapMs))
+	{
+		next->Queued = 0;
+		scInFlight = 1;
+		scInFlightKey = next->Key;
+		scInFlightEndMs = now + scCfg.WaitMs;
+		scLastSendMs = now;
+		scStats.Discoveries++;
+
+		memset(&req, 0, sizeof(req));
+		req.DstAddr = SVC_CACHE_BROADCAST;
+		req.NwkAddrOfInterest = SVC_CACHE_BROADCAST;
+		req.ProfileID = next->Key >> 16;
+		req.NumInClusters = 1;
+		req.InClusterList[0] = next->Key & 0xFFFF;
+		pthread_mutex_unlock(&scLock);
+		status = zdoMatchDescReq(&req);
+		pthread_mutex_lock(&scLock);
+		if (status != MT_RPC_SUCCESS)
+		{
+			dbg_print(PRINT_LEVEL_WARNING,
+			        "svcCache: Match_Desc_req 0x%04X/0x%04X failed\n",
+			        req.ProfileID, req.InClusterList[0]);
+			scInFlight = 0;
+			next = entryFind(SVC_CACHE_KEY(req.ProfileID, req.InClusterList[0]),
+			        NULL);
+			if (next)
+			{
+				queueDiscovery(next, now);
+			}
+		}
+		else
+		{
+			//the discovery is counted as pending until it ends
+			pending--;
+		}
+	}
+	if (scInFlight)
+	{
+		pending++;
+	}
+	pthread_mutex_unlock(&scLock);
+
+	if (ended && scCfg.Path)
+	{
+		svcCacheSave();
+	}
+
+	return pending;
+}
+
+/*********************************************************************
+ * @fn      svcCacheSave
+ *
+ * @brief   writes the cache to a temp file and renames it over the
+ *          cache file
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t svcCacheSave(void)
+{
+	char tmpPath[512];
+	uint32_t header[4];
+	scFileEntry_t rec;
+	svcCacheMember_t member;
+	uint64_t now = nowMs();
+	uint32_t n, i;
+	FILE *fp;
+
+	pthread_mutex_lock(&scLock);
+	if (!scOpen || (scCfg.Path == NULL))
+	{
+		pthread_mutex_unlock(&scLock);
+		return -1;
+	}
+
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", scCfg.Path);
+	fp = fopen(tmpPath, "w");
+	if (fp == NULL)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "svcCache: %s open failed - %s\n",
+		        tmpPath, strerror(errno));
+		pthread_mutex_unlock(&scLock);
+		return -1;
+	}
+
+	header[0] = SVC_CACHE_MAGIC;
+	header[1] = SVC_CACHE_VERSION;
+	header[2] = (uint32_t) time(NULL);
+	header[3] = scEntryCnt;
+	fwrite(header, sizeof(header), 1, fp);
+	for (n = 0; n < scEntryCnt; n++)
+	{
+		scEntry_t *entry = &scEntries[n];
+
+		rec.Key = entry->Key;
+		rec.AgeMs = entry->Complete ?
+		        (uint32_t) (now - entry->UpdatedMs) : 0xFFFFFFFF;
+		rec.MemberCount = entry->MemberCount;
+		fwrite(&rec, sizeof(rec), 1, fp);
+		for (i = 0; i < entry->MemberCount; i++)
+		{
+			member.NwkAddr = entry->Members[i].NwkAddr;
+			member.Endpoint = entry->Members[i].Endpoint;
+			fwrite(&member, sizeof(member), 1, fp);
+		}
+	}
+	fclose(fp);
+
+	if (rename(tmpPath, scCfg.Path) != 0)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "svcCache: rename to %s failed\n",
+		        scCfg.Path);
+		pthread_mutex_unlock(&scLock);
+		return -1;
+	}
+	pthread_mutex_unlock(&scLock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      svcCacheGetStats
+ *
+ * @brief   reads the cache statistics
+ *
+ * @param   stats - filled with the statistics
+ *
+ * @return  none
+ */
+void svcCacheGetStats(svcCacheStats_t *stats)
+{
+	pthread_mutex_lock(&scLock);
+	memcpy(stats, &scStats, sizeof(svcCacheStats_t));
+	pthread_mutex_unlock(&scLock);
+}
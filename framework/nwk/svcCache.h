@@ -0,0 +1,93 @@
+/*
+ * svcCache.h
+ *
+ * This module contains the service discovery cache, which maps a
+ * profile and server cluster to the endpoints implementing it.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef SVCCACHE_H
+#define SVCCACHE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// defaults used for the svcCacheCfg_t fields left 0
+#define SVC_CACHE_TTL_MS         (1800000)
+#define SVC_CACHE_WAIT_MS        (3000)
+#define SVC_CACHE_MIN_GAP_MS     (1000)
+#define SVC_CACHE_MAX_MISSES     (2)
+
+// svcCacheLookup return values
+#define SVC_CACHE_FRESH          (0)
+#define SVC_CACHE_STALE          (1)
+#define SVC_CACHE_MISS           (2)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint32_t TtlMs;           // age after which a discovery is no longer used
+	uint32_t RefreshMs;       // age after which a used entry is discovered
+	                          // again, 0 for 3/4 of TtlMs
+	uint32_t WaitMs;          // time Match_Desc_rsp are collected
+	uint32_t MinGapMs;        // time between two Match_Desc_req broadcasts
+	uint8_t MaxMisses;        // discoveries an endpoint may miss before removal
+	char *Path;               // file keeping the cache across restarts, or NULL
+} svcCacheCfg_t;
+
+typedef struct
+{
+	uint16_t NwkAddr;
+	uint8_t Endpoint;
+} svcCacheMember_t;
+
+typedef struct
+{
+	uint32_t Lookups;
+	uint32_t Hits;            // lookups answered without traffic
+	uint32_t Stale;
+	uint32_t Misses;
+	uint32_t Discoveries;     // Match_Desc_req broadcast
+	uint32_t Refreshes;       // discoveries started by the refresh policy
+	uint32_t Responses;       // Match_Desc_rsp received
+	uint32_t Invalidations;   // announces and leaves removing endpoints
+	uint32_t Entries;
+} svcCacheStats_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t svcCacheInit(svcCacheCfg_t *cfg);
+void svcCacheClose(void);
+
+int32_t svcCacheLookup(uint16_t profileId, uint16_t clusterId,
+        svcCacheMember_t *members, uint32_t maxMembers, uint32_t *count);
+void svcCacheDiscover(uint16_t profileId, uint16_t clusterId);
+uint32_t svcCachePoll(void);
+
+int32_t svcCacheSave(void);
+void svcCacheGetStats(svcCacheStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SVCCACHE_H */
@@ -0,0 +1,852 @@
+/*
+ * tblHarvest.c
+ *
+ * This module contains the table harvester, which periodically collects
+ * the routing and binding tables of the routers with Mgmt_Rtg_req and
+ * Mgmt_Bind_req.
+ *
+ * A refresh of a table first reads its first page. If the table size
+ * and a hash of that page match the last complete read, the refresh
+ * ends there, so unchanged tables cost one request. Every FullEvery
+ * refreshes the whole table is read regardless, to catch changes past
+ * the first page. The pages of one table are read in order, the tables
+ * of different routers in parallel while fewer than MaxInFlight requests
+ * are outstanding.
+ *
+ * The routes of a router are kept sorted by destination. When a table
+ * is read, the next hop of each destination is compared with the last
+ * read, the changes count the route thrash.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "tblHarvest.h"
+#include "rpc.h"
+#include "mtZdo.h"
+#include "mtEvent.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+// MT dispatch wait of tblHarvestRun() between polls
+#define TBL_HARVEST_POLL_MS        (10)
+
+#define FNV_OFFSET                 (0x811C9DC5)
+#define FNV_PRIME                  (0x01000193)
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowMs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in milli seconds
+ */
+static uint64_t nowMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*********************************************************************
+ * @fn      hashBytes
+ *
+ * @brief   FNV-1a hash
+ *
+ * @param   hash - hash so far
+ * @param   buf - data
+ * @param   len - length of the data
+ *
+ * @return  hash
+ */
+static uint32_t hashBytes(uint32_t hash, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		hash = (hash ^ p[i]) * FNV_PRIME;
+	}
+
+	return hash;
+}
+
+/*********************************************************************
+ * @fn      routeCompare
+ *
+ * @brief   orders routes by destination for qsort
+ */
+static int routeCompare(const void *a, const void *b)
+{
+	const tblHarvestRoute_t *ra = a;
+	const tblHarvestRoute_t *rb = b;
+
+	return (int) ra->DstAddr - (int) rb->DstAddr;
+}
+
+/*********************************************************************
+ * @fn      routeFind
+ *
+ * @brief   binary search of the routes of a router
+ *
+ * @param   routes - routes sorted by destination
+ * @param   count - number of routes
+ * @param   dstAddr - destination
+ *
+ * @return  route, NULL if the router has no route to the destination
+ */
+static tblHarvestRoute_t *routeFind(tblHarvestRoute_t *routes, uint32_t count,
+        uint16_t dstAddr)
+{
+	uint32_t lo = 0;
+	uint32_t hi = count;
+
+	while (lo < hi)
+	{
+		uint32_t mid = (lo + hi) / 2;
+
+		if (routes[mid].DstAddr == dstAddr)
+		{
+			return &routes[mid];
+		}
+		if (routes[mid].DstAddr < dstAddr)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      tableStart
+ *
+ * @brief   starts the refresh of a table
+ *
+ * @param   ctx - harvester
+ * @param   t - table
+ *
+ * @return  none
+ */
+static void tableStart(tblHarvest_t *ctx, tblHarvestTable_t *t)
+{
+	t->Busy = 1;
+	t->Probe = t->Valid && (t->Refreshes < ctx->Cfg.FullEvery);
+	t->NextIndex = 0;
+	t->Tries = 0;
+	t->DeadlineMs = 0;
+	t->Staged = 0;
+}
+
+/*********************************************************************
+ * @fn      tableEnd
+ *
+ * @brief   ends the refresh of a table
+ *
+ * @param   t - table
+ *
+ * @return  none
+ */
+static void tableEnd(tblHarvestTable_t *t)
+{
+	t->Busy = 0;
+	t->DeadlineMs = 0;
+	free(t->Staging);
+	t->Staging = NULL;
+}
+
+/*********************************************************************
+ * @fn      tablePage
+ *
+ * @brief   checks a response against the page in flight and handles the
+ *          probe of the first page
+ *
+ * @param   ctx - harvester
+ * @param   t - table
+ * @param   status - response status
+ * @param   total - table size reported
+ * @param   startIndex - StartIndex of the response
+ * @param   hash - hash of the entries of the response
+ * @param   entrySize - size of a stored entry
+ *
+ * @return  1 if the entries are to be staged, else 0
+ */
+static uint8_t tablePage(tblHarvest_t *ctx, tblHarvestTable_t *t,
+        uint8_t status, uint8_t total, uint8_t startIndex, uint32_t hash,
+        size_t entrySize)
+{
+	if (!t->Busy || (t->DeadlineMs == 0) || (startIndex != t->NextIndex))
+	{
+		//late answer to a page that was retried
+		return 0;
+	}
+	ctx->InFlight--;
+	t->DeadlineMs = 0;
+	t->Tries = 0;
+	ctx->Stats.Responses++;
+
+	if (status != MT_RPC_SUCCESS)
+	{
+		ctx->Stats.Dropped++;
+		tableEnd(t);
+		return 0;
+	}
+
+	if (startIndex == 0)
+	{
+		hash = hashBytes(hash, &total, sizeof(total));
+		if (t->Probe && (total == t->Total) && (hash == t->ProbeHash))
+		{
+			ctx->Stats.Unchanged++;
+			t->Refreshes++;
+			tableEnd(t);
+			return 0;
+		}
+		t->ProbeHash = hash;
+		t->Total = total;
+		free(t->Staging);
+		t->Staging = malloc((total ? total : 1) * entrySize);
+		if (t->Staging == NULL)
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "tblHarvest: allocation failed\n");
+			tableEnd(t);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*********************************************************************
+ * @fn      tableNext
+ *
+ * @brief   moves to the next page after the entries were staged
+ *
+ * @param   t - table
+ * @param   count - entries in the response
+ *
+ * @return  1 if the table is complete, else 0
+ */
+static uint8_t tableNext(tblHarvestTable_t *t, uint8_t count)
+{
+	uint32_t next = t->NextIndex + count;
+
+	if ((count == 0) || (next >= t->Total))
+	{
+		return 1;
+	}
+	t->NextIndex = next;
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      routeCommit
+ *
+ * @brief   replaces the routes of a router with the staged table and
+ *          counts the next hop changes
+ *
+ * @param   ctx - harvester
+ * @param   r - router
+ *
+ * @return  none
+ */
+static void routeCommit(tblHarvest_t *ctx, tblHarvestRouter_t *r)
+{
+	tblHarvestTable_t *t = &r->Rtg;
+	tblHarvestRoute_t *routes = t->Staging;
+	uint32_t i;
+
+	qsort(routes, t->Staged, sizeof(tblHarvestRoute_t), routeCompare);
+	for (i = 0; i < t->Staged; i++)
+	{
+		tblHarvestRoute_t *old = routeFind(r->Routes, t->Count,
+		        routes[i].DstAddr);
+
+		if (old == NULL)
+		{
+			continue;
+		}
+		routes[i].Changes = old->Changes;
+		if (old->NextHop != routes[i].NextHop)
+		{
+			routes[i].Changes++;
+			r->RouteChanges++;
+			ctx->Stats.RouteChanges++;
+		}
+	}
+
+	free(r->Routes);
+	r->Routes = routes;
+	t->Staging = NULL;
+	t->Count = t->Staged;
+	t->Valid = 1;
+	t->Refreshes = 0;
+	t->UpdatedMs = nowMs();
+	ctx->Stats.Reads++;
+	tableEnd(t);
+}
+
+/*********************************************************************
+ * @fn      bindCommit
+ *
+ * @brief   replaces the bindings of a router with the staged table
+ *
+ * @param   ctx - harvester
+ * @param   r - router
+ *
+ * @return  none
+ */
+static void bindCommit(tblHarvest_t *ctx, tblHarvestRouter_t *r)
+{
+	tblHarvestTable_t *t = &r->Bind;
+
+	free(r->Binds);
+	r->Binds = t->Staging;
+	t->Staging = NULL;
+	t->Count = t->Staged;
+	t->Valid = 1;
+	t->Refreshes = 0;
+	t->UpdatedMs = nowMs();
+	ctx->Stats.Reads++;
+	tableEnd(t);
+}
+
+/*********************************************************************
+ * MT EVENT LISTENERS
+ */
+
+static void mgmtRtgRspCb(uint16_t event, void *data, void *arg)
+{
+	MgmtRtgRspFormat_t *msg = data;
+	tblHarvest_t *ctx = arg;
+	tblHarvestRouter_t *r;
+	tblHarvestRoute_t *routes;
+	uint32_t hash = FNV_OFFSET;
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+	r = tblHarvestFindRouter(ctx, msg->SrcAddr);
+	if (r == NULL)
+	{
+		pthread_mutex_unlock(&ctx->Lock);
+		return;
+	}
+
+	for (i = 0; i < msg->RoutingTableListCount; i++)
+	{
+		RoutingTableListItemFormat_t *e = &msg->RoutingTableList[i];
+
+		hash = hashBytes(hash, &e->DstAddr, sizeof(e->DstAddr));
+		hash = hashBytes(hash, &e->Status, sizeof(e->Status));
+		hash = hashBytes(hash, &e->NextHop, sizeof(e->NextHop));
+	}
+	if (tablePage(ctx, &r->Rtg, msg->Status, msg->RoutingTableEntries,
+	        msg->StartIndex, hash, sizeof(tblHarvestRoute_t)))
+	{
+		routes = r->Rtg.Staging;
+		for (i = 0; (i < msg->RoutingTableListCount)
+		        && (r->Rtg.Staged < r->Rtg.Total); i++)
+		{
+			tblHarvestRoute_t *dst = &routes[r->Rtg.Staged++];
+
+			dst->DstAddr = msg->RoutingTableList[i].DstAddr;
+			dst->Status = msg->RoutingTableList[i].Status;
+			dst->NextHop = msg->RoutingTableList[i].NextHop;
+			dst->Changes = 0;
+		}
+		if (tableNext(&r->Rtg, msg->RoutingTableListCount))
+		{
+			routeCommit(ctx, r);
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+static void mgmtBindRspCb(uint16_t event, void *data, void *arg)
+{
+	MgmtBindRspFormat_t *msg = data;
+	tblHarvest_t *ctx = arg;
+	tblHarvestRouter_t *r;
+	tblHarvestBind_t *binds;
+	uint32_t hash = FNV_OFFSET;
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+	r = tblHarvestFindRouter(ctx, msg->SrcAddr);
+	if (r == NULL)
+	{
+		pthread_mutex_unlock(&ctx->Lock);
+		return;
+	}
+
+	for (i = 0; i < msg->BindingTableListCount; i++)
+	{
+		BindingTableListItemFormat_t *e = &msg->BindingTableList[i];
+
+		hash = hashBytes(hash, &e->SrcIEEEAddr, sizeof(e->SrcIEEEAddr));
+		hash = hashBytes(hash, &e->SrcEndpoint, sizeof(e->SrcEndpoint));
+		hash = hashBytes(hash, &e->ClusterID, sizeof(e->ClusterID));
+		hash = hashBytes(hash, &e->DstAddrMode, sizeof(e->DstAddrMode));
+		hash = hashBytes(hash, &e->DstIEEEAddr, sizeof(e->DstIEEEAddr));
+		hash = hashBytes(hash, &e->DstEndpoint, sizeof(e->DstEndpoint));
+	}
+	if (tablePage(ctx, &r->Bind, msg->Status, msg->BindingTableEntries,
+	        msg->StartIndex, hash, sizeof(tblHarvestBind_t)))
+	{
+		binds = r->Bind.Staging;
+		for (i = 0; (i < msg->BindingTableListCount)
+		        && (r->Bind.Staged < r->Bind.Total); i++)
+		{
+			tblHarvestBind_t *dst = &binds[r->Bind.Staged++];
+			BindingTableListItemFormat_t *e = &msg->BindingTableList[i];
+
+			dst->SrcIEEEAddr = e->SrcIEEEAddr;
+			dst->SrcEndpoint = e->SrcEndpoint;
+			dst->ClusterID = e->ClusterID;
+			dst->DstAddrMode = e->DstAddrMode;
+			dst->DstIEEEAddr = e->DstIEEEAddr;
+			dst->DstEndpoint = e->DstEndpoint;
+		}
+		if (tableNext(&r->Bind, msg->BindingTableListCount))
+		{
+			bindCommit(ctx, r);
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      tableSend
+ *
+ * @brief   sends the page in flight of a table. Called with the lock
+ *          held, the lock is released while the request waits for its
+ *          SRSP.
+ *
+ * @param   ctx - harvester
+ * @param   routerIdx - router index
+ * @param   kind - TBL_HARVEST_RTG or TBL_HARVEST_BIND
+ *
+ * @return  none
+ */
+static void tableSend(tblHarvest_t *ctx, uint32_t routerIdx, uint8_t kind)
+{
+	tblHarvestRouter_t *r = &ctx->Routers[routerIdx];
+	tblHarvestTable_t *t = (kind == TBL_HARVEST_RTG) ? &r->Rtg : &r->Bind;
+	uint16_t nwkAddr = r->NwkAddr;
+	uint8_t startIndex = t->NextIndex;
+	uint8_t status;
+
+	t->DeadlineMs = nowMs() + ctx->Cfg.TimeoutMs;
+	ctx->InFlight++;
+	ctx->Stats.Requests++;
+
+	pthread_mutex_unlock(&ctx->Lock);
+	if (kind == TBL_HARVEST_RTG)
+	{
+		MgmtRtgReqFormat_t req;
+
+		req.DstAddr = nwkAddr;
+		req.StartIndex = startIndex;
+		status = zdoMgmtRtgReq(&req);
+	}
+	else
+	{
+		MgmtBindReqFormat_t req;
+
+		req.DstAddr = nwkAddr;
+		req.StartIndex = startIndex;
+		status = zdoMgmtBindReq(&req);
+	}
+	pthread_mutex_lock(&ctx->Lock);
+
+	if (status != MT_RPC_SUCCESS)
+	{
+		//the router may have been removed while unlocked
+		r = tblHarvestFindRouter(ctx, nwkAddr);
+		t = r ? ((kind == TBL_HARVEST_RTG) ? &r->Rtg : &r->Bind) : NULL;
+		if (t && t->DeadlineMs && (t->NextIndex == startIndex))
+		{
+			//retried by the next poll
+			t->DeadlineMs = 1;
+		}
+	}
+}
+
+/*********************************************************************
+ * @fn      tableTimeout
+ *
+ * @brief   retries or drops a page that was not answered in time
+ *
+ * @param   ctx - harvester
+ * @param   t - table
+ * @param   now - time in milli seconds
+ *
+ * @return  none
+ */
+static void tableTimeout(tblHarvest_t *ctx, tblHarvestTable_t *t, uint64_t now)
+{
+	if (!t->Busy || (t->DeadlineMs == 0) || (now < t->DeadlineMs))
+	{
+		return;
+	}
+	ctx->InFlight--;
+	t->DeadlineMs = 0;
+	if (t->Tries < ctx->Cfg.MaxRetries)
+	{
+		t->Tries++;
+		ctx->Stats.Retries++;
+	}
+	else
+	{
+		ctx->Stats.Dropped++;
+		tableEnd(t);
+	}
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      tblHarvestInit
+ *
+ * @brief   sets up a harvester and makes it receive the Mgmt_Rtg_rsp and
+ *          Mgmt_Bind_rsp
+ *
+ * @param   ctx - harvester
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 if the memory was not allocated
+ */
+int32_t tblHarvestInit(tblHarvest_t *ctx, tblHarvestCfg_t *cfg)
+{
+	memset(ctx, 0, sizeof(tblHarvest_t));
+	memcpy(&ctx->Cfg, cfg, sizeof(tblHarvestCfg_t));
+	if (ctx->Cfg.Tables == 0)
+	{
+		ctx->Cfg.Tables = TBL_HARVEST_RTG | TBL_HARVEST_BIND;
+	}
+	if (ctx->Cfg.PeriodMs == 0)
+	{
+		ctx->Cfg.PeriodMs = TBL_HARVEST_PERIOD_MS;
+	}
+	if (ctx->Cfg.MaxInFlight == 0)
+	{
+		ctx->Cfg.MaxInFlight = TBL_HARVEST_MAX_IN_FLIGHT;
+	}
+	if (ctx->Cfg.TimeoutMs == 0)
+	{
+		ctx->Cfg.TimeoutMs = TBL_HARVEST_TIMEOUT_MS;
+	}
+	if (ctx->Cfg.MaxRetries == 0)
+	{
+		ctx->Cfg.MaxRetries = TBL_HARVEST_MAX_RETRIES;
+	}
+	if (ctx->Cfg.FullEvery == 0)
+	{
+		ctx->Cfg.FullEvery = TBL_HARVEST_FULL_EVERY;
+	}
+
+	ctx->RouterIndex = calloc(65536, sizeof(uint32_t));
+	if (ctx->RouterIndex == NULL)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "tblHarvestInit: allocation failed\n");
+		return -1;
+	}
+	pthread_mutex_init(&ctx->Lock, NULL);
+
+	mtEventAddListener(MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_MGMT_RTG_RSP),
+	        mgmtRtgRspCb, ctx, MT_EVENT_PRIO_DEFAULT);
+	mtEventAddListener(MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_MGMT_BIND_RSP),
+	        mgmtBindRspCb, ctx, MT_EVENT_PRIO_DEFAULT);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      tblHarvestClose
+ *
+ * @brief   stops the harvester receiving responses and frees the tables
+ *
+ * @param   ctx - harvester
+ *
+ * @return  none
+ */
+void tblHarvestClose(tblHarvest_t *ctx)
+{
+	uint32_t i;
+
+	mtEventRemoveListener(MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_MGMT_RTG_RSP),
+	        mgmtRtgRspCb, ctx);
+	mtEventRemoveListener(MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_MGMT_BIND_RSP),
+	        mgmtBindRspCb, ctx);
+
+	for (i = 0; i < ctx->RouterCount; i++)
+	{
+		tblHarvestRouter_t *r = &ctx->Routers[i];
+
+		free(r->Routes);
+		free(r->Binds);
+		free(r->Rtg.Staging);
+		free(r->Bind.Staging);
+	}
+	free(ctx->Routers);
+	free(ctx->RouterIndex);
+	pthread_mutex_destroy(&ctx->Lock);
+	memset(ctx, 0, sizeof(tblHarvest_t));
+}
+
+/*********************************************************************
+ * @fn      tblHarvestAddRouter
+ *
+ * @brief   adds a router to collect the tables of, its first refresh is
+ *          due at once
+ *
+ * @param   ctx - harvester
+ * @param   nwkAddr - network address of the router
+ *
+ * @return  0 on success, -1 if the memory was not allocated
+ */
+int32_t tblHarvestAddRouter(tblHarvest_t *ctx, uint16_t nwkAddr)
+{
+	tblHarvestRouter_t *r;
+
+	pthread_mutex_lock(&ctx->Lock);
+	if (ctx->RouterIndex[nwkAddr])
+	{
+		pthread_mutex_unlock(&ctx->Lock);
+		return 0;
+	}
+	if (ctx->RouterCount == ctx->RouterAlloc)
+	{
+		uint32_t newAlloc = ctx->RouterAlloc ? (ctx->RouterAlloc * 2) : 64;
+		void *p = realloc(ctx->Routers, newAlloc * sizeof(tblHarvestRouter_t));
+
+		if (p == NULL)
+		{
+			pthread_mutex_unlock(&ctx->Lock);
+			dbg_print(PRINT_LEVEL_WARNING,
+			        "tblHarvestAddRouter: allocation failed\n");
+			return -1;
+		}
+		ctx->Routers = p;
+		ctx->RouterAlloc = newAlloc;
+	}
+
+	r = &ctx->Routers[ctx->RouterCount];
+	memset(r, 0, sizeof(tblHarvestRouter_t));
+	r->NwkAddr = nwkAddr;
+	ctx->RouterIndex[nwkAddr] = ++ctx->RouterCount;
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      tblHarvestRemoveRouter
+ *
+ * @brief   stops collecting the tables of a router and frees them
+ *
+ * @param   ctx - harvester
+ * @param   nwkAddr - network address of the router
+ *
+ * @return  none
+ */
+void tblHarvestRemoveRouter(tblHarvest_t *ctx, uint16_t nwkAddr)
+{
+	tblHarvestRouter_t *r;
+	uint32_t idx;
+
+	pthread_mutex_lock(&ctx->Lock);
+	if (ctx->RouterIndex[nwkAddr] == 0)
+	{
+		pthread_mutex_unlock(&ctx->Lock);
+		return;
+	}
+	idx = ctx->RouterIndex[nwkAddr] - 1;
+	r = &ctx->Routers[idx];
+
+	if (r->Rtg.Busy && r->Rtg.DeadlineMs)
+	{
+		ctx->InFlight--;
+	}
+	if (r->Bind.Busy && r->Bind.DeadlineMs)
+	{
+		ctx->InFlight--;
+	}
+	free(r->Routes);
+	free(r->Binds);
+	free(r->Rtg.Staging);
+	free(r->Bind.Staging);
+	ctx->RouterIndex[nwkAddr] = 0;
+
+	//move the last router into the hole
+	ctx->RouterCount--;
+	if (idx != ctx->RouterCount)
+	{
+		*r = ctx->Routers[ctx->RouterCount];
+		ctx->RouterIndex[r->NwkAddr] = idx + 1;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      tblHarvestPoll
+ *
+ * @brief   starts the refreshes that are due, retries the pages that
+ *          timed out and sends the pages the in flight limit allows. The
+ *          responses are collected when the MT callbacks are dispatched.
+ *
+ * @param   ctx - harvester
+ *
+ * @return  number of table refreshes running
+ */
+uint32_t tblHarvestPoll(tblHarvest_t *ctx)
+{
+	uint64_t now = nowMs();
+	uint32_t running = 0;
+	uint32_t n;
+
+	pthread_mutex_lock(&ctx->Lock);
+	for (n = 0; n < ctx->RouterCount; n++)
+	{
+		tblHarvestRouter_t *r = &ctx->Routers[n];
+
+		tableTimeout(ctx, &r->Rtg, now);
+		tableTimeout(ctx, &r->Bind, now);
+		if (!r->Rtg.Busy && !r->Bind.Busy && (r->DueMs <= now))
+		{
+			if (ctx->Cfg.Tables & TBL_HARVEST_RTG)
+			{
+				tableStart(ctx, &r->Rtg);
+			}
+			if (ctx->Cfg.Tables & TBL_HARVEST_BIND)
+			{
+				tableStart(ctx, &r->Bind);
+			}
+			r->DueMs = now + ctx->Cfg.PeriodMs;
+		}
+	}
+
+	//round robin over the routers so none waits behind the others
+	for (n = 0; (n < ctx->RouterCount) && (ctx->InFlight < ctx->Cfg.MaxInFlight);
+	        n++)
+	{
+		uint32_t idx = (ctx->Cursor + n) % ctx->RouterCount;
+		tblHarvestRouter_t *r = &ctx->Routers[idx];
+
+		if (r->Rtg.Busy && (r->Rtg.DeadlineMs == 0))
+		{
+			tableSend(ctx, idx, TBL_HARVEST_RTG);
+			if (idx >= ctx->RouterCount)
+			{
+				continue;
+			}
+			r = &ctx->Routers[idx];
+		}
+		if (r->Bind.Busy && (r->Bind.DeadlineMs == 0)
+		        && (ctx->InFlight < ctx->Cfg.MaxInFlight))
+		{
+			tableSend(ctx, idx, TBL_HARVEST_BIND);
+		}
+	}
+	if (ctx->RouterCount)
+	{
+		ctx->Cursor = (ctx->Cursor + n) % ctx->RouterCount;
+	}
+
+	for (n = 0; n < ctx->RouterCount; n++)
+	{
+		running += ctx->Routers[n].Rtg.Busy + ctx->Routers[n].Bind.Busy;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return running;
+}
+
+/*********************************************************************
+ * @fn      tblHarvestRun
+ *
+ * @brief   refreshes the tables of all routers now, dispatching the MT
+ *          callbacks until the refreshes complete
+ *
+ * @param   ctx - harvester
+ *
+ * @return  none
+ */
+void tblHarvestRun(tblHarvest_t *ctx)
+{
+	uint32_t n;
+
+	pthread_mutex_lock(&ctx->Lock);
+	for (n = 0; n < ctx->RouterCount; n++)
+	{
+		ctx->Routers[n].DueMs = 0;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	while (tblHarvestPoll(ctx))
+	{
+		rpcWaitMqClientMsg(TBL_HARVEST_POLL_MS);
+	}
+}
+
+/*********************************************************************
+ * @fn      tblHarvestFindRouter
+ *
+ * @brief   looks up the tables of a router. The pointer is valid until
+ *          a router is added or removed.
+ *
+ * @param   ctx - harvester
+ * @param   nwkAddr - network address of the router
+ *
+ * @return  router, NULL if not harvested
+ */
+tblHarvestRouter_t *tblHarvestFindRouter(tblHarvest_t *ctx, uint16_t nwkAddr)
+{
+	if (ctx->RouterIndex[nwkAddr] == 0)
+	{
+		return NULL;
+	}
+
+	return &ctx->Routers[ctx->RouterIndex[nwkAddr] - 1];
+}
+
+/*********************************************************************
+ * @fn      tblHarvestFindRoute
+ *
+ * @brief   looks up the route of a router to a destination
+ *
+ * @param   router - router
+ * @param   dstAddr - destination
+ *
+ * @return  route, NULL if the router has no route to the destination
+ */
+tblHarvestRoute_t *tblHarvestFindRoute(tblHarvestRouter_t *router,
+        uint16_t dstAddr)
+{
+	return routeFind(router->Routes, router->Rtg.Count, dstAddr);
+}
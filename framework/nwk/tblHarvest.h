@@ -0,0 +1,152 @@
+/*
+ * tblHarvest.h
+ *
+ * This module contains the table harvester, which periodically collects
+ * the routing and binding tables of the routers with Mgmt_Rtg_req and
+ * Mgmt_Bind_req.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef TBLHARVEST_H
+#define TBLHARVEST_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include <pthread.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// tblHarvestCfg_t Tables
+#define TBL_HARVEST_RTG            (0x01)
+#define TBL_HARVEST_BIND           (0x02)
+
+// defaults used for the tblHarvestCfg_t fields left 0
+#define TBL_HARVEST_PERIOD_MS      (60000)
+#define TBL_HARVEST_MAX_IN_FLIGHT  (4)
+#define TBL_HARVEST_TIMEOUT_MS     (2000)
+#define TBL_HARVEST_MAX_RETRIES    (2)
+#define TBL_HARVEST_FULL_EVERY     (10)
+
+// entries a table can report
+#define TBL_HARVEST_MAX_ENTRIES    (255)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint8_t Tables;           // TBL_HARVEST_* to collect, 0 for both
+	uint32_t PeriodMs;        // time between the refreshes of a router
+	uint8_t MaxInFlight;      // requests in flight in the network
+	uint32_t TimeoutMs;       // time allowed for a response
+	uint8_t MaxRetries;       // retries of a page before the refresh is dropped
+	uint16_t FullEvery;       // refreshes between full reads of unchanged tables
+} tblHarvestCfg_t;
+
+typedef struct
+{
+	uint16_t DstAddr;
+	uint8_t Status;           // route status
+	uint16_t NextHop;
+	uint16_t Changes;         // next hop changes seen for this destination
+} tblHarvestRoute_t;
+
+typedef struct
+{
+	uint64_t SrcIEEEAddr;
+	uint8_t SrcEndpoint;
+	uint8_t ClusterID;
+	uint8_t DstAddrMode;
+	uint64_t DstIEEEAddr;
+	uint8_t DstEndpoint;
+} tblHarvestBind_t;
+
+// collection state of one table of one router
+typedef struct
+{
+	uint8_t Valid;            // a complete table was collected
+	uint8_t Total;            // entries reported by the router
+	uint8_t Count;            // entries stored
+	uint32_t ProbeHash;       // hash of the size and first page
+	uint16_t Refreshes;       // refreshes since the last full read
+	uint64_t UpdatedMs;       // time of the last full read
+
+	uint8_t Busy;             // a refresh is running
+	uint8_t Probe;            // the first page may end the refresh
+	uint8_t NextIndex;        // StartIndex of the page in flight
+	uint8_t Tries;
+	uint64_t DeadlineMs;      // 0 while no page is in flight
+	uint8_t Staged;           // entries collected by the running refresh
+	void *Staging;
+} tblHarvestTable_t;
+
+typedef struct
+{
+	uint16_t NwkAddr;
+	uint64_t DueMs;           // time of the next refresh
+	tblHarvestTable_t Rtg;
+	tblHarvestTable_t Bind;
+	tblHarvestRoute_t *Routes;  // sorted by DstAddr
+	tblHarvestBind_t *Binds;
+	uint32_t RouteChanges;    // next hop changes seen on this router
+} tblHarvestRouter_t;
+
+typedef struct
+{
+	uint32_t Requests;        // Mgmt_Rtg_req and Mgmt_Bind_req sent
+	uint32_t Responses;
+	uint32_t Retries;
+	uint32_t Dropped;         // refreshes given up after the retries
+	uint32_t Unchanged;       // refreshes ended by the first page
+	uint32_t Reads;           // complete tables read
+	uint32_t RouteChanges;    // next hop changes seen
+} tblHarvestStats_t;
+
+typedef struct
+{
+	tblHarvestCfg_t Cfg;
+	pthread_mutex_t Lock;
+	tblHarvestRouter_t *Routers;
+	uint32_t RouterCount;
+	uint32_t RouterAlloc;
+	uint32_t *RouterIndex;    // network address to router index + 1
+	uint32_t Cursor;          // router the next scan starts at
+	uint32_t InFlight;
+	tblHarvestStats_t Stats;
+} tblHarvest_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t tblHarvestInit(tblHarvest_t *ctx, tblHarvestCfg_t *cfg);
+void tblHarvestClose(tblHarvest_t *ctx);
+
+int32_t tblHarvestAddRouter(tblHarvest_t *ctx, uint16_t nwkAddr);
+void tblHarvestRemoveRouter(tblHarvest_t *ctx, uint16_t nwkAddr);
+
+uint32_t tblHarvestPoll(tblHarvest_t *ctx);
+void tblHarvestRun(tblHarvest_t *ctx);
+
+tblHarvestRouter_t *tblHarvestFindRouter(tblHarvest_t *ctx, uint16_t nwkAddr);
+tblHarvestRoute_t *tblHarvestFindRoute(tblHarvestRouter_t *router,
+        uint16_t dstAddr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TBLHARVEST_H */
@@ -0,0 +1,883 @@
+/*
+ * topoCrawl.c
+ *
+ * This module contains the topology crawler, which walks the routers of
+ * the network breadth first with Mgmt_Lqi_req and builds a graph of the
+ * nodes and links.
+ *
+ * Every neighbor table page is a separate request. The requests wait in
+ * a FIFO, so routers are crawled in the order they are discovered, and
+ * are sent while fewer than MaxInFlight are outstanding in the network
+ * and fewer than MaxPerRouter to the same router. Once the first page of
+ * a router gives the table size, its remaining pages are queued at once.
+ * A page that is not answered within TimeoutMs is requeued at the front
+ * up to MaxRetries times.
+ *
+ * The graph is kept between crawls. Each crawl updates the nodes and
+ * links it sees and stamps them with its round, the exports only include
+ * what the last crawl saw.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "topoCrawl.h"
+#include "nodeReg.h"
+#include "rpc.h"
+#include "mtZdo.h"
+#include "mtSys.h"
+#include "mtEvent.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define BIT_GET(map, bit)          ((map)[(bit) >> 3] & (1 << ((bit) & 7)))
+#define BIT_SET(map, bit)          ((map)[(bit) >> 3] |= (1 << ((bit) & 7)))
+
+// MT dispatch wait of topoCrawlRun() between polls
+#define TOPO_CRAWL_POLL_MS         (10)
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      nowUs
+ *
+ * @brief   reads the monotonic clock
+ *
+ * @return  time in micro seconds
+ */
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*********************************************************************
+ * @fn      grow
+ *
+ * @brief   doubles an array when it is full
+ *
+ * @param   array - array
+ * @param   alloc - elements allocated
+ * @param   used - elements used
+ * @param   size - element size
+ *
+ * @return  0 on success, -1 if the memory was not allocated
+ */
+static int32_t grow(void **array, uint32_t *alloc, uint32_t used, size_t size)
+{
+	uint32_t newAlloc;
+	void *p;
+
+	if (used < *alloc)
+	{
+		return 0;
+	}
+	newAlloc = (*alloc) ? (*alloc * 2) : 64;
+	p = realloc(*array, newAlloc * size);
+	if (p == NULL)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "topoCrawl: allocation failed\n");
+		return -1;
+	}
+	*array = p;
+	*alloc = newAlloc;
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      nodeGet
+ *
+ * @brief   looks up a node, adding it if not known
+ *
+ * @param   ctx - crawler
+ * @param   nwkAddr - network address
+ *
+ * @return  node index, -1 if the memory was not allocated
+ */
+static int32_t nodeGet(topoCrawl_t *ctx, uint16_t nwkAddr)
+{
+	topoCrawlNode_t *node;
+
+	if (ctx->NodeIndex[nwkAddr])
+	{
+		return ctx->NodeIndex[nwkAddr] - 1;
+	}
+	if (grow((void **) &ctx->Nodes, &ctx->NodeAlloc, ctx->NodeCount,
+	        sizeof(topoCrawlNode_t)) != 0)
+	{
+		return -1;
+	}
+
+	node = &ctx->Nodes[ctx->NodeCount];
+	memset(node, 0, sizeof(topoCrawlNode_t));
+	node->NwkAddr = nwkAddr;
+	node->Depth = TOPO_CRAWL_UNKNOWN;
+	node->Hops = TOPO_CRAWL_UNKNOWN;
+	node->Type = DEVICETYPE_ENDDEVICE;
+	ctx->NodeIndex[nwkAddr] = ++ctx->NodeCount;
+
+	return ctx->NodeCount - 1;
+}
+
+/*********************************************************************
+ * @fn      linkPut
+ *
+ * @brief   adds or updates the link from a router to a neighbor
+ *
+ * @param   ctx - crawler
+ * @param   from - node index of the router
+ * @param   to - node index of the neighbor
+ * @param   lqi - link quality
+ * @param   relation - neighbor relation
+ *
+ * @return  none
+ */
+static void linkPut(topoCrawl_t *ctx, uint32_t from, uint32_t to,
+        uint8_t lqi, uint8_t relation)
+{
+	topoCrawlLink_t *link;
+	uint32_t idx;
+
+	for (idx = ctx->Nodes[from].FirstLink; idx; idx = link->Next)
+	{
+		link = &ctx->Links[idx - 1];
+		if (link->To == to)
+		{
+			break;
+		}
+	}
+
+	if (idx == 0)
+	{
+		if (grow((void **) &ctx->Links, &ctx->LinkAlloc, ctx->LinkCount,
+		        sizeof(topoCrawlLink_t)) != 0)
+		{
+			return;
+		}
+		link = &ctx->Links[ctx->LinkCount++];
+		link->From = from;
+		link->To = to;
+		link->Next = ctx->Nodes[from].FirstLink;
+		ctx->Nodes[from].FirstLink = ctx->LinkCount;
+	}
+
+	link->Lqi = lqi;
+	link->Relation = relation;
+	link->Round = ctx->Round;
+}
+
+/*********************************************************************
+ * @fn      queuePush
+ *
+ * @brief   queues a page request
+ *
+ * @param   ctx - crawler
+ * @param   req - request
+ * @param   front - 1 to queue at the front, for retries
+ *
+ * @return  none
+ */
+static void queuePush(topoCrawl_t *ctx, topoCrawlReq_t *req, uint8_t front)
+{
+	uint32_t pos;
+
+	if (ctx->QueueCount == ctx->QueueAlloc)
+	{
+		uint32_t newAlloc = ctx->QueueAlloc ? (ctx->QueueAlloc * 2) : 64;
+		topoCrawlReq_t *q = malloc(newAlloc * sizeof(topoCrawlReq_t));
+		uint32_t i;
+
+		if (q == NULL)
+		{
+			dbg_print(PRINT_LEVEL_WARNING, "topoCrawl: allocation failed\n");
+			return;
+		}
+		for (i = 0; i < ctx->QueueCount; i++)
+		{
+			q[i] = ctx->Queue[(ctx->QueueHead + i) % ctx->QueueAlloc];
+		}
+		free(ctx->Queue);
+		ctx->Queue = q;
+		ctx->QueueHead = 0;
+		ctx->QueueAlloc = newAlloc;
+	}
+
+	if (front)
+	{
+		ctx->QueueHead = (ctx->QueueHead + ctx->QueueAlloc - 1)
+		        % ctx->QueueAlloc;
+		pos = ctx->QueueHead;
+	}
+	else
+	{
+		pos = (ctx->QueueHead + ctx->QueueCount) % ctx->QueueAlloc;
+	}
+	ctx->Queue[pos] = *req;
+	ctx->Queue[pos].DeadlineMs = 0;
+	ctx->QueueCount++;
+}
+
+/*********************************************************************
+ * @fn      queuePage
+ *
+ * @brief   queues a neighbor table page of a router unless it already is
+ *
+ * @param   ctx - crawler
+ * @param   nodeIdx - node index of the router
+ * @param   startIndex - first neighbor table entry of the page
+ *
+ * @return  none
+ */
+static void queuePage(topoCrawl_t *ctx, uint32_t nodeIdx, uint8_t startIndex)
+{
+	topoCrawlReq_t req;
+
+	if (BIT_GET(ctx->Nodes[nodeIdx].Requested, startIndex))
+	{
+		return;
+	}
+	BIT_SET(ctx->Nodes[nodeIdx].Requested, startIndex);
+
+	req.Node = nodeIdx;
+	req.StartIndex = startIndex;
+	req.Tries = 0;
+	queuePush(ctx, &req, 0);
+}
+
+/*********************************************************************
+ * @fn      queuePop
+ *
+ * @brief   takes the oldest request whose router is below MaxPerRouter
+ *
+ * @param   ctx - crawler
+ * @param   req - filled with the request
+ *
+ * @return  1 if a request was taken, else 0
+ */
+static uint8_t queuePop(topoCrawl_t *ctx, topoCrawlReq_t *req)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctx->QueueCount; i++)
+	{
+		uint32_t pos = (ctx->QueueHead + i) % ctx->QueueAlloc;
+
+		if (ctx->Nodes[ctx->Queue[pos].Node].InFlight < ctx->Cfg.MaxPerRouter)
+		{
+			*req = ctx->Queue[pos];
+			//fill the hole with the head, this keeps the order of the rest
+			ctx->Queue[pos] = ctx->Queue[ctx->QueueHead];
+			ctx->QueueHead = (ctx->QueueHead + 1) % ctx->QueueAlloc;
+			ctx->QueueCount--;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      pendingFind
+ *
+ * @brief   looks up the request a response answers
+ *
+ * @param   ctx - crawler
+ * @param   nwkAddr - network address of the router
+ * @param   startIndex - first neighbor table entry of the page
+ *
+ * @return  pending request, NULL if not in flight
+ */
+static topoCrawlReq_t *pendingFind(topoCrawl_t *ctx, uint16_t nwkAddr,
+        uint8_t startIndex)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctx->Cfg.MaxInFlight; i++)
+	{
+		topoCrawlReq_t *p = &ctx->Pending[i];
+
+		if (p->DeadlineMs && (ctx->Nodes[p->Node].NwkAddr == nwkAddr)
+		        && (p->StartIndex == startIndex))
+		{
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      pendingDone
+ *
+ * @brief   frees a pending request
+ *
+ * @param   ctx - crawler
+ * @param   p - pending request
+ *
+ * @return  none
+ */
+static void pendingDone(topoCrawl_t *ctx, topoCrawlReq_t *p)
+{
+	ctx->Nodes[p->Node].InFlight--;
+	ctx->InFlight--;
+	p->DeadlineMs = 0;
+}
+
+/*********************************************************************
+ * @fn      nodeFail
+ *
+ * @brief   gives up on a router
+ *
+ * @param   ctx - crawler
+ * @param   nodeIdx - node index of the router
+ *
+ * @return  none
+ */
+static void nodeFail(topoCrawl_t *ctx, uint32_t nodeIdx)
+{
+	topoCrawlNode_t *node = &ctx->Nodes[nodeIdx];
+
+	if (node->State != TOPO_CRAWL_NODE_FAILED)
+	{
+		node->State = TOPO_CRAWL_NODE_FAILED;
+		ctx->Stats.Failed++;
+		dbg_print(PRINT_LEVEL_WARNING, "topoCrawl: router 0x%04X failed\n",
+		        node->NwkAddr);
+	}
+}
+
+/*********************************************************************
+ * @fn      mgmtLqiRspCb
+ *
+ * @brief   merges a neighbor table page into the graph of the crawler
+ *          and queues the routers and pages it reveals
+ *
+ * @param   data - Mgmt_Lqi_rsp
+ * @param   arg - crawler
+ *
+ * @return  none
+ */
+static void mgmtLqiRspCb(uint16_t event, void *data, void *arg)
+{
+	MgmtLqiRspFormat_t *msg = data;
+	topoCrawl_t *ctx = arg;
+	topoCrawlReq_t *p;
+	topoCrawlNode_t *node;
+	int32_t nodeIdx;
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+
+	p = pendingFind(ctx, msg->SrcAddr, msg->StartIndex);
+	if (p)
+	{
+		pendingDone(ctx, p);
+	}
+
+	nodeIdx = nodeGet(ctx, msg->SrcAddr);
+	if (nodeIdx < 0)
+	{
+		pthread_mutex_unlock(&ctx->Lock);
+		return;
+	}
+	node = &ctx->Nodes[nodeIdx];
+
+	if (msg->Status != MT_RPC_SUCCESS)
+	{
+		//the router does not support the request, retrying will not help
+		nodeFail(ctx, nodeIdx);
+		pthread_mutex_unlock(&ctx->Lock);
+		return;
+	}
+	if (BIT_GET(node->Received, msg->StartIndex))
+	{
+		ctx->Stats.Duplicates++;
+		pthread_mutex_unlock(&ctx->Lock);
+		return;
+	}
+	BIT_SET(node->Received, msg->StartIndex);
+	BIT_SET(node->Requested, msg->StartIndex);
+	ctx->Stats.Responses++;
+
+	node->Round = ctx->Round;
+	node->Entries = msg->NeighborTableEntries;
+	node->Listed += msg->NeighborLqiListCount;
+	if (node->State != TOPO_CRAWL_NODE_FAILED)
+	{
+		node->State = (node->Listed >= node->Entries) ?
+		        TOPO_CRAWL_NODE_DONE : TOPO_CRAWL_NODE_CRAWLING;
+	}
+
+	for (i = 0; i < msg->NeighborLqiListCount; i++)
+	{
+		NeighborLqiListItemFormat_t *nb = &msg->NeighborLqiList[i];
+		uint8_t devType = nb->DevTyp_RxOnWhenIdle_Relat & 3;
+		uint8_t relation = (nb->DevTyp_RxOnWhenIdle_Relat >> 4) & 7;
+		topoCrawlNode_t *peer;
+		int32_t peerIdx;
+
+		peerIdx = nodeGet(ctx, nb->NetworkAddress);
+		if (peerIdx < 0)
+		{
+			break;
+		}
+		//the node array may have moved
+		node = &ctx->Nodes[nodeIdx];
+		peer = &ctx->Nodes[peerIdx];
+
+		if ((nb->ExtendedAddress != 0)
+		        && (nb->ExtendedAddress != 0xFFFFFFFFFFFFFFFFULL))
+		{
+			peer->IeeeAddr = nb->ExtendedAddress;
+		}
+		if (devType <= DEVICETYPE_ENDDEVICE)
+		{
+			peer->Type = devType;
+		}
+		peer->Depth = nb->Depth;
+		if ((node->Hops != TOPO_CRAWL_UNKNOWN)
+		        && ((peer->Hops == TOPO_CRAWL_UNKNOWN)
+		                || (peer->Hops > node->Hops + 1)))
+		{
+			peer->Hops = node->Hops + 1;
+		}
+		peer->Round = ctx->Round;
+		linkPut(ctx, nodeIdx, peerIdx, nb->LQI, relation);
+
+		//learn the neighbor addresses
+		nodeRegUpdate(nb->NetworkAddress, peer->IeeeAddr);
+
+		if ((peer->Type != DEVICETYPE_ENDDEVICE)
+		        && (peer->State == TOPO_CRAWL_NODE_SEEN))
+		{
+			peer->State = TOPO_CRAWL_NODE_QUEUED;
+			queuePage(ctx, peerIdx, 0);
+		}
+	}
+
+	//the size of the first page tells where the others start
+	if (msg->NeighborLqiListCount > 0)
+	{
+		uint32_t start;
+
+		for (start = msg->StartIndex + msg->NeighborLqiListCount;
+		        start < msg->NeighborTableEntries;
+		        start += msg->NeighborLqiListCount)
+		{
+			queuePage(ctx, nodeIdx, start);
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      typeName
+ *
+ * @brief   names a device type
+ *
+ * @param   type - DEVICETYPE_*
+ *
+ * @return  name
+ */
+static const char *typeName(uint8_t type)
+{
+	switch (type)
+	{
+	case DEVICETYPE_COORDINATOR:
+		return "coordinator";
+	case DEVICETYPE_ROUTER:
+		return "router";
+	default:
+		return "enddevice";
+	}
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      topoCrawlInit
+ *
+ * @brief   sets up a crawler and makes it receive the Mgmt_Lqi_rsp
+ *
+ * @param   ctx - crawler
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 if the memory was not allocated
+ */
+int32_t topoCrawlInit(topoCrawl_t *ctx, topoCrawlCfg_t *cfg)
+{
+	memset(ctx, 0, sizeof(topoCrawl_t));
+	memcpy(&ctx->Cfg, cfg, sizeof(topoCrawlCfg_t));
+	if ((ctx->Cfg.MaxInFlight == 0)
+	        || (ctx->Cfg.MaxInFlight > TOPO_CRAWL_PENDING_MAX))
+	{
+		ctx->Cfg.MaxInFlight = (ctx->Cfg.MaxInFlight == 0) ?
+		        TOPO_CRAWL_MAX_IN_FLIGHT : TOPO_CRAWL_PENDING_MAX;
+	}
+	if (ctx->Cfg.MaxPerRouter == 0)
+	{
+		ctx->Cfg.MaxPerRouter = TOPO_CRAWL_MAX_PER_ROUTER;
+	}
+	if (ctx->Cfg.TimeoutMs == 0)
+	{
+		ctx->Cfg.TimeoutMs = TOPO_CRAWL_TIMEOUT_MS;
+	}
+	if (ctx->Cfg.MaxRetries == 0)
+	{
+		ctx->Cfg.MaxRetries = TOPO_CRAWL_MAX_RETRIES;
+	}
+
+	ctx->NodeIndex = calloc(65536, sizeof(uint32_t));
+	if (ctx->NodeIndex == NULL)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "topoCrawlInit: allocation failed\n");
+		return -1;
+	}
+	pthread_mutex_init(&ctx->Lock, NULL);
+
+	mtEventAddListener(MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_MGMT_LQI_RSP),
+	        mgmtLqiRspCb, ctx, MT_EVENT_PRIO_DEFAULT);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      topoCrawlClose
+ *
+ * @brief   stops the crawler receiving responses and frees the graph
+ *
+ * @param   ctx - crawler
+ *
+ * @return  none
+ */
+void topoCrawlClose(topoCrawl_t *ctx)
+{
+	mtEventRemoveListener(MT_EVENT(MT_RPC_SYS_ZDO, MT_ZDO_MGMT_LQI_RSP),
+	        mgmtLqiRspCb, ctx);
+
+	free(ctx->Nodes);
+	free(ctx->NodeIndex);
+	free(ctx->Links);
+	free(ctx->Queue);
+	pthread_mutex_destroy(&ctx->Lock);
+	memset(ctx, 0, sizeof(topoCrawl_t));
+}
+
+/*********************************************************************
+ * @fn      topoCrawlStart
+ *
+ * @brief   starts a new crawl from the root. The graph of the previous
+ *          crawls is kept and updated.
+ *
+ * @param   ctx - crawler
+ *
+ * @return  none
+ */
+void topoCrawlStart(topoCrawl_t *ctx)
+{
+	int32_t rootIdx;
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+	ctx->Round++;
+	for (i = 0; i < ctx->NodeCount; i++)
+	{
+		topoCrawlNode_t *node = &ctx->Nodes[i];
+
+		node->State = TOPO_CRAWL_NODE_SEEN;
+		node->Hops = TOPO_CRAWL_UNKNOWN;
+		node->Listed = 0;
+		node->InFlight = 0;
+		memset(node->Received, 0, sizeof(node->Received));
+		memset(node->Requested, 0, sizeof(node->Requested));
+	}
+	memset(ctx->Pending, 0, sizeof(ctx->Pending));
+	ctx->InFlight = 0;
+	ctx->QueueHead = 0;
+	ctx->QueueCount = 0;
+	memset(&ctx->Stats, 0, sizeof(topoCrawlStats_t));
+	ctx->StartUs = nowUs();
+
+	rootIdx = nodeGet(ctx, ctx->Cfg.Root);
+	if (rootIdx >= 0)
+	{
+		topoCrawlNode_t *root = &ctx->Nodes[rootIdx];
+
+		root->Type = (ctx->Cfg.Root == 0) ?
+		        DEVICETYPE_COORDINATOR : DEVICETYPE_ROUTER;
+		root->Hops = 0;
+		root->Round = ctx->Round;
+		root->State = TOPO_CRAWL_NODE_QUEUED;
+		if (ctx->Cfg.Root == 0)
+		{
+			root->Depth = 0;
+		}
+		queuePage(ctx, rootIdx, 0);
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      topoCrawlPoll
+ *
+ * @brief   retries the pages that timed out and sends the queued pages
+ *          the in flight limits allow. The responses are merged when
+ *          the MT callbacks are dispatched.
+ *
+ * @param   ctx - crawler
+ *
+ * @return  1 while the crawl is running, 0 once it completed
+ */
+uint8_t topoCrawlPoll(topoCrawl_t *ctx)
+{
+	topoCrawlReq_t req;
+	uint64_t nowMs = nowUs() / 1000;
+	uint8_t busy;
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+	for (i = 0; i < ctx->Cfg.MaxInFlight; i++)
+	{
+		topoCrawlReq_t *p = &ctx->Pending[i];
+
+		if ((p->DeadlineMs == 0) || (nowMs < p->DeadlineMs))
+		{
+			continue;
+		}
+		req = *p;
+		pendingDone(ctx, p);
+		if (req.Tries < ctx->Cfg.MaxRetries)
+		{
+			req.Tries++;
+			ctx->Stats.Retries++;
+			queuePush(ctx, &req, 1);
+		}
+		else
+		{
+			nodeFail(ctx, req.Node);
+		}
+	}
+
+	while ((ctx->InFlight < ctx->Cfg.MaxInFlight) && queuePop(ctx, &req))
+	{
+		MgmtLqiReqFormat_t lqiReq;
+		topoCrawlReq_t *p = NULL;
+		uint8_t status;
+
+		//a page retried after a late response needs no request
+		if (BIT_GET(ctx->Nodes[req.Node].Received, req.StartIndex))
+		{
+			continue;
+		}
+		for (i = 0; i < ctx->Cfg.MaxInFlight; i++)
+		{
+			if (ctx->Pending[i].DeadlineMs == 0)
+			{
+				p = &ctx->Pending[i];
+				break;
+			}
+		}
+		req.DeadlineMs = nowMs + ctx->Cfg.TimeoutMs;
+		*p = req;
+		ctx->Nodes[req.Node].InFlight++;
+		ctx->InFlight++;
+		if (ctx->InFlight > ctx->Stats.PeakInFlight)
+		{
+			ctx->Stats.PeakInFlight = ctx->InFlight;
+		}
+		ctx->Stats.Requests++;
+
+		lqiReq.DstAddr = ctx->Nodes[req.Node].NwkAddr;
+		lqiReq.StartIndex = req.StartIndex;
+
+		//the request waits for its SRSP, which may dispatch a response
+		pthread_mutex_unlock(&ctx->Lock);
+		status = zdoMgmtLqiReq(&lqiReq);
+		pthread_mutex_lock(&ctx->Lock);
+
+		if (status != MT_RPC_SUCCESS)
+		{
+			//retried by the next poll
+			p = pendingFind(ctx, lqiReq.DstAddr, lqiReq.StartIndex);
+			if (p)
+			{
+				p->DeadlineMs = nowMs;
+			}
+		}
+	}
+
+	busy = (ctx->QueueCount > 0) || (ctx->InFlight > 0);
+	if (!busy && (ctx->StartUs != 0))
+	{
+		ctx->Stats.ElapsedUs = nowUs() - ctx->StartUs;
+		ctx->StartUs = 0;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return busy;
+}
+
+/*********************************************************************
+ * @fn      topoCrawlRun
+ *
+ * @brief   crawls the network, dispatching the MT callbacks until the
+ *          crawl completes
+ *
+ * @param   ctx - crawler
+ *
+ * @return  0 if every router answered, -1 if some failed
+ */
+int32_t topoCrawlRun(topoCrawl_t *ctx)
+{
+	topoCrawlStart(ctx);
+	while (topoCrawlPoll(ctx))
+	{
+		rpcWaitMqClientMsg(TOPO_CRAWL_POLL_MS);
+	}
+
+	dbg_print(PRINT_LEVEL_INFO,
+	        "topoCrawlRun: %u nodes, %u requests, %u retries, %u failed, %llu ms\n",
+	        ctx->NodeCount, ctx->Stats.Requests, ctx->Stats.Retries,
+	        ctx->Stats.Failed,
+	        (unsigned long long) (ctx->Stats.ElapsedUs / 1000));
+
+	return (ctx->Stats.Failed == 0) ? 0 : -1;
+}
+
+/*********************************************************************
+ * @fn      topoCrawlFindNode
+ *
+ * @brief   looks up a node of the graph
+ *
+ * @param   ctx - crawler
+ * @param   nwkAddr - network address
+ *
+ * @return  node, NULL if not in the graph
+ */
+topoCrawlNode_t *topoCrawlFindNode(topoCrawl_t *ctx, uint16_t nwkAddr)
+{
+	if (ctx->NodeIndex[nwkAddr] == 0)
+	{
+		return NULL;
+	}
+
+	return &ctx->Nodes[ctx->NodeIndex[nwkAddr] - 1];
+}
+
+/*********************************************************************
+ * @fn      topoCrawlExportJson
+ *
+ * @brief   writes the nodes and links seen by the last crawl as JSON
+ *
+ * @param   ctx - crawler
+ * @param   out - output stream
+ *
+ * @return  none
+ */
+void topoCrawlExportJson(topoCrawl_t *ctx, FILE *out)
+{
+	const char *sep = "";
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+	fprintf(out, "{\"round\":%u,\"nodes\":[", ctx->Round);
+	for (i = 0; i < ctx->NodeCount; i++)
+	{
+		topoCrawlNode_t *node = &ctx->Nodes[i];
+
+		if (node->Round != ctx->Round)
+		{
+			continue;
+		}
+		fprintf(out, "%s\n{\"nwk\":\"0x%04X\",\"ieee\":\"0x%016llX\","
+		        "\"type\":\"%s\",\"depth\":%d,\"hops\":%d,\"crawled\":%s}", sep,
+		        node->NwkAddr, (unsigned long long) node->IeeeAddr,
+		        typeName(node->Type),
+		        (node->Depth == TOPO_CRAWL_UNKNOWN) ? -1 : node->Depth,
+		        (node->Hops == TOPO_CRAWL_UNKNOWN) ? -1 : node->Hops,
+		        (node->State == TOPO_CRAWL_NODE_DONE) ? "true" : "false");
+		sep = ",";
+	}
+	fprintf(out, "],\"links\":[");
+	sep = "";
+	for (i = 0; i < ctx->LinkCount; i++)
+	{
+		topoCrawlLink_t *link = &ctx->Links[i];
+
+		if (link->Round != ctx->Round)
+		{
+			continue;
+		}
+		fprintf(out, "%s\n{\"from\":\"0x%04X\",\"to\":\"0x%04X\","
+		        "\"lqi\":%u,\"relation\":%u}", sep,
+		        ctx->Nodes[link->From].NwkAddr, ctx->Nodes[link->To].NwkAddr,
+		        link->Lqi, link->Relation);
+		sep = ",";
+	}
+	fprintf(out, "]}\n");
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      topoCrawlExportDot
+ *
+ * @brief   writes the nodes and links seen by the last crawl as a
+ *          Graphviz digraph, each edge labeled with its LQI
+ *
+ * @param   ctx - crawler
+ * @param   out - output stream
+ *
+ * @return  none
+ */
+void topoCrawlExportDot(topoCrawl_t *ctx, FILE *out)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+	fprintf(out, "digraph topology {\n");
+	for (i = 0; i < ctx->NodeCount; i++)
+	{
+		topoCrawlNode_t *node = &ctx->Nodes[i];
+
+		if (node->Round != ctx->Round)
+		{
+			continue;
+		}
+		fprintf(out, "\t\"0x%04X\" [label=\"0x%04X\\n%s\", shape=%s];\n",
+		        node->NwkAddr, node->NwkAddr, typeName(node->Type),
+		        (node->Type == DEVICETYPE_ENDDEVICE) ? "ellipse" : "box");
+	}
+	for (i = 0; i < ctx->LinkCount; i++)
+	{
+		topoCrawlLink_t *link = &ctx->Links[i];
+
+		if (link->Round != ctx->Round)
+		{
+			continue;
+		}
+		fprintf(out, "\t\"0x%04X\" -> \"0x%04X\" [label=\"%u\"%s];\n",
+		        ctx->Nodes[link->From].NwkAddr, ctx->Nodes[link->To].NwkAddr,
+		        link->Lqi, (link->Relation == 1) ? "" : ", style=dashed");
+	}
+	fprintf(out, "}\n");
+	pthread_mutex_unlock(&ctx->Lock);
+}
@@ -0,0 +1,157 @@
+/*
+ * topoCrawl.h
+ *
+ * This module contains the topology crawler, which walks the routers of
+ * the network breadth first with Mgmt_Lqi_req and builds a graph of the
+ * nodes and links.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef TOPOCRAWL_H
+#define TOPOCRAWL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// defaults used for the topoCrawlCfg_t fields left 0
+#define TOPO_CRAWL_MAX_IN_FLIGHT   (16)
+#define TOPO_CRAWL_MAX_PER_ROUTER  (2)
+#define TOPO_CRAWL_TIMEOUT_MS      (2000)
+#define TOPO_CRAWL_MAX_RETRIES     (2)
+
+// upper bound of TOPO_CRAWL_MAX_IN_FLIGHT
+#define TOPO_CRAWL_PENDING_MAX     (64)
+
+// topoCrawlNode_t State
+#define TOPO_CRAWL_NODE_SEEN       (0) // listed by a neighbor only
+#define TOPO_CRAWL_NODE_QUEUED     (1) // router waiting for its first page
+#define TOPO_CRAWL_NODE_CRAWLING   (2) // some pages received
+#define TOPO_CRAWL_NODE_DONE       (3) // all pages received
+#define TOPO_CRAWL_NODE_FAILED     (4) // a page failed after all retries
+
+// value of Hops and Depth while unknown
+#define TOPO_CRAWL_UNKNOWN         (0xFF)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint16_t Root;            // router the crawl starts at, 0 for the coordinator
+	uint8_t MaxInFlight;      // requests in flight in the network
+	uint8_t MaxPerRouter;     // requests in flight to one router
+	uint32_t TimeoutMs;       // time allowed for a response
+	uint8_t MaxRetries;       // retries of a page before the router fails
+} topoCrawlCfg_t;
+
+typedef struct
+{
+	uint16_t NwkAddr;
+	uint64_t IeeeAddr;        // 0 while unknown
+	uint8_t Type;             // DEVICETYPE_*
+	uint8_t Depth;            // network depth reported by the neighbors
+	uint8_t Hops;             // crawl hops from the root
+	uint8_t State;            // TOPO_CRAWL_NODE_*
+	uint32_t Round;           // crawl that last saw the node
+	uint8_t Entries;          // neighbor table size, routers only
+	uint8_t Listed;           // neighbor entries received this crawl
+	uint8_t InFlight;
+	uint32_t FirstLink;       // link index + 1 of the first link reported
+	uint8_t Received[32];     // bit per StartIndex answered
+	uint8_t Requested[32];    // bit per StartIndex queued or answered
+} topoCrawlNode_t;
+
+typedef struct
+{
+	uint32_t From;            // node index of the router reporting the link
+	uint32_t To;              // node index of the neighbor
+	uint8_t Lqi;
+	uint8_t Relation;         // 0 parent, 1 child, 2 sibling, 3 none, 4 previous child
+	uint32_t Round;           // crawl that last reported the link
+	uint32_t Next;            // link index + 1 of the next link of From
+} topoCrawlLink_t;
+
+typedef struct
+{
+	uint32_t Node;            // node index of the router
+	uint8_t StartIndex;
+	uint8_t Tries;            // retries already made
+	uint64_t DeadlineMs;      // 0 while the pending slot is free
+} topoCrawlReq_t;
+
+typedef struct
+{
+	uint32_t Requests;        // Mgmt_Lqi_req sent
+	uint32_t Responses;       // pages answered
+	uint32_t Retries;
+	uint32_t Failed;          // routers that failed
+	uint32_t Duplicates;      // pages answered twice
+	uint32_t PeakInFlight;
+	uint64_t ElapsedUs;       // wall time of the last crawl
+} topoCrawlStats_t;
+
+typedef struct
+{
+	topoCrawlCfg_t Cfg;
+	pthread_mutex_t Lock;
+	uint32_t Round;
+
+	topoCrawlNode_t *Nodes;
+	uint32_t NodeCount;
+	uint32_t NodeAlloc;
+	uint32_t *NodeIndex;      // network address to node index + 1
+
+	topoCrawlLink_t *Links;
+	uint32_t LinkCount;
+	uint32_t LinkAlloc;
+
+	topoCrawlReq_t *Queue;    // ring of the page requests waiting
+	uint32_t QueueHead;
+	uint32_t QueueCount;
+	uint32_t QueueAlloc;
+
+	topoCrawlReq_t Pending[TOPO_CRAWL_PENDING_MAX];
+	uint32_t InFlight;
+
+	uint64_t StartUs;
+	topoCrawlStats_t Stats;
+} topoCrawl_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t topoCrawlInit(topoCrawl_t *ctx, topoCrawlCfg_t *cfg);
+void topoCrawlClose(topoCrawl_t *ctx);
+
+void topoCrawlStart(topoCrawl_t *ctx);
+uint8_t topoCrawlPoll(topoCrawl_t *ctx);
+int32_t topoCrawlRun(topoCrawl_t *ctx);
+
+topoCrawlNode_t *topoCrawlFindNode(topoCrawl_t *ctx, uint16_t nwkAddr);
+
+void topoCrawlExportJson(topoCrawl_t *ctx, FILE *out);
+void topoCrawlExportDot(topoCrawl_t *ctx, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TOPOCRAWL_H */
@@ -46,6 +46,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
@@ -81,6 +84,9 @@ uint8_t uartDebugPrintsEnabled = 0;
  */
 int serialPortFd;
 
+// the device is the Unix domain socket of a ZNP mux daemon
+static uint8_t serialPortIsSocket;
+
 /*********************************************************************
  * API FUNCTIONS
  */
@@ -88,7 +94,9 @@ int serialPortFd;
 /*********************************************************************
  * @fn      rpcTransportOpen
  *
- * @brief   opens the serial port to the CC253x.
+ * @brief   opens the serial port to the CC253x. A Unix domain socket
+ *          is the one of a ZNP mux daemon (see rpcMux.h), which takes
+ *          the same frames as the ZNP.
  *
  * @param   devicePath - path to the UART device
  *
@@ -97,6 +105,7 @@ int serialPortFd;
 int32_t rpcTransportOpen(char *_devicePath, uint32_t port)
 {
 	struct termios tio;
+	struct stat st;
 	static char lastUsedDevicePath[255];
 	char * devicePath;
 
@@ -119,6 +128,41 @@ int32_t rpcTransportOpen(char *_devicePath, uint32_t port)
 		devicePath = lastUsedDevicePath;
 	}
 
+	serialPortIsSocket = (stat(devicePath, &st) == 0) && S_ISSOCK(st.st_mode);
+	if (serialPortIsSocket)
+	{
+		struct sockaddr_un addr;
+		size_t len = strlen(devicePath);
+
+		if (len >= sizeof(addr.sun_path))
+		{
+			dbg_print(PRINT_LEVEL_ERROR,
+			        "rpcTransportOpen: %s is too long for a socket path\n",
+			        devicePath);
+			return (-1);
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, devicePath, len + 1);
+		serialPortFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ((serialPortFd >= 0)
+		        && (connect(serialPortFd, (struct sockaddr *) &addr,
+		                sizeof(addr)) != 0))
+		{
+			close(serialPortFd);
+			serialPortFd = -1;
+		}
+		if (serialPortFd < 0)
+		{
+			perror(devicePath);
+			dbg_print(PRINT_LEVEL_ERROR,
+			        "rpcTransportOpen: %s connect failed\n", devicePath);
+			return (-1);
+		}
+
+		return serialPortFd;
+	}
+
 	/* open the device */
 	serialPortFd = open(devicePath, O_RDWR | O_NOCTTY);
 	if (serialPortFd < 0)
@@ -166,7 +210,10 @@ int32_t rpcTransportOpen(char *_devicePath, uint32_t port)
  */
 void rpcTransportClose(void)
 {
-	tcflush(serialPortFd, TCOFLUSH);
+	if (!serialPortIsSocket)
+	{
+		tcflush(serialPortFd, TCOFLUSH);
+	}
 	close(serialPortFd);
 
 	return;
@@ -185,9 +232,12 @@ void rpcTransportWrite(uint8_t* buf, uint8_t len)
 {
 	int remain = len;
 	int offset = 0;
-#if 1
+
 	dbg_print(PRINT_LEVEL_VERBOSE, "rpcTransportWrite : len = %d\n", len);
 
+#ifdef RPC_UART_CHUNKED_WRITE
+	// some USB UART bridges drop bytes of long writes, feed them 8 bytes
+	// at a time at the cost of about 1ms per chunk
 	while (remain > 0)
 	{
 		int sub = (remain >= 8 ? 8 : remain);
@@ -196,15 +246,33 @@ void rpcTransportWrite(uint8_t* buf, uint8_t len)
 		        remain);
 		write(serialPortFd, buf + offset, sub);
 
-		tcflush(serialPortFd, TCOFLUSH);
+		// wait for the chunk to be sent, TCOFLUSH would discard it
+		tcdrain(serialPortFd);
 		usleep(1000);
 		remain -= 8;
 		offset += 8;
 	}
 #else
-	write (serialPortFd, buf, len);
-	tcflush(serialPortFd, TCOFLUSH);
-
+	while (remain > 0)
+	{
+		int ret = write(serialPortFd, buf + offset, remain);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			dbg_print(PRINT_LEVEL_ERROR, "rpcTransportWrite: %s\n",
+			        strerror(errno));
+			break;
+		}
+		remain -= ret;
+		offset += ret;
+	}
+	if (!serialPortIsSocket)
+	{
+		tcdrain(serialPortFd);
+	}
 #endif
 	return;
 }
@@ -226,6 +294,12 @@ uint8_t rpcTransportRead(uint8_t* buf, uint8_t len)
 		dbg_print(PRINT_LEVEL_VERBOSE, "rpcTransportRead: read %d bytes\n",
 		        ret);
 	}
+	else if (serialPortIsSocket)
+	{
+		// the daemon went away, do not spin on the closed socket
+		dbg_print(PRINT_LEVEL_ERROR, "rpcTransportRead: connection closed\n");
+		usleep(100000);
+	}
 	return (ret);
 
 }
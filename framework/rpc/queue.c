@@ -105,6 +105,7 @@ static void addToTail(llq_t *hndl, char *data, int length)
 void llq_open(llq_t *hndl)
 {
 	hndl->head = hndl->tail = NULL;
+	hndl->count = 0;
 	sem_init(&(hndl->llqAccessSem), 0, 1);
 	sem_init(&(hndl->llqCountSem), 0, 0);
 }
@@ -169,6 +170,7 @@ int llq_timedreceive(llq_t *hndl, char *buffer, int maxLength,
 				hndl->head = NULL;
 				hndl->tail = NULL;
 			}
+			hndl->count--;
 
 			//release access sem
 			sem_post(&(hndl->llqAccessSem));
@@ -225,6 +227,7 @@ int llq_add(llq_t *hndl, char *buffer, int len, int prio)
 	{
 		addToTail(hndl, buffer, len);
 	}
+	hndl->count++;
 
 	//release access sem
 	sem_post(&(hndl->llqAccessSem));
@@ -235,3 +238,23 @@ int llq_add(llq_t *hndl, char *buffer, int len, int prio)
 	return ret;
 }
 
+
+/*********************************************************************
+ * @fn      llq_depth
+ *
+ * @brief   Number of messages currently in the queue
+ *
+ * @param   llq_t *hndl - handle to the queue
+ *
+ * @return   number of queued messages
+ */
+int llq_depth(llq_t *hndl)
+{
+	int depth;
+
+	sem_wait(&(hndl->llqAccessSem));
+	depth = hndl->count;
+	sem_post(&(hndl->llqAccessSem));
+
+	return depth;
+}
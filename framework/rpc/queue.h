@@ -62,6 +62,7 @@ typedef struct
 	node_t *tail;
 	node_t *temp;
 	node_t *head1;
+	int count;
 	sem_t llqAccessSem;
 	sem_t llqCountSem;
 } llq_t;
@@ -134,6 +135,17 @@ extern int llq_receive(llq_t *hndl, char *buffer, int maxLength);
 extern int llq_timedreceive(llq_t *hndl, char *buffer, int maxLength,
         const struct timespec * timeout);
 
+/*********************************************************************
+ * @fn      llq_depth
+ *
+ * @brief   Number of messages currently in the queue
+ *
+ * @param   llq_t *hndl - handle to the queue
+ *
+ * @return   number of queued messages
+ */
+extern int llq_depth(llq_t *hndl);
+
 #ifdef __cplusplus
 }
 #endif
@@ -58,6 +58,10 @@
 #include "rpcTransport.h"
 #include "mtParser.h"
 #include "dbgPrint.h"
+#include "rpcMetrics.h"
+#include "rpcTrace.h"
+#include "rpcFilter.h"
+#include "rpcSched.h"
 
 /*********************************************************************
  * MACROS
@@ -91,9 +95,26 @@ static sem_t srspSem;
 // expected SRSP command ID
 static uint8_t expectedSrspCmdId;
 
+// status byte of the expected SRSP, set by the RPC thread before it
+// posts srspSem, and kept by the sending thread for rpcGetSrspStatus()
+static uint8_t srspStatus;
+static __thread uint8_t threadSrspStatus;
+
 // RPC message queue for passing RPC frame from RPC process to APP process
 static llq_t rpcLlq;
 
+// handler taking the received frames in place of the RPC queue
+static rpcFrameCb_t rpcFrameCb;
+
+// AREQs not passing the filter are dropped before the RPC queue
+static const rpcFilter_t *volatile rpcAreqFilter;
+
+// handler seeing every frame received, besides the queue or rpcFrameCb
+static rpcFrameCb_t rpcRxTap;
+
+// scheduler ordering the frames sent in place of the RPC semaphore
+static rpcSched_t *volatile rpcTxSched;
+
 /*********************************************************************
  * EXTERNAL VARIABLES
  */
@@ -108,6 +129,9 @@ static uint8_t calcFcs(uint8_t *msg, uint8_t len);
 // function for printing out RPC frames
 static void printRpcMsg(char* preMsg, uint8_t sof, uint8_t len, uint8_t *msg);
 
+// function for dispatching a frame taken from the RPC queue
+static void rpcProcessMqMsg(uint8_t *rpcFrame, int32_t rpcLen);
+
 /*********************************************************************
  * API FUNCTIONS
  */
@@ -143,6 +167,117 @@ int32_t rpcOpen(char *_devicePath, uint32_t port)
 	return fd;
 }
 
+/*********************************************************************
+ * @fn      rpcRegisterFrameCallback
+ *
+ * @brief   hands every frame received from the ZNP to a handler on the
+ *          RPC thread instead of the RPC queue, for a process that
+ *          forwards the frames rather than parsing them. An SRSP is
+ *          handed over before the waiting SREQ is unblocked.
+ *
+ * @param   cb - handler, NULL to go back to the RPC queue
+ *
+ * @return  -
+ */
+void rpcRegisterFrameCallback(rpcFrameCb_t cb)
+{
+	rpcFrameCb = cb;
+}
+
+/*********************************************************************
+ * @fn      rpcRegisterRxTap
+ *
+ * @brief   shows every frame received from the ZNP, or queued with
+ *          rpcQueueFrame(), to a handler on the RPC thread before it is
+ *          filtered, queued or handed over. The handler must not block,
+ *          the frames after wait for it.
+ *
+ * @param   tap - handler, NULL for none
+ *
+ * @return  -
+ */
+void rpcRegisterRxTap(rpcFrameCb_t tap)
+{
+	rpcRxTap = tap;
+}
+
+/*********************************************************************
+ * @fn      rpcSetAreqFilter
+ *
+ * @brief   drops the AREQs the application has no use for before they
+ *          are queued and parsed. The filter stays in use until
+ *          replaced and must not change meanwhile.
+ *
+ * @param   filter - compiled filter, NULL to queue every AREQ
+ *
+ * @return  -
+ */
+void rpcSetAreqFilter(const rpcFilter_t *filter)
+{
+	rpcAreqFilter = filter;
+}
+
+/*********************************************************************
+ * @fn      rpcSetTxScheduler
+ *
+ * @brief   makes the threads calling rpcSendFrame() send in the order
+ *          of a TX scheduler rather than the order they come. It is
+ *          installed before the threads start sending and stays in use
+ *          until they stop.
+ *
+ * @param   sched - initialised scheduler, NULL for none
+ *
+ * @return  -
+ */
+void rpcSetTxScheduler(rpcSched_t *sched)
+{
+	rpcTxSched = sched;
+}
+
+/*********************************************************************
+ * @fn      rpcQueueFrame
+ *
+ * @brief   queues an AREQ received by other means than the transport,
+ *          as if rpcProcess() had read it, so that the MT callbacks of
+ *          the application get it
+ *
+ * @param   rpcFrame - frame from the Cmd0 byte to the FCS
+ * @param   rpcLen - length of the frame
+ *
+ * @return  -
+ */
+void rpcQueueFrame(uint8_t *rpcFrame, uint8_t rpcLen)
+{
+	uint8_t rpcBuff[RPC_MAX_LEN + RPC_TRACE_TAG_LEN];
+
+	RPC_TRACE_BEGIN(traceId, RPC_TRACE_DIR_RX);
+	memcpy(rpcBuff, rpcFrame, rpcLen);
+	RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_COMPLETE);
+	RPC_TRACE_FRAME(traceId, rpcBuff[0], rpcBuff[1],
+	        rpcLen - RPC_CMD0_FIELD_LEN - RPC_CMD1_FIELD_LEN - RPC_UART_FCS_LEN);
+#ifdef RPC_TRACE
+	memcpy(&rpcBuff[rpcLen], &traceId, RPC_TRACE_TAG_LEN);
+#endif
+
+	RPC_METRIC_INC(RPC_METRIC_FRAMES_IN);
+	RPC_METRIC_INC(RPC_METRIC_AREQ_IN);
+	if (rpcRxTap != NULL)
+	{
+		rpcRxTap(rpcBuff, rpcLen);
+	}
+	if ((rpcAreqFilter != NULL)
+	        && !rpcFilterMatch(rpcAreqFilter, rpcBuff, rpcLen))
+	{
+		RPC_METRIC_INC(RPC_METRIC_AREQ_FILTERED);
+		RPC_TRACE_DROP(traceId);
+		return;
+	}
+	RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_ENQUEUED);
+	llq_add(&rpcLlq, (char*) rpcBuff, rpcLen + RPC_TRACE_TAG_LEN, 0);
+	RPC_METRIC_INC(RPC_METRIC_LLQ_ENQUEUED);
+	RPC_METRIC_GAUGE_SET(RPC_METRIC_LLQ_DEPTH, llq_depth(&rpcLlq));
+}
+
 /*********************************************************************
  * @fn      rpcInitMq
  *
@@ -171,21 +306,20 @@ int32_t rpcInitMq(void)
  */
 int32_t rpcGetMqClientMsg(void)
 {
-	uint8_t rpcFrame[RPC_MAX_LEN + 1];
+	uint8_t rpcFrame[RPC_MAX_LEN + 1 + RPC_TRACE_TAG_LEN];
 	int32_t rpcLen;
 
 	dbg_print(PRINT_LEVEL_INFO, "rpcWaitMqClient: waiting on queue\n");
 
 	// wait for incoming message queue
-	rpcLen = llq_receive(&rpcLlq, (char *) rpcFrame, RPC_MAX_LEN + 1);
+	rpcLen = llq_receive(&rpcLlq, (char *) rpcFrame, sizeof(rpcFrame));
 
 	if (rpcLen != -1)
 	{
 		dbg_print(PRINT_LEVEL_VERBOSE, "rpcWaitMqClient: processing MT[%d]\n",
 		        rpcLen);
-
 		// process incoming message
-		mtProcess(rpcFrame, rpcLen);
+		rpcProcessMqMsg(rpcFrame, rpcLen);
 	}
 	else
 	{
@@ -208,13 +342,19 @@ int32_t rpcGetMqClientMsg(void)
  */
 int32_t rpcWaitMqClientMsg(uint32_t timeout)
 {
-	uint8_t rpcFrame[RPC_MAX_LEN + 1];
+	uint8_t rpcFrame[RPC_MAX_LEN + 1 + RPC_TRACE_TAG_LEN];
 	int32_t rpcLen, timeLeft = 0, mBefTime, mAftTime;
 	struct timespec to;
 	struct timeval befTime, aftTime;
-	// calculate timeout
-	to.tv_sec = time(0) + (timeout / 1000);
-	to.tv_nsec = (long) ((long) timeout % 1000) * 1000000L;
+	// calculate the absolute timeout, from the current time of day
+	clock_gettime(CLOCK_REALTIME, &to);
+	to.tv_sec += timeout / 1000;
+	to.tv_nsec += (long) ((long) timeout % 1000) * 1000000L;
+	if (to.tv_nsec >= 1000000000L)
+	{
+		to.tv_sec++;
+		to.tv_nsec -= 1000000000L;
+	}
 
 	dbg_print(PRINT_LEVEL_INFO, "rpcWaitMqClientMsg: timeout=%d\n", timeout);
 	dbg_print(PRINT_LEVEL_INFO,
@@ -222,7 +362,7 @@ int32_t rpcWaitMqClientMsg(uint32_t timeout)
 	        to.tv_sec, to.tv_nsec);
 
 	gettimeofday(&befTime, NULL);
-	rpcLen = llq_timedreceive(&rpcLlq, (char *) rpcFrame, RPC_MAX_LEN + 1, &to);
+	rpcLen = llq_timedreceive(&rpcLlq, (char *) rpcFrame, sizeof(rpcFrame), &to);
 	gettimeofday(&aftTime, NULL);
 	if (rpcLen != -1)
 	{
@@ -235,7 +375,7 @@ int32_t rpcWaitMqClientMsg(uint32_t timeout)
 		dbg_print(PRINT_LEVEL_INFO, "rpcWaitMqClientMsg: processing MT[%d]\n",
 		        rpcLen);
 		// process incoming message
-		mtProcess(rpcFrame, rpcLen);
+		rpcProcessMqMsg(rpcFrame, rpcLen);
 	}
 	else
 	{
@@ -264,6 +404,23 @@ void rpcForceRun(void)
 	rpcTransportWrite(&forceBoot, 1);
 }
 
+/*********************************************************************
+ * @fn      rpcForceBoot
+ *
+ * @brief   send force boot bootloader command, a bootloader waiting
+ *          after reset stays in boot mode
+ *
+ * @param   -
+ *
+ * @return  -
+ */
+void rpcForceBoot(void)
+{
+	uint8_t forceBoot = SB_FORCE_BOOT;
+
+	rpcTransportWrite(&forceBoot, 1);
+}
+
 /*************************************************************************************************
  * @fn      rpcProcess()
  *
@@ -276,7 +433,7 @@ void rpcForceRun(void)
 int32_t rpcProcess(void)
 {
 	uint8_t rpcLen, rpcTempLen, bytesRead, sofByte, rpcBuffIdx;
-	uint8_t retryAttempts = 0, len, rpcBuff[RPC_MAX_LEN];
+	uint8_t retryAttempts = 0, len, rpcBuff[RPC_MAX_LEN + RPC_TRACE_TAG_LEN];
 	uint8_t fcs;
 
 #ifndef HAL_UART_IP //No SOF for IP	//read first byte and check it is a SOF
@@ -285,6 +442,9 @@ int32_t rpcProcess(void)
 	if ((sofByte == MT_RPC_SOF) && (bytesRead == 1))
 #endif
 	{
+		// first byte of the frame is in
+		RPC_TRACE_BEGIN(traceId, RPC_TRACE_DIR_RX);
+
 		// clear retry counter
 		retryAttempts = 0;
 
@@ -361,9 +521,26 @@ int32_t rpcProcess(void)
 			{
 				dbg_print(PRINT_LEVEL_WARNING, "rpcProcess: fcs error %x:%x\n",
 				        rpcBuff[len + 3], fcs);
+				RPC_METRIC_INC(RPC_METRIC_FCS_ERRORS);
+				RPC_TRACE_DROP(traceId);
 				return -1;
 			}
 
+			RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_COMPLETE);
+			RPC_TRACE_FRAME(traceId, rpcBuff[1], rpcBuff[2], len);
+#ifdef RPC_TRACE
+			// the trace id travels behind the frame through the queue
+			memcpy(&rpcBuff[1 + rpcLen], &traceId, RPC_TRACE_TAG_LEN);
+#endif
+
+			RPC_METRIC_INC(RPC_METRIC_FRAMES_IN);
+			RPC_METRIC_ADD(RPC_METRIC_BYTES_IN, len + 5);
+
+			if (rpcRxTap != NULL)
+			{
+				rpcRxTap(&rpcBuff[1], rpcLen);
+			}
+
 			if ((rpcBuff[1] & MT_RPC_CMD_TYPE_MASK) == MT_RPC_CMD_SRSP)
 			{
 				// SRSP command ID deteced
@@ -372,6 +549,18 @@ int32_t rpcProcess(void)
 					dbg_print(PRINT_LEVEL_INFO,
 					        "rpcProcess: processing expected srsp [%02X]\n",
 					        rpcBuff[1] & MT_RPC_SUBSYSTEM_MASK);
+					srspStatus = (len > 0) ? rpcBuff[3] : MT_RPC_SUCCESS;
+
+					if (rpcFrameCb != NULL)
+					{
+						// the SRSP is handed over before the sreq returns
+						RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_CB_START);
+						rpcFrameCb(&rpcBuff[1], rpcLen);
+						RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_CB_END);
+						RPC_TRACE_END(traceId);
+						sem_post(&srspSem);
+						return 0;
+					}
 
 					//unblock waiting sreq
 					sem_post(&srspSem);
@@ -381,7 +570,10 @@ int32_t rpcProcess(void)
 					        rpcLen);
 
 					// send message to queue
-					llq_add(&rpcLlq, (char*) &rpcBuff[1], rpcLen, 1);
+					RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_ENQUEUED);
+					llq_add(&rpcLlq, (char*) &rpcBuff[1],
+					        rpcLen + RPC_TRACE_TAG_LEN, 1);
+					RPC_METRIC_INC(RPC_METRIC_LLQ_ENQUEUED);
 				}
 				else
 				{
@@ -390,9 +582,28 @@ int32_t rpcProcess(void)
 					        "rpcProcess: UNEXPECTED SREQ!: %02X%s:%02X%s",
 					        expectedSrspCmdId,
 					        (rpcBuff[1] & MT_RPC_SUBSYSTEM_MASK));
+					RPC_METRIC_INC(RPC_METRIC_SRSP_UNEXPECTED);
+					RPC_TRACE_DROP(traceId);
 					return 0;
 				}
 			}
+			else if (rpcFrameCb != NULL)
+			{
+				RPC_METRIC_INC(RPC_METRIC_AREQ_IN);
+				RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_CB_START);
+				rpcFrameCb(&rpcBuff[1], rpcLen);
+				RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_CB_END);
+				RPC_TRACE_END(traceId);
+				return 0;
+			}
+			else if ((rpcAreqFilter != NULL)
+			        && !rpcFilterMatch(rpcAreqFilter, &rpcBuff[1], rpcLen))
+			{
+				RPC_METRIC_INC(RPC_METRIC_AREQ_IN);
+				RPC_METRIC_INC(RPC_METRIC_AREQ_FILTERED);
+				RPC_TRACE_DROP(traceId);
+				return 0;
+			}
 			else
 			{
 				// should be AREQ frame
@@ -401,8 +612,13 @@ int32_t rpcProcess(void)
 				        rpcLen);
 
 				// send message to queue
-				llq_add(&rpcLlq, (char*) &rpcBuff[1], rpcLen, 0);
+				RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_ENQUEUED);
+				llq_add(&rpcLlq, (char*) &rpcBuff[1],
+				        rpcLen + RPC_TRACE_TAG_LEN, 0);
+				RPC_METRIC_INC(RPC_METRIC_AREQ_IN);
+				RPC_METRIC_INC(RPC_METRIC_LLQ_ENQUEUED);
 			}
+			RPC_METRIC_GAUGE_SET(RPC_METRIC_LLQ_DEPTH, llq_depth(&rpcLlq));
 
 			return 0;
 		}
@@ -417,6 +633,7 @@ int32_t rpcProcess(void)
 		dbg_print(PRINT_LEVEL_WARNING,
 		        "rpcProcess: No valid Start Of Frame found [%x:%x]\n", sofByte,
 		        bytesRead);
+		RPC_METRIC_INC(RPC_METRIC_SOF_RESYNCS);
 	}
 
 	return -1;
@@ -437,11 +654,21 @@ uint8_t rpcSendFrame(uint8_t cmd0, uint8_t cmd1, uint8_t *payload,
 {
 	uint8_t buf[RPC_MAX_LEN];
 	int32_t status = MT_RPC_SUCCESS;
+	rpcSched_t *sched = rpcTxSched;
+	RPC_TRACE_BEGIN(traceId, RPC_TRACE_DIR_TX);
+
+	// wait for the turn of the frame given by the scheduler
+	if (sched != NULL)
+	{
+		rpcSchedAcquire(sched, cmd0, cmd1, payload, payload_len);
+	}
 
 	// block here if SREQ is in progress
 	dbg_print(PRINT_LEVEL_INFO, "rpcSendFrame: Blocking on RPC sem\n");
 	sem_wait(&rpcSem);
 	dbg_print(PRINT_LEVEL_INFO, "rpcSendFrame: Sending RPC\n");
+	RPC_TRACE_STAMP(traceId, RPC_TRACE_TX_SEM_ACQUIRED);
+	RPC_TRACE_FRAME(traceId, cmd0, cmd1, payload_len);
 
 	// fill in header bytes
 	buf[0] = MT_RPC_SOF;
@@ -465,6 +692,11 @@ uint8_t rpcSendFrame(uint8_t cmd0, uint8_t cmd1, uint8_t *payload,
 	buf[payload_len + RPC_UART_HDR_LEN] = calcFcs(
 	        &buf[RPC_UART_FRAME_START_IDX], payload_len + RPC_HDR_LEN);
 
+	RPC_METRIC_INC(RPC_METRIC_FRAMES_OUT);
+	RPC_METRIC_ADD(RPC_METRIC_BYTES_OUT,
+	        payload_len + RPC_UART_HDR_LEN + RPC_UART_FCS_LEN);
+	RPC_METRIC_TIME(srspStart);
+
 #ifdef HAL_UART_IP
 	// No SOF or FCS
 	rpcTransportWrite(buf+1, payload_len + RPC_HDR_LEN + RPC_UART_FCS_LEN);
@@ -472,6 +704,7 @@ uint8_t rpcSendFrame(uint8_t cmd0, uint8_t cmd1, uint8_t *payload,
 	// send out RPC  message
 	rpcTransportWrite(buf, payload_len + RPC_UART_HDR_LEN + RPC_UART_FCS_LEN);
 #endif
+	RPC_TRACE_STAMP(traceId, RPC_TRACE_TX_WRITE_DONE);
 
 	// print out message to be sent
 	printRpcMsg("SOC OUT -->", buf[0], payload_len, &buf[2]);
@@ -486,6 +719,7 @@ uint8_t rpcSendFrame(uint8_t cmd0, uint8_t cmd1, uint8_t *payload,
 
 		dbg_print(PRINT_LEVEL_INFO, "rpcSendFrame: waiting for SRSP [%02x]\n",
 		        expectedSrspCmdId);
+		RPC_METRIC_INC(RPC_METRIC_SREQ_SENT);
 
 		//Wait for the SRSP
 		status = sem_timedwait(&srspSem, &srspTimeOut);
@@ -494,11 +728,16 @@ uint8_t rpcSendFrame(uint8_t cmd0, uint8_t cmd1, uint8_t *payload,
 			dbg_print(PRINT_LEVEL_WARNING,
 			        "rpcSendFrame: SRSP Error - CMD0: 0x%02X CMD1: 0x%02X\n",
 			        cmd0, cmd1);
+			RPC_METRIC_INC(RPC_METRIC_SRSP_TIMEOUTS);
 			status = MT_RPC_ERR_SUBSYSTEM;
 		}
 		else
 		{
 			dbg_print(PRINT_LEVEL_INFO, "rpcSendFrame: Receive SRSP\n");
+			RPC_TRACE_STAMP(traceId, RPC_TRACE_TX_SRSP_RECEIVED);
+			RPC_METRIC_OBSERVE(RPC_METRIC_SRSP_LATENCY,
+			        rpcMetricsNowUs() - srspStart);
+			threadSrspStatus = srspStatus;
 			status = MT_RPC_SUCCESS;
 		}
 
@@ -506,12 +745,33 @@ uint8_t rpcSendFrame(uint8_t cmd0, uint8_t cmd1, uint8_t *payload,
 		expectedSrspCmdId = 0xFF;
 	}
 
+	RPC_TRACE_END(traceId);
+
 	//Unlock RPC sem
 	sem_post(&rpcSem);
 
+	if (sched != NULL)
+	{
+		rpcSchedRelease(sched);
+	}
+
 	return status;
 }
 
+/*********************************************************************
+ * @fn      rpcGetSrspStatus
+ *
+ * @brief   status byte of the last SRSP received by the calling thread,
+ *          taken while it held the RPC semaphore, so another thread
+ *          processing the SRSP from the queue cannot change it
+ *
+ * @return  status, valid after rpcSendFrame() returned MT_RPC_SUCCESS
+ */
+uint8_t rpcGetSrspStatus(void)
+{
+	return threadSrspStatus;
+}
+
 /*********************************************************************
  * LOCAL FUNCTIONS
  */
@@ -539,6 +799,39 @@ static uint8_t calcFcs(uint8_t *msg, uint8_t size)
 	return result;
 }
 
+/*********************************************************************
+ * @fn      rpcProcessMqMsg
+ *
+ * @brief   dispatch a frame taken from the RPC queue to the MT parser
+ *
+ * @param   rpcFrame - frame starting from the Cmd0 byte
+ * @param   rpcLen - length of the queued message
+ *
+ * @return  -
+ */
+static void rpcProcessMqMsg(uint8_t *rpcFrame, int32_t rpcLen)
+{
+#ifdef RPC_TRACE
+	rpcTraceId_t traceId;
+
+	// strip the trace id from the end of the message
+	rpcLen -= RPC_TRACE_TAG_LEN;
+	memcpy(&traceId, &rpcFrame[rpcLen], RPC_TRACE_TAG_LEN);
+#endif
+	RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_DEQUEUED);
+
+	RPC_METRIC_INC(RPC_METRIC_LLQ_DEQUEUED);
+	RPC_METRIC_GAUGE_SET(RPC_METRIC_LLQ_DEPTH, llq_depth(&rpcLlq));
+	RPC_METRIC_TIME(cbStart);
+	RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_CB_START);
+
+	mtProcess(rpcFrame, rpcLen);
+
+	RPC_TRACE_STAMP(traceId, RPC_TRACE_RX_CB_END);
+	RPC_TRACE_END(traceId);
+	RPC_METRIC_OBSERVE(RPC_METRIC_CB_DURATION, rpcMetricsNowUs() - cbStart);
+}
+
 /*********************************************************************
  * @fn      printRpcMsg
  *
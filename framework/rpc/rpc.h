@@ -136,6 +136,10 @@ typedef enum
 	MT_RPC_ERR_LENGTH = 4       // invalid length
 } mtRpcErrorCode_t;
 
+// handler of the frames received from the ZNP, rpcFrame starts at the
+// Cmd0 byte and rpcLen counts Cmd0, Cmd1, the payload and the FCS
+typedef void (*rpcFrameCb_t)(uint8_t *rpcFrame, uint8_t rpcLen);
+
 /***********************************************************************************
  * GLOBAL VARIABLES
  */
@@ -149,8 +153,13 @@ void rpcClose(void);
 int32_t rpcProcess(void);
 uint8_t rpcSendFrame(uint8_t cmd0, uint8_t cmd1, uint8_t * payload,
         uint8_t payload_len);
+uint8_t rpcGetSrspStatus(void);
 void rpcForceRun(void);
+void rpcForceBoot(void);
 int32_t rpcInitMq(void);
+void rpcRegisterFrameCallback(rpcFrameCb_t cb);
+void rpcRegisterRxTap(rpcFrameCb_t tap);
+void rpcQueueFrame(uint8_t *rpcFrame, uint8_t rpcLen);
 int32_t rpcGetMqClientMsg(void);
 int32_t rpcWaitMqClientMsg(uint32_t timeout);
 
@@ -0,0 +1,224 @@
+/*
+ * rpcFilter.c
+ *
+ * This module contains the AREQ filters, see rpcFilter.h.
+ *
+ * The AF fields of a frame are packed into one 64 bit key, cluster,
+ * source address, group, source and destination endpoints from the
+ * top, so a rule on any of them is a single masked compare.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+
+#include "rpcFilter.h"
+#include "rpc.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define MT_AF_INCOMING_MSG_ID      (0x81)
+#define MT_AF_INCOMING_MSG_EXT_ID  (0x82)
+
+// bytes of the frames up to the destination endpoint, from Cmd0
+#define AF_INCOMING_MSG_MIN        (10)
+#define AF_INCOMING_MSG_EXT_MIN    (19)
+
+// source address of an IEEE addressed AF_INCOMING_MSG_EXT
+#define AF_NO_SHORT_ADDR           (0xFFFE)
+
+#define KEY_CLUSTER(v)             ((uint64_t) (v) << 48)
+#define KEY_SRC_ADDR(v)            ((uint64_t) (v) << 32)
+#define KEY_GROUP(v)               ((uint64_t) (v) << 16)
+#define KEY_SRC_EP(v)              ((uint64_t) (v) << 8)
+#define KEY_DST_EP(v)              ((uint64_t) (v))
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      afKey
+ *
+ * @brief   packs the fields of an AF incoming message
+ *
+ * @return  0 on success, -1 if the frame is too short
+ */
+static int32_t afKey(const uint8_t *rpcFrame, uint8_t rpcLen, uint64_t *key)
+{
+	uint16_t srcAddr;
+
+	if (rpcFrame[1] == MT_AF_INCOMING_MSG_ID)
+	{
+		if (rpcLen < AF_INCOMING_MSG_MIN + RPC_UART_FCS_LEN)
+		{
+			return -1;
+		}
+		*key = KEY_GROUP(rpcFrame[2] | (rpcFrame[3] << 8))
+		        | KEY_CLUSTER(rpcFrame[4] | (rpcFrame[5] << 8))
+		        | KEY_SRC_ADDR(rpcFrame[6] | (rpcFrame[7] << 8))
+		        | KEY_SRC_EP(rpcFrame[8]) | KEY_DST_EP(rpcFrame[9]);
+		return 0;
+	}
+
+	if (rpcLen < AF_INCOMING_MSG_EXT_MIN + RPC_UART_FCS_LEN)
+	{
+		return -1;
+	}
+	// address mode 2 is a short address
+	srcAddr = (rpcFrame[6] == 2) ?
+	        (rpcFrame[7] | (rpcFrame[8] << 8)) : AF_NO_SHORT_ADDR;
+	*key = KEY_GROUP(rpcFrame[2] | (rpcFrame[3] << 8))
+	        | KEY_CLUSTER(rpcFrame[4] | (rpcFrame[5] << 8))
+	        | KEY_SRC_ADDR(srcAddr) | KEY_SRC_EP(rpcFrame[15])
+	        | KEY_DST_EP(rpcFrame[18]);
+
+	return 0;
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      rpcFilterCompile
+ *
+ * @brief   builds a filter from its rules
+ *
+ * @param   filter - filter
+ * @param   rules - rules, a frame passes if it matches any
+ * @param   count - rules, 0 for a filter passing every frame
+ *
+ * @return  0 on success, -1 on too many rules, or on AF fields in a rule
+ *          that is not on the AF incoming messages
+ */
+int32_t rpcFilterCompile(rpcFilter_t *filter, const rpcFilterRule_t *rules,
+        uint32_t count)
+{
+	const rpcFilterRule_t *r;
+	uint64_t mask, value;
+	uint32_t i;
+
+	memset(filter, 0, sizeof(rpcFilter_t));
+	if (count > RPC_FILTER_MAX_RULES)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		r = &rules[i];
+		if (r->Sys > MT_RPC_SUBSYSTEM_MASK)
+		{
+			return -1;
+		}
+
+		if (!(r->Match & RPC_FILTER_AF_FIELDS))
+		{
+			if (r->Match & RPC_FILTER_CMD1)
+			{
+				filter->Pass[r->Sys][r->Cmd1 >> 5] |= 1UL << (r->Cmd1 & 31);
+			}
+			else
+			{
+				memset(filter->Pass[r->Sys], 0xFF,
+				        sizeof(filter->Pass[r->Sys]));
+			}
+			continue;
+		}
+
+		if ((r->Sys != MT_RPC_SYS_AF)
+		        || ((r->Match & RPC_FILTER_CMD1)
+		                && (r->Cmd1 != MT_AF_INCOMING_MSG_ID)
+		                && (r->Cmd1 != MT_AF_INCOMING_MSG_EXT_ID)))
+		{
+			return -1;
+		}
+		mask = 0;
+		value = 0;
+		if (r->Match & RPC_FILTER_CLUSTER)
+		{
+			mask |= KEY_CLUSTER(0xFFFF);
+			value |= KEY_CLUSTER(r->ClusterId);
+		}
+		if (r->Match & RPC_FILTER_SRC_ADDR)
+		{
+			mask |= KEY_SRC_ADDR(0xFFFF);
+			value |= KEY_SRC_ADDR(r->SrcAddr);
+		}
+		if (r->Match & RPC_FILTER_GROUP)
+		{
+			mask |= KEY_GROUP(0xFFFF);
+			value |= KEY_GROUP(r->GroupId);
+		}
+		if (r->Match & RPC_FILTER_SRC_EP)
+		{
+			mask |= KEY_SRC_EP(0xFF);
+			value |= KEY_SRC_EP(r->SrcEndpoint);
+		}
+		if (r->Match & RPC_FILTER_DST_EP)
+		{
+			mask |= KEY_DST_EP(0xFF);
+			value |= KEY_DST_EP(r->DstEndpoint);
+		}
+		filter->AfCmd1[filter->AfCount] =
+		        (r->Match & RPC_FILTER_CMD1) ? r->Cmd1 : 0;
+		filter->AfMask[filter->AfCount] = mask;
+		filter->AfValue[filter->AfCount] = value;
+		filter->AfCount++;
+	}
+	filter->Active = (count != 0);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcFilterMatch
+ *
+ * @brief   tells whether a frame passes a filter, without parsing it
+ *
+ * @param   filter - compiled filter
+ * @param   rpcFrame - frame from the Cmd0 byte
+ * @param   rpcLen - length of the frame, up to the FCS
+ *
+ * @return  1 if the frame passes, 0 if not
+ */
+int32_t rpcFilterMatch(const rpcFilter_t *filter, const uint8_t *rpcFrame,
+        uint8_t rpcLen)
+{
+	uint8_t sys = rpcFrame[0] & MT_RPC_SUBSYSTEM_MASK;
+	uint8_t cmd1 = rpcFrame[1];
+	uint64_t key;
+	uint32_t i;
+
+	if (!filter->Active
+	        || (filter->Pass[sys][cmd1 >> 5] & (1UL << (cmd1 & 31))))
+	{
+		return 1;
+	}
+	if ((filter->AfCount == 0) || (sys != MT_RPC_SYS_AF)
+	        || ((cmd1 != MT_AF_INCOMING_MSG_ID)
+	                && (cmd1 != MT_AF_INCOMING_MSG_EXT_ID))
+	        || (afKey(rpcFrame, rpcLen, &key) != 0))
+	{
+		return 0;
+	}
+
+	for (i = 0; i < filter->AfCount; i++)
+	{
+		if (((filter->AfCmd1[i] == 0) || (filter->AfCmd1[i] == cmd1))
+		        && ((key & filter->AfMask[i]) == filter->AfValue[i]))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
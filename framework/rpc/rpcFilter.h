@@ -0,0 +1,99 @@
+/*
+ * rpcFilter.h
+ *
+ * This module contains the AREQ filters, which decide from the raw MT
+ * frame whether an AREQ is wanted before anything parses it.
+ *
+ * A filter is given as rules, a frame passes if any rule matches it. A
+ * rule names a subsystem and optionally the command, and for the AF
+ * incoming messages the cluster, source address, source and destination
+ * endpoints and group. The rules are compiled once into a bitmap of the
+ * commands passing as they are and a short list of masked compares of
+ * the AF fields, so a frame is matched with a lookup and, for the AF
+ * messages only, a few compares.
+ *
+ * Filters are used by the mux daemon for each client (rpcMuxFilter())
+ * and by the RPC layer for the AREQs it queues (rpcSetAreqFilter()).
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef RPCFILTER_H
+#define RPCFILTER_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// rules of a filter, as many as one MT frame carries to the mux daemon
+#define RPC_FILTER_MAX_RULES       (22)
+
+// fields a rule matches, besides the subsystem
+#define RPC_FILTER_CMD1            (0x01)
+#define RPC_FILTER_CLUSTER         (0x02) // AF incoming messages only
+#define RPC_FILTER_SRC_ADDR        (0x04) // AF, short source addresses
+#define RPC_FILTER_SRC_EP          (0x08) // AF
+#define RPC_FILTER_DST_EP          (0x10) // AF
+#define RPC_FILTER_GROUP           (0x20) // AF
+#define RPC_FILTER_AF_FIELDS       (0x3E)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	uint8_t Sys;               // MT_RPC_SYS_*
+	uint8_t Cmd1;
+	uint8_t Match;             // RPC_FILTER_* fields compared
+	uint16_t ClusterId;
+	uint16_t SrcAddr;
+	uint16_t GroupId;
+	uint8_t SrcEndpoint;
+	uint8_t DstEndpoint;
+} rpcFilterRule_t;
+
+typedef struct
+{
+	uint8_t Active;            // 0: every frame passes
+
+	// commands passing whatever their fields, a bit per Cmd1 of each
+	// subsystem
+	uint32_t Pass[32][8];
+
+	// masked compares of the AF incoming message fields
+	uint8_t AfCount;
+	uint8_t AfCmd1[RPC_FILTER_MAX_RULES]; // 0 for both incoming messages
+	uint64_t AfMask[RPC_FILTER_MAX_RULES];
+	uint64_t AfValue[RPC_FILTER_MAX_RULES];
+} rpcFilter_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t rpcFilterCompile(rpcFilter_t *filter, const rpcFilterRule_t *rules,
+        uint32_t count);
+int32_t rpcFilterMatch(const rpcFilter_t *filter, const uint8_t *rpcFrame,
+        uint8_t rpcLen);
+
+// in the RPC layer, rpc.c
+void rpcSetAreqFilter(const rpcFilter_t *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPCFILTER_H */
@@ -0,0 +1,1010 @@
+/*
+ * rpcJournal.c
+ *
+ * This module contains the frame journal, see rpcJournal.h.
+ *
+ * The RPC thread and the journal thread share two staging buffers: the
+ * RPC thread appends to one while the journal thread writes the other
+ * into the segment, the lock being held only to copy a frame in and to
+ * swap the buffers. The segments and their indexes change under the
+ * write lock of SegLock, taken while a batch is appended, and the sync
+ * of the batch runs without it, so the queries are only held up by the
+ * copies.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rpcJournal.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define MT_AF_INCOMING_MSG_ID      (0x81)
+#define MT_AF_INCOMING_MSG_EXT_ID  (0x82)
+#define MT_ZDO_STATE_CHANGE_IND_ID (0xC0)
+
+// staged frame: receive time, node, length, then the frame
+#define JOURNAL_STAGE_HDR_LEN      (11)
+
+#define JOURNAL_ALIGN(n)           (((n) + 7) & ~7U)
+
+#define JOURNAL_MIN_SEG_BYTES      (64 * 1024)
+#define JOURNAL_MIN_STAGE_BYTES    (4 * 1024)
+
+#define JOURNAL_NODE_SLOTS         (64)
+
+// time the journal thread sleeps without frames, between retention checks
+#define JOURNAL_IDLE_MS            (1000)
+
+#define JOURNAL_SEG_NAME_LEN       (12)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+// journal of the RX tap, the tap has no context
+static rpcJournal_t *activeJournal;
+static pthread_mutex_t activeLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static uint64_t epochUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v & 0xFFFF);
+	put16(p + 2, v >> 16);
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+	put32(p, v & 0xFFFFFFFF);
+	put32(p + 4, v >> 32);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return get16(p) | ((uint32_t) get16(p + 2) << 16);
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+	return get32(p) | ((uint64_t) get32(p + 4) << 32);
+}
+
+/*********************************************************************
+ * @fn      frameNode
+ *
+ * @brief   tells whether a frame is journaled and the node it is from
+ *
+ * @return  NwkAddr of the source, RPC_JOURNAL_NO_NODE if unknown, -1 if
+ *          the frame is not journaled
+ */
+static int32_t frameNode(const uint8_t *rpcFrame, uint8_t rpcLen)
+{
+	uint8_t sys = rpcFrame[0] & MT_RPC_SUBSYSTEM_MASK;
+	uint8_t cmd1 = rpcFrame[1];
+
+	if ((rpcFrame[0] & MT_RPC_CMD_TYPE_MASK) != MT_RPC_CMD_AREQ)
+	{
+		return -1;
+	}
+
+	if (sys == MT_RPC_SYS_AF)
+	{
+		if (cmd1 == MT_AF_INCOMING_MSG_ID)
+		{
+			// GroupId, ClusterId, SrcAddr
+			return (rpcLen >= 8 + RPC_UART_FCS_LEN) ?
+			        get16(&rpcFrame[6]) : RPC_JOURNAL_NO_NODE;
+		}
+		if (cmd1 == MT_AF_INCOMING_MSG_EXT_ID)
+		{
+			// GroupId, ClusterId, SrcAddrMode, SrcAddr, mode 2 is short
+			return ((rpcLen >= 9 + RPC_UART_FCS_LEN) && (rpcFrame[6] == 2)) ?
+			        get16(&rpcFrame[7]) : RPC_JOURNAL_NO_NODE;
+		}
+		return -1;
+	}
+
+	if (sys == MT_RPC_SYS_ZDO)
+	{
+		// the ZDO indications start with the address of their node
+		return ((cmd1 != MT_ZDO_STATE_CHANGE_IND_ID)
+		        && (rpcLen >= 4 + RPC_UART_FCS_LEN)) ?
+		        get16(&rpcFrame[2]) : RPC_JOURNAL_NO_NODE;
+	}
+
+	return -1;
+}
+
+/*********************************************************************
+ * @fn      frameValid
+ *
+ * @brief   checks the FCS of a frame read back from a segment
+ */
+static uint8_t frameValid(const uint8_t *rpcFrame, uint8_t rpcLen)
+{
+	uint8_t fcs = rpcLen - RPC_CMD0_FIELD_LEN - RPC_CMD1_FIELD_LEN
+	        - RPC_UART_FCS_LEN;
+	uint32_t i;
+
+	for (i = 0; i < (uint32_t) rpcLen - RPC_UART_FCS_LEN; i++)
+	{
+		fcs ^= rpcFrame[i];
+	}
+
+	return fcs == rpcFrame[rpcLen - RPC_UART_FCS_LEN];
+}
+
+static uint32_t nodeHash(uint16_t nwkAddr, uint32_t slots)
+{
+	return ((nwkAddr * 40503U) >> 4) & (slots - 1);
+}
+
+/*********************************************************************
+ * @fn      nodeFind
+ *
+ * @brief   finds the index entry of a node in a segment
+ *
+ * @return  entry, NULL if the node has no record in the segment
+ */
+static rpcJournalNode_t *nodeFind(rpcJournalSeg_t *seg, uint16_t nwkAddr)
+{
+	uint32_t i = nodeHash(nwkAddr, seg->NodeSlots);
+
+	while (seg->Nodes[i].Last != 0)
+	{
+		if (seg->Nodes[i].NwkAddr == nwkAddr)
+		{
+			return &seg->Nodes[i];
+		}
+		i = (i + 1) & (seg->NodeSlots - 1);
+	}
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      nodeAdd
+ *
+ * @brief   finds or adds the index entry of a node, growing the table
+ *          past half full
+ *
+ * @return  entry, NULL if out of memory
+ */
+static rpcJournalNode_t *nodeAdd(rpcJournalSeg_t *seg, uint16_t nwkAddr)
+{
+	rpcJournalNode_t *node = nodeFind(seg, nwkAddr), *old;
+	uint32_t i, j, slots;
+
+	if (node != NULL)
+	{
+		return node;
+	}
+
+	if ((seg->NodeCount + 1) * 2 > seg->NodeSlots)
+	{
+		slots = seg->NodeSlots * 2;
+		old = seg->Nodes;
+		seg->Nodes = calloc(slots, sizeof(rpcJournalNode_t));
+		if (seg->Nodes == NULL)
+		{
+			seg->Nodes = old;
+			return NULL;
+		}
+		for (i = 0; i < seg->NodeSlots; i++)
+		{
+			if (old[i].Last != 0)
+			{
+				j = nodeHash(old[i].NwkAddr, slots);
+				while (seg->Nodes[j].Last != 0)
+				{
+					j = (j + 1) & (slots - 1);
+				}
+				seg->Nodes[j] = old[i];
+			}
+		}
+		seg->NodeSlots = slots;
+		free(old);
+	}
+
+	i = nodeHash(nwkAddr, seg->NodeSlots);
+	while (seg->Nodes[i].Last != 0)
+	{
+		i = (i + 1) & (seg->NodeSlots - 1);
+	}
+	seg->Nodes[i].NwkAddr = nwkAddr;
+	seg->NodeCount++;
+
+	// Last is set by the caller, the slot is taken from then on
+	return &seg->Nodes[i];
+}
+
+static void segPath(rpcJournal_t *ctx, uint32_t seq, char *path, size_t len)
+{
+	snprintf(path, len, "%s/%08u.jnl", ctx->Cfg.Dir, seq);
+}
+
+/*********************************************************************
+ * @fn      segAdd
+ *
+ * @brief   adds a mapped segment as the newest one
+ *
+ * @return  segment, NULL if out of memory
+ */
+static rpcJournalSeg_t *segAdd(rpcJournal_t *ctx, uint32_t seq, int fd,
+        uint8_t *map, uint32_t size)
+{
+	rpcJournalSeg_t *segs, *seg;
+
+	segs = realloc(ctx->Segs, (ctx->SegCount + 1) * sizeof(rpcJournalSeg_t));
+	if (segs == NULL)
+	{
+		return NULL;
+	}
+	ctx->Segs = segs;
+	seg = &segs[ctx->SegCount];
+	memset(seg, 0, sizeof(rpcJournalSeg_t));
+	seg->Nodes = calloc(JOURNAL_NODE_SLOTS, sizeof(rpcJournalNode_t));
+	if (seg->Nodes == NULL)
+	{
+		return NULL;
+	}
+	seg->NodeSlots = JOURNAL_NODE_SLOTS;
+	seg->Seq = seq;
+	seg->Fd = fd;
+	seg->Map = map;
+	seg->Size = size;
+	seg->Len = RPC_JOURNAL_SEG_HDR_LEN;
+	ctx->SegCount++;
+
+	return seg;
+}
+
+/*********************************************************************
+ * @fn      segRemove
+ *
+ * @brief   unmaps and deletes the oldest segment
+ */
+static void segRemove(rpcJournal_t *ctx)
+{
+	rpcJournalSeg_t *seg = &ctx->Segs[0];
+	char path[256];
+
+	segPath(ctx, seg->Seq, path, sizeof(path));
+	munmap(seg->Map, seg->Size);
+	close(seg->Fd);
+	if (unlink(path) != 0)
+	{
+		ctx->Stats.Errors++;
+	}
+	free(seg->Nodes);
+	ctx->SegCount--;
+	memmove(&ctx->Segs[0], &ctx->Segs[1],
+	        ctx->SegCount * sizeof(rpcJournalSeg_t));
+}
+
+/*********************************************************************
+ * @fn      segCreate
+ *
+ * @brief   creates the next segment, allocated on disk up front so that
+ *          a full disk fails here rather than on a write to the mapping
+ *
+ * @return  segment, NULL on failure
+ */
+static rpcJournalSeg_t *segCreate(rpcJournal_t *ctx)
+{
+	rpcJournalSeg_t *seg;
+	char path[256];
+	uint8_t *map;
+	int fd, dirFd;
+
+	segPath(ctx, ctx->NextSeq, path, sizeof(path));
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "rpcJournal: cannot create %s, %s\n",
+		        path, strerror(errno));
+		return NULL;
+	}
+	if (posix_fallocate(fd, 0, ctx->Cfg.SegBytes) != 0)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "rpcJournal: no room for %s\n", path);
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+	map = mmap(NULL, ctx->Cfg.SegBytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+	        fd, 0);
+	if (map == MAP_FAILED)
+	{
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+
+	seg = segAdd(ctx, ctx->NextSeq, fd, map, ctx->Cfg.SegBytes);
+	if (seg == NULL)
+	{
+		munmap(map, ctx->Cfg.SegBytes);
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+	put32(&map[0], RPC_JOURNAL_MAGIC);
+	put16(&map[4], 1);
+	put16(&map[6], RPC_JOURNAL_SEG_HDR_LEN);
+	put32(&map[8], ctx->NextSeq);
+	put32(&map[12], ctx->Cfg.SegBytes);
+	put64(&map[16], epochUs());
+	ctx->NextSeq++;
+	ctx->Stats.Segments++;
+
+	// the new name is durable once the directory is
+	dirFd = open(ctx->Cfg.Dir, O_RDONLY);
+	if (dirFd >= 0)
+	{
+		fsync(dirFd);
+		close(dirFd);
+	}
+
+	return seg;
+}
+
+/*********************************************************************
+ * @fn      segLoad
+ *
+ * @brief   maps a segment found when opening the journal and indexes its
+ *          records, up to the first one missing or torn. The segment is
+ *          not written again, so records of a batch left unfinished
+ *          behind a torn one are never taken for new ones.
+ *
+ * @return  0 on success, -1 if the file is not a segment
+ */
+static int32_t segLoad(rpcJournal_t *ctx, uint32_t seq)
+{
+	rpcJournalSeg_t *seg;
+	rpcJournalNode_t *node;
+	struct stat st;
+	char path[256];
+	uint8_t *map, *p;
+	uint32_t off, recLen;
+	uint16_t nwkAddr;
+	int fd;
+
+	segPath(ctx, seq, path, sizeof(path));
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if ((fstat(fd, &st) != 0) || (st.st_size < JOURNAL_MIN_SEG_BYTES)
+	        || (st.st_size > UINT32_MAX))
+	{
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		close(fd);
+		return -1;
+	}
+	if ((get32(&map[0]) != RPC_JOURNAL_MAGIC) || (get16(&map[4]) != 1)
+	        || ((seg = segAdd(ctx, seq, fd, map, st.st_size)) == NULL))
+	{
+		munmap(map, st.st_size);
+		close(fd);
+		return -1;
+	}
+
+	off = RPC_JOURNAL_SEG_HDR_LEN;
+	while (off + RPC_JOURNAL_REC_HDR_LEN <= seg->Size)
+	{
+		p = &map[off];
+		recLen = JOURNAL_ALIGN(RPC_JOURNAL_REC_HDR_LEN + p[14]);
+		if ((get64(p) == 0) || (p[14] < RPC_CMD0_FIELD_LEN
+		        + RPC_CMD1_FIELD_LEN + RPC_UART_FCS_LEN)
+		        || (off + recLen > seg->Size)
+		        || !frameValid(&p[RPC_JOURNAL_REC_HDR_LEN], p[14]))
+		{
+			break;
+		}
+		nwkAddr = get16(&p[12]);
+		node = nodeFind(seg, nwkAddr);
+		if (get32(&p[8]) != ((node != NULL) ? node->Last : 0))
+		{
+			break;
+		}
+		node = nodeAdd(seg, nwkAddr);
+		if (node == NULL)
+		{
+			break;
+		}
+		node->Last = off;
+		if (seg->FirstUs == 0)
+		{
+			seg->FirstUs = get64(p);
+		}
+		seg->LastUs = get64(p);
+		off += recLen;
+	}
+	seg->Len = off;
+	seg->Synced = off;
+
+	if (seq >= ctx->NextSeq)
+	{
+		ctx->NextSeq = seq + 1;
+	}
+
+	return 0;
+}
+
+static int seqCompare(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*********************************************************************
+ * @fn      journalLoad
+ *
+ * @brief   maps the segments of the directory, oldest first
+ *
+ * @return  0 on success, -1 if the directory cannot be read
+ */
+static int32_t journalLoad(rpcJournal_t *ctx)
+{
+	struct dirent *ent;
+	uint32_t *seqs = NULL, *more, count = 0, i;
+	char *end;
+	DIR *dir;
+
+	if ((mkdir(ctx->Cfg.Dir, 0755) != 0) && (errno != EEXIST))
+	{
+		return -1;
+	}
+	dir = opendir(ctx->Cfg.Dir);
+	if (dir == NULL)
+	{
+		return -1;
+	}
+	while ((ent = readdir(dir)) != NULL)
+	{
+		if ((strlen(ent->d_name) != JOURNAL_SEG_NAME_LEN)
+		        || (strcmp(&ent->d_name[8], ".jnl") != 0))
+		{
+			continue;
+		}
+		more = realloc(seqs, (count + 1) * sizeof(uint32_t));
+		if (more == NULL)
+		{
+			break;
+		}
+		seqs = more;
+		seqs[count] = strtoul(ent->d_name, &end, 10);
+		if (end == &ent->d_name[8])
+		{
+			count++;
+		}
+	}
+	closedir(dir);
+
+	qsort(seqs, count, sizeof(uint32_t), seqCompare);
+	for (i = 0; i < count; i++)
+	{
+		if (segLoad(ctx, seqs[i]) != 0)
+		{
+			dbg_print(PRINT_LEVEL_WARNING,
+			        "rpcJournal: %08u.jnl is not a segment, skipped\n",
+			        seqs[i]);
+		}
+	}
+	free(seqs);
+	ctx->FirstSeq = ctx->NextSeq;
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      journalWrite
+ *
+ * @brief   appends a staging buffer to the segments and syncs it, on the
+ *          journal thread
+ */
+static void journalWrite(rpcJournal_t *ctx, const uint8_t *stage,
+        uint32_t len)
+{
+	rpcJournalSeg_t *seg;
+	rpcJournalNode_t *node;
+	const uint8_t *s;
+	uint32_t off = 0, recLen, start, synced, i;
+	uint64_t begin, took;
+	uint8_t *p;
+
+	pthread_rwlock_wrlock(&ctx->SegLock);
+	while (off < len)
+	{
+		s = &stage[off];
+		off += JOURNAL_STAGE_HDR_LEN + s[10];
+		recLen = JOURNAL_ALIGN(RPC_JOURNAL_REC_HDR_LEN + s[10]);
+
+		seg = (ctx->SegCount > 0) ? &ctx->Segs[ctx->SegCount - 1] : NULL;
+		if ((seg == NULL) || (seg->Seq < ctx->FirstSeq)
+		        || (seg->Len + recLen > seg->Size))
+		{
+			seg = segCreate(ctx);
+		}
+		if ((seg == NULL) || ((node = nodeAdd(seg, get16(&s[8]))) == NULL))
+		{
+			ctx->Stats.Errors++;
+			continue;
+		}
+
+		p = &seg->Map[seg->Len];
+		put32(&p[8], node->Last);
+		put16(&p[12], get16(&s[8]));
+		p[14] = s[10];
+		p[15] = 0;
+		memcpy(&p[RPC_JOURNAL_REC_HDR_LEN], &s[JOURNAL_STAGE_HDR_LEN], s[10]);
+		put64(p, get64(s));
+		node->Last = seg->Len;
+
+		if (seg->FirstUs == 0)
+		{
+			seg->FirstUs = get64(s);
+		}
+		seg->LastUs = get64(s);
+		seg->Len += recLen;
+		ctx->Stats.Frames++;
+		ctx->Stats.Bytes += recLen;
+	}
+	pthread_rwlock_unlock(&ctx->SegLock);
+
+	// group commit, only this thread changes the segments
+	begin = nowUs();
+	for (i = 0; i < ctx->SegCount; i++)
+	{
+		seg = &ctx->Segs[i];
+		if (seg->Synced == seg->Len)
+		{
+			continue;
+		}
+		start = seg->Synced & ~(sysconf(_SC_PAGESIZE) - 1);
+		synced = seg->Len;
+		if (msync(&seg->Map[start], synced - start, MS_SYNC) != 0)
+		{
+			ctx->Stats.Errors++;
+		}
+		seg->Synced = synced;
+	}
+	took = nowUs() - begin;
+
+	pthread_rwlock_wrlock(&ctx->SegLock);
+	ctx->Stats.Commits++;
+	ctx->Stats.CommitUs += took;
+	if (took > ctx->Stats.MaxCommitUs)
+	{
+		ctx->Stats.MaxCommitUs = took;
+	}
+	pthread_rwlock_unlock(&ctx->SegLock);
+}
+
+/*********************************************************************
+ * @fn      journalExpire
+ *
+ * @brief   deletes the segments past the retention, never the newest
+ */
+static void journalExpire(rpcJournal_t *ctx)
+{
+	uint64_t limit;
+
+	if (ctx->Cfg.RetentionS == 0)
+	{
+		return;
+	}
+	limit = epochUs() - (ctx->Cfg.RetentionS * 1000000ULL);
+
+	pthread_rwlock_wrlock(&ctx->SegLock);
+	while ((ctx->SegCount > 1) && (ctx->Segs[0].LastUs < limit))
+	{
+		segRemove(ctx);
+		ctx->Stats.Expired++;
+	}
+	pthread_rwlock_unlock(&ctx->SegLock);
+}
+
+/*********************************************************************
+ * @fn      journalThread
+ *
+ * @brief   takes the staging buffer once its first frame waited CommitMs
+ *          or it is half full, and writes it, until closed and empty
+ */
+static void *journalThread(void *arg)
+{
+	rpcJournal_t *ctx = (rpcJournal_t *) arg;
+	struct timespec to;
+	uint64_t due;
+	uint32_t b;
+
+	pthread_mutex_lock(&ctx->StageLock);
+	while (1)
+	{
+		b = ctx->StageFill;
+		if (ctx->StageLen[b] == 0)
+		{
+			if (!ctx->Running)
+			{
+				break;
+			}
+			due = nowUs() + (JOURNAL_IDLE_MS * 1000ULL);
+			to.tv_sec = due / 1000000;
+			to.tv_nsec = (due % 1000000) * 1000;
+			if ((pthread_cond_timedwait(&ctx->StageCond, &ctx->StageLock,
+			        &to) != 0) && (ctx->StageLen[b] == 0))
+			{
+				pthread_mutex_unlock(&ctx->StageLock);
+				journalExpire(ctx);
+				pthread_mutex_lock(&ctx->StageLock);
+			}
+			continue;
+		}
+
+		due = ctx->StageFirstUs + (ctx->Cfg.CommitMs * 1000ULL);
+		if (ctx->Running && (ctx->StageLen[b] < ctx->Cfg.StageBytes / 2)
+		        && (nowUs() < due))
+		{
+			to.tv_sec = due / 1000000;
+			to.tv_nsec = (due % 1000000) * 1000;
+			pthread_cond_timedwait(&ctx->StageCond, &ctx->StageLock, &to);
+			continue;
+		}
+
+		ctx->StageFill = b ^ 1;
+		pthread_mutex_unlock(&ctx->StageLock);
+
+		journalWrite(ctx, ctx->Stage[b], ctx->StageLen[b]);
+		journalExpire(ctx);
+
+		pthread_mutex_lock(&ctx->StageLock);
+		ctx->StageLen[b] = 0;
+	}
+	pthread_mutex_unlock(&ctx->StageLock);
+
+	return NULL;
+}
+
+/*********************************************************************
+ * @fn      journalTap
+ *
+ * @brief   RX tap of the RPC layer, on the RPC thread
+ */
+static void journalTap(uint8_t *rpcFrame, uint8_t rpcLen)
+{
+	pthread_mutex_lock(&activeLock);
+	if (activeJournal != NULL)
+	{
+		rpcJournalAppend(activeJournal, rpcFrame, rpcLen);
+	}
+	pthread_mutex_unlock(&activeLock);
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      rpcJournalOpen
+ *
+ * @brief   opens the journal in its directory, indexing the segments
+ *          there, and journals the frames the RPC layer receives from
+ *          then on. One journal is open at a time.
+ *
+ * @param   ctx - journal
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 on failure
+ */
+int32_t rpcJournalOpen(rpcJournal_t *ctx, rpcJournalCfg_t *cfg)
+{
+	pthread_condattr_t attr;
+
+	memset(ctx, 0, sizeof(rpcJournal_t));
+	ctx->Cfg = *cfg;
+	if (ctx->Cfg.Dir == NULL)
+	{
+		return -1;
+	}
+	if (ctx->Cfg.SegBytes == 0)
+	{
+		ctx->Cfg.SegBytes = RPC_JOURNAL_SEG_BYTES;
+	}
+	if (ctx->Cfg.SegBytes < JOURNAL_MIN_SEG_BYTES)
+	{
+		ctx->Cfg.SegBytes = JOURNAL_MIN_SEG_BYTES;
+	}
+	if (ctx->Cfg.StageBytes == 0)
+	{
+		ctx->Cfg.StageBytes = RPC_JOURNAL_STAGE_BYTES;
+	}
+	if (ctx->Cfg.StageBytes < JOURNAL_MIN_STAGE_BYTES)
+	{
+		ctx->Cfg.StageBytes = JOURNAL_MIN_STAGE_BYTES;
+	}
+	if (ctx->Cfg.CommitMs == 0)
+	{
+		ctx->Cfg.CommitMs = RPC_JOURNAL_COMMIT_MS;
+	}
+
+	ctx->Stage[0] = malloc(ctx->Cfg.StageBytes);
+	ctx->Stage[1] = malloc(ctx->Cfg.StageBytes);
+	if ((ctx->Stage[0] == NULL) || (ctx->Stage[1] == NULL))
+	{
+		free(ctx->Stage[0]);
+		free(ctx->Stage[1]);
+		return -1;
+	}
+	pthread_mutex_init(&ctx->StageLock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ctx->StageCond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_rwlock_init(&ctx->SegLock, NULL);
+
+	if (journalLoad(ctx) != 0)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "rpcJournalOpen: cannot open %s\n",
+		        ctx->Cfg.Dir);
+		rpcJournalClose(ctx);
+		return -1;
+	}
+	journalExpire(ctx);
+
+	ctx->Running = 1;
+	if (pthread_create(&ctx->Thread, NULL, journalThread, ctx) != 0)
+	{
+		ctx->Running = 0;
+		rpcJournalClose(ctx);
+		return -1;
+	}
+
+	pthread_mutex_lock(&activeLock);
+	if (activeJournal != NULL)
+	{
+		pthread_mutex_unlock(&activeLock);
+		dbg_print(PRINT_LEVEL_WARNING, "rpcJournalOpen: a journal is open\n");
+		rpcJournalClose(ctx);
+		return -1;
+	}
+	activeJournal = ctx;
+	rpcRegisterRxTap(journalTap);
+	pthread_mutex_unlock(&activeLock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcJournalClose
+ *
+ * @brief   stops journaling, writes and syncs the frames staged and
+ *          unmaps the segments
+ *
+ * @param   ctx - journal
+ *
+ * @return  none
+ */
+void rpcJournalClose(rpcJournal_t *ctx)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&activeLock);
+	if (activeJournal == ctx)
+	{
+		rpcRegisterRxTap(NULL);
+		activeJournal = NULL;
+	}
+	pthread_mutex_unlock(&activeLock);
+
+	pthread_mutex_lock(&ctx->StageLock);
+	if (ctx->Running)
+	{
+		ctx->Running = 0;
+		pthread_cond_signal(&ctx->StageCond);
+		pthread_mutex_unlock(&ctx->StageLock);
+		pthread_join(ctx->Thread, NULL);
+	}
+	else
+	{
+		pthread_mutex_unlock(&ctx->StageLock);
+	}
+
+	for (i = 0; i < ctx->SegCount; i++)
+	{
+		munmap(ctx->Segs[i].Map, ctx->Segs[i].Size);
+		close(ctx->Segs[i].Fd);
+		free(ctx->Segs[i].Nodes);
+	}
+	free(ctx->Segs);
+	ctx->Segs = NULL;
+	ctx->SegCount = 0;
+	free(ctx->Stage[0]);
+	free(ctx->Stage[1]);
+	pthread_rwlock_destroy(&ctx->SegLock);
+	pthread_cond_destroy(&ctx->StageCond);
+	pthread_mutex_destroy(&ctx->StageLock);
+}
+
+/*********************************************************************
+ * @fn      rpcJournalAppend
+ *
+ * @brief   stages a received frame if it is an AF incoming message or a
+ *          ZDO indication, without waiting for the disk. Called by the
+ *          RX tap, or directly for frames from elsewhere.
+ *
+ * @param   ctx - journal
+ * @param   rpcFrame - frame from the Cmd0 byte to the FCS
+ * @param   rpcLen - length of the frame
+ *
+ * @return  0 if staged or not journaled, -1 if dropped
+ */
+int32_t rpcJournalAppend(rpcJournal_t *ctx, const uint8_t *rpcFrame,
+        uint8_t rpcLen)
+{
+	uint32_t need = JOURNAL_STAGE_HDR_LEN + rpcLen, half;
+	int32_t nwkAddr;
+	uint8_t *p;
+
+	if ((rpcLen < RPC_CMD0_FIELD_LEN + RPC_CMD1_FIELD_LEN + RPC_UART_FCS_LEN)
+	        || ((nwkAddr = frameNode(rpcFrame, rpcLen)) < 0))
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&ctx->StageLock);
+	p = ctx->Stage[ctx->StageFill];
+	if (ctx->StageLen[ctx->StageFill] + need > ctx->Cfg.StageBytes)
+	{
+		ctx->Stats.Drops++;
+		pthread_mutex_unlock(&ctx->StageLock);
+		return -1;
+	}
+	if (ctx->StageLen[ctx->StageFill] == 0)
+	{
+		ctx->StageFirstUs = nowUs();
+		pthread_cond_signal(&ctx->StageCond);
+	}
+	half = ctx->Cfg.StageBytes / 2;
+	if ((ctx->StageLen[ctx->StageFill] < half)
+	        && (ctx->StageLen[ctx->StageFill] + need >= half))
+	{
+		pthread_cond_signal(&ctx->StageCond);
+	}
+
+	p += ctx->StageLen[ctx->StageFill];
+	put64(p, epochUs());
+	put16(&p[8], nwkAddr);
+	p[10] = rpcLen;
+	memcpy(&p[JOURNAL_STAGE_HDR_LEN], rpcFrame, rpcLen);
+	ctx->StageLen[ctx->StageFill] += need;
+	pthread_mutex_unlock(&ctx->StageLock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcJournalLast
+ *
+ * @brief   reads the newest frames of a node journaled, those staged and
+ *          not yet written excepted
+ *
+ * @param   ctx - journal
+ * @param   nwkAddr - node, RPC_JOURNAL_NO_NODE for the frames of none
+ * @param   entries - frames, newest first
+ * @param   max - entries
+ *
+ * @return  frames read
+ */
+int32_t rpcJournalLast(rpcJournal_t *ctx, uint16_t nwkAddr,
+        rpcJournalEntry_t *entries, uint32_t max)
+{
+	rpcJournalSeg_t *seg;
+	rpcJournalNode_t *node;
+	rpcJournalEntry_t *e;
+	uint32_t count = 0, off, s;
+	const uint8_t *p;
+
+	pthread_rwlock_rdlock(&ctx->SegLock);
+	for (s = ctx->SegCount; (s > 0) && (count < max); s--)
+	{
+		seg = &ctx->Segs[s - 1];
+		node = nodeFind(seg, nwkAddr);
+		off = (node != NULL) ? node->Last : 0;
+		while ((off != 0) && (count < max))
+		{
+			p = &seg->Map[off];
+			e = &entries[count++];
+			e->RxUs = get64(p);
+			e->NwkAddr = get16(&p[12]);
+			e->Len = p[14];
+			memcpy(e->Frame, &p[RPC_JOURNAL_REC_HDR_LEN], e->Len);
+			off = get32(&p[8]);
+		}
+	}
+	pthread_rwlock_unlock(&ctx->SegLock);
+
+	return count;
+}
+
+/*********************************************************************
+ * @fn      rpcJournalPrintStats
+ *
+ * @brief   prints the counters of the journal
+ */
+void rpcJournalPrintStats(rpcJournal_t *ctx, FILE *out)
+{
+	rpcJournalStats_t st;
+	uint32_t segs, drops;
+
+	pthread_mutex_lock(&ctx->StageLock);
+	drops = ctx->Stats.Drops;
+	pthread_mutex_unlock(&ctx->StageLock);
+	pthread_rwlock_rdlock(&ctx->SegLock);
+	st = ctx->Stats;
+	segs = ctx->SegCount;
+	pthread_rwlock_unlock(&ctx->SegLock);
+
+	fprintf(out, "journal: %llu frames, %llu bytes, %u dropped, %u segments "
+	        "(%u created, %u expired), %u commits avg %llu us max %u us, "
+	        "%u errors\n", (unsigned long long) st.Frames,
+	        (unsigned long long) st.Bytes, drops, segs, st.Segments,
+	        st.Expired, st.Commits,
+	        (unsigned long long) (st.Commits ? st.CommitUs / st.Commits : 0),
+	        st.MaxCommitUs, st.Errors);
+}
@@ -0,0 +1,175 @@
+/*
+ * rpcJournal.h
+ *
+ * This module contains the frame journal, which stores the AF incoming
+ * messages and the ZDO indications received from the ZNP, as raw frames
+ * with their receive time, durably on disk, and answers "the last N
+ * frames of node X" from the disk pages without scanning them.
+ *
+ * The journal is a directory of segment files of a fixed size, written
+ * in turn and only appended to, each memory mapped. The RPC thread only
+ * copies the frames it deframed into a staging buffer; a thread of the
+ * journal appends them to the segment and syncs them in one go every
+ * CommitMs, the group commit, so the reader never waits for the disk. A
+ * staging buffer full when the next frame comes drops it and counts it.
+ *
+ * Each record points back at the previous record of its node in the
+ * segment, and each segment keeps in memory the newest record of every
+ * node, so the index holds one entry per node and segment and a query
+ * walks the records of its node only. The index is built again from the
+ * records when the journal is opened, a torn record ending the segment;
+ * the segments found then are only read, new frames go to a new one.
+ * Segments whose newest frame is older than RetentionS are deleted.
+ *
+ * Segment file NNNNNNNN.jnl, little endian:
+ *   header of RPC_JOURNAL_SEG_HDR_LEN bytes
+ *     uint32  RPC_JOURNAL_MAGIC
+ *     uint16  version, 1
+ *     uint16  header length
+ *     uint32  sequence number of the segment
+ *     uint32  length of the segment
+ *     uint64  creation time, micro seconds since the epoch
+ *   records, 8 byte aligned, up to the first zero receive time
+ *     uint64  receive time, micro seconds since the epoch
+ *     uint32  offset of the previous record of the node, 0 for none
+ *     uint16  node, NwkAddr of the source, RPC_JOURNAL_NO_NODE if none
+ *     uint8   length of the frame
+ *     uint8   0
+ *     frame from Cmd0 to the FCS
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef RPCJOURNAL_H
+#define RPCJOURNAL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "rpc.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define RPC_JOURNAL_MAGIC          (0x4A504E5A) // "ZNPJ"
+
+#define RPC_JOURNAL_SEG_HDR_LEN    (64)
+#define RPC_JOURNAL_REC_HDR_LEN    (16)
+
+#define RPC_JOURNAL_NO_NODE        (0xFFFF)
+
+// defaults used for the rpcJournalCfg_t fields left 0
+#define RPC_JOURNAL_SEG_BYTES      (16 * 1024 * 1024)
+#define RPC_JOURNAL_STAGE_BYTES    (256 * 1024)
+#define RPC_JOURNAL_COMMIT_MS      (10)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	const char *Dir;           // created if missing
+	uint32_t SegBytes;         // bytes of a segment file
+	uint32_t StageBytes;       // bytes of each of the two staging buffers
+	uint32_t CommitMs;         // longest a frame waits to be synced
+	uint32_t RetentionS;       // age of the segments deleted, 0 for never
+} rpcJournalCfg_t;
+
+typedef struct
+{
+	uint64_t Frames;           // frames journaled
+	uint64_t Bytes;            // bytes of the records
+	uint32_t Drops;            // frames dropped, staging buffer full
+	uint32_t Commits;          // syncs
+	uint64_t CommitUs;         // time spent syncing
+	uint32_t MaxCommitUs;
+	uint32_t Segments;         // segments created
+	uint32_t Expired;          // segments deleted by the retention
+	uint32_t Errors;
+} rpcJournalStats_t;
+
+// frame returned by a query
+typedef struct
+{
+	uint64_t RxUs;             // receive time, micro seconds since the epoch
+	uint16_t NwkAddr;
+	uint8_t Len;
+	uint8_t Frame[RPC_MAX_LEN]; // from Cmd0 to the FCS
+} rpcJournalEntry_t;
+
+// newest record of a node in a segment, Last 0 for a free slot
+typedef struct
+{
+	uint16_t NwkAddr;
+	uint32_t Last;
+} rpcJournalNode_t;
+
+typedef struct
+{
+	uint32_t Seq;
+	int Fd;
+	uint8_t *Map;
+	uint32_t Size;             // bytes of the file
+	uint32_t Len;              // end of the records
+	uint32_t Synced;           // end of the records synced
+	uint64_t FirstUs;
+	uint64_t LastUs;
+	rpcJournalNode_t *Nodes;   // open addressing, a power of 2 slots
+	uint32_t NodeSlots;
+	uint32_t NodeCount;
+} rpcJournalSeg_t;
+
+typedef struct
+{
+	rpcJournalCfg_t Cfg;
+
+	// staging, filled by the RPC thread, emptied by the journal thread
+	pthread_mutex_t StageLock;
+	pthread_cond_t StageCond;
+	uint8_t *Stage[2];
+	uint32_t StageLen[2];
+	uint32_t StageFill;        // buffer being filled
+	uint64_t StageFirstUs;     // monotonic time of its first frame
+	uint8_t Running;
+
+	// segments, oldest first, written by the journal thread only
+	pthread_rwlock_t SegLock;
+	rpcJournalSeg_t *Segs;
+	uint32_t SegCount;
+	uint32_t NextSeq;
+	uint32_t FirstSeq;         // first segment written since opened
+
+	pthread_t Thread;
+	rpcJournalStats_t Stats;
+} rpcJournal_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t rpcJournalOpen(rpcJournal_t *ctx, rpcJournalCfg_t *cfg);
+void rpcJournalClose(rpcJournal_t *ctx);
+int32_t rpcJournalAppend(rpcJournal_t *ctx, const uint8_t *rpcFrame,
+        uint8_t rpcLen);
+int32_t rpcJournalLast(rpcJournal_t *ctx, uint16_t nwkAddr,
+        rpcJournalEntry_t *entries, uint32_t max);
+void rpcJournalPrintStats(rpcJournal_t *ctx, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPCJOURNAL_H */
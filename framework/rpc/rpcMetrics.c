@@ -0,0 +1,661 @@
+/*
+ * rpcMetrics.c
+ *
+ * This module contains the metrics registry for the RPC / MT path of the
+ * ZigBee Network Processor (ZNP) Host Interface.
+ *
+ * Counters and histograms are kept in per-thread shards that only the
+ * owning thread writes, so the hot path never takes a lock or a bus
+ * locked instruction. Readers sum all shards.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "rpcMetrics.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+#define METRIC_LOAD(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#define METRIC_STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct rpcMetricsShard
+{
+	uint64_t counters[RPC_METRIC_COUNTER_MAX];
+	rpcMetricHistSnapshot_t hists[RPC_METRIC_HIST_MAX];
+	struct rpcMetricsShard *next;
+} rpcMetricsShard_t;
+
+typedef struct
+{
+	const char *name;
+	const char *help;
+} rpcMetricDesc_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+// shard of the calling thread, allocated on first use
+static __thread rpcMetricsShard_t *localShard;
+
+// list of all shards, only ever prepended to
+static rpcMetricsShard_t *shardList;
+static pthread_mutex_t shardLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t gauges[RPC_METRIC_GAUGE_MAX];
+
+// exporter thread state
+static pthread_t exportThread;
+static volatile int exportRunning;
+static char exportTarget[108];
+static uint32_t exportPeriodMs;
+
+static const rpcMetricDesc_t counterDesc[RPC_METRIC_MT_FRAMES] =
+{
+	{ "znp_rpc_frames_in_total", "Valid frames received from the ZNP" },
+	{ "znp_rpc_frames_out_total", "Frames written to the ZNP" },
+	{ "znp_rpc_bytes_in_total", "Bytes of valid frames received" },
+	{ "znp_rpc_bytes_out_total", "Bytes written to the ZNP" },
+	{ "znp_rpc_fcs_errors_total", "Frames dropped due to a bad FCS" },
+	{ "znp_rpc_sof_resyncs_total", "Bytes discarded while hunting for SOF" },
+	{ "znp_rpc_sreq_total", "SREQ frames sent" },
+	{ "znp_rpc_srsp_timeouts_total", "SREQs that did not get an SRSP" },
+	{ "znp_rpc_srsp_unexpected_total", "SRSPs nobody was waiting for" },
+	{ "znp_rpc_areq_in_total", "AREQ frames received" },
+	{ "znp_rpc_areq_filtered_total", "AREQs dropped by the AREQ filter" },
+	{ "znp_rpc_llq_enqueued_total", "Frames added to the RPC queue" },
+	{ "znp_rpc_llq_dequeued_total", "Frames taken from the RPC queue" },
+	{ "znp_mt_unhandled_total", "Frames no MT dispatcher handled" },
+};
+
+static const rpcMetricDesc_t gaugeDesc[RPC_METRIC_GAUGE_MAX] =
+{
+	{ "znp_rpc_llq_depth", "Frames currently in the RPC queue" },
+	{ "znp_rpc_llq_depth_max", "High water mark of the RPC queue" },
+};
+
+static const rpcMetricDesc_t histDesc[RPC_METRIC_HIST_MAX] =
+{
+	{ "znp_rpc_srsp_latency_seconds", "SREQ written until SRSP received" },
+	{ "znp_mt_callback_duration_seconds",
+	        "MT dispatch including the application callback" },
+};
+
+static const char *subsysName[MT_RPC_SYS_MAX] =
+{ "res0", "sys", "mac", "nwk", "af", "zdo", "sapi", "util", "dbg", "app",
+        "ota", "znp", "spare12", "sbl" };
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      getShard
+ *
+ * @brief   returns the shard of the calling thread, registering a new
+ *          one on the first call from a thread
+ *
+ * @param   -
+ *
+ * @return  shard, NULL if out of memory
+ */
+static rpcMetricsShard_t *getShard(void)
+{
+	rpcMetricsShard_t *shard = localShard;
+
+	if (shard == NULL)
+	{
+		shard = calloc(1, sizeof(rpcMetricsShard_t));
+		if (shard == NULL)
+		{
+			return NULL;
+		}
+
+		pthread_mutex_lock(&shardLock);
+		shard->next = shardList;
+		__atomic_store_n(&shardList, shard, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&shardLock);
+
+		localShard = shard;
+	}
+
+	return shard;
+}
+
+/*********************************************************************
+ * @fn      histBucket
+ *
+ * @brief   maps a sample to its log2 bucket, bucket b taking the
+ *          samples below 2^b us
+ *
+ * @param   us - sample in micro seconds
+ *
+ * @return  bucket index
+ */
+static uint32_t histBucket(uint64_t us)
+{
+	uint32_t idx = 0;
+
+	while ((us > 0) && (idx < (RPC_METRIC_HIST_BUCKETS - 1)))
+	{
+		us >>= 1;
+		idx++;
+	}
+
+	return idx;
+}
+
+/*********************************************************************
+ * @fn      appendf
+ *
+ * @brief   snprintf into buf at *pos, keeping track of the position
+ *
+ * @return  -
+ */
+static void appendf(char *buf, size_t len, size_t *pos, const char *fmt, ...)
+        __attribute__((format(printf, 4, 5)));
+
+static void appendf(char *buf, size_t len, size_t *pos, const char *fmt, ...)
+{
+	va_list argp;
+	int n;
+
+	if (*pos >= len)
+	{
+		return;
+	}
+
+	va_start(argp, fmt);
+	n = vsnprintf(buf + *pos, len - *pos, fmt, argp);
+	va_end(argp);
+
+	if (n > 0)
+	{
+		*pos += n;
+	}
+}
+
+/*********************************************************************
+ * @fn      exportFile
+ *
+ * @brief   writes the metrics to a temp file and renames it over the
+ *          target so scrapers never see a partial file
+ *
+ * @return  -
+ */
+static void exportFile(const char *path, char *buf, size_t len)
+{
+	char tmpPath[sizeof(exportTarget) + 4];
+	int32_t textLen;
+	FILE *fp;
+
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+	textLen = rpcMetricsFormat(buf, len);
+
+	fp = fopen(tmpPath, "w");
+	if (fp == NULL)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "rpcMetrics: %s open failed - %s\n",
+		        tmpPath, strerror(errno));
+		return;
+	}
+
+	fwrite(buf, 1, textLen, fp);
+	fclose(fp);
+
+	if (rename(tmpPath, path) != 0)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "rpcMetrics: rename to %s failed\n",
+		        path);
+	}
+}
+
+/*********************************************************************
+ * @fn      exportTask
+ *
+ * @brief   exporter thread, either rewrites a file every period or
+ *          serves the metrics text to every client connecting to a
+ *          Unix domain socket
+ *
+ * @return  -
+ */
+static void *exportTask(void *argument)
+{
+	size_t bufLen = 16384;
+	char *buf = malloc(bufLen);
+	int listenFd = -1;
+	const char *sockPath = NULL;
+
+	(void) argument;
+
+	if (buf == NULL)
+	{
+		return NULL;
+	}
+
+	if (strncmp(exportTarget, RPC_METRICS_UNIX_PREFIX,
+	        strlen(RPC_METRICS_UNIX_PREFIX)) == 0)
+	{
+		struct sockaddr_un addr;
+		size_t len;
+
+		sockPath = exportTarget + strlen(RPC_METRICS_UNIX_PREFIX);
+		len = strlen(sockPath);
+		if (len >= sizeof(addr.sun_path))
+		{
+			dbg_print(PRINT_LEVEL_ERROR, "rpcMetrics: %s is too long for a"
+			        " socket path\n", sockPath);
+			free(buf);
+			return NULL;
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, sockPath, len + 1);
+		unlink(sockPath);
+
+		listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ((listenFd < 0)
+		        || (bind(listenFd, (struct sockaddr *) &addr, sizeof(addr))
+		                != 0) || (listen(listenFd, 4) != 0))
+		{
+			dbg_print(PRINT_LEVEL_ERROR, "rpcMetrics: cannot listen on %s\n",
+			        sockPath);
+			if (listenFd >= 0)
+			{
+				close(listenFd);
+			}
+			free(buf);
+			return NULL;
+		}
+	}
+
+	while (exportRunning)
+	{
+		if (listenFd >= 0)
+		{
+			struct pollfd pfd =
+				{ listenFd, POLLIN, 0 };
+
+			// wake up periodically to check for a stop request
+			if (poll(&pfd, 1, 200) > 0)
+			{
+				int clientFd = accept(listenFd, NULL, NULL);
+				if (clientFd >= 0)
+				{
+					int32_t textLen = rpcMetricsFormat(buf, bufLen);
+					if (write(clientFd, buf, textLen) != textLen)
+					{
+						dbg_print(PRINT_LEVEL_INFO,
+						        "rpcMetrics: short write to client\n");
+					}
+					close(clientFd);
+				}
+			}
+		}
+		else
+		{
+			uint32_t slept;
+
+			exportFile(exportTarget, buf, bufLen);
+
+			for (slept = 0; exportRunning && (slept < exportPeriodMs);
+			        slept += 100)
+			{
+				usleep(100000);
+			}
+		}
+	}
+
+	if (listenFd >= 0)
+	{
+		close(listenFd);
+		unlink(sockPath);
+	}
+	free(buf);
+
+	return NULL;
+}
+
+/*********************************************************************
+ * API FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      rpcMetricsNowUs
+ *
+ * @brief   monotonic time stamp used for all latency measurements
+ *
+ * @param   -
+ *
+ * @return  time in micro seconds
+ */
+uint64_t rpcMetricsNowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+/*********************************************************************
+ * @fn      rpcMetricsAdd
+ *
+ * @brief   add to a counter on the calling thread's shard
+ *
+ * @param   id - counter
+ * @param   n - increment
+ *
+ * @return  -
+ */
+void rpcMetricsAdd(rpcMetricCounter_t id, uint64_t n)
+{
+	rpcMetricsShard_t *shard = getShard();
+
+	if ((shard != NULL) && (id < RPC_METRIC_COUNTER_MAX))
+	{
+		// single writer, a relaxed store is enough for the readers
+		METRIC_STORE(&shard->counters[id], shard->counters[id] + n);
+	}
+}
+
+/*********************************************************************
+ * @fn      rpcMetricsGaugeSet
+ *
+ * @brief   set a gauge, the RPC queue depth also maintains its high
+ *          water mark
+ *
+ * @param   id - gauge
+ * @param   value - new value
+ *
+ * @return  -
+ */
+void rpcMetricsGaugeSet(rpcMetricGauge_t id, int64_t value)
+{
+	if (id >= RPC_METRIC_GAUGE_MAX)
+	{
+		return;
+	}
+
+	METRIC_STORE(&gauges[id], value);
+
+	if (id == RPC_METRIC_LLQ_DEPTH)
+	{
+		int64_t max = METRIC_LOAD(&gauges[RPC_METRIC_LLQ_DEPTH_MAX]);
+
+		while ((value > max)
+		        && !__atomic_compare_exchange_n(
+		                &gauges[RPC_METRIC_LLQ_DEPTH_MAX], &max, value, 0,
+		                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+	}
+}
+
+/*********************************************************************
+ * @fn      rpcMetricsObserve
+ *
+ * @brief   record a latency sample on the calling thread's shard
+ *
+ * @param   id - histogram
+ * @param   us - sample in micro seconds
+ *
+ * @return  -
+ */
+void rpcMetricsObserve(rpcMetricHist_t id, uint64_t us)
+{
+	rpcMetricsShard_t *shard = getShard();
+	rpcMetricHistSnapshot_t *hist;
+	uint32_t bucket;
+
+	if ((shard == NULL) || (id >= RPC_METRIC_HIST_MAX))
+	{
+		return;
+	}
+
+	hist = &shard->hists[id];
+	bucket = histBucket(us);
+
+	METRIC_STORE(&hist->buckets[bucket], hist->buckets[bucket] + 1);
+	METRIC_STORE(&hist->sumUs, hist->sumUs + us);
+	METRIC_STORE(&hist->count, hist->count + 1);
+}
+
+/*********************************************************************
+ * @fn      rpcMetricsGetCounter
+ *
+ * @brief   sum of a counter over all threads
+ *
+ * @param   id - counter
+ *
+ * @return  value
+ */
+uint64_t rpcMetricsGetCounter(rpcMetricCounter_t id)
+{
+	rpcMetricsShard_t *shard;
+	uint64_t sum = 0;
+
+	if (id >= RPC_METRIC_COUNTER_MAX)
+	{
+		return 0;
+	}
+
+	for (shard = __atomic_load_n(&shardList, __ATOMIC_ACQUIRE); shard != NULL;
+	        shard = shard->next)
+	{
+		sum += METRIC_LOAD(&shard->counters[id]);
+	}
+
+	return sum;
+}
+
+/*********************************************************************
+ * @fn      rpcMetricsGetGauge
+ *
+ * @brief   current value of a gauge
+ *
+ * @param   id - gauge
+ *
+ * @return  value
+ */
+int64_t rpcMetricsGetGauge(rpcMetricGauge_t id)
+{
+	if (id >= RPC_METRIC_GAUGE_MAX)
+	{
+		return 0;
+	}
+
+	return METRIC_LOAD(&gauges[id]);
+}
+
+/*********************************************************************
+ * @fn      rpcMetricsSnapshot
+ *
+ * @brief   aggregate all counters, gauges and histograms
+ *
+ * @param   snap - filled in with the aggregated values
+ *
+ * @return  -
+ */
+void rpcMetricsSnapshot(rpcMetricsSnapshot_t *snap)
+{
+	rpcMetricsShard_t *shard;
+	uint32_t i, h, b;
+
+	memset(snap, 0, sizeof(rpcMetricsSnapshot_t));
+
+	for (shard = __atomic_load_n(&shardList, __ATOMIC_ACQUIRE); shard != NULL;
+	        shard = shard->next)
+	{
+		for (i = 0; i < RPC_METRIC_COUNTER_MAX; i++)
+		{
+			snap->counters[i] += METRIC_LOAD(&shard->counters[i]);
+		}
+
+		for (h = 0; h < RPC_METRIC_HIST_MAX; h++)
+		{
+			snap->hists[h].count += METRIC_LOAD(&shard->hists[h].count);
+			snap->hists[h].sumUs += METRIC_LOAD(&shard->hists[h].sumUs);
+			for (b = 0; b < RPC_METRIC_HIST_BUCKETS; b++)
+			{
+				snap->hists[h].buckets[b] += METRIC_LOAD(
+				        &shard->hists[h].buckets[b]);
+			}
+		}
+	}
+
+	for (i = 0; i < RPC_METRIC_GAUGE_MAX; i++)
+	{
+		snap->gauges[i] = METRIC_LOAD(&gauges[i]);
+	}
+}
+
+/*********************************************************************
+ * @fn      rpcMetricsFormat
+ *
+ * @brief   render all metrics in the Prometheus text exposition format
+ *
+ * @param   buf - output buffer
+ * @param   len - size of buf
+ *
+ * @return  number of bytes written (excluding the terminating NUL)
+ */
+int32_t rpcMetricsFormat(char *buf, size_t len)
+{
+	rpcMetricsSnapshot_t snap;
+	size_t pos = 0;
+	uint32_t i, b;
+
+	if (len == 0)
+	{
+		return 0;
+	}
+	buf[0] = '\0';
+
+	rpcMetricsSnapshot(&snap);
+
+	for (i = 0; i < RPC_METRIC_MT_FRAMES; i++)
+	{
+		appendf(buf, len, &pos, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+		        counterDesc[i].name, counterDesc[i].help, counterDesc[i].name,
+		        counterDesc[i].name, (unsigned long long) snap.counters[i]);
+	}
+
+	appendf(buf, len, &pos, "# HELP znp_mt_frames_total "
+			"Frames dispatched per MT subsystem\n"
+			"# TYPE znp_mt_frames_total counter\n");
+	for (i = 0; i < MT_RPC_SYS_MAX; i++)
+	{
+		appendf(buf, len, &pos, "znp_mt_frames_total{subsystem=\"%s\"} %llu\n",
+		        subsysName[i],
+		        (unsigned long long) snap.counters[RPC_METRIC_MT_SYS(i)]);
+	}
+
+	for (i = 0; i < RPC_METRIC_GAUGE_MAX; i++)
+	{
+		appendf(buf, len, &pos, "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n",
+		        gaugeDesc[i].name, gaugeDesc[i].help, gaugeDesc[i].name,
+		        gaugeDesc[i].name, (long long) snap.gauges[i]);
+	}
+
+	for (i = 0; i < RPC_METRIC_HIST_MAX; i++)
+	{
+		uint64_t cumulative = 0;
+
+		appendf(buf, len, &pos, "# HELP %s %s\n# TYPE %s histogram\n",
+		        histDesc[i].name, histDesc[i].help, histDesc[i].name);
+		// le is inclusive: bucket b ends at 2^b - 1 us
+		for (b = 0; b < (RPC_METRIC_HIST_BUCKETS - 1); b++)
+		{
+			cumulative += snap.hists[i].buckets[b];
+			appendf(buf, len, &pos, "%s_bucket{le=\"%.6f\"} %llu\n",
+			        histDesc[i].name, (double) ((1ULL << b) - 1) / 1e6,
+			        (unsigned long long) cumulative);
+		}
+		appendf(buf, len, &pos, "%s_bucket{le=\"+Inf\"} %llu\n",
+		        histDesc[i].name, (unsigned long long) snap.hists[i].count);
+		appendf(buf, len, &pos, "%s_sum %.6f\n%s_count %llu\n",
+		        histDesc[i].name, (double) snap.hists[i].sumUs / 1e6,
+		        histDesc[i].name, (unsigned long long) snap.hists[i].count);
+	}
+
+	if (pos >= len)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "rpcMetricsFormat: output truncated\n");
+		pos = len - 1;
+	}
+
+	return (int32_t) pos;
+}
+
+/*********************************************************************
+ * @fn      rpcMetricsExportStart
+ *
+ * @brief   start exporting the metrics periodically
+ *
+ * @param   target - file path, or "unix:<path>" to serve the metrics on
+ *                   a Unix domain socket
+ * @param   periodMs - file rewrite period, ignored for sockets
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t rpcMetricsExportStart(const char *target, uint32_t periodMs)
+{
+	if ((target == NULL) || exportRunning
+	        || (strlen(target) >= sizeof(exportTarget)))
+	{
+		return -1;
+	}
+
+	strcpy(exportTarget, target);
+	exportPeriodMs = (periodMs > 0) ? periodMs : RPC_METRICS_EXPORT_PERIOD_MS;
+	exportRunning = 1;
+
+	if (pthread_create(&exportThread, NULL, exportTask, NULL) != 0)
+	{
+		exportRunning = 0;
+		dbg_print(PRINT_LEVEL_ERROR, "rpcMetricsExportStart: no thread\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcMetricsExportStop
+ *
+ * @brief   stop the exporter thread
+ *
+ * @param   -
+ *
+ * @return  -
+ */
+void rpcMetricsExportStop(void)
+{
+	if (exportRunning)
+	{
+		exportRunning = 0;
+		pthread_join(exportThread, NULL);
+	}
+}
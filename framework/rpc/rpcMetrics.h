@@ -0,0 +1,142 @@
+/*
+ * rpcMetrics.h
+ *
+ * This module contains the metrics registry for the RPC / MT path of the
+ * ZigBee Network Processor (ZNP) Host Interface.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef RPCMETRICS_H
+#define RPCMETRICS_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rpc.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// number of log2 histogram buckets, bucket i counts samples < 2^i us
+// (the last bucket counts everything up to ~8s and above)
+#define RPC_METRIC_HIST_BUCKETS    (24)
+
+// default period of the metrics exporter
+#define RPC_METRICS_EXPORT_PERIOD_MS (5000)
+
+// prefix selecting the Unix domain socket exporter
+#define RPC_METRICS_UNIX_PREFIX    "unix:"
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// monotonic counters, updated on per-thread shards
+typedef enum
+{
+	RPC_METRIC_FRAMES_IN,        // valid frames received from the ZNP
+	RPC_METRIC_FRAMES_OUT,       // frames written to the ZNP
+	RPC_METRIC_BYTES_IN,         // bytes of valid frames received
+	RPC_METRIC_BYTES_OUT,        // bytes written to the ZNP
+	RPC_METRIC_FCS_ERRORS,       // frames dropped due to a bad FCS
+	RPC_METRIC_SOF_RESYNCS,      // bytes discarded while hunting for SOF
+	RPC_METRIC_SREQ_SENT,        // SREQ frames sent
+	RPC_METRIC_SRSP_TIMEOUTS,    // SREQ's that did not get an SRSP
+	RPC_METRIC_SRSP_UNEXPECTED,  // SRSP's nobody was waiting for
+	RPC_METRIC_AREQ_IN,          // AREQ frames received
+	RPC_METRIC_AREQ_FILTERED,    // AREQs dropped by the AREQ filter
+	RPC_METRIC_LLQ_ENQUEUED,     // frames added to the RPC queue
+	RPC_METRIC_LLQ_DEQUEUED,     // frames taken from the RPC queue
+	RPC_METRIC_MT_UNHANDLED,     // frames no MT dispatcher handled
+	RPC_METRIC_MT_FRAMES,        // first of the per subsystem dispatch
+	                             // counters, see RPC_METRIC_MT_SYS()
+	RPC_METRIC_COUNTER_MAX = RPC_METRIC_MT_FRAMES + MT_RPC_SYS_MAX
+} rpcMetricCounter_t;
+
+// gauges, shared by all threads
+typedef enum
+{
+	RPC_METRIC_LLQ_DEPTH,        // frames currently in the RPC queue
+	RPC_METRIC_LLQ_DEPTH_MAX,    // high water mark of the RPC queue
+	RPC_METRIC_GAUGE_MAX
+} rpcMetricGauge_t;
+
+// latency histograms in micro seconds
+typedef enum
+{
+	RPC_METRIC_SRSP_LATENCY,     // SREQ written until SRSP received
+	RPC_METRIC_CB_DURATION,      // MT dispatch including app callback
+	RPC_METRIC_HIST_MAX
+} rpcMetricHist_t;
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t sumUs;
+	uint64_t buckets[RPC_METRIC_HIST_BUCKETS];
+} rpcMetricHistSnapshot_t;
+
+typedef struct
+{
+	uint64_t counters[RPC_METRIC_COUNTER_MAX];
+	int64_t gauges[RPC_METRIC_GAUGE_MAX];
+	rpcMetricHistSnapshot_t hists[RPC_METRIC_HIST_MAX];
+} rpcMetricsSnapshot_t;
+
+/*********************************************************************
+ * MACROS
+ */
+
+// per subsystem MT dispatch counter, subsys is the Cmd0 subsystem
+#define RPC_METRIC_MT_SYS(subsys)  (RPC_METRIC_MT_FRAMES + \
+                   ((subsys) < MT_RPC_SYS_MAX ? (subsys) : MT_RPC_SYS_RES0))
+
+// instrumentation hooks, compiled out unless RPC_METRICS is defined
+#ifdef RPC_METRICS
+#define RPC_METRIC_INC(id)          rpcMetricsAdd((id), 1)
+#define RPC_METRIC_ADD(id, n)       rpcMetricsAdd((id), (n))
+#define RPC_METRIC_GAUGE_SET(id, v) rpcMetricsGaugeSet((id), (v))
+#define RPC_METRIC_OBSERVE(id, us)  rpcMetricsObserve((id), (us))
+#define RPC_METRIC_TIME(var)        uint64_t var = rpcMetricsNowUs()
+#else
+#define RPC_METRIC_INC(id)
+#define RPC_METRIC_ADD(id, n)
+#define RPC_METRIC_GAUGE_SET(id, v)
+#define RPC_METRIC_OBSERVE(id, us)
+#define RPC_METRIC_TIME(var)
+#endif
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+uint64_t rpcMetricsNowUs(void);
+void rpcMetricsAdd(rpcMetricCounter_t id, uint64_t n);
+void rpcMetricsGaugeSet(rpcMetricGauge_t id, int64_t value);
+void rpcMetricsObserve(rpcMetricHist_t id, uint64_t us);
+
+uint64_t rpcMetricsGetCounter(rpcMetricCounter_t id);
+int64_t rpcMetricsGetGauge(rpcMetricGauge_t id);
+void rpcMetricsSnapshot(rpcMetricsSnapshot_t *snap);
+int32_t rpcMetricsFormat(char *buf, size_t len);
+
+int32_t rpcMetricsExportStart(const char *target, uint32_t periodMs);
+void rpcMetricsExportStop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPCMETRICS_H */
@@ -0,0 +1,933 @@
+/*
+ * rpcMux.c
+ *
+ * This module contains the ZNP mux daemon, see rpcMux.h.
+ *
+ * The RPC thread hands the frames of the ZNP to the daemon through
+ * rpcRegisterFrameCallback(), which writes them to the clients right
+ * away, buffering what a client does not read at once. rpcMuxPoll()
+ * reads the clients and sends one frame of each client with a complete
+ * frame in turn, so a client sending much does not hold back the
+ * others. An SREQ is sent with rpcSendFrame(), which waits for the
+ * SRSP, the SREQs are thus sent one at a time and the SRSP received
+ * belongs to the client of the SREQ in progress.
+ *
+ * A client attached to the AREQ ring reads it on a thread of its own,
+ * which queues the frames with rpcQueueFrame() where rpcProcess() would
+ * have queued them, so the MT callbacks of the client are unchanged.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "rpcMux.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define MT_SYS_RESET_REQ_ID        (0x00)
+#define MT_SYS_RESET_IND_ID        (0x80)
+
+// wait of the ring reader thread between two checks of its stop flag
+#define RPC_MUX_SHM_WAIT_MS        (100)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+// daemon the frame callback delivers to, the callback has no context
+static rpcMux_t *activeMux;
+static pthread_mutex_t activeLock = PTHREAD_MUTEX_INITIALIZER;
+
+// client side AREQ ring and its reader thread
+static rpcShm_t shmRing;
+static pthread_t shmThread;
+static volatile uint8_t shmRunning;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      calcFcs
+ *
+ * @brief   XOR of the bytes of a frame from the length byte
+ */
+static uint8_t calcFcs(uint8_t *msg, uint32_t size)
+{
+	uint8_t result = 0;
+
+	while (size--)
+	{
+		result ^= *msg++;
+	}
+
+	return result;
+}
+
+/*********************************************************************
+ * @fn      clientFlush
+ *
+ * @brief   writes the buffered frames of a client, as far as the socket
+ *          takes them, called with the lock held
+ *
+ * @return  none
+ */
+static void clientFlush(rpcMuxClient_t *c)
+{
+	ssize_t sent;
+
+	while (c->TxLen && !c->Dead)
+	{
+		sent = send(c->Fd, c->Tx, c->TxLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+			{
+				c->Dead = 1;
+			}
+			return;
+		}
+		c->TxLen -= sent;
+		memmove(c->Tx, c->Tx + sent, c->TxLen);
+	}
+}
+
+/*********************************************************************
+ * @fn      clientSend
+ *
+ * @brief   queues a frame to a client and writes what the socket takes,
+ *          called with the lock held
+ *
+ * @param   ctx - daemon
+ * @param   c - client
+ * @param   frame - complete frame, from SOF to FCS
+ * @param   len - frame length
+ *
+ * @return  0 on success, -1 if the frame is dropped
+ */
+static int32_t clientSend(rpcMux_t *ctx, rpcMuxClient_t *c, uint8_t *frame,
+        uint32_t len)
+{
+	if (c->Dead)
+	{
+		return -1;
+	}
+	if (c->TxLen + len > RPC_MUX_TX_LEN)
+	{
+		c->Drops++;
+		ctx->Stats.Drops++;
+		return -1;
+	}
+	memcpy(c->Tx + c->TxLen, frame, len);
+	c->TxLen += len;
+	c->FramesOut++;
+	ctx->Stats.FramesOut++;
+	clientFlush(c);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      clientAccept
+ *
+ * @brief   takes a new connection
+ */
+static void clientAccept(rpcMux_t *ctx)
+{
+	rpcMuxClient_t *c;
+	int fd;
+	uint32_t i;
+
+	fd = accept(ctx->ListenFd, NULL, NULL);
+	if (fd < 0)
+	{
+		return;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	c = calloc(1, sizeof(rpcMuxClient_t));
+	if (c != NULL)
+	{
+		c->Tx = malloc(RPC_MUX_TX_LEN);
+	}
+	if ((c == NULL) || (c->Tx == NULL)
+	        || (ctx->ClientCount == RPC_MUX_MAX_CLIENTS))
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "rpcMux: connection refused\n");
+		ctx->Stats.Rejected++;
+		if (c != NULL)
+		{
+			free(c->Tx);
+		}
+		free(c);
+		close(fd);
+		return;
+	}
+	c->Fd = fd;
+	c->Id = ++ctx->NextId;
+	c->SysMask = RPC_MUX_SUBSCRIBE_ALL;
+
+	pthread_mutex_lock(&ctx->Lock);
+	for (i = 0; ctx->Clients[i] != NULL; i++)
+	{
+	}
+	ctx->Clients[i] = c;
+	ctx->ClientCount++;
+	ctx->Stats.Accepted++;
+	if (ctx->ClientCount > ctx->Stats.PeakClients)
+	{
+		ctx->Stats.PeakClients = ctx->ClientCount;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	dbg_print(PRINT_LEVEL_INFO, "rpcMux: client %u connected\n", c->Id);
+}
+
+/*********************************************************************
+ * @fn      clientClose
+ *
+ * @brief   drops a client, an SRSP it waits for goes nowhere
+ */
+static void clientClose(rpcMux_t *ctx, uint32_t idx)
+{
+	rpcMuxClient_t *c = ctx->Clients[idx];
+
+	pthread_mutex_lock(&ctx->Lock);
+	ctx->Clients[idx] = NULL;
+	ctx->ClientCount--;
+	ctx->Stats.Closed++;
+	if (ctx->SrspOwner == c)
+	{
+		ctx->SrspOwner = NULL;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	dbg_print(PRINT_LEVEL_INFO, "rpcMux: client %u closed\n", c->Id);
+	close(c->Fd);
+	free(c->Tx);
+	free(c);
+}
+
+/*********************************************************************
+ * @fn      clientRead
+ *
+ * @brief   reads what fits of the frames a client sent
+ *
+ * @return  0 on success, -1 once the client closed the connection
+ */
+static int32_t clientRead(rpcMuxClient_t *c)
+{
+	ssize_t got;
+
+	if (c->RxLen == RPC_MUX_RX_LEN)
+	{
+		return 0;
+	}
+	got = read(c->Fd, c->Rx + c->RxLen, RPC_MUX_RX_LEN - c->RxLen);
+	if (got == 0)
+	{
+		return -1;
+	}
+	if (got < 0)
+	{
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK)
+		        || (errno == EINTR)) ? 0 : -1;
+	}
+	c->RxLen += got;
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      clientFrame
+ *
+ * @brief   finds the next complete frame a client sent, skipping bytes
+ *          out of frame (like the force run byte) and bad frames
+ *
+ * @return  frame length from SOF to FCS, 0 if none is complete
+ */
+static uint32_t clientFrame(rpcMuxClient_t *c)
+{
+	uint32_t skip, len;
+
+	while (c->RxLen)
+	{
+		for (skip = 0; (skip < c->RxLen) && (c->Rx[skip] != MT_RPC_SOF);
+		        skip++)
+		{
+		}
+		if (skip)
+		{
+			c->Errors++;
+			c->RxLen -= skip;
+			memmove(c->Rx, c->Rx + skip, c->RxLen);
+			continue;
+		}
+		if (c->RxLen < RPC_UART_HDR_LEN)
+		{
+			return 0;
+		}
+		len = c->Rx[1] + RPC_UART_HDR_LEN + RPC_UART_FCS_LEN;
+		if (c->RxLen < len)
+		{
+			return 0;
+		}
+		if (calcFcs(&c->Rx[1], len - 2) == c->Rx[len - 1])
+		{
+			return len;
+		}
+
+		// resynchronise after the SOF of the bad frame
+		c->Errors++;
+		c->RxLen--;
+		memmove(c->Rx, c->Rx + 1, c->RxLen);
+	}
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      clientFilter
+ *
+ * @brief   replaces the AREQ filter of a client by the rules of an
+ *          RPC_MUX_FILTER payload
+ */
+static void clientFilter(rpcMuxClient_t *c, uint8_t *payload,
+        uint8_t payloadLen)
+{
+	rpcFilterRule_t rules[RPC_FILTER_MAX_RULES];
+	rpcFilter_t filter;
+	uint8_t *p = &payload[1];
+	uint32_t count = payload[0], i;
+
+	if ((payloadLen < 1) || (count > RPC_FILTER_MAX_RULES)
+	        || (payloadLen < 1 + (count * RPC_MUX_FILTER_RULE_LEN)))
+	{
+		c->Errors++;
+		return;
+	}
+	for (i = 0; i < count; i++, p += RPC_MUX_FILTER_RULE_LEN)
+	{
+		rules[i].Sys = p[0];
+		rules[i].Cmd1 = p[1];
+		rules[i].Match = p[2];
+		rules[i].ClusterId = p[3] | (p[4] << 8);
+		rules[i].SrcAddr = p[5] | (p[6] << 8);
+		rules[i].GroupId = p[7] | (p[8] << 8);
+		rules[i].SrcEndpoint = p[9];
+		rules[i].DstEndpoint = p[10];
+	}
+	if (rpcFilterCompile(&filter, rules, count) != 0)
+	{
+		c->Errors++;
+		return;
+	}
+	c->Filter = filter;
+}
+
+/*********************************************************************
+ * @fn      clientForward
+ *
+ * @brief   sends the first frame of a client to the ZNP, or handles it
+ *          in the daemon, and removes it from the client buffer
+ */
+static void clientForward(rpcMux_t *ctx, rpcMuxClient_t *c, uint32_t len)
+{
+	uint8_t frame[RPC_MAX_LEN + RPC_UART_HDR_LEN + RPC_UART_FCS_LEN];
+	uint8_t cmd0, cmd1, payloadLen;
+	uint8_t status;
+
+	memcpy(frame, c->Rx, len);
+	c->RxLen -= len;
+	memmove(c->Rx, c->Rx + len, c->RxLen);
+
+	payloadLen = frame[1];
+	cmd0 = frame[2];
+	cmd1 = frame[3];
+	c->FramesIn++;
+
+	if ((cmd0 & MT_RPC_SUBSYSTEM_MASK) == RPC_MUX_SYS)
+	{
+		if ((cmd1 == RPC_MUX_SUBSCRIBE) && (payloadLen >= 4))
+		{
+			c->SysMask = frame[4] | (frame[5] << 8) | (frame[6] << 16)
+			        | ((uint32_t) frame[7] << 24);
+		}
+		else if (cmd1 == RPC_MUX_FILTER)
+		{
+			pthread_mutex_lock(&ctx->Lock);
+			clientFilter(c, &frame[4], payloadLen);
+			pthread_mutex_unlock(&ctx->Lock);
+		}
+		return;
+	}
+
+	if ((cmd0 == (MT_RPC_CMD_AREQ | MT_RPC_SYS_SYS))
+	        && (cmd1 == MT_SYS_RESET_REQ_ID))
+	{
+		pthread_mutex_lock(&ctx->Lock);
+		if (ctx->ResetIndLen)
+		{
+			// the ZNP is up, the client gets the indication of its reset
+			ctx->Stats.Resets++;
+			clientSend(ctx, c, ctx->ResetInd, ctx->ResetIndLen);
+			pthread_mutex_unlock(&ctx->Lock);
+			return;
+		}
+		pthread_mutex_unlock(&ctx->Lock);
+	}
+
+	if ((cmd0 & MT_RPC_CMD_TYPE_MASK) != MT_RPC_CMD_SREQ)
+	{
+		ctx->Stats.Areqs++;
+		rpcSendFrame(cmd0, cmd1, &frame[4], payloadLen);
+		return;
+	}
+
+	pthread_mutex_lock(&ctx->Lock);
+	ctx->SrspOwner = c;
+	ctx->Stats.Sreqs++;
+	pthread_mutex_unlock(&ctx->Lock);
+
+	status = rpcSendFrame(cmd0, cmd1, &frame[4], payloadLen);
+
+	pthread_mutex_lock(&ctx->Lock);
+	if (status != MT_RPC_SUCCESS)
+	{
+		// the client times out waiting on its own
+		ctx->Stats.SrspTimeouts++;
+	}
+	ctx->SrspOwner = NULL;
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      shmReader
+ *
+ * @brief   client side thread queuing the AREQs of the ring
+ */
+static void *shmReader(void *arg)
+{
+	uint8_t frame[RPC_SHM_MAX_FRAME];
+	int32_t len;
+
+	(void) arg;
+	while (shmRunning)
+	{
+		len = rpcShmRead(&shmRing, frame, RPC_MUX_SHM_WAIT_MS);
+		if (len > 0)
+		{
+			rpcQueueFrame(frame, len);
+		}
+	}
+
+	return NULL;
+}
+
+/*********************************************************************
+ * CALLBACKS
+ */
+
+/*********************************************************************
+ * @fn      muxFrameCb
+ *
+ * @brief   frame of the ZNP, on the RPC thread: the SRSP goes to the
+ *          client of the SREQ, an AREQ to the subscribed clients
+ */
+static void muxFrameCb(uint8_t *rpcFrame, uint8_t rpcLen)
+{
+	uint8_t frame[RPC_MAX_LEN + RPC_UART_HDR_LEN];
+	uint32_t len = rpcLen + RPC_UART_SOF_LEN + RPC_LEN_FIELD_LEN;
+	uint8_t sys = rpcFrame[0] & MT_RPC_SUBSYSTEM_MASK;
+	rpcMuxClient_t *c;
+	rpcMux_t *ctx;
+	uint32_t i;
+
+	frame[0] = MT_RPC_SOF;
+	frame[1] = rpcLen - RPC_CMD0_FIELD_LEN - RPC_CMD1_FIELD_LEN
+	        - RPC_UART_FCS_LEN;
+	memcpy(&frame[2], rpcFrame, rpcLen);
+
+	pthread_mutex_lock(&activeLock);
+	ctx = activeMux;
+	if (ctx == NULL)
+	{
+		pthread_mutex_unlock(&activeLock);
+		return;
+	}
+
+	pthread_mutex_lock(&ctx->Lock);
+	ctx->Stats.FramesIn++;
+	if ((rpcFrame[0] & MT_RPC_CMD_TYPE_MASK) == MT_RPC_CMD_SRSP)
+	{
+		if (ctx->SrspOwner != NULL)
+		{
+			clientSend(ctx, ctx->SrspOwner, frame, len);
+		}
+		else
+		{
+			ctx->Stats.SrspOrphans++;
+		}
+	}
+	else
+	{
+		if ((rpcFrame[0] == (MT_RPC_CMD_AREQ | MT_RPC_SYS_SYS))
+		        && (rpcFrame[1] == MT_SYS_RESET_IND_ID))
+		{
+			memcpy(ctx->ResetInd, frame, len);
+			ctx->ResetIndLen = len;
+			pthread_cond_broadcast(&ctx->ResetCond);
+		}
+		if (ctx->Shm.Hdr != NULL)
+		{
+			rpcShmWrite(&ctx->Shm, rpcFrame, rpcLen);
+			ctx->ShmFrames++;
+		}
+		for (i = 0; i < RPC_MUX_MAX_CLIENTS; i++)
+		{
+			c = ctx->Clients[i];
+			if ((c == NULL) || !(c->SysMask & RPC_MUX_SYS_BIT(sys)))
+			{
+				continue;
+			}
+			if (!rpcFilterMatch(&c->Filter, rpcFrame, rpcLen))
+			{
+				c->Filtered++;
+				ctx->Stats.Filtered++;
+				continue;
+			}
+			clientSend(ctx, c, frame, len);
+		}
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+	pthread_mutex_unlock(&activeLock);
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      rpcMuxInit
+ *
+ * @brief   listens on the socket and takes the frames of the ZNP, the
+ *          RPC thread must run
+ *
+ * @param   ctx - daemon
+ * @param   path - socket path, RPC_MUX_DEFAULT_PATH if NULL
+ *
+ * @return  0 on success, -1 on failure
+ */
+int32_t rpcMuxInit(rpcMux_t *ctx, const char *path)
+{
+	struct sockaddr_un addr;
+	size_t len;
+
+	memset(ctx, 0, sizeof(rpcMux_t));
+	if (path == NULL)
+	{
+		path = RPC_MUX_DEFAULT_PATH;
+	}
+	len = strlen(path);
+	if ((len >= sizeof(ctx->Path)) || (len >= sizeof(addr.sun_path)))
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "rpcMux: %s is too long for a socket"
+		        " path\n", path);
+		return -1;
+	}
+	memcpy(ctx->Path, path, len + 1);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, ctx->Path, len + 1);
+	unlink(ctx->Path);
+
+	ctx->ListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((ctx->ListenFd < 0)
+	        || (bind(ctx->ListenFd, (struct sockaddr *) &addr, sizeof(addr))
+	                != 0) || (listen(ctx->ListenFd, 16) != 0))
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "rpcMux: cannot listen on %s\n",
+		        ctx->Path);
+		if (ctx->ListenFd >= 0)
+		{
+			close(ctx->ListenFd);
+		}
+		return -1;
+	}
+	pthread_mutex_init(&ctx->Lock, NULL);
+	pthread_cond_init(&ctx->ResetCond, NULL);
+
+	pthread_mutex_lock(&activeLock);
+	activeMux = ctx;
+	pthread_mutex_unlock(&activeLock);
+	rpcRegisterFrameCallback(muxFrameCb);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcMuxClose
+ *
+ * @brief   closes the clients and the socket, the frames of the ZNP go
+ *          back to the RPC queue
+ */
+void rpcMuxClose(rpcMux_t *ctx)
+{
+	uint32_t i;
+
+	rpcRegisterFrameCallback(NULL);
+	pthread_mutex_lock(&activeLock);
+	activeMux = NULL;
+	pthread_mutex_unlock(&activeLock);
+
+	for (i = 0; i < RPC_MUX_MAX_CLIENTS; i++)
+	{
+		if (ctx->Clients[i] != NULL)
+		{
+			clientClose(ctx, i);
+		}
+	}
+	close(ctx->ListenFd);
+	unlink(ctx->Path);
+	rpcShmClose(&ctx->Shm);
+	pthread_cond_destroy(&ctx->ResetCond);
+	pthread_mutex_destroy(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      rpcMuxResetZnp
+ *
+ * @brief   resets the ZNP and keeps its SYS_RESET_IND for the clients
+ *
+ * @param   ctx - daemon
+ * @param   timeoutMs - time to wait for the indication
+ *
+ * @return  0 on success, -1 if the ZNP did not indicate the reset
+ */
+int32_t rpcMuxResetZnp(rpcMux_t *ctx, uint32_t timeoutMs)
+{
+	uint8_t type = 1;
+	struct timespec to;
+	int32_t status = 0;
+
+	clock_gettime(CLOCK_REALTIME, &to);
+	to.tv_sec += timeoutMs / 1000;
+	to.tv_nsec += (long) (timeoutMs % 1000) * 1000000L;
+	if (to.tv_nsec >= 1000000000L)
+	{
+		to.tv_sec++;
+		to.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&ctx->Lock);
+	ctx->ResetIndLen = 0;
+	pthread_mutex_unlock(&ctx->Lock);
+
+	rpcSendFrame(MT_RPC_CMD_AREQ | MT_RPC_SYS_SYS, MT_SYS_RESET_REQ_ID, &type,
+	        1);
+
+	pthread_mutex_lock(&ctx->Lock);
+	while ((ctx->ResetIndLen == 0) && (status == 0))
+	{
+		if (pthread_cond_timedwait(&ctx->ResetCond, &ctx->Lock, &to) != 0)
+		{
+			status = -1;
+		}
+	}
+	if (ctx->ResetIndLen)
+	{
+		status = 0;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return status;
+}
+
+/*********************************************************************
+ * @fn      rpcMuxPoll
+ *
+ * @brief   takes new clients, reads the clients and sends one frame of
+ *          each client with a complete frame to the ZNP
+ *
+ * @param   ctx - daemon
+ * @param   timeoutMs - time to wait for a client when none has a frame
+ *
+ * @return  frames sent to the ZNP
+ */
+int32_t rpcMuxPoll(rpcMux_t *ctx, uint32_t timeoutMs)
+{
+	struct pollfd pfd[RPC_MUX_MAX_CLIENTS + 1];
+	uint32_t idx[RPC_MUX_MAX_CLIENTS + 1];
+	uint32_t i, n = 0, len;
+	int32_t sent = 0;
+	uint8_t pending = 0;
+	rpcMuxClient_t *c;
+
+	pfd[n].fd = ctx->ListenFd;
+	pfd[n].events = POLLIN;
+	n++;
+	pthread_mutex_lock(&ctx->Lock);
+	for (i = 0; i < RPC_MUX_MAX_CLIENTS; i++)
+	{
+		c = ctx->Clients[i];
+		if (c == NULL)
+		{
+			continue;
+		}
+		pending |= (clientFrame(c) != 0);
+		pfd[n].fd = c->Fd;
+		pfd[n].events = ((c->RxLen < RPC_MUX_RX_LEN) ? POLLIN : 0)
+		        | (c->TxLen ? POLLOUT : 0);
+		idx[n++] = i;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	if (poll(pfd, n, pending ? 0 : (int) timeoutMs) < 0)
+	{
+		return (errno == EINTR) ? 0 : -1;
+	}
+
+	for (i = 1; i < n; i++)
+	{
+		c = ctx->Clients[idx[i]];
+		if (pfd[i].revents & POLLOUT)
+		{
+			pthread_mutex_lock(&ctx->Lock);
+			clientFlush(c);
+			pthread_mutex_unlock(&ctx->Lock);
+		}
+		if ((pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+		        && (clientRead(c) != 0))
+		{
+			c->Dead = 1;
+		}
+		if (c->Dead)
+		{
+			clientClose(ctx, idx[i]);
+		}
+	}
+	if (pfd[0].revents & POLLIN)
+	{
+		clientAccept(ctx);
+	}
+
+	// one frame of each client, starting one client further each round
+	for (i = 0; i < RPC_MUX_MAX_CLIENTS; i++)
+	{
+		uint32_t at = (ctx->RoundRobin + i) % RPC_MUX_MAX_CLIENTS;
+
+		c = ctx->Clients[at];
+		if ((c != NULL) && !c->Dead && ((len = clientFrame(c)) != 0))
+		{
+			clientForward(ctx, c, len);
+			sent++;
+		}
+	}
+	ctx->RoundRobin = (ctx->RoundRobin + 1) % RPC_MUX_MAX_CLIENTS;
+
+	return sent;
+}
+
+/*********************************************************************
+ * @fn      rpcMuxPrintStats
+ *
+ * @brief   prints the counters of the daemon and of each client
+ */
+void rpcMuxPrintStats(rpcMux_t *ctx, FILE *out)
+{
+	rpcMuxStats_t *st = &ctx->Stats;
+	rpcMuxClient_t *c;
+	uint32_t i;
+
+	pthread_mutex_lock(&ctx->Lock);
+	fprintf(out, "clients %u (peak %u, %u accepted, %u refused), "
+	        "ZNP frames in %u, out %u (%u SREQ, %u timeouts, %u AREQ), "
+	        "%u resets answered, %u forwarded, %u dropped, %u filtered, "
+	        "%u orphan SRSP\n", ctx->ClientCount, st->PeakClients,
+	        st->Accepted, st->Rejected, st->FramesIn, st->Sreqs + st->Areqs,
+	        st->Sreqs, st->SrspTimeouts, st->Areqs, st->Resets, st->FramesOut,
+	        st->Drops, st->Filtered, st->SrspOrphans);
+	if (ctx->Shm.Hdr != NULL)
+	{
+		fprintf(out, "  ring %s: %u AREQs, %u readers, %llu bytes behind\n",
+		        ctx->Shm.Name, ctx->ShmFrames, rpcShmReaders(&ctx->Shm),
+		        (unsigned long long) rpcShmLag(&ctx->Shm));
+	}
+	for (i = 0; i < RPC_MUX_MAX_CLIENTS; i++)
+	{
+		c = ctx->Clients[i];
+		if (c == NULL)
+		{
+			continue;
+		}
+		fprintf(out, "  client %u: mask %08X, sent %u, received %u, "
+		        "dropped %u, filtered %u, errors %u, %u bytes buffered\n",
+		        c->Id, c->SysMask, c->FramesIn, c->FramesOut, c->Drops,
+		        c->Filtered, c->Errors, c->TxLen);
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      rpcMuxShmOpen
+ *
+ * @brief   writes the AREQs of the ZNP into a shared memory ring as well
+ *
+ * @param   ctx - daemon
+ * @param   name - shared memory name
+ * @param   size - ring bytes, RPC_SHM_DEFAULT_SIZE if 0
+ *
+ * @return  0 on success, -1 on failure
+ */
+int32_t rpcMuxShmOpen(rpcMux_t *ctx, const char *name, uint32_t size)
+{
+	rpcShm_t ring;
+
+	if (rpcShmCreate(&ring, name, size) != 0)
+	{
+		return -1;
+	}
+	pthread_mutex_lock(&ctx->Lock);
+	rpcShmClose(&ctx->Shm);
+	ctx->Shm = ring;
+	pthread_mutex_unlock(&ctx->Lock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcMuxSubscribe
+ *
+ * @brief   client side, sets the subsystems of the AREQs the daemon
+ *          forwards to this process
+ *
+ * @param   sysMask - RPC_MUX_SYS_BIT() of the subsystems
+ *
+ * @return  status of rpcSendFrame
+ */
+int32_t rpcMuxSubscribe(uint32_t sysMask)
+{
+	uint8_t payload[4];
+
+	payload[0] = sysMask & 0xFF;
+	payload[1] = (sysMask >> 8) & 0xFF;
+	payload[2] = (sysMask >> 16) & 0xFF;
+	payload[3] = (sysMask >> 24) & 0xFF;
+
+	return rpcSendFrame(MT_RPC_CMD_AREQ | RPC_MUX_SYS, RPC_MUX_SUBSCRIBE,
+	        payload, sizeof(payload));
+}
+
+/*********************************************************************
+ * @fn      rpcMuxFilter
+ *
+ * @brief   client side, sets the AREQ filter the daemon matches the
+ *          AREQs of the subscribed subsystems against before forwarding
+ *          them to this process
+ *
+ * @param   rules - rules, see rpcFilter.h
+ * @param   count - rules, 0 to forward every AREQ again
+ *
+ * @return  status of rpcSendFrame, MT_RPC_ERR_LENGTH on too many rules
+ */
+int32_t rpcMuxFilter(const rpcFilterRule_t *rules, uint32_t count)
+{
+	uint8_t payload[1 + (RPC_FILTER_MAX_RULES * RPC_MUX_FILTER_RULE_LEN)];
+	uint8_t *p = &payload[1];
+	uint32_t i;
+
+	if (count > RPC_FILTER_MAX_RULES)
+	{
+		return MT_RPC_ERR_LENGTH;
+	}
+	payload[0] = count;
+	for (i = 0; i < count; i++, p += RPC_MUX_FILTER_RULE_LEN)
+	{
+		p[0] = rules[i].Sys;
+		p[1] = rules[i].Cmd1;
+		p[2] = rules[i].Match;
+		p[3] = rules[i].ClusterId & 0xFF;
+		p[4] = rules[i].ClusterId >> 8;
+		p[5] = rules[i].SrcAddr & 0xFF;
+		p[6] = rules[i].SrcAddr >> 8;
+		p[7] = rules[i].GroupId & 0xFF;
+		p[8] = rules[i].GroupId >> 8;
+		p[9] = rules[i].SrcEndpoint;
+		p[10] = rules[i].DstEndpoint;
+	}
+
+	return rpcSendFrame(MT_RPC_CMD_AREQ | RPC_MUX_SYS, RPC_MUX_FILTER,
+	        payload, 1 + (count * RPC_MUX_FILTER_RULE_LEN));
+}
+
+/*********************************************************************
+ * @fn      rpcMuxShmAttach
+ *
+ * @brief   client side, reads the AREQs from the ring of the daemon
+ *          rather than from the socket, once rpcOpen() connected and the
+ *          RPC queue is set up
+ *
+ * @param   name - shared memory name given to rpcMuxShmOpen()
+ *
+ * @return  0 on success, -1 on failure, the AREQs keep coming on the
+ *          socket then
+ */
+int32_t rpcMuxShmAttach(const char *name)
+{
+	if (shmRunning || (rpcShmAttach(&shmRing, name) != 0))
+	{
+		return -1;
+	}
+	shmRunning = 1;
+	if (pthread_create(&shmThread, NULL, shmReader, NULL) != 0)
+	{
+		shmRunning = 0;
+		rpcShmClose(&shmRing);
+		return -1;
+	}
+
+	// AREQs written to the ring before the attach are lost, those after
+	// would come twice until the daemon takes the subscription
+	rpcMuxSubscribe(0);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcMuxShmDetach
+ *
+ * @brief   client side, stops reading the ring
+ */
+void rpcMuxShmDetach(void)
+{
+	if (!shmRunning)
+	{
+		return;
+	}
+	shmRunning = 0;
+	pthread_join(shmThread, NULL);
+	rpcShmClose(&shmRing);
+}
@@ -0,0 +1,166 @@
+/*
+ * rpcMux.h
+ *
+ * This module contains the ZNP mux daemon, which owns the ZNP and shares
+ * it among the client processes connected to a Unix domain socket.
+ *
+ * The clients exchange the same MT frames with the daemon as with the
+ * ZNP: the socket path is given to rpcOpen() in place of the serial
+ * port and the framework works unchanged. The daemon forwards the
+ * frames of the clients to the ZNP one client at a time, round robin,
+ * routes each SRSP to the client that sent the SREQ and fans the AREQs
+ * out to the clients subscribed to their subsystem, all of them by
+ * default. A client may narrow its subscription further with an AREQ
+ * filter (rpcFilter.h), which the daemon matches on the raw frames so
+ * the client neither receives nor parses the rest. A client too slow to read loses AREQs rather than stall the
+ * others.
+ *
+ * The ZNP is reset once by the daemon, a SYS_RESET_REQ of a client is
+ * answered with the SYS_RESET_IND of that reset so a client starting
+ * does not reset the network under the others.
+ *
+ * The daemon can also write every AREQ once into a shared memory ring
+ * (rpcShm.h), read by the clients of the same host that call
+ * rpcMuxShmAttach(): these get no AREQs on the socket anymore, only
+ * the SRSPs, and no longer cost the daemon a write per client.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef RPCMUX_H
+#define RPCMUX_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "rpc.h"
+#include "rpcShm.h"
+#include "rpcFilter.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define RPC_MUX_DEFAULT_PATH       "/tmp/znp.sock"
+
+#define RPC_MUX_MAX_CLIENTS        (32)
+
+// bytes of a client read but not yet sent to the ZNP
+#define RPC_MUX_RX_LEN             (2048)
+
+// bytes waiting for a client to read them, AREQs beyond are dropped
+#define RPC_MUX_TX_LEN             (64 * 1024)
+
+// subsystem of the frames a client sends to the daemon itself, never
+// forwarded to the ZNP
+#define RPC_MUX_SYS                (0x1F)
+
+// AREQ RPC_MUX_SYS commands
+#define RPC_MUX_SUBSCRIBE          (0x00) // payload: subsystem mask, 4 bytes
+#define RPC_MUX_FILTER             (0x01) // payload: rule count, rules
+
+// bytes of a rule of RPC_MUX_FILTER: Sys, Cmd1, Match, ClusterId,
+// SrcAddr, GroupId, SrcEndpoint, DstEndpoint, little endian
+#define RPC_MUX_FILTER_RULE_LEN    (11)
+
+// subsystem masks of RPC_MUX_SUBSCRIBE, bit n for subsystem n
+#define RPC_MUX_SYS_BIT(sys)       (1UL << (sys))
+#define RPC_MUX_SUBSCRIBE_ALL      (0xFFFFFFFFUL)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+	int Fd;
+	uint32_t Id;              // connection number
+	uint8_t Dead;             // the socket failed, closed by rpcMuxPoll
+	uint32_t SysMask;         // subsystems of the AREQs forwarded
+	rpcFilter_t Filter;       // AREQs forwarded among those subsystems
+
+	uint8_t Rx[RPC_MUX_RX_LEN];
+	uint32_t RxLen;
+	uint8_t *Tx;
+	uint32_t TxLen;
+
+	uint32_t FramesIn;        // frames of the client sent to the ZNP
+	uint32_t FramesOut;       // frames forwarded to the client
+	uint32_t Drops;           // AREQs dropped, the client read too slowly
+	uint32_t Filtered;        // AREQs the filter of the client dropped
+	uint32_t Errors;          // frames with a bad FCS or bytes out of frame
+} rpcMuxClient_t;
+
+typedef struct
+{
+	uint32_t Accepted;
+	uint32_t Rejected;        // connections over RPC_MUX_MAX_CLIENTS
+	uint32_t Closed;
+	uint32_t Sreqs;
+	uint32_t SrspTimeouts;
+	uint32_t SrspOrphans;     // SRSPs of a client that went away
+	uint32_t Areqs;           // AREQs of the clients sent to the ZNP
+	uint32_t Resets;          // SYS_RESET_REQs answered by the daemon
+	uint32_t FramesIn;        // frames received from the ZNP
+	uint32_t FramesOut;       // frames forwarded to the clients
+	uint32_t Drops;
+	uint32_t Filtered;
+	uint32_t PeakClients;
+} rpcMuxStats_t;
+
+typedef struct
+{
+	char Path[108];
+	int ListenFd;
+	pthread_mutex_t Lock;
+	pthread_cond_t ResetCond;
+
+	rpcMuxClient_t *Clients[RPC_MUX_MAX_CLIENTS];
+	uint32_t ClientCount;
+	uint32_t NextId;
+	uint32_t RoundRobin;      // client sending first in the next round
+
+	rpcMuxClient_t *SrspOwner; // client of the SREQ in progress
+
+	// SYS_RESET_IND of the last reset, as a complete frame
+	uint8_t ResetInd[RPC_MAX_LEN];
+	uint8_t ResetIndLen;
+
+	rpcShm_t Shm;             // AREQ ring, Shm.Hdr is NULL without one
+	uint32_t ShmFrames;       // AREQs written to the ring
+
+	rpcMuxStats_t Stats;
+} rpcMux_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t rpcMuxInit(rpcMux_t *ctx, const char *path);
+void rpcMuxClose(rpcMux_t *ctx);
+int32_t rpcMuxResetZnp(rpcMux_t *ctx, uint32_t timeoutMs);
+int32_t rpcMuxPoll(rpcMux_t *ctx, uint32_t timeoutMs);
+void rpcMuxPrintStats(rpcMux_t *ctx, FILE *out);
+int32_t rpcMuxShmOpen(rpcMux_t *ctx, const char *name, uint32_t size);
+
+int32_t rpcMuxSubscribe(uint32_t sysMask);
+int32_t rpcMuxFilter(const rpcFilterRule_t *rules, uint32_t count);
+int32_t rpcMuxShmAttach(const char *name);
+void rpcMuxShmDetach(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPCMUX_H */
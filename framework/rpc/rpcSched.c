@@ -0,0 +1,588 @@
+/*
+ * rpcSched.c
+ *
+ * This module contains the TX scheduler, see rpcSched.h.
+ *
+ * Each caller waits on a condition of its own in the flow of its class
+ * and destination. Whenever the frame being sent is done, or a caller
+ * comes while none is, the first class with flows waiting and within
+ * its rate limit gives the turn to the waiter at the head of its round
+ * robin. When only rate limited classes wait, the head waiter of the
+ * first one waits until the limit lets the next frame go and picks
+ * again.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rpcSched.h"
+#include "rpc.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define MT_AF_DATA_REQUEST_ID      (0x01)
+#define MT_AF_DATA_REQUEST_EXT_ID  (0x02)
+#define MT_AF_DATA_REQUEST_SRC_ID  (0x03)
+
+#define MT_ZDO_NWK_ADDR_REQ_ID     (0x00)
+#define MT_ZDO_MGMT_LEAVE_REQ_ID   (0x34)
+#define MT_ZDO_MGMT_UPDATE_REQ_ID  (0x37)
+// ZDP requests, which start with the address of the node asked
+#define MT_ZDO_ZDP_REQ_END         (0x40)
+
+// bytes of a frame besides the payload
+#define SCHED_FRAME_BYTES          (RPC_UART_HDR_LEN + RPC_UART_FCS_LEN)
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static __thread uint8_t schedThreadClass = RPC_SCHED_AUTO;
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint64_t nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static uint8_t schedClassOf(uint8_t cmd0, uint8_t cmd1)
+{
+	switch (cmd0 & MT_RPC_SUBSYSTEM_MASK)
+	{
+	case MT_RPC_SYS_SYS:
+		return RPC_SCHED_CONTROL;
+
+	case MT_RPC_SYS_ZDO:
+		// leave, direct join, permit join and network update
+		if ((cmd1 >= MT_ZDO_MGMT_LEAVE_REQ_ID)
+		        && (cmd1 <= MT_ZDO_MGMT_UPDATE_REQ_ID))
+		{
+			return RPC_SCHED_CONTROL;
+		}
+		return RPC_SCHED_INTERACTIVE;
+
+	case MT_RPC_SYS_OTA:
+	case MT_RPC_SYS_SBL:
+		return RPC_SCHED_BULK;
+
+	default:
+		return RPC_SCHED_INTERACTIVE;
+	}
+}
+
+// short address of the destination, the address mode above it for the
+// extended AF requests so a group is a flow of its own
+static uint32_t schedDestOf(uint8_t cmd0, uint8_t cmd1,
+        const uint8_t *payload, uint8_t payloadLen)
+{
+	switch (cmd0 & MT_RPC_SUBSYSTEM_MASK)
+	{
+	case MT_RPC_SYS_AF:
+		if (((cmd1 == MT_AF_DATA_REQUEST_ID)
+		        || (cmd1 == MT_AF_DATA_REQUEST_SRC_ID)) && (payloadLen >= 2))
+		{
+			return payload[0] | (payload[1] << 8);
+		}
+		if ((cmd1 == MT_AF_DATA_REQUEST_EXT_ID) && (payloadLen >= 3))
+		{
+			return (payload[0] << 16) | payload[1] | (payload[2] << 8);
+		}
+		break;
+
+	case MT_RPC_SYS_ZDO:
+		if ((cmd1 != MT_ZDO_NWK_ADDR_REQ_ID) && (cmd1 < MT_ZDO_ZDP_REQ_END)
+		        && (payloadLen >= 2))
+		{
+			return payload[0] | (payload[1] << 8);
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return RPC_SCHED_NO_DEST;
+}
+
+static uint32_t flowHash(rpcSched_t *ctx, uint8_t schedClass, uint32_t dest)
+{
+	return ((dest ^ ((uint32_t) schedClass << 24)) * 0x9E3779B1)
+	        & ctx->HashMask;
+}
+
+static void activeAppend(rpcSchedQueue_t *q, rpcSchedFlow_t *f)
+{
+	f->Next = NULL;
+	if (q->ActiveTail != NULL)
+	{
+		q->ActiveTail->Next = f;
+	}
+	else
+	{
+		q->Active = f;
+	}
+	q->ActiveTail = f;
+}
+
+/*********************************************************************
+ * @fn      flowGet
+ *
+ * @brief   finds the flow of a destination, else makes it the last of
+ *          the round. Flows exist while frames wait in them.
+ */
+static rpcSchedFlow_t *flowGet(rpcSched_t *ctx, uint8_t schedClass,
+        uint32_t dest)
+{
+	rpcSchedQueue_t *q = &ctx->Queues[schedClass];
+	uint32_t h = flowHash(ctx, schedClass, dest);
+	rpcSchedFlow_t *f;
+
+	for (f = ctx->Hash[h]; f != NULL; f = f->HashNext)
+	{
+		if ((f->Dest == dest) && (f->Class == schedClass))
+		{
+			return f;
+		}
+	}
+
+	f = ctx->FreeFlows;
+	if (f == NULL)
+	{
+		// the frames wait in order, sharing the spill flow
+		q->Stats.Spilled++;
+		f = &q->Spill;
+		if (f->Head == NULL)
+		{
+			activeAppend(q, f);
+		}
+		return f;
+	}
+
+	ctx->FreeFlows = f->Next;
+	memset(f, 0, sizeof(rpcSchedFlow_t));
+	f->Dest = dest;
+	f->Class = schedClass;
+	f->HashNext = ctx->Hash[h];
+	ctx->Hash[h] = f;
+	activeAppend(q, f);
+
+	return f;
+}
+
+static void flowFree(rpcSched_t *ctx, rpcSchedQueue_t *q, rpcSchedFlow_t *f)
+{
+	rpcSchedFlow_t **pf;
+
+	if (f == &q->Spill)
+	{
+		f->Deficit = 0;
+		f->Credited = 0;
+		return;
+	}
+
+	for (pf = &ctx->Hash[flowHash(ctx, f->Class, f->Dest)]; *pf != f;
+	        pf = &(*pf)->HashNext)
+		;
+	*pf = f->HashNext;
+	f->Next = ctx->FreeFlows;
+	ctx->FreeFlows = f;
+}
+
+/*********************************************************************
+ * @fn      drrNext
+ *
+ * @brief   takes the next waiter of a class by deficit round robin: the
+ *          flow at the head of the round gets Quantum bytes once per
+ *          round and sends while its frames fit, then goes last
+ */
+static rpcSchedWaiter_t *drrNext(rpcSched_t *ctx, rpcSchedQueue_t *q)
+{
+	rpcSchedFlow_t *f;
+	rpcSchedWaiter_t *w;
+
+	while (1)
+	{
+		f = q->Active;
+		if (!f->Credited)
+		{
+			f->Deficit += ctx->Cfg.Quantum;
+			f->Credited = 1;
+		}
+
+		w = f->Head;
+		if (f->Deficit >= (int32_t) w->Bytes)
+		{
+			f->Deficit -= w->Bytes;
+			f->Head = w->Next;
+			if (f->Head == NULL)
+			{
+				f->Tail = NULL;
+				q->Active = f->Next;
+				if (q->Active == NULL)
+				{
+					q->ActiveTail = NULL;
+				}
+				flowFree(ctx, q, f);
+			}
+			return w;
+		}
+
+		f->Credited = 0;
+		if (f->Next != NULL)
+		{
+			q->Active = f->Next;
+			activeAppend(q, f);
+		}
+	}
+}
+
+/*********************************************************************
+ * @fn      schedAdmit
+ *
+ * @brief   takes a frame of a class from its rate limit by the generic
+ *          cell rate algorithm, Tat the time the next frame is due
+ *
+ * @return  1 if the frame may go now, else 0 with WakeUs set
+ */
+static uint8_t schedAdmit(rpcSched_t *ctx, uint8_t c, uint64_t now)
+{
+	rpcSchedLimit_t *lim = &ctx->Cfg.Limits[c];
+	rpcSchedQueue_t *q = &ctx->Queues[c];
+	uint64_t interval, tau, due;
+
+	if (lim->Rate == 0)
+	{
+		return 1;
+	}
+
+	interval = 1000000 / lim->Rate;
+	tau = (uint64_t) (lim->Burst - 1) * interval;
+	if (q->Tat > now + tau)
+	{
+		due = q->Tat - tau;
+		if ((ctx->WakeUs == 0) || (due < ctx->WakeUs))
+		{
+			ctx->WakeUs = due;
+		}
+		q->Stats.Limited++;
+		return 0;
+	}
+	q->Tat = ((q->Tat > now) ? q->Tat : now) + interval;
+
+	return 1;
+}
+
+/*********************************************************************
+ * @fn      schedPick
+ *
+ * @brief   gives the turn to a waiter if no frame is being sent, with
+ *          the lock held
+ */
+static void schedPick(rpcSched_t *ctx, uint64_t now)
+{
+	rpcSchedQueue_t *q;
+	rpcSchedWaiter_t *w;
+	uint8_t c;
+
+	if (ctx->Busy)
+	{
+		return;
+	}
+
+	ctx->WakeUs = 0;
+	for (c = 0; c < RPC_SCHED_CLASSES; c++)
+	{
+		q = &ctx->Queues[c];
+		if ((q->Active == NULL) || !schedAdmit(ctx, c, now))
+		{
+			continue;
+		}
+
+		w = drrNext(ctx, q);
+		w->Granted = 1;
+		ctx->Busy = 1;
+		ctx->WakeUs = 0;
+		q->Stats.Waiting--;
+		q->Stats.Frames++;
+		q->Stats.Bytes += w->Bytes;
+		pthread_cond_signal(&w->Cond);
+		return;
+	}
+
+	// a waiter of the limited classes waits for the limit to pick again
+	for (c = 0; (ctx->WakeUs != 0) && (c < RPC_SCHED_CLASSES); c++)
+	{
+		if (ctx->Queues[c].Active != NULL)
+		{
+			pthread_cond_signal(&ctx->Queues[c].Active->Head->Cond);
+			break;
+		}
+	}
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      rpcSchedInit
+ *
+ * @brief   sets up a TX scheduler, installed with rpcSetTxScheduler()
+ *
+ * @param   ctx - scheduler
+ * @param   cfg - configuration, fields left 0 take the defaults
+ *
+ * @return  0 on success, -1 on failure
+ */
+int32_t rpcSchedInit(rpcSched_t *ctx, rpcSchedCfg_t *cfg)
+{
+	uint32_t i, slots = 1;
+
+	memset(ctx, 0, sizeof(rpcSched_t));
+	ctx->Cfg = *cfg;
+	if (ctx->Cfg.Quantum == 0)
+	{
+		ctx->Cfg.Quantum = RPC_SCHED_QUANTUM;
+	}
+	if (ctx->Cfg.Flows == 0)
+	{
+		ctx->Cfg.Flows = RPC_SCHED_FLOWS;
+	}
+	for (i = 0; i < RPC_SCHED_CLASSES; i++)
+	{
+		if (ctx->Cfg.Limits[i].Rate > 1000000)
+		{
+			ctx->Cfg.Limits[i].Rate = 1000000;
+		}
+		if (ctx->Cfg.Limits[i].Burst == 0)
+		{
+			ctx->Cfg.Limits[i].Burst = 1;
+		}
+		ctx->Queues[i].Spill.Dest = RPC_SCHED_NO_DEST;
+		ctx->Queues[i].Spill.Class = i;
+	}
+	while (slots < (2 * ctx->Cfg.Flows))
+	{
+		slots <<= 1;
+	}
+	ctx->HashMask = slots - 1;
+
+	ctx->FlowPool = calloc(ctx->Cfg.Flows, sizeof(rpcSchedFlow_t));
+	ctx->Hash = calloc(slots, sizeof(rpcSchedFlow_t *));
+	if ((ctx->FlowPool == NULL) || (ctx->Hash == NULL))
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "rpcSchedInit: allocation failed\n");
+		free(ctx->FlowPool);
+		free(ctx->Hash);
+		return -1;
+	}
+	for (i = 0; i < ctx->Cfg.Flows; i++)
+	{
+		ctx->FlowPool[i].Next = ctx->FreeFlows;
+		ctx->FreeFlows = &ctx->FlowPool[i];
+	}
+
+	pthread_mutex_init(&ctx->Lock, NULL);
+	pthread_condattr_init(&ctx->CondAttr);
+	pthread_condattr_setclock(&ctx->CondAttr, CLOCK_MONOTONIC);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcSchedClose
+ *
+ * @brief   frees a scheduler no longer installed and without waiters
+ *
+ * @param   ctx - scheduler
+ *
+ * @return  none
+ */
+void rpcSchedClose(rpcSched_t *ctx)
+{
+	pthread_condattr_destroy(&ctx->CondAttr);
+	pthread_mutex_destroy(&ctx->Lock);
+	free(ctx->Hash);
+	free(ctx->FlowPool);
+}
+
+/*********************************************************************
+ * @fn      rpcSchedSetThreadClass
+ *
+ * @brief   sets the class of the frames the calling thread sends, a
+ *          reporting or download thread marking itself bulk
+ *
+ * @param   schedClass - RPC_SCHED_* class, RPC_SCHED_AUTO for the class
+ *          of the command
+ *
+ * @return  none
+ */
+void rpcSchedSetThreadClass(uint8_t schedClass)
+{
+	schedThreadClass = schedClass;
+}
+
+/*********************************************************************
+ * @fn      rpcSchedAcquire
+ *
+ * @brief   waits for the turn of a frame, called by rpcSendFrame()
+ *
+ * @param   ctx - scheduler
+ * @param   cmd0 - Cmd0 of the frame
+ * @param   cmd1 - Cmd1 of the frame
+ * @param   payload - payload of the frame
+ * @param   payloadLen - its length
+ *
+ * @return  none
+ */
+void rpcSchedAcquire(rpcSched_t *ctx, uint8_t cmd0, uint8_t cmd1,
+        const uint8_t *payload, uint8_t payloadLen)
+{
+	uint8_t schedClass = schedThreadClass;
+	rpcSchedWaiter_t w;
+	rpcSchedQueue_t *q;
+	rpcSchedFlow_t *f;
+	struct timespec ts;
+	uint64_t waitUs;
+	uint8_t idle;
+
+	if (schedClass >= RPC_SCHED_CLASSES)
+	{
+		schedClass = schedClassOf(cmd0, cmd1);
+	}
+	memset(&w, 0, sizeof(w));
+	w.Bytes = payloadLen + SCHED_FRAME_BYTES;
+	q = &ctx->Queues[schedClass];
+
+	pthread_mutex_lock(&ctx->Lock);
+	w.QueuedUs = nowUs();
+
+	// nothing sent or waiting, the frame goes unless its class is limited
+	idle = !ctx->Busy && (ctx->Queues[RPC_SCHED_CONTROL].Active == NULL)
+	        && (ctx->Queues[RPC_SCHED_INTERACTIVE].Active == NULL)
+	        && (ctx->Queues[RPC_SCHED_BULK].Active == NULL);
+	if (idle && schedAdmit(ctx, schedClass, w.QueuedUs))
+	{
+		ctx->Busy = 1;
+		q->Stats.Frames++;
+		q->Stats.Bytes += w.Bytes;
+		pthread_mutex_unlock(&ctx->Lock);
+		return;
+	}
+
+	pthread_cond_init(&w.Cond, &ctx->CondAttr);
+	f = flowGet(ctx, schedClass, schedDestOf(cmd0, cmd1, payload, payloadLen));
+	if (f->Tail != NULL)
+	{
+		f->Tail->Next = &w;
+	}
+	else
+	{
+		f->Head = &w;
+	}
+	f->Tail = &w;
+	q->Stats.Waiting++;
+	if (q->Stats.Waiting > q->Stats.PeakWaiting)
+	{
+		q->Stats.PeakWaiting = q->Stats.Waiting;
+	}
+
+	// else the frame waits alone for the WakeUs set by its limit
+	if (!idle)
+	{
+		schedPick(ctx, w.QueuedUs);
+	}
+	while (!w.Granted)
+	{
+		if (ctx->WakeUs != 0)
+		{
+			ts.tv_sec = ctx->WakeUs / 1000000;
+			ts.tv_nsec = (ctx->WakeUs % 1000000) * 1000;
+			pthread_cond_timedwait(&w.Cond, &ctx->Lock, &ts);
+		}
+		else
+		{
+			pthread_cond_wait(&w.Cond, &ctx->Lock);
+		}
+		if (!w.Granted)
+		{
+			schedPick(ctx, nowUs());
+		}
+	}
+
+	waitUs = nowUs() - w.QueuedUs;
+	q->Stats.WaitUs += waitUs;
+	if (waitUs > q->Stats.MaxWaitUs)
+	{
+		q->Stats.MaxWaitUs = waitUs;
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+
+	pthread_cond_destroy(&w.Cond);
+}
+
+/*********************************************************************
+ * @fn      rpcSchedRelease
+ *
+ * @brief   ends the turn of the frame sent, called by rpcSendFrame()
+ *
+ * @param   ctx - scheduler
+ *
+ * @return  none
+ */
+void rpcSchedRelease(rpcSched_t *ctx)
+{
+	pthread_mutex_lock(&ctx->Lock);
+	ctx->Busy = 0;
+	schedPick(ctx, nowUs());
+	pthread_mutex_unlock(&ctx->Lock);
+}
+
+/*********************************************************************
+ * @fn      rpcSchedPrintStats
+ *
+ * @brief   prints the frames sent, waiting and their wait by class
+ *
+ * @param   ctx - scheduler
+ * @param   out - stream
+ *
+ * @return  none
+ */
+void rpcSchedPrintStats(rpcSched_t *ctx, FILE *out)
+{
+	static const char *names[RPC_SCHED_CLASSES] =
+		{ "control", "interactive", "bulk" };
+	rpcSchedStats_t *st;
+	uint8_t c;
+
+	pthread_mutex_lock(&ctx->Lock);
+	for (c = 0; c < RPC_SCHED_CLASSES; c++)
+	{
+		st = &ctx->Queues[c].Stats;
+		fprintf(out, "%s: %llu frames, %llu bytes, %u waiting, peak %u, "
+		        "wait avg %llu us max %u us, %u limited, %u spilled\n",
+		        names[c], (unsigned long long) st->Frames,
+		        (unsigned long long) st->Bytes, st->Waiting, st->PeakWaiting,
+		        (unsigned long long) ((st->Frames > 0) ?
+		                (st->WaitUs / st->Frames) : 0), st->MaxWaitUs,
+		        st->Limited, st->Spilled);
+	}
+	pthread_mutex_unlock(&ctx->Lock);
+}
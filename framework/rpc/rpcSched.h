@@ -0,0 +1,159 @@
+/*
+ * rpcSched.h
+ *
+ * This module contains the TX scheduler, which decides the order the
+ * threads calling rpcSendFrame() send their frames in, instead of the
+ * first come first served of the RPC semaphore, so a ZDO leave or a
+ * permit join is not held up for seconds behind an OTA download or the
+ * reports of a bulk sender.
+ *
+ * A frame belongs to one of three classes, served in strict priority:
+ * control, interactive and bulk. The class is the one set for the
+ * calling thread with rpcSchedSetThreadClass(), else the one of the
+ * command: SYS and the ZDO management of the network are control, OTA
+ * and SBL bulk, the rest interactive. Within a class each destination
+ * node is a flow, and the flows are served by deficit round robin, each
+ * sending Quantum bytes of frames per round, so one busy node does not
+ * hold up the others. A class may be rate limited, Rate frames per
+ * second with bursts of Burst frames; a limited class lets the lower
+ * classes send meanwhile.
+ *
+ * The callers keep waiting in rpcSendFrame(), the scheduler only picks
+ * which of them goes when the frame before is sent and its SRSP back.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef RPCSCHED_H
+#define RPCSCHED_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// class of the thread taken from the command
+#define RPC_SCHED_AUTO             (0xFF)
+
+// flow of the frames without a destination node
+#define RPC_SCHED_NO_DEST          (0xFFFFFFFF)
+
+// defaults used for the rpcSchedCfg_t fields left 0
+#define RPC_SCHED_QUANTUM          (64)
+#define RPC_SCHED_FLOWS            (256)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef enum
+{
+	RPC_SCHED_CONTROL,
+	RPC_SCHED_INTERACTIVE,
+	RPC_SCHED_BULK,
+	RPC_SCHED_CLASSES
+} rpcSchedClass_t;
+
+typedef struct
+{
+	uint32_t Rate;             // frames per second, 0 for no limit
+	uint32_t Burst;            // frames sent at once, 1 if 0
+} rpcSchedLimit_t;
+
+typedef struct
+{
+	rpcSchedLimit_t Limits[RPC_SCHED_CLASSES];
+	uint32_t Quantum;          // bytes a flow sends per round
+	uint32_t Flows;            // destinations waiting at most
+} rpcSchedCfg_t;
+
+typedef struct
+{
+	uint64_t Frames;           // frames sent
+	uint64_t Bytes;
+	uint32_t Waiting;          // frames waiting now
+	uint32_t PeakWaiting;
+	uint64_t WaitUs;           // time the frames waited
+	uint32_t MaxWaitUs;
+	uint32_t Limited;          // picks deferred by the rate limit
+	uint32_t Spilled;          // frames sent FIFO, no flow left
+} rpcSchedStats_t;
+
+// caller of rpcSendFrame() waiting for its turn
+typedef struct rpcSchedWaiter
+{
+	struct rpcSchedWaiter *Next;
+	pthread_cond_t Cond;
+	uint32_t Bytes;
+	uint64_t QueuedUs;
+	uint8_t Granted;
+} rpcSchedWaiter_t;
+
+typedef struct rpcSchedFlow
+{
+	struct rpcSchedFlow *Next;     // in the active list or the free list
+	struct rpcSchedFlow *HashNext;
+	uint32_t Dest;
+	uint8_t Class;
+	uint8_t Credited;              // got its quantum this round
+	int32_t Deficit;
+	rpcSchedWaiter_t *Head;
+	rpcSchedWaiter_t *Tail;
+} rpcSchedFlow_t;
+
+typedef struct
+{
+	rpcSchedFlow_t *Active;        // flows waiting, in round order
+	rpcSchedFlow_t *ActiveTail;
+	rpcSchedFlow_t Spill;          // waiters once the flows run out
+	uint64_t Tat;                  // rate limit, next time a frame is due
+	rpcSchedStats_t Stats;
+} rpcSchedQueue_t;
+
+typedef struct
+{
+	rpcSchedCfg_t Cfg;
+	pthread_mutex_t Lock;
+	pthread_condattr_t CondAttr;
+	rpcSchedQueue_t Queues[RPC_SCHED_CLASSES];
+	rpcSchedFlow_t *FlowPool;
+	rpcSchedFlow_t *FreeFlows;
+	rpcSchedFlow_t **Hash;
+	uint32_t HashMask;
+	uint8_t Busy;                  // a frame is being sent
+	uint64_t WakeUs;               // a limited class may send then, or 0
+} rpcSched_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t rpcSchedInit(rpcSched_t *ctx, rpcSchedCfg_t *cfg);
+void rpcSchedClose(rpcSched_t *ctx);
+void rpcSchedSetThreadClass(uint8_t schedClass);
+void rpcSchedAcquire(rpcSched_t *ctx, uint8_t cmd0, uint8_t cmd1,
+        const uint8_t *payload, uint8_t payloadLen);
+void rpcSchedRelease(rpcSched_t *ctx);
+void rpcSchedPrintStats(rpcSched_t *ctx, FILE *out);
+
+// in the RPC layer, rpc.c
+void rpcSetTxScheduler(rpcSched_t *sched);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPCSCHED_H */
@@ -0,0 +1,544 @@
+/*
+ * rpcShm.c
+ *
+ * This module contains the shared memory frame ring, see rpcShm.h.
+ *
+ * Each frame is a 4 byte length followed by the frame, padded to 4
+ * bytes, and never wraps around the end of the ring: a pad record
+ * skips the end instead, so a reader gets the frame in place. The
+ * writer announces the end of the frame it is about to write in
+ * Reserve before writing it and in Head once written. A reader takes
+ * the frame at its cursor once Head is past it and checks afterwards,
+ * like a seqlock, that Reserve did not move a ring size beyond the
+ * cursor meanwhile, which would mean the frame was overwritten.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "rpcShm.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define RPC_SHM_MAGIC              (0x5A4E5052) // "RPNZ"
+
+// length word of the record skipping the end of the ring
+#define RPC_SHM_PAD                (0xFFFFFFFF)
+
+// yields of a reader without frames before it sleeps
+#define RPC_SHM_SPINS              (16)
+
+#define RPC_SHM_RECORD_LEN(len)    ((4 + (len) + 3) & ~3U)
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint64_t nowMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*********************************************************************
+ * @fn      shmName
+ *
+ * @brief   POSIX shared memory names start with a slash
+ */
+static void shmName(char *dst, size_t dstLen, const char *name)
+{
+	snprintf(dst, dstLen, "%s%s", (name[0] == '/') ? "" : "/", name);
+}
+
+/*********************************************************************
+ * @fn      futexWait
+ *
+ * @brief   sleeps while *addr is val, at most timeoutMs
+ */
+static void futexWait(volatile uint32_t *addr, uint32_t val,
+        uint32_t timeoutMs)
+{
+	struct timespec ts;
+
+	ts.tv_sec = timeoutMs / 1000;
+	ts.tv_nsec = (long) (timeoutMs % 1000) * 1000000L;
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+/*********************************************************************
+ * @fn      readerOverrun
+ *
+ * @brief   the frames at the reader cursor were overwritten, the reader
+ *          resumes at the newest frame
+ */
+static void readerOverrun(rpcShm_t *ring)
+{
+	rpcShmSlot_t *slot = &ring->Hdr->Slots[ring->Slot];
+
+	ring->Cursor = __atomic_load_n(&ring->Hdr->Head, __ATOMIC_ACQUIRE);
+	slot->Overruns++;
+	__atomic_store_n(&slot->Cursor, ring->Cursor, __ATOMIC_RELEASE);
+}
+
+/*********************************************************************
+ * @fn      frameIntact
+ *
+ * @brief   checks the writer did not reach the record at the cursor
+ *          while it was read
+ */
+static int32_t frameIntact(rpcShm_t *ring)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return (__atomic_load_n(&ring->Hdr->Reserve, __ATOMIC_RELAXED)
+	        <= ring->Cursor + ring->Hdr->Size) ? 0 : -1;
+}
+
+/*********************************************************************
+ * @fn      shmMap
+ *
+ * @brief   maps a shared memory object
+ */
+static int32_t shmMap(rpcShm_t *ring, int fd, size_t size)
+{
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "rpcShm: cannot map %s\n", ring->Name);
+		return -1;
+	}
+	ring->Hdr = map;
+	ring->MapSize = size;
+
+	return 0;
+}
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      rpcShmCreate
+ *
+ * @brief   creates the ring as its writer
+ *
+ * @param   ring - ring
+ * @param   name - shared memory name
+ * @param   size - frame bytes, rounded up to a power of 2,
+ *          RPC_SHM_DEFAULT_SIZE if 0
+ *
+ * @return  0 on success, -1 on failure
+ */
+int32_t rpcShmCreate(rpcShm_t *ring, const char *name, uint32_t size)
+{
+	uint32_t dataOffset = (sizeof(rpcShmHdr_t) + 4095) & ~4095U;
+	uint32_t ringSize = 4096;
+	int fd;
+
+	memset(ring, 0, sizeof(rpcShm_t));
+	shmName(ring->Name, sizeof(ring->Name), name);
+	ring->Writer = 1;
+	ring->Slot = -1;
+
+	if (size == 0)
+	{
+		size = RPC_SHM_DEFAULT_SIZE;
+	}
+	while ((ringSize < size) && (ringSize < (1U << 30)))
+	{
+		ringSize <<= 1;
+	}
+
+	shm_unlink(ring->Name);
+	fd = shm_open(ring->Name, O_CREAT | O_EXCL | O_RDWR, 0660);
+	if ((fd < 0) || (ftruncate(fd, dataOffset + ringSize) != 0))
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "rpcShm: cannot create %s\n",
+		        ring->Name);
+		if (fd >= 0)
+		{
+			close(fd);
+			shm_unlink(ring->Name);
+		}
+		return -1;
+	}
+	if (shmMap(ring, fd, dataOffset + ringSize) != 0)
+	{
+		shm_unlink(ring->Name);
+		return -1;
+	}
+
+	ring->Data = (uint8_t *) ring->Hdr + dataOffset;
+	ring->Hdr->Size = ringSize;
+	ring->Hdr->DataOffset = dataOffset;
+	__atomic_store_n(&ring->Hdr->Magic, RPC_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcShmAttach
+ *
+ * @brief   attaches to the ring as a reader, reading from the next frame
+ *          written
+ *
+ * @param   ring - ring
+ * @param   name - shared memory name
+ *
+ * @return  0 on success, -1 on failure or without a free reader slot
+ */
+int32_t rpcShmAttach(rpcShm_t *ring, const char *name)
+{
+	struct stat st;
+	rpcShmSlot_t *slot;
+	uint32_t one = 1, zero, i;
+	int fd;
+
+	memset(ring, 0, sizeof(rpcShm_t));
+	shmName(ring->Name, sizeof(ring->Name), name);
+	ring->Slot = -1;
+
+	fd = shm_open(ring->Name, O_RDWR, 0);
+	if ((fd < 0) || (fstat(fd, &st) != 0)
+	        || ((size_t) st.st_size < sizeof(rpcShmHdr_t)))
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "rpcShm: cannot open %s\n", ring->Name);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+	if (shmMap(ring, fd, st.st_size) != 0)
+	{
+		return -1;
+	}
+	if ((__atomic_load_n(&ring->Hdr->Magic, __ATOMIC_ACQUIRE) != RPC_SHM_MAGIC)
+	        || (ring->Hdr->DataOffset + ring->Hdr->Size > ring->MapSize))
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "rpcShm: %s is not a frame ring\n",
+		        ring->Name);
+		rpcShmClose(ring);
+		return -1;
+	}
+	ring->Data = (uint8_t *) ring->Hdr + ring->Hdr->DataOffset;
+
+	for (i = 0; (ring->Slot < 0) && (i < RPC_SHM_MAX_READERS); i++)
+	{
+		slot = &ring->Hdr->Slots[i];
+
+		// take back the slot of a reader that died
+		zero = 1;
+		if (slot->InUse && (kill(slot->Pid, 0) != 0) && (errno == ESRCH))
+		{
+			__atomic_compare_exchange_n(&slot->InUse, &zero, 0, 0,
+			        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+		}
+
+		zero = 0;
+		if (__atomic_compare_exchange_n(&slot->InUse, &zero, one, 0,
+		        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			ring->Slot = i;
+		}
+	}
+	if (ring->Slot < 0)
+	{
+		dbg_print(PRINT_LEVEL_ERROR, "rpcShm: no free reader slot in %s\n",
+		        ring->Name);
+		rpcShmClose(ring);
+		return -1;
+	}
+
+	slot = &ring->Hdr->Slots[ring->Slot];
+	slot->Pid = getpid();
+	slot->Frames = 0;
+	slot->Overruns = 0;
+	ring->Cursor = __atomic_load_n(&ring->Hdr->Head, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&slot->Cursor, ring->Cursor, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcShmClose
+ *
+ * @brief   frees the reader slot, or removes the ring of the writer
+ */
+void rpcShmClose(rpcShm_t *ring)
+{
+	if (ring->Hdr == NULL)
+	{
+		return;
+	}
+	if (ring->Slot >= 0)
+	{
+		__atomic_store_n(&ring->Hdr->Slots[ring->Slot].InUse, 0,
+		        __ATOMIC_RELEASE);
+	}
+	munmap(ring->Hdr, ring->MapSize);
+	if (ring->Writer)
+	{
+		shm_unlink(ring->Name);
+	}
+	ring->Hdr = NULL;
+}
+
+/*********************************************************************
+ * @fn      rpcShmWrite
+ *
+ * @brief   writes a frame for all readers, never waits
+ *
+ * @param   ring - ring of the writer
+ * @param   frame - frame
+ * @param   len - frame length, up to RPC_SHM_MAX_FRAME
+ *
+ * @return  none
+ */
+void rpcShmWrite(rpcShm_t *ring, const uint8_t *frame, uint32_t len)
+{
+	rpcShmHdr_t *hdr = ring->Hdr;
+	uint64_t head = hdr->Head;
+	uint32_t rec = RPC_SHM_RECORD_LEN(len);
+	uint32_t off = head & (hdr->Size - 1);
+	uint32_t pad = 0;
+
+	if (len > RPC_SHM_MAX_FRAME)
+	{
+		return;
+	}
+	if (off + rec > hdr->Size)
+	{
+		pad = hdr->Size - off;
+	}
+
+	// readers of the bytes about to be overwritten must see Reserve move
+	__atomic_store_n(&hdr->Reserve, head + pad + rec, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (pad)
+	{
+		*(volatile uint32_t *) (ring->Data + off) = RPC_SHM_PAD;
+		head += pad;
+		off = 0;
+	}
+	*(volatile uint32_t *) (ring->Data + off) = len;
+	memcpy(ring->Data + off + 4, frame, len);
+
+	hdr->Frames++;
+	__atomic_store_n(&hdr->Head, head + rec, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&hdr->Seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&hdr->Waiters, __ATOMIC_SEQ_CST))
+	{
+		syscall(SYS_futex, &hdr->Seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+/*********************************************************************
+ * @fn      rpcShmLag
+ *
+ * @brief   bytes the slowest reader is behind the writer
+ */
+uint64_t rpcShmLag(rpcShm_t *ring)
+{
+	uint64_t head = __atomic_load_n(&ring->Hdr->Head, __ATOMIC_ACQUIRE);
+	uint64_t lag = 0, cursor;
+	uint32_t i;
+
+	for (i = 0; i < RPC_SHM_MAX_READERS; i++)
+	{
+		if (!__atomic_load_n(&ring->Hdr->Slots[i].InUse, __ATOMIC_ACQUIRE))
+		{
+			continue;
+		}
+		cursor = __atomic_load_n(&ring->Hdr->Slots[i].Cursor,
+		        __ATOMIC_ACQUIRE);
+		if ((head > cursor) && (head - cursor > lag))
+		{
+			lag = head - cursor;
+		}
+	}
+
+	return lag;
+}
+
+/*********************************************************************
+ * @fn      rpcShmReaders
+ *
+ * @brief   readers attached to the ring
+ */
+uint32_t rpcShmReaders(rpcShm_t *ring)
+{
+	uint32_t i, count = 0;
+
+	for (i = 0; i < RPC_SHM_MAX_READERS; i++)
+	{
+		count += (__atomic_load_n(&ring->Hdr->Slots[i].InUse,
+		        __ATOMIC_ACQUIRE) != 0);
+	}
+
+	return count;
+}
+
+/*********************************************************************
+ * @fn      rpcShmReadBegin
+ *
+ * @brief   takes the next frame in place, rpcShmReadEnd() tells whether
+ *          it was overwritten while in use
+ *
+ * @param   ring - ring of a reader
+ * @param   frame - set to the frame in the ring
+ * @param   timeoutMs - time to wait for a frame, 0 not to wait
+ *
+ * @return  frame length, 0 without a frame
+ */
+int32_t rpcShmReadBegin(rpcShm_t *ring, const uint8_t **frame,
+        uint32_t timeoutMs)
+{
+	rpcShmHdr_t *hdr = ring->Hdr;
+	uint64_t deadline = 0, now;
+	uint64_t head;
+	uint32_t off, len, seq, spins = 0;
+
+	while (1)
+	{
+		head = __atomic_load_n(&hdr->Head, __ATOMIC_ACQUIRE);
+		if (head - ring->Cursor > hdr->Size)
+		{
+			readerOverrun(ring);
+			continue;
+		}
+		if (head != ring->Cursor)
+		{
+			off = ring->Cursor & (hdr->Size - 1);
+			len = *(volatile uint32_t *) (ring->Data + off);
+			if (len == RPC_SHM_PAD)
+			{
+				if (frameIntact(ring) != 0)
+				{
+					readerOverrun(ring);
+					continue;
+				}
+				ring->Cursor += hdr->Size - off;
+				continue;
+			}
+			if ((len > RPC_SHM_MAX_FRAME)
+			        || (off + RPC_SHM_RECORD_LEN(len) > hdr->Size))
+			{
+				// the length was overwritten while read
+				readerOverrun(ring);
+				continue;
+			}
+			*frame = ring->Data + off + 4;
+			ring->Next = ring->Cursor + RPC_SHM_RECORD_LEN(len);
+			return len;
+		}
+
+		// nothing to read, a frame often follows closely, spin a while
+		// before sleeping until the writer moves Seq
+		if (timeoutMs == 0)
+		{
+			return 0;
+		}
+		if (spins < RPC_SHM_SPINS)
+		{
+			spins++;
+			sched_yield();
+			continue;
+		}
+		now = nowMs();
+		if (deadline == 0)
+		{
+			deadline = now + timeoutMs;
+		}
+		else if (now >= deadline)
+		{
+			return 0;
+		}
+		seq = __atomic_load_n(&hdr->Seq, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&hdr->Waiters, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&hdr->Head, __ATOMIC_SEQ_CST) == ring->Cursor)
+		{
+			futexWait(&hdr->Seq, seq, (uint32_t) (deadline - now));
+		}
+		__atomic_sub_fetch(&hdr->Waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/*********************************************************************
+ * @fn      rpcShmReadEnd
+ *
+ * @brief   releases the frame of rpcShmReadBegin()
+ *
+ * @return  0 if the frame stayed intact, -1 if it was overwritten and
+ *          what was read of it must be discarded
+ */
+int32_t rpcShmReadEnd(rpcShm_t *ring)
+{
+	rpcShmSlot_t *slot = &ring->Hdr->Slots[ring->Slot];
+
+	if (frameIntact(ring) != 0)
+	{
+		readerOverrun(ring);
+		return -1;
+	}
+	ring->Cursor = ring->Next;
+	slot->Frames++;
+	__atomic_store_n(&slot->Cursor, ring->Cursor, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcShmRead
+ *
+ * @brief   copies the next intact frame
+ *
+ * @param   ring - ring of a reader
+ * @param   buf - RPC_SHM_MAX_FRAME bytes
+ * @param   timeoutMs - time to wait for a frame, 0 not to wait
+ *
+ * @return  frame length, 0 without a frame
+ */
+int32_t rpcShmRead(rpcShm_t *ring, uint8_t *buf, uint32_t timeoutMs)
+{
+	const uint8_t *frame;
+	int32_t len;
+
+	do
+	{
+		len = rpcShmReadBegin(ring, &frame, timeoutMs);
+		if (len == 0)
+		{
+			return 0;
+		}
+		memcpy(buf, frame, len);
+	} while (rpcShmReadEnd(ring) != 0);
+
+	return len;
+}
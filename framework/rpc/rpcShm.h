@@ -0,0 +1,115 @@
+/*
+ * rpcShm.h
+ *
+ * This module contains a shared memory ring broadcasting the MT frames
+ * of one writer to the readers of other processes, without a system
+ * call or a copy per reader.
+ *
+ * The writer never waits for the readers: a reader too slow loses the
+ * frames overwritten under it and resumes at the newest frame. Each
+ * reader has its cursor in the shared memory, so the writer sees how
+ * far behind the slowest one is. A reader without frames sleeps on a
+ * futex the writer wakes only if somebody sleeps.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef RPCSHM_H
+#define RPCSHM_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// frame bytes the ring holds, a power of 2
+#define RPC_SHM_DEFAULT_SIZE       (1024 * 1024)
+
+#define RPC_SHM_MAX_READERS        (32)
+
+// largest frame of the ring
+#define RPC_SHM_MAX_FRAME          (256)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// reader slot, alone on its cache line
+typedef struct
+{
+	volatile uint32_t InUse;
+	volatile pid_t Pid;
+	volatile uint64_t Cursor;  // ring position of the next frame to read
+	volatile uint64_t Frames;
+	volatile uint64_t Overruns; // times frames were overwritten unread
+	uint8_t Pad[32];
+} rpcShmSlot_t;
+
+// start of the shared memory, the frames follow
+typedef struct
+{
+	uint32_t Magic;
+	uint32_t Size;             // frame bytes, a power of 2
+	uint32_t DataOffset;
+	uint8_t Pad0[52];
+
+	// positions grow forever, the offset in the ring is pos & (Size - 1)
+	volatile uint64_t Head;    // end of the frames written
+	volatile uint64_t Reserve; // end of the frame being written
+	volatile uint64_t Frames;
+	uint8_t Pad1[40];
+
+	volatile uint32_t Seq;     // futex, moves on every frame
+	volatile uint32_t Waiters; // readers sleeping on Seq
+	uint8_t Pad2[56];
+
+	rpcShmSlot_t Slots[RPC_SHM_MAX_READERS];
+} rpcShmHdr_t;
+
+typedef struct
+{
+	char Name[64];
+	rpcShmHdr_t *Hdr;
+	uint8_t *Data;
+	size_t MapSize;
+	uint8_t Writer;
+	int32_t Slot;              // reader slot, -1 for the writer
+	uint64_t Cursor;           // reader position
+	uint64_t Next;             // reader position after the frame in use
+} rpcShm_t;
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+int32_t rpcShmCreate(rpcShm_t *ring, const char *name, uint32_t size);
+int32_t rpcShmAttach(rpcShm_t *ring, const char *name);
+void rpcShmClose(rpcShm_t *ring);
+
+void rpcShmWrite(rpcShm_t *ring, const uint8_t *frame, uint32_t len);
+uint64_t rpcShmLag(rpcShm_t *ring);
+uint32_t rpcShmReaders(rpcShm_t *ring);
+
+int32_t rpcShmReadBegin(rpcShm_t *ring, const uint8_t **frame,
+        uint32_t timeoutMs);
+int32_t rpcShmReadEnd(rpcShm_t *ring);
+int32_t rpcShmRead(rpcShm_t *ring, uint8_t *buf, uint32_t timeoutMs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPCSHM_H */
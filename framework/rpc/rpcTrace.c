@@ -0,0 +1,662 @@
+/*
+ * rpcTrace.c
+ *
+ * This module contains the frame latency tracer for the RPC RX and TX
+ * pipelines of the ZigBee Network Processor (ZNP) Host Interface.
+ *
+ * Every frame gets a record in a ring buffer holding a monotonic time
+ * stamp per pipeline stage. A record is only written by the thread that
+ * currently owns the frame, so stamping is a plain store. When a frame
+ * leaves the pipeline the stage to stage deltas are folded into
+ * log-linear histograms.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rpcTrace.h"
+#include "rpc.h"
+#include "hostConsole.h"
+#include "dbgPrint.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// 8 linear sub buckets per power of 2, covers the full 64 bit range
+#define TRACE_SUB_BITS             (3)
+#define TRACE_SUB_BUCKETS          (1 << TRACE_SUB_BITS)
+#define TRACE_HIST_BUCKETS         ((64 - TRACE_SUB_BITS + 1) * TRACE_SUB_BUCKETS)
+
+#define TRACE_RECORD_FREE          (0)
+#define TRACE_RECORD_OPEN          (1)
+#define TRACE_RECORD_DONE          (2)
+
+// one histogram per stage plus an end to end one per direction
+#define TRACE_HIST_MAX             (RPC_TRACE_STAGE_MAX + RPC_TRACE_DIR_MAX)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+	uint32_t seq;
+	uint8_t state;
+	uint8_t dir;
+	uint8_t cmd0;
+	uint8_t cmd1;
+	uint8_t len;
+	uint64_t ts[RPC_TRACE_STAGE_MAX];
+} rpcTraceRecord_t;
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t sumNs;
+	uint64_t minNs;
+	uint64_t maxNs;
+	uint64_t buckets[TRACE_HIST_BUCKETS];
+} rpcTraceHist_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static volatile uint8_t traceEnabled;
+static uint32_t traceSeq;
+static rpcTraceRecord_t traceRecords[RPC_TRACE_RECORDS];
+
+static rpcTraceHist_t traceHists[TRACE_HIST_MAX];
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *stageName[RPC_TRACE_STAGE_MAX] =
+{ "rx_first_byte", "rx_complete", "rx_enqueued", "rx_dequeued",
+        "rx_cb_start", "rx_cb_end", "tx_entry", "tx_sem_acquired",
+        "tx_write_done", "tx_srsp_received" };
+
+static const char *dirName[RPC_TRACE_DIR_MAX] =
+{ "rx", "tx" };
+
+// first and last stage of each direction
+static const uint8_t dirFirst[RPC_TRACE_DIR_MAX] =
+{ RPC_TRACE_RX_FIRST_BYTE, RPC_TRACE_TX_ENTRY };
+static const uint8_t dirLast[RPC_TRACE_DIR_MAX] =
+{ RPC_TRACE_RX_CB_END, RPC_TRACE_TX_SRSP_RECEIVED };
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      getRecord
+ *
+ * @brief   returns the record of an open frame, NULL if tracing was
+ *          off when the frame started or the record has been reused
+ *
+ * @param   id - trace id of the frame
+ *
+ * @return  record
+ */
+static rpcTraceRecord_t *getRecord(rpcTraceId_t id)
+{
+	rpcTraceRecord_t *rec;
+
+	if (id == RPC_TRACE_INVALID)
+	{
+		return NULL;
+	}
+
+	rec = &traceRecords[id & (RPC_TRACE_RECORDS - 1)];
+	if ((rec->seq != id) || (rec->state != TRACE_RECORD_OPEN))
+	{
+		return NULL;
+	}
+
+	return rec;
+}
+
+/*********************************************************************
+ * @fn      histBucket
+ *
+ * @brief   maps a sample to its log-linear bucket
+ *
+ * @param   ns - sample in nano seconds
+ *
+ * @return  bucket index
+ */
+static uint32_t histBucket(uint64_t ns)
+{
+	uint32_t msb;
+
+	if (ns < TRACE_SUB_BUCKETS)
+	{
+		return (uint32_t) ns;
+	}
+
+	msb = 63 - __builtin_clzll(ns);
+	return ((msb - TRACE_SUB_BITS + 1) << TRACE_SUB_BITS)
+	        + ((ns >> (msb - TRACE_SUB_BITS)) & (TRACE_SUB_BUCKETS - 1));
+}
+
+/*********************************************************************
+ * @fn      histBucketValue
+ *
+ * @brief   lowest sample value mapping to a bucket
+ *
+ * @param   idx - bucket index
+ *
+ * @return  value in nano seconds
+ */
+static uint64_t histBucketValue(uint32_t idx)
+{
+	uint32_t msb;
+
+	if (idx < TRACE_SUB_BUCKETS)
+	{
+		return idx;
+	}
+
+	msb = (idx >> TRACE_SUB_BITS) + TRACE_SUB_BITS - 1;
+	return ((uint64_t) (TRACE_SUB_BUCKETS + (idx & (TRACE_SUB_BUCKETS - 1))))
+	        << (msb - TRACE_SUB_BITS);
+}
+
+/*********************************************************************
+ * @fn      histAdd
+ *
+ * @brief   adds a sample to a histogram, called with traceLock held
+ *
+ * @return  -
+ */
+static void histAdd(rpcTraceHist_t *hist, uint64_t ns)
+{
+	if ((hist->count == 0) || (ns < hist->minNs))
+	{
+		hist->minNs = ns;
+	}
+	if (ns > hist->maxNs)
+	{
+		hist->maxNs = ns;
+	}
+	hist->count++;
+	hist->sumNs += ns;
+	hist->buckets[histBucket(ns)]++;
+}
+
+/*********************************************************************
+ * @fn      histStats
+ *
+ * @brief   summarises a histogram
+ *
+ * @return  -
+ */
+static void histStats(rpcTraceHist_t *hist, rpcTraceStats_t *stats)
+{
+	static const uint32_t permille[4] =
+	{ 500, 900, 990, 999 };
+	uint64_t *out[4] =
+	{ &stats->p50Ns, &stats->p90Ns, &stats->p99Ns, &stats->p999Ns };
+	uint64_t seen = 0;
+	uint32_t idx, p = 0;
+
+	memset(stats, 0, sizeof(rpcTraceStats_t));
+
+	pthread_mutex_lock(&traceLock);
+	stats->count = hist->count;
+	if (hist->count > 0)
+	{
+		stats->minNs = hist->minNs;
+		stats->maxNs = hist->maxNs;
+		stats->meanNs = hist->sumNs / hist->count;
+
+		for (idx = 0; (idx < TRACE_HIST_BUCKETS) && (p < 4); idx++)
+		{
+			seen += hist->buckets[idx];
+			while ((p < 4) && (seen * 1000 >= hist->count * permille[p])
+			        && (seen > 0))
+			{
+				*out[p] = histBucketValue(idx);
+				if (*out[p] > stats->maxNs)
+				{
+					*out[p] = stats->maxNs;
+				}
+				p++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&traceLock);
+}
+
+/*********************************************************************
+ * @fn      frameType
+ *
+ * @brief   returns the command type of a frame as text
+ *
+ * @return  type name
+ */
+static const char *frameType(uint8_t cmd0)
+{
+	switch (cmd0 & MT_RPC_CMD_TYPE_MASK)
+	{
+	case MT_RPC_CMD_SREQ:
+		return "SREQ";
+	case MT_RPC_CMD_SRSP:
+		return "SRSP";
+	case MT_RPC_CMD_AREQ:
+		return "AREQ";
+	default:
+		return "POLL";
+	}
+}
+
+/*********************************************************************
+ * @fn      printStats
+ *
+ * @brief   prints one line of the statistics table
+ *
+ * @return  -
+ */
+static void printStats(const char *name, rpcTraceStats_t *stats)
+{
+	consolePrint("%-18s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+	        (unsigned long long) stats->count, stats->meanNs / 1000.0,
+	        stats->p50Ns / 1000.0, stats->p99Ns / 1000.0,
+	        stats->p999Ns / 1000.0, stats->maxNs / 1000.0);
+}
+
+/*********************************************************************
+ * API FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      rpcTraceEnable
+ *
+ * @brief   switches tracing of new frames on or off
+ *
+ * @param   enable - 1 to trace frames
+ *
+ * @return  -
+ */
+void rpcTraceEnable(uint8_t enable)
+{
+	traceEnabled = enable;
+}
+
+/*********************************************************************
+ * @fn      rpcTraceIsEnabled
+ *
+ * @brief   returns whether new frames are traced
+ *
+ * @param   -
+ *
+ * @return  1 if enabled
+ */
+uint8_t rpcTraceIsEnabled(void)
+{
+	return traceEnabled;
+}
+
+/*********************************************************************
+ * @fn      rpcTraceReset
+ *
+ * @brief   clears the latency histograms
+ *
+ * @param   -
+ *
+ * @return  -
+ */
+void rpcTraceReset(void)
+{
+	pthread_mutex_lock(&traceLock);
+	memset(traceHists, 0, sizeof(traceHists));
+	pthread_mutex_unlock(&traceLock);
+}
+
+/*********************************************************************
+ * @fn      rpcTraceNowNs
+ *
+ * @brief   monotonic time stamp used by the tracer
+ *
+ * @param   -
+ *
+ * @return  time in nano seconds
+ */
+uint64_t rpcTraceNowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/*********************************************************************
+ * @fn      rpcTraceBegin
+ *
+ * @brief   opens a record for a new frame and stamps the first stage
+ *          of its direction
+ *
+ * @param   dir - RPC_TRACE_DIR_RX or RPC_TRACE_DIR_TX
+ *
+ * @return  trace id, RPC_TRACE_INVALID if tracing is disabled
+ */
+rpcTraceId_t rpcTraceBegin(rpcTraceDir_t dir)
+{
+	rpcTraceRecord_t *rec;
+	rpcTraceId_t id;
+
+	if (!traceEnabled)
+	{
+		return RPC_TRACE_INVALID;
+	}
+
+	id = __atomic_fetch_add(&traceSeq, 1, __ATOMIC_RELAXED);
+	if (id == RPC_TRACE_INVALID)
+	{
+		id = __atomic_fetch_add(&traceSeq, 1, __ATOMIC_RELAXED);
+	}
+
+	rec = &traceRecords[id & (RPC_TRACE_RECORDS - 1)];
+	rec->state = TRACE_RECORD_FREE;
+	__atomic_store_n(&rec->seq, id, __ATOMIC_RELEASE);
+	memset(rec->ts, 0, sizeof(rec->ts));
+	rec->dir = dir;
+	rec->cmd0 = 0;
+	rec->cmd1 = 0;
+	rec->len = 0;
+	rec->ts[dirFirst[dir]] = rpcTraceNowNs();
+	__atomic_store_n(&rec->state, TRACE_RECORD_OPEN, __ATOMIC_RELEASE);
+
+	return id;
+}
+
+/*********************************************************************
+ * @fn      rpcTraceStamp
+ *
+ * @brief   records the time a frame reached a stage
+ *
+ * @param   id - trace id of the frame
+ * @param   stage - stage reached
+ *
+ * @return  -
+ */
+void rpcTraceStamp(rpcTraceId_t id, rpcTraceStage_t stage)
+{
+	rpcTraceRecord_t *rec = getRecord(id);
+
+	if (rec != NULL)
+	{
+		rec->ts[stage] = rpcTraceNowNs();
+	}
+}
+
+/*********************************************************************
+ * @fn      rpcTraceFrame
+ *
+ * @brief   attaches the frame header to a record
+ *
+ * @param   id - trace id of the frame
+ * @param   cmd0 - Cmd0 of the frame
+ * @param   cmd1 - Cmd1 of the frame
+ * @param   len - payload length
+ *
+ * @return  -
+ */
+void rpcTraceFrame(rpcTraceId_t id, uint8_t cmd0, uint8_t cmd1, uint8_t len)
+{
+	rpcTraceRecord_t *rec = getRecord(id);
+
+	if (rec != NULL)
+	{
+		rec->cmd0 = cmd0;
+		rec->cmd1 = cmd1;
+		rec->len = len;
+	}
+}
+
+/*********************************************************************
+ * @fn      rpcTraceEnd
+ *
+ * @brief   closes the record of a frame and adds its stage latencies
+ *          to the histograms
+ *
+ * @param   id - trace id of the frame
+ *
+ * @return  -
+ */
+void rpcTraceEnd(rpcTraceId_t id)
+{
+	rpcTraceRecord_t *rec = getRecord(id);
+	uint32_t stage, prev;
+
+	if (rec == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&traceLock);
+	prev = dirFirst[rec->dir];
+	for (stage = prev + 1; stage <= dirLast[rec->dir]; stage++)
+	{
+		if (rec->ts[stage] != 0)
+		{
+			histAdd(&traceHists[stage], rec->ts[stage] - rec->ts[prev]);
+			prev = stage;
+		}
+	}
+	histAdd(&traceHists[RPC_TRACE_STAGE_MAX + rec->dir],
+	        rec->ts[prev] - rec->ts[dirFirst[rec->dir]]);
+	pthread_mutex_unlock(&traceLock);
+
+	__atomic_store_n(&rec->state, TRACE_RECORD_DONE, __ATOMIC_RELEASE);
+}
+
+/*********************************************************************
+ * @fn      rpcTraceDrop
+ *
+ * @brief   discards the record of a frame that left the pipeline early
+ *          (FCS error, unexpected SRSP)
+ *
+ * @param   id - trace id of the frame
+ *
+ * @return  -
+ */
+void rpcTraceDrop(rpcTraceId_t id)
+{
+	rpcTraceRecord_t *rec = getRecord(id);
+
+	if (rec != NULL)
+	{
+		__atomic_store_n(&rec->state, TRACE_RECORD_FREE, __ATOMIC_RELEASE);
+	}
+}
+
+/*********************************************************************
+ * @fn      rpcTraceStageName
+ *
+ * @brief   returns the name of a stage
+ *
+ * @param   stage - stage
+ *
+ * @return  name
+ */
+const char *rpcTraceStageName(rpcTraceStage_t stage)
+{
+	if (stage >= RPC_TRACE_STAGE_MAX)
+	{
+		return "unknown";
+	}
+
+	return stageName[stage];
+}
+
+/*********************************************************************
+ * @fn      rpcTraceGetStats
+ *
+ * @brief   latency distribution of a stage, measured from the previous
+ *          stage the frame passed. The first stage of a direction has
+ *          no samples, see rpcTraceGetTotalStats().
+ *
+ * @param   stage - stage
+ * @param   stats - filled with the distribution
+ *
+ * @return  0 on success, -1 for an invalid stage
+ */
+int32_t rpcTraceGetStats(rpcTraceStage_t stage, rpcTraceStats_t *stats)
+{
+	if (stage >= RPC_TRACE_STAGE_MAX)
+	{
+		return -1;
+	}
+
+	histStats(&traceHists[stage], stats);
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcTraceGetTotalStats
+ *
+ * @brief   end to end latency distribution of a direction
+ *
+ * @param   dir - direction
+ * @param   stats - filled with the distribution
+ *
+ * @return  0 on success, -1 for an invalid direction
+ */
+int32_t rpcTraceGetTotalStats(rpcTraceDir_t dir, rpcTraceStats_t *stats)
+{
+	if (dir >= RPC_TRACE_DIR_MAX)
+	{
+		return -1;
+	}
+
+	histStats(&traceHists[RPC_TRACE_STAGE_MAX + dir], stats);
+	return 0;
+}
+
+/*********************************************************************
+ * @fn      rpcTracePrintStats
+ *
+ * @brief   prints the per stage latencies in micro seconds
+ *
+ * @param   -
+ *
+ * @return  -
+ */
+void rpcTracePrintStats(void)
+{
+	rpcTraceStats_t stats;
+	uint32_t dir, stage;
+
+	consolePrint("%-18s %8s %10s %10s %10s %10s %10s\n", "stage [us]",
+	        "count", "mean", "p50", "p99", "p99.9", "max");
+
+	for (dir = 0; dir < RPC_TRACE_DIR_MAX; dir++)
+	{
+		for (stage = dirFirst[dir] + 1; stage <= dirLast[dir]; stage++)
+		{
+			rpcTraceGetStats(stage, &stats);
+			printStats(stageName[stage], &stats);
+		}
+
+		rpcTraceGetTotalStats(dir, &stats);
+		printStats(dir == RPC_TRACE_DIR_RX ? "rx_total" : "tx_total",
+		        &stats);
+	}
+}
+
+/*********************************************************************
+ * @fn      rpcTraceDump
+ *
+ * @brief   writes the completed records in the Chrome trace event
+ *          format (chrome://tracing, Perfetto). Each frame is an async
+ *          slice with one nested slice per stage.
+ *
+ * @param   path - output file
+ *
+ * @return  number of frames written, -1 on error
+ */
+int32_t rpcTraceDump(const char *path)
+{
+	rpcTraceRecord_t rec;
+	uint32_t last, seq, stage, prev;
+	int32_t frames = 0;
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (fp == NULL)
+	{
+		dbg_print(PRINT_LEVEL_WARNING, "rpcTraceDump: %s open failed - %s\n",
+		        path, strerror(errno));
+		return -1;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	// oldest to newest
+	last = __atomic_load_n(&traceSeq, __ATOMIC_RELAXED);
+	for (seq = last - RPC_TRACE_RECORDS; seq != last; seq++)
+	{
+		rpcTraceRecord_t *slot = &traceRecords[seq & (RPC_TRACE_RECORDS - 1)];
+
+		if ((__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE)
+		        != TRACE_RECORD_DONE) || (slot->seq != seq))
+		{
+			continue;
+		}
+		memcpy(&rec, slot, sizeof(rec));
+		if ((__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq)
+		        || (rec.state != TRACE_RECORD_DONE))
+		{
+			// reused while copying
+			continue;
+		}
+
+		prev = dirFirst[rec.dir];
+		fprintf(fp, "%s{\"name\":\"%s %02X:%02X\",\"cat\":\"%s\",\"ph\":\"b\","
+		        "\"id\":%u,\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+		        "\"args\":{\"cmd0\":%u,\"cmd1\":%u,\"len\":%u}}",
+		        frames ? ",\n" : "",
+		        frameType(rec.cmd0), rec.cmd0, rec.cmd1, dirName[rec.dir],
+		        seq, rec.dir + 1, rec.ts[prev] / 1000.0, rec.cmd0, rec.cmd1,
+		        rec.len);
+
+		for (stage = prev + 1; stage <= dirLast[rec.dir]; stage++)
+		{
+			if (rec.ts[stage] == 0)
+			{
+				continue;
+			}
+
+			fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\","
+			        "\"id\":%u,\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+			        stageName[stage], dirName[rec.dir], seq, rec.dir + 1,
+			        rec.ts[prev] / 1000.0);
+			fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\","
+			        "\"id\":%u,\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+			        stageName[stage], dirName[rec.dir], seq, rec.dir + 1,
+			        rec.ts[stage] / 1000.0);
+			prev = stage;
+		}
+
+		fprintf(fp, ",\n{\"name\":\"%s %02X:%02X\",\"cat\":\"%s\",\"ph\":\"e\","
+		        "\"id\":%u,\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+		        frameType(rec.cmd0), rec.cmd0, rec.cmd1, dirName[rec.dir],
+		        seq, rec.dir + 1, rec.ts[prev] / 1000.0);
+		frames++;
+	}
+
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+
+	return frames;
+}
@@ -0,0 +1,127 @@
+/*
+ * rpcTrace.h
+ *
+ * This module contains the frame latency tracer for the RPC RX and TX
+ * pipelines of the ZigBee Network Processor (ZNP) Host Interface.
+ *
+ * Copyright 2016, Han Pengfei. All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ *
+ */
+
+#ifndef RPCTRACE_H
+#define RPCTRACE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// number of frame records kept, must be a power of 2
+#define RPC_TRACE_RECORDS          (4096)
+
+// id returned when tracing is disabled
+#define RPC_TRACE_INVALID          (0xFFFFFFFF)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef uint32_t rpcTraceId_t;
+
+typedef enum
+{
+	RPC_TRACE_DIR_RX,
+	RPC_TRACE_DIR_TX,
+	RPC_TRACE_DIR_MAX
+} rpcTraceDir_t;
+
+// pipeline stages, in the order a frame passes them
+typedef enum
+{
+	RPC_TRACE_RX_FIRST_BYTE,     // SOF read from the transport
+	RPC_TRACE_RX_COMPLETE,       // whole frame read and FCS checked
+	RPC_TRACE_RX_ENQUEUED,       // added to the RPC queue
+	RPC_TRACE_RX_DEQUEUED,       // taken from the queue by the app thread
+	RPC_TRACE_RX_CB_START,       // MT dispatch started
+	RPC_TRACE_RX_CB_END,         // MT dispatch and callback returned
+
+	RPC_TRACE_TX_ENTRY,          // rpcSendFrame() called
+	RPC_TRACE_TX_SEM_ACQUIRED,   // RPC semaphore taken
+	RPC_TRACE_TX_WRITE_DONE,     // frame written to the transport
+	RPC_TRACE_TX_SRSP_RECEIVED,  // SRSP signalled by the RPC thread
+
+	RPC_TRACE_STAGE_MAX
+} rpcTraceStage_t;
+
+// latency distribution in nano seconds
+typedef struct
+{
+	uint64_t count;
+	uint64_t minNs;
+	uint64_t maxNs;
+	uint64_t meanNs;
+	uint64_t p50Ns;
+	uint64_t p90Ns;
+	uint64_t p99Ns;
+	uint64_t p999Ns;
+} rpcTraceStats_t;
+
+/*********************************************************************
+ * MACROS
+ */
+
+// instrumentation hooks, compiled out unless RPC_TRACE is defined.
+// RX frames carry their trace id behind the frame through the RPC
+// queue, RPC_TRACE_TAG_LEN is the size of that trailer.
+#ifdef RPC_TRACE
+#define RPC_TRACE_TAG_LEN                 (sizeof(rpcTraceId_t))
+#define RPC_TRACE_BEGIN(id, dir)          rpcTraceId_t id = rpcTraceBegin(dir)
+#define RPC_TRACE_STAMP(id, stage)        rpcTraceStamp((id), (stage))
+#define RPC_TRACE_FRAME(id, c0, c1, len)  rpcTraceFrame((id), (c0), (c1), (len))
+#define RPC_TRACE_END(id)                 rpcTraceEnd(id)
+#define RPC_TRACE_DROP(id)                rpcTraceDrop(id)
+#else
+#define RPC_TRACE_TAG_LEN                 (0)
+#define RPC_TRACE_BEGIN(id, dir)
+#define RPC_TRACE_STAMP(id, stage)
+#define RPC_TRACE_FRAME(id, c0, c1, len)
+#define RPC_TRACE_END(id)
+#define RPC_TRACE_DROP(id)
+#endif
+
+/*********************************************************************
+ * GLOBAL FUNCTIONS
+ */
+
+void rpcTraceEnable(uint8_t enable);
+uint8_t rpcTraceIsEnabled(void);
+void rpcTraceReset(void);
+
+uint64_t rpcTraceNowNs(void);
+rpcTraceId_t rpcTraceBegin(rpcTraceDir_t dir);
+void rpcTraceStamp(rpcTraceId_t id, rpcTraceStage_t stage);
+void rpcTraceFrame(rpcTraceId_t id, uint8_t cmd0, uint8_t cmd1, uint8_t len);
+void rpcTraceEnd(rpcTraceId_t id);
+void rpcTraceDrop(rpcTraceId_t id);
+
+const char *rpcTraceStageName(rpcTraceStage_t stage);
+int32_t rpcTraceGetStats(rpcTraceStage_t stage, rpcTraceStats_t *stats);
+int32_t rpcTraceGetTotalStats(rpcTraceDir_t dir, rpcTraceStats_t *stats);
+void rpcTracePrintStats(void);
+int32_t rpcTraceDump(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPCTRACE_H */